@@ -149,6 +149,13 @@ iomap_write_end(struct inode *inode, loff_t pos, unsigned len,
 	return ret;
 }
 
+/*
+ * Large writes are copied a page at a time, but there's no need to walk the
+ * user buffer or look at the dirty limits that often.  Fault in this much of
+ * the source buffer at once and only throttle once for each run of pages.
+ */
+#define IOMAP_WRITE_RUN		(16 * PAGE_SIZE)
+
 static loff_t
 iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		struct iomap *iomap)
@@ -156,6 +163,8 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 	struct iov_iter *i = data;
 	long status = 0;
 	ssize_t written = 0;
+	size_t faulted = 0;	/* Bytes of the source known to be present */
+	size_t dirtied = 0;	/* Bytes dirtied since we last throttled */
 	unsigned int flags = AOP_FLAG_NOFS;
 
 	do {
@@ -180,10 +189,23 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 		 * Not only is this an optimisation, but it is also required
 		 * to check that the address is actually valid, when atomic
 		 * usercopies are used, below.
+		 *
+		 * Try to fault in a whole run of pages; if that fails, fall
+		 * back to just this page so that we still make progress up
+		 * to the first bad address.
 		 */
-		if (unlikely(iov_iter_fault_in_readable(i, bytes))) {
-			status = -EFAULT;
-			break;
+		if (bytes > faulted) {
+			faulted = min_t(size_t, IOMAP_WRITE_RUN,
+					min_t(loff_t, iov_iter_count(i), length));
+			if (faulted <= bytes ||
+			    iov_iter_fault_in_readable(i, faulted)) {
+				faulted = bytes;
+				if (unlikely(iov_iter_fault_in_readable(i,
+								bytes))) {
+					status = -EFAULT;
+					break;
+				}
+			}
 		}
 
 		status = iomap_write_begin(inode, pos, bytes, flags, &page,
@@ -217,15 +239,23 @@ iomap_write_actor(struct inode *inode, loff_t pos, loff_t length, void *data,
 			 */
 			bytes = min_t(unsigned long, PAGE_SIZE - offset,
 						iov_iter_single_seg_count(i));
+			faulted = 0;
 			goto again;
 		}
 		pos += copied;
 		written += copied;
 		length -= copied;
+		faulted -= min(faulted, copied);
 
-		balance_dirty_pages_ratelimited(inode->i_mapping);
+		dirtied += copied;
+		if (dirtied >= IOMAP_WRITE_RUN) {
+			balance_dirty_pages_ratelimited(inode->i_mapping);
+			dirtied = 0;
+		}
 	} while (iov_iter_count(i) && length);
 
+	if (dirtied)
+		balance_dirty_pages_ratelimited(inode->i_mapping);
 	return written ? written : status;
 }
 
@@ -682,6 +712,8 @@ EXPORT_SYMBOL_GPL(iomap_seek_data);
  * Private flags for iomap_dio, must not overlap with the public ones in
  * iomap.h:
  */
+#define IOMAP_DIO_WRITE_FUA	(1 << 28)
+#define IOMAP_DIO_NEED_SYNC	(1 << 29)
 #define IOMAP_DIO_WRITE		(1 << 30)
 #define IOMAP_DIO_DIRTY		(1 << 31)
 
@@ -733,6 +765,15 @@ static ssize_t iomap_dio_complete(struct iomap_dio *dio)
 	}
 
 	inode_dio_end(file_inode(iocb->ki_filp));
+
+	/*
+	 * If this is a DSYNC write, make sure we push it to stable storage now
+	 * that we've written data.  Writes that went out entirely as FUA to
+	 * already stable extents don't need this.
+	 */
+	if (ret > 0 && (dio->flags & IOMAP_DIO_NEED_SYNC))
+		ret = generic_write_sync(iocb, ret);
+
 	kfree(dio);
 
 	return ret;
@@ -742,13 +783,8 @@ static void iomap_dio_complete_work(struct work_struct *work)
 {
 	struct iomap_dio *dio = container_of(work, struct iomap_dio, aio.work);
 	struct kiocb *iocb = dio->iocb;
-	bool is_write = (dio->flags & IOMAP_DIO_WRITE);
-	ssize_t ret;
 
-	ret = iomap_dio_complete(dio);
-	if (is_write && ret > 0)
-		ret = generic_write_sync(iocb, ret);
-	iocb->ki_complete(iocb, ret, 0);
+	iocb->ki_complete(iocb, iomap_dio_complete(dio), 0);
 }
 
 /*
@@ -831,6 +867,7 @@ iomap_dio_actor(struct inode *inode, loff_t pos, loff_t length,
 	struct iov_iter iter;
 	struct bio *bio;
 	bool need_zeroout = false;
+	bool use_fua = false;
 	int nr_pages, ret;
 
 	if ((pos | length | align) & ((1 << blkbits) - 1))
@@ -853,14 +890,31 @@ iomap_dio_actor(struct inode *inode, loff_t pos, loff_t length,
 	case IOMAP_MAPPED:
 		if (iomap->flags & IOMAP_F_SHARED)
 			dio->flags |= IOMAP_DIO_COW;
-		if (iomap->flags & IOMAP_F_NEW)
+		if (iomap->flags & IOMAP_F_NEW) {
 			need_zeroout = true;
+		} else if ((dio->flags & IOMAP_DIO_WRITE_FUA) &&
+			   !(iomap->flags & (IOMAP_F_SHARED | IOMAP_F_DIRTY)) &&
+			   blk_queue_fua(bdev_get_queue(iomap->bdev))) {
+			/*
+			 * Overwriting stable, written blocks with no metadata
+			 * left to commit: a FUA write makes the data durable
+			 * on its own.
+			 */
+			use_fua = true;
+		}
 		break;
 	default:
 		WARN_ON_ONCE(1);
 		return -EIO;
 	}
 
+	/*
+	 * A single extent that needs a metadata update or cache flush means
+	 * the whole write has to go through generic_write_sync at completion.
+	 */
+	if (!use_fua)
+		dio->flags &= ~IOMAP_DIO_WRITE_FUA;
+
 	/*
 	 * Operate on a partial iter trimmed to the extent we were called for.
 	 * We'll update the iter in the dio once we're done with this extent.
@@ -898,7 +952,8 @@ iomap_dio_actor(struct inode *inode, loff_t pos, loff_t length,
 		}
 
 		if (dio->flags & IOMAP_DIO_WRITE) {
-			bio_set_op_attrs(bio, REQ_OP_WRITE, REQ_SYNC | REQ_IDLE);
+			bio_set_op_attrs(bio, REQ_OP_WRITE, REQ_SYNC | REQ_IDLE |
+					(use_fua ? REQ_FUA : 0));
 			task_io_account_write(bio->bi_iter.bi_size);
 		} else {
 			bio_set_op_attrs(bio, REQ_OP_READ, 0);
@@ -974,6 +1029,18 @@ iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 	} else {
 		dio->flags |= IOMAP_DIO_WRITE;
 		flags |= IOMAP_WRITE;
+
+		/*
+		 * For O_DSYNC writes that don't extend the file, optimistically
+		 * issue the data with FUA.  The actor clears WRITE_FUA for any
+		 * extent that can't use it, and then we fall back to a normal
+		 * sync at completion.
+		 */
+		if (iocb->ki_flags & IOCB_DSYNC) {
+			dio->flags |= IOMAP_DIO_NEED_SYNC;
+			if (!(iocb->ki_flags & IOCB_SYNC) && end < dio->i_size)
+				dio->flags |= IOMAP_DIO_WRITE_FUA;
+		}
 	}
 
 	if (iocb->ki_flags & IOCB_NOWAIT) {
@@ -1015,6 +1082,14 @@ iomap_dio_rw(struct kiocb *iocb, struct iov_iter *iter,
 	if (ret < 0)
 		iomap_dio_set_error(dio, ret);
 
+	/*
+	 * If every bio went out as FUA, the data is already stable and there
+	 * is nothing to commit, so skip the cache flush and log force.  This
+	 * is safe as completion can't run until we drop our reference below.
+	 */
+	if (dio->flags & IOMAP_DIO_WRITE_FUA)
+		dio->flags &= ~IOMAP_DIO_NEED_SYNC;
+
 	if (ret >= 0 && iov_iter_rw(iter) == WRITE && !is_sync_kiocb(iocb) &&
 			!inode->i_sb->s_dio_done_wq) {
 		ret = sb_init_dio_done_wq(inode->i_sb);
@@ -26,14 +26,14 @@
 #include "xfs_message.h"
 
 void *
-kmem_alloc(size_t size, xfs_km_flags_t flags)
+kmem_alloc_node(size_t size, xfs_km_flags_t flags, int node)
 {
 	int	retries = 0;
 	gfp_t	lflags = kmem_flags_convert(flags);
 	void	*ptr;
 
 	do {
-		ptr = kmalloc(size, lflags);
+		ptr = kmalloc_node(size, lflags, node);
 		if (ptr || (flags & (KM_MAYFAIL|KM_NOSLEEP)))
 			return ptr;
 		if (!(++retries % 100))
@@ -46,13 +46,13 @@ kmem_alloc(size_t size, xfs_km_flags_t flags)
 }
 
 void *
-kmem_zalloc_large(size_t size, xfs_km_flags_t flags)
+kmem_alloc_large(size_t size, xfs_km_flags_t flags)
 {
 	unsigned nofs_flag = 0;
 	void	*ptr;
 	gfp_t	lflags;
 
-	ptr = kmem_zalloc(size, flags | KM_MAYFAIL);
+	ptr = kmem_alloc(size, flags | KM_MAYFAIL);
 	if (ptr)
 		return ptr;
 
@@ -67,7 +67,7 @@ kmem_zalloc_large(size_t size, xfs_km_flags_t flags)
 		nofs_flag = memalloc_nofs_save();
 
 	lflags = kmem_flags_convert(flags);
-	ptr = __vmalloc(size, lflags | __GFP_ZERO, PAGE_KERNEL);
+	ptr = __vmalloc(size, lflags, PAGE_KERNEL);
 
 	if (flags & KM_NOFS)
 		memalloc_nofs_restore(nofs_flag);
@@ -96,14 +96,14 @@ kmem_realloc(const void *old, size_t newsize, xfs_km_flags_t flags)
 }
 
 void *
-kmem_zone_alloc(kmem_zone_t *zone, xfs_km_flags_t flags)
+kmem_zone_alloc_node(kmem_zone_t *zone, xfs_km_flags_t flags, int node)
 {
 	int	retries = 0;
 	gfp_t	lflags = kmem_flags_convert(flags);
 	void	*ptr;
 
 	do {
-		ptr = kmem_cache_alloc(zone, lflags);
+		ptr = kmem_cache_alloc_node(zone, lflags, node);
 		if (ptr || (flags & (KM_MAYFAIL|KM_NOSLEEP)))
 			return ptr;
 		if (!(++retries % 100))
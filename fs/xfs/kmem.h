@@ -22,6 +22,7 @@
 #include <linux/sched.h>
 #include <linux/mm.h>
 #include <linux/vmalloc.h>
+#include <linux/mempool.h>
 
 /*
  * General memory allocation interfaces
@@ -70,14 +71,19 @@ kmem_flags_convert(xfs_km_flags_t flags)
 	return lflags;
 }
 
-extern void *kmem_alloc(size_t, xfs_km_flags_t);
-extern void *kmem_zalloc_large(size_t size, xfs_km_flags_t);
+extern void *kmem_alloc_node(size_t, xfs_km_flags_t, int);
+extern void *kmem_alloc_large(size_t size, xfs_km_flags_t);
 extern void *kmem_realloc(const void *, size_t, xfs_km_flags_t);
 static inline void  kmem_free(const void *ptr)
 {
 	kvfree(ptr);
 }
 
+static inline void *
+kmem_alloc(size_t size, xfs_km_flags_t flags)
+{
+	return kmem_alloc_node(size, flags, NUMA_NO_NODE);
+}
 
 static inline void *
 kmem_zalloc(size_t size, xfs_km_flags_t flags)
@@ -85,6 +91,12 @@ kmem_zalloc(size_t size, xfs_km_flags_t flags)
 	return kmem_alloc(size, flags | KM_ZERO);
 }
 
+static inline void *
+kmem_zalloc_large(size_t size, xfs_km_flags_t flags)
+{
+	return kmem_alloc_large(size, flags | KM_ZERO);
+}
+
 /*
  * Zone interfaces
  */
@@ -123,7 +135,13 @@ kmem_zone_destroy(kmem_zone_t *zone)
 		kmem_cache_destroy(zone);
 }
 
-extern void *kmem_zone_alloc(kmem_zone_t *, xfs_km_flags_t);
+extern void *kmem_zone_alloc_node(kmem_zone_t *, xfs_km_flags_t, int);
+
+static inline void *
+kmem_zone_alloc(kmem_zone_t *zone, xfs_km_flags_t flags)
+{
+	return kmem_zone_alloc_node(zone, flags, NUMA_NO_NODE);
+}
 
 static inline void *
 kmem_zone_zalloc(kmem_zone_t *zone, xfs_km_flags_t flags)
@@ -131,4 +149,36 @@ kmem_zone_zalloc(kmem_zone_t *zone, xfs_km_flags_t flags)
 	return kmem_zone_alloc(zone, flags | KM_ZERO);
 }
 
+/*
+ * Mempool interfaces
+ *
+ * Pools back the objects the transaction commit and log write paths cannot
+ * do without.  A sleeping allocation waits for an element to be returned to
+ * the pool instead of retrying the page allocator, so forward progress only
+ * depends on log I/O completing.  mempool_alloc() can't zero the element
+ * itself, so we do that here.
+ */
+static inline void *
+kmem_pool_alloc(mempool_t *pool, size_t size, xfs_km_flags_t flags)
+{
+	void	*ptr;
+
+	ptr = mempool_alloc(pool, kmem_flags_convert(flags & ~KM_ZERO));
+	if (ptr && (flags & KM_ZERO))
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+static inline void *
+kmem_pool_zalloc(mempool_t *pool, size_t size, xfs_km_flags_t flags)
+{
+	return kmem_pool_alloc(pool, size, flags | KM_ZERO);
+}
+
+static inline void
+kmem_pool_free(mempool_t *pool, void *ptr)
+{
+	mempool_free(ptr, pool);
+}
+
 #endif /* __XFS_SUPPORT_KMEM_H__ */
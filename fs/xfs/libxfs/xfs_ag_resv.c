@@ -123,13 +123,27 @@ xfs_ag_resv_needed(
 	struct xfs_perag		*pag,
 	enum xfs_ag_resv_type		type)
 {
+	struct xfs_mount		*mp = pag->pag_mount;
+	xfs_extlen_t			meta = pag->pag_meta_resv.ar_reserved;
+	xfs_extlen_t			agfl = pag->pag_agfl_resv.ar_reserved;
 	xfs_extlen_t			len;
 
-	len = pag->pag_meta_resv.ar_reserved + pag->pag_agfl_resv.ar_reserved;
+	/*
+	 * If the reservations for this AG haven't been set up yet, assume
+	 * the worst case of a full size AG with empty btrees.
+	 */
+	if (READ_ONCE(pag->pag_resv_pending)) {
+		meta = mp->m_ag_resv_est_meta;
+		agfl = mp->m_ag_resv_est_agfl;
+	}
+
+	len = meta + agfl;
 	switch (type) {
 	case XFS_AG_RESV_METADATA:
+		len -= meta;
+		break;
 	case XFS_AG_RESV_AGFL:
-		len -= xfs_perag_resv(pag, type)->ar_reserved;
+		len -= agfl;
 		break;
 	case XFS_AG_RESV_NONE:
 		/* empty */
@@ -156,7 +170,9 @@ __xfs_ag_resv_free(
 	trace_xfs_ag_resv_free(pag, type, 0);
 
 	resv = xfs_perag_resv(pag, type);
+	spin_lock(&pag->pag_mount->m_sb_lock);
 	pag->pag_mount->m_ag_max_usable += resv->ar_asked;
+	spin_unlock(&pag->pag_mount->m_sb_lock);
 	/*
 	 * AGFL blocks are always considered "free", so whatever
 	 * was reserved at mount time must be given back at umount.
@@ -216,7 +232,10 @@ __xfs_ag_resv_init(
 		return error;
 	}
 
+	/* AGs may be set up concurrently, see xfs_fs_reserve_ag_blocks. */
+	spin_lock(&mp->m_sb_lock);
 	mp->m_ag_max_usable -= ask;
+	spin_unlock(&mp->m_sb_lock);
 
 	resv = xfs_perag_resv(pag, type);
 	resv->ar_asked = ask;
@@ -226,6 +245,37 @@ __xfs_ag_resv_init(
 	return 0;
 }
 
+/*
+ * Estimate the size of a per-AG reservation without reading anything from
+ * disk.  This assumes a full size AG whose btrees are all empty, so it is
+ * never smaller than what xfs_ag_resv_init will actually reserve.
+ */
+xfs_extlen_t
+xfs_ag_resv_estimate(
+	struct xfs_mount		*mp,
+	enum xfs_ag_resv_type		type)
+{
+	xfs_agblock_t			agblocks = mp->m_sb.sb_agblocks;
+	xfs_extlen_t			ask = 0;
+
+	switch (type) {
+	case XFS_AG_RESV_METADATA:
+		if (xfs_sb_version_hasreflink(&mp->m_sb))
+			ask += xfs_refcountbt_max_size(mp, agblocks);
+		if (xfs_sb_version_hasfinobt(&mp->m_sb) && !mp->m_inotbt_nores)
+			ask += xfs_inobt_max_size(mp);
+		break;
+	case XFS_AG_RESV_AGFL:
+		if (xfs_sb_version_hasrmapbt(&mp->m_sb))
+			ask += max(agblocks / 100,
+				   xfs_rmapbt_max_size(mp, agblocks));
+		break;
+	default:
+		ASSERT(0);
+	}
+	return ask;
+}
+
 /* Create a per-AG block reservation. */
 int
 xfs_ag_resv_init(
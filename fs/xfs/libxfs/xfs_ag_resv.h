@@ -22,6 +22,8 @@
 
 int xfs_ag_resv_free(struct xfs_perag *pag);
 int xfs_ag_resv_init(struct xfs_perag *pag);
+xfs_extlen_t xfs_ag_resv_estimate(struct xfs_mount *mp,
+		enum xfs_ag_resv_type type);
 
 bool xfs_ag_resv_critical(struct xfs_perag *pag, enum xfs_ag_resv_type type);
 xfs_extlen_t xfs_ag_resv_needed(struct xfs_perag *pag,
@@ -371,6 +371,23 @@ xfs_alloc_fix_len(
 	args->len = rlen;
 }
 
+/*
+ * Account for a by-size btree record of len blocks being added (delta 1) or
+ * removed (delta -1) in the AG's free space histogram.  Updates happen with
+ * the AGF locked; unlocked readers may see slightly stale counts, just as
+ * they may for pagf_longest.
+ */
+static inline void
+xfs_alloc_hist_update(
+	struct xfs_perag	*pag,
+	xfs_extlen_t		len,
+	int			delta)
+{
+	ASSERT(len > 0);
+	if (pag->pagf_hist_init)
+		pag->pagf_hist[ilog2(len)] += delta;
+}
+
 /*
  * Update the two btrees, logically removing from freespace the extent
  * starting at rbno, rlen blocks.  The extent is contained within the
@@ -395,6 +412,7 @@ xfs_alloc_fixup_trees(
 	xfs_extlen_t	nflen1=0;	/* first new free length */
 	xfs_extlen_t	nflen2=0;	/* second new free length */
 	struct xfs_mount *mp;
+	struct xfs_perag *pag;
 
 	mp = cnt_cur->bc_mp;
 
@@ -488,6 +506,13 @@ xfs_alloc_fixup_trees(
 			return error;
 		XFS_WANT_CORRUPTED_RETURN(mp, i == 1);
 	}
+	pag = xfs_perag_get(mp, cnt_cur->bc_private.a.agno);
+	xfs_alloc_hist_update(pag, flen, -1);
+	if (nfbno1 != NULLAGBLOCK)
+		xfs_alloc_hist_update(pag, nflen1, 1);
+	if (nfbno2 != NULLAGBLOCK)
+		xfs_alloc_hist_update(pag, nflen2, 1);
+	xfs_perag_put(pag);
 	/*
 	 * Fix up the by-block btree entry(s).
 	 */
@@ -677,6 +702,8 @@ xfs_alloc_ag_vextent(
 	 * Branch to correct routine based on the type.
 	 */
 	args->wasfromfl = 0;
+	args->busy_start = NULLAGBLOCK;
+	args->busy_end = 0;
 	switch (args->type) {
 	case XFS_ALLOCTYPE_THIS_AG:
 		error = xfs_alloc_ag_vextent_size(args);
@@ -723,6 +750,10 @@ xfs_alloc_ag_vextent(
 
 	XFS_STATS_INC(args->mp, xs_allocx);
 	XFS_STATS_ADD(args->mp, xs_allocb, args->len);
+	XFS_AG_STATS_INC(args->pag, as_allocs);
+	XFS_AG_STATS_ADD(args->pag, as_alloc_blocks, args->len);
+	if (xfs_alloc_is_userdata(args->datatype))
+		atomic64_add(args->len, &args->pag->pag_data_blocks);
 	return error;
 }
 
@@ -935,6 +966,79 @@ xfs_alloc_find_best_extent(
 	return error;
 }
 
+/*
+ * Use the by-size btree to find a free extent near args->agbno that is big
+ * enough for the allocation.  By-size records of the same length are sorted
+ * by block number, so a lookup for (len, agbno) lands on the closest extent
+ * of that length at or after agbno, or failing that on the lowest extent of
+ * the next larger length.  Do such a lookup for minlen, then for twice the
+ * length found each time until we run past the longest free extent, and
+ * return the closest usable extent in *cbno, or NULLAGBLOCK if none.
+ *
+ * This takes a handful of lookups however fragmented the AG is, and gives
+ * the by-bno walk in xfs_alloc_ag_vextent_near a distance it never needs to
+ * search beyond.
+ */
+STATIC int
+xfs_alloc_near_cntbt_lookup(
+	struct xfs_alloc_arg	*args,	/* allocation argument structure */
+	struct xfs_btree_cur	*cnt_cur, /* by-size btree cursor */
+	xfs_agblock_t		*cbno,	/* out: closest extent found */
+	xfs_extlen_t		*clen,	/* out: its length */
+	xfs_extlen_t		*cdiff)	/* out: its distance from agbno */
+{
+	xfs_extlen_t		longest = args->pag->pagf_longest;
+	xfs_extlen_t		len = args->minlen;
+	xfs_agblock_t		bno;
+	xfs_agblock_t		bnoa;
+	xfs_extlen_t		flen;
+	xfs_extlen_t		flena;
+	xfs_extlen_t		diff;
+	xfs_agblock_t		new;
+	unsigned		busy_gen;
+	int			error;
+	int			i;
+
+	*cbno = NULLAGBLOCK;
+	*clen = 0;
+	*cdiff = NULLAGBLOCK;
+
+	while (len <= longest) {
+		error = xfs_alloc_lookup_ge(cnt_cur, args->agbno, len, &i);
+		if (error)
+			return error;
+		if (!i)
+			break;
+		error = xfs_alloc_get_rec(cnt_cur, &bno, &flen, &i);
+		if (error)
+			return error;
+		XFS_WANT_CORRUPTED_RETURN(args->mp, i == 1);
+
+		xfs_alloc_compute_aligned(args, bno, flen, &bnoa, &flena,
+				&busy_gen);
+		if (flena >= args->minlen && bnoa >= args->min_agbno &&
+		    bnoa <= args->max_agbno) {
+			args->len = XFS_EXTLEN_MIN(flena, args->maxlen);
+			xfs_alloc_fix_len(args);
+			diff = xfs_alloc_compute_diff(args->agbno, args->len,
+					args->alignment, args->datatype, bnoa,
+					flena, &new);
+			if (new != NULLAGBLOCK && diff < *cdiff) {
+				*cbno = bno;
+				*clen = flen;
+				*cdiff = diff;
+				if (!diff)
+					break;
+			}
+		}
+
+		if (flen > longest / 2)
+			break;
+		len = flen * 2;
+	}
+	return 0;
+}
+
 /*
  * Allocate a variable extent near bno in the allocation group agno.
  * Extent's length (returned in len) will be between minlen and maxlen,
@@ -964,6 +1068,9 @@ xfs_alloc_ag_vextent_near(
 	xfs_extlen_t	ltlena;		/* aligned ... */
 	xfs_agblock_t	ltnew;		/* useful start bno of left side */
 	xfs_extlen_t	rlen;		/* length of returned extent */
+	xfs_agblock_t	cbno;		/* closest extent from by-size btree */
+	xfs_extlen_t	clen;		/* length of by-size btree extent */
+	xfs_extlen_t	cdiff;		/* distance of by-size btree extent */
 	bool		busy;
 	unsigned	busy_gen;
 #ifdef DEBUG
@@ -1147,7 +1254,16 @@ xfs_alloc_ag_vextent_near(
 	 * With alignment, it's possible for both to fail; the upper
 	 * level algorithm that picks allocation groups for allocations
 	 * is not supposed to do this.
+	 *
+	 * Before walking the by-bno tree, find a usable extent through a few
+	 * by-size tree lookups.  Neither search needs to go further from
+	 * agbno than that extent, which bounds the walk on AGs that are
+	 * fragmented into many extents smaller than minlen.
 	 */
+	error = xfs_alloc_near_cntbt_lookup(args, cnt_cur, &cbno, &clen,
+			&cdiff);
+	if (error)
+		goto error0;
 	/*
 	 * Allocate and initialize the cursor for the leftward search.
 	 */
@@ -1200,7 +1316,9 @@ xfs_alloc_ag_vextent_near(
 				break;
 			if ((error = xfs_btree_decrement(bno_cur_lt, 0, &i)))
 				goto error0;
-			if (!i || ltbnoa < args->min_agbno) {
+			if (!i || ltbnoa < args->min_agbno ||
+			    (ltbno + ltlen < args->agbno &&
+			     args->agbno - (ltbno + ltlen) > cdiff)) {
 				xfs_btree_del_cursor(bno_cur_lt,
 						     XFS_BTREE_NOERROR);
 				bno_cur_lt = NULL;
@@ -1216,7 +1334,8 @@ xfs_alloc_ag_vextent_near(
 				break;
 			if ((error = xfs_btree_increment(bno_cur_gt, 0, &i)))
 				goto error0;
-			if (!i || gtbnoa > args->max_agbno) {
+			if (!i || gtbnoa > args->max_agbno ||
+			    gtbno - args->agbno > cdiff) {
 				xfs_btree_del_cursor(bno_cur_gt,
 						     XFS_BTREE_NOERROR);
 				bno_cur_gt = NULL;
@@ -1266,6 +1385,23 @@ xfs_alloc_ag_vextent_near(
 			goto error0;
 	}
 
+	/*
+	 * If the by-bno searches gave up short of the extent the by-size
+	 * lookups found, allocate from that one.
+	 */
+	if (bno_cur_lt == NULL && bno_cur_gt == NULL && cbno != NULLAGBLOCK) {
+		bno_cur_lt = xfs_allocbt_init_cursor(args->mp, args->tp,
+			args->agbp, args->agno, XFS_BTNUM_BNO);
+		error = xfs_alloc_lookup_eq(bno_cur_lt, cbno, clen, &i);
+		if (error)
+			goto error0;
+		XFS_WANT_CORRUPTED_GOTO(args->mp, i == 1, error0);
+		ltbno = cbno;
+		ltlen = clen;
+		xfs_alloc_compute_aligned(args, ltbno, ltlen, &ltbnoa, &ltlena,
+				&busy_gen);
+	}
+
 	/*
 	 * If we couldn't get anything, give up.
 	 */
@@ -1274,7 +1410,7 @@ xfs_alloc_ag_vextent_near(
 
 		if (busy) {
 			trace_xfs_alloc_near_busy(args);
-			xfs_extent_busy_flush(args->mp, args->pag, busy_gen);
+			xfs_extent_busy_flush(args, busy_gen);
 			goto restart;
 		}
 		trace_xfs_alloc_size_neither(args);
@@ -1422,8 +1558,7 @@ xfs_alloc_ag_vextent_size(
 				xfs_btree_del_cursor(cnt_cur,
 						     XFS_BTREE_NOERROR);
 				trace_xfs_alloc_size_busy(args);
-				xfs_extent_busy_flush(args->mp,
-							args->pag, busy_gen);
+				xfs_extent_busy_flush(args, busy_gen);
 				goto restart;
 			}
 		}
@@ -1492,7 +1627,7 @@ xfs_alloc_ag_vextent_size(
 		if (busy) {
 			xfs_btree_del_cursor(cnt_cur, XFS_BTREE_NOERROR);
 			trace_xfs_alloc_size_busy(args);
-			xfs_extent_busy_flush(args->mp, args->pag, busy_gen);
+			xfs_extent_busy_flush(args, busy_gen);
 			goto restart;
 		}
 		goto out_nominleft;
@@ -1884,8 +2019,15 @@ xfs_free_ag_extent(
 	 * Update the freespace totals in the ag and superblock.
 	 */
 	pag = xfs_perag_get(mp, agno);
+	if (haveleft)
+		xfs_alloc_hist_update(pag, ltlen, -1);
+	if (haveright)
+		xfs_alloc_hist_update(pag, gtlen, -1);
+	xfs_alloc_hist_update(pag, nlen, 1);
 	error = xfs_alloc_update_counters(tp, pag, agbp, len);
 	xfs_ag_resv_free_extent(pag, type, tp, len);
+	XFS_AG_STATS_INC(pag, as_frees);
+	XFS_AG_STATS_ADD(pag, as_free_blocks, len);
 	xfs_perag_put(pag);
 	if (error)
 		goto error0;
@@ -2035,6 +2177,65 @@ xfs_alloc_space_available(
 	return true;
 }
 
+/*
+ * Put a run of len contiguous blocks starting at bno on the freelist.  This
+ * is what xfs_alloc_put_freelist does for a single block, but the AGF and
+ * the AGFL slots are updated and logged once for the whole run.
+ */
+STATIC int
+xfs_alloc_put_freelist_extent(
+	struct xfs_trans	*tp,
+	struct xfs_buf		*agbp,
+	struct xfs_buf		*agflbp,
+	xfs_agblock_t		bno,
+	xfs_extlen_t		len)
+{
+	struct xfs_mount	*mp = tp->t_mountp;
+	struct xfs_agf		*agf = XFS_BUF_TO_AGF(agbp);
+	struct xfs_perag	*pag;
+	__be32			*agfl_bno;
+	unsigned int		first;	/* first slot filled */
+	unsigned int		last;	/* last slot filled */
+	int			startoff;
+	int			endoff;
+	xfs_extlen_t		i;
+
+	ASSERT(len > 0);
+	ASSERT(be32_to_cpu(agf->agf_flcount) + len <= XFS_AGFL_SIZE(mp));
+
+	agfl_bno = XFS_BUF_TO_AGFL_BNO(mp, agflbp);
+	last = be32_to_cpu(agf->agf_fllast);
+	first = last + 1;
+	if (first == XFS_AGFL_SIZE(mp))
+		first = 0;
+	for (i = 0; i < len; i++) {
+		if (++last == XFS_AGFL_SIZE(mp))
+			last = 0;
+		agfl_bno[last] = cpu_to_be32(bno + i);
+	}
+
+	agf->agf_fllast = cpu_to_be32(last);
+	be32_add_cpu(&agf->agf_flcount, len);
+	xfs_trans_agflist_delta(tp, len);
+	pag = xfs_perag_get(mp, be32_to_cpu(agf->agf_seqno));
+	pag->pagf_flcount += len;
+	xfs_perag_put(pag);
+	xfs_alloc_log_agf(tp, agbp, XFS_AGF_FLLAST | XFS_AGF_FLCOUNT);
+
+	/* The filled slots may wrap around the end of the AGFL. */
+	xfs_trans_buf_set_type(tp, agflbp, XFS_BLFT_AGFL_BUF);
+	startoff = (char *)&agfl_bno[first] - (char *)agflbp->b_addr;
+	if (last < first) {
+		endoff = (char *)&agfl_bno[XFS_AGFL_SIZE(mp)] -
+			 (char *)agflbp->b_addr;
+		xfs_trans_log_buf(tp, agflbp, startoff, endoff - 1);
+		startoff = (char *)&agfl_bno[0] - (char *)agflbp->b_addr;
+	}
+	endoff = (char *)&agfl_bno[last + 1] - (char *)agflbp->b_addr;
+	xfs_trans_log_buf(tp, agflbp, startoff, endoff - 1);
+	return 0;
+}
+
 /*
  * Decide whether to use this allocation group for this allocation.
  * If so, fix up the btree freelist's size.
@@ -2051,6 +2252,8 @@ xfs_alloc_fix_freelist(
 	struct xfs_buf		*agflbp = NULL;
 	struct xfs_alloc_arg	targs;	/* local allocation arguments */
 	xfs_agblock_t		bno;	/* freelist block */
+	xfs_agblock_t		runbno = NULLAGBLOCK; /* run being freed */
+	xfs_extlen_t		runlen;	/* length of run being freed */
 	xfs_extlen_t		need;	/* total blocks needed in freelist */
 	int			error = 0;
 
@@ -2061,6 +2264,7 @@ xfs_alloc_fix_freelist(
 		if (!pag->pagf_init) {
 			ASSERT(flags & XFS_ALLOC_FLAG_TRYLOCK);
 			ASSERT(!(flags & XFS_ALLOC_FLAG_FREEING));
+			XFS_AG_STATS_INC(pag, as_agf_trylock_fails);
 			goto out_agbp_relse;
 		}
 	}
@@ -2092,6 +2296,7 @@ xfs_alloc_fix_freelist(
 		if (!agbp) {
 			ASSERT(flags & XFS_ALLOC_FLAG_TRYLOCK);
 			ASSERT(!(flags & XFS_ALLOC_FLAG_FREEING));
+			XFS_AG_STATS_INC(pag, as_agf_trylock_fails);
 			goto out_no_agbp;
 		}
 	}
@@ -2130,18 +2335,38 @@ xfs_alloc_fix_freelist(
 		xfs_rmap_skip_owner_update(&targs.oinfo);
 	else
 		xfs_rmap_ag_owner(&targs.oinfo, XFS_RMAP_OWN_AG);
+	/*
+	 * Blocks put on the freelist by a refill come off it in the same
+	 * order, so free contiguous runs as one extent rather than updating
+	 * the free space btrees for every block.
+	 */
+	runlen = 0;
 	while (!(flags & XFS_ALLOC_FLAG_NOSHRINK) && pag->pagf_flcount > need) {
 		struct xfs_buf	*bp;
 
 		error = xfs_alloc_get_freelist(tp, agbp, &bno, 0);
-		if (error)
-			goto out_agbp_relse;
-		error = xfs_free_ag_extent(tp, agbp, args->agno, bno, 1,
-					   &targs.oinfo, XFS_AG_RESV_AGFL);
 		if (error)
 			goto out_agbp_relse;
 		bp = xfs_btree_get_bufs(mp, tp, args->agno, bno, 0);
 		xfs_trans_binval(tp, bp);
+		if (runlen && bno == runbno + runlen) {
+			runlen++;
+			continue;
+		}
+		if (runlen) {
+			error = xfs_free_ag_extent(tp, agbp, args->agno, runbno,
+					runlen, &targs.oinfo, XFS_AG_RESV_AGFL);
+			if (error)
+				goto out_agbp_relse;
+		}
+		runbno = bno;
+		runlen = 1;
+	}
+	if (runlen) {
+		error = xfs_free_ag_extent(tp, agbp, args->agno, runbno, runlen,
+				&targs.oinfo, XFS_AG_RESV_AGFL);
+		if (error)
+			goto out_agbp_relse;
 	}
 
 	targs.tp = tp;
@@ -2177,14 +2402,12 @@ xfs_alloc_fix_freelist(
 			goto out_agflbp_relse;
 		}
 		/*
-		 * Put each allocated block on the list.
+		 * Put the allocated blocks on the list.
 		 */
-		for (bno = targs.agbno; bno < targs.agbno + targs.len; bno++) {
-			error = xfs_alloc_put_freelist(tp, agbp,
-							agflbp, bno, 0);
-			if (error)
-				goto out_agflbp_relse;
-		}
+		error = xfs_alloc_put_freelist_extent(tp, agbp, agflbp,
+				targs.agbno, targs.len);
+		if (error)
+			goto out_agflbp_relse;
 	}
 	xfs_trans_brelse(tp, agflbp);
 	args->agbp = agbp;
@@ -2489,6 +2712,47 @@ const struct xfs_buf_ops xfs_agf_buf_ops = {
 	.verify_write = xfs_agf_write_verify,
 };
 
+STATIC int
+xfs_alloc_hist_init_rec(
+	struct xfs_btree_cur		*cur,
+	struct xfs_alloc_rec_incore	*rec,
+	void				*priv)
+{
+	uint32_t			*hist = priv;
+
+	if (!rec->ar_blockcount)
+		return -EFSCORRUPTED;
+	hist[ilog2(rec->ar_blockcount)]++;
+	return 0;
+}
+
+/*
+ * Build the AG's free space histogram by walking the by-size btree.  This
+ * is done once, the first time the AGF is read; from then on the histogram
+ * is kept up to date by every change to the by-size btree records.
+ */
+STATIC int
+xfs_alloc_hist_init(
+	struct xfs_mount	*mp,
+	struct xfs_trans	*tp,
+	struct xfs_buf		*agbp,
+	struct xfs_perag	*pag)
+{
+	struct xfs_btree_cur	*cur;
+	int			error;
+
+	memset(pag->pagf_hist, 0, sizeof(pag->pagf_hist));
+	cur = xfs_allocbt_init_cursor(mp, tp, agbp, pag->pag_agno,
+			XFS_BTNUM_CNT);
+	error = xfs_alloc_query_all(cur, xfs_alloc_hist_init_rec,
+			pag->pagf_hist);
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	if (error)
+		return error;
+	pag->pagf_hist_init = true;
+	return 0;
+}
+
 /*
  * Read in the allocation group header (free/alloc section).
  */
@@ -2540,6 +2804,11 @@ xfs_alloc_read_agf(
 	error = xfs_read_agf(mp, tp, agno,
 			(flags & XFS_ALLOC_FLAG_TRYLOCK) ? XBF_TRYLOCK : 0,
 			bpp);
+	if (error == -EAGAIN || (!error && !*bpp)) {
+		pag = xfs_perag_get(mp, agno);
+		xfs_perag_set_contended(pag);
+		xfs_perag_put(pag);
+	}
 	if (error)
 		return error;
 	if (!*bpp)
@@ -2563,7 +2832,11 @@ xfs_alloc_read_agf(
 		spin_lock_init(&pag->pagb_lock);
 		pag->pagb_count = 0;
 		pag->pagb_tree = RB_ROOT;
+		seqcount_init(&pag->pagb_seq);
+		INIT_LIST_HEAD(&pag->pagb_discard);
+		pag->pagb_discard_blocks = 0;
 		pag->pagf_init = 1;
+		xfs_trans_dresv_agf_init(mp, pag);
 	}
 #ifdef DEBUG
 	else if (!XFS_FORCED_SHUTDOWN(mp)) {
@@ -2577,6 +2850,15 @@ xfs_alloc_read_agf(
 		       be32_to_cpu(agf->agf_levels[XFS_BTNUM_CNTi]));
 	}
 #endif
+	/*
+	 * A failure here leaves the histogram unbuilt.  Remember that, so we
+	 * don't walk a broken by-size btree again on every AGF read; repairing
+	 * the free space btrees lets us try again.  Any corruption will be
+	 * reported when the allocator next uses the btree.
+	 */
+	if (!pag->pagf_hist_init && !pag->pagf_hist_bad &&
+	    xfs_alloc_hist_init(mp, tp, *bpp, pag))
+		pag->pagf_hist_bad = true;
 	xfs_perag_put(pag);
 	return 0;
 }
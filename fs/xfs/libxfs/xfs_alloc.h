@@ -87,6 +87,8 @@ typedef struct xfs_alloc_arg {
 	xfs_fsblock_t	firstblock;	/* io first block allocated */
 	struct xfs_owner_info	oinfo;	/* owner of blocks being allocated */
 	enum xfs_ag_resv_type	resv;	/* block reservation to use */
+	xfs_agblock_t	busy_start;	/* range of busy extents that got */
+	xfs_agblock_t	busy_end;	/* in the way of the allocation */
 } xfs_alloc_arg_t;
 
 /*
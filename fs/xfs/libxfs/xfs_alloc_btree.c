@@ -59,6 +59,8 @@ xfs_allocbt_set_root(
 	agf->agf_roots[btnum] = ptr->s;
 	be32_add_cpu(&agf->agf_levels[btnum], inc);
 	pag->pagf_levels[btnum] += inc;
+	if (inc > 0)
+		xfs_trans_dresv_update(cur->bc_mp, pag);
 	xfs_perag_put(pag);
 
 	xfs_alloc_log_agf(cur->bc_tp, agbp, XFS_AGF_ROOTS | XFS_AGF_LEVELS);
@@ -132,6 +132,22 @@ xfs_attr_get_ilocked(
 		return xfs_attr_node_get(args);
 }
 
+/* Retrieve an extended attribute, preferably from the in-core cache. */
+STATIC int
+xfs_attr_get_cached(
+	struct xfs_inode	*ip,
+	struct xfs_da_args	*args)
+{
+	int			error;
+
+	error = xfs_attr_cache_get(ip, args);
+	if (error == -EAGAIN) {
+		error = xfs_attr_get_ilocked(ip, args);
+		xfs_attr_cache_add(ip, args, error);
+	}
+	return error;
+}
+
 /* Retrieve an extended attribute by name, and its value. */
 int
 xfs_attr_get(
@@ -160,7 +176,7 @@ xfs_attr_get(
 	args.op_flags = XFS_DA_OP_OKNOENT;
 
 	lock_mode = xfs_ilock_attr_map_shared(ip);
-	error = xfs_attr_get_ilocked(ip, &args);
+	error = xfs_attr_get_cached(ip, &args);
 	xfs_iunlock(ip, lock_mode);
 
 	*valuelenp = args.valuelen;
@@ -203,6 +219,100 @@ xfs_attr_calc_size(
 	return nblks;
 }
 
+/*
+ * Add a name to the attribute fork of args->dp, which must be locked and
+ * joined to args->trans.  The transaction may be rolled along the way but is
+ * neither committed nor cancelled here; if we had to give up on it,
+ * args->trans comes back NULL.  *shortform is set if the name was added to
+ * (or failed to fit in) a shortform list, in which case even an error leaves
+ * changes in the transaction that the caller must commit.
+ */
+STATIC int
+xfs_attr_set_args(
+	struct xfs_da_args	*args,
+	bool			*shortform)
+{
+	struct xfs_inode	*dp = args->dp;
+	int			error;
+
+	*shortform = false;
+
+	/*
+	 * If the attribute list is non-existent or a shortform list,
+	 * upgrade it to a single-leaf-block attribute list.
+	 */
+	if (dp->i_d.di_aformat == XFS_DINODE_FMT_LOCAL ||
+	    (dp->i_d.di_aformat == XFS_DINODE_FMT_EXTENTS &&
+	     dp->i_d.di_anextents == 0)) {
+
+		/*
+		 * Build initial attribute list (if required).
+		 */
+		if (dp->i_d.di_aformat == XFS_DINODE_FMT_EXTENTS)
+			xfs_attr_shortform_create(args);
+
+		/*
+		 * Try to add the attr to the attribute list in
+		 * the inode.
+		 */
+		*shortform = true;
+		error = xfs_attr_shortform_addname(args);
+		if (error != -ENOSPC)
+			return error;
+
+		/*
+		 * It won't fit in the shortform, transform to a leaf block.
+		 * GROT: another possible req'mt for a double-split btree op.
+		 */
+		*shortform = false;
+		xfs_defer_init(args->dfops, args->firstblock);
+		error = xfs_attr_shortform_to_leaf(args);
+		if (!error)
+			error = xfs_defer_finish(&args->trans, args->dfops, dp);
+		if (error) {
+			args->trans = NULL;
+			xfs_defer_cancel(args->dfops);
+			return error;
+		}
+
+		/*
+		 * Commit the leaf transformation.  We'll need another (linked)
+		 * transaction to add the new attribute to the leaf.
+		 */
+
+		error = xfs_trans_roll(&args->trans, dp);
+		if (error)
+			return error;
+
+	}
+
+	if (xfs_bmap_one_block(dp, XFS_ATTR_FORK))
+		return xfs_attr_leaf_addname(args);
+	return xfs_attr_node_addname(args);
+}
+
+/*
+ * Remove a name from the attribute fork of args->dp, which must be locked and
+ * joined to args->trans.  As for xfs_attr_set_args, the transaction is left
+ * to the caller.
+ */
+STATIC int
+xfs_attr_remove_args(
+	struct xfs_da_args	*args)
+{
+	struct xfs_inode	*dp = args->dp;
+
+	if (!xfs_inode_hasattr(dp))
+		return -ENOATTR;
+	if (dp->i_d.di_aformat == XFS_DINODE_FMT_LOCAL) {
+		ASSERT(dp->i_afp->if_flags & XFS_IFINLINE);
+		return xfs_attr_shortform_remove(args);
+	}
+	if (xfs_bmap_one_block(dp, XFS_ATTR_FORK))
+		return xfs_attr_leaf_removename(args);
+	return xfs_attr_node_removename(args);
+}
+
 int
 xfs_attr_set(
 	struct xfs_inode	*dp,
@@ -217,6 +327,7 @@ xfs_attr_set(
 	struct xfs_trans_res	tres;
 	xfs_fsblock_t		firstblock;
 	int			rsvd = (flags & ATTR_ROOT) != 0;
+	bool			shortform;
 	int			error, err2, local;
 
 	XFS_STATS_INC(mp, xs_attr_set);
@@ -267,6 +378,7 @@ xfs_attr_set(
 		return error;
 
 	xfs_ilock(dp, XFS_ILOCK_EXCL);
+	xfs_attr_cache_inval(dp);
 	error = xfs_trans_reserve_quota_nblks(args.trans, dp, args.total, 0,
 				rsvd ? XFS_QMOPT_RES_REGBLKS | XFS_QMOPT_FORCE_RES :
 				       XFS_QMOPT_RES_REGBLKS);
@@ -278,79 +390,31 @@ xfs_attr_set(
 
 	xfs_trans_ijoin(args.trans, dp, 0);
 
-	/*
-	 * If the attribute list is non-existent or a shortform list,
-	 * upgrade it to a single-leaf-block attribute list.
-	 */
-	if (dp->i_d.di_aformat == XFS_DINODE_FMT_LOCAL ||
-	    (dp->i_d.di_aformat == XFS_DINODE_FMT_EXTENTS &&
-	     dp->i_d.di_anextents == 0)) {
-
+	error = xfs_attr_set_args(&args, &shortform);
+	if (shortform) {
 		/*
-		 * Build initial attribute list (if required).
+		 * Commit the shortform mods, and we're done.
+		 * NOTE: this is also the error path (EEXIST, etc).
 		 */
-		if (dp->i_d.di_aformat == XFS_DINODE_FMT_EXTENTS)
-			xfs_attr_shortform_create(&args);
+		ASSERT(args.trans != NULL);
 
 		/*
-		 * Try to add the attr to the attribute list in
-		 * the inode.
+		 * If this is a synchronous mount, make sure that
+		 * the transaction goes to disk before returning
+		 * to the user.
 		 */
-		error = xfs_attr_shortform_addname(&args);
-		if (error != -ENOSPC) {
-			/*
-			 * Commit the shortform mods, and we're done.
-			 * NOTE: this is also the error path (EEXIST, etc).
-			 */
-			ASSERT(args.trans != NULL);
-
-			/*
-			 * If this is a synchronous mount, make sure that
-			 * the transaction goes to disk before returning
-			 * to the user.
-			 */
-			if (mp->m_flags & XFS_MOUNT_WSYNC)
-				xfs_trans_set_sync(args.trans);
-
-			if (!error && (flags & ATTR_KERNOTIME) == 0) {
-				xfs_trans_ichgtime(args.trans, dp,
-							XFS_ICHGTIME_CHG);
-			}
-			err2 = xfs_trans_commit(args.trans);
-			xfs_iunlock(dp, XFS_ILOCK_EXCL);
+		if (mp->m_flags & XFS_MOUNT_WSYNC)
+			xfs_trans_set_sync(args.trans);
 
-			return error ? error : err2;
+		if (!error && (flags & ATTR_KERNOTIME) == 0) {
+			xfs_trans_ichgtime(args.trans, dp,
+						XFS_ICHGTIME_CHG);
 		}
+		err2 = xfs_trans_commit(args.trans);
+		xfs_iunlock(dp, XFS_ILOCK_EXCL);
 
-		/*
-		 * It won't fit in the shortform, transform to a leaf block.
-		 * GROT: another possible req'mt for a double-split btree op.
-		 */
-		xfs_defer_init(args.dfops, args.firstblock);
-		error = xfs_attr_shortform_to_leaf(&args);
-		if (!error)
-			error = xfs_defer_finish(&args.trans, args.dfops, dp);
-		if (error) {
-			args.trans = NULL;
-			xfs_defer_cancel(&dfops);
-			goto out;
-		}
-
-		/*
-		 * Commit the leaf transformation.  We'll need another (linked)
-		 * transaction to add the new attribute to the leaf.
-		 */
-
-		error = xfs_trans_roll(&args.trans, dp);
-		if (error)
-			goto out;
-
+		return error ? error : err2;
 	}
-
-	if (xfs_bmap_one_block(dp, XFS_ATTR_FORK))
-		error = xfs_attr_leaf_addname(&args);
-	else
-		error = xfs_attr_node_addname(&args);
 	if (error)
 		goto out;
 
@@ -431,23 +495,14 @@ xfs_attr_remove(
 		return error;
 
 	xfs_ilock(dp, XFS_ILOCK_EXCL);
+	xfs_attr_cache_inval(dp);
 	/*
 	 * No need to make quota reservations here. We expect to release some
 	 * blocks not allocate in the common case.
 	 */
 	xfs_trans_ijoin(args.trans, dp, 0);
 
-	if (!xfs_inode_hasattr(dp)) {
-		error = -ENOATTR;
-	} else if (dp->i_d.di_aformat == XFS_DINODE_FMT_LOCAL) {
-		ASSERT(dp->i_afp->if_flags & XFS_IFINLINE);
-		error = xfs_attr_shortform_remove(&args);
-	} else if (xfs_bmap_one_block(dp, XFS_ATTR_FORK)) {
-		error = xfs_attr_leaf_removename(&args);
-	} else {
-		error = xfs_attr_node_removename(&args);
-	}
-
+	error = xfs_attr_remove_args(&args);
 	if (error)
 		goto out;
 
@@ -477,6 +532,229 @@ xfs_attr_remove(
 	return error;
 }
 
+/*
+ * Look up a batch of attributes under a single hold of the ILOCK.  The result
+ * of each lookup is left in its xo_error and xo_valuelen.  Operations that
+ * come in with xo_error already set are skipped.
+ */
+int
+xfs_attr_get_multi(
+	struct xfs_inode	*dp,
+	struct xfs_attr_op	*ops,
+	int			nops)
+{
+	struct xfs_da_args	args;
+	uint			lock_mode;
+	int			error;
+	int			i;
+
+	if (XFS_FORCED_SHUTDOWN(dp->i_mount))
+		return -EIO;
+
+	lock_mode = xfs_ilock_attr_map_shared(dp);
+	for (i = 0; i < nops; i++) {
+		if (ops[i].xo_error)
+			continue;
+		ASSERT(ops[i].xo_opcode == ATTR_OP_GET);
+		XFS_STATS_INC(dp->i_mount, xs_attr_get);
+
+		error = xfs_attr_args_init(&args, dp, ops[i].xo_name,
+				ops[i].xo_flags);
+		if (!error) {
+			args.value = ops[i].xo_value;
+			args.valuelen = ops[i].xo_valuelen;
+			args.op_flags = XFS_DA_OP_OKNOENT;
+			error = xfs_attr_get_cached(dp, &args);
+			ops[i].xo_valuelen = args.valuelen;
+		}
+		ops[i].xo_error = error == -EEXIST ? 0 : error;
+	}
+	xfs_iunlock(dp, lock_mode);
+	return 0;
+}
+
+/*
+ * Apply a batch of attribute sets and removes to an inode as one chain of
+ * transactions: a single log, block and quota reservation sized for the whole
+ * batch, the ILOCK held throughout and one final commit.  We roll the
+ * transaction between operations, so the log reservation only has to cover
+ * the largest of them.
+ *
+ * The result of each operation is left in its xo_error.  A name that already
+ * exists (ATTR_CREATE) or doesn't exist (ATTR_REPLACE, removes) fails just
+ * that operation; any other error stops the batch, marks the operations that
+ * never ran with -ECANCELED and is returned.  Operations that come in with
+ * xo_error already set are skipped.
+ */
+int
+xfs_attr_set_multi(
+	struct xfs_inode	*dp,
+	struct xfs_attr_op	*ops,
+	int			nops)
+{
+	struct xfs_mount	*mp = dp->i_mount;
+	struct xfs_da_args	args;
+	struct xfs_defer_ops	dfops;
+	struct xfs_trans_res	tres;
+	struct xfs_trans	*tp;
+	xfs_fsblock_t		firstblock;
+	uint			logres = M_RES(mp)->tr_attrrm.tr_logres;
+	int			total = 0;
+	int			sf_size = 0;
+	int			rsvd = 1;
+	bool			changed = false;
+	bool			chgtime = false;
+	bool			shortform;
+	int			nblks;
+	int			local;
+	int			error;
+	int			i;
+
+	if (XFS_FORCED_SHUTDOWN(mp))
+		return -EIO;
+
+	for (i = 0; i < nops; i++) {
+		if (ops[i].xo_error)
+			continue;
+		ASSERT(ops[i].xo_opcode == ATTR_OP_SET ||
+		       ops[i].xo_opcode == ATTR_OP_REMOVE);
+		ops[i].xo_error = xfs_attr_args_init(&args, dp,
+				ops[i].xo_name, ops[i].xo_flags);
+		if (ops[i].xo_error)
+			continue;
+
+		/* Root fork attributes can use reserved data blocks. */
+		if (!(ops[i].xo_flags & ATTR_ROOT))
+			rsvd = 0;
+
+		if (ops[i].xo_opcode == ATTR_OP_REMOVE) {
+			XFS_STATS_INC(mp, xs_attr_remove);
+			total += XFS_ATTRRM_SPACE_RES(mp);
+			continue;
+		}
+
+		XFS_STATS_INC(mp, xs_attr_set);
+		args.valuelen = ops[i].xo_valuelen;
+		nblks = xfs_attr_calc_size(&args, &local);
+		total += nblks;
+		logres = max(logres, M_RES(mp)->tr_attrsetm.tr_logres +
+				     M_RES(mp)->tr_attrsetrt.tr_logres * nblks);
+		if (!sf_size)
+			sf_size = sizeof(xfs_attr_sf_hdr_t) +
+				XFS_ATTR_SF_ENTSIZE_BYNAME(args.namelen,
+							   args.valuelen);
+	}
+
+	error = xfs_qm_dqattach(dp, 0);
+	if (error)
+		return error;
+
+	/*
+	 * If the inode doesn't have an attribute fork, add one.
+	 * (inode must not be locked when we call this routine)
+	 */
+	if (sf_size && XFS_IFORK_Q(dp) == 0) {
+		error = xfs_bmap_add_attrfork(dp, sf_size, rsvd);
+		if (error)
+			return error;
+	}
+
+	tres.tr_logres = logres;
+	tres.tr_logcount = max(XFS_ATTRSET_LOG_COUNT, XFS_ATTRRM_LOG_COUNT);
+	tres.tr_logflags = XFS_TRANS_PERM_LOG_RES;
+	error = xfs_trans_alloc(mp, &tres, total, 0,
+			rsvd ? XFS_TRANS_RESERVE : 0, &tp);
+	if (error)
+		return error;
+
+	xfs_ilock(dp, XFS_ILOCK_EXCL);
+	xfs_attr_cache_inval(dp);
+	error = xfs_trans_reserve_quota_nblks(tp, dp, total, 0,
+				rsvd ? XFS_QMOPT_RES_REGBLKS | XFS_QMOPT_FORCE_RES :
+				       XFS_QMOPT_RES_REGBLKS);
+	if (error) {
+		xfs_iunlock(dp, XFS_ILOCK_EXCL);
+		xfs_trans_cancel(tp);
+		return error;
+	}
+
+	xfs_trans_ijoin(tp, dp, 0);
+
+	for (i = 0; i < nops; i++) {
+		if (ops[i].xo_error)
+			continue;
+
+		/* Give each operation a fresh log reservation. */
+		if (changed) {
+			error = xfs_trans_roll(&tp, dp);
+			if (error) {
+				ops[i].xo_error = error;
+				goto out;
+			}
+		}
+
+		xfs_attr_args_init(&args, dp, ops[i].xo_name, ops[i].xo_flags);
+		args.trans = tp;
+		args.firstblock = &firstblock;
+		args.dfops = &dfops;
+		if (ops[i].xo_opcode == ATTR_OP_SET) {
+			args.value = ops[i].xo_value;
+			args.valuelen = ops[i].xo_valuelen;
+			args.op_flags = XFS_DA_OP_ADDNAME | XFS_DA_OP_OKNOENT;
+			args.total = xfs_attr_calc_size(&args, &local);
+			error = xfs_attr_set_args(&args, &shortform);
+		} else {
+			args.op_flags = XFS_DA_OP_OKNOENT;
+			error = xfs_attr_remove_args(&args);
+		}
+		tp = args.trans;
+		ops[i].xo_error = error;
+
+		/*
+		 * Failed lookups leave the transaction clean, or holding
+		 * shortform changes that have to be committed anyway.
+		 */
+		if (error == -EEXIST || error == -ENOATTR)
+			continue;
+		if (error)
+			goto out;
+		changed = true;
+		if (!(ops[i].xo_flags & ATTR_KERNOTIME))
+			chgtime = true;
+	}
+
+	/*
+	 * If this is a synchronous mount, make sure that the
+	 * transaction goes to disk before returning to the user.
+	 */
+	if (changed && (mp->m_flags & XFS_MOUNT_WSYNC))
+		xfs_trans_set_sync(tp);
+
+	if (chgtime)
+		xfs_trans_ichgtime(tp, dp, XFS_ICHGTIME_CHG);
+
+	/*
+	 * Commit the last in the sequence of transactions.  A batch where
+	 * every operation failed its lookup hasn't touched the inode core,
+	 * and anything the attr code did change it has logged itself.
+	 */
+	if (changed)
+		xfs_trans_log_inode(tp, dp, XFS_ILOG_CORE);
+	error = xfs_trans_commit(tp);
+	xfs_iunlock(dp, XFS_ILOCK_EXCL);
+	return error;
+
+out:
+	while (++i < nops) {
+		if (!ops[i].xo_error)
+			ops[i].xo_error = -ECANCELED;
+	}
+	if (tp)
+		xfs_trans_cancel(tp);
+	xfs_iunlock(dp, XFS_ILOCK_EXCL);
+	return error;
+}
+
 /*========================================================================
  * External routines when attribute list is inside the inode
  *========================================================================*/
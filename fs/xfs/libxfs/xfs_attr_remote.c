@@ -42,7 +42,7 @@
 #include "xfs_buf_item.h"
 #include "xfs_error.h"
 
-#define ATTR_RMTVALUE_MAPSIZE	1	/* # of map entries at once */
+#define ATTR_RMTVALUE_MAPSIZE	8	/* # of map entries at once */
 
 /*
  * Each contiguous block has a header, so it is not just a simple attribute
@@ -88,6 +88,28 @@ xfs_attr3_rmt_hdr_ok(
 	return true;
 }
 
+/*
+ * Remote value buffers can be built from several discontiguous extents.  Step
+ * the disk address of the block being looked at forwards by one block,
+ * moving on to the next extent of the buffer when we run off the end of the
+ * current one.
+ */
+static xfs_daddr_t
+xfs_attr3_rmt_next_bno(
+	struct xfs_buf		*bp,
+	int			*mapi,
+	xfs_daddr_t		bno,
+	int			blksize)
+{
+	struct xfs_buf_map	*map = &bp->b_maps[*mapi];
+
+	bno += BTOBB(blksize);
+	if (bno < map->bm_bn + map->bm_len || *mapi + 1 >= bp->b_map_count)
+		return bno;
+	(*mapi)++;
+	return bp->b_maps[*mapi].bm_bn;
+}
+
 static bool
 xfs_attr3_rmt_verify(
 	struct xfs_mount	*mp,
@@ -125,6 +147,7 @@ xfs_attr3_rmt_read_verify(
 	int		len;
 	xfs_daddr_t	bno;
 	int		blksize = mp->m_attr_geo->blksize;
+	int		mapi = 0;
 
 	/* no verification of non-crc buffers */
 	if (!xfs_sb_version_hascrc(&mp->m_sb))
@@ -146,7 +169,7 @@ xfs_attr3_rmt_read_verify(
 		}
 		len -= blksize;
 		ptr += blksize;
-		bno += BTOBB(blksize);
+		bno = xfs_attr3_rmt_next_bno(bp, &mapi, bno, blksize);
 	}
 
 	if (bp->b_error)
@@ -164,6 +187,7 @@ xfs_attr3_rmt_write_verify(
 	char		*ptr;
 	int		len;
 	xfs_daddr_t	bno;
+	int		mapi = 0;
 
 	/* no verification of non-crc buffers */
 	if (!xfs_sb_version_hascrc(&mp->m_sb))
@@ -196,7 +220,7 @@ xfs_attr3_rmt_write_verify(
 
 		len -= blksize;
 		ptr += blksize;
-		bno += BTOBB(blksize);
+		bno = xfs_attr3_rmt_next_bno(bp, &mapi, bno, blksize);
 	}
 	ASSERT(len == 0);
 }
@@ -259,6 +283,7 @@ xfs_attr_rmtval_copyout(
 	xfs_daddr_t	bno = bp->b_bn;
 	int		len = BBTOB(bp->b_length);
 	int		blksize = mp->m_attr_geo->blksize;
+	int		mapi = 0;
 
 	ASSERT(len >= blksize);
 
@@ -284,7 +309,7 @@ xfs_attr_rmtval_copyout(
 		/* roll buffer forwards */
 		len -= blksize;
 		src += blksize;
-		bno += BTOBB(blksize);
+		bno = xfs_attr3_rmt_next_bno(bp, &mapi, bno, blksize);
 
 		/* roll attribute data forwards */
 		*valuelen -= byte_cnt;
@@ -307,6 +332,7 @@ xfs_attr_rmtval_copyin(
 	xfs_daddr_t	bno = bp->b_bn;
 	int		len = BBTOB(bp->b_length);
 	int		blksize = mp->m_attr_geo->blksize;
+	int		mapi = 0;
 
 	ASSERT(len >= blksize);
 
@@ -334,7 +360,7 @@ xfs_attr_rmtval_copyin(
 		/* roll buffer forwards */
 		len -= blksize;
 		dst += blksize;
-		bno += BTOBB(blksize);
+		bno = xfs_attr3_rmt_next_bno(bp, &mapi, bno, blksize);
 
 		/* roll attribute data forwards */
 		*valuelen -= byte_cnt;
@@ -346,12 +372,19 @@ xfs_attr_rmtval_copyin(
 /*
  * Read the value associated with an attribute from the out-of-line buffer
  * that we stored it in.
+ *
+ * Up to ATTR_RMTVALUE_MAPSIZE extents of the value are read at once into a
+ * single compound buffer, so the reads of all of them are in flight together
+ * and the value is copied straight out into the caller's buffer.  Compound
+ * buffers don't match the per-extent buffers that xfs_attr_rmtval_remove()
+ * invalidates, so they are never left in the buffer cache.
  */
 int
 xfs_attr_rmtval_get(
 	struct xfs_da_args	*args)
 {
 	struct xfs_bmbt_irec	map[ATTR_RMTVALUE_MAPSIZE];
+	struct xfs_buf_map	bmap[ATTR_RMTVALUE_MAPSIZE];
 	struct xfs_mount	*mp = args->dp->i_mount;
 	struct xfs_buf		*bp;
 	xfs_dablk_t		lblkno = args->rmtblkno;
@@ -378,32 +411,32 @@ xfs_attr_rmtval_get(
 			return error;
 		ASSERT(nmap >= 1);
 
-		for (i = 0; (i < nmap) && (valuelen > 0); i++) {
-			xfs_daddr_t	dblkno;
-			int		dblkcnt;
-
+		for (i = 0; i < nmap; i++) {
 			ASSERT((map[i].br_startblock != DELAYSTARTBLOCK) &&
 			       (map[i].br_startblock != HOLESTARTBLOCK));
-			dblkno = XFS_FSB_TO_DADDR(mp, map[i].br_startblock);
-			dblkcnt = XFS_FSB_TO_BB(mp, map[i].br_blockcount);
-			error = xfs_trans_read_buf(mp, args->trans,
-						   mp->m_ddev_targp,
-						   dblkno, dblkcnt, 0, &bp,
-						   &xfs_attr3_rmt_buf_ops);
-			if (error)
-				return error;
-
-			error = xfs_attr_rmtval_copyout(mp, bp, args->dp->i_ino,
-							&offset, &valuelen,
-							&dst);
-			xfs_trans_brelse(args->trans, bp);
-			if (error)
-				return error;
+			bmap[i].bm_bn = XFS_FSB_TO_DADDR(mp,
+							 map[i].br_startblock);
+			bmap[i].bm_len = XFS_FSB_TO_BB(mp,
+						       map[i].br_blockcount);
 
 			/* roll attribute extent map forwards */
 			lblkno += map[i].br_blockcount;
 			blkcnt -= map[i].br_blockcount;
 		}
+
+		error = xfs_trans_read_buf_map(mp, args->trans,
+					       mp->m_ddev_targp, bmap, nmap, 0,
+					       &bp, &xfs_attr3_rmt_buf_ops);
+		if (error)
+			return error;
+
+		error = xfs_attr_rmtval_copyout(mp, bp, args->dp->i_ino,
+						&offset, &valuelen, &dst);
+		if (nmap > 1)
+			xfs_buf_set_ref(bp, 0);
+		xfs_trans_brelse(args->trans, bp);
+		if (error)
+			return error;
 	}
 	ASSERT(valuelen == 0);
 	return 0;
@@ -420,6 +453,8 @@ xfs_attr_rmtval_set(
 	struct xfs_inode	*dp = args->dp;
 	struct xfs_mount	*mp = dp->i_mount;
 	struct xfs_bmbt_irec	map;
+	struct xfs_bmbt_irec	wmap[ATTR_RMTVALUE_MAPSIZE];
+	struct xfs_buf_map	bmap[ATTR_RMTVALUE_MAPSIZE];
 	xfs_dablk_t		lblkno;
 	xfs_fileoff_t		lfileoff = 0;
 	uint8_t			*src = args->value;
@@ -493,33 +528,42 @@ xfs_attr_rmtval_set(
 	 * Roll through the "value", copying the attribute value to the
 	 * already-allocated blocks.  Blocks are written synchronously
 	 * so that we can know they are all on disk before we turn off
-	 * the INCOMPLETE flag.
+	 * the INCOMPLETE flag.  As on the read side, up to
+	 * ATTR_RMTVALUE_MAPSIZE extents go out in one compound buffer that
+	 * is dropped from the cache once written.
 	 */
 	lblkno = args->rmtblkno;
 	blkcnt = args->rmtblkcnt;
 	valuelen = args->rmtvaluelen;
 	while (valuelen > 0) {
 		struct xfs_buf	*bp;
-		xfs_daddr_t	dblkno;
-		int		dblkcnt;
+		int		i;
 
 		ASSERT(blkcnt > 0);
 
 		xfs_defer_init(args->dfops, args->firstblock);
-		nmap = 1;
+		nmap = ATTR_RMTVALUE_MAPSIZE;
 		error = xfs_bmapi_read(dp, (xfs_fileoff_t)lblkno,
-				       blkcnt, &map, &nmap,
+				       blkcnt, wmap, &nmap,
 				       XFS_BMAPI_ATTRFORK);
 		if (error)
 			return error;
-		ASSERT(nmap == 1);
-		ASSERT((map.br_startblock != DELAYSTARTBLOCK) &&
-		       (map.br_startblock != HOLESTARTBLOCK));
+		ASSERT(nmap >= 1);
 
-		dblkno = XFS_FSB_TO_DADDR(mp, map.br_startblock),
-		dblkcnt = XFS_FSB_TO_BB(mp, map.br_blockcount);
+		for (i = 0; i < nmap; i++) {
+			ASSERT((wmap[i].br_startblock != DELAYSTARTBLOCK) &&
+			       (wmap[i].br_startblock != HOLESTARTBLOCK));
+			bmap[i].bm_bn = XFS_FSB_TO_DADDR(mp,
+							 wmap[i].br_startblock);
+			bmap[i].bm_len = XFS_FSB_TO_BB(mp,
+						       wmap[i].br_blockcount);
 
-		bp = xfs_buf_get(mp->m_ddev_targp, dblkno, dblkcnt, 0);
+			/* roll attribute extent map forwards */
+			lblkno += wmap[i].br_blockcount;
+			blkcnt -= wmap[i].br_blockcount;
+		}
+
+		bp = xfs_buf_get_map(mp->m_ddev_targp, bmap, nmap, 0);
 		if (!bp)
 			return -ENOMEM;
 		bp->b_ops = &xfs_attr3_rmt_buf_ops;
@@ -528,14 +572,11 @@ xfs_attr_rmtval_set(
 				       &valuelen, &src);
 
 		error = xfs_bwrite(bp);	/* GROT: NOTE: synchronous write */
+		if (nmap > 1)
+			xfs_buf_set_ref(bp, 0);
 		xfs_buf_relse(bp);
 		if (error)
 			return error;
-
-
-		/* roll attribute extent map forwards */
-		lblkno += map.br_blockcount;
-		blkcnt -= map.br_blockcount;
 	}
 	ASSERT(valuelen == 0);
 	return 0;
@@ -179,6 +179,60 @@ xfs_bmbt_update(
 	return xfs_btree_update(cur, &rec);
 }
 
+/*
+ * Worst-case height of the data fork bmbt of ip if every block of its
+ * outstanding delalloc plus len more became an extent of its own.  Converting
+ * the inode's delalloc can't grow the tree beyond that, so there is no need to
+ * reserve for the filesystem-wide maximum height.
+ */
+STATIC int
+xfs_bmap_indlen_levels(
+	struct xfs_inode	*ip,
+	xfs_filblks_t		len)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	int			maxlevels = XFS_BM_MAXLEVELS(mp, XFS_DATA_FORK);
+	int			maxrootrecs;
+	int			level;
+	uint64_t		maxblocks;
+
+	maxrootrecs = xfs_bmdr_maxrecs(XFS_BMDR_SPACE_CALC(MINDBTPTRS), 0);
+	maxblocks = DIV_ROUND_UP_ULL((uint64_t)ip->i_d.di_nextents +
+			ip->i_delayed_blks + len, mp->m_bmap_dmnr[0]);
+	for (level = 1; maxblocks > 1 && level < maxlevels; level++) {
+		if (maxblocks <= maxrootrecs)
+			maxblocks = 1;
+		else
+			maxblocks = DIV_ROUND_UP_ULL(maxblocks,
+					mp->m_bmap_dmnr[1]);
+	}
+	return level;
+}
+
+/*
+ * Worst-case number of bmbt blocks on levels [lo, hi) for len new records.
+ */
+STATIC xfs_filblks_t
+xfs_bmap_indlen_range(
+	struct xfs_mount	*mp,
+	xfs_filblks_t		len,
+	int			lo,
+	int			hi)
+{
+	int			level;
+	int			maxrecs = mp->m_bmap_dmxr[0];
+	xfs_filblks_t		rval = 0;
+
+	for (level = 0; level < hi; level++) {
+		len += maxrecs - 1;
+		do_div(len, maxrecs);
+		if (level >= lo)
+			rval += len;
+		maxrecs = mp->m_bmap_dmxr[1];
+	}
+	return rval;
+}
+
 /*
  * Compute the worst-case number of indirect blocks that will be used
  * for ip's delayed extent of length "len".
@@ -188,40 +242,94 @@ xfs_bmap_worst_indlen(
 	xfs_inode_t	*ip,		/* incore inode pointer */
 	xfs_filblks_t	len)		/* delayed extent length */
 {
-	int		level;		/* btree level number */
-	int		maxrecs;	/* maximum record count at this level */
-	xfs_mount_t	*mp;		/* mount structure */
+	xfs_mount_t	*mp = ip->i_mount;
 	xfs_filblks_t	rval;		/* return value */
-	xfs_filblks_t   orig_len;
-
-	mp = ip->i_mount;
 
 	/* Calculate the worst-case size of the bmbt. */
-	orig_len = len;
-	maxrecs = mp->m_bmap_dmxr[0];
-	for (level = 0, rval = 0;
-	     level < XFS_BM_MAXLEVELS(mp, XFS_DATA_FORK);
-	     level++) {
-		len += maxrecs - 1;
-		do_div(len, maxrecs);
-		rval += len;
-		if (len == 1) {
-			rval += XFS_BM_MAXLEVELS(mp, XFS_DATA_FORK) -
-				level - 1;
-			break;
-		}
-		if (level == 0)
-			maxrecs = mp->m_bmap_dmxr[1];
-	}
+	rval = xfs_bmap_indlen_range(mp, len, 0,
+			xfs_bmap_indlen_levels(ip, len));
 
 	/* Calculate the worst-case size of the rmapbt. */
 	if (xfs_sb_version_hasrmapbt(&mp->m_sb))
-		rval += 1 + xfs_rmapbt_calc_size(mp, orig_len) +
+		rval += 1 + xfs_rmapbt_calc_size(mp, len) +
 				mp->m_rmap_maxlevels;
 
 	return rval;
 }
 
+/*
+ * Delalloc extents reserve indirect blocks for the tree height their inode
+ * could reach at the time.  If a later reservation raises that height, the
+ * conversion of an older extent may need blocks on the new levels as well.
+ * Instead of resizing every extent, reserve the new levels once for all of
+ * the outstanding delalloc blocks into a pool on the inode, which conversions
+ * draw on when they outgrow their own reservation.
+ */
+STATIC int
+xfs_bmap_indlen_pool_grow(
+	struct xfs_inode	*ip,
+	xfs_filblks_t		len)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_inode_io	*io = xfs_inode_io_get(ip);
+	int			levels = xfs_bmap_indlen_levels(ip, len);
+	xfs_filblks_t		need;
+	int			error;
+
+	if (levels <= io->iio_indlen_levels)
+		return 0;
+	if (ip->i_delayed_blks) {
+		need = xfs_bmap_indlen_range(mp, ip->i_delayed_blks,
+				io->iio_indlen_levels, levels);
+		error = xfs_mod_fdblocks(mp, -((int64_t)need), false);
+		if (error)
+			return error;
+		io->iio_indlen_pool += need;
+	}
+	io->iio_indlen_levels = levels;
+	return 0;
+}
+
+/*
+ * A conversion used more indirect blocks than its extent had reserved.  Take
+ * them from the inode pool, or from the reserve pool if a non-delalloc
+ * allocation grew the tree behind our back.
+ */
+STATIC void
+xfs_bmap_indlen_pool_take(
+	struct xfs_inode	*ip,
+	xfs_filblks_t		len)
+{
+	struct xfs_inode_io	*io = ip->i_io;
+	xfs_filblks_t		from_pool = 0;
+
+	if (io) {
+		from_pool = min(len, io->iio_indlen_pool);
+		io->iio_indlen_pool -= from_pool;
+	}
+	if (len > from_pool)
+		xfs_mod_fdblocks(ip->i_mount, -((int64_t)(len - from_pool)),
+				true);
+}
+
+/*
+ * Once the last delalloc block of the inode is gone, give the pool back.
+ */
+STATIC void
+xfs_bmap_indlen_pool_trim(
+	struct xfs_inode	*ip)
+{
+	struct xfs_inode_io	*io = ip->i_io;
+
+	if (ip->i_delayed_blks || !io)
+		return;
+	if (io->iio_indlen_pool)
+		xfs_mod_fdblocks(ip->i_mount, (int64_t)io->iio_indlen_pool,
+				false);
+	io->iio_indlen_pool = 0;
+	io->iio_indlen_levels = 0;
+}
+
 /*
  * Calculate the default attribute fork offset for newly created inodes.
  */
@@ -880,7 +988,7 @@ xfs_bmap_local_to_extents(
 	xfs_ifork_t	*ifp;		/* inode fork pointer */
 	xfs_alloc_arg_t	args;		/* allocation arguments */
 	xfs_buf_t	*bp;		/* buffer for extent block */
-	xfs_bmbt_rec_host_t *ep;	/* extent record pointer */
+	struct xfs_bmbt_irec rec;
 
 	/*
 	 * We don't want to deal with the case of keeping inode data inline yet.
@@ -898,8 +1006,7 @@ xfs_bmap_local_to_extents(
 
 	flags = 0;
 	error = 0;
-	ASSERT((ifp->if_flags & (XFS_IFINLINE|XFS_IFEXTENTS|XFS_IFEXTIREC)) ==
-								XFS_IFINLINE);
+	ASSERT((ifp->if_flags & (XFS_IFINLINE|XFS_IFEXTENTS)) == XFS_IFINLINE);
 	memset(&args, 0, sizeof(args));
 	args.tp = tp;
 	args.mp = ip->i_mount;
@@ -943,12 +1050,12 @@ xfs_bmap_local_to_extents(
 	xfs_bmap_local_to_extents_empty(ip, whichfork);
 	flags |= XFS_ILOG_CORE;
 
-	xfs_iext_add(ifp, 0, 1);
-	ep = xfs_iext_get_ext(ifp, 0);
-	xfs_bmbt_set_allf(ep, 0, args.fsbno, 1, XFS_EXT_NORM);
-	trace_xfs_bmap_post_update(ip, 0,
-			whichfork == XFS_ATTR_FORK ? BMAP_ATTRFORK : 0,
-			_THIS_IP_);
+	rec.br_startoff = 0;
+	rec.br_startblock = args.fsbno;
+	rec.br_blockcount = 1;
+	rec.br_state = XFS_EXT_NORM;
+	xfs_iext_insert(ip, 0, 1, &rec,
+			whichfork == XFS_ATTR_FORK ? BMAP_ATTRFORK : 0);
 	XFS_IFORK_NEXT_SET(ip, whichfork, 1);
 	ip->i_d.di_nblocks = 1;
 	xfs_trans_mod_dquot_byino(tp, ip,
@@ -1216,7 +1323,7 @@ xfs_bmap_add_attrfork(
  */
 
 /*
- * Read in the extents to if_extents.
+ * Read in the extents to the in-core extent tree.
  * All inode fields are set up by caller, we just traverse the btree
  * and copy the records in. If the file system cannot contain unwritten
  * extents, the records are checked for no "state" flags.
@@ -1236,7 +1343,6 @@ xfs_bmap_read_extents(
 	int			level;	/* btree level, for checking */
 	xfs_mount_t		*mp;	/* file system mount structure */
 	__be64			*pp;	/* pointer to block address */
-	/* REFERENCED */
 	xfs_extnum_t		room;	/* number of entries there's room for */
 
 	mp = ip->i_mount;
@@ -1271,7 +1377,7 @@ xfs_bmap_read_extents(
 	/*
 	 * Here with bp and block set to the leftmost leaf node in the tree.
 	 */
-	room = xfs_iext_count(ifp);
+	room = XFS_IFORK_NEXTENTS(ip, whichfork);
 	i = 0;
 	/*
 	 * Loop over all leaf nodes.  Copy information to the extent records.
@@ -1303,14 +1409,16 @@ xfs_bmap_read_extents(
 		 */
 		frp = XFS_BMBT_REC_ADDR(mp, block, 1);
 		for (j = 0; j < num_recs; j++, i++, frp++) {
-			xfs_bmbt_rec_host_t *trp = xfs_iext_get_ext(ifp, i);
-			trp->l0 = be64_to_cpu(frp->l0);
-			trp->l1 = be64_to_cpu(frp->l1);
-			if (!xfs_bmbt_validate_extent(mp, whichfork, trp)) {
+			xfs_bmbt_rec_host_t rec;
+
+			rec.l0 = be64_to_cpu(frp->l0);
+			rec.l1 = be64_to_cpu(frp->l1);
+			if (!xfs_bmbt_validate_extent(mp, whichfork, &rec)) {
 				XFS_ERROR_REPORT("xfs_bmap_read_extents(2)",
 						 XFS_ERRLEVEL_LOW, mp);
 				goto error0;
 			}
+			xfs_iext_insert_rec(ifp, i, &rec);
 		}
 		xfs_trans_brelse(tp, bp);
 		bno = nextbno;
@@ -1615,6 +1723,7 @@ xfs_bmap_add_extent_delay_real(
 	       (bma->cur->bc_private.b.flags & XFS_BTCUR_BPRV_WASDEL));
 
 	XFS_STATS_INC(mp, xs_add_exlist);
+	xfs_iext_bump_seq(ifp);
 
 #define	LEFT		r[0]
 #define	RIGHT		r[1]
@@ -1841,6 +1950,7 @@ xfs_bmap_add_extent_delay_real(
 			LEFT.br_blockcount + new->br_blockcount);
 		xfs_bmbt_set_startoff(ep,
 			PREV.br_startoff + new->br_blockcount);
+		xfs_iext_update_key(ifp, bma->idx);
 		trace_xfs_bmap_post_update(bma->ip, bma->idx - 1, state, _THIS_IP_);
 
 		temp = PREV.br_blockcount - new->br_blockcount;
@@ -1879,6 +1989,7 @@ xfs_bmap_add_extent_delay_real(
 		 */
 		trace_xfs_bmap_pre_update(bma->ip, bma->idx, state, _THIS_IP_);
 		xfs_bmbt_set_startoff(ep, new_endoff);
+		xfs_iext_update_key(ifp, bma->idx);
 		temp = PREV.br_blockcount - new->br_blockcount;
 		xfs_bmbt_set_blockcount(ep, temp);
 		xfs_iext_insert(bma->ip, bma->idx, 1, new, state);
@@ -1928,6 +2039,7 @@ xfs_bmap_add_extent_delay_real(
 			new->br_startoff, new->br_startblock,
 			new->br_blockcount + RIGHT.br_blockcount,
 			RIGHT.br_state);
+		xfs_iext_update_key(ifp, bma->idx + 1);
 		trace_xfs_bmap_post_update(bma->ip, bma->idx + 1, state, _THIS_IP_);
 		if (bma->cur == NULL)
 			rval = XFS_ILOG_DEXT;
@@ -2126,6 +2238,9 @@ xfs_bmap_add_extent_delay_real(
 		if (temp < da_old)
 			xfs_mod_fdblocks(bma->ip->i_mount,
 					(int64_t)(da_old - temp), false);
+		else if (temp > da_old)
+			xfs_bmap_indlen_pool_take(bma->ip, temp - da_old);
+		xfs_bmap_indlen_pool_trim(bma->ip);
 	}
 
 	/* clear out the allocated field, done with it now in any case. */
@@ -2183,6 +2298,7 @@ xfs_bmap_add_extent_unwritten_real(
 	ASSERT(!isnullstartblock(new->br_startblock));
 
 	XFS_STATS_INC(mp, xs_add_exlist);
+	xfs_iext_bump_seq(ifp);
 
 #define	LEFT		r[0]
 #define	RIGHT		r[1]
@@ -2416,6 +2532,7 @@ xfs_bmap_add_extent_unwritten_real(
 			LEFT.br_blockcount + new->br_blockcount);
 		xfs_bmbt_set_startoff(ep,
 			PREV.br_startoff + new->br_blockcount);
+		xfs_iext_update_key(ifp, *idx);
 		trace_xfs_bmap_post_update(ip, *idx - 1, state, _THIS_IP_);
 
 		trace_xfs_bmap_pre_update(ip, *idx, state, _THIS_IP_);
@@ -2461,6 +2578,7 @@ xfs_bmap_add_extent_unwritten_real(
 		trace_xfs_bmap_pre_update(ip, *idx, state, _THIS_IP_);
 		ASSERT(ep && xfs_bmbt_get_state(ep) == oldext);
 		xfs_bmbt_set_startoff(ep, new_endoff);
+		xfs_iext_update_key(ifp, *idx);
 		xfs_bmbt_set_blockcount(ep,
 			PREV.br_blockcount - new->br_blockcount);
 		xfs_bmbt_set_startblock(ep,
@@ -2508,6 +2626,7 @@ xfs_bmap_add_extent_unwritten_real(
 		xfs_bmbt_set_allf(xfs_iext_get_ext(ifp, *idx),
 			new->br_startoff, new->br_startblock,
 			new->br_blockcount + RIGHT.br_blockcount, newext);
+		xfs_iext_update_key(ifp, *idx);
 		trace_xfs_bmap_post_update(ip, *idx, state, _THIS_IP_);
 
 		if (cur == NULL)
@@ -2705,6 +2824,7 @@ xfs_bmap_add_extent_hole_delay(
 	if (whichfork == XFS_COW_FORK)
 		state |= BMAP_COWFORK;
 	ASSERT(isnullstartblock(new->br_startblock));
+	xfs_iext_bump_seq(ifp);
 
 	/*
 	 * Check and set flags if this segment has a left neighbor
@@ -2809,6 +2929,7 @@ xfs_bmap_add_extent_hole_delay(
 		xfs_bmbt_set_allf(xfs_iext_get_ext(ifp, *idx),
 			new->br_startoff,
 			nullstartblock((int)newlen), temp, right.br_state);
+		xfs_iext_update_key(ifp, *idx);
 		trace_xfs_bmap_post_update(ip, *idx, state, _THIS_IP_);
 		break;
 
@@ -2863,6 +2984,7 @@ xfs_bmap_add_extent_hole_real(
 	ASSERT(!cur || !(cur->bc_private.b.flags & XFS_BTCUR_BPRV_WASDEL));
 
 	XFS_STATS_INC(mp, xs_add_exlist);
+	xfs_iext_bump_seq(ifp);
 
 	state = 0;
 	if (whichfork == XFS_ATTR_FORK)
@@ -3006,6 +3128,7 @@ xfs_bmap_add_extent_hole_real(
 			new->br_startoff, new->br_startblock,
 			new->br_blockcount + right.br_blockcount,
 			right.br_state);
+		xfs_iext_update_key(ifp, *idx);
 		trace_xfs_bmap_post_update(ip, *idx, state, _THIS_IP_);
 
 		if (cur == NULL) {
@@ -3576,6 +3699,7 @@ xfs_bmap_btalloc(
 	int		tryagain;
 	int		error;
 	int		stripe_align;
+	xfs_extlen_t	dax_align = 0;
 
 	ASSERT(ap->length);
 
@@ -3590,8 +3714,19 @@ xfs_bmap_btalloc(
 
 	if (ap->flags & XFS_BMAPI_COWFORK)
 		align = xfs_get_cowextsz_hint(ap->ip);
-	else if (xfs_alloc_is_userdata(ap->datatype))
+	else if (xfs_alloc_is_userdata(ap->datatype)) {
 		align = xfs_get_extsz_hint(ap->ip);
+
+		/*
+		 * DAX files need PMD aligned blocks to be mapped with huge
+		 * pages, which matters more to them than stripe alignment.
+		 */
+		dax_align = xfs_get_dax_align(ap->ip);
+		if (dax_align) {
+			align = max(align, dax_align);
+			stripe_align = dax_align;
+		}
+	}
 	if (align) {
 		error = xfs_bmap_extsize_align(mp, &ap->got, &ap->prev,
 						align, 0, ap->eof, 0, ap->conv,
@@ -3723,6 +3858,25 @@ xfs_bmap_btalloc(
 			else
 				args.minalignslop = 0;
 		}
+	} else if (dax_align && !ap->dfops->dop_low) {
+		/* Try for an aligned extent first, then take anything. */
+		atype = args.type;
+		isaligned = 1;
+		args.alignment = dax_align;
+		args.minalignslop = 0;
+	} else if (ap->wasdel && stripe_align && !ap->dfops->dop_low &&
+		   (mp->m_flags & XFS_MOUNT_SWALLOC) &&
+		   ap->length >= stripe_align &&
+		   !do_mod(ap->offset, stripe_align)) {
+		/*
+		 * Delalloc conversion of a stripe aligned range inside the
+		 * file.  Line it up with a stripe too, so that writing back
+		 * the stripe doesn't cost a read-modify-write in the array.
+		 */
+		atype = args.type;
+		isaligned = 1;
+		args.alignment = stripe_align;
+		args.minalignslop = 0;
 	} else {
 		args.alignment = 1;
 		args.minalignslop = 0;
@@ -4151,6 +4305,9 @@ xfs_bmapi_reserve_delalloc(
 	if (error)
 		goto out_unreserve_blocks;
 
+	error = xfs_bmap_indlen_pool_grow(ip, alen);
+	if (error)
+		goto out_unreserve_indlen;
 
 	ip->i_delayed_blks += alen;
 
@@ -4173,6 +4330,8 @@ xfs_bmapi_reserve_delalloc(
 
 	return 0;
 
+out_unreserve_indlen:
+	xfs_mod_fdblocks(mp, indlen, false);
 out_unreserve_blocks:
 	if (rt)
 		xfs_mod_frextents(mp, extsz);
@@ -4872,6 +5031,7 @@ xfs_bmap_del_extent_delay(
 	ASSERT(del->br_blockcount > 0);
 	ASSERT(got->br_startoff <= del->br_startoff);
 	ASSERT(got_endoff >= del_endoff);
+	xfs_iext_bump_seq(ifp);
 
 	if (isrt) {
 		uint64_t rtexts = XFS_FSB_TO_B(mp, del->br_blockcount);
@@ -4891,6 +5051,7 @@ xfs_bmap_del_extent_delay(
 	if (error)
 		return error;
 	ip->i_delayed_blks -= del->br_blockcount;
+	xfs_bmap_indlen_pool_trim(ip);
 
 	if (whichfork == XFS_COW_FORK)
 		state |= BMAP_COWFORK;
@@ -4919,6 +5080,7 @@ xfs_bmap_del_extent_delay(
 				got->br_blockcount), da_old);
 		got->br_startblock = nullstartblock((int)da_new);
 		xfs_bmbt_set_all(xfs_iext_get_ext(ifp, *idx), got);
+		xfs_iext_update_key(ifp, *idx);
 		trace_xfs_bmap_post_update(ip, *idx, state, _THIS_IP_);
 		break;
 	case BMAP_RIGHT_CONTIG:
@@ -5027,6 +5189,7 @@ xfs_bmap_del_extent_cow(
 		got->br_blockcount -= del->br_blockcount;
 		got->br_startblock = del->br_startblock + del->br_blockcount;
 		xfs_bmbt_set_all(xfs_iext_get_ext(ifp, *idx), got);
+		xfs_iext_update_key(ifp, *idx);
 		trace_xfs_bmap_post_update(ip, *idx, state, _THIS_IP_);
 		break;
 	case BMAP_RIGHT_CONTIG:
@@ -5107,6 +5270,7 @@ xfs_bmap_del_extent(
 	ifp = XFS_IFORK_PTR(ip, whichfork);
 	ASSERT((*idx >= 0) && (*idx < xfs_iext_count(ifp)));
 	ASSERT(del->br_blockcount > 0);
+	xfs_iext_bump_seq(ifp);
 	ep = xfs_iext_get_ext(ifp, *idx);
 	xfs_bmbt_get_all(ep, &got);
 	ASSERT(got.br_startoff <= del->br_startoff);
@@ -5207,6 +5371,7 @@ xfs_bmap_del_extent(
 		 */
 		trace_xfs_bmap_pre_update(ip, *idx, state, _THIS_IP_);
 		xfs_bmbt_set_startoff(ep, del_endoff);
+		xfs_iext_update_key(ifp, *idx);
 		temp = got.br_blockcount - del->br_blockcount;
 		xfs_bmbt_set_blockcount(ep, temp);
 		if (delay) {
@@ -5798,6 +5963,7 @@ __xfs_bunmapi(
 		xfs_btree_del_cursor(cur,
 			error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
 	}
+	xfs_bmap_indlen_pool_trim(ip);
 	return error;
 }
 
@@ -5956,6 +6122,7 @@ xfs_bmse_shift_one(
 	mp = ip->i_mount;
 	ifp = XFS_IFORK_PTR(ip, whichfork);
 	total_extents = xfs_iext_count(ifp);
+	xfs_iext_bump_seq(ifp);
 
 	xfs_bmbt_get_all(gotp, &got);
 
@@ -6026,11 +6193,12 @@ xfs_bmse_shift_one(
 	 * offset of the in-core extent and update the btree if applicable.
 	 */
 update_current_ext:
+	xfs_bmbt_set_startoff(gotp, startoff);
+	xfs_iext_update_key(ifp, *current_ext);
 	if (direction == SHIFT_LEFT)
 		(*current_ext)++;
 	else
 		(*current_ext)--;
-	xfs_bmbt_set_startoff(gotp, startoff);
 	*logflags |= XFS_ILOG_CORE;
 	adj_irec = got;
 	if (!cur) {
@@ -6059,6 +6227,27 @@ xfs_bmse_shift_one(
 	return xfs_rmap_map_extent(mp, dfops, ip, whichfork, &adj_irec);
 }
 
+/*
+ * Can the next extent be shifted in the same transaction as the one just
+ * shifted?  Only if its bmbt record is in the same leaf block, which the
+ * cursor still points into after the last update.
+ */
+STATIC bool
+xfs_bmse_same_leaf(
+	struct xfs_btree_cur	*cur,
+	enum shift_direction	direction)
+{
+	struct xfs_btree_block	*block;
+	struct xfs_buf		*bp;
+
+	if (!cur)
+		return true;
+	block = xfs_btree_get_block(cur, 0, &bp);
+	if (direction == SHIFT_LEFT)
+		return cur->bc_ptrs[0] < xfs_btree_get_numrecs(block);
+	return cur->bc_ptrs[0] > 1;
+}
+
 /*
  * Shift extent records to the left/right to cover/create a hole.
  *
@@ -6094,6 +6283,7 @@ xfs_bmap_shift_extents(
 	int				error = 0;
 	int				whichfork = XFS_DATA_FORK;
 	int				logflags = 0;
+	bool				merged;
 
 	if (unlikely(XFS_TEST_ERROR(
 	    (XFS_IFORK_FORMAT(ip, whichfork) != XFS_DINODE_FMT_EXTENTS &&
@@ -6191,7 +6381,9 @@ xfs_bmap_shift_extents(
 		 * If there was an extent merge during the shift, the extent
 		 * count can change. Update the total and grade the next record.
 		 */
+		merged = false;
 		if (direction == SHIFT_LEFT) {
+			merged = xfs_iext_count(ifp) != total_extents;
 			total_extents = xfs_iext_count(ifp);
 			stop_extent = total_extents;
 		}
@@ -6202,6 +6394,14 @@ xfs_bmap_shift_extents(
 			break;
 		}
 		gotp = xfs_iext_get_ext(ifp, current_ext);
+
+		/*
+		 * A merge deletes a bmbt record and may have rebalanced the
+		 * tree, and a record in another leaf needs log space we
+		 * haven't reserved.  Either way, finish this transaction.
+		 */
+		if (merged || !xfs_bmse_same_leaf(cur, direction))
+			break;
 	}
 
 	if (!*done) {
@@ -192,6 +192,16 @@ static inline bool xfs_bmap_is_real_extent(struct xfs_bmbt_irec *irec)
  */
 #define XFS_BMAP_MAX_SHIFT_EXTENTS	1
 
+/*
+ * Shifts that don't merge can be batched as long as every record touched
+ * lives in the same bmbt leaf, since the write reservation covers logging one
+ * full bmbt path.  With rmap each shift also queues an unmap and a map
+ * intent, so keep the batch small enough that they fit in one RUI (16
+ * extents).
+ */
+#define XFS_BMAP_MAX_SHIFT_BATCH	256
+#define XFS_BMAP_MAX_SHIFT_RMAP		8
+
 enum shift_direction {
 	SHIFT_LEFT = 0,
 	SHIFT_RIGHT,
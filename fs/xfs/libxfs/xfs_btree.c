@@ -1550,6 +1550,51 @@ xfs_btree_log_block(
 	XFS_BTREE_TRACE_CURSOR(cur, XBT_EXIT);
 }
 
+/*
+ * Once a cursor has stepped forwards through this many leaves in a row, start
+ * reading ahead the next XFS_BTREE_RA_LEAVES leaves as well as the right
+ * sibling.
+ */
+#define XFS_BTREE_SEQ_LEAVES	2
+#define XFS_BTREE_RA_LEAVES	8
+
+/*
+ * The cursor has just moved on to the next leaf.  If it has been walking
+ * forwards for a while, read ahead the leaves after the right sibling using
+ * the pointers in the parent node.  bc_ra_next remembers how far we got in
+ * the parent, so each leaf is only read ahead once.
+ */
+STATIC void
+xfs_btree_readahead_leaves(
+	struct xfs_btree_cur	*cur,
+	bool			new_parent)
+{
+	struct xfs_btree_block	*block;
+	struct xfs_buf		*bp;
+	int			numrecs;
+	int			last;
+	int			i;
+
+	if (new_parent)
+		cur->bc_ra_next = 0;
+	if (cur->bc_seq_leaves < XFS_BTREE_SEQ_LEAVES) {
+		cur->bc_seq_leaves++;
+		return;
+	}
+	if (cur->bc_nlevels < 2)
+		return;
+
+	block = xfs_btree_get_block(cur, 1, &bp);
+	numrecs = xfs_btree_get_numrecs(block);
+	last = min(cur->bc_ptrs[1] + 1 + XFS_BTREE_RA_LEAVES, numrecs);
+
+	/* The right sibling is read ahead by xfs_btree_increment. */
+	for (i = max(cur->bc_ra_next, cur->bc_ptrs[1] + 2); i <= last; i++)
+		xfs_btree_readahead_ptr(cur, xfs_btree_ptr_addr(cur, i, block),
+				1);
+	cur->bc_ra_next = max(cur->bc_ra_next, last + 1);
+}
+
 /*
  * Increment cursor by one record at the level.
  * For nonzero levels the leaf-ward information is untouched.
@@ -1565,6 +1610,7 @@ xfs_btree_increment(
 	struct xfs_buf		*bp;
 	int			error;		/* error return value */
 	int			lev;
+	int			top;		/* highest level changed */
 
 	XFS_BTREE_TRACE_CURSOR(cur, XBT_ENTRY);
 	XFS_BTREE_TRACE_ARGI(cur, level);
@@ -1626,6 +1672,7 @@ xfs_btree_increment(
 		goto error0;
 	}
 	ASSERT(lev < cur->bc_nlevels);
+	top = lev;
 
 	/*
 	 * Now walk back down the tree, fixing up the cursor's buffer
@@ -1643,6 +1690,8 @@ xfs_btree_increment(
 		xfs_btree_setbuf(cur, lev, bp);
 		cur->bc_ptrs[lev] = 1;
 	}
+	if (level == 0)
+		xfs_btree_readahead_leaves(cur, top > 1);
 out1:
 	XFS_BTREE_TRACE_CURSOR(cur, XBT_EXIT);
 	*stat = 1;
@@ -1679,6 +1728,8 @@ xfs_btree_decrement(
 
 	ASSERT(level < cur->bc_nlevels);
 
+	cur->bc_seq_leaves = 0;
+
 	/* Read-ahead to the left at this level. */
 	xfs_btree_readahead(cur, level, XFS_BTCUR_LEFTRA);
 
@@ -1864,6 +1915,8 @@ xfs_btree_lookup(
 
 	block = NULL;
 	keyno = 0;
+	cur->bc_seq_leaves = 0;
+	cur->bc_ra_next = 0;
 
 	/* initialise start pointer from cursor */
 	cur->bc_ops->init_ptr_from_cur(cur, &ptr);
@@ -2906,10 +2959,30 @@ xfs_btree_split_worker(
 	current_restore_flags_nested(&pflags, new_pflags);
 }
 
+/*
+ * A BMBT split allocates a block, which can in turn split the free space and
+ * rmap btrees, all on top of whatever stack the caller already used.  Only
+ * hand that off to the worker when the caller has actually used up a good
+ * part of its stack; the hop costs two context switches right in the middle
+ * of the allocation.
+ */
+static inline bool
+xfs_btree_split_needs_stack(void)
+{
+#ifdef CONFIG_STACK_GROWSUP
+	return true;
+#else
+	unsigned long		sp = (unsigned long)&sp;
+
+	return sp - (unsigned long)task_stack_page(current) < THREAD_SIZE / 2;
+#endif
+}
+
 /*
  * BMBT split requests often come in with little stack to work on. Push
  * them off to a worker thread so there is lots of stack to use. For the other
- * btree types, just call directly to avoid the context switch overhead here.
+ * btree types, and for BMBT splits that still have plenty of stack left, just
+ * call directly to avoid the context switch overhead here.
  */
 STATIC int					/* error */
 xfs_btree_split(
@@ -2923,7 +2996,7 @@ xfs_btree_split(
 	struct xfs_btree_split_args	args;
 	DECLARE_COMPLETION_ONSTACK(done);
 
-	if (cur->bc_btnum != XFS_BTNUM_BMAP)
+	if (cur->bc_btnum != XFS_BTNUM_BMAP || !xfs_btree_split_needs_stack())
 		return __xfs_btree_split(cur, level, ptrp, key, curp, stat);
 
 	args.cur = cur;
@@ -4570,6 +4643,63 @@ xfs_btree_compute_maxlevels(
 	return level;
 }
 
+/*
+ * State of a range query.  Records are either handed to ->fn one at a time,
+ * or collected in ->recs and handed to ->batch_fn a leaf block at a time.
+ */
+struct xfs_btree_query {
+	xfs_btree_query_range_fn	fn;
+	xfs_btree_query_batch_fn	batch_fn;
+	void				*priv;
+	union xfs_btree_rec		**recs;
+	int				nr;
+};
+
+/* Pass a record that matched the query to the caller, or queue it. */
+static inline int
+xfs_btree_query_emit(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_query		*q,
+	union xfs_btree_rec		*recp)
+{
+	if (!q->batch_fn)
+		return q->fn(cur, recp, q->priv);
+	q->recs[q->nr++] = recp;
+	return 0;
+}
+
+/*
+ * Hand the queued records to the caller.  This must be done before the
+ * cursor leaves the leaf block they point into.
+ */
+STATIC int
+xfs_btree_query_flush(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_query		*q)
+{
+	int				nr = q->nr;
+
+	if (!nr)
+		return 0;
+	q->nr = 0;
+	return q->batch_fn(cur, q->recs, nr, q->priv);
+}
+
+/* Hand over the queued records if the scan is about to leave the leaf. */
+STATIC int
+xfs_btree_query_leaf_done(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_query		*q)
+{
+	struct xfs_btree_block		*block;
+	struct xfs_buf			*bp;
+
+	block = xfs_btree_get_block(cur, 0, &bp);
+	if (cur->bc_ptrs[0] < xfs_btree_get_numrecs(block))
+		return 0;
+	return xfs_btree_query_flush(cur, q);
+}
+
 /*
  * Query a regular btree for all records overlapping a given interval.
  * Start with a LE lookup of the key of low_rec and return all records
@@ -4580,8 +4710,7 @@ xfs_btree_simple_query_range(
 	struct xfs_btree_cur		*cur,
 	union xfs_btree_key		*low_key,
 	union xfs_btree_key		*high_key,
-	xfs_btree_query_range_fn	fn,
-	void				*priv)
+	struct xfs_btree_query		*q)
 {
 	union xfs_btree_rec		*recp;
 	union xfs_btree_key		rec_key;
@@ -4632,18 +4761,25 @@ xfs_btree_simple_query_range(
 			break;
 
 		/* Callback */
-		error = fn(cur, recp, priv);
+		error = xfs_btree_query_emit(cur, q, recp);
 		if (error < 0 || error == XFS_BTREE_QUERY_RANGE_ABORT)
 			break;
 
 advloop:
+		error = xfs_btree_query_leaf_done(cur, q);
+		if (error < 0 || error == XFS_BTREE_QUERY_RANGE_ABORT)
+			break;
+
 		/* Move on to the next record. */
 		error = xfs_btree_increment(cur, 0, &stat);
 		if (error)
 			break;
 	}
 
+	if (!error)
+		error = xfs_btree_query_flush(cur, q);
 out:
+	q->nr = 0;
 	return error;
 }
 
@@ -4671,8 +4807,7 @@ xfs_btree_overlapped_query_range(
 	struct xfs_btree_cur		*cur,
 	union xfs_btree_key		*low_key,
 	union xfs_btree_key		*high_key,
-	xfs_btree_query_range_fn	fn,
-	void				*priv)
+	struct xfs_btree_query		*q)
 {
 	union xfs_btree_ptr		ptr;
 	union xfs_btree_ptr		*pp;
@@ -4710,6 +4845,12 @@ xfs_btree_overlapped_query_range(
 		/* End of node, pop back towards the root. */
 		if (cur->bc_ptrs[level] > be16_to_cpu(block->bb_numrecs)) {
 pop_up:
+			if (level == 0) {
+				error = xfs_btree_query_flush(cur, q);
+				if (error < 0 ||
+				    error == XFS_BTREE_QUERY_RANGE_ABORT)
+					break;
+			}
 			if (level < cur->bc_nlevels - 1)
 				cur->bc_ptrs[level + 1]++;
 			level++;
@@ -4734,7 +4875,7 @@ xfs_btree_overlapped_query_range(
 			 * this record overlaps the query range; callback.
 			 */
 			if (ldiff >= 0 && hdiff >= 0) {
-				error = fn(cur, recp, priv);
+				error = xfs_btree_query_emit(cur, q, recp);
 				if (error < 0 ||
 				    error == XFS_BTREE_QUERY_RANGE_ABORT)
 					break;
@@ -4800,23 +4941,16 @@ xfs_btree_overlapped_query_range(
 		}
 	}
 
+	q->nr = 0;
 	return error;
 }
 
-/*
- * Query a btree for all records overlapping a given interval of keys.  The
- * supplied function will be called with each record found; return one of the
- * XFS_BTREE_QUERY_RANGE_{CONTINUE,ABORT} values or the usual negative error
- * code.  This function returns XFS_BTREE_QUERY_RANGE_ABORT, zero, or a
- * negative error code.
- */
-int
-xfs_btree_query_range(
+STATIC int
+__xfs_btree_query_range(
 	struct xfs_btree_cur		*cur,
 	union xfs_btree_irec		*low_rec,
 	union xfs_btree_irec		*high_rec,
-	xfs_btree_query_range_fn	fn,
-	void				*priv)
+	struct xfs_btree_query		*q)
 {
 	union xfs_btree_rec		rec;
 	union xfs_btree_key		low_key;
@@ -4837,17 +4971,14 @@ xfs_btree_query_range(
 
 	if (!(cur->bc_flags & XFS_BTREE_OVERLAPPING))
 		return xfs_btree_simple_query_range(cur, &low_key,
-				&high_key, fn, priv);
-	return xfs_btree_overlapped_query_range(cur, &low_key, &high_key,
-			fn, priv);
+				&high_key, q);
+	return xfs_btree_overlapped_query_range(cur, &low_key, &high_key, q);
 }
 
-/* Query a btree for all records. */
-int
-xfs_btree_query_all(
+STATIC int
+__xfs_btree_query_all(
 	struct xfs_btree_cur		*cur,
-	xfs_btree_query_range_fn	fn,
-	void				*priv)
+	struct xfs_btree_query		*q)
 {
 	union xfs_btree_key		low_key;
 	union xfs_btree_key		high_key;
@@ -4856,7 +4987,101 @@ xfs_btree_query_all(
 	memset(&low_key, 0, sizeof(low_key));
 	memset(&high_key, 0xFF, sizeof(high_key));
 
-	return xfs_btree_simple_query_range(cur, &low_key, &high_key, fn, priv);
+	return xfs_btree_simple_query_range(cur, &low_key, &high_key, q);
+}
+
+/*
+ * Query a btree for all records overlapping a given interval of keys.  The
+ * supplied function will be called with each record found; return one of the
+ * XFS_BTREE_QUERY_RANGE_{CONTINUE,ABORT} values or the usual negative error
+ * code.  This function returns XFS_BTREE_QUERY_RANGE_ABORT, zero, or a
+ * negative error code.
+ */
+int
+xfs_btree_query_range(
+	struct xfs_btree_cur		*cur,
+	union xfs_btree_irec		*low_rec,
+	union xfs_btree_irec		*high_rec,
+	xfs_btree_query_range_fn	fn,
+	void				*priv)
+{
+	struct xfs_btree_query		q = {
+		.fn			= fn,
+		.priv			= priv,
+	};
+
+	return __xfs_btree_query_range(cur, low_rec, high_rec, &q);
+}
+
+/* Query a btree for all records. */
+int
+xfs_btree_query_all(
+	struct xfs_btree_cur		*cur,
+	xfs_btree_query_range_fn	fn,
+	void				*priv)
+{
+	struct xfs_btree_query		q = {
+		.fn			= fn,
+		.priv			= priv,
+	};
+
+	return __xfs_btree_query_all(cur, &q);
+}
+
+/*
+ * Set up a batched query.  The record array has to hold a full leaf block.
+ */
+STATIC void
+xfs_btree_query_batch_init(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_query		*q,
+	xfs_btree_query_batch_fn	fn,
+	void				*priv)
+{
+	memset(q, 0, sizeof(*q));
+	q->batch_fn = fn;
+	q->priv = priv;
+	q->recs = kmem_alloc(cur->bc_ops->get_maxrecs(cur, 0) *
+			sizeof(union xfs_btree_rec *), KM_SLEEP | KM_NOFS);
+}
+
+/*
+ * Batched versions of xfs_btree_query_range and xfs_btree_query_all.  The
+ * supplied function is called with an array of the matching records from
+ * one leaf block at a time instead of once per record, and has the same
+ * return conventions as the unbatched callbacks.  The records point into the
+ * leaf block and are only valid for the duration of the call.
+ */
+int
+xfs_btree_query_range_batch(
+	struct xfs_btree_cur		*cur,
+	union xfs_btree_irec		*low_rec,
+	union xfs_btree_irec		*high_rec,
+	xfs_btree_query_batch_fn	fn,
+	void				*priv)
+{
+	struct xfs_btree_query		q;
+	int				error;
+
+	xfs_btree_query_batch_init(cur, &q, fn, priv);
+	error = __xfs_btree_query_range(cur, low_rec, high_rec, &q);
+	kmem_free(q.recs);
+	return error;
+}
+
+int
+xfs_btree_query_all_batch(
+	struct xfs_btree_cur		*cur,
+	xfs_btree_query_batch_fn	fn,
+	void				*priv)
+{
+	struct xfs_btree_query		q;
+	int				error;
+
+	xfs_btree_query_batch_init(cur, &q, fn, priv);
+	error = __xfs_btree_query_all(cur, &q);
+	kmem_free(q.recs);
+	return error;
 }
 
 /*
@@ -4946,3 +5171,358 @@ xfs_btree_has_record(
 
 	return 0;
 }
+
+/*
+ * Bulk loading of btrees.
+ *
+ * Given a stream of records in key order, write a new btree bottom-up without
+ * going through xfs_btree_insert.  Every level is filled to the same target
+ * occupancy, so the result is a perfectly packed btree whose blocks are all
+ * within the minrecs/maxrecs limits.  Blocks are written straight to disk
+ * outside of the log; the caller points the AG header or inode fork at the
+ * new root only once xfs_btree_bload has returned, at which point all of the
+ * blocks are on disk.
+ */
+
+struct xfs_btree_bload_geo {
+	uint64_t		nr_blocks;	/* blocks at this level */
+	unsigned int		recs_per_block;	/* entries in each block */
+	unsigned int		nr_extra;	/* blocks with one more entry */
+};
+
+struct xfs_btree_bload_level {
+	struct xfs_buf		*bp;		/* current block's buffer */
+	struct xfs_btree_block	*block;		/* current block */
+	union xfs_btree_ptr	ptr;		/* current block's address */
+	uint64_t		blkidx;		/* blocks started so far */
+	unsigned int		cap;		/* entries wanted in block */
+	unsigned int		nr;		/* entries in block */
+};
+
+struct xfs_btree_bload_ctx {
+	struct xfs_btree_bload_geo	geo[XFS_BTREE_MAXLEVELS];
+	struct xfs_btree_bload_level	lv[XFS_BTREE_MAXLEVELS];
+	struct list_head		buffers;
+};
+
+/* Work out how many entries we want in each block of a level. */
+STATIC unsigned int
+xfs_btree_bload_desired(
+	struct xfs_btree_cur	*cur,
+	struct xfs_btree_bload	*bbl,
+	int			level,
+	unsigned int		maxr)
+{
+	unsigned int		fill = level ? bbl->node_fill : bbl->leaf_fill;
+	unsigned int		minr = cur->bc_ops->get_minrecs(cur, level);
+	unsigned int		desired;
+
+	/* By default, leave blocks halfway between minrecs and maxrecs. */
+	if (fill == 0)
+		desired = (maxr + minr) / 2;
+	else
+		desired = maxr * min(fill, 100U) / 100;
+	return clamp(desired, max(minr, 1U), maxr);
+}
+
+/*
+ * Compute the shape of a btree holding nr_records records: the number of
+ * blocks at each level, how many entries go in each of them and the height.
+ */
+STATIC int
+xfs_btree_bload_geometry(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_bload		*bbl,
+	uint64_t			nr_records,
+	struct xfs_btree_bload_geo	*geo)
+{
+	uint64_t			nr = nr_records;
+	uint64_t			blocks;
+	uint64_t			per;
+	uint64_t			extra;
+	unsigned int			maxr;
+	unsigned int			desired;
+	int				level;
+
+	bbl->nr_records = nr_records;
+	bbl->nr_blocks = 0;
+
+	for (level = 0; level < XFS_BTREE_MAXLEVELS; level++) {
+		/*
+		 * Above the leaves, an inode-rooted btree stops as soon as
+		 * the level fits in the inode fork.
+		 */
+		if ((cur->bc_flags & XFS_BTREE_ROOT_IN_INODE) && level > 0) {
+			cur->bc_nlevels = level + 1;
+			maxr = cur->bc_ops->get_dmaxrecs(cur, level);
+			if (nr <= maxr) {
+				geo[level].nr_blocks = 0;
+				geo[level].recs_per_block = nr;
+				geo[level].nr_extra = 0;
+				bbl->btree_height = level + 1;
+				return 0;
+			}
+		}
+
+		cur->bc_nlevels = XFS_BTREE_MAXLEVELS;
+		maxr = cur->bc_ops->get_maxrecs(cur, level);
+		desired = xfs_btree_bload_desired(cur, bbl, level, maxr);
+
+		blocks = max_t(uint64_t, div64_u64(nr, desired), 1);
+		for (;;) {
+			per = div64_u64(nr, blocks);
+			extra = nr - per * blocks;
+			if (per + (extra ? 1 : 0) <= maxr)
+				break;
+			blocks++;
+		}
+
+		geo[level].nr_blocks = blocks;
+		geo[level].recs_per_block = per;
+		geo[level].nr_extra = extra;
+		bbl->nr_blocks += blocks;
+
+		if (blocks == 1 && !(cur->bc_flags & XFS_BTREE_ROOT_IN_INODE)) {
+			bbl->btree_height = level + 1;
+			return 0;
+		}
+		nr = blocks;
+	}
+
+	return -EOVERFLOW;
+}
+
+/*
+ * Work out how many blocks a bulk load of nr_records records will need and
+ * how tall the btree will be, so that the caller can reserve the space.
+ */
+int
+xfs_btree_bload_compute_geometry(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_bload		*bbl,
+	uint64_t			nr_records)
+{
+	struct xfs_btree_bload_geo	geo[XFS_BTREE_MAXLEVELS];
+
+	return xfs_btree_bload_geometry(cur, bbl, nr_records, geo);
+}
+
+/* Queue a finished block for writing and let go of it. */
+STATIC void
+xfs_btree_bload_drop_buf(
+	struct xfs_btree_bload_ctx	*ctx,
+	struct xfs_btree_bload_level	*lv)
+{
+	xfs_buf_delwri_queue(lv->bp, &ctx->buffers);
+	xfs_buf_relse(lv->bp);
+	lv->bp = NULL;
+}
+
+/* Start the next block of a level and link it to the previous one. */
+STATIC int
+xfs_btree_bload_new_block(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_bload		*bbl,
+	struct xfs_btree_bload_ctx	*ctx,
+	int				level,
+	void				*priv)
+{
+	struct xfs_btree_bload_geo	*geo = &ctx->geo[level];
+	struct xfs_btree_bload_level	*lv = &ctx->lv[level];
+	struct xfs_btree_block		*block;
+	struct xfs_buf			*bp;
+	union xfs_btree_ptr		ptr;
+	int				error;
+
+	/* The root of an inode-rooted btree lives in the fork. */
+	if (geo->nr_blocks == 0) {
+		struct xfs_inode	*ip = cur->bc_private.b.ip;
+		int			whichfork = cur->bc_private.b.whichfork;
+		struct xfs_ifork	*ifp = XFS_IFORK_PTR(ip, whichfork);
+		int			numrecs = 0;
+
+		if (ifp->if_broot)
+			numrecs = xfs_btree_get_numrecs(ifp->if_broot);
+		xfs_iroot_realloc(ip, geo->recs_per_block - numrecs, whichfork);
+		block = ifp->if_broot;
+		xfs_btree_init_block_int(cur->bc_mp, block, XFS_BUF_DADDR_NULL,
+				cur->bc_btnum, level, 0, ip->i_ino,
+				cur->bc_flags);
+		lv->block = block;
+		lv->cap = geo->recs_per_block;
+		lv->nr = 0;
+		lv->blkidx++;
+		return 0;
+	}
+
+	error = bbl->claim_block(cur, &ptr, priv);
+	if (error)
+		return error;
+	error = xfs_btree_get_buf_block(cur, &ptr, 0, &block, &bp);
+	if (error)
+		return error;
+	xfs_buf_zero(bp, 0, BBTOB(bp->b_length));
+	xfs_btree_init_block_cur(cur, bp, level, 0);
+
+	if (lv->bp) {
+		xfs_btree_set_sibling(cur, lv->block, &ptr, XFS_BB_RIGHTSIB);
+		xfs_btree_set_sibling(cur, block, &lv->ptr, XFS_BB_LEFTSIB);
+		xfs_btree_bload_drop_buf(ctx, lv);
+	}
+	if (level == bbl->btree_height - 1)
+		bbl->root = ptr;
+
+	lv->bp = bp;
+	lv->block = block;
+	lv->ptr = ptr;
+	lv->cap = geo->recs_per_block + (lv->blkidx < geo->nr_extra ? 1 : 0);
+	lv->nr = 0;
+	lv->blkidx++;
+	return 0;
+}
+
+STATIC int xfs_btree_bload_add(struct xfs_btree_cur *cur,
+		struct xfs_btree_bload *bbl, struct xfs_btree_bload_ctx *ctx,
+		int level, union xfs_btree_key *key, union xfs_btree_ptr *ptr,
+		void *priv);
+
+/* A block is complete; add its keys and address to the level above. */
+STATIC int
+xfs_btree_bload_finish_block(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_bload		*bbl,
+	struct xfs_btree_bload_ctx	*ctx,
+	int				level,
+	void				*priv)
+{
+	struct xfs_btree_bload_level	*lv = &ctx->lv[level];
+	union xfs_btree_key		key;
+
+	ASSERT(lv->nr == lv->cap);
+	if (level == bbl->btree_height - 1)
+		return 0;
+
+	xfs_btree_get_keys(cur, lv->block, &key);
+	return xfs_btree_bload_add(cur, bbl, ctx, level + 1, &key, &lv->ptr,
+			priv);
+}
+
+/*
+ * Append an entry to a level: the record in cur->bc_rec for the leaves, or
+ * a key and child pointer for the nodes.
+ */
+STATIC int
+xfs_btree_bload_add(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_bload		*bbl,
+	struct xfs_btree_bload_ctx	*ctx,
+	int				level,
+	union xfs_btree_key		*key,
+	union xfs_btree_ptr		*ptr,
+	void				*priv)
+{
+	struct xfs_btree_bload_level	*lv = &ctx->lv[level];
+	int				error;
+
+	if (lv->block && lv->nr == lv->cap) {
+		error = xfs_btree_bload_finish_block(cur, bbl, ctx, level,
+				priv);
+		if (error)
+			return error;
+	}
+	if (!lv->block || lv->nr == lv->cap) {
+		error = xfs_btree_bload_new_block(cur, bbl, ctx, level, priv);
+		if (error)
+			return error;
+	}
+
+	lv->nr++;
+	if (level == 0) {
+		cur->bc_ops->init_rec_from_cur(cur,
+				xfs_btree_rec_addr(cur, lv->nr, lv->block));
+	} else {
+		xfs_btree_copy_keys(cur,
+				xfs_btree_key_addr(cur, lv->nr, lv->block),
+				key, 1);
+		xfs_btree_copy_ptrs(cur,
+				xfs_btree_ptr_addr(cur, lv->nr, lv->block),
+				ptr, 1);
+	}
+	xfs_btree_set_numrecs(lv->block, lv->nr);
+	return 0;
+}
+
+/*
+ * Build a new btree from bbl->nr_records records, as sized by a previous
+ * call to xfs_btree_bload_compute_geometry.  ->get_record is called once per
+ * record, in key order, to load the next record into cur->bc_rec, and
+ * ->claim_block once per block to hand out the space reserved for the new
+ * btree.  The cursor must not have a transaction attached.
+ *
+ * On return bbl->root and bbl->btree_height describe the new btree.  For
+ * btrees rooted in an inode, the root has been built in the incore fork and
+ * the caller has to log it.
+ */
+int
+xfs_btree_bload(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_bload		*bbl,
+	void				*priv)
+{
+	struct xfs_btree_bload_ctx	*ctx;
+	uint64_t			i;
+	int				level;
+	int				error;
+
+	ASSERT(cur->bc_tp == NULL);
+
+	ctx = kmem_zalloc(sizeof(*ctx), KM_SLEEP | KM_NOFS);
+	INIT_LIST_HEAD(&ctx->buffers);
+
+	error = xfs_btree_bload_geometry(cur, bbl, bbl->nr_records, ctx->geo);
+	if (error)
+		goto out;
+	cur->bc_nlevels = bbl->btree_height;
+
+	for (i = 0; i < bbl->nr_records; i++) {
+		error = bbl->get_record(cur, priv);
+		if (error)
+			goto out;
+		error = xfs_btree_bload_add(cur, bbl, ctx, 0, NULL, NULL, priv);
+		if (error)
+			goto out;
+	}
+
+	/* Close off the last block of every level, working upwards. */
+	for (level = 0; level < bbl->btree_height; level++) {
+		struct xfs_btree_bload_level	*lv = &ctx->lv[level];
+
+		if (!lv->block) {
+			/* Only an empty btree has nothing at a level. */
+			ASSERT(bbl->nr_records == 0 && level == 0);
+			error = xfs_btree_bload_new_block(cur, bbl, ctx, level,
+					priv);
+			if (error)
+				goto out;
+		}
+		error = xfs_btree_bload_finish_block(cur, bbl, ctx, level,
+				priv);
+		if (error)
+			goto out;
+		if (lv->bp)
+			xfs_btree_bload_drop_buf(ctx, lv);
+	}
+
+	error = xfs_buf_delwri_submit(&ctx->buffers);
+	kmem_free(ctx);
+	return error;
+
+out:
+	for (level = 0; level < XFS_BTREE_MAXLEVELS; level++) {
+		if (ctx->lv[level].bp)
+			xfs_buf_relse(ctx->lv[level].bp);
+	}
+	xfs_buf_delwri_cancel(&ctx->buffers);
+	kmem_free(ctx);
+	return error;
+}
@@ -216,6 +216,8 @@ typedef struct xfs_btree_cur
 #define	XFS_BTCUR_RIGHTRA	2	/* right sibling has been read-ahead */
 	uint8_t		bc_nlevels;	/* number of levels in the tree */
 	uint8_t		bc_blocklog;	/* log2(blocksize) of btree blocks */
+	uint8_t		bc_seq_leaves;	/* leaves walked forwards in a row */
+	int		bc_ra_next;	/* next parent slot to read ahead */
 	xfs_btnum_t	bc_btnum;	/* identifies which btree type */
 	int		bc_statoff;	/* offset of btre stats array */
 	union {
@@ -497,6 +499,15 @@ int xfs_btree_query_range(struct xfs_btree_cur *cur,
 int xfs_btree_query_all(struct xfs_btree_cur *cur, xfs_btree_query_range_fn fn,
 		void *priv);
 
+typedef int (*xfs_btree_query_batch_fn)(struct xfs_btree_cur *cur,
+		union xfs_btree_rec **recs, int nr, void *priv);
+
+int xfs_btree_query_range_batch(struct xfs_btree_cur *cur,
+		union xfs_btree_irec *low_rec, union xfs_btree_irec *high_rec,
+		xfs_btree_query_batch_fn fn, void *priv);
+int xfs_btree_query_all_batch(struct xfs_btree_cur *cur,
+		xfs_btree_query_batch_fn fn, void *priv);
+
 typedef int (*xfs_btree_visit_blocks_fn)(struct xfs_btree_cur *cur, int level,
 		void *data);
 int xfs_btree_visit_blocks(struct xfs_btree_cur *cur,
@@ -525,4 +536,34 @@ void xfs_btree_get_sibling(struct xfs_btree_cur *cur,
 int xfs_btree_has_record(struct xfs_btree_cur *cur, union xfs_btree_irec *low,
 		union xfs_btree_irec *high, bool *exists);
 
+/*
+ * Bulk loading of btrees from a sorted record stream.
+ */
+typedef int (*xfs_btree_bload_get_record_fn)(struct xfs_btree_cur *cur,
+		void *priv);
+typedef int (*xfs_btree_bload_claim_block_fn)(struct xfs_btree_cur *cur,
+		union xfs_btree_ptr *ptr, void *priv);
+
+struct xfs_btree_bload {
+	xfs_btree_bload_get_record_fn	get_record;
+	xfs_btree_bload_claim_block_fn	claim_block;
+
+	/* percent of maxrecs to fill each block with, 0 for the default */
+	unsigned int			leaf_fill;
+	unsigned int			node_fill;
+
+	/* set by xfs_btree_bload_compute_geometry */
+	uint64_t			nr_records;
+	uint64_t			nr_blocks;
+	unsigned int			btree_height;
+
+	/* set by xfs_btree_bload */
+	union xfs_btree_ptr		root;
+};
+
+int xfs_btree_bload_compute_geometry(struct xfs_btree_cur *cur,
+		struct xfs_btree_bload *bbl, uint64_t nr_records);
+int xfs_btree_bload(struct xfs_btree_cur *cur, struct xfs_btree_bload *bbl,
+		void *priv);
+
 #endif	/* __XFS_BTREE_H__ */
@@ -28,6 +28,7 @@
 #include "xfs_mount.h"
 #include "xfs_defer.h"
 #include "xfs_trans.h"
+#include "xfs_log.h"
 #include "xfs_trace.h"
 
 /*
@@ -274,6 +275,27 @@ xfs_defer_trans_roll(
 	return error;
 }
 
+/*
+ * Return the most recently added work item if it is of the given type and
+ * hasn't been logged yet, so that the caller can fold a new update into it
+ * instead of adding another item.
+ */
+struct list_head *
+xfs_defer_last_item(
+	struct xfs_defer_ops		*dop,
+	enum xfs_defer_ops_type		type)
+{
+	struct xfs_defer_pending	*dfp;
+
+	if (list_empty(&dop->dop_intake))
+		return NULL;
+	dfp = list_last_entry(&dop->dop_intake, struct xfs_defer_pending,
+			dfp_list);
+	if (dfp->dfp_type->type != type || list_empty(&dfp->dfp_work))
+		return NULL;
+	return dfp->dfp_work.prev;
+}
+
 /* Do we have any work items to finish? */
 bool
 xfs_defer_has_unfinished_work(
@@ -306,6 +328,66 @@ xfs_defer_join(
 	return -EFSCORRUPTED;
 }
 
+/*
+ * Relog the intent items of pending work that has been sitting in the AIL
+ * for so long that it is holding up the log tail, so that long chains of
+ * deferred work don't pin the tail while the rest of the system waits for
+ * log space.  The old intent is cancelled with a done item covering all of
+ * its remaining work, and a fresh intent for the same work is logged in the
+ * current transaction.  Types whose done items record the work they cover
+ * provide ->log_done to fill them in.
+ *
+ * Returns true if anything was relogged and the transaction needs rolling.
+ */
+STATIC bool
+xfs_defer_relog(
+	struct xfs_trans		*tp,
+	struct xfs_defer_ops		*dop)
+{
+	struct xfs_defer_pending	*dfp;
+	struct xfs_log_item		*lip;
+	struct list_head		*li;
+	xfs_lsn_t			threshold_lsn = NULLCOMMITLSN;
+	void				*done;
+	bool				relogged = false;
+
+	list_for_each_entry(dfp, &dop->dop_pending, dfp_list) {
+		lip = dfp->dfp_intent;
+		if (!lip || !lip->li_lsn || xfs_log_item_in_current_chkpt(lip))
+			continue;
+
+		/* Only work out the push target once we have a candidate. */
+		if (threshold_lsn == NULLCOMMITLSN) {
+			threshold_lsn = xlog_grant_push_threshold(
+					tp->t_mountp->m_log, 0);
+			if (threshold_lsn == NULLCOMMITLSN)
+				break;
+		}
+		if (XFS_LSN_CMP(lip->li_lsn, threshold_lsn) >= 0)
+			continue;
+
+		trace_xfs_defer_relog_intent(tp->t_mountp, dfp);
+
+		done = dfp->dfp_type->create_done(tp, dfp->dfp_intent,
+				dfp->dfp_count);
+		if (dfp->dfp_type->log_done) {
+			list_for_each(li, &dfp->dfp_work)
+				dfp->dfp_type->log_done(tp, done, li);
+		}
+		lip = done;
+		tp->t_flags |= XFS_TRANS_DIRTY;
+		lip->li_desc->lid_flags |= XFS_LID_DIRTY;
+
+		dfp->dfp_intent = dfp->dfp_type->create_intent(tp,
+				dfp->dfp_count);
+		list_for_each(li, &dfp->dfp_work)
+			dfp->dfp_type->log_item(tp, dfp->dfp_intent, li);
+		relogged = true;
+	}
+
+	return relogged;
+}
+
 /*
  * Finish all the pending work.  This involves logging intent items for
  * any work items that wandered in since the last transaction roll (if
@@ -341,6 +423,13 @@ xfs_defer_finish(
 		if (error)
 			goto out;
 
+		/* Move any intents that are pinning the log tail forward. */
+		if (xfs_defer_relog(*tp, dop)) {
+			error = xfs_defer_trans_roll(tp, dop, ip);
+			if (error)
+				goto out;
+		}
+
 		/* Log an intent-done item for the first pending item. */
 		dfp = list_first_entry(&dop->dop_pending,
 				struct xfs_defer_pending, dfp_list);
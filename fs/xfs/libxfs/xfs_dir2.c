@@ -30,6 +30,7 @@
 #include "xfs_bmap.h"
 #include "xfs_dir2.h"
 #include "xfs_dir2_priv.h"
+#include "xfs_dir2_index.h"
 #include "xfs_error.h"
 #include "xfs_trace.h"
 
@@ -413,10 +414,13 @@ xfs_dir_lookup(
 	rval = xfs_dir2_isleaf(args, &v);
 	if (rval)
 		goto out_free;
-	if (v)
+	if (v) {
 		rval = xfs_dir2_leaf_lookup(args);
-	else
-		rval = xfs_dir2_node_lookup(args);
+	} else {
+		rval = xfs_dir2_index_lookup(args);
+		if (rval == -EAGAIN)
+			rval = xfs_dir2_node_lookup(args);
+	}
 
 out_check_rval:
 	if (rval == -EEXIST)
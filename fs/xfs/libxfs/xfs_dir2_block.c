@@ -819,10 +819,10 @@ xfs_dir2_block_removename(
 		xfs_dir2_data_log_header(args, bp);
 	xfs_dir3_data_check(dp, bp);
 	/*
-	 * See if the size as a shortform is good enough.
+	 * See if the size as a shortform is comfortably good enough.
 	 */
 	size = xfs_dir2_block_sfsize(dp, hdr, &sfh);
-	if (size > XFS_IFORK_DSIZE(dp))
+	if (size > XFS_DIR2_SF_SHRINK_SIZE(dp))
 		return 0;
 
 	/*
@@ -980,10 +980,13 @@ xfs_dir2_leaf_to_block(
 	tagp = (__be16 *)((char *)hdr + args->geo->blksize) - 1;
 	dup = (xfs_dir2_data_unused_t *)((char *)hdr + be16_to_cpu(*tagp));
 	/*
-	 * If it's not free or is too short we can't do it.
+	 * If it's not free or is too short we can't do it, and if it would
+	 * leave the block nearly full we don't, as the next few creates would
+	 * just convert it back to leaf form.
 	 */
 	if (be16_to_cpu(dup->freetag) != XFS_DIR2_DATA_FREE_TAG ||
-	    be16_to_cpu(dup->length) < size)
+	    be16_to_cpu(dup->length) <
+			size + XFS_DIR2_BLOCK_SHRINK_SLACK(args->geo))
 		return 0;
 
 	/*
@@ -1034,7 +1037,7 @@ xfs_dir2_leaf_to_block(
 	 * Now see if the resulting block can be shrunken to shortform.
 	 */
 	size = xfs_dir2_block_sfsize(dp, hdr, &sfh);
-	if (size > XFS_IFORK_DSIZE(dp))
+	if (size > XFS_DIR2_SF_SHRINK_SIZE(dp))
 		return 0;
 
 	return xfs_dir2_block_to_sf(args, dbp, size, &sfh);
@@ -28,6 +28,7 @@
 #include "xfs_bmap.h"
 #include "xfs_dir2.h"
 #include "xfs_dir2_priv.h"
+#include "xfs_dir2_index.h"
 #include "xfs_error.h"
 #include "xfs_trace.h"
 #include "xfs_trans.h"
@@ -1772,6 +1773,10 @@ xfs_dir2_node_to_leaf(
 	if (leafhdr.stale)
 		xfs_dir3_leaf_compact(args, &leafhdr, lbp);
 
+	/* The in-memory indexes only cover node format directories. */
+	xfs_dir2_index_free(dp);
+	xfs_dir2_freemap_free(dp);
+
 	lbp->b_ops = &xfs_dir3_leaf1_buf_ops;
 	xfs_trans_buf_set_type(tp, lbp, XFS_BLFT_DIR_LEAF1_BUF);
 	leafhdr.magic = (leafhdr.magic == XFS_DIR2_LEAFN_MAGIC)
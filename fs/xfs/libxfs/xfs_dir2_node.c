@@ -28,6 +28,7 @@
 #include "xfs_bmap.h"
 #include "xfs_dir2.h"
 #include "xfs_dir2_priv.h"
+#include "xfs_dir2_index.h"
 #include "xfs_error.h"
 #include "xfs_trace.h"
 #include "xfs_trans.h"
@@ -297,6 +298,8 @@ xfs_dir2_free_log_bests(
 {
 	xfs_dir2_free_t		*free;		/* freespace structure */
 	__be16			*bests;
+	struct xfs_dir3_icfree_hdr freehdr;
+	int			i;
 
 	free = bp->b_addr;
 	bests = args->dp->d_ops->free_bests_p(free);
@@ -306,6 +309,12 @@ xfs_dir2_free_log_bests(
 		(uint)((char *)&bests[first] - (char *)free),
 		(uint)((char *)&bests[last] - (char *)free +
 		       sizeof(bests[0]) - 1));
+
+	/* Keep the in-memory free space map in step. */
+	args->dp->d_ops->free_hdr_from_disk(&freehdr, free);
+	for (i = first; i <= last; i++)
+		xfs_dir2_freemap_set(args->dp, freehdr.firstdb + i,
+				be16_to_cpu(bests[i]));
 }
 
 /*
@@ -495,6 +504,7 @@ xfs_dir2_leafn_add(
 	lep->hashval = cpu_to_be32(args->hashval);
 	lep->address = cpu_to_be32(xfs_dir2_db_off_to_dataptr(args->geo,
 				args->blkno, args->index));
+	xfs_dir2_index_add(dp, args->hashval, be32_to_cpu(lep->address));
 
 	dp->d_ops->leaf_hdr_to_disk(leaf, &leafhdr);
 	xfs_dir3_leaf_log_header(args, bp);
@@ -1143,6 +1153,7 @@ xfs_dir3_data_block_free(
 
 	/* One less used entry in the free table. */
 	freehdr.nused--;
+	xfs_dir2_freemap_set(dp, freehdr.firstdb + findex, NULLDATAOFF);
 
 	/*
 	 * If this was the last entry in the table, we can trim the table size
@@ -1242,6 +1253,8 @@ xfs_dir2_leafn_remove(
 	ASSERT(dblk->blkno == db);
 	off = xfs_dir2_dataptr_to_off(args->geo, be32_to_cpu(lep->address));
 	ASSERT(dblk->index == off);
+	xfs_dir2_index_remove(dp, be32_to_cpu(lep->hashval),
+			be32_to_cpu(lep->address));
 
 	/*
 	 * Kill the leaf entry by marking it stale.
@@ -1682,6 +1695,128 @@ xfs_dir2_node_addname(
 	return rval;
 }
 
+/*
+ * Build the in-memory free space map of a directory by reading all of its
+ * freespace blocks.  That is what one unlucky addname scan costs anyway.
+ */
+STATIC int
+xfs_dir2_node_freemap_build(
+	struct xfs_da_args	*args,
+	xfs_dir2_db_t		lastfbno)
+{
+	struct xfs_inode	*dp = args->dp;
+	struct xfs_buf		*fbp;
+	__be16			*bests;
+	struct xfs_dir3_icfree_hdr freehdr;
+	xfs_dir2_db_t		fbno;
+	int			i;
+	int			error;
+
+	error = xfs_dir2_freemap_init(dp);
+	if (error)
+		return error;
+
+	for (fbno = xfs_dir2_byte_to_db(args->geo, XFS_DIR2_FREE_OFFSET);
+	     fbno < lastfbno; fbno++) {
+		error = xfs_dir2_free_try_read(args->trans, dp,
+				xfs_dir2_db_to_da(args->geo, fbno), &fbp);
+		if (error) {
+			xfs_dir2_freemap_free(dp);
+			return error;
+		}
+		if (!fbp)
+			continue;
+		dp->d_ops->free_hdr_from_disk(&freehdr, fbp->b_addr);
+		bests = dp->d_ops->free_bests_p(fbp->b_addr);
+		for (i = 0; i < freehdr.nvalid; i++)
+			xfs_dir2_freemap_set(dp, freehdr.firstdb + i,
+					be16_to_cpu(bests[i]));
+		xfs_trans_brelse(args->trans, fbp);
+	}
+	return 0;
+}
+
+/*
+ * Ask the in-memory free space map for a data block with room for the new
+ * entry, and read the freespace block that goes with it.  Returns 0 with
+ * *dbnop set to -1 if no data block has room, or -EAGAIN if the caller has to
+ * scan the freespace blocks itself.  When a data block is found, the
+ * freespace block covering it replaces (and releases) the one the caller came
+ * in with in *fbpp.
+ */
+STATIC int
+xfs_dir2_node_addname_freemap(
+	struct xfs_da_args	*args,
+	struct xfs_da_state_blk	*fblk,
+	xfs_dir2_db_t		ifbno,
+	xfs_dir2_db_t		lastfbno,
+	int			length,
+	xfs_dir2_db_t		*dbnop,
+	struct xfs_buf		**fbpp,
+	int			*findexp)
+{
+	struct xfs_inode	*dp = args->dp;
+	struct xfs_buf		*fbp;
+	__be16			*bests;
+	struct xfs_dir3_icfree_hdr freehdr;
+	xfs_dir2_db_t		dbno;
+	xfs_dir2_db_t		fbno;
+	int			findex;
+	int			error;
+
+	error = xfs_dir2_freemap_find(dp, length, &dbno);
+	if (error == -EAGAIN) {
+		error = xfs_dir2_node_freemap_build(args, lastfbno);
+		if (error)
+			return error;
+		error = xfs_dir2_freemap_find(dp, length, &dbno);
+	}
+	if (error == -ENOSPC) {
+		*dbnop = -1;
+		return 0;
+	}
+	if (error)
+		return error;
+
+	fbno = dp->d_ops->db_to_fdb(args->geo, dbno);
+	findex = dp->d_ops->db_to_fdindex(args->geo, dbno);
+	if (*fbpp && fbno == ifbno) {
+		fbp = *fbpp;
+	} else {
+		error = xfs_dir2_free_try_read(args->trans, dp,
+				xfs_dir2_db_to_da(args->geo, fbno), &fbp);
+		if (error)
+			return error;
+		if (!fbp)
+			goto out_stale;
+	}
+
+	dp->d_ops->free_hdr_from_disk(&freehdr, fbp->b_addr);
+	bests = dp->d_ops->free_bests_p(fbp->b_addr);
+	if (findex >= freehdr.nvalid ||
+	    be16_to_cpu(bests[findex]) == NULLDATAOFF ||
+	    be16_to_cpu(bests[findex]) < length) {
+		if (fbp != *fbpp)
+			xfs_trans_brelse(args->trans, fbp);
+		goto out_stale;
+	}
+
+	if (*fbpp && fbp != *fbpp) {
+		xfs_trans_brelse(args->trans, *fbpp);
+		if (fblk && fblk->bp)
+			fblk->bp = NULL;
+	}
+	*fbpp = fbp;
+	*findexp = findex;
+	*dbnop = dbno;
+	return 0;
+
+out_stale:
+	ASSERT(0);
+	xfs_dir2_freemap_free(dp);
+	return -EAGAIN;
+}
+
 /*
  * Add the data entry for a node-format directory name addition.
  * The leaf entry is added in xfs_dir2_leafn_add.
@@ -1715,6 +1850,7 @@ xfs_dir2_node_addname_int(
 	__be16			*bests;
 	struct xfs_dir3_icfree_hdr freehdr;
 	struct xfs_dir2_data_free *bf;
+	bool			scan = true;	/* scan freespace blocks */
 
 	dp = args->dp;
 	mp = dp->i_mount;
@@ -1775,13 +1911,27 @@ xfs_dir2_node_addname_int(
 			return error;
 		lastfbno = xfs_dir2_da_to_db(args->geo, (xfs_dablk_t)fo);
 		fbno = ifbno;
+
+		/*
+		 * Try the in-memory free space map before falling back to
+		 * a scan.
+		 */
+		error = xfs_dir2_node_addname_freemap(args, fblk, ifbno,
+				lastfbno, length, &dbno, &fbp, &findex);
+		if (!error) {
+			scan = false;
+			if (dbno != -1)
+				free = fbp->b_addr;
+		} else if (error != -EAGAIN) {
+			return error;
+		}
 	}
 	/*
 	 * While we haven't identified a data block, search the freeblock
 	 * data for a good data block.  If we find a null freeblock entry,
 	 * indicating a hole in the data blocks, remember that.
 	 */
-	while (dbno == -1) {
+	while (scan && dbno == -1) {
 		/*
 		 * If we don't have a freeblock in hand, get the next one.
 		 */
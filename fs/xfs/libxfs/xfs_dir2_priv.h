@@ -20,6 +20,18 @@
 
 struct dir_context;
 
+/*
+ * Hysteresis for shrinking a directory to a smaller format.  A directory only
+ * goes back to shortform once it fits in three quarters of the inode literal
+ * area, and back from leaf to block form once an eighth of the block would
+ * still be free afterwards.  Otherwise a directory whose entries churn around
+ * a format boundary converts back and forth on every create and unlink, each
+ * time allocating or freeing a block and logging all of its entries.
+ */
+#define XFS_DIR2_SF_SHRINK_SIZE(dp) \
+	(XFS_IFORK_DSIZE(dp) - (XFS_IFORK_DSIZE(dp) >> 2))
+#define XFS_DIR2_BLOCK_SHRINK_SLACK(geo)	((geo)->blksize >> 3)
+
 /* xfs_dir2.c */
 extern int xfs_dir2_grow_inode(struct xfs_da_args *args, int space,
 				xfs_dir2_db_t *dbp);
@@ -131,6 +143,9 @@ extern int xfs_dir2_sf_verify(struct xfs_inode *ip);
 
 /* xfs_dir2_readdir.c */
 extern int xfs_readdir(struct xfs_trans *tp, struct xfs_inode *dp,
-		       struct dir_context *ctx, size_t bufsize);
+		       struct dir_context *ctx, size_t bufsize,
+		       struct file_ra_state *ra);
+extern void xfs_dir2_inode_readahead(struct xfs_mount *mp, xfs_ino_t ino,
+		xfs_daddr_t *last_blkno, struct xfs_buf_ra_batch *rab);
 
 #endif /* __XFS_DIR2_PRIV_H__ */
@@ -82,15 +82,17 @@ struct getbmapx {
 #define BMV_IF_DELALLOC		0x8	/* rtn status BMV_OF_DELALLOC if req */
 #define BMV_IF_NO_HOLES		0x10	/* Do not return holes */
 #define BMV_IF_COWFORK		0x20	/* return CoW fork rather than data */
+#define BMV_IF_CHUNKED		0x40	/* drop locks between chunks of maps */
 #define BMV_IF_VALID	\
 	(BMV_IF_ATTRFORK|BMV_IF_NO_DMAPI_READ|BMV_IF_PREALLOC|	\
-	 BMV_IF_DELALLOC|BMV_IF_NO_HOLES|BMV_IF_COWFORK)
+	 BMV_IF_DELALLOC|BMV_IF_NO_HOLES|BMV_IF_COWFORK|BMV_IF_CHUNKED)
 
 /*	bmv_oflags values - returned for each non-header segment */
 #define BMV_OF_PREALLOC		0x1	/* segment = unwritten pre-allocation */
 #define BMV_OF_DELALLOC		0x2	/* segment = delayed allocation */
 #define BMV_OF_LAST		0x4	/* segment is the last in the file */
 #define BMV_OF_SHARED		0x8	/* segment shared with another file */
+#define BMV_OF_CHANGED		0x10	/* fork changed before segment read */
 
 /*	fmr_owner special values for FS_IOC_GETFSMAP */
 #define XFS_FMR_OWN_FREE	FMR_OWN_FREE      /* free space */
@@ -318,6 +320,97 @@ typedef struct xfs_fsop_bulkreq {
 	__s32		__user *ocount;	/* output count pointer		*/
 } xfs_fsop_bulkreq_t;
 
+/*
+ * Structure returned from ioctl XFS_IOC_AG_BULKSTAT.  Unlike xfs_bstat, every
+ * field has an explicit size so that the layout is the same for all ABIs and
+ * no compat translation is needed.
+ */
+struct xfs_bstat_v2 {
+	__u64		bs_ino;		/* inode number			*/
+	__u64		bs_size;	/* file size			*/
+	__u64		bs_blocks;	/* number of blocks		*/
+	__s64		bs_atime;	/* access time, seconds		*/
+	__s64		bs_mtime;	/* modify time, seconds		*/
+	__s64		bs_ctime;	/* inode change time, seconds	*/
+	__u32		bs_atime_nsec;	/* access time, nanoseconds	*/
+	__u32		bs_mtime_nsec;	/* modify time, nanoseconds	*/
+	__u32		bs_ctime_nsec;	/* change time, nanoseconds	*/
+	__u32		bs_blksize;	/* block size			*/
+	__u32		bs_rdev;	/* device value			*/
+	__u32		bs_uid;		/* user id			*/
+	__u32		bs_gid;		/* group id			*/
+	__u32		bs_projid;	/* project id			*/
+	__u32		bs_nlink;	/* number of links		*/
+	__u32		bs_gen;		/* generation count		*/
+	__u32		bs_xflags;	/* extended flags		*/
+	__u32		bs_extsize;	/* extent size, bytes		*/
+	__u32		bs_cowextsize;	/* cow extent size, bytes	*/
+	__u32		bs_extents;	/* number of data extents	*/
+	__u16		bs_aextents;	/* number of attr extents	*/
+	__u16		bs_forkoff;	/* inode fork offset in bytes	*/
+	__u16		bs_mode;	/* type and mode		*/
+	__u16		bs_pad16;	/* zero				*/
+	__u64		bs_pad[8];	/* zero				*/
+};
+
+/*
+ * Per-AG bulkstat request (XFS_IOC_AG_BULKSTAT).
+ *
+ * Walks the inodes of a single allocation group from @ino up to, but not
+ * including, @end_ino so that userspace can scan each AG from its own thread.
+ * On return @ino is the cursor to pass in on the next call, @icount is the
+ * number of records written to @ubuffer and XFS_AG_BULKREQ_DONE is set in
+ * @flags once the range has been exhausted.  @ra_chunks sets how many inode
+ * chunks beyond the current batch are read ahead; zero means the default.
+ */
+struct xfs_ag_bulkreq {
+	__u64		ubuffer;	/* array of struct xfs_bstat_v2	*/
+	__u64		ino;		/* next inode, 0 = start of AG	*/
+	__u64		end_ino;	/* end of range, 0 = end of AG	*/
+	__u32		agno;		/* allocation group to walk	*/
+	__u32		icount;		/* entries in buffer / returned	*/
+	__u32		ra_chunks;	/* inode chunks to read ahead	*/
+	__u32		flags;		/* XFS_AG_BULKREQ_*		*/
+	__u64		reserved[4];	/* must be zero			*/
+};
+
+#define XFS_AG_BULKREQ_DONE	(1U << 31)	/* out: range exhausted */
+
+/*
+ * Directory entry with the attributes of the inode it points to, returned by
+ * XFS_IOC_READDIRSTAT.  @ds_error is a positive errno if the inode could not
+ * be looked up, e.g. because the entry was removed after it was read, in
+ * which case @ds_bstat is zeroed.
+ */
+struct xfs_dirent_stat {
+	struct xfs_bstat_v2 ds_bstat;	/* inode attributes		*/
+	__u64		ds_ino;		/* inode number in the entry	*/
+	__u32		ds_error;	/* errno for ds_bstat, or zero	*/
+	__u8		ds_namelen;	/* length of ds_name		*/
+	__u8		ds_type;	/* DT_* file type		*/
+	__u16		ds_pad;		/* zero				*/
+	char		ds_name[256];	/* NUL terminated name		*/
+};
+
+/*
+ * Readdir plus stat request (XFS_IOC_READDIRSTAT), issued on a directory.
+ *
+ * Reads up to @icount entries starting at the directory cookie @pos and
+ * returns them in directory order, each with its inode's attributes.  On
+ * return @pos is the cookie to pass in on the next call, @icount is the number
+ * of entries written to @ubuffer and XFS_READDIRSTAT_DONE is set in @flags
+ * once the end of the directory has been reached.
+ */
+struct xfs_readdirstat_req {
+	__u64		ubuffer;	/* array of struct xfs_dirent_stat */
+	__u64		pos;		/* directory cookie, 0 = start	*/
+	__u32		icount;		/* entries in buffer / returned	*/
+	__u32		flags;		/* XFS_READDIRSTAT_*		*/
+	__u64		reserved[4];	/* must be zero			*/
+};
+
+#define XFS_READDIRSTAT_DONE	(1U << 31)	/* out: end of directory */
+
 
 /*
  * Structures returned from xfs_inumbers routine (XFS_IOC_FSINUMBERS).
@@ -446,6 +539,190 @@ typedef struct xfs_handle {
 } xfs_handle_t;
 #define ha_fsid ha_u._ha_fsid
 
+/*
+ * Batched handle resolution (XFS_IOC_OPEN_BY_HANDLES), issued on a directory
+ * of the filesystem the handles belong to.
+ *
+ * Resolves @count handles from the @handles array and fills in the result at
+ * the same index in @results.  The handles are visited in inode number order
+ * so that inodes sharing a cluster are read together.  With XFS_HANDLES_STAT
+ * each result carries the inode's attributes; with XFS_HANDLES_OPEN a file
+ * descriptor is opened with @oflags, as XFS_IOC_OPEN_BY_HANDLE would.  A
+ * handle that can't be resolved only sets hr_error for its own entry.
+ */
+struct xfs_handle_res {
+	struct xfs_bstat_v2 hr_bstat;	/* attributes, if XFS_HANDLES_STAT */
+	__s32		hr_fd;		/* fd, if XFS_HANDLES_OPEN, else -1 */
+	__u32		hr_error;	/* errno for this handle, or zero */
+};
+
+struct xfs_handles_req {
+	__u64		handles;	/* array of xfs_handle_t	*/
+	__u64		results;	/* array of struct xfs_handle_res */
+	__u32		count;		/* entries in both arrays	*/
+	__u32		flags;		/* XFS_HANDLES_*		*/
+	__u32		oflags;		/* open flags for XFS_HANDLES_OPEN */
+	__u32		pad;		/* must be zero			*/
+	__u64		reserved[4];	/* must be zero			*/
+};
+
+#define XFS_HANDLES_STAT	(1U << 0)	/* return inode attributes */
+#define XFS_HANDLES_OPEN	(1U << 1)	/* open a file descriptor */
+
+#define XFS_HANDLES_FLAGS	(XFS_HANDLES_STAT | XFS_HANDLES_OPEN)
+
+/*
+ * Handle to path resolution (XFS_IOC_HANDLE_TO_PATH), issued on a directory
+ * of the filesystem the handle belongs to.
+ *
+ * Writes the path of the inode named by @handle, relative to the root of the
+ * filesystem, into the @buflen byte buffer at @buf and sets @buflen to the
+ * length of the path including the trailing NUL.  Directories can always be
+ * resolved by following their '..' entries.  Other files only resolve if
+ * the dentry cache already has a name for them; otherwise, and for unlinked
+ * files, -ENOENT is returned.  -ERANGE means that @buf was too small and
+ * @buflen has been set to the size needed.
+ */
+struct xfs_handle_path_req {
+	__u64		handle;		/* xfs_handle_t			*/
+	__u64		buf;		/* path buffer			*/
+	__u32		buflen;		/* in: buffer size, out: path size */
+	__u32		pad;		/* must be zero			*/
+	__u64		reserved[2];	/* must be zero			*/
+};
+
+/*
+ * Change tracking feed (XFS_IOC_GET_CHANGES), available when mounted with
+ * the changelog option.
+ *
+ * Returns the inodes changed by each checkpoint written to the log, in log
+ * order, starting after the cursor formed by @lsn and @offset, the number of
+ * changes at @lsn already consumed.  Both are updated so the next call picks
+ * up where this one stopped; start from zero.  LSNs are stable across
+ * remounts, so a saved cursor stays valid as long as XFS_CHANGES_LOST isn't
+ * reported, which means changes after the cursor are no longer available
+ * and the caller has to fall back to a full scan.  An inode may be reported
+ * more than once.
+ */
+struct xfs_change {
+	__u64		ch_lsn;		/* LSN of the checkpoint	*/
+	__u64		ch_ino;		/* inode that changed		*/
+};
+
+struct xfs_changes_req {
+	__u64		ubuffer;	/* array of struct xfs_change	*/
+	__u64		lsn;		/* in/out: cursor LSN		*/
+	__u32		offset;		/* in/out: changes seen at @lsn	*/
+	__u32		count;		/* in: buffer size, out: returned */
+	__u32		flags;		/* out: XFS_CHANGES_*		*/
+	__u32		pad;		/* must be zero			*/
+	__u64		reserved[4];	/* must be zero			*/
+};
+
+#define XFS_CHANGES_LOST	(1U << 0)	/* out: changes were lost */
+#define XFS_CHANGES_DONE	(1U << 31)	/* out: no more changes yet */
+
+/*
+ * Project quota usage report (XFS_IOC_GET_PROJ_USAGE).
+ *
+ * Returns usage and limits for up to @count projects with ids of @projid
+ * and up, in id order, from a snapshot that is kept without taking dquot
+ * locks.  Usage includes outstanding reservations, as statfs does.  Only
+ * projects that have been in use since quotas were turned on are reported.
+ */
+struct xfs_proj_usage {
+	__u32		pu_projid;	/* project id			*/
+	__u32		pu_pad;		/* zero				*/
+	__u64		pu_bytes;	/* space used, bytes		*/
+	__u64		pu_inodes;	/* inodes used			*/
+	__u64		pu_blk_softlimit; /* space soft limit, bytes	*/
+	__u64		pu_blk_hardlimit; /* space hard limit, bytes	*/
+	__u64		pu_ino_softlimit; /* inode soft limit		*/
+	__u64		pu_ino_hardlimit; /* inode hard limit		*/
+};
+
+struct xfs_proj_usage_req {
+	__u64		ubuffer;	/* array of struct xfs_proj_usage */
+	__u32		projid;		/* in/out: first id to report	*/
+	__u32		count;		/* in: buffer size, out: returned */
+	__u32		flags;		/* out: XFS_PROJ_USAGE_*	*/
+	__u32		pad;		/* must be zero			*/
+	__u64		reserved[4];	/* must be zero			*/
+};
+
+#define XFS_PROJ_USAGE_DONE	(1U << 31)	/* out: no more projects */
+
+/*
+ * Hottest cached inodes (XFS_IOC_GET_HOT_INODES), available when mounted
+ * with the ioheat option.
+ *
+ * Reads, writes and page faults add the number of pages they touch to the
+ * read or write heat of the inode, and heat halves every minute, so it
+ * approximates the I/O rate of the last few minutes.  Returns up to @count
+ * of the hottest inodes in the inode cache, hottest first, ranked by the sum
+ * of the kinds of heat selected in @flags.
+ */
+struct xfs_inode_heat {
+	__u64		ih_ino;		/* inode number			*/
+	__u32		ih_gen;		/* inode generation		*/
+	__u32		ih_read;	/* read heat, pages		*/
+	__u32		ih_write;	/* write heat, pages		*/
+	__u32		ih_pad;		/* zero				*/
+};
+
+struct xfs_hot_inodes_req {
+	__u64		ubuffer;	/* array of struct xfs_inode_heat */
+	__u32		count;		/* in: buffer size, out: returned */
+	__u32		flags;		/* in: XFS_HOT_*		*/
+	__u64		reserved[4];	/* must be zero			*/
+};
+
+#define XFS_HOT_READ		(1U << 0)	/* rank by read heat */
+#define XFS_HOT_WRITE		(1U << 1)	/* rank by write heat */
+#define XFS_HOT_FLAGS		(XFS_HOT_READ | XFS_HOT_WRITE)
+
+/*
+ * Recursive removal (XFS_IOC_RMTREE), issued on a directory opened for
+ * reading on a filesystem mounted read-write.
+ *
+ * Removes everything below the directory, leaving the directory itself empty,
+ * with the same permission checks as unlinking each name in turn.  On return
+ * @removed is the number of names removed, also when the call fails part way
+ * through; a failed or interrupted removal can simply be restarted.
+ */
+struct xfs_rmtree_req {
+	__u64		removed;	/* out: names removed		*/
+	__u32		flags;		/* must be zero			*/
+	__u32		pad;		/* must be zero			*/
+	__u64		reserved[4];	/* must be zero			*/
+};
+
+/*
+ * Batched create (XFS_IOC_CREATE_BATCH), issued on a directory on a
+ * filesystem mounted read-write.
+ *
+ * Creates a regular file or directory for each of the @count entries in
+ * @ubuffer, as open(O_CREAT|O_EXCL) or mkdir would, with the process umask
+ * applied to @ce_mode.  Each entry gets its own result: @ce_ino is the new
+ * inode number and @ce_error is zero, or @ce_error is the errno the create
+ * failed with.  On return @count is the number of entries processed, which
+ * is less than asked for if the call was interrupted or more than
+ * XFS_CREATE_BATCH_MAX entries were passed in.
+ */
+struct xfs_create_ent {
+	__u64		ce_name;	/* in: NUL terminated name	*/
+	__u64		ce_ino;		/* out: new inode number	*/
+	__u32		ce_mode;	/* in: S_IFREG or S_IFDIR | perms */
+	__u32		ce_error;	/* out: errno, or zero		*/
+};
+
+struct xfs_create_batch_req {
+	__u64		ubuffer;	/* array of struct xfs_create_ent */
+	__u32		count;		/* in: entries, out: processed	*/
+	__u32		flags;		/* must be zero			*/
+	__u64		reserved[4];	/* must be zero			*/
+};
+
 /*
  * Structure passed to XFS_IOC_SWAPEXT
  */
@@ -453,6 +730,7 @@ typedef struct xfs_swapext
 {
 	int64_t		sx_version;	/* version */
 #define XFS_SX_VERSION		0
+#define XFS_SX_VERSION_RTMOVE	1	/* files on different devices */
 	int64_t		sx_fdtarget;	/* fd of target file */
 	int64_t		sx_fdtmp;	/* fd of tmp file */
 	xfs_off_t	sx_offset;	/* offset into file */
@@ -461,6 +739,69 @@ typedef struct xfs_swapext
 	xfs_bstat_t	sx_stat;	/* stat of target b4 copy */
 } xfs_swapext_t;
 
+/*
+ * Structure passed to XFS_IOC_SWAPRANGE.  Exchanges sr_length bytes at
+ * sr_offset1 in the file the ioctl is called on with the same number of
+ * bytes at sr_offset2 in sr_fd.  Offsets must be block aligned; the length
+ * must be too unless the range runs to EOF in both files.  Once the call
+ * has started changing the files the whole range will be exchanged, even
+ * across a crash.
+ */
+struct xfs_swap_range {
+	__s64		sr_fd;		/* fd of the other file */
+	__u64		sr_offset1;	/* offset in this file */
+	__u64		sr_offset2;	/* offset in the other file */
+	__u64		sr_length;	/* bytes to exchange */
+	__u64		sr_flags;	/* see XFS_SWAP_RANGE_* */
+	__u64		sr_pad[3];	/* must be zero */
+};
+
+/* Also exchange file sizes; the range must start at 0 and cover both files */
+#define XFS_SWAP_RANGE_SET_SIZES	(1ULL << 0)
+
+#define XFS_SWAP_RANGE_FLAGS		(XFS_SWAP_RANGE_SET_SIZES)
+
+/*
+ * Structure passed to XFS_IOC_DEFRAG_RANGE.  Rewrites fragmented parts of
+ * dr_length bytes at dr_offset into fewer extents while the file stays in
+ * use.  Requires reflink support.  On return dr_offset and dr_length
+ * describe what's left of the range, so an interrupted call can be resumed.
+ */
+struct xfs_defrag_range {
+	__u64		dr_offset;	/* in/out: start of range */
+	__u64		dr_length;	/* in/out: bytes left */
+	__u64		dr_flags;	/* see XFS_DEFRAG_* */
+	__u64		dr_moved;	/* out: bytes rewritten */
+	__u64		dr_pad[4];	/* must be zero */
+};
+
+/* Don't pause between chunks to leave bandwidth for other I/O */
+#define XFS_DEFRAG_NOTHROTTLE		(1ULL << 0)
+
+#define XFS_DEFRAG_FLAGS		(XFS_DEFRAG_NOTHROTTLE)
+
+/*
+ * Structure passed to XFS_IOC_COMPACT_AG.  Moves short runs of file data
+ * that sit between free extents in AG ca_agno out to other AGs so that the
+ * free space around them merges into longer extents.  Requires the rmapbt
+ * and reflink features.  Scanning starts at ca_agbno; on return ca_agbno
+ * says where to resume, and is sb_agblocks once the whole AG is done.
+ */
+struct xfs_compact_ag {
+	__u32		ca_agno;	/* AG to compact */
+	__u32		ca_maxgap;	/* longest used run to move, in fsblocks;
+					 * 0 picks a default */
+	__u64		ca_agbno;	/* in/out: where to start/resume */
+	__u64		ca_flags;	/* see XFS_COMPACT_* */
+	__u64		ca_moved;	/* out: fsblocks moved */
+	__u64		ca_pad[4];	/* must be zero */
+};
+
+/* Don't pause between batches to leave bandwidth for other I/O */
+#define XFS_COMPACT_NOTHROTTLE		(1ULL << 0)
+
+#define XFS_COMPACT_FLAGS		(XFS_COMPACT_NOTHROTTLE)
+
 /*
  * Flags for going down operation
  */
@@ -544,6 +885,80 @@ struct xfs_scrub_metadata {
 				 XFS_SCRUB_OFLAG_WARNING)
 #define XFS_SCRUB_FLAGS_ALL	(XFS_SCRUB_FLAGS_IN | XFS_SCRUB_FLAGS_OUT)
 
+/*
+ * Vectored scrubbing of AG metadata.  @svh_vectors points to @svh_nr
+ * scrub vectors naming per-AG metadata types (XFS_SCRUB_TYPE_AGF through
+ * XFS_SCRUB_TYPE_REFCNTBT), and every type is checked in each of the
+ * @svh_agcount AGs starting at @svh_agno.  Results are written to
+ * @svh_results, an array of @svh_agcount * @svh_nr results in AG-major
+ * order.  Up to @svh_workers AGs (zero means the default) are checked
+ * in parallel, and each worker rests for @svh_rest_us microseconds
+ * between checks so that scrubbing doesn't swamp the storage.
+ */
+struct xfs_scrub_vec {
+	__u32 sv_type;		/* What to check? */
+	__u32 sv_flags;		/* XFS_SCRUB_FLAGS_IN */
+};
+
+struct xfs_scrub_vec_result {
+	__u32 svr_flags;	/* XFS_SCRUB_FLAGS_OUT */
+	__s32 svr_ret;		/* zero or negative errno */
+};
+
+struct xfs_scrub_vec_head {
+	__u64 svh_vectors;	/* array of struct xfs_scrub_vec */
+	__u64 svh_results;	/* array of struct xfs_scrub_vec_result */
+	__u32 svh_agno;		/* first AG to check */
+	__u32 svh_agcount;	/* number of AGs to check */
+	__u32 svh_nr;		/* number of scrub vectors */
+	__u32 svh_workers;	/* parallel AG checks, 0 = default */
+	__u32 svh_rest_us;	/* rest time between checks */
+	__u32 svh_pad;		/* must be zero */
+	__u64 svh_reserved[4];	/* must be zero */
+};
+
+/* Longest rest between checks that we'll honour. */
+#define XFS_SCRUB_VEC_MAX_REST_US	(1000000)
+
+/*
+ * Scrub every inode in a range of AGs.  @sih_types is a mask of
+ * (1 << XFS_SCRUB_TYPE_*) naming the per-inode checks to run
+ * (XFS_SCRUB_TYPE_INODE through XFS_SCRUB_TYPE_PARENT); checks that
+ * don't apply to an inode, such as a directory check of a regular file,
+ * are skipped.  Only checks that fail or set an output flag are
+ * reported, in the array of @sih_max_failures records at @sih_failures.
+ * If an AG's inode btree can't be walked, the walk of that AG stops and
+ * an XFS_SCRUB_TYPE_INOBT record naming the first inode of the AG is
+ * reported.  On return @sih_checked is the number of inodes examined
+ * and @sih_found is the number of problems found, which can be larger
+ * than @sih_max_failures.  Up to @sih_workers AGs (zero means the
+ * default) are walked in parallel.
+ */
+struct xfs_scrub_inode_failure {
+	__u64 sif_ino;		/* inode number */
+	__u32 sif_gen;		/* inode generation */
+	__u32 sif_type;		/* XFS_SCRUB_TYPE_* */
+	__u32 sif_flags;	/* XFS_SCRUB_FLAGS_OUT */
+	__s32 sif_ret;		/* zero or negative errno */
+};
+
+struct xfs_scrub_inodes_head {
+	__u64 sih_failures;	/* array of struct xfs_scrub_inode_failure */
+	__u64 sih_checked;	/* out: inodes examined */
+	__u32 sih_types;	/* mask of per-inode types to check */
+	__u32 sih_flags;	/* XFS_SCRUB_FLAGS_IN */
+	__u32 sih_agno;		/* first AG to check */
+	__u32 sih_agcount;	/* number of AGs to check */
+	__u32 sih_max_failures;	/* size of the failure array */
+	__u32 sih_found;	/* out: problems found */
+	__u32 sih_workers;	/* parallel AG walks, 0 = default */
+	__u32 sih_pad;		/* must be zero */
+	__u64 sih_reserved[4];	/* must be zero */
+};
+
+/* Most failure records that we'll copy out. */
+#define XFS_SCRUB_INODES_MAX_FAILURES	(1U << 16)
+
 /*
  * AG reserved block counters
  */
@@ -599,6 +1014,20 @@ struct xfs_fsop_ag_resblks {
 #define XFS_IOC_FREE_EOFBLOCKS	_IOR ('X', 58, struct xfs_fs_eofblocks)
 /*	XFS_IOC_GETFSMAP ------ hoisted 59         */
 #define XFS_IOC_SCRUB_METADATA	_IOWR('X', 60, struct xfs_scrub_metadata)
+#define XFS_IOC_AG_BULKSTAT	_IOWR('X', 61, struct xfs_ag_bulkreq)
+#define XFS_IOC_SCRUBV_METADATA	_IOWR('X', 62, struct xfs_scrub_vec_head)
+#define XFS_IOC_READDIRSTAT	_IOWR('X', 63, struct xfs_readdirstat_req)
+#define XFS_IOC_SWAPRANGE	_IOW ('X', 64, struct xfs_swap_range)
+#define XFS_IOC_DEFRAG_RANGE	_IOWR('X', 65, struct xfs_defrag_range)
+#define XFS_IOC_COMPACT_AG	_IOWR('X', 66, struct xfs_compact_ag)
+#define XFS_IOC_OPEN_BY_HANDLES	_IOW ('X', 67, struct xfs_handles_req)
+#define XFS_IOC_GET_CHANGES	_IOWR('X', 68, struct xfs_changes_req)
+#define XFS_IOC_GET_PROJ_USAGE	_IOWR('X', 69, struct xfs_proj_usage_req)
+#define XFS_IOC_SCRUB_INODES	_IOWR('X', 70, struct xfs_scrub_inodes_head)
+#define XFS_IOC_HANDLE_TO_PATH	_IOWR('X', 71, struct xfs_handle_path_req)
+#define XFS_IOC_GET_HOT_INODES	_IOWR('X', 72, struct xfs_hot_inodes_req)
+#define XFS_IOC_RMTREE		_IOWR('X', 73, struct xfs_rmtree_req)
+#define XFS_IOC_CREATE_BATCH	_IOWR('X', 74, struct xfs_create_batch_req)
 
 /*
  * ioctl commands that replace IRIX syssgi()'s
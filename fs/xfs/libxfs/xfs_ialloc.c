@@ -881,6 +881,7 @@ xfs_ialloc_ag_alloc(
 	be32_add_cpu(&agi->agi_freecount, newlen);
 	pag = xfs_perag_get(args.mp, agno);
 	pag->pagi_freecount += newlen;
+	pag->pagfi_startino = NULLAGINO;
 	xfs_perag_put(pag);
 	agi->agi_newino = cpu_to_be32(newino);
 
@@ -933,6 +934,7 @@ xfs_ialloc_ag_select(
 	int		needspace;	/* file mode implies space allocated */
 	xfs_perag_t	*pag;		/* per allocation group data */
 	xfs_agnumber_t	pagno;		/* parent (starting) ag number */
+	xfs_agnumber_t	busyagno;	/* first usable but contended ag */
 	int		error;
 
 	/*
@@ -960,6 +962,7 @@ xfs_ialloc_ag_select(
 	 * if none are currently free.
 	 */
 	agno = pagno;
+	busyagno = NULLAGNUMBER;
 	flags = XFS_ALLOC_FLAG_TRYLOCK;
 	for (;;) {
 		pag = xfs_perag_get(mp, agno);
@@ -974,10 +977,8 @@ xfs_ialloc_ag_select(
 				goto nextag;
 		}
 
-		if (pag->pagi_freecount) {
-			xfs_perag_put(pag);
-			return agno;
-		}
+		if (pag->pagi_freecount)
+			goto found;
 
 		if (!okalloc)
 			goto nextag;
@@ -1011,11 +1012,21 @@ xfs_ialloc_ag_select(
 		if (!longest)
 			longest = pag->pagf_flcount > 0;
 
-		if (pag->pagf_freeblks >= needspace + ineed &&
-		    longest >= ineed) {
+		if (pag->pagf_freeblks < needspace + ineed ||
+		    longest < ineed)
+			goto nextag;
+found:
+		/*
+		 * On the first pass, pass over AGs whose headers other
+		 * allocators have recently had to wait for, but remember the
+		 * first usable one in case every AG is busy.
+		 */
+		if (!flags || !xfs_perag_contended(pag)) {
 			xfs_perag_put(pag);
 			return agno;
 		}
+		if (busyagno == NULLAGNUMBER)
+			busyagno = agno;
 nextag:
 		xfs_perag_put(pag);
 		/*
@@ -1030,6 +1041,8 @@ xfs_ialloc_ag_select(
 		if (agno == pagno) {
 			if (flags == 0)
 				return NULLAGNUMBER;
+			if (busyagno != NULLAGNUMBER)
+				return busyagno;
 			flags = 0;
 		}
 	}
@@ -1583,9 +1596,25 @@ xfs_dialloc_ag(
 	 * parent. If so, find the closest available inode to the parent. If
 	 * not, consider the agi hint or find the first free inode in the AG.
 	 */
-	if (agno == pagno)
-		error = xfs_dialloc_ag_finobt_near(pagino, &cur, &rec);
-	else
+	if (agno == pagno) {
+		/*
+		 * If the last allocation for this parent left free inodes in
+		 * its record, that record is still the closest one and we can
+		 * go straight to it.
+		 */
+		i = 0;
+		if (pag->pagfi_pagino == pagino &&
+		    pag->pagfi_startino != NULLAGINO) {
+			error = xfs_inobt_lookup(cur, pag->pagfi_startino,
+					XFS_LOOKUP_EQ, &i);
+			if (!error && i == 1)
+				error = xfs_inobt_get_rec(cur, &rec, &i);
+			if (error)
+				goto error_cur;
+		}
+		if (i != 1)
+			error = xfs_dialloc_ag_finobt_near(pagino, &cur, &rec);
+	} else
 		error = xfs_dialloc_ag_finobt_newino(agi, cur, &rec);
 	if (error)
 		goto error_cur;
@@ -1609,6 +1638,13 @@ xfs_dialloc_ag(
 	if (error)
 		goto error_cur;
 
+	if (agno == pagno && rec.ir_freecount) {
+		pag->pagfi_pagino = pagino;
+		pag->pagfi_startino = rec.ir_startino;
+	} else if (agno == pagno) {
+		pag->pagfi_startino = NULLAGINO;
+	}
+
 	/*
 	 * The finobt has now been updated appropriately. We haven't updated the
 	 * agi and superblock yet, so we can create an inobt cursor and validate
@@ -1813,12 +1849,45 @@ xfs_dialloc(
 
 out_alloc:
 	*IO_agbp = NULL;
-	return xfs_dialloc_ag(tp, agbp, parent, inop);
+	error = xfs_dialloc_ag(tp, agbp, parent, inop);
+	if (!error && !noroom)
+		xfs_inode_prealloc_queue(mp, XFS_INO_TO_AGNO(mp, *inop));
+	return error;
 out_error:
 	xfs_perag_put(pag);
 	return error;
 }
 
+/*
+ * Allocate a new inode chunk in an AG ahead of the creates that will need it.
+ * Nothing is allocated if the AG has gained enough free inodes since the
+ * caller decided to call us.
+ */
+int
+xfs_ialloc_ag_prealloc(
+	struct xfs_trans	*tp,
+	xfs_agnumber_t		agno,
+	int			*alloc)
+{
+	struct xfs_mount	*mp = tp->t_mountp;
+	struct xfs_buf		*agbp;
+	struct xfs_perag	*pag;
+	int			error;
+
+	*alloc = 0;
+	error = xfs_ialloc_read_agi(mp, tp, agno, &agbp);
+	if (error)
+		return error;
+
+	pag = xfs_perag_get(mp, agno);
+	if (pag->pagi_freecount < mp->m_ialloc_inos)
+		error = xfs_ialloc_ag_alloc(tp, agbp, alloc);
+	xfs_perag_put(pag);
+	if (!*alloc)
+		xfs_trans_brelse(tp, agbp);
+	return error;
+}
+
 /*
  * Free the blocks of an inode chunk. We must consider that the inode chunk
  * might be sparse and only free the regions that are allocated as part of the
@@ -2038,6 +2107,7 @@ xfs_difree_finobt(
 {
 	struct xfs_agi			*agi = XFS_BUF_TO_AGI(agbp);
 	xfs_agnumber_t			agno = be32_to_cpu(agi->agi_seqno);
+	struct xfs_perag		*pag;
 	struct xfs_btree_cur		*cur;
 	struct xfs_inobt_rec_incore	rec;
 	int				offset = agino - ibtrec->ir_startino;
@@ -2065,6 +2135,11 @@ xfs_difree_finobt(
 			goto error;
 		ASSERT(i == 1);
 
+		/* A new record may be closer than the allocation hint. */
+		pag = xfs_perag_get(mp, agno);
+		pag->pagfi_startino = NULLAGINO;
+		xfs_perag_put(pag);
+
 		goto out;
 	}
 
@@ -2451,6 +2526,7 @@ xfs_ialloc_log_agi(
 		offsetof(xfs_agi_t, agi_unlinked),
 		offsetof(xfs_agi_t, agi_free_root),
 		offsetof(xfs_agi_t, agi_free_level),
+		offsetof(xfs_agi_t, agi_iblocks),
 		sizeof(xfs_agi_t)
 	};
 #ifdef DEBUG
@@ -2596,6 +2672,7 @@ xfs_read_agi(
 	xfs_agnumber_t		agno,	/* allocation group number */
 	struct xfs_buf		**bpp)	/* allocation group hdr buf */
 {
+	struct xfs_perag	*pag;
 	int			error;
 
 	trace_xfs_read_agi(mp, agno);
@@ -2603,7 +2680,20 @@ xfs_read_agi(
 	ASSERT(agno != NULLAGNUMBER);
 	error = xfs_trans_read_buf(mp, tp, mp->m_ddev_targp,
 			XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
-			XFS_FSS_TO_BB(mp, 1), 0, bpp, &xfs_agi_buf_ops);
+			XFS_FSS_TO_BB(mp, 1), tp ? XBF_TRYLOCK : 0, bpp,
+			&xfs_agi_buf_ops);
+	if (!error && !*bpp) {
+		/*
+		 * Someone else holds the AGI.  Note that for AG selection,
+		 * then wait for it.
+		 */
+		pag = xfs_perag_get(mp, agno);
+		xfs_perag_set_contended(pag);
+		xfs_perag_put(pag);
+		error = xfs_trans_read_buf(mp, tp, mp->m_ddev_targp,
+				XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
+				XFS_FSS_TO_BB(mp, 1), 0, bpp, &xfs_agi_buf_ops);
+	}
 	if (error)
 		return error;
 	if (tp)
@@ -2635,6 +2725,8 @@ xfs_ialloc_read_agi(
 	if (!pag->pagi_init) {
 		pag->pagi_freecount = be32_to_cpu(agi->agi_freecount);
 		pag->pagi_count = be32_to_cpu(agi->agi_count);
+		pag->pagfi_pagino = NULLAGINO;
+		pag->pagfi_startino = NULLAGINO;
 		pag->pagi_init = 1;
 	}
 
@@ -2731,19 +2823,23 @@ struct xfs_ialloc_count_inodes {
 	xfs_agino_t			freecount;
 };
 
-/* Record inode counts across all inobt records. */
+/* Record inode counts across a leaf block's worth of inobt records. */
 STATIC int
 xfs_ialloc_count_inodes_helper(
 	struct xfs_btree_cur		*cur,
-	union xfs_btree_rec		*rec,
+	union xfs_btree_rec		**recs,
+	int				nr,
 	void				*priv)
 {
 	struct xfs_inobt_rec_incore	irec;
 	struct xfs_ialloc_count_inodes	*ci = priv;
+	int				i;
 
-	xfs_inobt_btrec_to_irec(cur->bc_mp, rec, &irec);
-	ci->count += irec.ir_count;
-	ci->freecount += irec.ir_freecount;
+	for (i = 0; i < nr; i++) {
+		xfs_inobt_btrec_to_irec(cur->bc_mp, recs[i], &irec);
+		ci->count += irec.ir_count;
+		ci->freecount += irec.ir_freecount;
+	}
 
 	return 0;
 }
@@ -2759,7 +2855,8 @@ xfs_ialloc_count_inodes(
 	int				error;
 
 	ASSERT(cur->bc_btnum == XFS_BTNUM_INO);
-	error = xfs_btree_query_all(cur, xfs_ialloc_count_inodes_helper, &ci);
+	error = xfs_btree_query_all_batch(cur, xfs_ialloc_count_inodes_helper,
+			&ci);
 	if (!error) {
 		*count = ci.count;
 		*freecount = ci.freecount;
@@ -135,6 +135,15 @@ xfs_ialloc_read_agi(
 	xfs_agnumber_t	agno,		/* allocation group number */
 	struct xfs_buf	**bpp);		/* allocation group hdr buf */
 
+/*
+ * Allocate a new inode chunk in an AG that is running low on free inodes.
+ */
+int
+xfs_ialloc_ag_prealloc(
+	struct xfs_trans *tp,		/* transaction pointer */
+	xfs_agnumber_t	agno,		/* allocation group number */
+	int		*alloc);	/* out: a chunk was allocated */
+
 /*
  * Read in the allocation group header to initialise the per-ag data
  * in the mount structure
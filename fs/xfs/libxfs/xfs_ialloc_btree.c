@@ -81,6 +81,25 @@ xfs_finobt_set_root(
 			   XFS_AGI_FREE_ROOT | XFS_AGI_FREE_LEVEL);
 }
 
+/* Keep the AGI's count of inode btree blocks up to date. */
+STATIC void
+xfs_inobt_mod_blockcount(
+	struct xfs_btree_cur	*cur,
+	int			howmuch)
+{
+	struct xfs_buf		*agbp = cur->bc_private.a.agbp;
+	struct xfs_agi		*agi = XFS_BUF_TO_AGI(agbp);
+
+	if (!xfs_sb_version_hasinobtcounts(&cur->bc_mp->m_sb))
+		return;
+
+	if (cur->bc_btnum == XFS_BTNUM_FINO)
+		be32_add_cpu(&agi->agi_fblocks, howmuch);
+	else
+		be32_add_cpu(&agi->agi_iblocks, howmuch);
+	xfs_ialloc_log_agi(cur->bc_tp, agbp, XFS_AGI_IBLOCKS);
+}
+
 STATIC int
 __xfs_inobt_alloc_block(
 	struct xfs_btree_cur	*cur,
@@ -121,6 +140,7 @@ __xfs_inobt_alloc_block(
 
 	new->s = cpu_to_be32(XFS_FSB_TO_AGBNO(args.mp, args.fsbno));
 	*stat = 1;
+	xfs_inobt_mod_blockcount(cur, 1);
 	return 0;
 }
 
@@ -151,11 +171,16 @@ xfs_inobt_free_block(
 	struct xfs_buf		*bp)
 {
 	struct xfs_owner_info	oinfo;
+	int			error;
 
 	xfs_rmap_ag_owner(&oinfo, XFS_RMAP_OWN_INOBT);
-	return xfs_free_extent(cur->bc_tp,
+	error = xfs_free_extent(cur->bc_tp,
 			XFS_DADDR_TO_FSB(cur->bc_mp, XFS_BUF_ADDR(bp)), 1,
 			&oinfo, XFS_AG_RESV_NONE);
+	if (error)
+		return error;
+	xfs_inobt_mod_blockcount(cur, -1);
+	return 0;
 }
 
 STATIC int
@@ -524,7 +549,7 @@ xfs_inobt_rec_check_count(
 }
 #endif	/* DEBUG */
 
-static xfs_extlen_t
+xfs_extlen_t
 xfs_inobt_max_size(
 	struct xfs_mount	*mp)
 {
@@ -560,6 +585,25 @@ xfs_inobt_count_blocks(
 	return error;
 }
 
+/* Read the finobt block count that the AGI keeps for us. */
+static int
+xfs_finobt_read_blocks(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
+	xfs_extlen_t		*tree_blocks)
+{
+	struct xfs_buf		*agbp;
+	int			error;
+
+	error = xfs_ialloc_read_agi(mp, NULL, agno, &agbp);
+	if (error)
+		return error;
+
+	*tree_blocks = be32_to_cpu(XFS_BUF_TO_AGI(agbp)->agi_fblocks);
+	xfs_buf_relse(agbp);
+	return 0;
+}
+
 /*
  * Figure out how many blocks to reserve and how many are used by this btree.
  */
@@ -576,7 +620,11 @@ xfs_finobt_calc_reserves(
 	if (!xfs_sb_version_hasfinobt(&mp->m_sb))
 		return 0;
 
-	error = xfs_inobt_count_blocks(mp, agno, XFS_BTNUM_FINO, &tree_len);
+	if (xfs_sb_version_hasinobtcounts(&mp->m_sb))
+		error = xfs_finobt_read_blocks(mp, agno, &tree_len);
+	else
+		error = xfs_inobt_count_blocks(mp, agno, XFS_BTNUM_FINO,
+				&tree_len);
 	if (error)
 		return error;
 
@@ -74,5 +74,6 @@ int xfs_inobt_rec_check_count(struct xfs_mount *,
 
 int xfs_finobt_calc_reserves(struct xfs_mount *mp, xfs_agnumber_t agno,
 		xfs_extlen_t *ask, xfs_extlen_t *used);
+xfs_extlen_t xfs_inobt_max_size(struct xfs_mount *mp);
 
 #endif	/* __XFS_IALLOC_BTREE_H__ */
@@ -0,0 +1,798 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include <linux/log2.h>
+
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_inode.h"
+#include "xfs_bmap_btree.h"
+#include "xfs_trace.h"
+
+/*
+ * In-core extent tree.
+ *
+ * The in-core extent records of a fork are kept in a B+tree made of blocks
+ * of XFS_IEXT_NODE_SIZE bytes, i.e. a handful of cache lines each.
+ *
+ * Leaves are nothing but an array of packed struct xfs_bmbt_rec_host records;
+ * there is no leaf header at all.  The number of records in a leaf is kept
+ * in the parent node, or is simply the extent count of the fork if the leaf
+ * is the root of the tree.
+ *
+ * Interior nodes store for each child the start offset of the first record
+ * below it, the pointer to it and the number of records below it.  The keys
+ * give us O(log n) lookups by file offset, and the record counts give us
+ * O(log n) lookups by extent index, which is how most of the bmap code
+ * addresses the extent list.  The end of a node is marked by a NULL child
+ * pointer.
+ *
+ * Callers may modify the records they get from xfs_iext_get_ext in place,
+ * but anyone changing the start offset of a record must call
+ * xfs_iext_update_key afterwards so that the keys stay accurate.
+ *
+ * A root leaf is only sized for the records it holds so that the common case
+ * of a fork with a handful of extents doesn't waste a full block.
+ */
+#define XFS_IEXT_NODE_SIZE	256
+
+#define XFS_IEXT_LEAF_RECS	\
+	((int)(XFS_IEXT_NODE_SIZE / sizeof(struct xfs_bmbt_rec_host)))
+#define XFS_IEXT_NODE_KEYS	\
+	((int)(XFS_IEXT_NODE_SIZE / \
+	       (sizeof(uint64_t) + sizeof(void *) + sizeof(xfs_extnum_t))))
+
+struct xfs_iext_leaf {
+	struct xfs_bmbt_rec_host	recs[XFS_IEXT_LEAF_RECS];
+};
+
+struct xfs_iext_node {
+	uint64_t			keys[XFS_IEXT_NODE_KEYS];
+	void				*ptrs[XFS_IEXT_NODE_KEYS];
+	xfs_extnum_t			counts[XFS_IEXT_NODE_KEYS];
+};
+
+/* A new right sibling created by splitting a full block. */
+struct xfs_iext_split {
+	void				*ptr;
+	uint64_t			key;
+	xfs_extnum_t			count;
+};
+
+static inline int
+xfs_iext_node_nr_entries(
+	struct xfs_iext_node	*node)
+{
+	int			i;
+
+	for (i = 0; i < XFS_IEXT_NODE_KEYS; i++)
+		if (!node->ptrs[i])
+			break;
+	return i;
+}
+
+/* Return the lowest start offset stored in a block at the given level. */
+static inline uint64_t
+xfs_iext_block_key(
+	void			*block,
+	int			level)
+{
+	if (level == 1)
+		return xfs_bmbt_get_startoff(
+				&((struct xfs_iext_leaf *)block)->recs[0]);
+	return ((struct xfs_iext_node *)block)->keys[0];
+}
+
+/* Allocation size of a root leaf holding nr records. */
+static inline size_t
+xfs_iext_root_leaf_size(
+	xfs_extnum_t		nr)
+{
+	if (nr >= XFS_IEXT_LEAF_RECS)
+		return XFS_IEXT_NODE_SIZE;
+	return roundup_pow_of_two(nr) * sizeof(struct xfs_bmbt_rec_host);
+}
+
+/*
+ * Take a consistent copy of the lookup hint.  Returns false if the hint is
+ * being updated or is stale.
+ */
+static bool
+xfs_iext_hint_get(
+	struct xfs_ifork	*ifp,
+	struct xfs_iext_hint	*hint)
+{
+	unsigned int		lock = READ_ONCE(ifp->if_hint.ih_lock);
+
+	if (lock & 1)
+		return false;
+	smp_rmb();
+	*hint = ifp->if_hint;
+	smp_rmb();
+	if (READ_ONCE(ifp->if_hint.ih_lock) != lock)
+		return false;
+	return hint->ih_leaf && hint->ih_seq == READ_ONCE(ifp->if_seq);
+}
+
+/*
+ * Remember the leaf a lookup ended up in.  If someone else is updating the
+ * hint right now we just leave it to them.
+ */
+static void
+xfs_iext_hint_set(
+	struct xfs_ifork	*ifp,
+	void			*leaf,
+	xfs_extnum_t		base,
+	xfs_extnum_t		nr)
+{
+	struct xfs_iext_hint	*hint = &ifp->if_hint;
+	unsigned int		lock = READ_ONCE(hint->ih_lock);
+
+	if (READ_ONCE(hint->ih_leaf) == leaf &&
+	    READ_ONCE(hint->ih_seq) == ifp->if_seq)
+		return;
+	if ((lock & 1) || cmpxchg(&hint->ih_lock, lock, lock + 1) != lock)
+		return;
+	smp_wmb();
+	hint->ih_seq = ifp->if_seq;
+	hint->ih_leaf = leaf;
+	hint->ih_base = base;
+	hint->ih_nr = nr;
+	smp_store_release(&hint->ih_lock, lock + 2);
+}
+
+/* Count number of incore extents based on if_bytes */
+xfs_extnum_t
+xfs_iext_count(struct xfs_ifork *ifp)
+{
+	return ifp->if_bytes / (uint)sizeof(xfs_bmbt_rec_t);
+}
+
+/*
+ * Return a pointer to the extent record at file index idx.
+ */
+struct xfs_bmbt_rec_host *
+xfs_iext_get_ext(
+	struct xfs_ifork	*ifp,
+	xfs_extnum_t		idx)
+{
+	struct xfs_iext_node	*node;
+	struct xfs_iext_hint	hint;
+	void			*block = ifp->if_u1.if_root;
+	int			level;
+	int			i;
+
+	ASSERT(idx >= 0);
+	ASSERT(idx < xfs_iext_count(ifp));
+
+	if (!ifp->if_bytes)
+		return NULL;
+
+	/* Stepping through the records of the last leaf we looked up? */
+	if (xfs_iext_hint_get(ifp, &hint) && idx >= hint.ih_base &&
+	    idx < hint.ih_base + hint.ih_nr)
+		return &((struct xfs_iext_leaf *)hint.ih_leaf)->recs[
+				idx - hint.ih_base];
+
+	for (level = ifp->if_height; level > 1; level--) {
+		node = block;
+		for (i = 0; idx >= node->counts[i]; i++)
+			idx -= node->counts[i];
+		block = node->ptrs[i];
+	}
+	return &((struct xfs_iext_leaf *)block)->recs[idx];
+}
+
+/*
+ * Refresh the tree keys after the start offset of the extent record at index
+ * idx was changed in place.  Only the keys for which that record is the first
+ * one below the key need updating.
+ */
+void
+xfs_iext_update_key(
+	struct xfs_ifork	*ifp,
+	xfs_extnum_t		idx)
+{
+	struct xfs_iext_node	*node;
+	void			*block = ifp->if_u1.if_root;
+	uint64_t		key;
+	int			level;
+	int			i;
+
+	ASSERT(idx >= 0);
+	ASSERT(idx < xfs_iext_count(ifp));
+
+	if (ifp->if_height <= 1)
+		return;
+
+	key = xfs_bmbt_get_startoff(xfs_iext_get_ext(ifp, idx));
+	for (level = ifp->if_height; level > 1; level--) {
+		node = block;
+		for (i = 0; idx >= node->counts[i]; i++)
+			idx -= node->counts[i];
+		if (idx == 0)
+			node->keys[i] = key;
+		block = node->ptrs[i];
+	}
+}
+
+/*
+ * Insert a record into a leaf holding nr records.  If the leaf is full, split
+ * it and return the new right sibling in *split.
+ */
+STATIC bool
+xfs_iext_insert_leaf(
+	struct xfs_iext_leaf		*leaf,
+	xfs_extnum_t			nr,
+	xfs_extnum_t			pos,
+	struct xfs_bmbt_rec_host	*rec,
+	struct xfs_iext_split		*split)
+{
+	struct xfs_iext_leaf		*new;
+	xfs_extnum_t			keep;
+
+	if (nr < XFS_IEXT_LEAF_RECS) {
+		memmove(&leaf->recs[pos + 1], &leaf->recs[pos],
+				(nr - pos) * sizeof(*rec));
+		leaf->recs[pos] = *rec;
+		return false;
+	}
+
+	new = kmem_alloc(XFS_IEXT_NODE_SIZE, KM_NOFS);
+	if (pos == nr) {
+		/*
+		 * Appending to the leaf, which is what happens when reading in
+		 * the extent list or writing a file sequentially.  Start a new
+		 * leaf instead of splitting evenly to keep the leaves full.
+		 */
+		new->recs[0] = *rec;
+		split->count = 1;
+	} else {
+		keep = nr / 2;
+		memcpy(&new->recs[0], &leaf->recs[keep],
+				(nr - keep) * sizeof(*rec));
+		split->count = nr - keep;
+		if (pos <= keep) {
+			xfs_iext_insert_leaf(leaf, keep, pos, rec, NULL);
+		} else {
+			xfs_iext_insert_leaf(new, split->count, pos - keep,
+					rec, NULL);
+			split->count++;
+		}
+	}
+
+	split->ptr = new;
+	split->key = xfs_bmbt_get_startoff(&new->recs[0]);
+	return true;
+}
+
+static void
+xfs_iext_node_insert_entry(
+	struct xfs_iext_node	*node,
+	int			nr,
+	int			pos,
+	struct xfs_iext_split	*entry)
+{
+	memmove(&node->keys[pos + 1], &node->keys[pos],
+			(nr - pos) * sizeof(node->keys[0]));
+	memmove(&node->ptrs[pos + 1], &node->ptrs[pos],
+			(nr - pos) * sizeof(node->ptrs[0]));
+	memmove(&node->counts[pos + 1], &node->counts[pos],
+			(nr - pos) * sizeof(node->counts[0]));
+	node->keys[pos] = entry->key;
+	node->ptrs[pos] = entry->ptr;
+	node->counts[pos] = entry->count;
+}
+
+/*
+ * Add a child entry at slot pos of a node holding nr entries.  If the node is
+ * full, split it and return the new right sibling in *split.
+ */
+STATIC bool
+xfs_iext_node_add_entry(
+	struct xfs_iext_node	*node,
+	int			nr,
+	int			pos,
+	struct xfs_iext_split	*entry,
+	struct xfs_iext_split	*split)
+{
+	struct xfs_iext_node	*new;
+	int			keep;
+	int			i;
+
+	if (nr < XFS_IEXT_NODE_KEYS) {
+		xfs_iext_node_insert_entry(node, nr, pos, entry);
+		return false;
+	}
+
+	new = kmem_zalloc(XFS_IEXT_NODE_SIZE, KM_NOFS);
+	if (pos == nr) {
+		/* Appending, see xfs_iext_insert_leaf. */
+		xfs_iext_node_insert_entry(new, 0, 0, entry);
+	} else {
+		keep = nr / 2;
+		for (i = keep; i < nr; i++) {
+			new->keys[i - keep] = node->keys[i];
+			new->ptrs[i - keep] = node->ptrs[i];
+			new->counts[i - keep] = node->counts[i];
+			node->keys[i] = 0;
+			node->ptrs[i] = NULL;
+			node->counts[i] = 0;
+		}
+		if (pos <= keep)
+			xfs_iext_node_insert_entry(node, keep, pos, entry);
+		else
+			xfs_iext_node_insert_entry(new, nr - keep, pos - keep,
+					entry);
+	}
+
+	split->ptr = new;
+	split->key = new->keys[0];
+	split->count = 0;
+	for (i = 0; i < XFS_IEXT_NODE_KEYS && new->ptrs[i]; i++)
+		split->count += new->counts[i];
+	return true;
+}
+
+/*
+ * Insert a record at index pos of the subtree below node, which sits at the
+ * given level of the tree.  Inserts at the boundary between two children go
+ * to the end of the left one so that the keys only change when inserting at
+ * the very start of the tree.
+ */
+STATIC bool
+xfs_iext_insert_node(
+	struct xfs_iext_node		*node,
+	int				level,
+	xfs_extnum_t			pos,
+	struct xfs_bmbt_rec_host	*rec,
+	struct xfs_iext_split		*split)
+{
+	struct xfs_iext_split		child;
+	int				nr = xfs_iext_node_nr_entries(node);
+	int				i;
+	bool				did_split;
+
+	for (i = 0; i < nr - 1; i++) {
+		if (pos <= node->counts[i])
+			break;
+		pos -= node->counts[i];
+	}
+
+	if (level == 2)
+		did_split = xfs_iext_insert_leaf(node->ptrs[i],
+				node->counts[i], pos, rec, &child);
+	else
+		did_split = xfs_iext_insert_node(node->ptrs[i], level - 1,
+				pos, rec, &child);
+
+	node->counts[i]++;
+	if (pos == 0)
+		node->keys[i] = xfs_bmbt_get_startoff(rec);
+	if (!did_split)
+		return false;
+
+	node->counts[i] -= child.count;
+	return xfs_iext_node_add_entry(node, nr, i + 1, &child, split);
+}
+
+/*
+ * Insert a single, already packed extent record at index idx.
+ */
+void
+xfs_iext_insert_rec(
+	struct xfs_ifork		*ifp,
+	xfs_extnum_t			idx,
+	struct xfs_bmbt_rec_host	*rec)
+{
+	struct xfs_iext_node		*node;
+	struct xfs_iext_split		split;
+	xfs_extnum_t			nr = xfs_iext_count(ifp);
+	size_t				new_size;
+	bool				did_split;
+
+	ASSERT(idx >= 0 && idx <= nr);
+
+	if (ifp->if_height == 0) {
+		ASSERT(nr == 0);
+		ifp->if_u1.if_root = kmem_alloc(xfs_iext_root_leaf_size(1),
+				KM_NOFS);
+		ifp->if_height = 1;
+	} else if (ifp->if_height == 1 && nr < XFS_IEXT_LEAF_RECS) {
+		new_size = xfs_iext_root_leaf_size(nr + 1);
+		if (new_size > xfs_iext_root_leaf_size(nr))
+			ifp->if_u1.if_root = kmem_realloc(ifp->if_u1.if_root,
+					new_size, KM_NOFS);
+	}
+
+	if (ifp->if_height == 1)
+		did_split = xfs_iext_insert_leaf(ifp->if_u1.if_root, nr, idx,
+				rec, &split);
+	else
+		did_split = xfs_iext_insert_node(ifp->if_u1.if_root,
+				ifp->if_height, idx, rec, &split);
+
+	if (did_split) {
+		/* Grow the tree by one level. */
+		node = kmem_zalloc(XFS_IEXT_NODE_SIZE, KM_NOFS);
+		node->keys[0] = xfs_iext_block_key(ifp->if_u1.if_root,
+				ifp->if_height);
+		node->ptrs[0] = ifp->if_u1.if_root;
+		node->counts[0] = nr + 1 - split.count;
+		node->keys[1] = split.key;
+		node->ptrs[1] = split.ptr;
+		node->counts[1] = split.count;
+		ifp->if_u1.if_root = node;
+		ifp->if_height++;
+	}
+	ifp->if_bytes += sizeof(xfs_bmbt_rec_t);
+}
+
+/*
+ * Insert new item(s) into the extent records for incore inode
+ * fork 'ifp'.  'count' new items are inserted at index 'idx'.
+ */
+void
+xfs_iext_insert(
+	struct xfs_inode	*ip,		/* incore inode pointer */
+	xfs_extnum_t		idx,		/* starting index of new items */
+	xfs_extnum_t		count,		/* number of inserted items */
+	struct xfs_bmbt_irec	*new,		/* items to insert */
+	int			state)		/* type of extent conversion */
+{
+	struct xfs_ifork	*ifp = xfs_iext_state_to_fork(ip, state);
+	struct xfs_bmbt_rec_host rec;
+	xfs_extnum_t		i;		/* extent record index */
+
+	trace_xfs_iext_insert(ip, idx, new, state, _RET_IP_);
+
+	ASSERT(ifp->if_flags & XFS_IFEXTENTS);
+	xfs_iext_bump_seq(ifp);
+	for (i = idx; i < idx + count; i++, new++) {
+		xfs_bmbt_set_all(&rec, new);
+		xfs_iext_insert_rec(ifp, i, &rec);
+	}
+}
+
+static void
+xfs_iext_node_remove_entry(
+	struct xfs_iext_node	*node,
+	int			nr,
+	int			pos)
+{
+	memmove(&node->keys[pos], &node->keys[pos + 1],
+			(nr - pos - 1) * sizeof(node->keys[0]));
+	memmove(&node->ptrs[pos], &node->ptrs[pos + 1],
+			(nr - pos - 1) * sizeof(node->ptrs[0]));
+	memmove(&node->counts[pos], &node->counts[pos + 1],
+			(nr - pos - 1) * sizeof(node->counts[0]));
+	node->keys[nr - 1] = 0;
+	node->ptrs[nr - 1] = NULL;
+	node->counts[nr - 1] = 0;
+}
+
+/*
+ * Merge child pos + 1 of node into child pos and free it.  The children sit
+ * at the given level of the tree.
+ */
+STATIC void
+xfs_iext_merge_children(
+	struct xfs_iext_node	*node,
+	int			nr,
+	int			pos,
+	int			level)
+{
+	struct xfs_iext_node	*left, *right;
+	int			lnr, rnr;
+
+	if (level == 1) {
+		memcpy(&((struct xfs_iext_leaf *)node->ptrs[pos])->recs[
+					node->counts[pos]],
+		       &((struct xfs_iext_leaf *)node->ptrs[pos + 1])->recs[0],
+		       node->counts[pos + 1] *
+				sizeof(struct xfs_bmbt_rec_host));
+	} else {
+		left = node->ptrs[pos];
+		right = node->ptrs[pos + 1];
+		lnr = xfs_iext_node_nr_entries(left);
+		rnr = xfs_iext_node_nr_entries(right);
+		memcpy(&left->keys[lnr], &right->keys[0],
+				rnr * sizeof(left->keys[0]));
+		memcpy(&left->ptrs[lnr], &right->ptrs[0],
+				rnr * sizeof(left->ptrs[0]));
+		memcpy(&left->counts[lnr], &right->counts[0],
+				rnr * sizeof(left->counts[0]));
+	}
+
+	node->counts[pos] += node->counts[pos + 1];
+	kmem_free(node->ptrs[pos + 1]);
+	xfs_iext_node_remove_entry(node, nr, pos + 1);
+}
+
+/* Size of a child in units of its capacity (records or entries). */
+static inline int
+xfs_iext_child_size(
+	struct xfs_iext_node	*node,
+	int			pos,
+	int			level)
+{
+	if (level == 1)
+		return node->counts[pos];
+	return xfs_iext_node_nr_entries(node->ptrs[pos]);
+}
+
+/*
+ * If child pos of node dropped below half full, merge it with a neighbour
+ * if the two of them fit into a single block.
+ */
+STATIC void
+xfs_iext_rebalance(
+	struct xfs_iext_node	*node,
+	int			nr,
+	int			pos,
+	int			level)
+{
+	int			max;
+	int			size;
+
+	max = level == 1 ? XFS_IEXT_LEAF_RECS : XFS_IEXT_NODE_KEYS;
+	size = xfs_iext_child_size(node, pos, level);
+	if (size >= max / 2)
+		return;
+
+	if (pos > 0 && xfs_iext_child_size(node, pos - 1, level) + size <= max)
+		xfs_iext_merge_children(node, nr, pos - 1, level);
+	else if (pos + 1 < nr &&
+		 xfs_iext_child_size(node, pos + 1, level) + size <= max)
+		xfs_iext_merge_children(node, nr, pos, level);
+}
+
+STATIC void
+xfs_iext_remove_leaf(
+	struct xfs_iext_leaf	*leaf,
+	xfs_extnum_t		nr,
+	xfs_extnum_t		pos)
+{
+	memmove(&leaf->recs[pos], &leaf->recs[pos + 1],
+			(nr - pos - 1) * sizeof(struct xfs_bmbt_rec_host));
+}
+
+/*
+ * Remove the record at index pos of the subtree below node, which sits at the
+ * given level of the tree.  Empty children are freed, and children that end
+ * up less than half full are merged with a neighbour where possible.
+ */
+STATIC void
+xfs_iext_remove_node(
+	struct xfs_iext_node	*node,
+	int			level,
+	xfs_extnum_t		pos)
+{
+	int			nr = xfs_iext_node_nr_entries(node);
+	void			*child;
+	int			i;
+
+	for (i = 0; i < nr; i++) {
+		if (pos < node->counts[i])
+			break;
+		pos -= node->counts[i];
+	}
+	ASSERT(i < nr);
+
+	child = node->ptrs[i];
+	if (level == 2)
+		xfs_iext_remove_leaf(child, node->counts[i], pos);
+	else
+		xfs_iext_remove_node(child, level - 1, pos);
+
+	if (--node->counts[i] == 0) {
+		kmem_free(child);
+		xfs_iext_node_remove_entry(node, nr, i);
+		return;
+	}
+
+	if (pos == 0)
+		node->keys[i] = xfs_iext_block_key(child, level - 1);
+	xfs_iext_rebalance(node, nr, i, level - 1);
+}
+
+/* Remove the single record at index idx. */
+STATIC void
+xfs_iext_remove_one(
+	struct xfs_ifork	*ifp,
+	xfs_extnum_t		idx)
+{
+	struct xfs_iext_node	*node;
+	xfs_extnum_t		nr = xfs_iext_count(ifp);
+	size_t			new_size;
+
+	ASSERT(idx >= 0 && idx < nr);
+
+	if (ifp->if_height == 1) {
+		xfs_iext_remove_leaf(ifp->if_u1.if_root, nr, idx);
+		if (nr == 1) {
+			kmem_free(ifp->if_u1.if_root);
+			ifp->if_u1.if_root = NULL;
+			ifp->if_height = 0;
+		} else {
+			new_size = xfs_iext_root_leaf_size(nr - 1);
+			if (new_size < xfs_iext_root_leaf_size(nr))
+				ifp->if_u1.if_root = kmem_realloc(
+						ifp->if_u1.if_root, new_size,
+						KM_NOFS);
+		}
+	} else {
+		xfs_iext_remove_node(ifp->if_u1.if_root, ifp->if_height, idx);
+
+		/* Shrink the tree while the root has just a single child. */
+		node = ifp->if_u1.if_root;
+		while (ifp->if_height > 1 && !node->ptrs[1]) {
+			ifp->if_u1.if_root = node->ptrs[0];
+			ifp->if_height--;
+			kmem_free(node);
+			node = ifp->if_u1.if_root;
+			if (ifp->if_height == 1)
+				ifp->if_u1.if_root = kmem_realloc(
+						ifp->if_u1.if_root,
+						xfs_iext_root_leaf_size(nr - 1),
+						KM_NOFS);
+		}
+	}
+	ifp->if_bytes -= sizeof(xfs_bmbt_rec_t);
+}
+
+/*
+ * Remove ext_diff extent records starting at index idx.
+ */
+void
+xfs_iext_remove(
+	struct xfs_inode	*ip,		/* incore inode pointer */
+	xfs_extnum_t		idx,		/* index to begin removing exts */
+	int			ext_diff,	/* number of extents to remove */
+	int			state)		/* type of extent conversion */
+{
+	struct xfs_ifork	*ifp = xfs_iext_state_to_fork(ip, state);
+
+	trace_xfs_iext_remove(ip, idx, state, _RET_IP_);
+
+	ASSERT(ext_diff > 0);
+	ASSERT(idx + ext_diff <= xfs_iext_count(ifp));
+	xfs_iext_bump_seq(ifp);
+	while (ext_diff-- > 0)
+		xfs_iext_remove_one(ifp, idx);
+}
+
+STATIC void
+xfs_iext_destroy_node(
+	void			*block,
+	int			level)
+{
+	struct xfs_iext_node	*node = block;
+	int			i;
+
+	if (level > 1) {
+		for (i = 0; i < XFS_IEXT_NODE_KEYS && node->ptrs[i]; i++)
+			xfs_iext_destroy_node(node->ptrs[i], level - 1);
+	}
+	kmem_free(block);
+}
+
+/*
+ * Free incore file extents.
+ */
+void
+xfs_iext_destroy(
+	struct xfs_ifork	*ifp)		/* inode fork pointer */
+{
+	if (ifp->if_height)
+		xfs_iext_destroy_node(ifp->if_u1.if_root, ifp->if_height);
+	ifp->if_u1.if_root = NULL;
+	ifp->if_height = 0;
+	ifp->if_real_bytes = 0;
+	ifp->if_bytes = 0;
+	ifp->if_hint.ih_leaf = NULL;
+}
+
+/*
+ * Return a pointer to the extent record for file system block bno, or to the
+ * first extent record after it if bno lies in a hole.  Store the index of the
+ * returned extent record in *idxp.  If bno is beyond the last extent, return
+ * NULL and store the extent count in *idxp.
+ *
+ * Streaming I/O looks up offset after offset in the same leaf, so we first try
+ * the leaf the previous lookup ended up in.  If bno falls within it we only
+ * need to search that one leaf, which is no more than a few cache lines, and
+ * the tree walk from the root is skipped.
+ */
+struct xfs_bmbt_rec_host *
+xfs_iext_bno_to_ext(
+	struct xfs_ifork	*ifp,		/* inode fork pointer */
+	xfs_fileoff_t		bno,		/* block number to search for */
+	xfs_extnum_t		*idxp)		/* index of target extent */
+{
+	struct xfs_bmbt_rec_host *ep;
+	struct xfs_iext_node	*node;
+	struct xfs_iext_leaf	*leaf;
+	void			*block = ifp->if_u1.if_root;
+	xfs_extnum_t		nextents = xfs_iext_count(ifp);
+	xfs_extnum_t		nr = nextents;
+	xfs_extnum_t		base = 0;
+	xfs_extnum_t		low, high, mid;
+	struct xfs_iext_hint	hint;
+	int			level;
+	int			i;
+
+	if (nextents == 0) {
+		*idxp = 0;
+		return NULL;
+	}
+
+	/*
+	 * The answer is in the hinted leaf if bno doesn't lie before its first
+	 * record (unless it's the first leaf) and the leaf's last record ends
+	 * beyond bno.
+	 */
+	if (xfs_iext_hint_get(ifp, &hint)) {
+		leaf = hint.ih_leaf;
+		ep = &leaf->recs[hint.ih_nr - 1];
+		if ((hint.ih_base == 0 ||
+		     xfs_bmbt_get_startoff(&leaf->recs[0]) <= bno) &&
+		    xfs_bmbt_get_startoff(ep) + xfs_bmbt_get_blockcount(ep) >
+		    bno) {
+			base = hint.ih_base;
+			nr = hint.ih_nr;
+			goto search_leaf;
+		}
+	}
+
+	for (level = ifp->if_height; level > 1; level--) {
+		node = block;
+		for (i = 0; i < XFS_IEXT_NODE_KEYS - 1; i++) {
+			if (!node->ptrs[i + 1] || node->keys[i + 1] > bno)
+				break;
+			base += node->counts[i];
+		}
+		nr = node->counts[i];
+		block = node->ptrs[i];
+	}
+
+	leaf = block;
+	xfs_iext_hint_set(ifp, leaf, base, nr);
+
+search_leaf:
+	/* Find the first record in the leaf that ends beyond bno. */
+	low = 0;
+	high = nr;
+	while (low < high) {
+		mid = (low + high) >> 1;
+		ep = &leaf->recs[mid];
+		if (xfs_bmbt_get_startoff(ep) + xfs_bmbt_get_blockcount(ep) <=
+		    bno)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	*idxp = base + low;
+	if (low < nr)
+		return &leaf->recs[low];
+	if (base + low == nextents)
+		return NULL;
+	return xfs_iext_get_ext(ifp, base + low);
+}
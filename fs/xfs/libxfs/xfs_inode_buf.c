@@ -380,6 +380,27 @@ xfs_log_dinode_to_disk(
 	}
 }
 
+/* Apply a compact log inode core on top of a v3 on-disk inode. */
+void
+xfs_log_dinode_small_to_disk(
+	struct xfs_log_dinode_small	*from,
+	struct xfs_dinode		*to)
+{
+	ASSERT(to->di_version == 3);
+
+	to->di_atime.t_sec = cpu_to_be32(from->di_atime.t_sec);
+	to->di_atime.t_nsec = cpu_to_be32(from->di_atime.t_nsec);
+	to->di_mtime.t_sec = cpu_to_be32(from->di_mtime.t_sec);
+	to->di_mtime.t_nsec = cpu_to_be32(from->di_mtime.t_nsec);
+	to->di_ctime.t_sec = cpu_to_be32(from->di_ctime.t_sec);
+	to->di_ctime.t_nsec = cpu_to_be32(from->di_ctime.t_nsec);
+
+	to->di_size = cpu_to_be64(from->di_size);
+	to->di_nblocks = cpu_to_be64(from->di_nblocks);
+	to->di_changecount = cpu_to_be64(from->di_changecount);
+	to->di_lsn = cpu_to_be64(from->di_lsn);
+}
+
 bool
 xfs_dinode_verify(
 	struct xfs_mount	*mp,
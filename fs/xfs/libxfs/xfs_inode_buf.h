@@ -26,6 +26,9 @@ struct xfs_dinode;
  * xfs_inode and represents the current on disk values but the structure is not
  * in on-disk format.  That is, this structure is always translated to on-disk
  * format specific structures at the appropriate time.
+ *
+ * Every cached inode carries one of these, so keep the fields ordered to
+ * leave no padding holes.
  */
 struct xfs_icdinode {
 	int8_t		di_version;	/* inode version */
@@ -42,13 +45,12 @@ struct xfs_icdinode {
 	xfs_aextnum_t	di_anextents;	/* number of extents in attribute fork*/
 	uint8_t		di_forkoff;	/* attr fork offs, <<3 for 64b align */
 	int8_t		di_aformat;	/* format of attr fork's data */
-	uint32_t	di_dmevmask;	/* DMIG event mask */
-	uint16_t	di_dmstate;	/* DMIG state info */
 	uint16_t	di_flags;	/* random flags, XFS_DIFLAG_... */
-
-	uint64_t	di_flags2;	/* more random flags */
+	uint16_t	di_dmstate;	/* DMIG state info */
+	uint32_t	di_dmevmask;	/* DMIG event mask */
 	uint32_t	di_cowextsize;	/* basic cow extent size for file */
 
+	uint64_t	di_flags2;	/* more random flags */
 	xfs_ictimestamp_t di_crtime;	/* time created */
 };
 
@@ -73,6 +75,8 @@ void	xfs_inode_to_disk(struct xfs_inode *ip, struct xfs_dinode *to,
 void	xfs_inode_from_disk(struct xfs_inode *ip, struct xfs_dinode *from);
 void	xfs_log_dinode_to_disk(struct xfs_log_dinode *from,
 			       struct xfs_dinode *to);
+void	xfs_log_dinode_small_to_disk(struct xfs_log_dinode_small *from,
+				     struct xfs_dinode *to);
 
 bool	xfs_dinode_good_version(struct xfs_mount *mp, __u8 version);
 
@@ -35,6 +35,7 @@ typedef uint32_t xlog_tid_t;
 
 #define XLOG_MIN_ICLOGS		2
 #define XLOG_MAX_ICLOGS		8
+#define XLOG_MAX_LARGE_ICLOGS	32		/* v2 logs only */
 #define XLOG_HEADER_MAGIC_NUM	0xFEEDbabe	/* Invalid cycle number */
 #define XLOG_VERSION_1		1
 #define XLOG_VERSION_2		2		/* Large IClogs, Log sunit */
@@ -42,6 +43,7 @@ typedef uint32_t xlog_tid_t;
 #define XLOG_MIN_RECORD_BSIZE	(16*1024)	/* eventually 32k */
 #define XLOG_BIG_RECORD_BSIZE	(32*1024)	/* 32k buffers */
 #define XLOG_MAX_RECORD_BSIZE	(256*1024)
+#define XLOG_MAX_LARGE_RECORD_BSIZE (4*1024*1024) /* v2 logs only */
 #define XLOG_HEADER_CYCLE_SIZE	(32*1024)	/* cycle data in header */
 #define XLOG_MIN_RECORD_BSHIFT	14		/* 16384 == 1 << 14 */
 #define XLOG_BIG_RECORD_BSHIFT	15		/* 32k == 1 << 15 */
@@ -116,7 +118,9 @@ static inline uint xlog_get_cycle(char *ptr)
 #define XLOG_REG_TYPE_CUD_FORMAT	24
 #define XLOG_REG_TYPE_BUI_FORMAT	25
 #define XLOG_REG_TYPE_BUD_FORMAT	26
-#define XLOG_REG_TYPE_MAX		26
+#define XLOG_REG_TYPE_SXI_FORMAT	27
+#define XLOG_REG_TYPE_SXD_FORMAT	28
+#define XLOG_REG_TYPE_MAX		28
 
 /*
  * Flags to log operation header
@@ -239,6 +243,8 @@ typedef struct xfs_trans_header {
 #define	XFS_LI_CUD		0x1243
 #define	XFS_LI_BUI		0x1244	/* bmbt update intent */
 #define	XFS_LI_BUD		0x1245
+#define	XFS_LI_SXI		0x1246	/* extent swap intent */
+#define	XFS_LI_SXD		0x1247
 
 #define XFS_LI_TYPE_DESC \
 	{ XFS_LI_EFI,		"XFS_LI_EFI" }, \
@@ -254,7 +260,9 @@ typedef struct xfs_trans_header {
 	{ XFS_LI_CUI,		"XFS_LI_CUI" }, \
 	{ XFS_LI_CUD,		"XFS_LI_CUD" }, \
 	{ XFS_LI_BUI,		"XFS_LI_BUI" }, \
-	{ XFS_LI_BUD,		"XFS_LI_BUD" }
+	{ XFS_LI_BUD,		"XFS_LI_BUD" }, \
+	{ XFS_LI_SXI,		"XFS_LI_SXI" }, \
+	{ XFS_LI_SXD,		"XFS_LI_SXD" }
 
 /*
  * Inode Log Item Format definitions.
@@ -328,6 +336,7 @@ typedef struct xfs_inode_log_format_64 {
 #define	XFS_ILOG_ABROOT	0x100	/* log i_af.i_broot */
 #define XFS_ILOG_DOWNER	0x200	/* change the data fork owner on replay */
 #define XFS_ILOG_AOWNER	0x400	/* change the attr fork owner on replay */
+#define XFS_ILOG_CCORE	0x800	/* compact core, see xfs_log_dinode_small */
 
 
 /*
@@ -338,6 +347,12 @@ typedef struct xfs_inode_log_format_64 {
  */
 #define XFS_ILOG_TIMESTAMP	0x4000
 
+/*
+ * Like XFS_ILOG_TIMESTAMP, but for di_size.  Never makes it to disk either;
+ * a core that only has these two set can be logged in the compact format.
+ */
+#define XFS_ILOG_ISIZE		0x8000
+
 #define	XFS_ILOG_NONCORE	(XFS_ILOG_DDATA | XFS_ILOG_DEXT | \
 				 XFS_ILOG_DBROOT | XFS_ILOG_DEV | \
 				 XFS_ILOG_UUID | XFS_ILOG_ADATA | \
@@ -355,7 +370,8 @@ typedef struct xfs_inode_log_format_64 {
 				 XFS_ILOG_DEV | XFS_ILOG_UUID | \
 				 XFS_ILOG_ADATA | XFS_ILOG_AEXT | \
 				 XFS_ILOG_ABROOT | XFS_ILOG_TIMESTAMP | \
-				 XFS_ILOG_DOWNER | XFS_ILOG_AOWNER)
+				 XFS_ILOG_ISIZE | XFS_ILOG_DOWNER | \
+				 XFS_ILOG_AOWNER)
 
 static inline int xfs_ilog_fbroot(int w)
 {
@@ -441,6 +457,26 @@ static inline uint xfs_log_dinode_size(int version)
 	return offsetof(struct xfs_log_dinode, di_next_unlinked);
 }
 
+/*
+ * Compact inode core, logged with XFS_ILOG_CCORE instead of XFS_ILOG_CORE
+ * when only the timestamps, size and block count of a v3 inode have changed
+ * since it was last written back.  Recovery applies these fields on top of
+ * the on-disk inode, which is only correct because a fully logged core keeps
+ * the inode pinned in the log until it has been flushed.  Only used when
+ * XFS_SB_FEAT_INCOMPAT_LOG_ICORE is set.
+ */
+struct xfs_log_dinode_small {
+	uint16_t	di_magic;	/* inode magic # = XFS_DINODE_MAGIC */
+	uint16_t	di_pad[3];	/* unused, zeroed space */
+	xfs_ictimestamp_t di_atime;	/* time last accessed */
+	xfs_ictimestamp_t di_mtime;	/* time last modified */
+	xfs_ictimestamp_t di_ctime;	/* time created/inode modified */
+	xfs_fsize_t	di_size;	/* number of bytes in file */
+	xfs_rfsblock_t	di_nblocks;	/* # of direct & btree blocks used */
+	uint64_t	di_changecount;	/* number of attribute changes */
+	xfs_lsn_t	di_lsn;		/* flush sequence */
+};
+
 /*
  * Buffer Log Format defintions
  *
@@ -782,6 +818,49 @@ struct xfs_bud_log_format {
 	uint64_t		bud_bui_id;	/* id of corresponding bui */
 };
 
+/*
+ * SXI/SXD (extent swap) log format definitions
+ */
+
+/*
+ * Exchange the mappings of [startoff1, startoff1 + blockcount) in the data
+ * fork of inode1 with [startoff2, startoff2 + blockcount) in the data fork of
+ * inode2.  As each mapping pair is exchanged the intent is relogged with the
+ * offsets advanced and the blockcount reduced.
+ */
+struct xfs_swap_extent {
+	uint64_t		se_inode1;
+	uint64_t		se_inode2;
+	uint64_t		se_startoff1;
+	uint64_t		se_startoff2;
+	uint64_t		se_blockcount;
+	uint64_t		se_flags;
+};
+
+/* No flags are defined yet. */
+#define XFS_SWAP_EXTENT_FLAGS		(0)
+
+/*
+ * This is the structure used to lay out an sxi log item in the log.
+ */
+struct xfs_sxi_log_format {
+	uint16_t		sxi_type;	/* sxi log item type */
+	uint16_t		sxi_size;	/* size of this item */
+	uint32_t		__pad;
+	uint64_t		sxi_id;		/* sxi identifier */
+	struct xfs_swap_extent	sxi_extent;	/* range to swap */
+};
+
+/*
+ * This is the structure used to lay out an sxd log item in the log.
+ */
+struct xfs_sxd_log_format {
+	uint16_t		sxd_type;	/* sxd log item type */
+	uint16_t		sxd_size;	/* size of this item */
+	uint32_t		__pad;
+	uint64_t		sxd_sxi_id;	/* id of corresponding sxi */
+};
+
 /*
  * Dquot Log format definitions.
  *
@@ -40,6 +40,7 @@ typedef struct xlog_recover_item {
 	int			ri_cnt;	/* count of regions found */
 	int			ri_total;	/* total regions */
 	xfs_log_iovec_t		*ri_buf;	/* ptr to regions buffer */
+	xfs_lsn_t		ri_lsn;		/* lsn of owning xact, pass 2 */
 } xlog_recover_item_t;
 
 typedef struct xlog_recover {
@@ -54,10 +55,14 @@ typedef struct xlog_recover {
 #define ITEM_TYPE(i)	(*(unsigned short *)(i)->ri_buf[0].i_addr)
 
 /*
- * This is the number of entries in the l_buf_cancel_table used during
- * recovery.
+ * Bounds on the number of entries in the l_buf_cancel_table used during
+ * recovery.  The table is sized from the log so that large logs with many
+ * cancelled buffers don't end up walking long hash chains; we aim for one
+ * bucket per XLOG_BC_BUCKET_BBS basic blocks of log.
  */
 #define	XLOG_BC_TABLE_SIZE	64
+#define	XLOG_BC_TABLE_MAX	(1U << 16)
+#define	XLOG_BC_BUCKET_BBS	BTOBB(64 * 1024)
 
 #define	XLOG_RECOVER_CRCPASS	0
 #define	XLOG_RECOVER_PASS1	1
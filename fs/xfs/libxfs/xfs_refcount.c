@@ -119,6 +119,21 @@ xfs_refcount_get_rec(
 	return error;
 }
 
+/*
+ * Let in-core caches of shared extent state know that this AG's refcount
+ * btree has changed.
+ */
+STATIC void
+xfs_refcount_bump_gen(
+	struct xfs_btree_cur		*cur)
+{
+	struct xfs_perag		*pag;
+
+	pag = xfs_perag_get(cur->bc_mp, cur->bc_private.a.agno);
+	atomic_inc(&pag->pagf_refcount_gen);
+	xfs_perag_put(pag);
+}
+
 /*
  * Update the record referred to by cur to the value given
  * by [bno, len, refcount].
@@ -137,6 +152,7 @@ xfs_refcount_update(
 	rec.refc.rc_blockcount = cpu_to_be32(irec->rc_blockcount);
 	rec.refc.rc_refcount = cpu_to_be32(irec->rc_refcount);
 	error = xfs_btree_update(cur, &rec);
+	xfs_refcount_bump_gen(cur);
 	if (error)
 		trace_xfs_refcount_update_error(cur->bc_mp,
 				cur->bc_private.a.agno, error, _RET_IP_);
@@ -161,6 +177,7 @@ xfs_refcount_insert(
 	cur->bc_rec.rc.rc_blockcount = irec->rc_blockcount;
 	cur->bc_rec.rc.rc_refcount = irec->rc_refcount;
 	error = xfs_btree_insert(cur, i);
+	xfs_refcount_bump_gen(cur);
 	XFS_WANT_CORRUPTED_GOTO(cur->bc_mp, *i == 1, out_error);
 out_error:
 	if (error)
@@ -190,6 +207,7 @@ xfs_refcount_delete(
 	XFS_WANT_CORRUPTED_GOTO(cur->bc_mp, found_rec == 1, out_error);
 	trace_xfs_refcount_delete(cur->bc_mp, cur->bc_private.a.agno, &irec);
 	error = xfs_btree_delete(cur, i);
+	xfs_refcount_bump_gen(cur);
 	XFS_WANT_CORRUPTED_GOTO(cur->bc_mp, *i == 1, out_error);
 	if (error)
 		goto out_error;
@@ -1136,6 +1154,54 @@ xfs_refcount_finish_one(
 	return error;
 }
 
+/*
+ * Try to fold a new refcount adjustment into the last one queued on this
+ * transaction chain.  Freeing or remapping runs of a shared file's extents
+ * queues adjustments of physically adjacent ranges, and adjusting their
+ * union once does the same to the refcountbt as adjusting each of them, with
+ * one search and one pair of edge splits instead of one per extent.  Extents
+ * are often walked backwards, so merge at either end.
+ *
+ * CoW staging updates are left alone, as their order relative to each other
+ * matters.
+ */
+static bool
+xfs_refcount_merge_intent(
+	struct xfs_mount		*mp,
+	struct xfs_defer_ops		*dfops,
+	enum xfs_refcount_intent_type	type,
+	xfs_fsblock_t			startblock,
+	xfs_extlen_t			blockcount)
+{
+	struct list_head		*li;
+	struct xfs_refcount_intent	*ri;
+
+	if (type != XFS_REFCOUNT_INCREASE && type != XFS_REFCOUNT_DECREASE)
+		return false;
+
+	li = xfs_defer_last_item(dfops, XFS_DEFER_OPS_TYPE_REFCOUNT);
+	if (!li)
+		return false;
+	ri = container_of(li, struct xfs_refcount_intent, ri_list);
+
+	if (ri->ri_type != type ||
+	    ri->ri_blockcount + blockcount > MAXEXTLEN ||
+	    XFS_FSB_TO_AGNO(mp, ri->ri_startblock) !=
+	    XFS_FSB_TO_AGNO(mp, startblock))
+		return false;
+
+	if (ri->ri_startblock + ri->ri_blockcount == startblock) {
+		ri->ri_blockcount += blockcount;
+		return true;
+	}
+	if (startblock + blockcount == ri->ri_startblock) {
+		ri->ri_startblock = startblock;
+		ri->ri_blockcount += blockcount;
+		return true;
+	}
+	return false;
+}
+
 /*
  * Record a refcount intent for later processing.
  */
@@ -1153,6 +1219,9 @@ __xfs_refcount_add(
 			type, XFS_FSB_TO_AGBNO(mp, startblock),
 			blockcount);
 
+	if (xfs_refcount_merge_intent(mp, dfops, type, startblock, blockcount))
+		return 0;
+
 	ri = kmem_alloc(sizeof(struct xfs_refcount_intent),
 			KM_SLEEP | KM_NOFS);
 	INIT_LIST_HEAD(&ri->ri_list);
@@ -1573,6 +1642,9 @@ xfs_refcount_free_cow_extent(
 			fsb, len);
 }
 
+/* Leftover CoW extents freed per transaction chain during recovery. */
+#define XFS_REFCOUNT_RECOVER_BATCH	32
+
 struct xfs_refcount_recovery {
 	struct list_head		rr_list;
 	struct xfs_refcount_irec	rr_rrec;
@@ -1614,6 +1686,7 @@ xfs_refcount_recover_cow_leftovers(
 	struct xfs_defer_ops		dfops;
 	xfs_fsblock_t			fsb;
 	xfs_agblock_t			agbno;
+	unsigned int			nr = 0;
 	int				error;
 
 	if (mp->m_sb.sb_agblocks >= XFS_REFC_COW_START)
@@ -1657,12 +1730,21 @@ xfs_refcount_recover_cow_leftovers(
 	xfs_trans_brelse(tp, agbp);
 	xfs_trans_cancel(tp);
 
-	/* Now iterate the list to free the leftovers */
+	/*
+	 * Now iterate the list to free the leftovers.  Each extent is freed
+	 * with its own deferred ops, but we keep rolling the same
+	 * transaction for a batch of them rather than allocating a new
+	 * transaction (and waiting for log space) for every extent.
+	 */
+	tp = NULL;
 	list_for_each_entry_safe(rr, n, &debris, rr_list) {
 		/* Set up transaction. */
-		error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write, 0, 0, 0, &tp);
-		if (error)
-			goto out_free;
+		if (!tp) {
+			error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write,
+					0, 0, 0, &tp);
+			if (error)
+				goto out_free;
+		}
 
 		trace_xfs_refcount_recover_extent(mp, agno, &rr->rr_rrec);
 
@@ -1683,14 +1765,19 @@ xfs_refcount_recover_cow_leftovers(
 		if (error)
 			goto out_defer;
 
-		error = xfs_trans_commit(tp);
-		if (error)
-			goto out_free;
-
 		list_del(&rr->rr_list);
 		kmem_free(rr);
+
+		if (++nr % XFS_REFCOUNT_RECOVER_BATCH == 0) {
+			error = xfs_trans_commit(tp);
+			tp = NULL;
+			if (error)
+				goto out_free;
+		}
 	}
 
+	if (tp)
+		error = xfs_trans_commit(tp);
 	return error;
 out_defer:
 	xfs_defer_cancel(&dfops);
@@ -61,6 +61,8 @@ xfs_refcountbt_set_root(
 	agf->agf_refcount_root = ptr->s;
 	be32_add_cpu(&agf->agf_refcount_level, inc);
 	pag->pagf_refcount_level += inc;
+	if (inc > 0)
+		xfs_trans_dresv_update(cur->bc_mp, pag);
 	xfs_perag_put(pag);
 
 	xfs_alloc_log_agf(cur->bc_tp, agbp,
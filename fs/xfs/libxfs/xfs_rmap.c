@@ -2173,6 +2173,53 @@ xfs_rmap_update_is_needed(
 	return xfs_sb_version_hasrmapbt(&mp->m_sb) && whichfork != XFS_COW_FORK;
 }
 
+/*
+ * Try to fold a new mapping into the last rmap intent queued on this
+ * transaction chain.  Appending to a file produces a run of maps of extents
+ * that are contiguous both on disk and in the file, and mapping them as one
+ * extent has the same effect on the rmapbt as mapping them one at a time, so
+ * we can save a btree update and a log item slot for each of them.
+ *
+ * Only maps are merged: an unmap or conversion has to fall within a single
+ * existing rmap record, which two adjacent updates might not.  Only the last
+ * queued intent is considered so that the order of updates is preserved.
+ */
+static bool
+xfs_rmap_merge_intent(
+	struct xfs_mount		*mp,
+	struct xfs_defer_ops		*dfops,
+	enum xfs_rmap_intent_type	type,
+	uint64_t			owner,
+	int				whichfork,
+	struct xfs_bmbt_irec		*bmap)
+{
+	struct list_head		*li;
+	struct xfs_rmap_intent		*ri;
+	struct xfs_bmbt_irec		*prev;
+
+	if (type != XFS_RMAP_MAP && type != XFS_RMAP_MAP_SHARED)
+		return false;
+
+	li = xfs_defer_last_item(dfops, XFS_DEFER_OPS_TYPE_RMAP);
+	if (!li)
+		return false;
+	ri = container_of(li, struct xfs_rmap_intent, ri_list);
+	prev = &ri->ri_bmap;
+
+	if (ri->ri_type != type || ri->ri_owner != owner ||
+	    ri->ri_whichfork != whichfork ||
+	    prev->br_state != bmap->br_state ||
+	    prev->br_startblock + prev->br_blockcount != bmap->br_startblock ||
+	    prev->br_startoff + prev->br_blockcount != bmap->br_startoff ||
+	    prev->br_blockcount + bmap->br_blockcount > MAXEXTLEN ||
+	    XFS_FSB_TO_AGNO(mp, prev->br_startblock) !=
+	    XFS_FSB_TO_AGNO(mp, bmap->br_startblock))
+		return false;
+
+	prev->br_blockcount += bmap->br_blockcount;
+	return true;
+}
+
 /*
  * Record a rmap intent; the list is kept sorted first by AG and then by
  * increasing age.
@@ -2196,6 +2243,9 @@ __xfs_rmap_add(
 			bmap->br_blockcount,
 			bmap->br_state);
 
+	if (xfs_rmap_merge_intent(mp, dfops, type, owner, whichfork, bmap))
+		return 0;
+
 	ri = kmem_alloc(sizeof(struct xfs_rmap_intent), KM_SLEEP | KM_NOFS);
 	INIT_LIST_HEAD(&ri->ri_list);
 	ri->ri_type = type;
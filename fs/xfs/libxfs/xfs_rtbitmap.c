@@ -515,6 +515,12 @@ xfs_rtmodify_summary_int(
 
 		*sp += delta;
 		xfs_trans_log_buf(tp, bp, first, first + sizeof(*sp) - 1);
+		if (mp->m_rsum_index) {
+			if (*sp)
+				__set_bit(bbno, xfs_rtsum_index_level(mp, log));
+			else
+				__clear_bit(bbno, xfs_rtsum_index_level(mp, log));
+		}
 	}
 	if (sum)
 		*sum = *sp;
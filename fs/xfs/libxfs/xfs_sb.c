@@ -70,7 +70,9 @@ xfs_perag_get(
 }
 
 /*
- * search from @first to find the next perag with the given tag set.
+ * search from @first to find the next perag with the given inode cache tag
+ * set.  The tags live in each perag rather than in the perag radix tree so
+ * that setting them never needs m_perag_lock.
  */
 struct xfs_perag *
 xfs_perag_get_tag(
@@ -79,20 +81,24 @@ xfs_perag_get_tag(
 	int			tag)
 {
 	struct xfs_perag	*pag;
-	int			found;
+	xfs_agnumber_t		agno;
 	int			ref;
 
+	if (!atomic_read(&mp->m_ici_tagged[tag]))
+		return NULL;
+
 	rcu_read_lock();
-	found = radix_tree_gang_lookup_tag(&mp->m_perag_tree,
-					(void **)&pag, first, 1, tag);
-	if (found <= 0) {
+	for (agno = first; agno < mp->m_sb.sb_agcount; agno++) {
+		pag = radix_tree_lookup(&mp->m_perag_tree, agno);
+		if (!pag || !test_bit(tag, &pag->pag_ici_tags))
+			continue;
+		ref = atomic_inc_return(&pag->pag_ref);
 		rcu_read_unlock();
-		return NULL;
+		trace_xfs_perag_get_tag(mp, pag->pag_agno, ref, _RET_IP_);
+		return pag;
 	}
-	ref = atomic_inc_return(&pag->pag_ref);
 	rcu_read_unlock();
-	trace_xfs_perag_get_tag(mp, pag->pag_agno, ref, _RET_IP_);
-	return pag;
+	return NULL;
 }
 
 void
@@ -179,6 +185,13 @@ xfs_mount_validate_sb(
 			return -EFSCORRUPTED;
 	}
 
+	if (xfs_sb_version_hasinobtcounts(sbp) &&
+	    !xfs_sb_version_hasfinobt(sbp)) {
+		xfs_notice(mp,
+"Inode btree counters require the free inode btree.");
+		return -EFSCORRUPTED;
+	}
+
 	if (xfs_sb_version_has_pquotino(sbp)) {
 		if (sbp->sb_qflags & (XFS_OQUOTA_ENFD | XFS_OQUOTA_CHKD)) {
 			xfs_notice(mp,
@@ -840,7 +853,7 @@ xfs_log_sb(
 
 	mp->m_sb.sb_icount = percpu_counter_sum(&mp->m_icount);
 	mp->m_sb.sb_ifree = percpu_counter_sum(&mp->m_ifree);
-	mp->m_sb.sb_fdblocks = percpu_counter_sum(&mp->m_fdblocks);
+	mp->m_sb.sb_fdblocks = xfs_fdblocks_sum(mp);
 
 	xfs_sb_to_disk(XFS_BUF_TO_SBP(bp), &mp->m_sb);
 	xfs_trans_buf_set_type(tp, bp, XFS_BLFT_SB_BUF);
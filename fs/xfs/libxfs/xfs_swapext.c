@@ -0,0 +1,206 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_defer.h"
+#include "xfs_inode.h"
+#include "xfs_trans.h"
+#include "xfs_bmap.h"
+#include "xfs_quota.h"
+#include "xfs_swapext.h"
+#include "xfs_trace.h"
+
+/*
+ * Extent Swapping
+ * ===============
+ *
+ * Exchanging a range of mappings between two files is done with a chain of
+ * transactions driven by a single extent swap intent (SXI).  Each time the
+ * intent is finished we look up the mappings at the start of both ranges,
+ * trim them to the shorter of the two and queue bmap updates that unmap
+ * both and map each one into the other file.  The intent is then requeued
+ * with the range advanced past the pair, behind the bmap updates, so that
+ * each pair is fully exchanged before we look at the next one.  Once the
+ * range is used up, one last empty intent is logged with the final pair's
+ * bmap updates and then finished without doing anything.
+ *
+ * The bmap updates and the advanced intent are logged in the same
+ * transaction as the done item for the old intent, so if we crash, log
+ * recovery picks up exactly where we left off and finishes the exchange.
+ *
+ * Up to XFS_SWAPEXT_BATCH pairs are queued each time the intent is finished,
+ * so the intent only has to be relogged once per batch.  Later pairs in a
+ * batch cover file ranges and blocks that the earlier pairs' updates don't
+ * touch, so their mappings can be read before those updates are done.
+ *
+ * Block counts move between the inodes as the pairs are exchanged, so quota
+ * usage is transferred pair by pair in the transaction that queues them.
+ */
+
+/* Schedule the exchange of a range of mappings between two files. */
+int
+xfs_swapext_schedule(
+	struct xfs_mount		*mp,
+	struct xfs_defer_ops		*dfops,
+	struct xfs_inode		*ip1,
+	struct xfs_inode		*ip2,
+	xfs_fileoff_t			startoff1,
+	xfs_fileoff_t			startoff2,
+	xfs_filblks_t			blockcount)
+{
+	struct xfs_swapext_intent	*sxi;
+	int				error;
+
+	ASSERT(ip1 != ip2);
+	ASSERT(blockcount > 0);
+
+	trace_xfs_swapext_defer(ip1, ip2, startoff1, startoff2, blockcount);
+
+	error = xfs_defer_join(dfops, ip1);
+	if (error)
+		return error;
+	error = xfs_defer_join(dfops, ip2);
+	if (error)
+		return error;
+
+	sxi = kmem_alloc(sizeof(struct xfs_swapext_intent), KM_SLEEP | KM_NOFS);
+	INIT_LIST_HEAD(&sxi->sxi_list);
+	sxi->sxi_ip1 = ip1;
+	sxi->sxi_ip2 = ip2;
+	sxi->sxi_startoff1 = startoff1;
+	sxi->sxi_startoff2 = startoff2;
+	sxi->sxi_blockcount = blockcount;
+	sxi->sxi_flags = 0;
+
+	xfs_defer_add(dfops, XFS_DEFER_OPS_TYPE_SWAPEXT, &sxi->sxi_list);
+	return 0;
+}
+
+/* Exchange the next pair of mappings and advance the intent past them. */
+STATIC int
+xfs_swapext_one_pair(
+	struct xfs_trans		*tp,
+	struct xfs_defer_ops		*dfops,
+	struct xfs_swapext_intent	*sxi)
+{
+	struct xfs_mount		*mp = tp->t_mountp;
+	struct xfs_bmbt_irec		irec1;
+	struct xfs_bmbt_irec		irec2;
+	xfs_filblks_t			len;
+	long				delta = 0;
+	int				nimaps;
+	int				error;
+
+	/* Read the mappings at the start of both ranges. */
+	nimaps = 1;
+	error = xfs_bmapi_read(sxi->sxi_ip1, sxi->sxi_startoff1,
+			sxi->sxi_blockcount, &irec1, &nimaps, 0);
+	if (error)
+		return error;
+	ASSERT(nimaps == 1);
+
+	nimaps = 1;
+	error = xfs_bmapi_read(sxi->sxi_ip2, sxi->sxi_startoff2,
+			irec1.br_blockcount, &irec2, &nimaps, 0);
+	if (error)
+		return error;
+	ASSERT(nimaps == 1);
+
+	/* Everything should have been written back before we started. */
+	if (irec1.br_startblock == DELAYSTARTBLOCK ||
+	    irec2.br_startblock == DELAYSTARTBLOCK) {
+		ASSERT(0);
+		return -EFSCORRUPTED;
+	}
+
+	/* Trim both mappings to the shorter of the two. */
+	len = min(irec1.br_blockcount, irec2.br_blockcount);
+	irec1.br_blockcount = len;
+	irec2.br_blockcount = len;
+
+	trace_xfs_swap_extent_rmap_remap_piece(sxi->sxi_ip1, &irec1);
+	trace_xfs_swap_extent_rmap_remap_piece(sxi->sxi_ip2, &irec2);
+
+	/*
+	 * Unmap both extents before mapping either of them, so that the rmap
+	 * updates never see two owners for the same blocks.  Holes are
+	 * skipped by the bmap update helpers.
+	 */
+	error = xfs_bmap_unmap_extent(mp, dfops, sxi->sxi_ip2, &irec2);
+	if (error)
+		return error;
+	error = xfs_bmap_unmap_extent(mp, dfops, sxi->sxi_ip1, &irec1);
+	if (error)
+		return error;
+
+	/* Move the quota usage along with the blocks. */
+	if (irec1.br_startblock != HOLESTARTBLOCK)
+		delta -= len;
+	if (irec2.br_startblock != HOLESTARTBLOCK)
+		delta += len;
+	if (delta) {
+		xfs_trans_mod_dquot_byino(tp, sxi->sxi_ip1,
+				XFS_TRANS_DQ_BCOUNT, delta);
+		xfs_trans_mod_dquot_byino(tp, sxi->sxi_ip2,
+				XFS_TRANS_DQ_BCOUNT, -delta);
+	}
+
+	irec1.br_startoff = sxi->sxi_startoff2;
+	irec2.br_startoff = sxi->sxi_startoff1;
+
+	error = xfs_bmap_map_extent(mp, dfops, sxi->sxi_ip1, &irec2);
+	if (error)
+		return error;
+	error = xfs_bmap_map_extent(mp, dfops, sxi->sxi_ip2, &irec1);
+	if (error)
+		return error;
+
+	sxi->sxi_startoff1 += len;
+	sxi->sxi_startoff2 += len;
+	sxi->sxi_blockcount -= len;
+	return 0;
+}
+
+/*
+ * Exchange the next batch of mapping pairs in the range described by the
+ * intent, and advance the intent past them.  An intent with nothing left to
+ * exchange only marks the end of the swap.
+ */
+int
+xfs_swapext_finish_one(
+	struct xfs_trans		*tp,
+	struct xfs_defer_ops		*dfops,
+	struct xfs_swapext_intent	*sxi)
+{
+	int				i;
+	int				error;
+
+	trace_xfs_swapext_deferred(sxi->sxi_ip1, sxi->sxi_ip2,
+			sxi->sxi_startoff1, sxi->sxi_startoff2,
+			sxi->sxi_blockcount);
+
+	for (i = 0; i < XFS_SWAPEXT_BATCH && sxi->sxi_blockcount > 0; i++) {
+		error = xfs_swapext_one_pair(tp, dfops, sxi);
+		if (error)
+			return error;
+	}
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef __XFS_SWAPEXT_H__
+#define __XFS_SWAPEXT_H__
+
+struct xfs_defer_ops;
+struct xfs_inode;
+struct xfs_mount;
+struct xfs_trans;
+
+/*
+ * In-core description of a range of file mappings to exchange between the
+ * data forks of two inodes.  The range is advanced as each mapping pair is
+ * exchanged, so the intent always describes the work that remains.
+ */
+struct xfs_swapext_intent {
+	struct list_head	sxi_list;
+	struct xfs_inode	*sxi_ip1;
+	struct xfs_inode	*sxi_ip2;
+	xfs_fileoff_t		sxi_startoff1;
+	xfs_fileoff_t		sxi_startoff2;
+	xfs_filblks_t		sxi_blockcount;
+	uint64_t		sxi_flags;
+};
+
+/* Mapping pairs exchanged each time the intent is finished. */
+#define XFS_SWAPEXT_BATCH	4
+
+int xfs_swapext_schedule(struct xfs_mount *mp, struct xfs_defer_ops *dfops,
+		struct xfs_inode *ip1, struct xfs_inode *ip2,
+		xfs_fileoff_t startoff1, xfs_fileoff_t startoff2,
+		xfs_filblks_t blockcount);
+int xfs_swapext_finish_one(struct xfs_trans *tp, struct xfs_defer_ops *dfops,
+		struct xfs_swapext_intent *sxi);
+
+#endif	/* __XFS_SWAPEXT_H__ */
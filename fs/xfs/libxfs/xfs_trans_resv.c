@@ -73,23 +73,48 @@ xfs_calc_buf_res(
  * num trees * ((2 blocks/level * max depth) - 1)
  *
  * Keep in mind that max depth is calculated separately for each type of tree.
+ * The depths used are those in @lv, which are the maximum possible depths
+ * unless we are sizing reservations for the trees as they currently are.
  */
-uint
-xfs_allocfree_log_count(
-	struct xfs_mount *mp,
-	uint		num_ops)
+STATIC uint
+xfs_allocfree_log_count_levels(
+	struct xfs_mount		*mp,
+	const struct xfs_resv_levels	*lv,
+	uint				num_ops)
 {
 	uint		blocks;
 
-	blocks = num_ops * 2 * (2 * mp->m_ag_maxlevels - 1);
+	blocks = num_ops * 2 * (2 * lv->rl_ag - 1);
 	if (xfs_sb_version_hasrmapbt(&mp->m_sb))
-		blocks += num_ops * (2 * mp->m_rmap_maxlevels - 1);
+		blocks += num_ops * (2 * lv->rl_rmap - 1);
 	if (xfs_sb_version_hasreflink(&mp->m_sb))
-		blocks += num_ops * (2 * mp->m_refc_maxlevels - 1);
+		blocks += num_ops * (2 * lv->rl_refc - 1);
 
 	return blocks;
 }
 
+/* The deepest the per-AG btrees can ever be. */
+void
+xfs_trans_resv_max_levels(
+	struct xfs_mount	*mp,
+	struct xfs_resv_levels	*lv)
+{
+	lv->rl_ag = mp->m_ag_maxlevels;
+	lv->rl_rmap = mp->m_rmap_maxlevels;
+	lv->rl_refc = mp->m_refc_maxlevels;
+}
+
+uint
+xfs_allocfree_log_count(
+	struct xfs_mount *mp,
+	uint		num_ops)
+{
+	struct xfs_resv_levels	lv;
+
+	xfs_trans_resv_max_levels(mp, &lv);
+	return xfs_allocfree_log_count_levels(mp, &lv, num_ops);
+}
+
 /*
  * Logging inodes is really tricksy. They are logged in memory format,
  * which means that what we write into the log doesn't directly translate into
@@ -208,17 +233,18 @@ xfs_calc_finobt_res(
  */
 STATIC uint
 xfs_calc_write_reservation(
-	struct xfs_mount	*mp)
+	struct xfs_mount		*mp,
+	const struct xfs_resv_levels	*lv)
 {
 	return XFS_DQUOT_LOGRES(mp) +
 		MAX((xfs_calc_inode_res(mp, 1) +
 		     xfs_calc_buf_res(XFS_BM_MAXLEVELS(mp, XFS_DATA_FORK),
 				      XFS_FSB_TO_B(mp, 1)) +
 		     xfs_calc_buf_res(3, mp->m_sb.sb_sectsize) +
-		     xfs_calc_buf_res(xfs_allocfree_log_count(mp, 2),
+		     xfs_calc_buf_res(xfs_allocfree_log_count_levels(mp, lv, 2),
 				      XFS_FSB_TO_B(mp, 1))),
 		    (xfs_calc_buf_res(5, mp->m_sb.sb_sectsize) +
-		     xfs_calc_buf_res(xfs_allocfree_log_count(mp, 2),
+		     xfs_calc_buf_res(xfs_allocfree_log_count_levels(mp, lv, 2),
 				      XFS_FSB_TO_B(mp, 1))));
 }
 
@@ -237,17 +263,18 @@ xfs_calc_write_reservation(
  */
 STATIC uint
 xfs_calc_itruncate_reservation(
-	struct xfs_mount	*mp)
+	struct xfs_mount		*mp,
+	const struct xfs_resv_levels	*lv)
 {
 	return XFS_DQUOT_LOGRES(mp) +
 		MAX((xfs_calc_inode_res(mp, 1) +
 		     xfs_calc_buf_res(XFS_BM_MAXLEVELS(mp, XFS_DATA_FORK) + 1,
 				      XFS_FSB_TO_B(mp, 1))),
 		    (xfs_calc_buf_res(9, mp->m_sb.sb_sectsize) +
-		     xfs_calc_buf_res(xfs_allocfree_log_count(mp, 4),
+		     xfs_calc_buf_res(xfs_allocfree_log_count_levels(mp, lv, 4),
 				      XFS_FSB_TO_B(mp, 1)) +
 		    xfs_calc_buf_res(5, 0) +
-		    xfs_calc_buf_res(xfs_allocfree_log_count(mp, 1),
+		    xfs_calc_buf_res(xfs_allocfree_log_count_levels(mp, lv, 1),
 				     XFS_FSB_TO_B(mp, 1)) +
 		    xfs_calc_buf_res(2 + mp->m_ialloc_blks +
 				     mp->m_in_maxlevels, 0)));
@@ -760,9 +787,10 @@ xfs_calc_qm_setqlim_reservation(
  */
 STATIC uint
 xfs_calc_qm_dqalloc_reservation(
-	struct xfs_mount	*mp)
+	struct xfs_mount		*mp,
+	const struct xfs_resv_levels	*lv)
 {
-	return xfs_calc_write_reservation(mp) +
+	return xfs_calc_write_reservation(mp, lv) +
 		xfs_calc_buf_res(1,
 			XFS_FSB_TO_B(mp, XFS_DQUOT_CLUSTER_SIZE_FSB) - 1);
 }
@@ -807,18 +835,22 @@ xfs_trans_resv_calc(
 	struct xfs_mount	*mp,
 	struct xfs_trans_resv	*resp)
 {
+	struct xfs_resv_levels	lv;
+
+	xfs_trans_resv_max_levels(mp, &lv);
+
 	/*
 	 * The following transactions are logged in physical format and
 	 * require a permanent reservation on space.
 	 */
-	resp->tr_write.tr_logres = xfs_calc_write_reservation(mp);
+	resp->tr_write.tr_logres = xfs_calc_write_reservation(mp, &lv);
 	if (xfs_sb_version_hasreflink(&mp->m_sb))
 		resp->tr_write.tr_logcount = XFS_WRITE_LOG_COUNT_REFLINK;
 	else
 		resp->tr_write.tr_logcount = XFS_WRITE_LOG_COUNT;
 	resp->tr_write.tr_logflags |= XFS_TRANS_PERM_LOG_RES;
 
-	resp->tr_itruncate.tr_logres = xfs_calc_itruncate_reservation(mp);
+	resp->tr_itruncate.tr_logres = xfs_calc_itruncate_reservation(mp, &lv);
 	if (xfs_sb_version_hasreflink(&mp->m_sb))
 		resp->tr_itruncate.tr_logcount =
 				XFS_ITRUNCATE_LOG_COUNT_REFLINK;
@@ -879,7 +911,8 @@ xfs_trans_resv_calc(
 	resp->tr_growrtalloc.tr_logcount = XFS_DEFAULT_PERM_LOG_COUNT;
 	resp->tr_growrtalloc.tr_logflags |= XFS_TRANS_PERM_LOG_RES;
 
-	resp->tr_qm_dqalloc.tr_logres = xfs_calc_qm_dqalloc_reservation(mp);
+	resp->tr_qm_dqalloc.tr_logres =
+			xfs_calc_qm_dqalloc_reservation(mp, &lv);
 	if (xfs_sb_version_hasreflink(&mp->m_sb))
 		resp->tr_qm_dqalloc.tr_logcount = XFS_WRITE_LOG_COUNT_REFLINK;
 	else
@@ -913,3 +946,18 @@ xfs_trans_resv_calc(
 	resp->tr_growrtzero.tr_logres = xfs_calc_growrtzero_reservation(mp);
 	resp->tr_growrtfree.tr_logres = xfs_calc_growrtfree_reservation(mp);
 }
+
+/*
+ * Recalculate the reservations of the data path transactions whose size is
+ * dominated by allocation btree splits for per-AG btrees of the depths in @lv.
+ * Everything else in @resp is left alone.
+ */
+void
+xfs_trans_resv_calc_levels(
+	struct xfs_mount		*mp,
+	struct xfs_trans_resv		*resp,
+	const struct xfs_resv_levels	*lv)
+{
+	resp->tr_write.tr_logres = xfs_calc_write_reservation(mp, lv);
+	resp->tr_itruncate.tr_logres = xfs_calc_itruncate_reservation(mp, lv);
+}
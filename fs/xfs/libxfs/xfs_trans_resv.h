@@ -103,7 +103,20 @@ struct xfs_trans_resv {
 #define	XFS_ATTRSET_LOG_COUNT		3
 #define	XFS_ATTRRM_LOG_COUNT		3
 
+/*
+ * Depths of the per-AG btrees that a set of reservations is sized for.
+ */
+struct xfs_resv_levels {
+	uint		rl_ag;		/* free space btrees */
+	uint		rl_rmap;	/* reverse mapping btree */
+	uint		rl_refc;	/* refcount btree */
+};
+
 void xfs_trans_resv_calc(struct xfs_mount *mp, struct xfs_trans_resv *resp);
+void xfs_trans_resv_calc_levels(struct xfs_mount *mp,
+		struct xfs_trans_resv *resp, const struct xfs_resv_levels *lv);
+void xfs_trans_resv_max_levels(struct xfs_mount *mp,
+		struct xfs_resv_levels *lv);
 uint xfs_allocfree_log_count(struct xfs_mount *mp, uint num_ops);
 
 #endif	/* __XFS_TRANS_RESV_H__ */
@@ -891,6 +891,7 @@ xfs_scrub_agi(
 	xfs_agino_t			last_agino;
 	xfs_agino_t			count;
 	xfs_agino_t			freecount;
+	xfs_extlen_t			blocks;
 	bool				is_freesp;
 	bool				has_inodes;
 	bool				has_rmap;
@@ -995,16 +996,33 @@ xfs_scrub_agi(
 		xfs_scrub_block_xref_check_ok(sc, sc->sa.agi_bp,
 				be32_to_cpu(agi->agi_count) == count &&
 				be32_to_cpu(agi->agi_freecount) == freecount);
+
+		if (!xfs_sb_version_hasinobtcounts(&mp->m_sb))
+			break;
+		error = xfs_btree_count_blocks(psa->ino_cur, &blocks);
+		if (!xfs_scrub_should_xref(sc, &error, &psa->ino_cur))
+			break;
+		xfs_scrub_block_xref_check_ok(sc, sc->sa.agi_bp,
+				be32_to_cpu(agi->agi_iblocks) == blocks);
 		break;
 	}
 
 	/* Cross-reference with finobt. */
-	if (psa->fino_cur) {
+	while (psa->fino_cur) {
 		error = xfs_ialloc_has_inodes_at_extent(psa->fino_cur,
 				XFS_AGI_BLOCK(mp), 1, &has_inodes);
-		if (xfs_scrub_should_xref(sc, &error, &psa->fino_cur))
-			xfs_scrub_block_xref_check_ok(sc, sc->sa.agi_bp,
-					!has_inodes);
+		if (!xfs_scrub_should_xref(sc, &error, &psa->fino_cur))
+			break;
+		xfs_scrub_block_xref_check_ok(sc, sc->sa.agi_bp, !has_inodes);
+
+		if (!xfs_sb_version_hasinobtcounts(&mp->m_sb))
+			break;
+		error = xfs_btree_count_blocks(psa->fino_cur, &blocks);
+		if (!xfs_scrub_should_xref(sc, &error, &psa->fino_cur))
+			break;
+		xfs_scrub_block_xref_check_ok(sc, sc->sa.agi_bp,
+				be32_to_cpu(agi->agi_fblocks) == blocks);
+		break;
 	}
 
 	/* Cross-reference with the rmapbt. */
@@ -53,6 +53,33 @@ xfs_scrub_setup_ag_allocbt(
 
 /* Free space btree scrubber. */
 
+/*
+ * Free extent size histogram for an AG, gathered while we walk the bnobt.
+ * Bucket i counts the free extents of 2^i to 2^(i+1) - 1 blocks.
+ */
+#define XFS_SCRUB_FREESP_BUCKETS	32
+
+struct xfs_scrub_freesp {
+	unsigned long long		extents[XFS_SCRUB_FREESP_BUCKETS];
+	unsigned long long		blocks[XFS_SCRUB_FREESP_BUCKETS];
+};
+
+/* Emit the free extent size histogram through the trace buffer. */
+STATIC void
+xfs_scrub_freesp_report(
+	struct xfs_scrub_context	*sc,
+	struct xfs_scrub_freesp		*fs)
+{
+	int				i;
+
+	for (i = 0; i < XFS_SCRUB_FREESP_BUCKETS; i++) {
+		if (!fs->extents[i])
+			continue;
+		trace_xfs_scrub_freesp_extents(sc, sc->sa.agno, 1U << i,
+				fs->extents[i], fs->blocks[i]);
+	}
+}
+
 /* Scrub a bnobt/cntbt record. */
 STATIC int
 xfs_scrub_allocbt_helper(
@@ -79,6 +106,13 @@ xfs_scrub_allocbt_helper(
 	agf = XFS_BUF_TO_AGF(bs->sc->sa.agf_bp);
 	rec_end = (unsigned long long)bno + len;
 
+	if (bs->private && len > 0) {
+		struct xfs_scrub_freesp	*fs = bs->private;
+
+		fs->extents[ilog2(len)]++;
+		fs->blocks[ilog2(len)] += len;
+	}
+
 	xfs_scrub_btree_check_ok(bs->sc, bs->cur, 0,
 			bno < mp->m_sb.sb_agblocks &&
 			bno < be32_to_cpu(agf->agf_length) &&
@@ -161,11 +195,28 @@ xfs_scrub_allocbt(
 {
 	struct xfs_owner_info		oinfo;
 	struct xfs_btree_cur		*cur;
+	struct xfs_scrub_freesp		*fs = NULL;
+	int				error;
 
 	xfs_rmap_ag_owner(&oinfo, XFS_RMAP_OWN_AG);
 	cur = which == XFS_BTNUM_BNO ? sc->sa.bno_cur : sc->sa.cnt_cur;
-	return xfs_scrub_btree(sc, cur, xfs_scrub_allocbt_helper,
-			&oinfo, NULL);
+
+	/*
+	 * Both free space btrees index the same extents, so only gather
+	 * the size histogram from the bnobt.
+	 */
+	if (which == XFS_BTNUM_BNO &&
+	    trace_xfs_scrub_freesp_extents_enabled())
+		fs = kmem_zalloc(sizeof(*fs), KM_SLEEP | KM_NOFS);
+
+	error = xfs_scrub_btree(sc, cur, xfs_scrub_allocbt_helper,
+			&oinfo, fs);
+	if (fs) {
+		if (!error && !(sc->sm->sm_flags & XFS_SCRUB_OFLAG_CORRUPT))
+			xfs_scrub_freesp_report(sc, fs);
+		kmem_free(fs);
+	}
+	return error;
 }
 
 int
@@ -0,0 +1,500 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_defer.h"
+#include "xfs_btree.h"
+#include "xfs_bit.h"
+#include "xfs_log_format.h"
+#include "xfs_trans.h"
+#include "xfs_sb.h"
+#include "xfs_alloc.h"
+#include "xfs_alloc_btree.h"
+#include "xfs_rmap.h"
+#include "xfs_rmap_btree.h"
+#include "xfs_extent_busy.h"
+#include "scrub/xfs_scrub.h"
+#include "scrub/scrub.h"
+#include "scrub/common.h"
+#include "scrub/repair.h"
+#include <linux/sort.h>
+
+/*
+ * Free Space Btree Repair
+ *
+ * Every block in an AG is either mapped by the rmapbt or free, so the
+ * free space btrees can be reconstructed from the gaps between the
+ * reverse mappings.  The blocks of the old bnobt and cntbt are the
+ * OWN_AG extents that are neither on the AGFL nor part of the rmapbt;
+ * we leave them out of the new trees and free them once the AGF points
+ * at the replacements, which puts them back into the new free space
+ * btrees the normal way.
+ *
+ * The new btree blocks are carved out of the tails of the largest free
+ * extents.  We always leave at least one block behind so that carving
+ * never changes the number of free space records we have to store.
+ */
+
+struct xfs_repair_alloc {
+	struct xfs_repair_extent_list	free;		/* rmap gaps */
+	struct xfs_repair_extent_list	ag_owned;	/* OWN_AG extents */
+	struct xfs_repair_extent_list	not_allocbt;	/* agfl + rmapbt */
+	struct xfs_scrub_context	*sc;
+	xfs_agblock_t			next_bno;
+	unsigned int			nr_records;
+};
+
+/* Record the free space before this rmap and any OWN_AG blocks. */
+STATIC int
+xfs_repair_alloc_rmap_fn(
+	struct xfs_btree_cur		*cur,
+	struct xfs_rmap_irec		*rec,
+	void				*priv)
+{
+	struct xfs_repair_alloc		*ra = priv;
+	int				error = 0;
+
+	if (xfs_scrub_should_terminate(&error))
+		return error;
+
+	if (rec->rm_startblock > ra->next_bno) {
+		error = xfs_repair_collect_extent(ra->sc, &ra->free,
+				ra->next_bno, rec->rm_startblock - ra->next_bno);
+		if (error)
+			return error;
+		ra->nr_records++;
+	}
+	ra->next_bno = max_t(xfs_agblock_t, ra->next_bno,
+			rec->rm_startblock + rec->rm_blockcount);
+
+	if (rec->rm_owner == XFS_RMAP_OWN_AG)
+		return xfs_repair_collect_extent(ra->sc, &ra->ag_owned,
+				rec->rm_startblock, rec->rm_blockcount);
+	return 0;
+}
+
+/* Remember an AGFL block so that we don't free it. */
+STATIC int
+xfs_repair_alloc_agfl_fn(
+	struct xfs_scrub_context	*sc,
+	xfs_agblock_t			agbno,
+	void				*priv)
+{
+	struct xfs_repair_alloc		*ra = priv;
+
+	return xfs_repair_collect_extent(sc, &ra->not_allocbt, agbno, 1);
+}
+
+/* Remember a rmapbt block so that we don't free it. */
+STATIC int
+xfs_repair_alloc_rmapbt_fn(
+	struct xfs_btree_cur		*cur,
+	int				level,
+	void				*priv)
+{
+	struct xfs_repair_alloc		*ra = priv;
+	struct xfs_buf			*bp;
+	xfs_fsblock_t			fsb;
+
+	xfs_btree_get_block(cur, level, &bp);
+	if (!bp)
+		return 0;
+
+	fsb = XFS_DADDR_TO_FSB(cur->bc_mp, bp->b_bn);
+	return xfs_repair_collect_extent(ra->sc, &ra->not_allocbt,
+			XFS_FSB_TO_AGBNO(cur->bc_mp, fsb), 1);
+}
+
+/* Sort free extents by decreasing length. */
+static int
+xfs_repair_alloc_len_cmp(
+	const void			*a,
+	const void			*b)
+{
+	const struct xfs_repair_extent	*ap = *(struct xfs_repair_extent **)a;
+	const struct xfs_repair_extent	*bp = *(struct xfs_repair_extent **)b;
+
+	if (ap->len > bp->len)
+		return -1;
+	else if (ap->len < bp->len)
+		return 1;
+	return 0;
+}
+
+/*
+ * Allocate @nr_blocks blocks for the new btrees from the tails of the
+ * largest free extents that aren't busy, and give them to OWN_AG.
+ */
+STATIC int
+xfs_repair_alloc_carve(
+	struct xfs_repair_alloc		*ra,
+	xfs_agblock_t			*blocks,
+	xfs_extlen_t			nr_blocks)
+{
+	struct xfs_scrub_context	*sc = ra->sc;
+	struct xfs_mount		*mp = sc->mp;
+	struct xfs_repair_extent	**exts;
+	struct xfs_repair_extent	*rex;
+	struct xfs_owner_info		oinfo;
+	xfs_agnumber_t			agno = sc->sa.agno;
+	xfs_agblock_t			start;
+	xfs_extlen_t			got = 0;
+	xfs_extlen_t			take;
+	unsigned int			i = 0;
+	int				error = 0;
+
+	if (ra->nr_records == 0)
+		return -ENOSPC;
+
+	exts = kmem_zalloc_large(ra->nr_records * sizeof(*exts), KM_SLEEP);
+	if (!exts)
+		return -ENOMEM;
+	for_each_xfs_repair_extent(rex, &ra->free)
+		exts[i++] = rex;
+	sort(exts, ra->nr_records, sizeof(*exts), xfs_repair_alloc_len_cmp,
+			NULL);
+
+	xfs_rmap_ag_owner(&oinfo, XFS_RMAP_OWN_AG);
+	for (i = 0; i < ra->nr_records && got < nr_blocks; i++) {
+		rex = exts[i];
+		if (rex->len < 2)
+			break;
+
+		take = min_t(xfs_extlen_t, rex->len - 1, nr_blocks - got);
+		start = rex->agbno + rex->len - take;
+		if (xfs_extent_busy_search(mp, agno, start, take))
+			continue;
+
+		error = xfs_rmap_alloc(sc->tp, sc->sa.agf_bp, agno, start, take,
+				&oinfo);
+		if (error)
+			goto out;
+
+		rex->len -= take;
+		while (take-- > 0)
+			blocks[got++] = start++;
+	}
+
+	if (got < nr_blocks)
+		error = -ENOSPC;
+out:
+	kmem_free(exts);
+	return error;
+}
+
+/* Sort incore free space records in cntbt order. */
+static int
+xfs_repair_alloc_cnt_cmp(
+	const void			*a,
+	const void			*b)
+{
+	const struct xfs_alloc_rec_incore *ap = a;
+	const struct xfs_alloc_rec_incore *bp = b;
+
+	if (ap->ar_blockcount > bp->ar_blockcount)
+		return 1;
+	else if (ap->ar_blockcount < bp->ar_blockcount)
+		return -1;
+	if (ap->ar_startblock > bp->ar_startblock)
+		return 1;
+	else if (ap->ar_startblock < bp->ar_startblock)
+		return -1;
+	return 0;
+}
+
+/* State for bulk loading one of the new free space btrees. */
+struct xfs_repair_alloc_load {
+	struct xfs_alloc_rec_incore	*irecs;
+	xfs_agblock_t			*blocks;
+	unsigned int			next_rec;
+	unsigned int			next_block;
+};
+
+/* Feed the next free space record to the bulk loader. */
+STATIC int
+xfs_repair_alloc_get_record(
+	struct xfs_btree_cur		*cur,
+	void				*priv)
+{
+	struct xfs_repair_alloc_load	*load = priv;
+
+	cur->bc_rec.a = load->irecs[load->next_rec++];
+	return 0;
+}
+
+/* Hand the bulk loader the next of the blocks we carved out for it. */
+STATIC int
+xfs_repair_alloc_claim_block(
+	struct xfs_btree_cur		*cur,
+	union xfs_btree_ptr		*ptr,
+	void				*priv)
+{
+	struct xfs_repair_alloc_load	*load = priv;
+
+	ptr->s = cpu_to_be32(load->blocks[load->next_block++]);
+	return 0;
+}
+
+/*
+ * Set up a bulk loader and a transactionless cursor for one of the free
+ * space btrees, and work out how big the new btree is going to be.
+ */
+STATIC int
+xfs_repair_alloc_bload_init(
+	struct xfs_scrub_context	*sc,
+	xfs_btnum_t			btnum,
+	unsigned int			nr_records,
+	struct xfs_btree_bload		*bbl,
+	struct xfs_btree_cur		**curp)
+{
+	struct xfs_btree_cur		*cur;
+	int				error;
+
+	memset(bbl, 0, sizeof(*bbl));
+	bbl->get_record = xfs_repair_alloc_get_record;
+	bbl->claim_block = xfs_repair_alloc_claim_block;
+
+	cur = xfs_allocbt_init_cursor(sc->mp, NULL, sc->sa.agf_bp,
+			sc->sa.agno, btnum);
+	error = xfs_btree_bload_compute_geometry(cur, bbl, nr_records);
+	if (error) {
+		xfs_btree_del_cursor(cur, XFS_BTREE_ERROR);
+		return error;
+	}
+	*curp = cur;
+	return 0;
+}
+
+/* Write out one of the new trees and wait for it to hit the disk. */
+STATIC int
+xfs_repair_alloc_bload(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_bload		*bbl,
+	struct xfs_alloc_rec_incore	*irecs,
+	xfs_agblock_t			*blocks)
+{
+	struct xfs_repair_alloc_load	load = {
+		.irecs			= irecs,
+		.blocks			= blocks,
+	};
+	int				error;
+
+	error = xfs_btree_bload(cur, bbl, &load);
+	ASSERT(error || load.next_block == bbl->nr_blocks);
+	return error;
+}
+
+/* Repair the freespace btrees for some AG. */
+int
+xfs_repair_allocbt(
+	struct xfs_scrub_context	*sc)
+{
+	struct xfs_repair_alloc		ra;
+	struct xfs_btree_bload		bno_bl;
+	struct xfs_btree_bload		cnt_bl;
+	struct xfs_owner_info		oinfo;
+	struct xfs_mount		*mp = sc->mp;
+	struct xfs_btree_cur		*cur;
+	struct xfs_btree_cur		*bno_cur = NULL;
+	struct xfs_btree_cur		*cnt_cur = NULL;
+	struct xfs_repair_extent	*rex;
+	struct xfs_alloc_rec_incore	*irecs = NULL;
+	xfs_agblock_t			*blocks = NULL;
+	struct xfs_perag		*pag;
+	struct xfs_agf			*agf;
+	xfs_agnumber_t			agno = sc->sa.agno;
+	xfs_extlen_t			freeblks = 0;
+	xfs_extlen_t			longest = 0;
+	xfs_extlen_t			rmap_blocks;
+	int64_t				old_free;
+	int64_t				delta;
+	unsigned int			i = 0;
+	int				error;
+
+	/* We need the rmapbt to reconstruct the free space. */
+	if (!xfs_sb_version_hasrmapbt(&mp->m_sb) || !sc->sa.rmap_cur)
+		return -EOPNOTSUPP;
+
+	agf = XFS_BUF_TO_AGF(sc->sa.agf_bp);
+	pag = xfs_perag_get(mp, agno);
+	if (be32_to_cpu(agf->agf_flcount) < xfs_alloc_min_freelist(mp, pag)) {
+		error = -ENOSPC;
+		goto out_pag;
+	}
+
+	memset(&ra, 0, sizeof(ra));
+	ra.sc = sc;
+	xfs_repair_init_extent_list(&ra.free);
+	xfs_repair_init_extent_list(&ra.ag_owned);
+	xfs_repair_init_extent_list(&ra.not_allocbt);
+
+	/* Find the free space and the blocks owned by the AG btrees. */
+	error = xfs_rmap_query_all(sc->sa.rmap_cur, xfs_repair_alloc_rmap_fn,
+			&ra);
+	if (error)
+		goto out;
+	if (ra.next_bno < be32_to_cpu(agf->agf_length)) {
+		error = xfs_repair_collect_extent(sc, &ra.free, ra.next_bno,
+				be32_to_cpu(agf->agf_length) - ra.next_bno);
+		if (error)
+			goto out;
+		ra.nr_records++;
+	}
+
+	/* Whatever isn't on the AGFL or in the rmapbt is the old allocbt. */
+	error = xfs_scrub_walk_agfl(sc, xfs_repair_alloc_agfl_fn, &ra);
+	if (error)
+		goto out;
+	error = xfs_btree_visit_blocks(sc->sa.rmap_cur,
+			xfs_repair_alloc_rmapbt_fn, &ra);
+	if (error)
+		goto out;
+	error = xfs_repair_subtract_extents(sc, &ra.ag_owned, &ra.not_allocbt);
+	if (error)
+		goto out;
+
+	/* Size the new trees and find space for them. */
+	error = xfs_repair_alloc_bload_init(sc, XFS_BTNUM_BNO, ra.nr_records,
+			&bno_bl, &bno_cur);
+	if (error)
+		goto out;
+	error = xfs_repair_alloc_bload_init(sc, XFS_BTNUM_CNT, ra.nr_records,
+			&cnt_bl, &cnt_cur);
+	if (error)
+		goto out;
+	if (bno_bl.btree_height > mp->m_ag_maxlevels ||
+	    cnt_bl.btree_height > mp->m_ag_maxlevels) {
+		error = -EFSCORRUPTED;
+		goto out;
+	}
+
+	blocks = kmem_zalloc_large((bno_bl.nr_blocks + cnt_bl.nr_blocks) *
+			sizeof(xfs_agblock_t), KM_SLEEP);
+	irecs = kmem_zalloc_large(max_t(unsigned int, 1, ra.nr_records) *
+			sizeof(*irecs), KM_SLEEP);
+	if (!blocks || !irecs) {
+		error = -ENOMEM;
+		goto out;
+	}
+
+	/* From here on out we modify the AG, so the cursors must go. */
+	old_free = be32_to_cpu(agf->agf_freeblks) +
+		   be32_to_cpu(agf->agf_flcount) +
+		   be32_to_cpu(agf->agf_btreeblks);
+	xfs_scrub_ag_btcur_free(&sc->sa);
+	error = xfs_repair_alloc_carve(&ra, blocks,
+			bno_bl.nr_blocks + cnt_bl.nr_blocks);
+	if (error)
+		goto out;
+
+	for_each_xfs_repair_extent(rex, &ra.free) {
+		irecs[i].ar_startblock = rex->agbno;
+		irecs[i].ar_blockcount = rex->len;
+		freeblks += rex->len;
+		longest = max(longest, rex->len);
+		i++;
+	}
+	ASSERT(i == ra.nr_records);
+
+	/* Write out the new trees and wait for them to hit the disk. */
+	error = xfs_repair_alloc_bload(bno_cur, &bno_bl, irecs, blocks);
+	if (error)
+		goto out;
+
+	sort(irecs, ra.nr_records, sizeof(*irecs), xfs_repair_alloc_cnt_cmp,
+			NULL);
+	error = xfs_repair_alloc_bload(cnt_cur, &cnt_bl, irecs,
+			blocks + bno_bl.nr_blocks);
+	if (error)
+		goto out;
+
+	/* Count the rmapbt again, since the carving may have grown it. */
+	cur = xfs_rmapbt_init_cursor(mp, sc->tp, sc->sa.agf_bp, agno);
+	error = xfs_btree_count_blocks(cur, &rmap_blocks);
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	if (error)
+		goto out;
+
+	/* Point the AGF at the new trees. */
+	agf->agf_roots[XFS_BTNUM_BNOi] = bno_bl.root.s;
+	agf->agf_levels[XFS_BTNUM_BNOi] = cpu_to_be32(bno_bl.btree_height);
+	agf->agf_roots[XFS_BTNUM_CNTi] = cnt_bl.root.s;
+	agf->agf_levels[XFS_BTNUM_CNTi] = cpu_to_be32(cnt_bl.btree_height);
+	agf->agf_freeblks = cpu_to_be32(freeblks);
+	agf->agf_longest = cpu_to_be32(longest);
+	agf->agf_btreeblks = cpu_to_be32(bno_bl.nr_blocks - 1 +
+					 cnt_bl.nr_blocks - 1 +
+					 rmap_blocks - 1);
+	xfs_alloc_log_agf(sc->tp, sc->sa.agf_bp, XFS_AGF_ROOTS |
+			XFS_AGF_LEVELS | XFS_AGF_FREEBLKS | XFS_AGF_LONGEST |
+			XFS_AGF_BTREEBLKS);
+
+	pag->pagf_levels[XFS_BTNUM_BNOi] = bno_bl.btree_height;
+	pag->pagf_levels[XFS_BTNUM_CNTi] = cnt_bl.btree_height;
+	pag->pagf_freeblks = freeblks;
+	pag->pagf_longest = longest;
+	pag->pagf_flcount = be32_to_cpu(agf->agf_flcount);
+	pag->pagf_btreeblks = be32_to_cpu(agf->agf_btreeblks);
+
+	/*
+	 * The bulk loader doesn't maintain the free space histogram, so have
+	 * the next AGF read rebuild it from the new by-size btree.
+	 */
+	pag->pagf_hist_init = false;
+	pag->pagf_hist_bad = false;
+
+	/*
+	 * Fix the free block counter.  The old allocbt blocks are no longer
+	 * accounted anywhere until we free them below.
+	 */
+	delta = (int64_t)freeblks + be32_to_cpu(agf->agf_flcount) +
+		be32_to_cpu(agf->agf_btreeblks) - old_free;
+	if (delta < 0) {
+		error = xfs_mod_fdblocks(mp, delta, false);
+		if (error)
+			goto out;
+		xfs_trans_mod_sb(sc->tp, XFS_TRANS_SB_RES_FDBLOCKS, delta);
+	} else if (delta > 0) {
+		xfs_trans_mod_sb(sc->tp, XFS_TRANS_SB_FDBLOCKS, delta);
+	}
+
+	error = xfs_repair_commit_ag(sc);
+	if (error)
+		goto out;
+
+	/* Free the old allocbt blocks into the new trees. */
+	xfs_rmap_ag_owner(&oinfo, XFS_RMAP_OWN_AG);
+	error = xfs_repair_reap_extents(sc, &ra.ag_owned, &oinfo);
+out:
+	if (cnt_cur)
+		xfs_btree_del_cursor(cnt_cur, error ? XFS_BTREE_ERROR :
+				XFS_BTREE_NOERROR);
+	if (bno_cur)
+		xfs_btree_del_cursor(bno_cur, error ? XFS_BTREE_ERROR :
+				XFS_BTREE_NOERROR);
+	kmem_free(irecs);
+	kmem_free(blocks);
+	xfs_repair_cancel_extents(&ra.not_allocbt);
+	xfs_repair_cancel_extents(&ra.ag_owned);
+	xfs_repair_cancel_extents(&ra.free);
+out_pag:
+	xfs_perag_put(pag);
+	return error;
+}
@@ -123,6 +123,8 @@ struct xfs_scrub_bmap_info {
 	struct xfs_scrub_context	*sc;
 	xfs_daddr_t			eofs;
 	xfs_fileoff_t			lastoff;
+	struct xfs_rmap_irec		last_rmap;
+	xfs_agnumber_t			last_rmap_agno;
 	bool				is_rt;
 	bool				is_shared;
 	int				whichfork;
@@ -165,6 +167,17 @@ xfs_scrub_bmap_xref_rmap(
 		    !xfs_scrub_fblock_xref_check_ok(info->sc, info->whichfork,
 				irec->br_startoff, has_rmap))
 			return;
+	} else if (info->last_rmap_agno == sa->agno &&
+		   info->last_rmap.rm_owner == owner &&
+		   info->last_rmap.rm_startblock <= bno &&
+		   bno < info->last_rmap.rm_startblock +
+			 info->last_rmap.rm_blockcount) {
+		/*
+		 * Without reflink, rmaps can't overlap, so if the last rmap
+		 * we found covers the start of this extent, it's the one
+		 * that the lookup would find.
+		 */
+		rmap = info->last_rmap;
 	} else {
 		error = xfs_rmap_lookup_le(sa->rmap_cur, bno, 0, owner,
 				offset, rflags, &has_rmap);
@@ -179,6 +192,11 @@ xfs_scrub_bmap_xref_rmap(
 		    !xfs_scrub_fblock_xref_check_ok(info->sc, info->whichfork,
 				irec->br_startoff, has_rmap))
 			return;
+
+		if (!xfs_sb_version_hasreflink(&info->sc->mp->m_sb)) {
+			info->last_rmap = rmap;
+			info->last_rmap_agno = sa->agno;
+		}
 	}
 
 	/* Check the rmap. */
@@ -278,7 +296,7 @@ xfs_scrub_bmap_extent(
 	struct xfs_scrub_bmap_info	*info,
 	struct xfs_bmbt_irec		*irec)
 {
-	struct xfs_scrub_ag		sa = { 0 };
+	struct xfs_scrub_ag		*sa = &info->sc->sa;
 	struct xfs_mount		*mp = info->sc->mp;
 	struct xfs_buf			*bp = NULL;
 	xfs_daddr_t			daddr;
@@ -324,7 +342,7 @@ xfs_scrub_bmap_extent(
 
 	/* Set ourselves up for cross-referencing later. */
 	if (!info->is_rt) {
-		error = xfs_scrub_ag_init(info->sc, agno, &sa);
+		error = xfs_scrub_xref_ag_init(info->sc, agno);
 		if (!xfs_scrub_fblock_op_ok(info->sc, info->whichfork,
 				irec->br_startoff, &error))
 			goto out;
@@ -338,14 +356,14 @@ xfs_scrub_bmap_extent(
 					bno, irec->br_blockcount));
 
 	/* Cross-reference with the bnobt. */
-	if (sa.bno_cur) {
-		error = xfs_alloc_has_record(sa.bno_cur, bno,
+	if (sa->bno_cur) {
+		error = xfs_alloc_has_record(sa->bno_cur, bno,
 				irec->br_blockcount, &is_freesp);
-		if (xfs_scrub_should_xref(info->sc, &error, &sa.bno_cur))
+		if (xfs_scrub_should_xref(info->sc, &error, &sa->bno_cur))
 			xfs_scrub_fblock_xref_check_ok(info->sc,
 					info->whichfork, irec->br_startoff,
 					!is_freesp);
-	} else {
+	} else if (info->is_rt) {
 		xfs_ilock(mp->m_rbmip, XFS_ILOCK_SHARED | XFS_ILOCK_RTBITMAP);
 		error = xfs_rtalloc_extent_is_free(mp, info->sc->tp,
 				irec->br_startblock, irec->br_blockcount,
@@ -358,39 +376,38 @@ xfs_scrub_bmap_extent(
 	}
 
 	/* Cross-reference with inobt. */
-	if (sa.ino_cur) {
-		error = xfs_ialloc_has_inodes_at_extent(sa.ino_cur,
+	if (sa->ino_cur) {
+		error = xfs_ialloc_has_inodes_at_extent(sa->ino_cur,
 				irec->br_startblock, irec->br_blockcount,
 				&has_inodes);
-		if (xfs_scrub_should_xref(info->sc, &error, &sa.ino_cur))
+		if (xfs_scrub_should_xref(info->sc, &error, &sa->ino_cur))
 			xfs_scrub_fblock_xref_check_ok(info->sc,
 					info->whichfork, irec->br_startoff,
 					!has_inodes);
 	}
 
 	/* Cross-reference with finobt. */
-	if (sa.fino_cur) {
-		error = xfs_ialloc_has_inodes_at_extent(sa.fino_cur,
+	if (sa->fino_cur) {
+		error = xfs_ialloc_has_inodes_at_extent(sa->fino_cur,
 				irec->br_startblock, irec->br_blockcount,
 				&has_inodes);
-		if (xfs_scrub_should_xref(info->sc, &error, &sa.fino_cur))
+		if (xfs_scrub_should_xref(info->sc, &error, &sa->fino_cur))
 			xfs_scrub_fblock_xref_check_ok(info->sc,
 					info->whichfork, irec->br_startoff,
 					!has_inodes);
 	}
 
 	/* Cross-reference with rmapbt. */
-	if (sa.rmap_cur)
-		xfs_scrub_bmap_xref_rmap(info, &sa, irec, bno);
+	if (sa->rmap_cur)
+		xfs_scrub_bmap_xref_rmap(info, sa, irec, bno);
 
 	/*
 	 * If this is a non-shared file on a reflink filesystem,
 	 * check the refcountbt to see if the flag is wrong.
 	 */
-	if (sa.refc_cur)
-		xfs_scrub_bmap_xref_refc(info, &sa, irec, bno);
+	if (sa->refc_cur)
+		xfs_scrub_bmap_xref_refc(info, sa, irec, bno);
 
-	xfs_scrub_ag_free(info->sc, &sa);
 out:
 	info->lastoff = irec->br_startoff + irec->br_blockcount;
 	return error;
@@ -447,6 +464,8 @@ xfs_scrub_bmap(
 	struct xfs_btree_cur		*cur;
 	xfs_fileoff_t			endoff;
 	xfs_extnum_t			idx;
+	xfs_extnum_t			nextents = 0;
+	xfs_filblks_t			nblocks = 0;
 	bool				found;
 	int				error = 0;
 
@@ -456,6 +475,7 @@ xfs_scrub_bmap(
 	info.eofs = XFS_FSB_TO_BB(mp, info.is_rt ? mp->m_sb.sb_rblocks :
 					      mp->m_sb.sb_dblocks);
 	info.whichfork = whichfork;
+	info.last_rmap_agno = NULLAGNUMBER;
 	info.is_shared = whichfork == XFS_DATA_FORK && xfs_is_reflink_inode(ip);
 	info.sc = sc;
 
@@ -533,8 +553,16 @@ xfs_scrub_bmap(
 		error = xfs_scrub_bmap_extent(ip, NULL, &info, &irec);
 		if (error == -EDEADLOCK)
 			return error;
+		nextents++;
+		nblocks += irec.br_blockcount;
 	}
 
+	/* Report forks fragmented enough to be worth defragmenting. */
+	if (!error && xfs_scrub_frag_extents &&
+	    nextents >= xfs_scrub_frag_extents)
+		trace_xfs_scrub_bmap_fragmented(sc, whichfork, nextents,
+				nblocks);
+
 out_unlock:
 	return error;
 }
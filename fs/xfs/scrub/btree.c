@@ -385,8 +385,7 @@ xfs_scrub_btree_check_block_owner(
 	struct xfs_scrub_btree		*bs,
 	xfs_daddr_t			daddr)
 {
-	struct xfs_scrub_ag		sa = { 0 };
-	struct xfs_scrub_ag		*psa;
+	struct xfs_scrub_ag		*psa = &bs->sc->sa;
 	xfs_agnumber_t			agno;
 	xfs_agblock_t			bno;
 	bool				is_freesp;
@@ -396,13 +395,15 @@ xfs_scrub_btree_check_block_owner(
 	agno = xfs_daddr_to_agno(bs->cur->bc_mp, daddr);
 	bno = xfs_daddr_to_agbno(bs->cur->bc_mp, daddr);
 
+	/*
+	 * Inode-rooted btree blocks can be in any AG; keep the last AG's
+	 * headers and cursors around since sibling blocks tend to be
+	 * close together.
+	 */
 	if (bs->cur->bc_flags & XFS_BTREE_LONG_PTRS) {
-		error = xfs_scrub_ag_init(bs->sc, agno, &sa);
+		error = xfs_scrub_xref_ag_init(bs->sc, agno);
 		if (error)
 			return error;
-		psa = &sa;
-	} else {
-		psa = &bs->sc->sa;
 	}
 
 	/* Cross-reference with the bnobt. */
@@ -422,9 +423,6 @@ xfs_scrub_btree_check_block_owner(
 					has_rmap);
 	}
 
-	if (psa == &sa)
-		xfs_scrub_ag_free(bs->sc, &sa);
-
 	return error;
 }
 
@@ -458,6 +456,44 @@ xfs_scrub_btree_check_owner(
 	return xfs_scrub_btree_check_block_owner(bs, XFS_BUF_ADDR(bp));
 }
 
+/*
+ * Start reading all the children of a node at idle priority so that the
+ * walk finds them in memory instead of waiting on one block at a time.
+ * Pointers that are obviously bad are skipped; the walk will complain
+ * about them when it gets there.
+ */
+STATIC void
+xfs_scrub_btree_readahead(
+	struct xfs_btree_cur		*cur,
+	struct xfs_btree_block		*block)
+{
+	struct xfs_mount		*mp = cur->bc_mp;
+	union xfs_btree_ptr		*pp;
+	xfs_fsblock_t			fsbno;
+	xfs_agblock_t			agbno;
+	xfs_daddr_t			daddr;
+	int				i;
+
+	for (i = 1; i <= be16_to_cpu(block->bb_numrecs); i++) {
+		pp = xfs_btree_ptr_addr(cur, i, block);
+		if (cur->bc_flags & XFS_BTREE_LONG_PTRS) {
+			fsbno = be64_to_cpu(pp->l);
+			if (XFS_FSB_TO_AGNO(mp, fsbno) >= mp->m_sb.sb_agcount ||
+			    XFS_FSB_TO_AGBNO(mp, fsbno) >= mp->m_sb.sb_agblocks)
+				continue;
+			daddr = XFS_FSB_TO_DADDR(mp, fsbno);
+		} else {
+			agbno = be32_to_cpu(pp->s);
+			if (agbno >= mp->m_sb.sb_agblocks)
+				continue;
+			daddr = XFS_AGB_TO_DADDR(mp, cur->bc_private.a.agno,
+					agbno);
+		}
+		xfs_buf_readahead_idle(mp->m_ddev_targp, daddr,
+				XFS_FSB_TO_BB(mp, 1), cur->bc_ops->buf_ops);
+	}
+}
+
 /* Grab and scrub a btree block. */
 STATIC int
 xfs_scrub_btree_block(
@@ -478,6 +514,12 @@ xfs_scrub_btree_block(
 	if (error)
 		return error;
 
+	if (level > 0 && xfs_scrub_idle_io)
+		xfs_scrub_btree_readahead(bs->cur, *pblock);
+
+	bs->nblocks[level]++;
+	bs->nrecs[level] += be16_to_cpu((*pblock)->bb_numrecs);
+
 	error = xfs_scrub_btree_check_owner(bs, *pbp);
 	if (error)
 		return error;
@@ -615,5 +657,13 @@ xfs_scrub_btree(
 		kmem_free(co);
 	}
 
+	/* Report how full each level is if we walked the whole tree. */
+	if (!error && !(sc->sm->sm_flags & XFS_SCRUB_OFLAG_CORRUPT)) {
+		for (i = 0; i < cur->bc_nlevels; i++)
+			trace_xfs_scrub_btree_fill(sc, cur, i, bs.nblocks[i],
+					bs.nrecs[i], bs.nblocks[i] *
+					cur->bc_ops->get_maxrecs(cur, i));
+	}
+
 	return error;
 }
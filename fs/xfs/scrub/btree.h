@@ -59,6 +59,10 @@ struct xfs_scrub_btree {
 	union xfs_btree_key		lastkey[XFS_BTREE_MAXLEVELS];
 	bool				firstkey[XFS_BTREE_MAXLEVELS];
 	struct list_head		to_check;
+
+	/* blocks and records seen at each level, for fill reporting */
+	unsigned long long		nblocks[XFS_BTREE_MAXLEVELS];
+	unsigned long long		nrecs[XFS_BTREE_MAXLEVELS];
 };
 int xfs_scrub_btree(struct xfs_scrub_context *sc, struct xfs_btree_cur *cur,
 		    xfs_scrub_btree_rec_fn scrub_fn,
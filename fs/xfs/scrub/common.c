@@ -628,6 +628,35 @@ xfs_scrub_ag_init(
 	return xfs_scrub_ag_btcur_init(sc, sa);
 }
 
+/*
+ * Set up the context's AG state for cross-referencing a record in @agno.
+ *
+ * Scrubbers of inode-rooted metadata (file mappings, bmbt blocks, inode
+ * records) use sc->sa as a cross-reference cache: the AG headers and
+ * cursors stay around from one record to the next and are only replaced
+ * when a record lands in a different AG.  Each cursor still holds the
+ * btree path of its last lookup, so a lookup near the previous one
+ * walks blocks that are already attached to the cursor instead of
+ * reading them again.  Only one AG is ever held, so we don't break the
+ * AG locking order, and scrub teardown releases whatever is left.
+ */
+int
+xfs_scrub_xref_ag_init(
+	struct xfs_scrub_context	*sc,
+	xfs_agnumber_t			agno)
+{
+	int				error;
+
+	if (sc->sa.agno == agno)
+		return 0;
+
+	xfs_scrub_ag_free(sc, &sc->sa);
+	error = xfs_scrub_ag_init(sc, agno, &sc->sa);
+	if (error)
+		xfs_scrub_ag_free(sc, &sc->sa);
+	return error;
+}
+
 /*
  * Load and verify an AG header for further AG header examination.
  * If this header is not the target of the examination, don't return
@@ -798,6 +827,53 @@ xfs_scrub_setup_inode_contents(
 	return error;
 }
 
+/* How often we sample the data device's read latency. */
+#define XFS_SCRUB_QOS_INTERVAL		(HZ / 10)
+
+/* Give up waiting for the foreground after this many samples. */
+#define XFS_SCRUB_QOS_MAX_PAUSES	10
+
+/*
+ * If the administrator set a read latency target, sample the average
+ * read latency of the data device from the block layer's disk stats
+ * every so often and sleep while it's over the target.  We always make
+ * progress eventually so that a persistently slow disk can't stall
+ * scrub forever.
+ */
+void
+xfs_scrub_throttle(
+	struct xfs_scrub_context	*sc)
+{
+	struct hd_struct		*part;
+	unsigned long			ios;
+	unsigned long			ticks;
+	unsigned int			target = xfs_scrub_latency_ms;
+	unsigned int			lat;
+	int				pauses = 0;
+
+	if (!target || time_before(jiffies, sc->qos_next))
+		return;
+
+	part = sc->mp->m_ddev_targp->bt_bdev->bd_part;
+	for (;;) {
+		ios = part_stat_read(part, ios[READ]);
+		ticks = part_stat_read(part, ticks[READ]);
+		lat = 0;
+		if (sc->qos_ios && ios > sc->qos_ios)
+			lat = jiffies_to_msecs(ticks - sc->qos_ticks) /
+					(ios - sc->qos_ios);
+		sc->qos_ios = ios;
+		sc->qos_ticks = ticks;
+		sc->qos_next = jiffies + XFS_SCRUB_QOS_INTERVAL;
+
+		if (lat <= target || ++pauses > XFS_SCRUB_QOS_MAX_PAUSES ||
+		    fatal_signal_pending(current))
+			break;
+		trace_xfs_scrub_throttle(sc, lat, target);
+		schedule_timeout_killable(XFS_SCRUB_QOS_INTERVAL);
+	}
+}
+
 /*
  * Predicate that decides if we need to evaluate the cross-reference check.
  * If there was an error accessing the cross-reference btree, just delete
@@ -809,6 +885,8 @@ xfs_scrub_should_xref(
 	int				*error,
 	struct xfs_btree_cur		**curpp)
 {
+	xfs_scrub_throttle(sc);
+
 	/* If not a btree cross-reference, just check the error code. */
 	if (curpp == NULL) {
 		if (*error == 0)
@@ -48,6 +48,9 @@ xfs_scrub_trans_alloc(
 	uint				flags,
 	struct xfs_trans		**tpp)
 {
+	if (sm->sm_flags & XFS_SCRUB_IFLAG_REPAIR)
+		return xfs_trans_alloc(mp, resp, blocks, rtextents, flags,
+				tpp);
 	return xfs_trans_alloc_empty(mp, tpp);
 }
 
@@ -111,6 +114,9 @@ bool xfs_scrub_fblock_warn_ok(struct xfs_scrub_context *sc, int whichfork,
 bool xfs_scrub_should_xref(struct xfs_scrub_context *sc, int *error,
 			   struct xfs_btree_cur **curpp);
 
+/* Back off if foreground reads are slow. */
+void xfs_scrub_throttle(struct xfs_scrub_context *sc);
+
 /* Signal an incomplete scrub. */
 bool xfs_scrub_check_thoroughness(struct xfs_scrub_context *sc, bool fs_ok);
 
@@ -146,6 +152,7 @@ int xfs_scrub_setup_quota(struct xfs_scrub_context *sc, struct xfs_inode *ip);
 void xfs_scrub_ag_free(struct xfs_scrub_context *sc, struct xfs_scrub_ag *sa);
 int xfs_scrub_ag_init(struct xfs_scrub_context *sc, xfs_agnumber_t agno,
 		      struct xfs_scrub_ag *sa);
+int xfs_scrub_xref_ag_init(struct xfs_scrub_context *sc, xfs_agnumber_t agno);
 int xfs_scrub_ag_read_headers(struct xfs_scrub_context *sc, xfs_agnumber_t agno,
 			      struct xfs_buf **agi, struct xfs_buf **agf,
 			      struct xfs_buf **agfl);
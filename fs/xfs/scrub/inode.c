@@ -102,7 +102,7 @@ xfs_scrub_inode_xref_rmap(
 	xfs_ino_t			ino)
 {
 	struct xfs_owner_info		oinfo;
-	struct xfs_scrub_ag		sa = { 0 };
+	struct xfs_scrub_ag		*sa = &sc->sa;
 	xfs_agnumber_t			agno;
 	xfs_agblock_t			agbno;
 	bool				has_rmap;
@@ -111,16 +111,15 @@ xfs_scrub_inode_xref_rmap(
 	agno = XFS_INO_TO_AGNO(sc->mp, ino);
 	agbno = XFS_INO_TO_AGBNO(sc->mp, ino);
 	xfs_rmap_ag_owner(&oinfo, XFS_RMAP_OWN_INODES);
-	error = xfs_scrub_ag_init(sc, agno, &sa);
+	error = xfs_scrub_xref_ag_init(sc, agno);
 	if (!xfs_scrub_xref_op_ok(sc, agno, agbno, &error))
 		return error;
 
-	error = xfs_rmap_record_exists(sa.rmap_cur, agbno,
+	error = xfs_rmap_record_exists(sa->rmap_cur, agbno,
 			1, &oinfo, &has_rmap);
-	if (xfs_scrub_should_xref(sc, &error, &sa.rmap_cur))
+	if (xfs_scrub_should_xref(sc, &error, &sa->rmap_cur))
 		xfs_scrub_ino_xref_check_ok(sc, ino, NULL,
 				has_rmap);
-	xfs_scrub_ag_free(sc, &sa);
 	return error;
 }
 
@@ -292,7 +291,9 @@ xfs_scrub_inode(
 		break;
 	case XFS_DINODE_FMT_LOCAL:
 		xfs_scrub_ino_check_ok(sc, ino, bp,
-				S_ISDIR(mode) || S_ISLNK(mode));
+				S_ISDIR(mode) || S_ISLNK(mode) ||
+				(S_ISREG(mode) &&
+				 xfs_sb_version_hasinlinedata(&mp->m_sb)));
 		break;
 	case XFS_DINODE_FMT_EXTENTS:
 		xfs_scrub_ino_check_ok(sc, ino, bp, S_ISREG(mode) ||
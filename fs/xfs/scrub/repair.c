@@ -0,0 +1,311 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_defer.h"
+#include "xfs_btree.h"
+#include "xfs_bit.h"
+#include "xfs_log_format.h"
+#include "xfs_trans.h"
+#include "xfs_sb.h"
+#include "xfs_inode.h"
+#include "xfs_alloc.h"
+#include "xfs_bmap.h"
+#include "xfs_rmap.h"
+#include "scrub/xfs_scrub.h"
+#include "scrub/scrub.h"
+#include "scrub/common.h"
+#include "scrub/repair.h"
+#include <linux/list_sort.h>
+
+/*
+ * Online Repair
+ *
+ * Repair functions are called after the scrubber has flagged a piece of
+ * metadata as corrupt (or in need of preening).  The scrub setup
+ * functions hand us a real transaction and the locked AG headers; as
+ * long as we hold the AGI and AGF buffers nobody else can allocate or
+ * free space in the AG, so the AG is effectively frozen while we
+ * rebuild the damaged structure from the secondary metadata (usually
+ * the reverse mapping btree).
+ *
+ * Replacement btrees are written out in bulk to freshly allocated
+ * blocks that are not part of any transaction.  Once those writes have
+ * completed we commit a transaction that points the AG header at the
+ * new roots, and then free the blocks of the old structure in a series
+ * of regular transactions.  If we crash before the header update hits
+ * the log, the new blocks were free space and the old tree is intact.
+ */
+
+/*
+ * The ioctl presence test uses this to advertise that the kernel knows
+ * how to repair things.
+ */
+int
+xfs_repair_probe(
+	struct xfs_scrub_context	*sc)
+{
+	return 0;
+}
+
+/*
+ * Commit the repair transaction.  The AG header buffers are released by
+ * the commit and the btree cursors may point at blocks we just replaced,
+ * so drop all of them from the scrub context first.
+ */
+int
+xfs_repair_commit_ag(
+	struct xfs_scrub_context	*sc)
+{
+	int				error;
+
+	xfs_scrub_ag_btcur_free(&sc->sa);
+	sc->sa.agi_bp = NULL;
+	sc->sa.agf_bp = NULL;
+	sc->sa.agfl_bp = NULL;
+
+	error = xfs_trans_commit(sc->tp);
+	sc->tp = NULL;
+	return error;
+}
+
+/* Extent lists */
+
+/* Add an AG extent to a list, merging it with the tail if possible. */
+int
+xfs_repair_collect_extent(
+	struct xfs_scrub_context	*sc,
+	struct xfs_repair_extent_list	*exlist,
+	xfs_agblock_t			agbno,
+	xfs_extlen_t			len)
+{
+	struct xfs_repair_extent	*rex;
+
+	if (!list_empty(&exlist->list)) {
+		rex = list_last_entry(&exlist->list, struct xfs_repair_extent,
+				list);
+		if (rex->agbno + rex->len == agbno) {
+			rex->len += len;
+			return 0;
+		}
+	}
+
+	rex = kmem_alloc(sizeof(struct xfs_repair_extent), KM_MAYFAIL);
+	if (!rex)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&rex->list);
+	rex->agbno = agbno;
+	rex->len = len;
+	list_add_tail(&rex->list, &exlist->list);
+	return 0;
+}
+
+/* Free every extent in a list. */
+void
+xfs_repair_cancel_extents(
+	struct xfs_repair_extent_list	*exlist)
+{
+	struct xfs_repair_extent	*rex;
+	struct xfs_repair_extent	*n;
+
+	for_each_xfs_repair_extent_safe(rex, n, exlist) {
+		list_del(&rex->list);
+		kmem_free(rex);
+	}
+}
+
+/* Compare two extents by starting block. */
+static int
+xfs_repair_extent_cmp(
+	void				*priv,
+	struct list_head		*a,
+	struct list_head		*b)
+{
+	struct xfs_repair_extent	*ap;
+	struct xfs_repair_extent	*bp;
+
+	ap = container_of(a, struct xfs_repair_extent, list);
+	bp = container_of(b, struct xfs_repair_extent, list);
+
+	if (ap->agbno > bp->agbno)
+		return 1;
+	else if (ap->agbno < bp->agbno)
+		return -1;
+	return 0;
+}
+
+/*
+ * Remove all the blocks mentioned in sublist from the extents in exlist.
+ * Both lists are sorted by starting block, and the extents in sublist
+ * must not overlap each other.
+ */
+int
+xfs_repair_subtract_extents(
+	struct xfs_scrub_context	*sc,
+	struct xfs_repair_extent_list	*exlist,
+	struct xfs_repair_extent_list	*sublist)
+{
+	struct xfs_repair_extent	*rex;
+	struct xfs_repair_extent	*n;
+	struct xfs_repair_extent	*sub;
+	struct xfs_repair_extent	*new;
+	struct list_head		*lp;
+	xfs_agblock_t			rex_end;
+	xfs_agblock_t			sub_end;
+
+	list_sort(NULL, &exlist->list, xfs_repair_extent_cmp);
+	list_sort(NULL, &sublist->list, xfs_repair_extent_cmp);
+
+	lp = sublist->list.next;
+	for_each_xfs_repair_extent_safe(rex, n, exlist) {
+		/* Skip the parts of sublist that end before this extent. */
+		while (lp != &sublist->list) {
+			sub = list_entry(lp, struct xfs_repair_extent, list);
+			if (sub->agbno + sub->len > rex->agbno)
+				break;
+			lp = lp->next;
+		}
+
+		/* Punch out everything that overlaps this extent. */
+		while (lp != &sublist->list) {
+			sub = list_entry(lp, struct xfs_repair_extent, list);
+			rex_end = rex->agbno + rex->len;
+			sub_end = sub->agbno + sub->len;
+			if (sub->agbno >= rex_end)
+				break;
+
+			if (sub->agbno > rex->agbno) {
+				new = kmem_alloc(sizeof(struct xfs_repair_extent),
+						KM_MAYFAIL);
+				if (!new)
+					return -ENOMEM;
+				new->agbno = rex->agbno;
+				new->len = sub->agbno - rex->agbno;
+				list_add_tail(&new->list, &rex->list);
+			}
+
+			if (sub_end >= rex_end) {
+				list_del(&rex->list);
+				kmem_free(rex);
+				break;
+			}
+
+			rex->len = rex_end - sub_end;
+			rex->agbno = sub_end;
+			lp = lp->next;
+		}
+	}
+
+	return 0;
+}
+
+/* Blocks we invalidate and free per transaction when reaping. */
+#define XFS_REPAIR_REAP_BATCH	16
+
+/* Invalidate and free a run of blocks that used to belong to @oinfo. */
+STATIC int
+xfs_repair_reap_chunk(
+	struct xfs_scrub_context	*sc,
+	xfs_agnumber_t			agno,
+	xfs_agblock_t			agbno,
+	xfs_extlen_t			len,
+	struct xfs_owner_info		*oinfo)
+{
+	struct xfs_mount		*mp = sc->mp;
+	struct xfs_trans		*tp;
+	struct xfs_buf			*bp;
+	struct xfs_defer_ops		dfops;
+	xfs_fsblock_t			firstfsb;
+	xfs_extlen_t			i;
+	int				error;
+
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_itruncate, 0, 0, 0, &tp);
+	if (error)
+		return error;
+
+	/*
+	 * Stale any cached copies of the old blocks so that an old dirty
+	 * buffer can never be written over whatever gets allocated there
+	 * next.
+	 */
+	for (i = 0; i < len; i++) {
+		bp = xfs_trans_get_buf(tp, mp->m_ddev_targp,
+				XFS_AGB_TO_DADDR(mp, agno, agbno + i),
+				XFS_FSB_TO_BB(mp, 1), 0);
+		if (!bp) {
+			error = -ENOMEM;
+			goto out_cancel;
+		}
+		xfs_trans_binval(tp, bp);
+	}
+
+	xfs_defer_init(&dfops, &firstfsb);
+	xfs_bmap_add_free(mp, &dfops, XFS_AGB_TO_FSB(mp, agno, agbno), len,
+			oinfo);
+	error = xfs_defer_finish(&tp, &dfops, NULL);
+	if (error) {
+		xfs_defer_cancel(&dfops);
+		goto out_cancel;
+	}
+
+	return xfs_trans_commit(tp);
+out_cancel:
+	xfs_trans_cancel(tp);
+	return error;
+}
+
+/*
+ * Free all the extents in a list that used to belong to the structure
+ * we just replaced.  The AG headers must already have been released.
+ */
+int
+xfs_repair_reap_extents(
+	struct xfs_scrub_context	*sc,
+	struct xfs_repair_extent_list	*exlist,
+	struct xfs_owner_info		*oinfo)
+{
+	struct xfs_repair_extent	*rex;
+	struct xfs_repair_extent	*n;
+	xfs_agnumber_t			agno = sc->sm->sm_agno;
+	xfs_extlen_t			len;
+	int				error = 0;
+
+	ASSERT(sc->tp == NULL);
+	ASSERT(sc->sa.agf_bp == NULL);
+
+	for_each_xfs_repair_extent_safe(rex, n, exlist) {
+		while (rex->len > 0) {
+			len = min_t(xfs_extlen_t, rex->len,
+					XFS_REPAIR_REAP_BATCH);
+			error = xfs_repair_reap_chunk(sc, agno, rex->agbno, len,
+					oinfo);
+			if (error)
+				goto out;
+			rex->agbno += len;
+			rex->len -= len;
+		}
+		list_del(&rex->list);
+		kmem_free(rex);
+	}
+out:
+	xfs_repair_cancel_extents(exlist);
+	return error;
+}
@@ -0,0 +1,71 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef __XFS_SCRUB_REPAIR_H__
+#define __XFS_SCRUB_REPAIR_H__
+
+/* Should we try to repair this piece of metadata? */
+static inline bool
+xfs_repair_should_fix(
+	struct xfs_scrub_metadata	*sm)
+{
+	return (sm->sm_flags & XFS_SCRUB_IFLAG_REPAIR) &&
+	       (sm->sm_flags & (XFS_SCRUB_OFLAG_CORRUPT |
+				XFS_SCRUB_OFLAG_XCORRUPT |
+				XFS_SCRUB_OFLAG_PREEN));
+}
+
+int xfs_repair_probe(struct xfs_scrub_context *sc);
+int xfs_repair_commit_ag(struct xfs_scrub_context *sc);
+
+/* Lists of AG extents. */
+
+struct xfs_repair_extent {
+	struct list_head		list;
+	xfs_agblock_t			agbno;
+	xfs_extlen_t			len;
+};
+
+struct xfs_repair_extent_list {
+	struct list_head		list;
+};
+
+static inline void
+xfs_repair_init_extent_list(
+	struct xfs_repair_extent_list	*exlist)
+{
+	INIT_LIST_HEAD(&exlist->list);
+}
+
+#define for_each_xfs_repair_extent(rex, exlist) \
+	list_for_each_entry((rex), &(exlist)->list, list)
+#define for_each_xfs_repair_extent_safe(rex, n, exlist) \
+	list_for_each_entry_safe((rex), (n), &(exlist)->list, list)
+
+int xfs_repair_collect_extent(struct xfs_scrub_context *sc,
+			      struct xfs_repair_extent_list *exlist,
+			      xfs_agblock_t agbno, xfs_extlen_t len);
+void xfs_repair_cancel_extents(struct xfs_repair_extent_list *exlist);
+int xfs_repair_subtract_extents(struct xfs_scrub_context *sc,
+				struct xfs_repair_extent_list *exlist,
+				struct xfs_repair_extent_list *sublist);
+int xfs_repair_reap_extents(struct xfs_scrub_context *sc,
+			    struct xfs_repair_extent_list *exlist,
+			    struct xfs_owner_info *oinfo);
+
+/* Metadata repairers */
+int xfs_repair_allocbt(struct xfs_scrub_context *sc);
+
+#endif	/* __XFS_SCRUB_REPAIR_H__ */
@@ -48,6 +48,7 @@
 #include "scrub/trace.h"
 #include "scrub/scrub.h"
 #include "scrub/btree.h"
+#include "scrub/repair.h"
 
 /*
  * Online Scrub and Repair
@@ -184,6 +185,7 @@ static const struct xfs_scrub_meta_ops meta_scrub_ops[] = {
 	{ /* ioctl presence test */
 		.setup	= xfs_scrub_setup_fs,
 		.scrub	= xfs_scrub_tester,
+		.repair	= xfs_repair_probe,
 	},
 	{ /* superblock */
 		.setup	= xfs_scrub_setup_ag_header,
@@ -204,10 +206,12 @@ static const struct xfs_scrub_meta_ops meta_scrub_ops[] = {
 	{ /* bnobt */
 		.setup	= xfs_scrub_setup_ag_allocbt,
 		.scrub	= xfs_scrub_bnobt,
+		.repair	= xfs_repair_allocbt,
 	},
 	{ /* cntbt */
 		.setup	= xfs_scrub_setup_ag_allocbt,
 		.scrub	= xfs_scrub_cntbt,
+		.repair	= xfs_repair_allocbt,
 	},
 	{ /* inobt */
 		.setup	= xfs_scrub_setup_ag_iallocbt,
@@ -305,6 +309,7 @@ xfs_scrub_metadata(
 	struct xfs_mount		*mp = ip->i_mount;
 	const struct xfs_scrub_meta_ops	*ops;
 	bool				try_harder = false;
+	bool				repaired = false;
 	int				error = 0;
 
 	trace_xfs_scrub(ip, sm, error);
@@ -337,10 +342,15 @@ xfs_scrub_metadata(
 	if (ops->has && !ops->has(&mp->m_sb))
 		goto out;
 
-	/* We don't know how to repair anything yet. */
-	error = -EOPNOTSUPP;
-	if (sm->sm_flags & XFS_SCRUB_IFLAG_REPAIR)
-		goto out;
+	/* Can we repair this type of metadata? */
+	if (sm->sm_flags & XFS_SCRUB_IFLAG_REPAIR) {
+		error = -EOPNOTSUPP;
+		if (ops->repair == NULL)
+			goto out;
+		error = -EROFS;
+		if (mp->m_flags & XFS_MOUNT_RDONLY)
+			goto out;
+	}
 
 	/* This isn't a stable feature.  Use with care. */
 	{
@@ -351,6 +361,14 @@ xfs_scrub_metadata(
 	"EXPERIMENTAL online scrub feature in use. Use at your own risk!");
 		warned = true;
 	}
+	if (sm->sm_flags & XFS_SCRUB_IFLAG_REPAIR) {
+		static bool warned;
+
+		if (!warned)
+			xfs_alert(mp,
+	"EXPERIMENTAL online repair feature in use. Use at your own risk!");
+		warned = true;
+	}
 
 	atomic_inc(&mp->m_scrubbers);
 
@@ -382,6 +400,23 @@ xfs_scrub_metadata(
 	} else if (error)
 		goto out_teardown;
 
+	if (!repaired && xfs_repair_should_fix(sc.sm)) {
+		/*
+		 * Fix the damage, then tear everything down and scrub
+		 * the metadata again so that the caller sees the state of
+		 * the new structure.
+		 */
+		error = sc.ops->repair(&sc);
+		if (error)
+			goto out_teardown;
+		error = xfs_scrub_teardown(&sc, ip, 0);
+		if (error)
+			goto out_dec;
+		sm->sm_flags &= ~XFS_SCRUB_FLAGS_OUT;
+		repaired = true;
+		goto retry_op;
+	}
+
 	if (sc.sm->sm_flags & (XFS_SCRUB_OFLAG_CORRUPT |
 			       XFS_SCRUB_OFLAG_XCORRUPT))
 		xfs_alert_ratelimited(mp, "Corruption detected during scrub.");
@@ -394,3 +429,435 @@ xfs_scrub_metadata(
 	trace_xfs_scrub_done(ip, sm, error);
 	return error;
 }
+
+/* Vectored scrubbing of AG metadata. */
+
+/* Default number of AGs to check in parallel. */
+#define XFS_SCRUB_VEC_WORKERS	4
+
+struct xfs_scrub_vec_ctx {
+	struct xfs_inode		*ip;
+	struct xfs_scrub_vec_head	*head;
+	struct xfs_scrub_vec		*vecs;
+	struct xfs_scrub_vec_result	*results;
+	atomic_t			next_ag;
+	bool				aborted;
+};
+
+struct xfs_scrub_vec_work {
+	struct work_struct		work;
+	struct xfs_scrub_vec_ctx	*ctx;
+};
+
+/* Is this a type of metadata that lives in a single AG? */
+static inline bool
+xfs_scrub_type_is_ag(
+	__u32				type)
+{
+	return type >= XFS_SCRUB_TYPE_AGF && type <= XFS_SCRUB_TYPE_REFCNTBT;
+}
+
+/*
+ * Pull the AG headers into the buffer cache.  Every check of this AG
+ * starts by reading them, so after this they are almost always cache
+ * hits; we can't hold the buffers across checks because each check
+ * locks them in its own transaction.
+ */
+STATIC void
+xfs_scrub_vec_readahead_ag(
+	struct xfs_mount		*mp,
+	xfs_agnumber_t			agno)
+{
+	xfs_buf_readahead(mp->m_ddev_targp,
+			XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1), &xfs_agi_buf_ops);
+	xfs_buf_readahead(mp->m_ddev_targp,
+			XFS_AG_DADDR(mp, agno, XFS_AGF_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1), &xfs_agf_buf_ops);
+	xfs_buf_readahead(mp->m_ddev_targp,
+			XFS_AG_DADDR(mp, agno, XFS_AGFL_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1), &xfs_agfl_buf_ops);
+}
+
+/* Run every scrub vector against one AG. */
+STATIC void
+xfs_scrub_vec_ag(
+	struct xfs_scrub_vec_ctx	*ctx,
+	unsigned int			agidx)
+{
+	struct xfs_scrub_vec_head	*head = ctx->head;
+	struct xfs_scrub_vec_result	*res;
+	struct xfs_scrub_metadata	sm;
+	xfs_agnumber_t			agno = head->svh_agno + agidx;
+	unsigned int			i;
+
+	xfs_scrub_vec_readahead_ag(ctx->ip->i_mount, agno);
+
+	res = &ctx->results[(size_t)agidx * head->svh_nr];
+	for (i = 0; i < head->svh_nr; i++, res++) {
+		/* Workers can't see signals, so the caller tells them. */
+		if (fatal_signal_pending(current))
+			WRITE_ONCE(ctx->aborted, true);
+		if (READ_ONCE(ctx->aborted)) {
+			res->svr_ret = -EINTR;
+			continue;
+		}
+
+		memset(&sm, 0, sizeof(sm));
+		sm.sm_type = ctx->vecs[i].sv_type;
+		sm.sm_flags = ctx->vecs[i].sv_flags;
+		sm.sm_agno = agno;
+		res->svr_ret = xfs_scrub_metadata(ctx->ip, &sm);
+		res->svr_flags = sm.sm_flags & XFS_SCRUB_FLAGS_OUT;
+
+		if (head->svh_rest_us)
+			schedule_timeout_killable(
+					usecs_to_jiffies(head->svh_rest_us));
+	}
+}
+
+/* Keep grabbing AGs until they're all done. */
+STATIC void
+xfs_scrub_vec_run(
+	struct xfs_scrub_vec_ctx	*ctx)
+{
+	unsigned int			agidx;
+
+	while ((agidx = atomic_inc_return(&ctx->next_ag) - 1) <
+			ctx->head->svh_agcount)
+		xfs_scrub_vec_ag(ctx, agidx);
+}
+
+STATIC void
+xfs_scrub_vec_worker(
+	struct work_struct		*work)
+{
+	struct xfs_scrub_vec_work	*svw;
+
+	svw = container_of(work, struct xfs_scrub_vec_work, work);
+	xfs_scrub_vec_run(svw->ctx);
+}
+
+/*
+ * Check a list of metadata types in a range of AGs.  The AGs are shared
+ * out among the caller and a small pool of workers; each runs all the
+ * vectors for one AG before moving on to the next so that the AG headers
+ * stay hot in the buffer cache.  Per-check failures are reported in the
+ * results array; we only return an error if the request is malformed.
+ * If we can't start any helpers, the caller checks every AG itself.
+ */
+int
+xfs_scrub_metadata_vec(
+	struct xfs_inode		*ip,
+	struct xfs_scrub_vec_head	*head,
+	struct xfs_scrub_vec		*vecs,
+	struct xfs_scrub_vec_result	*results)
+{
+	struct xfs_mount		*mp = ip->i_mount;
+	struct xfs_scrub_vec_ctx	ctx;
+	struct xfs_scrub_vec_work	*svw;
+	struct workqueue_struct		*wq;
+	unsigned int			nr_workers;
+	unsigned int			i;
+
+	for (i = 0; i < head->svh_nr; i++) {
+		if (!xfs_scrub_type_is_ag(vecs[i].sv_type))
+			return -EINVAL;
+		if (vecs[i].sv_flags & ~XFS_SCRUB_FLAGS_IN)
+			return -EINVAL;
+	}
+
+	nr_workers = head->svh_workers ? head->svh_workers :
+					 XFS_SCRUB_VEC_WORKERS;
+	nr_workers = min3(nr_workers, num_online_cpus(), head->svh_agcount);
+
+	ctx.ip = ip;
+	ctx.head = head;
+	ctx.vecs = vecs;
+	ctx.results = results;
+	ctx.aborted = false;
+	atomic_set(&ctx.next_ag, 0);
+
+	/* The caller does its share, so we need one helper fewer. */
+	if (nr_workers <= 1)
+		goto run;
+
+	svw = kmem_zalloc((nr_workers - 1) * sizeof(*svw), KM_MAYFAIL);
+	if (!svw)
+		goto run;
+	wq = alloc_workqueue("xfs-scrubv/%s", WQ_UNBOUND | WQ_FREEZABLE,
+			nr_workers - 1, mp->m_fsname);
+	if (!wq) {
+		kmem_free(svw);
+		goto run;
+	}
+
+	for (i = 0; i < nr_workers - 1; i++) {
+		INIT_WORK(&svw[i].work, xfs_scrub_vec_worker);
+		svw[i].ctx = &ctx;
+		queue_work(wq, &svw[i].work);
+	}
+	xfs_scrub_vec_run(&ctx);
+	destroy_workqueue(wq);
+	kmem_free(svw);
+	return 0;
+
+run:
+	xfs_scrub_vec_run(&ctx);
+	return 0;
+}
+
+/* Kernel-driven scrubbing of every inode. */
+
+struct xfs_scrub_inodes_ctx {
+	struct xfs_mount		*mp;
+	struct xfs_scrub_inodes_head	*head;
+	struct xfs_scrub_inode_failure	*failures;
+	spinlock_t			lock;
+	unsigned int			found;
+	atomic64_t			checked;
+	atomic_t			next_ag;
+	bool				aborted;
+};
+
+struct xfs_scrub_inodes_work {
+	struct work_struct		work;
+	struct xfs_scrub_inodes_ctx	*ctx;
+};
+
+/* Is this a type of metadata that belongs to a single inode? */
+static inline bool
+xfs_scrub_type_is_inode(
+	__u32				type)
+{
+	return type >= XFS_SCRUB_TYPE_INODE && type <= XFS_SCRUB_TYPE_PARENT;
+}
+
+/* Record a problem; we count all of them but only keep what fits. */
+STATIC void
+xfs_scrub_inodes_report(
+	struct xfs_scrub_inodes_ctx	*ctx,
+	xfs_ino_t			ino,
+	uint32_t			gen,
+	unsigned int			type,
+	unsigned int			flags,
+	int				ret)
+{
+	struct xfs_scrub_inode_failure	*sif;
+
+	spin_lock(&ctx->lock);
+	if (ctx->found < ctx->head->sih_max_failures) {
+		sif = &ctx->failures[ctx->found];
+		sif->sif_ino = ino;
+		sif->sif_gen = gen;
+		sif->sif_type = type;
+		sif->sif_flags = flags;
+		sif->sif_ret = ret;
+	}
+	ctx->found++;
+	spin_unlock(&ctx->lock);
+}
+
+/*
+ * Does this check apply to this inode?  This is only a hint to save us
+ * setting up checks that have nothing to look at; the scrubbers make
+ * the real decision under the ILOCK and return -ENOENT if there's
+ * nothing there.
+ */
+STATIC bool
+xfs_scrub_inodes_want(
+	struct xfs_inode		*ip,
+	unsigned int			type)
+{
+	umode_t				mode = VFS_I(ip)->i_mode;
+
+	switch (type) {
+	case XFS_SCRUB_TYPE_BMBTA:
+	case XFS_SCRUB_TYPE_XATTR:
+		return XFS_IFORK_Q(ip);
+	case XFS_SCRUB_TYPE_BMBTC:
+		return ip->i_cowfp != NULL;
+	case XFS_SCRUB_TYPE_DIR:
+	case XFS_SCRUB_TYPE_PARENT:
+		return S_ISDIR(mode);
+	case XFS_SCRUB_TYPE_SYMLINK:
+		return S_ISLNK(mode);
+	default:
+		return true;
+	}
+}
+
+/* Run every requested check against one inode. */
+STATIC int
+xfs_scrub_inodes_one(
+	struct xfs_mount		*mp,
+	xfs_ino_t			ino,
+	void				*data)
+{
+	struct xfs_scrub_inodes_ctx	*ctx = data;
+	struct xfs_scrub_inodes_head	*head = ctx->head;
+	struct xfs_scrub_metadata	sm;
+	struct xfs_inode		*ip;
+	unsigned int			type;
+	int				error;
+
+	/* Workers can't see signals, so the caller tells them. */
+	if (fatal_signal_pending(current))
+		WRITE_ONCE(ctx->aborted, true);
+	if (READ_ONCE(ctx->aborted))
+		return -EINTR;
+
+	if (xfs_internal_inum(mp, ino))
+		return 0;
+
+	/*
+	 * The inode may have been freed since the inobt walk dropped the
+	 * AGI, in which case there's nothing to check.  Don't let a full
+	 * scan push everyone else's inodes out of the cache.
+	 */
+	error = xfs_iget(mp, NULL, ino,
+			 XFS_IGET_UNTRUSTED | XFS_IGET_DONTCACHE, 0, &ip);
+	if (error == -ENOENT || error == -EINVAL)
+		return 0;
+	if (error) {
+		xfs_scrub_inodes_report(ctx, ino, 0, XFS_SCRUB_TYPE_INODE,
+				XFS_SCRUB_OFLAG_CORRUPT, error);
+		goto out;
+	}
+
+	for (type = XFS_SCRUB_TYPE_INODE; xfs_scrub_type_is_inode(type);
+	     type++) {
+		if (!(head->sih_types & (1U << type)))
+			continue;
+		if (!xfs_scrub_inodes_want(ip, type))
+			continue;
+
+		memset(&sm, 0, sizeof(sm));
+		sm.sm_type = type;
+		sm.sm_flags = head->sih_flags;
+		error = xfs_scrub_metadata(ip, &sm);
+		if (error == -ENOENT)
+			continue;
+		if (error || (sm.sm_flags & XFS_SCRUB_FLAGS_OUT))
+			xfs_scrub_inodes_report(ctx, ino,
+					VFS_I(ip)->i_generation, type,
+					sm.sm_flags & XFS_SCRUB_FLAGS_OUT,
+					error);
+	}
+	IRELE(ip);
+out:
+	atomic64_inc(&ctx->checked);
+	return 0;
+}
+
+/* Keep grabbing AGs until they're all done. */
+STATIC void
+xfs_scrub_inodes_run(
+	struct xfs_scrub_inodes_ctx	*ctx)
+{
+	struct xfs_mount		*mp = ctx->mp;
+	xfs_agnumber_t			agno;
+	unsigned int			agidx;
+	int				error;
+
+	while ((agidx = atomic_inc_return(&ctx->next_ag) - 1) <
+			ctx->head->sih_agcount) {
+		agno = ctx->head->sih_agno + agidx;
+		error = xfs_inode_walk_ag(mp, agno, xfs_scrub_inodes_one, ctx);
+		if (error == -EINTR)
+			break;
+		if (error)
+			xfs_scrub_inodes_report(ctx,
+					XFS_AGINO_TO_INO(mp, agno, 0), 0,
+					XFS_SCRUB_TYPE_INOBT,
+					XFS_SCRUB_OFLAG_INCOMPLETE, error);
+	}
+}
+
+STATIC void
+xfs_scrub_inodes_worker(
+	struct work_struct		*work)
+{
+	struct xfs_scrub_inodes_work	*siw;
+
+	siw = container_of(work, struct xfs_scrub_inodes_work, work);
+	xfs_scrub_inodes_run(siw->ctx);
+}
+
+/*
+ * Check every inode in a range of AGs.  The AGs are shared out among the
+ * caller and a small pool of workers in the same way as vectored scrub.
+ * Each walks its AG's inode btree a batch of records at a time with
+ * readahead issued for all the inode clusters in the batch, so the
+ * checks themselves rarely wait for inode buffers.  Only problems are
+ * recorded in the failure array; we return an error if the request is
+ * malformed or the caller was killed.
+ */
+int
+xfs_scrub_inodes(
+	struct xfs_inode		*ip,
+	struct xfs_scrub_inodes_head	*head,
+	struct xfs_scrub_inode_failure	*failures)
+{
+	struct xfs_mount		*mp = ip->i_mount;
+	struct xfs_scrub_inodes_ctx	ctx;
+	struct xfs_scrub_inodes_work	*siw;
+	struct workqueue_struct		*wq;
+	unsigned int			nr_workers;
+	unsigned int			type;
+	unsigned int			i;
+
+	if (!head->sih_types)
+		return -EINVAL;
+	for (type = 0; type < 32; type++) {
+		if ((head->sih_types & (1U << type)) &&
+		    !xfs_scrub_type_is_inode(type))
+			return -EINVAL;
+	}
+	if (head->sih_flags & ~XFS_SCRUB_FLAGS_IN)
+		return -EINVAL;
+
+	nr_workers = head->sih_workers ? head->sih_workers :
+					 XFS_SCRUB_VEC_WORKERS;
+	nr_workers = min3(nr_workers, num_online_cpus(), head->sih_agcount);
+
+	ctx.mp = mp;
+	ctx.head = head;
+	ctx.failures = failures;
+	spin_lock_init(&ctx.lock);
+	ctx.found = 0;
+	atomic64_set(&ctx.checked, 0);
+	atomic_set(&ctx.next_ag, 0);
+	ctx.aborted = false;
+
+	/* The caller does its share, so we need one helper fewer. */
+	if (nr_workers <= 1)
+		goto run;
+
+	siw = kmem_zalloc((nr_workers - 1) * sizeof(*siw), KM_MAYFAIL);
+	if (!siw)
+		goto run;
+	wq = alloc_workqueue("xfs-scrubi/%s", WQ_UNBOUND | WQ_FREEZABLE,
+			nr_workers - 1, mp->m_fsname);
+	if (!wq) {
+		kmem_free(siw);
+		goto run;
+	}
+
+	for (i = 0; i < nr_workers - 1; i++) {
+		INIT_WORK(&siw[i].work, xfs_scrub_inodes_worker);
+		siw[i].ctx = &ctx;
+		queue_work(wq, &siw[i].work);
+	}
+	xfs_scrub_inodes_run(&ctx);
+	destroy_workqueue(wq);
+	kmem_free(siw);
+	goto out;
+
+run:
+	xfs_scrub_inodes_run(&ctx);
+out:
+	head->sih_found = ctx.found;
+	head->sih_checked = atomic64_read(&ctx.checked);
+	return ctx.aborted ? -EINTR : 0;
+}
@@ -27,6 +27,7 @@ struct xfs_scrub_meta_ops {
 				 struct xfs_inode *);
 	int		(*scrub)(struct xfs_scrub_context *);
 	bool		(*has)(struct xfs_sb *);
+	int		(*repair)(struct xfs_scrub_context *);
 };
 
 /* Buffer pointers and btree cursors for an entire AG. */
@@ -58,6 +59,11 @@ struct xfs_scrub_context {
 	uint				ilock_flags;
 	bool				try_harder;
 
+	/* Block device read statistics at the last throttle sample. */
+	unsigned long			qos_next;
+	unsigned long			qos_ios;
+	unsigned long			qos_ticks;
+
 	/* State tracking for single-AG operations. */
 	struct xfs_scrub_ag		sa;
 };
@@ -528,6 +528,125 @@ TRACE_EVENT(xfs_scrub_xref_error,
 		  __entry->ret_ip)
 );
 
+TRACE_EVENT(xfs_scrub_throttle,
+	TP_PROTO(struct xfs_scrub_context *sc, unsigned int latency,
+		 unsigned int target),
+	TP_ARGS(sc, latency, target),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(int, type)
+		__field(unsigned int, latency)
+		__field(unsigned int, target)
+	),
+	TP_fast_assign(
+		__entry->dev = sc->mp->m_super->s_dev;
+		__entry->type = sc->sm->sm_type;
+		__entry->latency = latency;
+		__entry->target = target;
+	),
+	TP_printk("dev %d:%d type '%s' read latency %ums target %ums",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __print_symbolic(__entry->type, XFS_SCRUB_TYPE_DESC),
+		  __entry->latency,
+		  __entry->target)
+);
+
+TRACE_EVENT(xfs_scrub_freesp_extents,
+	TP_PROTO(struct xfs_scrub_context *sc, xfs_agnumber_t agno,
+		 xfs_extlen_t minlen, unsigned long long extents,
+		 unsigned long long blocks),
+	TP_ARGS(sc, agno, minlen, extents, blocks),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(xfs_agnumber_t, agno)
+		__field(xfs_extlen_t, minlen)
+		__field(unsigned long long, extents)
+		__field(unsigned long long, blocks)
+	),
+	TP_fast_assign(
+		__entry->dev = sc->mp->m_super->s_dev;
+		__entry->agno = agno;
+		__entry->minlen = minlen;
+		__entry->extents = extents;
+		__entry->blocks = blocks;
+	),
+	TP_printk("dev %d:%d agno %u free extents of %u+ blocks: %llu extents %llu blocks",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->agno,
+		  __entry->minlen,
+		  __entry->extents,
+		  __entry->blocks)
+);
+
+TRACE_EVENT(xfs_scrub_btree_fill,
+	TP_PROTO(struct xfs_scrub_context *sc, struct xfs_btree_cur *cur,
+		 int level, unsigned long long blocks,
+		 unsigned long long recs, unsigned long long maxrecs),
+	TP_ARGS(sc, cur, level, blocks, recs, maxrecs),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(int, type)
+		__field(xfs_btnum_t, btnum)
+		__field(xfs_agnumber_t, agno)
+		__field(xfs_ino_t, ino)
+		__field(int, level)
+		__field(int, nlevels)
+		__field(unsigned long long, blocks)
+		__field(unsigned long long, recs)
+		__field(unsigned long long, maxrecs)
+	),
+	TP_fast_assign(
+		__entry->dev = sc->mp->m_super->s_dev;
+		__entry->type = sc->sm->sm_type;
+		__entry->btnum = cur->bc_btnum;
+		__entry->agno = (cur->bc_flags & XFS_BTREE_LONG_PTRS) ?
+				NULLAGNUMBER : cur->bc_private.a.agno;
+		__entry->ino = sc->ip ? sc->ip->i_ino : 0;
+		__entry->level = level;
+		__entry->nlevels = cur->bc_nlevels;
+		__entry->blocks = blocks;
+		__entry->recs = recs;
+		__entry->maxrecs = maxrecs;
+	),
+	TP_printk("dev %d:%d type '%s' btnum '%s' agno %u ino %llu level %d nlevels %d blocks %llu recs %llu maxrecs %llu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __print_symbolic(__entry->type, XFS_SCRUB_TYPE_DESC),
+		  __print_symbolic(__entry->btnum, XFS_BTNUM_DESC),
+		  __entry->agno,
+		  __entry->ino,
+		  __entry->level,
+		  __entry->nlevels,
+		  __entry->blocks,
+		  __entry->recs,
+		  __entry->maxrecs)
+);
+
+TRACE_EVENT(xfs_scrub_bmap_fragmented,
+	TP_PROTO(struct xfs_scrub_context *sc, int whichfork,
+		 xfs_extnum_t extents, xfs_filblks_t blocks),
+	TP_ARGS(sc, whichfork, extents, blocks),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(xfs_ino_t, ino)
+		__field(int, whichfork)
+		__field(xfs_extnum_t, extents)
+		__field(xfs_filblks_t, blocks)
+	),
+	TP_fast_assign(
+		__entry->dev = sc->mp->m_super->s_dev;
+		__entry->ino = sc->ip->i_ino;
+		__entry->whichfork = whichfork;
+		__entry->extents = extents;
+		__entry->blocks = blocks;
+	),
+	TP_printk("dev %d:%d ino %llu fork '%s' extents %u blocks %llu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->ino,
+		  __print_symbolic(__entry->whichfork, XFS_FORK_DESC),
+		  __entry->extents,
+		  __entry->blocks)
+);
+
 #endif /* _TRACE_XFS_SCRUB_TRACE_H */
 
 #undef TRACE_INCLUDE_PATH
@@ -22,8 +22,16 @@
 
 #ifndef CONFIG_XFS_ONLINE_SCRUB
 # define xfs_scrub_metadata(ip, sm)	(-ENOTTY)
+# define xfs_scrub_metadata_vec(ip, h, v, r)	(-ENOTTY)
+# define xfs_scrub_inodes(ip, h, f)	(-ENOTTY)
 #else
 int xfs_scrub_metadata(struct xfs_inode *ip, struct xfs_scrub_metadata *sm);
+int xfs_scrub_metadata_vec(struct xfs_inode *ip,
+			   struct xfs_scrub_vec_head *head,
+			   struct xfs_scrub_vec *vecs,
+			   struct xfs_scrub_vec_result *results);
+int xfs_scrub_inodes(struct xfs_inode *ip, struct xfs_scrub_inodes_head *head,
+		     struct xfs_scrub_inode_failure *failures);
 #endif /* CONFIG_XFS_ONLINE_SCRUB */
 
 #endif	/* __XFS_SCRUB_H__ */
@@ -32,7 +32,9 @@
 #include "xfs_bmap_util.h"
 #include "xfs_bmap_btree.h"
 #include "xfs_reflink.h"
+#include <linux/backing-dev.h>
 #include <linux/gfp.h>
+#include <linux/list_sort.h>
 #include <linux/mpage.h>
 #include <linux/pagevec.h>
 #include <linux/writeback.h>
@@ -46,6 +48,9 @@ struct xfs_writepage_ctx {
 	unsigned int		io_type;
 	struct xfs_ioend	*ioend;
 	sector_t		last_block;
+	xfs_fileoff_t		cow_hole_start;	/* range known to have */
+	xfs_fileoff_t		cow_hole_end;	/* no CoW reservation */
+	unsigned int		cow_seq;	/* CoW fork if_seq of hole */
 };
 
 void
@@ -85,11 +90,17 @@ xfs_find_bdev_for_inode(
  * associated buffer_heads, paying attention to the start and end offsets that
  * we need to process on the page.
  *
- * Landmine Warning: bh->b_end_io() will call end_page_writeback() on the last
- * buffer in the IO. Once it does this, it is unsafe to access the bufferhead or
- * the page at all, as we may be racing with memory reclaim and it can free both
- * the bufferhead chain and the page as it will see the page as clean and
- * unused.
+ * This does the same job as calling end_buffer_async_write on each buffer in
+ * the range, but that rescans every buffer on the page for each buffer it
+ * finishes, which is quadratic in the number of blocks per page and hurts on
+ * large page machines with small filesystem blocks.  Instead, finish the
+ * whole range and then scan the page once, all under the page's buffer
+ * state lock so that we can't race with completions from other bios.
+ *
+ * Landmine Warning: once we call end_page_writeback() it is unsafe to access
+ * the bufferhead or the page at all, as we may be racing with memory reclaim
+ * and it can free both the bufferhead chain and the page as it will see the
+ * page as clean and unused.
  */
 static void
 xfs_finish_page_writeback(
@@ -97,29 +108,55 @@ xfs_finish_page_writeback(
 	struct bio_vec		*bvec,
 	int			error)
 {
+	struct page		*page = bvec->bv_page;
 	unsigned int		end = bvec->bv_offset + bvec->bv_len - 1;
-	struct buffer_head	*head, *bh, *next;
+	struct buffer_head	*head, *bh;
 	unsigned int		off = 0;
 	unsigned int		bsize;
+	unsigned long		flags;
+	bool			busy = false;
 
 	ASSERT(bvec->bv_offset < PAGE_SIZE);
 	ASSERT((bvec->bv_offset & (i_blocksize(inode) - 1)) == 0);
 	ASSERT(end < PAGE_SIZE);
 	ASSERT((bvec->bv_len & (i_blocksize(inode) - 1)) == 0);
 
-	bh = head = page_buffers(bvec->bv_page);
-
+	bh = head = page_buffers(page);
 	bsize = bh->b_size;
+
+	if (error) {
+		do {
+			if (off > end)
+				break;
+			if (off >= bvec->bv_offset) {
+				mark_buffer_write_io_error(bh);
+				clear_buffer_uptodate(bh);
+			}
+			off += bsize;
+		} while ((bh = bh->b_this_page) != head);
+		SetPageError(page);
+		off = 0;
+	}
+
+	local_irq_save(flags);
+	bit_spin_lock(BH_Uptodate_Lock, &head->b_state);
 	do {
-		if (off > end)
-			break;
-		next = bh->b_this_page;
-		if (off < bvec->bv_offset)
-			goto next_bh;
-		bh->b_end_io(bh, !error);
-next_bh:
+		if (off >= bvec->bv_offset && off <= end) {
+			ASSERT(buffer_async_write(bh));
+			if (!error)
+				set_buffer_uptodate(bh);
+			clear_buffer_async_write(bh);
+			unlock_buffer(bh);
+		} else if (buffer_async_write(bh)) {
+			busy = true;
+		}
 		off += bsize;
-	} while ((bh = next) != head);
+	} while ((bh = bh->b_this_page) != head);
+	bit_spin_unlock(BH_Uptodate_Lock, &head->b_state);
+	local_irq_restore(flags);
+
+	if (!busy)
+		end_page_writeback(page);
 }
 
 /*
@@ -217,7 +254,7 @@ __xfs_setfilesize(
 
 	ip->i_d.di_size = isize;
 	xfs_trans_ijoin(tp, ip, XFS_ILOCK_EXCL);
-	xfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	xfs_trans_log_inode(tp, ip, XFS_ILOG_ISIZE);
 
 	return xfs_trans_commit(tp);
 }
@@ -265,17 +302,18 @@ xfs_setfilesize_ioend(
 }
 
 /*
- * IO write completion.
+ * Finish the I/O for one ioend, which may have had more ioends merged into
+ * it.  The merged ioends are on the list at @merged and share the result.
  */
 STATIC void
-xfs_end_io(
-	struct work_struct *work)
+xfs_end_ioend(
+	struct xfs_ioend	*ioend,
+	struct list_head	*merged)
 {
-	struct xfs_ioend	*ioend =
-		container_of(work, struct xfs_ioend, io_work);
 	struct xfs_inode	*ip = XFS_I(ioend->io_inode);
 	xfs_off_t		offset = ioend->io_offset;
 	size_t			size = ioend->io_size;
+	struct xfs_ioend	*next;
 	int			error;
 
 	/*
@@ -318,22 +356,156 @@ xfs_end_io(
 done:
 	if (ioend->io_append_trans)
 		error = xfs_setfilesize_ioend(ioend, error);
+	while (!list_empty(merged)) {
+		next = list_first_entry(merged, struct xfs_ioend, io_list);
+		list_del_init(&next->io_list);
+		xfs_destroy_ioend(next, error);
+	}
 	xfs_destroy_ioend(ioend, error);
 }
 
+/*
+ * Can we fold @next into @ioend?  Both must have succeeded, be of the same
+ * type and be adjacent in the file.  Don't build a range larger than a
+ * single write could have been, since that's what the CoW remapping code
+ * expects.
+ */
+static bool
+xfs_ioend_can_merge(
+	struct xfs_ioend	*ioend,
+	struct xfs_ioend	*next)
+{
+	if (ioend->io_bio->bi_status || next->io_bio->bi_status)
+		return false;
+	if (ioend->io_type != next->io_type)
+		return false;
+	if (ioend->io_offset + ioend->io_size != next->io_offset)
+		return false;
+	if (ioend->io_size + next->io_size > MAX_RW_COUNT)
+		return false;
+	return true;
+}
+
+/*
+ * Fold @next into @ioend.  We only need one transaction to update the file
+ * size for the merged range, so keep whichever one we find first and cancel
+ * the other.
+ */
+static void
+xfs_ioend_merge(
+	struct xfs_ioend	*ioend,
+	struct xfs_ioend	*next)
+{
+	ioend->io_size += next->io_size;
+	if (!next->io_append_trans)
+		return;
+	if (!ioend->io_append_trans) {
+		ioend->io_append_trans = next->io_append_trans;
+	} else {
+		/* This cancels the transaction and returns the error. */
+		xfs_setfilesize_ioend(next, -ECANCELED);
+	}
+	next->io_append_trans = NULL;
+}
+
+/* Sort ioends by file offset. */
+static int
+xfs_ioend_compare(
+	void			*priv,
+	struct list_head	*a,
+	struct list_head	*b)
+{
+	struct xfs_ioend	*ia;
+	struct xfs_ioend	*ib;
+
+	ia = container_of(a, struct xfs_ioend, io_list);
+	ib = container_of(b, struct xfs_ioend, io_list);
+	if (ia->io_offset < ib->io_offset)
+		return -1;
+	if (ia->io_offset > ib->io_offset)
+		return 1;
+	return 0;
+}
+
+/*
+ * IO write completion.
+ *
+ * Converting unwritten extents, remapping CoW blocks and updating the file
+ * size each cost a transaction per call, so rather than doing that for each
+ * ioend we collect the ioends that need any of that on a per-inode list and
+ * let a single work item pick up whatever has accumulated.  Adjacent ioends
+ * of the same type are merged so that one transaction covers all of them.
+ * Page writeback isn't ended until the metadata update is done, so fsync
+ * and friends still wait for the extent conversion and size update.
+ */
+void
+xfs_end_io(
+	struct work_struct	*work)
+{
+	struct xfs_inode_io	*io;
+	struct xfs_ioend	*ioend;
+	struct xfs_ioend	*next;
+	struct list_head	completion_list;
+	struct list_head	merged;
+	unsigned long		flags;
+
+	io = container_of(work, struct xfs_inode_io, iio_ioend_work);
+
+	spin_lock_irqsave(&io->iio_ioend_lock, flags);
+	list_replace_init(&io->iio_ioend_list, &completion_list);
+	spin_unlock_irqrestore(&io->iio_ioend_lock, flags);
+
+	list_sort(NULL, &completion_list, xfs_ioend_compare);
+
+	while (!list_empty(&completion_list)) {
+		ioend = list_first_entry(&completion_list, struct xfs_ioend,
+				io_list);
+		list_del_init(&ioend->io_list);
+
+		INIT_LIST_HEAD(&merged);
+		while (!list_empty(&completion_list)) {
+			next = list_first_entry(&completion_list,
+					struct xfs_ioend, io_list);
+			if (!xfs_ioend_can_merge(ioend, next))
+				break;
+			xfs_ioend_merge(ioend, next);
+			list_move_tail(&next->io_list, &merged);
+		}
+
+		xfs_end_ioend(ioend, &merged);
+	}
+}
+
 STATIC void
 xfs_end_bio(
 	struct bio		*bio)
 {
 	struct xfs_ioend	*ioend = bio->bi_private;
-	struct xfs_mount	*mp = XFS_I(ioend->io_inode)->i_mount;
+	struct xfs_inode	*ip = XFS_I(ioend->io_inode);
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_inode_io	*io = ip->i_io;
+	unsigned long		flags;
+	bool			queue;
 
-	if (ioend->io_type == XFS_IO_UNWRITTEN || ioend->io_type == XFS_IO_COW)
-		queue_work(mp->m_unwritten_workqueue, &ioend->io_work);
-	else if (ioend->io_append_trans)
-		queue_work(mp->m_data_workqueue, &ioend->io_work);
-	else
+	xfs_buftarg_write_done(XFS_IS_REALTIME_INODE(ip) ?
+			mp->m_rtdev_targp : mp->m_ddev_targp);
+
+	if (ioend->io_type != XFS_IO_UNWRITTEN &&
+	    ioend->io_type != XFS_IO_COW &&
+	    !ioend->io_append_trans) {
 		xfs_destroy_ioend(ioend, blk_status_to_errno(bio->bi_status));
+		return;
+	}
+
+	/* Dirtying the pages went through xfs_file_iomap_begin. */
+	ASSERT(io != NULL);
+	spin_lock_irqsave(&io->iio_ioend_lock, flags);
+	queue = list_empty(&io->iio_ioend_list);
+	list_add_tail(&ioend->io_list, &io->iio_ioend_list);
+	spin_unlock_irqrestore(&io->iio_ioend_lock, flags);
+	if (queue)
+		xfs_io_queue_work(mp, XFS_WQ_CONV, mp->m_unwritten_workqueue,
+				  &io->iio_ioend_work, ioend->io_cpu);
 }
 
 STATIC int
@@ -539,8 +711,8 @@ xfs_alloc_ioend(
 	ioend->io_inode = inode;
 	ioend->io_size = 0;
 	ioend->io_offset = offset;
-	INIT_WORK(&ioend->io_work, xfs_end_io);
 	ioend->io_append_trans = NULL;
+	ioend->io_cpu = raw_smp_processor_id();
 	ioend->io_bio = bio;
 	return ioend;
 }
@@ -774,6 +946,8 @@ xfs_map_cow(
 	unsigned int		*new_type)
 {
 	struct xfs_inode	*ip = XFS_I(inode);
+	struct xfs_ifork	*ifp = XFS_IFORK_PTR(ip, XFS_COW_FORK);
+	xfs_fileoff_t		offset_fsb;
 	struct xfs_bmbt_irec	imap;
 	bool			is_cow = false;
 	int			error;
@@ -789,11 +963,30 @@ xfs_map_cow(
 		}
 	}
 
+	/*
+	 * If an earlier lookup found no COW mapping here and the COW fork
+	 * hasn't changed since, there still is none.  Most blocks of a large
+	 * reflinked file usually aren't being COWed, so this saves taking the
+	 * ILOCK and searching the COW fork for every block we write back.
+	 * Any COW reservation for this page was made before it was dirtied,
+	 * and hence is visible to us now that we hold the page lock.
+	 */
+	offset_fsb = XFS_B_TO_FSBT(ip->i_mount, offset);
+	if (offset_fsb >= wpc->cow_hole_start &&
+	    offset_fsb < wpc->cow_hole_end &&
+	    READ_ONCE(ifp->if_seq) == wpc->cow_seq)
+		return 0;
+
 	/*
 	 * Else we need to check if there is a COW mapping at this offset.
 	 */
 	xfs_ilock(ip, XFS_ILOCK_SHARED);
 	is_cow = xfs_reflink_find_cow_mapping(ip, offset, &imap);
+	if (!is_cow) {
+		wpc->cow_hole_start = imap.br_startoff;
+		wpc->cow_hole_end = imap.br_startoff + imap.br_blockcount;
+		wpc->cow_seq = ifp->if_seq;
+	}
 	xfs_iunlock(ip, XFS_ILOCK_SHARED);
 
 	if (!is_cow)
@@ -977,6 +1170,113 @@ xfs_writepage_map(
 	return error;
 }
 
+/*
+ * On filesystems with the inline data feature a small new file is written
+ * into the inode literal area rather than into a block of its own.  We only
+ * do this when the whole file is covered by a single one block delalloc
+ * reservation, so that there is nothing to free but that reservation, and
+ * only if the data would still fit if an attribute fork were added later.
+ *
+ * Returns true if the page was written inline, in which case it has been
+ * cleaned and unlocked.
+ */
+STATIC bool
+xfs_writepage_inline(
+	struct xfs_inode	*ip,
+	struct page		*page,
+	loff_t			isize)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_ifork	*ifp = &ip->i_df;
+	struct xfs_trans	*tp;
+	struct xfs_bmbt_irec	got;
+	struct buffer_head	*bh, *head;
+	int			error;
+
+	if (!xfs_sb_version_hasinlinedata(&mp->m_sb) || page->index != 0)
+		return false;
+	if (isize <= 0 || isize > XFS_IFORK_DSIZE(ip) ||
+	    (!XFS_IFORK_Q(ip) && isize > xfs_default_attroffset(ip)))
+		return false;
+	if (XFS_IS_REALTIME_INODE(ip) || IS_DAX(VFS_I(ip)) ||
+	    xfs_is_reflink_inode(ip) || !PageUptodate(page))
+		return false;
+
+	if (xfs_trans_alloc(mp, &M_RES(mp)->tr_ichange, 0, 0, 0, &tp))
+		return false;
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+
+	if (ip->i_d.di_format != XFS_DINODE_FMT_EXTENTS ||
+	    !(ifp->if_flags & XFS_IFEXTENTS) ||
+	    ip->i_d.di_nextents != 0 || xfs_iext_count(ifp) != 1)
+		goto out_cancel;
+	xfs_iext_get_extent(ifp, 0, &got);
+	if (got.br_startoff != 0 || got.br_blockcount != 1 ||
+	    !isnullstartblock(got.br_startblock))
+		goto out_cancel;
+
+	if (xfs_bmap_punch_delalloc_range(ip, 0, 1) || ifp->if_bytes)
+		goto out_cancel;
+
+	xfs_trans_ijoin(tp, ip, XFS_ILOCK_EXCL);
+	xfs_init_local_fork(ip, XFS_DATA_FORK, kmap(page), isize);
+	kunmap(page);
+	ip->i_d.di_format = XFS_DINODE_FMT_LOCAL;
+	ip->i_d.di_size = isize;
+	xfs_trans_log_inode(tp, ip, XFS_ILOG_CORE | XFS_ILOG_DDATA);
+	error = xfs_trans_commit(tp);
+	if (error)
+		mapping_set_error(page->mapping, error);
+
+	/* The data lives in the inode now, the buffers map nothing. */
+	bh = head = page_buffers(page);
+	do {
+		clear_buffer_dirty(bh);
+		clear_buffer_delay(bh);
+		clear_buffer_mapped(bh);
+	} while ((bh = bh->b_this_page) != head);
+	unlock_page(page);
+	return true;
+
+out_cancel:
+	xfs_trans_cancel(tp);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return false;
+}
+
+/*
+ * Fill a page of an inline regular file from the data fork.  Returns false if
+ * the file was converted to extents before we got the ILOCK.
+ */
+STATIC bool
+xfs_readpage_inline(
+	struct xfs_inode	*ip,
+	struct page		*page)
+{
+	struct xfs_ifork	*ifp = &ip->i_df;
+	size_t			size = 0;
+	void			*kaddr;
+
+	xfs_ilock(ip, XFS_ILOCK_SHARED);
+	if (!xfs_is_inline_data_inode(ip)) {
+		xfs_iunlock(ip, XFS_ILOCK_SHARED);
+		return false;
+	}
+	kaddr = kmap_atomic(page);
+	if (page->index == 0) {
+		size = ifp->if_bytes;
+		memcpy(kaddr, ifp->if_u1.if_data, size);
+	}
+	memset(kaddr + size, 0, PAGE_SIZE - size);
+	kunmap_atomic(kaddr);
+	xfs_iunlock(ip, XFS_ILOCK_SHARED);
+
+	flush_dcache_page(page);
+	SetPageUptodate(page);
+	unlock_page(page);
+	return true;
+}
+
 /*
  * Write out a dirty page.
  *
@@ -1088,6 +1388,9 @@ xfs_do_writepage(
 		end_offset = offset;
 	}
 
+	if (xfs_writepage_inline(XFS_I(inode), page, offset))
+		return 0;
+
 	return xfs_writepage_map(wpc, wbc, inode, page, offset, end_offset);
 
 redirty:
@@ -1112,6 +1415,54 @@ xfs_vm_writepage(
 	return ret;
 }
 
+/*
+ * Writing less than a full stripe to a parity RAID makes the array read the
+ * rest of the stripe back to recompute parity.  When stripe width allocation
+ * is enabled, widen writeback to whole stripe widths so that the dirty pages
+ * of a stripe go out together and the flusher's plug can hand the array full
+ * stripes: ranged writeback is extended to stripe boundaries, cyclic
+ * writeback restarts at the beginning of a stripe, and background writeback
+ * doesn't stop part way through one.
+ */
+STATIC void
+xfs_writeback_stripe_align(
+	struct xfs_inode	*ip,
+	struct writeback_control *wbc)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct address_space	*mapping = VFS_I(ip)->i_mapping;
+	loff_t			stripe_bytes;
+	pgoff_t			stripe_pages;
+	pgoff_t			index;
+
+	if (!mp->m_swidth || !(mp->m_flags & XFS_MOUNT_SWALLOC) ||
+	    XFS_IS_REALTIME_INODE(ip))
+		return;
+	stripe_bytes = XFS_FSB_TO_B(mp, mp->m_swidth);
+	if (stripe_bytes <= PAGE_SIZE || (stripe_bytes & ~PAGE_MASK))
+		return;
+	stripe_pages = stripe_bytes >> PAGE_SHIFT;
+
+	if (wbc->range_cyclic) {
+		mapping->writeback_index = rounddown(mapping->writeback_index,
+						     stripe_pages);
+	} else {
+		index = wbc->range_start >> PAGE_SHIFT;
+		wbc->range_start = (loff_t)rounddown(index, stripe_pages) <<
+				PAGE_SHIFT;
+		index = wbc->range_end >> PAGE_SHIFT;
+		if (wbc->range_end != LLONG_MAX &&
+		    index < ULONG_MAX - stripe_pages) {
+			index = roundup(index + 1, stripe_pages);
+			wbc->range_end = ((loff_t)index << PAGE_SHIFT) - 1;
+		}
+	}
+
+	if (wbc->sync_mode == WB_SYNC_NONE && wbc->nr_to_write > 0 &&
+	    wbc->nr_to_write < LONG_MAX - stripe_pages)
+		wbc->nr_to_write = roundup(wbc->nr_to_write, stripe_pages);
+}
+
 STATIC int
 xfs_vm_writepages(
 	struct address_space	*mapping,
@@ -1127,6 +1478,7 @@ xfs_vm_writepages(
 		return dax_writeback_mapping_range(mapping,
 				xfs_find_bdev_for_inode(mapping->host), wbc);
 
+	xfs_writeback_stripe_align(XFS_I(mapping->host), wbc);
 	ret = write_cache_pages(mapping, wbc, xfs_do_writepage, &wpc);
 	if (wpc.ioend)
 		ret = xfs_submit_ioend(wbc, wpc.ioend, ret);
@@ -1328,6 +1680,8 @@ xfs_vm_bmap(
 		return 0;
 
 	filemap_write_and_wait(mapping);
+	if (xfs_is_inline_data_inode(ip))
+		return 0;
 	return generic_block_bmap(mapping, block, xfs_get_blocks);
 }
 
@@ -1336,10 +1690,101 @@ xfs_vm_readpage(
 	struct file		*unused,
 	struct page		*page)
 {
+	struct xfs_inode	*ip = XFS_I(page->mapping->host);
+
 	trace_xfs_vm_readpage(page->mapping->host, 1);
+	if (xfs_is_inline_data_inode(ip) && xfs_readpage_inline(ip, page))
+		return 0;
 	return mpage_readpage(page, xfs_get_blocks);
 }
 
+/*
+ * The VM sizes readahead without knowing anything about the file layout, so
+ * the window routinely ends just short of the end of an extent and the rest of
+ * it has to be read by a separate, smaller I/O later.  Extend the window to the
+ * end of the written extent the last page falls into, and on through any
+ * extents that continue it both logically and physically, so that mpage reads
+ * the whole run with one large bio.
+ *
+ * We never read ahead into holes, delalloc or unwritten extents.  Within the
+ * window mpage zeroes those without I/O anyway, as xfs_get_blocks doesn't map
+ * them for reads.  The extension is bounded by another readahead window worth
+ * of pages and stops at EOF and at the first page that is already cached.
+ */
+STATIC unsigned
+xfs_vm_readahead_extend(
+	struct address_space	*mapping,
+	struct list_head	*pages,
+	unsigned		nr_pages)
+{
+	struct inode		*inode = mapping->host;
+	struct xfs_inode	*ip = XFS_I(inode);
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_ifork	*ifp = XFS_IFORK_PTR(ip, XFS_DATA_FORK);
+	unsigned long		ra_pages = inode_to_bdi(inode)->ra_pages;
+	loff_t			isize = i_size_read(inode);
+	gfp_t			gfp = readahead_gfp_mask(mapping);
+	struct xfs_bmbt_irec	got;
+	xfs_extnum_t		idx;
+	xfs_fileoff_t		offset_fsb;
+	xfs_fileoff_t		end_fsb = 0;
+	xfs_fsblock_t		next_block = NULLFSBLOCK;
+	pgoff_t			index, end_index;
+	struct page		*page;
+	uint			lockmode;
+
+	if (!ra_pages || !isize || XFS_FORCED_SHUTDOWN(mp))
+		return nr_pages;
+
+	/* the list is in reverse order, so the last page is at the head */
+	index = list_first_entry(pages, struct page, lru)->index + 1;
+	if ((loff_t)index << PAGE_SHIFT >= isize)
+		return nr_pages;
+	offset_fsb = XFS_B_TO_FSBT(mp, (xfs_off_t)index << PAGE_SHIFT);
+
+	lockmode = xfs_ilock_data_map_shared(ip);
+	if ((XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) == XFS_DINODE_FMT_EXTENTS ||
+	     XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) == XFS_DINODE_FMT_BTREE) &&
+	    xfs_iext_lookup_extent(ip, ifp, offset_fsb, &idx, &got) &&
+	    got.br_startoff <= offset_fsb) {
+		do {
+			if (isnullstartblock(got.br_startblock) ||
+			    got.br_state == XFS_EXT_UNWRITTEN)
+				break;
+			if (next_block != NULLFSBLOCK &&
+			    got.br_startblock != next_block)
+				break;
+			end_fsb = got.br_startoff + got.br_blockcount;
+			next_block = got.br_startblock + got.br_blockcount;
+		} while (xfs_iext_get_extent(ifp, ++idx, &got) &&
+			 got.br_startoff == end_fsb);
+	}
+	xfs_iunlock(ip, lockmode);
+
+	if (!end_fsb)
+		return nr_pages;
+
+	end_index = (min_t(loff_t, XFS_FSB_TO_B(mp, end_fsb), isize) - 1) >>
+			PAGE_SHIFT;
+	end_index = min_t(pgoff_t, end_index, index + ra_pages - 1);
+
+	for (; index <= end_index; index++) {
+		rcu_read_lock();
+		page = radix_tree_lookup(&mapping->page_tree, index);
+		rcu_read_unlock();
+		if (page && !radix_tree_exceptional_entry(page))
+			break;
+
+		page = __page_cache_alloc(gfp);
+		if (!page)
+			break;
+		page->index = index;
+		list_add(&page->lru, pages);
+		nr_pages++;
+	}
+	return nr_pages;
+}
+
 STATIC int
 xfs_vm_readpages(
 	struct file		*unused,
@@ -1347,6 +1792,11 @@ xfs_vm_readpages(
 	struct list_head	*pages,
 	unsigned		nr_pages)
 {
+	/* Inline files are tiny, leave them to ->readpage. */
+	if (xfs_is_inline_data_inode(XFS_I(mapping->host)))
+		return 0;
+
+	nr_pages = xfs_vm_readahead_extend(mapping, pages, nr_pages);
 	trace_xfs_vm_readpages(mapping->host, nr_pages);
 	return mpage_readpages(mapping, pages, nr_pages, xfs_get_blocks);
 }
@@ -133,6 +133,18 @@ typedef struct xfs_attr_list_context {
 } xfs_attr_list_context_t;
 
 
+/*
+ * One operation of a batched attribute get, set or remove.
+ */
+struct xfs_attr_op {
+	const unsigned char	*xo_name;
+	unsigned char		*xo_value;
+	int			xo_valuelen;	/* buffer size / value length */
+	int			xo_flags;	/* ATTR_* flags */
+	int			xo_opcode;	/* ATTR_OP_* */
+	int			xo_error;	/* result */
+};
+
 /*========================================================================
  * Function prototypes for the kernel.
  *========================================================================*/
@@ -150,8 +162,21 @@ int xfs_attr_get(struct xfs_inode *ip, const unsigned char *name,
 int xfs_attr_set(struct xfs_inode *dp, const unsigned char *name,
 		 unsigned char *value, int valuelen, int flags);
 int xfs_attr_remove(struct xfs_inode *dp, const unsigned char *name, int flags);
+int xfs_attr_get_multi(struct xfs_inode *dp, struct xfs_attr_op *ops,
+		int nops);
+int xfs_attr_set_multi(struct xfs_inode *dp, struct xfs_attr_op *ops,
+		int nops);
 int xfs_attr_list(struct xfs_inode *dp, char *buffer, int bufsize,
 		  int flags, struct attrlist_cursor_kern *cursor);
 
+/*
+ * In-core cache of small attributes.
+ */
+int xfs_attr_cache_get(struct xfs_inode *ip, struct xfs_da_args *args);
+void xfs_attr_cache_add(struct xfs_inode *ip, struct xfs_da_args *args,
+		int error);
+void xfs_attr_cache_inval(struct xfs_inode *ip);
+void xfs_attr_cache_free(struct xfs_inode *ip);
+
 
 #endif	/* __XFS_ATTR_H__ */
@@ -0,0 +1,219 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_da_format.h"
+#include "xfs_da_btree.h"
+#include "xfs_inode.h"
+#include "xfs_attr.h"
+
+/*
+ * In-core cache of small extended attributes.
+ *
+ * Security labels, ACLs and application metadata attributes are looked up on
+ * every open, and each lookup of a leaf or node format attribute fork means
+ * a buffer cache lookup and a walk of the leaf block.  So we remember the last
+ * few lookups of small attributes, hits and misses both, in a short list
+ * hanging off the inode.
+ *
+ * Lookups and fills run under the shared ILOCK, so the list has a spinlock of
+ * its own.  Anything that changes the attribute fork holds the ILOCK
+ * exclusively for the whole change, and empties the list once it has the
+ * lock; that keeps readers from caching anything until the change is done.
+ */
+#define XFS_ATTR_CACHE_MAX_ENTS		8
+#define XFS_ATTR_CACHE_MAX_VALUELEN	256
+
+/* Only the namespace flags take part in matching a name. */
+#define XFS_ATTR_CACHE_NSP_FLAGS	(ATTR_ROOT | ATTR_SECURE)
+
+struct xfs_attr_cache_ent {
+	struct list_head	ace_list;
+	int			ace_flags;	/* attr namespace */
+	int			ace_valuelen;	/* -1 if the attr doesn't exist */
+	int			ace_namelen;
+	unsigned char		ace_data[];	/* name then value */
+};
+
+struct xfs_attr_cache {
+	spinlock_t		ac_lock;
+	struct list_head	ac_list;	/* most recently added first */
+	int			ac_count;
+};
+
+static inline bool
+xfs_attr_cache_match(
+	struct xfs_attr_cache_ent *ace,
+	struct xfs_da_args	*args)
+{
+	return ace->ace_namelen == args->namelen &&
+	       ace->ace_flags == (args->flags & XFS_ATTR_CACHE_NSP_FLAGS) &&
+	       !memcmp(ace->ace_data, args->name, args->namelen);
+}
+
+/*
+ * Look an attribute up in the cache.  Returns -EAGAIN if it isn't cached,
+ * otherwise what xfs_attr_get_ilocked would have returned.
+ */
+int
+xfs_attr_cache_get(
+	struct xfs_inode	*ip,
+	struct xfs_da_args	*args)
+{
+	struct xfs_attr_cache	*ac = READ_ONCE(ip->i_attr_cache);
+	struct xfs_attr_cache_ent *ace;
+	int			error = -EAGAIN;
+
+	ASSERT(xfs_isilocked(ip, XFS_ILOCK_SHARED | XFS_ILOCK_EXCL));
+
+	if (!ac)
+		return -EAGAIN;
+
+	spin_lock(&ac->ac_lock);
+	list_for_each_entry(ace, &ac->ac_list, ace_list) {
+		if (!xfs_attr_cache_match(ace, args))
+			continue;
+		if (ace->ace_valuelen < 0) {
+			error = -ENOATTR;
+		} else if (args->flags & ATTR_KERNOVAL) {
+			args->valuelen = ace->ace_valuelen;
+			error = -EEXIST;
+		} else if (args->valuelen < ace->ace_valuelen) {
+			args->valuelen = ace->ace_valuelen;
+			error = -ERANGE;
+		} else {
+			args->valuelen = ace->ace_valuelen;
+			memcpy(args->value, ace->ace_data + ace->ace_namelen,
+					ace->ace_valuelen);
+			error = -EEXIST;
+		}
+		break;
+	}
+	spin_unlock(&ac->ac_lock);
+	return error;
+}
+
+/*
+ * Remember the result of looking an attribute up on disk.  error is what
+ * xfs_attr_get_ilocked returned; we cache small values that were returned in
+ * full and names that don't exist, and ignore everything else.
+ */
+void
+xfs_attr_cache_add(
+	struct xfs_inode	*ip,
+	struct xfs_da_args	*args,
+	int			error)
+{
+	struct xfs_attr_cache	*ac = READ_ONCE(ip->i_attr_cache);
+	struct xfs_attr_cache_ent *ace;
+	struct xfs_attr_cache_ent *old;
+	int			valuelen;
+
+	ASSERT(xfs_isilocked(ip, XFS_ILOCK_SHARED | XFS_ILOCK_EXCL));
+
+	if (error == -ENOATTR)
+		valuelen = -1;
+	else if (error == -EEXIST && !(args->flags & ATTR_KERNOVAL) &&
+		 args->valuelen <= XFS_ATTR_CACHE_MAX_VALUELEN)
+		valuelen = args->valuelen;
+	else
+		return;
+
+	if (!ac) {
+		ac = kmem_alloc(sizeof(*ac), KM_NOFS | KM_MAYFAIL);
+		if (!ac)
+			return;
+		spin_lock_init(&ac->ac_lock);
+		INIT_LIST_HEAD(&ac->ac_list);
+		ac->ac_count = 0;
+		if (cmpxchg(&ip->i_attr_cache, NULL, ac) != NULL) {
+			kmem_free(ac);
+			ac = READ_ONCE(ip->i_attr_cache);
+		}
+	}
+
+	ace = kmem_alloc(sizeof(*ace) + args->namelen + max(valuelen, 0),
+			KM_NOFS | KM_MAYFAIL);
+	if (!ace)
+		return;
+	ace->ace_flags = args->flags & XFS_ATTR_CACHE_NSP_FLAGS;
+	ace->ace_namelen = args->namelen;
+	ace->ace_valuelen = valuelen;
+	memcpy(ace->ace_data, args->name, args->namelen);
+	if (valuelen > 0)
+		memcpy(ace->ace_data + args->namelen, args->value, valuelen);
+
+	/* Someone may have beaten us to it; otherwise push out the oldest. */
+	old = NULL;
+	spin_lock(&ac->ac_lock);
+	list_for_each_entry(old, &ac->ac_list, ace_list) {
+		if (xfs_attr_cache_match(old, args)) {
+			spin_unlock(&ac->ac_lock);
+			kmem_free(ace);
+			return;
+		}
+	}
+	old = NULL;
+	if (ac->ac_count == XFS_ATTR_CACHE_MAX_ENTS) {
+		old = list_last_entry(&ac->ac_list, struct xfs_attr_cache_ent,
+				ace_list);
+		list_del(&old->ace_list);
+		ac->ac_count--;
+	}
+	list_add(&ace->ace_list, &ac->ac_list);
+	ac->ac_count++;
+	spin_unlock(&ac->ac_lock);
+	kmem_free(old);
+}
+
+static void
+xfs_attr_cache_purge(
+	struct xfs_attr_cache	*ac)
+{
+	struct xfs_attr_cache_ent *ace;
+	struct xfs_attr_cache_ent *n;
+
+	list_for_each_entry_safe(ace, n, &ac->ac_list, ace_list)
+		kmem_free(ace);
+	INIT_LIST_HEAD(&ac->ac_list);
+	ac->ac_count = 0;
+}
+
+/* The attribute fork is about to change; forget everything we know. */
+void
+xfs_attr_cache_inval(
+	struct xfs_inode	*ip)
+{
+	ASSERT(xfs_isilocked(ip, XFS_ILOCK_EXCL));
+
+	if (ip->i_attr_cache)
+		xfs_attr_cache_purge(ip->i_attr_cache);
+}
+
+void
+xfs_attr_cache_free(
+	struct xfs_inode	*ip)
+{
+	if (!ip->i_attr_cache)
+		return;
+	xfs_attr_cache_purge(ip->i_attr_cache);
+	kmem_free(ip->i_attr_cache);
+	ip->i_attr_cache = NULL;
+}
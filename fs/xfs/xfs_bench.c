@@ -0,0 +1,247 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_da_format.h"
+#include "xfs_da_btree.h"
+#include "xfs_inode.h"
+#include "xfs_bmap_btree.h"
+#include "xfs_cksum.h"
+#include "xfs_bench.h"
+
+#include <linux/random.h>
+
+/*
+ * In-kernel microbenchmarks of libxfs hot paths.
+ *
+ * Writing an operation count to /sys/fs/xfs/bench/run runs every benchmark
+ * against synthetic in-memory structures, and /sys/fs/xfs/bench/run reports
+ * the results of the last run as "<name> <ops> <ns/op>" lines. Nothing here
+ * touches a mounted filesystem, so the numbers only reflect CPU and cache
+ * cost of the code under test.
+ */
+
+enum {
+	XFS_BENCH_IEXT_APPEND = 0,
+	XFS_BENCH_IEXT_LOOKUP,
+	XFS_BENCH_IEXT_PREPEND,
+	XFS_BENCH_DA_HASHNAME,
+	XFS_BENCH_CKSUM,
+	XFS_BENCH_MAX,
+};
+
+static const char * const xfs_bench_names[XFS_BENCH_MAX] = {
+	[XFS_BENCH_IEXT_APPEND]	= "iext_append",
+	[XFS_BENCH_IEXT_LOOKUP]	= "iext_lookup",
+	[XFS_BENCH_IEXT_PREPEND] = "iext_prepend",
+	[XFS_BENCH_DA_HASHNAME]	= "da_hashname",
+	[XFS_BENCH_CKSUM]	= "cksum_4k",
+};
+
+struct xfs_bench_result {
+	unsigned int		ops;
+	uint64_t		ns;
+};
+
+static DEFINE_MUTEX(xfs_bench_lock);
+static struct xfs_bench_result xfs_bench_results[XFS_BENCH_MAX];
+
+static void
+xfs_bench_record(
+	int			bench,
+	unsigned int		ops,
+	uint64_t		start)
+{
+	xfs_bench_results[bench].ops = ops;
+	xfs_bench_results[bench].ns = ktime_get_ns() - start;
+}
+
+static void
+xfs_bench_iext_rec(
+	struct xfs_bmbt_rec_host *rec,
+	xfs_fileoff_t		startoff)
+{
+	struct xfs_bmbt_irec	irec = {
+		.br_startoff	= startoff,
+		.br_startblock	= startoff,
+		.br_blockcount	= 1,
+		.br_state	= XFS_EXT_NORM,
+	};
+
+	xfs_bmbt_set_all(rec, &irec);
+}
+
+/*
+ * Build an extent fork of @nr one block extents with one block holes between
+ * them, then look up random offsets in it. A second fork is built by always
+ * inserting at the front, which splits leaves and nodes on the left edge of
+ * the tree instead of the right.
+ */
+STATIC int
+xfs_bench_iext(
+	unsigned int		nr)
+{
+	struct xfs_ifork	*ifp;
+	struct xfs_bmbt_rec_host rec;
+	xfs_extnum_t		idx;
+	uint64_t		start;
+	unsigned int		i;
+
+	ifp = kmem_zalloc(sizeof(*ifp), KM_MAYFAIL);
+	if (!ifp)
+		return -ENOMEM;
+	ifp->if_flags = XFS_IFEXTENTS;
+
+	start = ktime_get_ns();
+	for (i = 0; i < nr; i++) {
+		xfs_bench_iext_rec(&rec, (xfs_fileoff_t)i * 2);
+		xfs_iext_insert_rec(ifp, i, &rec);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	xfs_bench_record(XFS_BENCH_IEXT_APPEND, nr, start);
+
+	start = ktime_get_ns();
+	for (i = 0; i < nr; i++) {
+		xfs_iext_bno_to_ext(ifp, prandom_u32_max(nr * 2), &idx);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	xfs_bench_record(XFS_BENCH_IEXT_LOOKUP, nr, start);
+	xfs_iext_destroy(ifp);
+
+	start = ktime_get_ns();
+	for (i = 0; i < nr; i++) {
+		xfs_bench_iext_rec(&rec, (xfs_fileoff_t)(nr - i) * 2);
+		xfs_iext_insert_rec(ifp, 0, &rec);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	xfs_bench_record(XFS_BENCH_IEXT_PREPEND, nr, start);
+	xfs_iext_destroy(ifp);
+
+	kmem_free(ifp);
+	return 0;
+}
+
+#define XFS_BENCH_NAMES		256
+
+/* Hash random directory entry names of typical lengths. */
+STATIC int
+xfs_bench_hashname(
+	unsigned int		nr)
+{
+	uint8_t			*names;
+	uint8_t			lens[XFS_BENCH_NAMES];
+	volatile xfs_dahash_t	hash;
+	uint64_t		start;
+	unsigned int		i;
+
+	names = kmem_alloc(XFS_BENCH_NAMES * MAXNAMELEN, KM_MAYFAIL);
+	if (!names)
+		return -ENOMEM;
+	for (i = 0; i < XFS_BENCH_NAMES; i++) {
+		lens[i] = 4 + prandom_u32_max(28);
+		prandom_bytes(names + i * MAXNAMELEN, lens[i]);
+	}
+
+	start = ktime_get_ns();
+	for (i = 0; i < nr; i++) {
+		unsigned int	n = i % XFS_BENCH_NAMES;
+
+		hash = xfs_da_hashname(names + n * MAXNAMELEN, lens[n]);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	xfs_bench_record(XFS_BENCH_DA_HASHNAME, nr, start);
+
+	kmem_free(names);
+	return 0;
+}
+
+/* Compute metadata block CRCs the way the buffer verifiers do. */
+STATIC int
+xfs_bench_cksum(
+	unsigned int		nr)
+{
+	char			*buf;
+	uint64_t		start;
+	unsigned int		i;
+
+	buf = kmem_alloc(PAGE_SIZE, KM_MAYFAIL);
+	if (!buf)
+		return -ENOMEM;
+	prandom_bytes(buf, PAGE_SIZE);
+
+	/* a CRC per op costs a lot more than the other benchmarks */
+	nr = max(nr / 16, 1U);
+	start = ktime_get_ns();
+	for (i = 0; i < nr; i++) {
+		xfs_update_cksum(buf, PAGE_SIZE, 8);
+		if (!(i & 1023))
+			cond_resched();
+	}
+	xfs_bench_record(XFS_BENCH_CKSUM, nr, start);
+
+	kmem_free(buf);
+	return 0;
+}
+
+int
+xfs_bench_run(
+	unsigned int		nr_ops)
+{
+	int			error;
+
+	if (nr_ops == 0 || nr_ops > XFS_BENCH_MAX_OPS)
+		return -EINVAL;
+
+	mutex_lock(&xfs_bench_lock);
+	memset(xfs_bench_results, 0, sizeof(xfs_bench_results));
+	error = xfs_bench_iext(nr_ops);
+	if (!error)
+		error = xfs_bench_hashname(nr_ops);
+	if (!error)
+		error = xfs_bench_cksum(nr_ops);
+	mutex_unlock(&xfs_bench_lock);
+	return error;
+}
+
+int
+xfs_bench_format(
+	char			*buf,
+	size_t			len)
+{
+	struct xfs_bench_result	*res;
+	int			i;
+	int			ret = 0;
+
+	mutex_lock(&xfs_bench_lock);
+	for (i = 0; i < XFS_BENCH_MAX; i++) {
+		res = &xfs_bench_results[i];
+		if (!res->ops)
+			continue;
+		ret += snprintf(buf + ret, len - ret, "%s %u %llu\n",
+				xfs_bench_names[i], res->ops,
+				div_u64(res->ns, res->ops));
+	}
+	mutex_unlock(&xfs_bench_lock);
+	return ret;
+}
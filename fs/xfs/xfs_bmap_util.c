@@ -45,6 +45,7 @@
 #include "xfs_iomap.h"
 #include "xfs_reflink.h"
 #include "xfs_refcount.h"
+#include "xfs_swapext.h"
 
 /* Kernel only BMAP related definitions and functions */
 
@@ -77,11 +78,15 @@ xfs_zero_extent(
 	struct xfs_mount *mp = ip->i_mount;
 	xfs_daddr_t	sector = xfs_fsb_to_db(ip, start_fsb);
 	sector_t	block = XFS_BB_TO_FSBT(mp, sector);
+	int		error;
 
-	return blkdev_issue_zeroout(xfs_find_bdev_for_inode(VFS_I(ip)),
+	error = blkdev_issue_zeroout(xfs_find_bdev_for_inode(VFS_I(ip)),
 		block << (mp->m_super->s_blocksize_bits - 9),
 		count_fsb << (mp->m_super->s_blocksize_bits - 9),
 		GFP_NOFS, 0);
+	xfs_buftarg_write_done(XFS_IS_REALTIME_INODE(ip) ?
+			mp->m_rtdev_targp : mp->m_ddev_targp);
+	return error;
 }
 
 int
@@ -94,6 +99,7 @@ xfs_bmap_rtalloc(
 	xfs_extlen_t	ralen = 0;	/* realtime allocation length */
 	xfs_extlen_t	align;		/* minimum allocation alignment */
 	xfs_rtblock_t	rtb;
+	bool		pick;		/* pick a start for a new file */
 
 	mp = ap->ip->i_mount;
 	align = xfs_get_extsz_hint(ap->ip);
@@ -126,6 +132,38 @@ xfs_bmap_rtalloc(
 	if (ralen * mp->m_sb.sb_rextsize >= MAXEXTLEN)
 		ralen = MAXEXTLEN / mp->m_sb.sb_rextsize;
 
+	/*
+	 * Searching the rt bitmap is the expensive part of the allocation, so
+	 * do it with the bitmap and summary inodes only locked shared, which
+	 * lets concurrent allocators search in parallel.  Then lock them
+	 * exclusively and allocate starting at the extent we found, which is
+	 * a quick exact allocation unless somebody else took it in the
+	 * meantime.  Picking a start for a new file updates the bitmap inode,
+	 * so that case is done entirely under the exclusive locks.
+	 *
+	 * On a zoned rt device the allocator always appends at the current
+	 * zone's write pointer, so there is nothing to search for or pick.
+	 */
+	pick = ap->eof && ap->offset == 0 && !mp->m_rtzones;
+	if (!pick && !mp->m_rtzones) {
+		xfs_extlen_t	foundlen;
+
+		ap->blkno = 0;
+		xfs_bmap_adjacent(ap);
+		do_div(ap->blkno, mp->m_sb.sb_rextsize);
+
+		xfs_ilock(mp->m_rbmip, XFS_ILOCK_SHARED|XFS_ILOCK_RTBITMAP);
+		xfs_ilock(mp->m_rsumip, XFS_ILOCK_SHARED|XFS_ILOCK_RTSUM);
+		error = xfs_rtfind_extent(mp, ap->blkno, 1, ralen, &foundlen,
+				prod, &rtb);
+		xfs_iunlock(mp->m_rsumip, XFS_ILOCK_SHARED);
+		xfs_iunlock(mp->m_rbmip, XFS_ILOCK_SHARED);
+		if (error)
+			return error;
+		if (rtb != NULLRTBLOCK)
+			ap->blkno = rtb;
+	}
+
 	/*
 	 * Lock out modifications to both the RT bitmap and summary inodes
 	 */
@@ -138,23 +176,20 @@ xfs_bmap_rtalloc(
 	 * If it's an allocation to an empty file at offset 0,
 	 * pick an extent that will space things out in the rt area.
 	 */
-	if (ap->eof && ap->offset == 0) {
+	if (pick) {
 		xfs_rtblock_t uninitialized_var(rtx); /* realtime extent no */
 
 		error = xfs_rtpick_extent(mp, ap->tp, ralen, &rtx);
 		if (error)
 			return error;
 		ap->blkno = rtx * mp->m_sb.sb_rextsize;
-	} else {
-		ap->blkno = 0;
+		xfs_bmap_adjacent(ap);
+		do_div(ap->blkno, mp->m_sb.sb_rextsize);
 	}
 
-	xfs_bmap_adjacent(ap);
-
 	/*
 	 * Realtime allocation, done through xfs_rtallocate_extent.
 	 */
-	do_div(ap->blkno, mp->m_sb.sb_rextsize);
 	rtb = ap->blkno;
 	ap->length = ralen;
 	error = xfs_rtallocate_extent(ap->tp, ap->blkno, 1, ap->length,
@@ -525,12 +560,42 @@ xfs_getbmap_adjust_shared(
 	return 0;
 }
 
+STATIC uint
+xfs_getbmap_ilock(
+	struct xfs_inode	*ip,
+	int			whichfork)
+{
+	uint			lock;
+
+	switch (whichfork) {
+	case XFS_COW_FORK:
+		lock = XFS_ILOCK_SHARED;
+		xfs_ilock(ip, lock);
+		break;
+	case XFS_ATTR_FORK:
+		lock = xfs_ilock_attr_map_shared(ip);
+		break;
+	default:
+		lock = xfs_ilock_data_map_shared(ip);
+		break;
+	}
+	return lock;
+}
+
 /*
  * Get inode's extents as described in bmv, and format for output.
  * Calls formatter to fill the user's buffer until all extents
  * are mapped, until the passed-in bmv->bmv_count slots have
  * been filled, or until the formatter short-circuits the loop,
  * if it is tracking filled-in extents on its own.
+ *
+ * With BMV_IF_CHUNKED the iolock isn't held at all and the ilock is dropped
+ * after every chunk of mappings, so that a scan of a file with a huge extent
+ * list doesn't hold off writers for the whole walk.  Each chunk is looked up
+ * again from the offset reached so far; if the fork's sequence count shows
+ * that the extent list changed while unlocked, the first mapping of the new
+ * chunk is flagged BMV_OF_CHANGED.  If the fork went away or stopped being
+ * mapped by extents meanwhile, the walk ends early.
  */
 int						/* error code */
 xfs_getbmap(
@@ -557,9 +622,14 @@ xfs_getbmap(
 	int			bmapi_flags;	/* flags for xfs_bmapi */
 	int			cur_ext = 0;
 	struct xfs_bmbt_irec	inject_map;
+	struct xfs_ifork	*ifp;
+	unsigned int		seq;
+	int			oflags;
+	bool			chunked;
 
 	mp = ip->i_mount;
 	iflags = bmv->bmv_iflags;
+	chunked = (iflags & BMV_IF_CHUNKED);
 
 #ifndef DEBUG
 	/* Only allow CoW fork queries if we're debugging. */
@@ -650,35 +720,25 @@ xfs_getbmap(
 	if (!out)
 		return -ENOMEM;
 
-	xfs_ilock(ip, XFS_IOLOCK_SHARED);
-	switch (whichfork) {
-	case XFS_DATA_FORK:
-		if (!(iflags & BMV_IF_DELALLOC) &&
-		    (ip->i_delayed_blks || XFS_ISIZE(ip) > ip->i_d.di_size)) {
-			error = filemap_write_and_wait(VFS_I(ip)->i_mapping);
-			if (error)
-				goto out_unlock_iolock;
-
-			/*
-			 * Even after flushing the inode, there can still be
-			 * delalloc blocks on the inode beyond EOF due to
-			 * speculative preallocation.  These are not removed
-			 * until the release function is called or the inode
-			 * is inactivated.  Hence we cannot assert here that
-			 * ip->i_delayed_blks == 0.
-			 */
-		}
+	if (!chunked)
+		xfs_ilock(ip, XFS_IOLOCK_SHARED);
+	if (whichfork == XFS_DATA_FORK && !(iflags & BMV_IF_DELALLOC) &&
+	    (ip->i_delayed_blks || XFS_ISIZE(ip) > ip->i_d.di_size)) {
+		error = filemap_write_and_wait(VFS_I(ip)->i_mapping);
+		if (error)
+			goto out_unlock_iolock;
 
-		lock = xfs_ilock_data_map_shared(ip);
-		break;
-	case XFS_COW_FORK:
-		lock = XFS_ILOCK_SHARED;
-		xfs_ilock(ip, lock);
-		break;
-	case XFS_ATTR_FORK:
-		lock = xfs_ilock_attr_map_shared(ip);
-		break;
+		/*
+		 * Even after flushing the inode, there can still be
+		 * delalloc blocks on the inode beyond EOF due to
+		 * speculative preallocation.  These are not removed
+		 * until the release function is called or the inode
+		 * is inactivated.  Hence we cannot assert here that
+		 * ip->i_delayed_blks == 0.
+		 */
 	}
+	lock = xfs_getbmap_ilock(ip, whichfork);
+	ifp = XFS_IFORK_PTR(ip, whichfork);
 
 	/*
 	 * Don't let nex be bigger than the number of extents
@@ -719,7 +779,7 @@ xfs_getbmap(
 
 		for (i = 0; i < nmap && bmv->bmv_length &&
 				cur_ext < bmv->bmv_count - 1; i++) {
-			out[cur_ext].bmv_oflags = 0;
+			out[cur_ext].bmv_oflags &= BMV_OF_CHANGED;
 			if (map[i].br_state == XFS_EXT_UNWRITTEN)
 				out[cur_ext].bmv_oflags |= BMV_OF_PREALLOC;
 			else if (map[i].br_startblock == DELAYSTARTBLOCK)
@@ -742,7 +802,8 @@ xfs_getbmap(
 			 */
 			if (map[i].br_startblock == DELAYSTARTBLOCK &&
 			    map[i].br_startoff < XFS_B_TO_FSB(mp, XFS_ISIZE(ip)))
-				ASSERT((iflags & BMV_IF_DELALLOC) != 0);
+				ASSERT((iflags & (BMV_IF_DELALLOC |
+						  BMV_IF_CHUNKED)) != 0);
 
                         if (map[i].br_startblock == HOLESTARTBLOCK &&
 			    whichfork == XFS_ATTR_FORK) {
@@ -776,7 +837,9 @@ xfs_getbmap(
 			 */
 			if ((iflags & BMV_IF_NO_HOLES) &&
 			    map[i].br_startblock == HOLESTARTBLOCK) {
+				oflags = out[cur_ext].bmv_oflags;
 				memset(&out[cur_ext], 0, sizeof(out[cur_ext]));
+				out[cur_ext].bmv_oflags = oflags & BMV_OF_CHANGED;
 				continue;
 			}
 
@@ -800,6 +863,32 @@ xfs_getbmap(
 			bmv->bmv_entries++;
 			cur_ext++;
 		}
+
+		if (chunked && nmap && bmv->bmv_length &&
+		    cur_ext < bmv->bmv_count - 1) {
+			seq = READ_ONCE(ifp->if_seq);
+			xfs_iunlock(ip, lock);
+			cond_resched();
+			lock = xfs_getbmap_ilock(ip, whichfork);
+
+			/*
+			 * The attr fork may have been removed or converted
+			 * back to local format while we weren't holding the
+			 * ilock, so look it up again and stop if there are no
+			 * extents left to map.
+			 */
+			ifp = XFS_IFORK_PTR(ip, whichfork);
+			if (!ifp ||
+			    (XFS_IFORK_FORMAT(ip, whichfork) !=
+					XFS_DINODE_FMT_EXTENTS &&
+			     XFS_IFORK_FORMAT(ip, whichfork) !=
+					XFS_DINODE_FMT_BTREE)) {
+				error = 0;
+				goto out_free_map;
+			}
+			if (ifp->if_seq != seq)
+				out[cur_ext].bmv_oflags = BMV_OF_CHANGED;
+		}
 	} while (nmap && bmv->bmv_length && cur_ext < bmv->bmv_count - 1);
 
  out_free_map:
@@ -807,7 +896,8 @@ xfs_getbmap(
  out_unlock_ilock:
 	xfs_iunlock(ip, lock);
  out_unlock_iolock:
-	xfs_iunlock(ip, XFS_IOLOCK_SHARED);
+	if (!chunked)
+		xfs_iunlock(ip, XFS_IOLOCK_SHARED);
 
 	for (i = 0; i < cur_ext; i++) {
 		/* format results & advance arg */
@@ -895,6 +985,115 @@ xfs_bmap_punch_delalloc_range(
 	return error;
 }
 
+/*
+ * Move the data of an inline regular file out of the inode literal area into
+ * a block of its own so that the file can be mapped like any other.  The new
+ * block is written synchronously before the transaction that points the data
+ * fork at it commits, so after a crash we find either the inline data or a
+ * fully written block.  Any cached pages already hold the same data.
+ */
+int
+xfs_inline_data_to_extents(
+	struct xfs_inode	*ip)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_ifork	*ifp = &ip->i_df;
+	struct xfs_trans	*tp;
+	struct xfs_defer_ops	dfops;
+	struct xfs_bmbt_irec	imap;
+	struct xfs_buf		*bp;
+	xfs_fsblock_t		firstfsb;
+	int			nimaps = 1;
+	uint			resblks;
+	int			size;
+	int			error;
+
+	if (!xfs_is_inline_data_inode(ip))
+		return 0;
+	ASSERT(!XFS_IS_REALTIME_INODE(ip));
+
+	error = xfs_qm_dqattach(ip, 0);
+	if (error)
+		return error;
+
+	resblks = XFS_DIOSTRAT_SPACE_RES(mp, 1);
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write, resblks, 0, 0, &tp);
+	if (error)
+		return error;
+
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	error = xfs_trans_reserve_quota_nblks(tp, ip, resblks, 0,
+			XFS_QMOPT_RES_REGBLKS);
+	if (error)
+		goto out_cancel;
+
+	/* Someone else may have converted the inode while we waited. */
+	if (!xfs_is_inline_data_inode(ip))
+		goto out_unreserve;
+
+	bp = xfs_buf_get_uncached(mp->m_ddev_targp, XFS_FSB_TO_BB(mp, 1), 0);
+	if (!bp) {
+		error = -ENOMEM;
+		goto out_unreserve;
+	}
+	size = ifp->if_bytes;
+	memcpy(bp->b_addr, ifp->if_u1.if_data, size);
+	memset(bp->b_addr + size, 0, BBTOB(bp->b_length) - size);
+
+	/* Turn the data fork into an empty extent list and map a block. */
+	xfs_trans_ijoin(tp, ip, 0);
+	xfs_idata_realloc(ip, -size, XFS_DATA_FORK);
+	ifp->if_flags &= ~XFS_IFINLINE;
+	ifp->if_flags |= XFS_IFEXTENTS;
+	ip->i_d.di_format = XFS_DINODE_FMT_EXTENTS;
+
+	xfs_defer_init(&dfops, &firstfsb);
+	error = xfs_bmapi_write(tp, ip, 0, 1, 0, &firstfsb, resblks, &imap,
+			&nimaps, &dfops);
+	if (!error && nimaps == 0)
+		error = -ENOSPC;
+	if (error) {
+		/*
+		 * If the allocation failed before changing anything we can
+		 * put the inline data back and cancel cleanly.
+		 */
+		if (!(tp->t_flags & XFS_TRANS_DIRTY)) {
+			ip->i_d.di_format = XFS_DINODE_FMT_LOCAL;
+			xfs_init_local_fork(ip, XFS_DATA_FORK, bp->b_addr,
+					size);
+		}
+		goto out_bmap_cancel;
+	}
+	ASSERT(imap.br_startoff == 0 && imap.br_blockcount == 1);
+	ASSERT(!isnullstartblock(imap.br_startblock));
+
+	error = xfs_defer_finish(&tp, &dfops, NULL);
+	if (error)
+		goto out_bmap_cancel;
+
+	XFS_BUF_SET_ADDR(bp, XFS_FSB_TO_DADDR(mp, imap.br_startblock));
+	error = xfs_bwrite(bp);
+	xfs_buf_relse(bp);
+	if (error)
+		goto out_cancel;
+
+	xfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+	error = xfs_trans_commit(tp);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return error;
+
+out_bmap_cancel:
+	xfs_buf_relse(bp);
+	xfs_defer_cancel(&dfops);
+out_unreserve:
+	xfs_trans_unreserve_quota_nblks(tp, ip, (long)resblks, 0,
+			XFS_QMOPT_RES_REGBLKS);
+out_cancel:
+	xfs_trans_cancel(tp);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return error;
+}
+
 /*
  * Test whether it is appropriate to check an inode for and free post EOF
  * blocks. The 'force' parameter determines whether we should also consider
@@ -904,7 +1103,7 @@ bool
 xfs_can_free_eofblocks(struct xfs_inode *ip, bool force)
 {
 	/* prealloc/delalloc exists only on regular files */
-	if (!S_ISREG(VFS_I(ip)->i_mode))
+	if (!S_ISREG(VFS_I(ip)->i_mode) || xfs_is_inline_data_inode(ip))
 		return false;
 
 	/*
@@ -1016,6 +1215,116 @@ xfs_free_eofblocks(
 	return error;
 }
 
+/*
+ * Number of extents' worth of bmbt split space reserved up front by the bulk
+ * preallocation path, and the largest data reservation it makes at once.
+ */
+#define XFS_BULK_ALLOC_EXTENTS	64
+#define XFS_BULK_ALLOC_MAXLEN	((xfs_filblks_t)MAXEXTLEN * 256)
+
+/*
+ * Preallocate [*startoffset_fsb, *startoffset_fsb + *allocatesize_fsb) for a
+ * regular (non-realtime) file.  Rather than a new transaction, block and quota
+ * reservation and ILOCK cycle for every extent, reserve space for the whole
+ * range up front and allocate one extent per xfs_bmapi_write call in a single
+ * permanent transaction that is rolled, regranting the log reservation,
+ * between calls.  The unused block and quota reservation moves to the new
+ * transaction on every roll.  We only commit and reserve again when the
+ * remaining reservation can no longer cover a worst case bmbt split.
+ *
+ * On return the range has been advanced past whatever was allocated.  Returns
+ * -ENOSPC or -EDQUOT if the reservation for the range can't be made.
+ */
+STATIC int
+xfs_alloc_file_space_bulk(
+	struct xfs_inode	*ip,
+	xfs_fileoff_t		*startoffset_fsb,
+	xfs_filblks_t		*allocatesize_fsb,
+	xfs_extlen_t		extsz,
+	int			alloc_type)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_trans	*tp;
+	struct xfs_defer_ops	dfops;
+	struct xfs_bmbt_irec	imap;
+	xfs_fsblock_t		firstfsb;
+	xfs_filblks_t		datablks, len;
+	uint			ovhd = XFS_EXTENTADD_SPACE_RES(mp, XFS_DATA_FORK);
+	uint			resblks, left;
+	int			nimaps;
+	int			error;
+
+next_trans:
+	/* leave room for extent size hint alignment at both ends */
+	datablks = min_t(xfs_filblks_t, *allocatesize_fsb + 2 * extsz,
+			 XFS_BULK_ALLOC_MAXLEN);
+	resblks = datablks + ovhd * min_t(xfs_filblks_t, datablks,
+					  XFS_BULK_ALLOC_EXTENTS);
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write, resblks, 0, 0, &tp);
+	if (error)
+		return error;
+
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	error = xfs_trans_reserve_quota_nblks(tp, ip, resblks, 0,
+			XFS_QMOPT_RES_REGBLKS);
+	if (error)
+		goto out_trans_cancel;
+
+	xfs_trans_ijoin(tp, ip, 0);
+
+	while (*allocatesize_fsb) {
+		left = tp->t_blk_res - tp->t_blk_res_used;
+		if (left <= ovhd + 2 * extsz) {
+			error = xfs_trans_commit(tp);
+			xfs_iunlock(ip, XFS_ILOCK_EXCL);
+			if (error)
+				return error;
+			goto next_trans;
+		}
+		len = min_t(xfs_filblks_t, *allocatesize_fsb,
+			    left - ovhd - 2 * extsz);
+
+		nimaps = 1;
+		xfs_defer_init(&dfops, &firstfsb);
+		error = xfs_bmapi_write(tp, ip, *startoffset_fsb, len,
+				alloc_type, &firstfsb, left, &imap, &nimaps,
+				&dfops);
+		if (error)
+			goto out_bmap_cancel;
+
+		error = xfs_defer_finish(&tp, &dfops, ip);
+		if (error)
+			goto out_bmap_cancel;
+
+		if (nimaps == 0) {
+			/* keep whatever we managed to allocate */
+			error = xfs_trans_commit(tp);
+			xfs_iunlock(ip, XFS_ILOCK_EXCL);
+			return error ? error : -ENOSPC;
+		}
+		*startoffset_fsb += imap.br_blockcount;
+		*allocatesize_fsb -= min_t(xfs_filblks_t, *allocatesize_fsb,
+					   imap.br_blockcount);
+		if (!*allocatesize_fsb)
+			break;
+
+		error = xfs_trans_roll(&tp, ip);
+		if (error)
+			goto out_trans_cancel;
+	}
+
+	error = xfs_trans_commit(tp);
+out_unlock:
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return error;
+
+out_bmap_cancel:
+	xfs_defer_cancel(&dfops);
+out_trans_cancel:
+	xfs_trans_cancel(tp);
+	goto out_unlock;
+}
+
 int
 xfs_alloc_file_space(
 	struct xfs_inode	*ip,
@@ -1060,6 +1369,19 @@ xfs_alloc_file_space(
 	startoffset_fsb	= XFS_B_TO_FSBT(mp, offset);
 	allocatesize_fsb = XFS_B_TO_FSB(mp, count);
 
+	/*
+	 * Try to reserve and allocate the whole range in one transaction
+	 * chain.  If the full reservation can't be made, fall back to
+	 * allocating an extent at a time until we really run out of space.
+	 */
+	if (!rt) {
+		error = xfs_alloc_file_space_bulk(ip, &startoffset_fsb,
+				&allocatesize_fsb, extsz, alloc_type);
+		if (error != -ENOSPC && error != -EDQUOT)
+			return error;
+		error = 0;
+	}
+
 	/*
 	 * Allocate file space until done or until there is an error
 	 */
@@ -1168,20 +1490,30 @@ xfs_alloc_file_space(
 	return error;
 }
 
+/*
+ * Unmap the file range [startoffset_fsb, startoffset_fsb + len_fsb).  Rather
+ * than paying for a fresh transaction, quota reservation and ILOCK cycle for
+ * every couple of extents, keep the inode joined to a single permanent
+ * transaction and roll it between xfs_bunmapi calls the same way
+ * xfs_itruncate_extents does.  We only commit and start over once a bmbt
+ * split has eaten into the block reservation so that each bunmapi call still
+ * has a full worst case reservation behind it.
+ */
 static int
-xfs_unmap_extent(
+xfs_unmap_range(
 	struct xfs_inode	*ip,
 	xfs_fileoff_t		startoffset_fsb,
-	xfs_filblks_t		len_fsb,
-	int			*done)
+	xfs_filblks_t		len_fsb)
 {
 	struct xfs_mount	*mp = ip->i_mount;
 	struct xfs_trans	*tp;
 	struct xfs_defer_ops	dfops;
 	xfs_fsblock_t		firstfsb;
 	uint			resblks = XFS_DIOSTRAT_SPACE_RES(mp, 0);
+	int			done = 0;
 	int			error;
 
+next_trans:
 	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write, resblks, 0, 0, &tp);
 	if (error) {
 		ASSERT(error == -ENOSPC || XFS_FORCED_SHUTDOWN(mp));
@@ -1196,15 +1528,32 @@ xfs_unmap_extent(
 
 	xfs_trans_ijoin(tp, ip, 0);
 
-	xfs_defer_init(&dfops, &firstfsb);
-	error = xfs_bunmapi(tp, ip, startoffset_fsb, len_fsb, 0, 2, &firstfsb,
-			&dfops, done);
-	if (error)
-		goto out_bmap_cancel;
+	while (!done) {
+		xfs_defer_init(&dfops, &firstfsb);
+		error = xfs_bunmapi(tp, ip, startoffset_fsb, len_fsb, 0, 2,
+				&firstfsb, &dfops, &done);
+		if (error)
+			goto out_bmap_cancel;
 
-	error = xfs_defer_finish(&tp, &dfops, ip);
-	if (error)
-		goto out_bmap_cancel;
+		error = xfs_defer_finish(&tp, &dfops, ip);
+		if (error)
+			goto out_bmap_cancel;
+
+		if (done)
+			break;
+
+		if (tp->t_blk_res - tp->t_blk_res_used < resblks) {
+			error = xfs_trans_commit(tp);
+			xfs_iunlock(ip, XFS_ILOCK_EXCL);
+			if (error)
+				return error;
+			goto next_trans;
+		}
+
+		error = xfs_trans_roll(&tp, ip);
+		if (error)
+			goto out_trans_cancel;
+	}
 
 	error = xfs_trans_commit(tp);
 out_unlock:
@@ -1290,7 +1639,7 @@ xfs_free_file_space(
 	struct xfs_mount	*mp = ip->i_mount;
 	xfs_fileoff_t		startoffset_fsb;
 	xfs_fileoff_t		endoffset_fsb;
-	int			done = 0, error;
+	int			error;
 
 	trace_xfs_free_file_space(ip);
 
@@ -1323,12 +1672,10 @@ xfs_free_file_space(
 	}
 
 	if (endoffset_fsb > startoffset_fsb) {
-		while (!done) {
-			error = xfs_unmap_extent(ip, startoffset_fsb,
-					endoffset_fsb - startoffset_fsb, &done);
-			if (error)
-				return error;
-		}
+		error = xfs_unmap_range(ip, startoffset_fsb,
+				endoffset_fsb - startoffset_fsb);
+		if (error)
+			return error;
 	}
 
 	/*
@@ -1412,9 +1759,15 @@ xfs_shift_file_space(
 	xfs_fileoff_t		next_fsb;
 	xfs_fileoff_t		shift_fsb;
 	uint			resblks;
+	int			batch;
 
 	ASSERT(direction == SHIFT_LEFT || direction == SHIFT_RIGHT);
 
+	if (xfs_sb_version_hasrmapbt(&mp->m_sb))
+		batch = XFS_BMAP_MAX_SHIFT_RMAP;
+	else
+		batch = XFS_BMAP_MAX_SHIFT_BATCH;
+
 	if (direction == SHIFT_LEFT) {
 		/*
 		 * Reserve blocks to cover potential extent merges after left
@@ -1487,12 +1840,13 @@ xfs_shift_file_space(
 		xfs_defer_init(&dfops, &first_block);
 
 		/*
-		 * We are using the write transaction in which max 2 bmbt
-		 * updates are allowed
+		 * The write transaction covers logging one bmbt path, so
+		 * xfs_bmap_shift_extents stops each batch at a leaf boundary
+		 * or after a merge.
 		 */
 		error = xfs_bmap_shift_extents(tp, ip, &next_fsb, shift_fsb,
 				&done, stop_fsb, &first_block, &dfops,
-				direction, XFS_BMAP_MAX_SHIFT_EXTENTS);
+				direction, batch);
 		if (error)
 			goto out_bmap_cancel;
 
@@ -1589,7 +1943,8 @@ xfs_insert_file_space(
 static int
 xfs_swap_extents_check_format(
 	struct xfs_inode	*ip,	/* target inode */
-	struct xfs_inode	*tip)	/* tmp inode */
+	struct xfs_inode	*tip,	/* tmp inode */
+	bool			rtmove)
 {
 
 	/* Should never get a local format */
@@ -1599,9 +1954,10 @@ xfs_swap_extents_check_format(
 
 	/*
 	 * if the target inode has less extents that then temporary inode then
-	 * why did userspace call us?
+	 * why did userspace call us?  Moving the file to another device is a
+	 * good reason, so let that through.
 	 */
-	if (ip->i_d.di_nextents < tip->i_d.di_nextents)
+	if (!rtmove && ip->i_d.di_nextents < tip->i_d.di_nextents)
 		return -EINVAL;
 
 	/*
@@ -1663,6 +2019,47 @@ xfs_swap_extents_check_format(
 	return 0;
 }
 
+/*
+ * Check that we can move the data of a file between the data and realtime
+ * devices by swapping it with a temporary file on the other device.  The
+ * realtime flag moves along with the data fork, so the inode that ends up
+ * with the realtime extents is the one flagged realtime, and the quota
+ * usage moves from one block counter to the other with it.
+ *
+ * Which files to move is decided from the per-inode I/O heat the kernel
+ * tracks with the ioheat mount option and reports through
+ * XFS_IOC_GET_HOT_INODES.  The data copy into the temporary file is left to
+ * userspace, which can pace it, and the usual ctime/mtime check makes the
+ * switch over atomic with respect to writers.
+ */
+static int
+xfs_swap_extents_check_rtmove(
+	struct xfs_inode	*ip,
+	struct xfs_inode	*tip,
+	struct xfs_swapext	*sxp)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_inode	*dip;	/* the inode that will become realtime */
+
+	if (sxp->sx_version != XFS_SX_VERSION_RTMOVE)
+		return -EINVAL;
+	if (!S_ISREG(VFS_I(ip)->i_mode))
+		return -EINVAL;
+
+	/* rmap and reflink don't know about realtime extents yet. */
+	if (xfs_sb_version_hasrmapbt(&mp->m_sb))
+		return -EOPNOTSUPP;
+	if (IS_DAX(VFS_I(ip)) || IS_DAX(VFS_I(tip)))
+		return -EOPNOTSUPP;
+
+	/* An extent size hint has to be valid on the realtime device. */
+	dip = XFS_IS_REALTIME_INODE(ip) ? tip : ip;
+	if ((dip->i_d.di_flags & XFS_DIFLAG_EXTSIZE) &&
+	    dip->i_d.di_extsize % mp->m_sb.sb_rextsize)
+		return -EINVAL;
+	return 0;
+}
+
 static int
 xfs_swap_extent_flush(
 	struct xfs_inode	*ip)
@@ -1681,7 +2078,9 @@ xfs_swap_extent_flush(
 }
 
 /*
- * Move extents from one file to another, when rmap is enabled.
+ * Move extents from one file to another, when rmap is enabled.  The whole
+ * exchange is driven by a single extent swap intent, so if we crash part way
+ * through, log recovery finishes the job.
  */
 STATIC int
 xfs_swap_extent_rmap(
@@ -1689,108 +2088,36 @@ xfs_swap_extent_rmap(
 	struct xfs_inode		*ip,
 	struct xfs_inode		*tip)
 {
-	struct xfs_bmbt_irec		irec;
-	struct xfs_bmbt_irec		uirec;
-	struct xfs_bmbt_irec		tirec;
-	xfs_fileoff_t			offset_fsb;
-	xfs_fileoff_t			end_fsb;
+	struct xfs_mount		*mp = ip->i_mount;
 	xfs_filblks_t			count_fsb;
 	xfs_fsblock_t			firstfsb;
 	struct xfs_defer_ops		dfops;
 	int				error;
-	xfs_filblks_t			ilen;
-	xfs_filblks_t			rlen;
-	int				nimaps;
 	uint64_t			tip_flags2;
 
 	/*
 	 * If the source file has shared blocks, we must flag the donor
 	 * file as having shared blocks so that we get the shared-block
-	 * rmap functions when we go to fix up the rmaps.  The flags
-	 * will be switch for reals later.
+	 * rmap functions when we go to fix up the rmaps.  Log the flag,
+	 * because log recovery might have to finish the swap; the flags
+	 * will be switched for reals later.
 	 */
 	tip_flags2 = tip->i_d.di_flags2;
-	if (ip->i_d.di_flags2 & XFS_DIFLAG2_REFLINK)
+	if (ip->i_d.di_flags2 & XFS_DIFLAG2_REFLINK) {
 		tip->i_d.di_flags2 |= XFS_DIFLAG2_REFLINK;
+		xfs_trans_log_inode(*tpp, tip, XFS_ILOG_CORE);
+	}
 
-	offset_fsb = 0;
-	end_fsb = XFS_B_TO_FSB(ip->i_mount, i_size_read(VFS_I(ip)));
-	count_fsb = (xfs_filblks_t)(end_fsb - offset_fsb);
-
-	while (count_fsb) {
-		/* Read extent from the donor file */
-		nimaps = 1;
-		error = xfs_bmapi_read(tip, offset_fsb, count_fsb, &tirec,
-				&nimaps, 0);
+	count_fsb = XFS_B_TO_FSB(mp, i_size_read(VFS_I(ip)));
+	if (count_fsb) {
+		xfs_defer_init(&dfops, &firstfsb);
+		error = xfs_swapext_schedule(mp, &dfops, ip, tip, 0, 0,
+				count_fsb);
 		if (error)
-			goto out;
-		ASSERT(nimaps == 1);
-		ASSERT(tirec.br_startblock != DELAYSTARTBLOCK);
-
-		trace_xfs_swap_extent_rmap_remap(tip, &tirec);
-		ilen = tirec.br_blockcount;
-
-		/* Unmap the old blocks in the source file. */
-		while (tirec.br_blockcount) {
-			xfs_defer_init(&dfops, &firstfsb);
-			trace_xfs_swap_extent_rmap_remap_piece(tip, &tirec);
-
-			/* Read extent from the source file */
-			nimaps = 1;
-			error = xfs_bmapi_read(ip, tirec.br_startoff,
-					tirec.br_blockcount, &irec,
-					&nimaps, 0);
-			if (error)
-				goto out_defer;
-			ASSERT(nimaps == 1);
-			ASSERT(tirec.br_startoff == irec.br_startoff);
-			trace_xfs_swap_extent_rmap_remap_piece(ip, &irec);
-
-			/* Trim the extent. */
-			uirec = tirec;
-			uirec.br_blockcount = rlen = min_t(xfs_filblks_t,
-					tirec.br_blockcount,
-					irec.br_blockcount);
-			trace_xfs_swap_extent_rmap_remap_piece(tip, &uirec);
-
-			/* Remove the mapping from the donor file. */
-			error = xfs_bmap_unmap_extent((*tpp)->t_mountp, &dfops,
-					tip, &uirec);
-			if (error)
-				goto out_defer;
-
-			/* Remove the mapping from the source file. */
-			error = xfs_bmap_unmap_extent((*tpp)->t_mountp, &dfops,
-					ip, &irec);
-			if (error)
-				goto out_defer;
-
-			/* Map the donor file's blocks into the source file. */
-			error = xfs_bmap_map_extent((*tpp)->t_mountp, &dfops,
-					ip, &uirec);
-			if (error)
-				goto out_defer;
-
-			/* Map the source file's blocks into the donor file. */
-			error = xfs_bmap_map_extent((*tpp)->t_mountp, &dfops,
-					tip, &irec);
-			if (error)
-				goto out_defer;
-
-			error = xfs_defer_finish(tpp, &dfops, ip);
-			if (error)
-				goto out_defer;
-
-			tirec.br_startoff += rlen;
-			if (tirec.br_startblock != HOLESTARTBLOCK &&
-			    tirec.br_startblock != DELAYSTARTBLOCK)
-				tirec.br_startblock += rlen;
-			tirec.br_blockcount -= rlen;
-		}
-
-		/* Roll on... */
-		count_fsb -= ilen;
-		offset_fsb += ilen;
+			goto out_defer;
+		error = xfs_defer_finish(tpp, &dfops, NULL);
+		if (error)
+			goto out_defer;
 	}
 
 	tip->i_d.di_flags2 = tip_flags2;
@@ -1798,12 +2125,47 @@ xfs_swap_extent_rmap(
 
 out_defer:
 	xfs_defer_cancel(&dfops);
-out:
 	trace_xfs_swap_extent_rmap_error(ip, error, _RET_IP_);
 	tip->i_d.di_flags2 = tip_flags2;
 	return error;
 }
 
+/*
+ * Move the quota usage of @from's data fork blocks to @to, which is about to
+ * take over the fork.  File data on the realtime device is counted apart from
+ * everything else, so when moving a file between devices the data moves from
+ * one counter to the other; the bmbt blocks always live on the data device.
+ */
+STATIC int
+xfs_swap_extent_fork_quota(
+	struct xfs_trans	*tp,
+	struct xfs_inode	*from,
+	struct xfs_inode	*to,
+	xfs_filblks_t		forkblks)
+{
+	xfs_extnum_t		junk = 0;
+	xfs_filblks_t		rtblks = 0;
+	int			error;
+
+	if (XFS_IS_REALTIME_INODE(from)) {
+		if (!(from->i_df.if_flags & XFS_IFEXTENTS)) {
+			error = xfs_iread_extents(tp, from, XFS_DATA_FORK);
+			if (error)
+				return error;
+		}
+		xfs_bmap_count_leaves(&from->i_df, &junk, &rtblks);
+		xfs_trans_mod_dquot_byino(tp, from, XFS_TRANS_DQ_RTBCOUNT,
+				-(long)rtblks);
+		xfs_trans_mod_dquot_byino(tp, to, XFS_TRANS_DQ_RTBCOUNT,
+				rtblks);
+		forkblks -= rtblks;
+	}
+	xfs_trans_mod_dquot_byino(tp, from, XFS_TRANS_DQ_BCOUNT,
+			-(long)forkblks);
+	xfs_trans_mod_dquot_byino(tp, to, XFS_TRANS_DQ_BCOUNT, forkblks);
+	return 0;
+}
+
 /* Swap the extents of two files by swapping data forks. */
 STATIC int
 xfs_swap_extent_forks(
@@ -1814,10 +2176,10 @@ xfs_swap_extent_forks(
 	int			*target_log_flags)
 {
 	struct xfs_ifork	tempifp, *ifp, *tifp;
+	struct xfs_inode_io	*io, *tio;
 	xfs_filblks_t		aforkblks = 0;
 	xfs_filblks_t		taforkblks = 0;
 	xfs_extnum_t		junk;
-	xfs_extnum_t		nextents;
 	uint64_t		tmp;
 	int			error;
 
@@ -1839,6 +2201,20 @@ xfs_swap_extent_forks(
 			return error;
 	}
 
+	/*
+	 * The quota usage of the data fork blocks goes wherever the blocks go,
+	 * which matters when the files have different owners or live on
+	 * different devices.
+	 */
+	error = xfs_swap_extent_fork_quota(tp, ip, tip,
+			ip->i_d.di_nblocks - aforkblks);
+	if (error)
+		return error;
+	error = xfs_swap_extent_fork_quota(tp, tip, ip,
+			tip->i_d.di_nblocks - taforkblks);
+	if (error)
+		return error;
+
 	/*
 	 * Before we've swapped the forks, lets set the owners of the forks
 	 * appropriately. We have to do this as we are demand paging the btree
@@ -1873,6 +2249,14 @@ xfs_swap_extent_forks(
 	*ifp = *tifp;		/* struct copy */
 	*tifp = tempifp;	/* struct copy */
 
+	/*
+	 * Move both fork sequence numbers past either old value so that
+	 * neither inode can mistake the other's extents for its own.
+	 */
+	ifp->if_seq = tifp->if_seq = max(ifp->if_seq, tifp->if_seq);
+	xfs_iext_bump_seq(ifp);
+	xfs_iext_bump_seq(tifp);
+
 	/*
 	 * Fix the on-disk inode values
 	 */
@@ -1900,16 +2284,15 @@ xfs_swap_extent_forks(
 	ASSERT(tip->i_delayed_blks == 0);
 	tip->i_delayed_blks = ip->i_delayed_blks;
 	ip->i_delayed_blks = 0;
+	if (ip->i_io || tip->i_io) {
+		io = xfs_inode_io_get(ip);
+		tio = xfs_inode_io_get(tip);
+		swap(tio->iio_indlen_levels, io->iio_indlen_levels);
+		swap(tio->iio_indlen_pool, io->iio_indlen_pool);
+	}
 
 	switch (ip->i_d.di_format) {
 	case XFS_DINODE_FMT_EXTENTS:
-		/*
-		 * If the extents fit in the inode, fix the pointer.  Otherwise
-		 * it's already NULL or pointing to the extent.
-		 */
-		nextents = xfs_iext_count(&ip->i_df);
-		if (nextents <= XFS_INLINE_EXTS)
-			ifp->if_u1.if_extents = ifp->if_u2.if_inline_ext;
 		(*src_log_flags) |= XFS_ILOG_DEXT;
 		break;
 	case XFS_DINODE_FMT_BTREE:
@@ -1921,13 +2304,6 @@ xfs_swap_extent_forks(
 
 	switch (tip->i_d.di_format) {
 	case XFS_DINODE_FMT_EXTENTS:
-		/*
-		 * If the extents fit in the inode, fix the pointer.  Otherwise
-		 * it's already NULL or pointing to the extent.
-		 */
-		nextents = xfs_iext_count(&tip->i_df);
-		if (nextents <= XFS_INLINE_EXTS)
-			tifp->if_u1.if_extents = tifp->if_u2.if_inline_ext;
 		(*target_log_flags) |= XFS_ILOG_DEXT;
 		break;
 	case XFS_DINODE_FMT_BTREE:
@@ -1955,6 +2331,7 @@ xfs_swap_extents(
 	struct xfs_ifork	*cowfp;
 	uint64_t		f;
 	int			resblks;
+	bool			rtmove;
 
 	/*
 	 * Lock the inodes against other IO, page faults and truncate to
@@ -1972,10 +2349,19 @@ xfs_swap_extents(
 		goto out_unlock;
 	}
 
-	/* Verify both files are either real-time or non-realtime */
-	if (XFS_IS_REALTIME_INODE(ip) != XFS_IS_REALTIME_INODE(tip)) {
-		error = -EINVAL;
-		goto out_unlock;
+	/*
+	 * Verify both files are either real-time or non-realtime, unless the
+	 * caller wants to move the data to the other device.
+	 */
+	rtmove = XFS_IS_REALTIME_INODE(ip) != XFS_IS_REALTIME_INODE(tip);
+	if (rtmove) {
+		error = xfs_swap_extents_check_rtmove(ip, tip, sxp);
+		if (error)
+			goto out_unlock;
+
+		/* Direct I/O already in flight has mapped the old device. */
+		inode_dio_wait(VFS_I(ip));
+		inode_dio_wait(VFS_I(tip));
 	}
 
 	error = xfs_swap_extent_flush(ip);
@@ -1985,12 +2371,25 @@ xfs_swap_extents(
 	if (error)
 		goto out_unlock;
 
+	/* Quota usage moves with the blocks, so we need both inodes' dquots. */
+	error = xfs_qm_dqattach(ip, 0);
+	if (error)
+		goto out_unlock;
+	error = xfs_qm_dqattach(tip, 0);
+	if (error)
+		goto out_unlock;
+
 	/*
 	 * Extent "swapping" with rmap requires a permanent reservation and
 	 * a block reservation because it's really just a remap operation
 	 * performed with log redo items!
 	 */
 	if (xfs_sb_version_hasrmapbt(&mp->m_sb)) {
+		error = xfs_add_incompat_log_feature(mp,
+				XFS_SB_FEAT_INCOMPAT_LOG_SWAPEXT);
+		if (error)
+			goto out_unlock;
+
 		/*
 		 * Conceptually this shouldn't affect the shape of either
 		 * bmbt, but since we atomically move extents one by one,
@@ -2032,7 +2431,7 @@ xfs_swap_extents(
 	trace_xfs_swap_extent_before(tip, 1);
 
 	/* check inode formats now that data is flushed */
-	error = xfs_swap_extents_check_format(ip, tip);
+	error = xfs_swap_extents_check_format(ip, tip, rtmove);
 	if (error) {
 		xfs_notice(mp,
 		    "%s: inode 0x%llx format is incompatible for exchanging.",
@@ -2088,6 +2487,12 @@ xfs_swap_extents(
 		xfs_inode_set_cowblocks_tag(tip);
 	}
 
+	/* The realtime flag follows the data fork to the other inode. */
+	if (rtmove) {
+		ip->i_d.di_flags ^= XFS_DIFLAG_REALTIME;
+		tip->i_d.di_flags ^= XFS_DIFLAG_REALTIME;
+	}
+
 	xfs_trans_log_inode(tp, ip,  src_log_flags);
 	xfs_trans_log_inode(tp, tip, target_log_flags);
 
@@ -2113,3 +2518,232 @@ xfs_swap_extents(
 	xfs_trans_cancel(tp);
 	goto out_unlock;
 }
+
+/*
+ * Atomically exchange a range of blocks between two files.
+ *
+ * The exchange is logged as a single extent swap intent, so once the first
+ * transaction commits the whole range will be exchanged, even if we crash
+ * part way through.  This makes it usable for atomic file updates: write the
+ * new contents to a temporary file and exchange them into place.  With
+ * XFS_SWAP_RANGE_SET_SIZES the file sizes are exchanged in the same
+ * transaction that logs the intent.
+ */
+int
+xfs_swap_range(
+	struct xfs_inode	*ip1,
+	struct xfs_inode	*ip2,
+	struct xfs_swap_range	*sr)
+{
+	struct xfs_mount	*mp = ip1->i_mount;
+	struct inode		*inode1 = VFS_I(ip1);
+	struct inode		*inode2 = VFS_I(ip2);
+	struct xfs_trans	*tp;
+	struct xfs_defer_ops	dfops;
+	xfs_fsblock_t		firstfsb;
+	xfs_fileoff_t		startoff1;
+	xfs_fileoff_t		startoff2;
+	xfs_filblks_t		blockcount;
+	xfs_off_t		len;
+	xfs_fsize_t		size;
+	int			lock_flags;
+	int			resblks;
+	int			error;
+
+	if (sr->sr_flags & ~XFS_SWAP_RANGE_FLAGS)
+		return -EINVAL;
+	if (sr->sr_length == 0)
+		return 0;
+	if ((sr->sr_flags & XFS_SWAP_RANGE_SET_SIZES) &&
+	    (sr->sr_offset1 != 0 || sr->sr_offset2 != 0))
+		return -EINVAL;
+	if (!IS_ALIGNED(sr->sr_offset1, mp->m_sb.sb_blocksize) ||
+	    !IS_ALIGNED(sr->sr_offset2, mp->m_sb.sb_blocksize))
+		return -EINVAL;
+	if (sr->sr_offset1 + sr->sr_length < sr->sr_offset1 ||
+	    sr->sr_offset2 + sr->sr_length < sr->sr_offset2 ||
+	    sr->sr_offset1 + sr->sr_length > mp->m_super->s_maxbytes ||
+	    sr->sr_offset2 + sr->sr_length > mp->m_super->s_maxbytes)
+		return -EINVAL;
+
+	lock_two_nondirectories(inode1, inode2);
+	lock_flags = XFS_MMAPLOCK_EXCL;
+	xfs_lock_two_inodes(ip1, ip2, XFS_MMAPLOCK_EXCL);
+
+	if (!S_ISREG(inode1->i_mode) || !S_ISREG(inode2->i_mode)) {
+		error = -EINVAL;
+		goto out_unlock;
+	}
+	if (XFS_IS_REALTIME_INODE(ip1) || XFS_IS_REALTIME_INODE(ip2)) {
+		error = -EINVAL;
+		goto out_unlock;
+	}
+	if (IS_IMMUTABLE(inode1) || IS_IMMUTABLE(inode2) ||
+	    IS_APPEND(inode1) || IS_APPEND(inode2)) {
+		error = -EPERM;
+		goto out_unlock;
+	}
+
+	/*
+	 * A partial last block is only allowed if the range runs to EOF in
+	 * both files.  Without XFS_SWAP_RANGE_SET_SIZES the range can't go
+	 * beyond EOF, since the blocks we moved there would be invisible;
+	 * with it, the range has to cover both files.
+	 */
+	len = sr->sr_length;
+	if (!IS_ALIGNED(len, mp->m_sb.sb_blocksize)) {
+		if (sr->sr_offset1 + len < i_size_read(inode1) ||
+		    sr->sr_offset2 + len < i_size_read(inode2)) {
+			error = -EINVAL;
+			goto out_unlock;
+		}
+		len = round_up(len, mp->m_sb.sb_blocksize);
+	}
+	if (sr->sr_flags & XFS_SWAP_RANGE_SET_SIZES) {
+		if (len < i_size_read(inode1) || len < i_size_read(inode2)) {
+			error = -EINVAL;
+			goto out_unlock;
+		}
+	} else if (sr->sr_offset1 + len >
+			round_up(i_size_read(inode1), mp->m_sb.sb_blocksize) ||
+		   sr->sr_offset2 + len >
+			round_up(i_size_read(inode2), mp->m_sb.sb_blocksize)) {
+		error = -EINVAL;
+		goto out_unlock;
+	}
+
+	/* Write back and drop the page cache over both ranges. */
+	inode_dio_wait(inode1);
+	inode_dio_wait(inode2);
+	error = filemap_write_and_wait_range(inode1->i_mapping,
+			sr->sr_offset1, sr->sr_offset1 + len - 1);
+	if (error)
+		goto out_unlock;
+	error = filemap_write_and_wait_range(inode2->i_mapping,
+			sr->sr_offset2, sr->sr_offset2 + len - 1);
+	if (error)
+		goto out_unlock;
+	truncate_pagecache_range(inode1, sr->sr_offset1,
+			sr->sr_offset1 + len - 1);
+	truncate_pagecache_range(inode2, sr->sr_offset2,
+			sr->sr_offset2 + len - 1);
+
+	/* Only block mappings can be exchanged. */
+	error = xfs_inline_data_to_extents(ip1);
+	if (error)
+		goto out_unlock;
+	error = xfs_inline_data_to_extents(ip2);
+	if (error)
+		goto out_unlock;
+
+	/*
+	 * Get rid of anything in the ranges that isn't a real mapping in the
+	 * data fork: delalloc reservations past EOF, which only matter if the
+	 * range runs past EOF, and CoW staging extents.
+	 */
+	if (sr->sr_flags & XFS_SWAP_RANGE_SET_SIZES) {
+		if (xfs_can_free_eofblocks(ip1, true)) {
+			error = xfs_free_eofblocks(ip1);
+			if (error)
+				goto out_unlock;
+		}
+		if (xfs_can_free_eofblocks(ip2, true)) {
+			error = xfs_free_eofblocks(ip2);
+			if (error)
+				goto out_unlock;
+		}
+	}
+	if (xfs_is_reflink_inode(ip1)) {
+		error = xfs_reflink_cancel_cow_range(ip1, sr->sr_offset1, len,
+				true);
+		if (error)
+			goto out_unlock;
+	}
+	if (xfs_is_reflink_inode(ip2)) {
+		error = xfs_reflink_cancel_cow_range(ip2, sr->sr_offset2, len,
+				true);
+		if (error)
+			goto out_unlock;
+	}
+
+	error = xfs_qm_dqattach(ip1, 0);
+	if (error)
+		goto out_unlock;
+	error = xfs_qm_dqattach(ip2, 0);
+	if (error)
+		goto out_unlock;
+
+	error = xfs_add_incompat_log_feature(mp,
+			XFS_SB_FEAT_INCOMPAT_LOG_SWAPEXT);
+	if (error)
+		goto out_unlock;
+
+	resblks = XFS_SWAP_RMAP_SPACE_RES(mp,
+			XFS_IFORK_NEXTENTS(ip1, XFS_DATA_FORK), XFS_DATA_FORK) +
+		  XFS_SWAP_RMAP_SPACE_RES(mp,
+			XFS_IFORK_NEXTENTS(ip2, XFS_DATA_FORK), XFS_DATA_FORK);
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write, resblks, 0, 0, &tp);
+	if (error)
+		goto out_unlock;
+
+	xfs_lock_two_inodes(ip1, ip2, XFS_ILOCK_EXCL);
+	lock_flags |= XFS_ILOCK_EXCL;
+	xfs_trans_ijoin(tp, ip1, 0);
+	xfs_trans_ijoin(tp, ip2, 0);
+
+	/*
+	 * If either file has shared blocks, both files need the shared-block
+	 * rmap functions while we move the blocks around.  This has to be on
+	 * disk before the intent is, so set it now and leave it set.
+	 */
+	if (xfs_is_reflink_inode(ip1) || xfs_is_reflink_inode(ip2)) {
+		ip1->i_d.di_flags2 |= XFS_DIFLAG2_REFLINK;
+		ip2->i_d.di_flags2 |= XFS_DIFLAG2_REFLINK;
+	}
+
+	if (sr->sr_flags & XFS_SWAP_RANGE_SET_SIZES) {
+		size = ip1->i_d.di_size;
+		ip1->i_d.di_size = ip2->i_d.di_size;
+		ip2->i_d.di_size = size;
+		i_size_write(inode1, ip1->i_d.di_size);
+		i_size_write(inode2, ip2->i_d.di_size);
+	}
+
+	xfs_trans_ichgtime(tp, ip1, XFS_ICHGTIME_MOD | XFS_ICHGTIME_CHG);
+	xfs_trans_ichgtime(tp, ip2, XFS_ICHGTIME_MOD | XFS_ICHGTIME_CHG);
+	xfs_trans_log_inode(tp, ip1, XFS_ILOG_CORE);
+	xfs_trans_log_inode(tp, ip2, XFS_ILOG_CORE);
+
+	startoff1 = XFS_B_TO_FSBT(mp, sr->sr_offset1);
+	startoff2 = XFS_B_TO_FSBT(mp, sr->sr_offset2);
+	blockcount = XFS_B_TO_FSB(mp, len);
+	trace_xfs_swap_range(ip1, ip2, startoff1, startoff2, blockcount);
+
+	xfs_defer_init(&dfops, &firstfsb);
+	error = xfs_swapext_schedule(mp, &dfops, ip1, ip2, startoff1,
+			startoff2, blockcount);
+	if (error)
+		goto out_defer;
+	error = xfs_defer_finish(&tp, &dfops, NULL);
+	if (error)
+		goto out_defer;
+
+	/*
+	 * If this is a synchronous mount, make sure that the
+	 * transaction goes to disk before returning to the user.
+	 */
+	if (mp->m_flags & XFS_MOUNT_WSYNC)
+		xfs_trans_set_sync(tp);
+
+	error = xfs_trans_commit(tp);
+	goto out_unlock;
+
+out_defer:
+	xfs_defer_cancel(&dfops);
+	xfs_trans_cancel(tp);
+out_unlock:
+	xfs_iunlock(ip1, lock_flags);
+	xfs_iunlock(ip2, lock_flags);
+	unlock_two_nondirectories(inode1, inode2);
+	return error;
+}
@@ -34,18 +34,54 @@
 #include <linux/backing-dev.h>
 #include <linux/freezer.h>
 #include <linux/sched/mm.h>
+#include <linux/ioprio.h>
 
+#include "xfs_shared.h"
 #include "xfs_format.h"
 #include "xfs_log_format.h"
 #include "xfs_trans_resv.h"
 #include "xfs_sb.h"
 #include "xfs_mount.h"
+#include "xfs_da_format.h"
+#include "xfs_da_btree.h"
+#include "xfs_dir2.h"
 #include "xfs_trace.h"
 #include "xfs_log.h"
 #include "xfs_error.h"
 
 static kmem_zone_t *xfs_buf_zone;
 
+/*
+ * Sub-page buffers of a power of two size get their memory from a slab of
+ * that size. The slabs are aligned to the object size so a buffer never
+ * straddles a page boundary, and the common 512 byte sector and 4k block
+ * metadata buffers don't pay for the general purpose kmalloc size rounding.
+ */
+#define XFS_BUF_DATA_ZONES	(PAGE_SHIFT - BBSHIFT)
+static kmem_zone_t *xfs_buf_data_zone[XFS_BUF_DATA_ZONES];
+static char xfs_buf_data_zone_name[XFS_BUF_DATA_ZONES][16];
+
+static inline int
+xfs_buf_data_zone_index(
+	size_t			size)
+{
+	if (size < BBSIZE || size >= PAGE_SIZE || !is_power_of_2(size))
+		return -1;
+	return ilog2(size) - BBSHIFT;
+}
+
+static void
+xfs_buf_free_kmem(
+	struct xfs_buf		*bp)
+{
+	int			i = xfs_buf_data_zone_index(BBTOB(bp->b_length));
+
+	if (i >= 0)
+		kmem_zone_free(xfs_buf_data_zone[i], bp->b_addr);
+	else
+		kmem_free(bp->b_addr);
+}
+
 #ifdef XFS_BUF_LOCK_TRACKING
 # define XB_SET_OWNER(bp)	((bp)->b_last_holder = current->pid)
 # define XB_CLEAR_OWNER(bp)	((bp)->b_last_holder = -1)
@@ -69,9 +105,12 @@ xfs_buf_is_vmapped(
 	 *
 	 * b_addr is null if the buffer is not mapped, but the code is clever
 	 * enough to know it doesn't have to map a single page, so the check has
-	 * to be both for b_addr and bp->b_page_count > 1.
+	 * to be both for b_addr and bp->b_page_count > 1. Physically contiguous
+	 * buffers are addressed through the kernel direct mapping, so they are
+	 * never vmapped either.
 	 */
-	return bp->b_addr && bp->b_page_count > 1;
+	return bp->b_addr && bp->b_page_count > 1 &&
+	       !(bp->b_flags & _XBF_CONTIG);
 }
 
 static inline int
@@ -209,6 +248,35 @@ xfs_buf_free_maps(
 	}
 }
 
+/*
+ * Work out which NUMA node memory for a buffer at the given location should be
+ * allocated on. Buffers in the data device belong to an AG and are placed on
+ * the node that AG is associated with (see xfs_perag_buf_nid()). That keeps the
+ * buffer, its memory and its (per-node) LRU list entry together, and lets the
+ * buftarg shrinker reclaim the metadata of those AGs when that node is under
+ * memory pressure. Everything else is allocated wherever we happen to be.
+ */
+STATIC int
+xfs_buf_map_nid(
+	struct xfs_buftarg	*btp,
+	struct xfs_buf_map	*map)
+{
+	struct xfs_mount	*mp = btp->bt_mount;
+	struct xfs_perag	*pag;
+	int			nid;
+
+	if (num_online_nodes() <= 1 || btp != mp->m_ddev_targp ||
+	    map->bm_bn == XFS_BUF_DADDR_NULL)
+		return NUMA_NO_NODE;
+
+	pag = xfs_perag_get(mp, xfs_daddr_to_agno(mp, map->bm_bn));
+	if (!pag)
+		return NUMA_NO_NODE;
+	nid = pag->pag_buf_nid;
+	xfs_perag_put(pag);
+	return nid;
+}
+
 struct xfs_buf *
 _xfs_buf_alloc(
 	struct xfs_buftarg	*target,
@@ -218,17 +286,21 @@ _xfs_buf_alloc(
 {
 	struct xfs_buf		*bp;
 	int			error;
+	int			nid;
 	int			i;
 
-	bp = kmem_zone_zalloc(xfs_buf_zone, KM_NOFS);
+	nid = xfs_buf_map_nid(target, map);
+	bp = kmem_zone_alloc_node(xfs_buf_zone, KM_NOFS | KM_ZERO, nid);
 	if (unlikely(!bp))
 		return NULL;
+	bp->b_nid = nid;
 
 	/*
 	 * We don't want certain flags to appear in b_flags unless they are
 	 * specifically set by later operations on the buffer.
 	 */
-	flags &= ~(XBF_UNMAPPED | XBF_TRYLOCK | XBF_ASYNC | XBF_READ_AHEAD);
+	flags &= ~(XBF_UNMAPPED | XBF_TRYLOCK | XBF_ASYNC | XBF_READ_AHEAD |
+		   XBF_IDLE_IO);
 
 	atomic_set(&bp->b_hold, 1);
 	atomic_set(&bp->b_lru_ref, 1);
@@ -262,7 +334,6 @@ _xfs_buf_alloc(
 	bp->b_io_length = bp->b_length;
 
 	atomic_set(&bp->b_pin_count, 0);
-	init_waitqueue_head(&bp->b_waiters);
 
 	XFS_STATS_INC(target->bt_mount, xb_create);
 	trace_xfs_buf_init(bp, _RET_IP_);
@@ -308,6 +379,124 @@ _xfs_buf_free_pages(
 	}
 }
 
+/*
+ * Multi-page buffers that can't get physically contiguous memory have to be
+ * mapped with vm_map_ram(). Tearing those mappings down again is expensive as
+ * the lazy vunmap flush sends TLB shootdown IPIs to every CPU, and metadata
+ * workloads with large directory blocks cycle through such buffers constantly.
+ *
+ * To avoid that churn, the memory and mapping of a freed vmapped buffer is
+ * kept in a small per-buftarg cache and handed to the next buffer of the same
+ * size rather than being unmapped. The cache is emptied by the buftarg
+ * shrinker under memory pressure and at unmount.
+ */
+#define XFS_BUF_VMAP_CACHE_MAX	32
+
+struct xfs_buf_vmap {
+	struct list_head	bv_list;
+	void			*bv_addr;
+	int			bv_page_count;
+	struct page		*bv_pages[];
+};
+
+/*
+ * Stash the vmapped memory of a buffer that is being freed in the cache.
+ * Returns true if the cache now owns the pages and the mapping.
+ */
+STATIC bool
+xfs_buf_vmap_cache_put(
+	struct xfs_buf		*bp)
+{
+	struct xfs_buftarg	*btp = bp->b_target;
+	struct xfs_buf_vmap	*bv;
+
+	if (bp->b_offset ||
+	    READ_ONCE(btp->bt_vmap_count) >= XFS_BUF_VMAP_CACHE_MAX)
+		return false;
+
+	bv = kmem_alloc(sizeof(*bv) + bp->b_page_count * sizeof(struct page *),
+			KM_NOSLEEP);
+	if (!bv)
+		return false;
+	bv->bv_addr = bp->b_addr;
+	bv->bv_page_count = bp->b_page_count;
+	memcpy(bv->bv_pages, bp->b_pages,
+	       bp->b_page_count * sizeof(struct page *));
+
+	spin_lock(&btp->bt_vmap_lock);
+	if (btp->bt_vmap_count >= XFS_BUF_VMAP_CACHE_MAX) {
+		spin_unlock(&btp->bt_vmap_lock);
+		kmem_free(bv);
+		return false;
+	}
+	list_add(&bv->bv_list, &btp->bt_vmap_cache);
+	btp->bt_vmap_count++;
+	spin_unlock(&btp->bt_vmap_lock);
+	return true;
+}
+
+/*
+ * Find cached vmapped memory of the right size for a new buffer and attach it
+ * to the buffer, which is then already mapped.
+ */
+STATIC bool
+xfs_buf_vmap_cache_get(
+	struct xfs_buf		*bp,
+	int			page_count)
+{
+	struct xfs_buftarg	*btp = bp->b_target;
+	struct xfs_buf_vmap	*bv;
+
+	if (!READ_ONCE(btp->bt_vmap_count))
+		return false;
+
+	spin_lock(&btp->bt_vmap_lock);
+	list_for_each_entry(bv, &btp->bt_vmap_cache, bv_list) {
+		if (bv->bv_page_count == page_count)
+			goto found;
+	}
+	spin_unlock(&btp->bt_vmap_lock);
+	return false;
+
+found:
+	list_del(&bv->bv_list);
+	btp->bt_vmap_count--;
+	spin_unlock(&btp->bt_vmap_lock);
+
+	memcpy(bp->b_pages, bv->bv_pages, page_count * sizeof(struct page *));
+	bp->b_addr = bv->bv_addr;
+	kmem_free(bv);
+	return true;
+}
+
+/*
+ * Unmap and free all the cached vmapped buffer memory. Returns the number of
+ * entries freed.
+ */
+STATIC unsigned long
+xfs_buf_vmap_cache_drain(
+	struct xfs_buftarg	*btp)
+{
+	struct xfs_buf_vmap	*bv, *n;
+	unsigned long		freed = 0;
+	LIST_HEAD(dispose);
+	int			i;
+
+	spin_lock(&btp->bt_vmap_lock);
+	list_splice_init(&btp->bt_vmap_cache, &dispose);
+	btp->bt_vmap_count = 0;
+	spin_unlock(&btp->bt_vmap_lock);
+
+	list_for_each_entry_safe(bv, n, &dispose, bv_list) {
+		vm_unmap_ram(bv->bv_addr, bv->bv_page_count);
+		for (i = 0; i < bv->bv_page_count; i++)
+			__free_page(bv->bv_pages[i]);
+		kmem_free(bv);
+		freed++;
+	}
+	return freed;
+}
+
 /*
  *	Releases the specified buffer.
  *
@@ -326,9 +515,12 @@ xfs_buf_free(
 	if (bp->b_flags & _XBF_PAGES) {
 		uint		i;
 
-		if (xfs_buf_is_vmapped(bp))
+		if (xfs_buf_is_vmapped(bp)) {
+			if (xfs_buf_vmap_cache_put(bp))
+				goto out_free_pages;
 			vm_unmap_ram(bp->b_addr - bp->b_offset,
 					bp->b_page_count);
+		}
 
 		for (i = 0; i < bp->b_page_count; i++) {
 			struct page	*page = bp->b_pages[i];
@@ -336,12 +528,52 @@ xfs_buf_free(
 			__free_page(page);
 		}
 	} else if (bp->b_flags & _XBF_KMEM)
-		kmem_free(bp->b_addr);
+		xfs_buf_free_kmem(bp);
+out_free_pages:
 	_xfs_buf_free_pages(bp);
 	xfs_buf_free_maps(bp);
+	kmem_free(bp->b_retry);
 	kmem_zone_free(xfs_buf_zone, bp);
 }
 
+/*
+ * Try to allocate physically contiguous memory for a multi-page buffer so that
+ * it can be addressed through the kernel direct mapping rather than needing a
+ * vmap. We don't try hard - if a high order page isn't readily available we
+ * fall back to allocating pages individually.
+ *
+ * The high order page is split so that the buffer pages can be treated as
+ * individual pages by the rest of the buffer code. Any tail pages beyond the
+ * end of the buffer are freed straight away.
+ */
+STATIC bool
+xfs_buf_alloc_contig_pages(
+	struct xfs_buf		*bp,
+	gfp_t			gfp_mask)
+{
+	unsigned int		order = get_order(bp->b_page_count << PAGE_SHIFT);
+	struct page		*page;
+	int			i;
+
+	if (order > MAX_ORDER - 1)
+		return false;
+
+	page = alloc_pages_node(bp->b_nid,
+				gfp_mask | __GFP_NORETRY | __GFP_NOWARN, order);
+	if (!page)
+		return false;
+
+	split_page(page, order);
+	for (i = 0; i < bp->b_page_count; i++)
+		bp->b_pages[i] = page + i;
+	for (; i < (1 << order); i++)
+		__free_page(page + i);
+
+	bp->b_addr = page_address(page) + bp->b_offset;
+	bp->b_flags |= _XBF_CONTIG;
+	return true;
+}
+
 /*
  * Allocates all the pages for buffer in question and builds it's page list.
  */
@@ -364,7 +596,13 @@ xfs_buf_allocate_memory(
 	 */
 	size = BBTOB(bp->b_length);
 	if (size < PAGE_SIZE) {
-		bp->b_addr = kmem_alloc(size, KM_NOFS);
+		int	zi = xfs_buf_data_zone_index(size);
+
+		if (zi >= 0)
+			bp->b_addr = kmem_zone_alloc_node(xfs_buf_data_zone[zi],
+					KM_NOFS, bp->b_nid);
+		else
+			bp->b_addr = kmem_alloc_node(size, KM_NOFS, bp->b_nid);
 		if (!bp->b_addr) {
 			/* low memory - use alloc_page loop instead */
 			goto use_alloc_page;
@@ -373,7 +611,7 @@ xfs_buf_allocate_memory(
 		if (((unsigned long)(bp->b_addr + size - 1) & PAGE_MASK) !=
 		    ((unsigned long)bp->b_addr & PAGE_MASK)) {
 			/* b_addr spans two pages - use alloc_page instead */
-			kmem_free(bp->b_addr);
+			xfs_buf_free_kmem(bp);
 			bp->b_addr = NULL;
 			goto use_alloc_page;
 		}
@@ -397,11 +635,21 @@ xfs_buf_allocate_memory(
 	offset = bp->b_offset;
 	bp->b_flags |= _XBF_PAGES;
 
+	if (bp->b_page_count > 1) {
+		if (xfs_buf_vmap_cache_get(bp, bp->b_page_count))
+			return 0;
+		if (xfs_buf_alloc_contig_pages(bp, gfp_mask)) {
+			XFS_STATS_ADD(bp->b_target->bt_mount, xb_page_found,
+				      bp->b_page_count);
+			return 0;
+		}
+	}
+
 	for (i = 0; i < bp->b_page_count; i++) {
 		struct page	*page;
 		uint		retries = 0;
 retry:
-		page = alloc_page(gfp_mask);
+		page = alloc_pages_node(bp->b_nid, gfp_mask, 0);
 		if (unlikely(page == NULL)) {
 			if (flags & XBF_READ_AHEAD) {
 				bp->b_page_count = i;
@@ -451,8 +699,8 @@ _xfs_buf_map_pages(
 	uint			flags)
 {
 	ASSERT(bp->b_flags & _XBF_PAGES);
-	if (bp->b_page_count == 1) {
-		/* A single page buffer is always mappable */
+	if (bp->b_page_count == 1 || (bp->b_flags & _XBF_CONTIG)) {
+		/* single page and contiguous buffers are always mappable */
 		bp->b_addr = page_address(bp->b_pages[0]) + bp->b_offset;
 	} else if (flags & XBF_UNMAPPED) {
 		bp->b_addr = NULL;
@@ -471,7 +719,7 @@ _xfs_buf_map_pages(
 		nofs_flag = memalloc_nofs_save();
 		do {
 			bp->b_addr = vm_map_ram(bp->b_pages, bp->b_page_count,
-						-1, PAGE_KERNEL);
+						bp->b_nid, PAGE_KERNEL);
 			if (bp->b_addr)
 				break;
 			vm_unmap_aliases();
@@ -624,12 +872,14 @@ _xfs_buf_find(
 
 	if (!xfs_buf_trylock(bp)) {
 		if (flags & XBF_TRYLOCK) {
+			XFS_AG_STATS_INC(bp->b_pag, as_buf_trylock_fails);
 			xfs_buf_rele(bp);
 			XFS_STATS_INC(btp->bt_mount, xb_busy_locked);
 			return NULL;
 		}
 		xfs_buf_lock(bp);
 		XFS_STATS_INC(btp->bt_mount, xb_get_locked_waited);
+		XFS_AG_STATS_INC(bp->b_pag, as_buf_lock_waits);
 	}
 
 	/*
@@ -640,7 +890,7 @@ _xfs_buf_find(
 	if (bp->b_flags & XBF_STALE) {
 		ASSERT((bp->b_flags & _XBF_DELWRI_Q) == 0);
 		ASSERT(bp->b_iodone == NULL);
-		bp->b_flags &= _XBF_KMEM | _XBF_PAGES;
+		bp->b_flags &= _XBF_KMEM | _XBF_PAGES | _XBF_CONTIG;
 		bp->b_ops = NULL;
 	}
 
@@ -719,8 +969,9 @@ _xfs_buf_read(
 	ASSERT(!(flags & XBF_WRITE));
 	ASSERT(bp->b_maps[0].bm_bn != XFS_BUF_DADDR_NULL);
 
-	bp->b_flags &= ~(XBF_WRITE | XBF_ASYNC | XBF_READ_AHEAD);
-	bp->b_flags |= flags & (XBF_READ | XBF_ASYNC | XBF_READ_AHEAD);
+	bp->b_flags &= ~(XBF_WRITE | XBF_ASYNC | XBF_READ_AHEAD | XBF_IDLE_IO);
+	bp->b_flags |= flags & (XBF_READ | XBF_ASYNC | XBF_READ_AHEAD |
+				XBF_IDLE_IO);
 
 	if (flags & XBF_ASYNC) {
 		xfs_buf_submit(bp);
@@ -748,7 +999,15 @@ xfs_buf_read_map(
 		if (!(bp->b_flags & XBF_DONE)) {
 			XFS_STATS_INC(target->bt_mount, xb_get_read);
 			bp->b_ops = ops;
-			_xfs_buf_read(bp, flags);
+			if (flags & XBF_ASYNC) {
+				_xfs_buf_read(bp, flags);
+			} else {
+				ktime_t	start = ktime_get();
+
+				_xfs_buf_read(bp, flags);
+				XFS_STATS_LAT(target->bt_mount,
+						XFS_LAT_BUF_READ, start);
+			}
 		} else if (flags & XBF_ASYNC) {
 			/*
 			 * Read ahead call which is already satisfied,
@@ -783,6 +1042,26 @@ xfs_buf_readahead_map(
 		     XBF_TRYLOCK|XBF_ASYNC|XBF_READ_AHEAD, ops);
 }
 
+/*
+ * Readahead for background work such as scrub that should not compete
+ * with foreground I/O: the read is issued at idle I/O priority.
+ */
+void
+xfs_buf_readahead_idle(
+	struct xfs_buftarg	*target,
+	xfs_daddr_t		blkno,
+	size_t			numblks,
+	const struct xfs_buf_ops *ops)
+{
+	DEFINE_SINGLE_BUF_MAP(map, blkno, numblks);
+
+	if (bdi_read_congested(target->bt_bdev->bd_bdi))
+		return;
+
+	xfs_buf_read_map(target, &map, 1,
+		     XBF_TRYLOCK|XBF_ASYNC|XBF_READ_AHEAD|XBF_IDLE_IO, ops);
+}
+
 /*
  * Read an uncached buffer from disk. Allocates and returns a locked
  * buffer containing the disk contents or nothing.
@@ -1104,29 +1383,128 @@ xfs_buf_unlock(
 	trace_xfs_buf_unlock(bp, _RET_IP_);
 }
 
+STATIC int
+xfs_buf_wait_unpin_action(
+	atomic_t		*pin_count)
+{
+	io_schedule();
+	return 0;
+}
+
+/*
+ * Unpin waiters sleep on the hashed atomic_t waitqueues rather than a
+ * waitqueue head embedded in every buffer; waiting for a buffer to be unpinned
+ * is rare, so there's no point in paying for it in every buffer.
+ */
 STATIC void
 xfs_buf_wait_unpin(
 	xfs_buf_t		*bp)
 {
-	DECLARE_WAITQUEUE	(wait, current);
+	wait_on_atomic_t(&bp->b_pin_count, xfs_buf_wait_unpin_action,
+			 TASK_UNINTERRUPTIBLE);
+}
 
-	if (atomic_read(&bp->b_pin_count) == 0)
-		return;
+/*
+ *	Buffer Utility Routines
+ */
 
-	add_wait_queue(&bp->b_waiters, &wait);
-	for (;;) {
-		set_current_state(TASK_UNINTERRUPTIBLE);
-		if (atomic_read(&bp->b_pin_count) == 0)
-			break;
-		io_schedule();
+/*
+ * Verifiers that get their own row in the buffer I/O stats. Row 0 is for
+ * buffers without a verifier and the last row catches everything else, such
+ * as the scrub verifiers.
+ */
+static const struct xfs_buf_ops *xfs_buf_io_types[] = {
+	&xfs_sb_buf_ops,
+	&xfs_sb_quiet_buf_ops,
+	&xfs_agf_buf_ops,
+	&xfs_agfl_buf_ops,
+	&xfs_agi_buf_ops,
+	&xfs_allocbt_buf_ops,
+	&xfs_inobt_buf_ops,
+	&xfs_rmapbt_buf_ops,
+	&xfs_refcountbt_buf_ops,
+	&xfs_bmbt_buf_ops,
+	&xfs_inode_buf_ops,
+	&xfs_inode_buf_ra_ops,
+	&xfs_da3_node_buf_ops,
+	&xfs_dir3_block_buf_ops,
+	&xfs_dir3_data_buf_ops,
+	&xfs_dir3_leaf1_buf_ops,
+	&xfs_dir3_leafn_buf_ops,
+	&xfs_dir3_free_buf_ops,
+	&xfs_attr3_leaf_buf_ops,
+	&xfs_attr3_rmt_buf_ops,
+	&xfs_symlink_buf_ops,
+	&xfs_dquot_buf_ops,
+	&xfs_dquot_buf_ra_ops,
+#ifdef CONFIG_XFS_RT
+	&xfs_rtbuf_ops,
+#endif
+};
+
+#define XFS_BUFIO_OTHER		(XFS_BUFIO_TYPES - 1)
+
+const char *
+xfs_buf_io_type_name(
+	int			type)
+{
+	if (type == 0)
+		return "none";
+	if (type == XFS_BUFIO_OTHER)
+		return "other";
+	if (type > ARRAY_SIZE(xfs_buf_io_types))
+		return NULL;
+	return xfs_buf_io_types[type - 1]->name;
+}
+
+static int
+xfs_buf_io_type(
+	const struct xfs_buf_ops *ops)
+{
+	int			i;
+
+	if (!ops)
+		return 0;
+	for (i = 0; i < ARRAY_SIZE(xfs_buf_io_types); i++) {
+		if (xfs_buf_io_types[i] == ops)
+			return i + 1;
 	}
-	remove_wait_queue(&bp->b_waiters, &wait);
-	set_current_state(TASK_RUNNING);
+	return XFS_BUFIO_OTHER;
 }
 
 /*
- *	Buffer Utility Routines
+ * Account a completed buffer I/O to the verifier of the buffer. Buffers
+ * failed at submission time were never timed and are skipped.
  */
+static void
+xfs_buf_io_account(
+	struct xfs_buf		*bp,
+	bool			read)
+{
+	struct xfs_mount	*mp = bp->b_target->bt_mount;
+	int			type;
+	int64_t			us;
+
+	BUILD_BUG_ON(ARRAY_SIZE(xfs_buf_io_types) + 2 > XFS_BUFIO_TYPES);
+
+	if (!bp->b_io_start || !(bp->b_flags & (XBF_READ | XBF_WRITE)))
+		return;
+	us = ktime_us_delta(ktime_get(), bp->b_io_start);
+	bp->b_io_start = 0;
+
+	type = xfs_buf_io_type(bp->b_ops);
+	if (read) {
+		XFS_STATS_BUFIO(mp, type, XFS_BUFIO_READS, 1);
+		XFS_STATS_BUFIO(mp, type, XFS_BUFIO_READ_BYTES,
+				BBTOB(bp->b_io_length));
+		XFS_STATS_BUFIO(mp, type, XFS_BUFIO_READ_US, us);
+	} else {
+		XFS_STATS_BUFIO(mp, type, XFS_BUFIO_WRITES, 1);
+		XFS_STATS_BUFIO(mp, type, XFS_BUFIO_WRITE_BYTES,
+				BBTOB(bp->b_io_length));
+		XFS_STATS_BUFIO(mp, type, XFS_BUFIO_WRITE_US, us);
+	}
+}
 
 void
 xfs_buf_ioend(
@@ -1136,7 +1514,12 @@ xfs_buf_ioend(
 
 	trace_xfs_buf_iodone(bp, _RET_IP_);
 
-	bp->b_flags &= ~(XBF_READ | XBF_WRITE | XBF_READ_AHEAD);
+	if ((bp->b_flags & (XBF_WRITE | XBF_FUA)) == XBF_WRITE)
+		xfs_buftarg_write_done(bp->b_target);
+	xfs_buf_io_account(bp, read);
+
+	bp->b_flags &= ~(XBF_READ | XBF_WRITE | XBF_READ_AHEAD | XBF_IDLE_IO |
+			 XBF_PRIO_IO | XBF_BG_IO | _XBF_VERIFIED);
 
 	/*
 	 * Pull in IO completion errors now. We are guaranteed to be running
@@ -1158,7 +1541,7 @@ xfs_buf_ioend(
 		(*(bp->b_iodone))(bp);
 	else if (bp->b_flags & XBF_ASYNC)
 		xfs_buf_relse(bp);
-	else
+	else if (!(bp->b_flags & _XBF_POLL))
 		complete(&bp->b_iowait);
 }
 
@@ -1176,8 +1559,17 @@ static void
 xfs_buf_ioend_async(
 	struct xfs_buf	*bp)
 {
+	struct xfs_mount	*mp = bp->b_target->bt_mount;
+
 	INIT_WORK(&bp->b_ioend_work, xfs_buf_ioend_work);
-	queue_work(bp->b_ioend_wq, &bp->b_ioend_work);
+	if (bp->b_ioend_wq == mp->m_buf_workqueue)
+		xfs_io_queue_work(mp, XFS_WQ_BUF, bp->b_ioend_wq,
+				  &bp->b_ioend_work, bp->b_io_cpu);
+	else if (bp->b_ioend_wq == mp->m_log_workqueue)
+		xfs_io_queue_work(mp, XFS_WQ_LOG, bp->b_ioend_wq,
+				  &bp->b_ioend_work, bp->b_io_cpu);
+	else
+		queue_work(bp->b_ioend_wq, &bp->b_ioend_work);
 }
 
 void
@@ -1239,8 +1631,16 @@ xfs_buf_bio_end_io(
 	if (!bp->b_error && xfs_buf_is_vmapped(bp) && (bp->b_flags & XBF_READ))
 		invalidate_kernel_vmap_range(bp->b_addr, xfs_buf_vmap_len(bp));
 
-	if (atomic_dec_and_test(&bp->b_io_remaining) == 1)
-		xfs_buf_ioend_async(bp);
+	/*
+	 * A polling submitter runs the completion processing itself, so all
+	 * that is left to do here is to tell it the I/O is done.
+	 */
+	if (atomic_dec_and_test(&bp->b_io_remaining) == 1) {
+		if (bp->b_flags & _XBF_POLL)
+			complete(&bp->b_iowait);
+		else
+			xfs_buf_ioend_async(bp);
+	}
 	bio_put(bio);
 }
 
@@ -1289,6 +1689,8 @@ xfs_buf_ioapply_map(
 	bio->bi_end_io = xfs_buf_bio_end_io;
 	bio->bi_private = bp;
 	bio_set_op_attrs(bio, op, op_flags);
+	if (bp->b_flags & XBF_IDLE_IO)
+		bio_set_prio(bio, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0));
 
 	for (; size && nr_pages; nr_pages--, page_index++) {
 		int	rbytes, nbytes = PAGE_SIZE - offset;
@@ -1312,7 +1714,7 @@ xfs_buf_ioapply_map(
 			flush_kernel_vmap_range(bp->b_addr,
 						xfs_buf_vmap_len(bp));
 		}
-		submit_bio(bio);
+		bp->b_io_cookie = submit_bio(bio);
 		if (size)
 			goto next_chunk;
 	} else {
@@ -1327,22 +1729,27 @@ xfs_buf_ioapply_map(
 
 }
 
-STATIC void
-_xfs_buf_ioapply(
-	struct xfs_buf	*bp)
+/*
+ * Set the buffer up for I/O and work out the bio operation and flags for it.
+ * If the write verifier fails the error is returned and also left in
+ * bp->b_error, and the I/O must not be issued.
+ */
+STATIC int
+_xfs_buf_ioprep(
+	struct xfs_buf	*bp,
+	int		*opp,
+	int		*op_flagsp)
 {
-	struct blk_plug	plug;
 	int		op;
 	int		op_flags = 0;
-	int		offset;
-	int		size;
-	int		i;
 
 	/*
 	 * Make sure we capture only current IO errors rather than stale errors
 	 * left over from previous use of the buffer (e.g. failed readahead).
 	 */
 	bp->b_error = 0;
+	bp->b_io_start = ktime_get();
+	bp->b_io_cpu = raw_smp_processor_id();
 
 	/*
 	 * Initialize the I/O completion workqueue if we haven't yet or the
@@ -1355,6 +1762,24 @@ _xfs_buf_ioapply(
 		op = REQ_OP_WRITE;
 		if (bp->b_flags & XBF_SYNCIO)
 			op_flags = REQ_SYNC;
+
+		/*
+		 * Tell the block layer which writes somebody is waiting on.
+		 * Log writes are issued synchronously and must never queue
+		 * behind throttled writeback, so they are tagged like
+		 * O_DIRECT writes, which writeback throttling lets through.
+		 * Urgent AIL pushes free log space for blocked transactions
+		 * and are marked sync so the I/O schedulers don't treat them
+		 * as async writeback; everything else the AIL writes is
+		 * background work.
+		 */
+		if (bp->b_flags & XBF_PRIO_IO) {
+			op_flags |= REQ_SYNC | REQ_PRIO;
+			if (bp->b_flags & XBF_SYNCIO)
+				op_flags |= REQ_IDLE;
+		} else if (bp->b_flags & XBF_BG_IO) {
+			op_flags |= REQ_BACKGROUND;
+		}
 		if (bp->b_flags & XBF_FUA)
 			op_flags |= REQ_FUA;
 		if (bp->b_flags & XBF_FLUSH)
@@ -1364,13 +1789,19 @@ _xfs_buf_ioapply(
 		 * Run the write verifier callback function if it exists. If
 		 * this function fails it will mark the buffer with an error and
 		 * the IO should not be dispatched.
+		 *
+		 * A buffer that is being resubmitted after a failed write
+		 * hasn't been unlocked since the verifier last passed and
+		 * updated the CRCs, so there is nothing left to check.
 		 */
-		if (bp->b_ops) {
+		if (bp->b_flags & _XBF_VERIFIED) {
+			bp->b_flags &= ~_XBF_VERIFIED;
+		} else if (bp->b_ops) {
 			bp->b_ops->verify_write(bp);
 			if (bp->b_error) {
 				xfs_force_shutdown(bp->b_target->bt_mount,
 						   SHUTDOWN_CORRUPT_INCORE);
-				return;
+				return bp->b_error;
 			}
 		} else if (bp->b_bn != XFS_BUF_DADDR_NULL) {
 			struct xfs_mount *mp = bp->b_target->bt_mount;
@@ -1392,11 +1823,31 @@ _xfs_buf_ioapply(
 		op_flags = REQ_RAHEAD;
 	} else {
 		op = REQ_OP_READ;
+
+		/* somebody is blocked on a synchronous metadata read */
+		if (!(bp->b_flags & (XBF_ASYNC | XBF_IDLE_IO)))
+			op_flags = REQ_PRIO;
 	}
 
 	/* we only use the buffer cache for meta-data */
 	op_flags |= REQ_META;
 
+	*opp = op;
+	*op_flagsp = op_flags;
+	return 0;
+}
+
+STATIC void
+_xfs_buf_ioapply_maps(
+	struct xfs_buf	*bp,
+	int		op,
+	int		op_flags)
+{
+	struct blk_plug	plug;
+	int		offset;
+	int		size;
+	int		i;
+
 	/*
 	 * Walk all the vectors issuing IO on them. Set up the initial offset
 	 * into the buffer and the desired IO size before we start -
@@ -1416,17 +1867,30 @@ _xfs_buf_ioapply(
 	blk_finish_plug(&plug);
 }
 
+STATIC void
+_xfs_buf_ioapply(
+	struct xfs_buf	*bp)
+{
+	int		op;
+	int		op_flags;
+
+	if (_xfs_buf_ioprep(bp, &op, &op_flags))
+		return;
+	_xfs_buf_ioapply_maps(bp, op, op_flags);
+}
+
 /*
- * Asynchronous IO submission path. This transfers the buffer lock ownership and
- * the current reference to the IO. It is not safe to reference the buffer after
- * a call to this function unless the caller holds an additional reference
- * itself.
+ * The two halves of asynchronous submission around issuing the bios, shared
+ * by xfs_buf_submit() and delwri buffer clustering.  xfs_buf_submit_start()
+ * returns false if the buffer has already been completed because the
+ * filesystem is shut down.
  */
-void
-xfs_buf_submit(
-	struct xfs_buf	*bp)
+static bool
+xfs_buf_submit_start(
+	struct xfs_buf	*bp,
+	unsigned long	caller_ip)
 {
-	trace_xfs_buf_submit(bp, _RET_IP_);
+	trace_xfs_buf_submit(bp, caller_ip);
 
 	ASSERT(!(bp->b_flags & _XBF_DELWRI_Q));
 	ASSERT(bp->b_flags & XBF_ASYNC);
@@ -1437,7 +1901,7 @@ xfs_buf_submit(
 		bp->b_flags &= ~XBF_DONE;
 		xfs_buf_stale(bp);
 		xfs_buf_ioend(bp);
-		return;
+		return false;
 	}
 
 	if (bp->b_flags & XBF_WRITE)
@@ -1463,8 +1927,13 @@ xfs_buf_submit(
 	 */
 	atomic_set(&bp->b_io_remaining, 1);
 	xfs_buf_ioacct_inc(bp);
-	_xfs_buf_ioapply(bp);
+	return true;
+}
 
+static void
+xfs_buf_submit_end(
+	struct xfs_buf	*bp)
+{
 	/*
 	 * If _xfs_buf_ioapply failed, we can get back here with only the IO
 	 * reference we took above. If we drop it to zero, run completion so
@@ -1481,8 +1950,47 @@ xfs_buf_submit(
 	/* Note: it is not safe to reference bp now we've dropped our ref */
 }
 
+/*
+ * Asynchronous IO submission path. This transfers the buffer lock ownership and
+ * the current reference to the IO. It is not safe to reference the buffer after
+ * a call to this function unless the caller holds an additional reference
+ * itself.
+ */
+void
+xfs_buf_submit(
+	struct xfs_buf	*bp)
+{
+	if (!xfs_buf_submit_start(bp, _RET_IP_))
+		return;
+	_xfs_buf_ioapply(bp);
+	xfs_buf_submit_end(bp);
+}
+
+/*
+ * Wait for a polled buffer's bios to complete.  Spin in blk_mq_poll on the
+ * hardware queue the last bio went to for as long as it keeps finding
+ * completions, and fall back to sleeping on b_iowait if the queue doesn't
+ * support polling or the I/O completed somewhere else.
+ */
+STATIC void
+xfs_buf_poll_wait(
+	struct xfs_buf		*bp)
+{
+	struct request_queue	*q = bdev_get_queue(bp->b_target->bt_bdev);
+
+	while (!completion_done(&bp->b_iowait)) {
+		if (!blk_mq_poll(q, bp->b_io_cookie))
+			break;
+	}
+	wait_for_completion(&bp->b_iowait);
+}
+
 /*
  * Synchronous buffer IO submission path, read or write.
+ *
+ * With the hipri mount option, synchronous reads poll for completion and run
+ * xfs_buf_ioend in the submitter's context rather than bouncing through the
+ * interrupt handler and the buffer completion workqueue.
  */
 int
 xfs_buf_submit_wait(
@@ -1515,6 +2023,10 @@ xfs_buf_submit_wait(
 	 */
 	xfs_buf_hold(bp);
 
+	if ((bp->b_flags & XBF_READ) &&
+	    (bp->b_target->bt_mount->m_flags & XFS_MOUNT_HIPRI))
+		bp->b_flags |= _XBF_POLL;
+
 	/*
 	 * Set the count to 1 initially, this will stop an I/O completion
 	 * callout which happens before we have started all the I/O from calling
@@ -1523,6 +2035,17 @@ xfs_buf_submit_wait(
 	atomic_set(&bp->b_io_remaining, 1);
 	_xfs_buf_ioapply(bp);
 
+	if (bp->b_flags & _XBF_POLL) {
+		trace_xfs_buf_iowait(bp, _RET_IP_);
+		if (atomic_dec_and_test(&bp->b_io_remaining) == 0)
+			xfs_buf_poll_wait(bp);
+		trace_xfs_buf_iowait_done(bp, _RET_IP_);
+		xfs_buf_ioend(bp);
+		bp->b_flags &= ~_XBF_POLL;
+		error = bp->b_error;
+		goto out_rele;
+	}
+
 	/*
 	 * make sure we run completion synchronously if it raced with us and is
 	 * already complete.
@@ -1536,6 +2059,7 @@ xfs_buf_submit_wait(
 	trace_xfs_buf_iowait_done(bp, _RET_IP_);
 	error = bp->b_error;
 
+out_rele:
 	/*
 	 * all done now, we can release the hold that keeps the buffer
 	 * referenced for the entire IO.
@@ -1640,6 +2164,19 @@ xfs_buftarg_wait_rele(
 	return LRU_REMOVED;
 }
 
+/*
+ * Wait for all buffer I/O in flight on the buftarg to complete and for its
+ * completion processing to finish.
+ */
+void
+xfs_buftarg_wait_io(
+	struct xfs_buftarg	*btp)
+{
+	while (percpu_counter_sum(&btp->bt_io_count))
+		delay(100);
+	flush_workqueue(btp->bt_mount->m_buf_workqueue);
+}
+
 void
 xfs_wait_buftarg(
 	struct xfs_buftarg	*btp)
@@ -1659,9 +2196,7 @@ xfs_wait_buftarg(
 	 * all reference counts have been dropped before we start walking the
 	 * LRU list.
 	 */
-	while (percpu_counter_sum(&btp->bt_io_count))
-		delay(100);
-	flush_workqueue(btp->bt_mount->m_buf_workqueue);
+	xfs_buftarg_wait_io(btp);
 
 	/* loop until there is nothing left on the lru list. */
 	while (list_lru_count(&btp->bt_lru)) {
@@ -1726,9 +2261,18 @@ xfs_buftarg_shrink_scan(
 	struct xfs_buftarg	*btp = container_of(shrink,
 					struct xfs_buftarg, bt_shrinker);
 	LIST_HEAD(dispose);
-	unsigned long		freed;
+	unsigned long		freed = 0;
 
-	freed = list_lru_shrink_walk(&btp->bt_lru, sc,
+	/*
+	 * The LRU is memcg aware: a buffer sits on the list of the cgroup
+	 * that instantiated it, and reclaim on behalf of a cgroup only walks
+	 * that cgroup's list, so one container scanning lots of metadata
+	 * doesn't push the hot metadata of the others out of the cache.  The
+	 * vmap cache is shared, so only drain it for global reclaim.
+	 */
+	if (!sc->memcg)
+		freed = xfs_buf_vmap_cache_drain(btp);
+	freed += list_lru_shrink_walk(&btp->bt_lru, sc,
 				     xfs_buftarg_isolate, &dispose);
 
 	while (!list_empty(&dispose)) {
@@ -1748,7 +2292,33 @@ xfs_buftarg_shrink_count(
 {
 	struct xfs_buftarg	*btp = container_of(shrink,
 					struct xfs_buftarg, bt_shrinker);
-	return list_lru_shrink_count(&btp->bt_lru, sc);
+	unsigned long		count;
+
+	count = list_lru_shrink_count(&btp->bt_lru, sc);
+	if (!sc->memcg)
+		count += READ_ONCE(btp->bt_vmap_count);
+	return count;
+}
+
+/*
+ * Record that a cache flush which was issued when bt_write_seq was seq has
+ * completed successfully.  Flushes can complete out of order, so never move
+ * bt_flush_seq backwards.
+ */
+void
+xfs_buftarg_flushed(
+	struct xfs_buftarg	*btp,
+	int			seq)
+{
+	int			old = atomic_read(&btp->bt_flush_seq);
+	int			prev;
+
+	while (seq - old > 0) {
+		prev = atomic_cmpxchg(&btp->bt_flush_seq, old, seq);
+		if (prev == old)
+			break;
+		old = prev;
+	}
 }
 
 void
@@ -1757,6 +2327,7 @@ xfs_free_buftarg(
 	struct xfs_buftarg	*btp)
 {
 	unregister_shrinker(&btp->bt_shrinker);
+	xfs_buf_vmap_cache_drain(btp);
 	ASSERT(percpu_counter_sum(&btp->bt_io_count) == 0);
 	percpu_counter_destroy(&btp->bt_io_count);
 	list_lru_destroy(&btp->bt_lru);
@@ -1818,16 +2389,19 @@ xfs_alloc_buftarg(
 	if (xfs_setsize_buftarg_early(btp, bdev))
 		goto error;
 
-	if (list_lru_init(&btp->bt_lru))
+	if (list_lru_init_memcg(&btp->bt_lru))
 		goto error;
 
 	if (percpu_counter_init(&btp->bt_io_count, 0, GFP_KERNEL))
 		goto error;
 
+	spin_lock_init(&btp->bt_vmap_lock);
+	INIT_LIST_HEAD(&btp->bt_vmap_cache);
+
 	btp->bt_shrinker.count_objects = xfs_buftarg_shrink_count;
 	btp->bt_shrinker.scan_objects = xfs_buftarg_shrink_scan;
 	btp->bt_shrinker.seeks = DEFAULT_SEEKS;
-	btp->bt_shrinker.flags = SHRINKER_NUMA_AWARE;
+	btp->bt_shrinker.flags = SHRINKER_NUMA_AWARE | SHRINKER_MEMCG_AWARE;
 	register_shrinker(&btp->bt_shrinker);
 	return btp;
 
@@ -1929,6 +2503,241 @@ xfs_buf_cmp(
 	return 0;
 }
 
+/*
+ * Delwri buffer clustering.
+ *
+ * The delwri list is sorted by block number, so buffers that are adjacent on
+ * disk, such as the inode cluster buffers of one chunk or btree blocks that
+ * were allocated together, end up next to each other in it.  Rather than
+ * give each of them its own bio, gather runs of adjacent single map buffers
+ * and write each run with one bio.  Every buffer in the run holds an I/O
+ * count for the bio, and bio completion fans out to each buffer in turn.
+ * Batched readahead uses the same machinery to read runs of buffers.
+ */
+
+/* Handed to the bio so that completion can find the buffers. */
+struct xfs_buf_cluster_io {
+	int		bci_count;
+	struct xfs_buf	*bci_bufs[];
+};
+
+static void
+xfs_buf_cluster_end_io(
+	struct bio		*bio)
+{
+	struct xfs_buf_cluster_io *bci = bio->bi_private;
+	int			error = blk_status_to_errno(bio->bi_status);
+	int			i;
+
+	for (i = 0; i < bci->bci_count; i++) {
+		struct xfs_buf	*bp = bci->bci_bufs[i];
+
+		if (error)
+			cmpxchg(&bp->b_io_error, 0, error);
+		if (!error && xfs_buf_is_vmapped(bp) &&
+		    (bp->b_flags & XBF_READ))
+			invalidate_kernel_vmap_range(bp->b_addr,
+						     xfs_buf_vmap_len(bp));
+		if (atomic_dec_and_test(&bp->b_io_remaining) == 1)
+			xfs_buf_ioend_async(bp);
+	}
+	kmem_free(bci);
+	bio_put(bio);
+}
+
+static inline int
+xfs_buf_io_pages(
+	struct xfs_buf		*bp)
+{
+	return DIV_ROUND_UP(bp->b_offset + BBTOB(bp->b_io_length), PAGE_SIZE);
+}
+
+static void
+xfs_buf_cluster_add_pages(
+	struct bio		*bio,
+	struct xfs_buf		*bp)
+{
+	int			page_index = 0;
+	int			offset = bp->b_offset;
+	int			size = BBTOB(bp->b_io_length);
+	int			nbytes;
+	int			rbytes;
+
+	while (offset >= PAGE_SIZE) {
+		page_index++;
+		offset -= PAGE_SIZE;
+	}
+
+	for (; size; page_index++) {
+		nbytes = min_t(int, PAGE_SIZE - offset, size);
+		rbytes = bio_add_page(bio, bp->b_pages[page_index], nbytes,
+				      offset);
+		/* the bio was sized for every page of the run */
+		ASSERT(rbytes == nbytes);
+		offset = 0;
+		size -= nbytes;
+	}
+
+	if (xfs_buf_is_vmapped(bp))
+		flush_kernel_vmap_range(bp->b_addr, xfs_buf_vmap_len(bp));
+}
+
+/* Issue the I/O for the gathered run and start a new one. */
+static void
+xfs_buf_cluster_submit(
+	struct xfs_buf_cluster	*bc)
+{
+	struct xfs_buf_cluster_io *bci = NULL;
+	struct xfs_buf		*bp = bc->bc_bufs[0];
+	struct bio		*bio;
+	blk_qc_t		cookie;
+	int			i;
+
+	if (bc->bc_count > 1)
+		bci = kmem_alloc(sizeof(*bci) +
+				 bc->bc_count * sizeof(struct xfs_buf *),
+				 KM_NOFS | KM_MAYFAIL);
+	if (!bci) {
+		/* a single buffer, or no memory: each gets its own bios */
+		for (i = 0; i < bc->bc_count; i++) {
+			_xfs_buf_ioapply_maps(bc->bc_bufs[i], bc->bc_op,
+					      bc->bc_op_flags);
+			xfs_buf_submit_end(bc->bc_bufs[i]);
+		}
+		bc->bc_count = 0;
+		return;
+	}
+
+	bio = bio_alloc(GFP_NOIO, bc->bc_pages);
+	bio->bi_bdev = bp->b_target->bt_bdev;
+	bio->bi_iter.bi_sector = bp->b_maps[0].bm_bn;
+	bio->bi_end_io = xfs_buf_cluster_end_io;
+	bio->bi_private = bci;
+	bio_set_op_attrs(bio, bc->bc_op, bc->bc_op_flags);
+	if (bp->b_flags & XBF_IDLE_IO)
+		bio_set_prio(bio, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0));
+
+	bci->bci_count = bc->bc_count;
+	for (i = 0; i < bc->bc_count; i++) {
+		bp = bc->bc_bufs[i];
+		bci->bci_bufs[i] = bp;
+		atomic_inc(&bp->b_io_remaining);
+		xfs_buf_cluster_add_pages(bio, bp);
+	}
+	cookie = submit_bio(bio);
+
+	/* the submission references keep the buffers around until here */
+	for (i = 0; i < bc->bc_count; i++) {
+		bp = bc->bc_bufs[i];
+		bp->b_io_cookie = cookie;
+		xfs_buf_submit_end(bp);
+	}
+	bc->bc_count = 0;
+}
+
+/*
+ * Start the I/O on a locked buffer, either by adding it to the current run
+ * or by issuing the run and starting a new one.  Buffers with multiple maps
+ * are issued on their own.
+ */
+static void
+xfs_buf_cluster_add(
+	struct xfs_buf_cluster	*bc,
+	struct xfs_buf		*bp)
+{
+	struct xfs_buf		*first;
+	int			nr_pages = xfs_buf_io_pages(bp);
+	int			op;
+	int			op_flags;
+
+	if (!xfs_buf_submit_start(bp, _RET_IP_))
+		return;
+	if (_xfs_buf_ioprep(bp, &op, &op_flags)) {
+		xfs_buf_submit_end(bp);
+		return;
+	}
+
+	first = bc->bc_count ? bc->bc_bufs[0] : NULL;
+	if (first &&
+	    (bc->bc_count == XFS_BUF_CLUSTER_MAX ||
+	     bc->bc_pages + nr_pages > BIO_MAX_PAGES ||
+	     bp->b_map_count > 1 ||
+	     bp->b_maps[0].bm_bn != bc->bc_next ||
+	     bp->b_target != first->b_target ||
+	     op != bc->bc_op || op_flags != bc->bc_op_flags ||
+	     ((bp->b_flags ^ first->b_flags) & XBF_IDLE_IO)))
+		xfs_buf_cluster_submit(bc);
+
+	if (bp->b_map_count > 1) {
+		_xfs_buf_ioapply_maps(bp, op, op_flags);
+		xfs_buf_submit_end(bp);
+		return;
+	}
+
+	if (!bc->bc_count) {
+		bc->bc_pages = 0;
+		bc->bc_op = op;
+		bc->bc_op_flags = op_flags;
+	}
+	bc->bc_bufs[bc->bc_count++] = bp;
+	bc->bc_pages += nr_pages;
+	bc->bc_next = bp->b_maps[0].bm_bn + bp->b_io_length;
+}
+
+void
+xfs_buf_ra_batch_start(
+	struct xfs_buf_ra_batch	*rab)
+{
+	rab->rab_cluster.bc_count = 0;
+	blk_start_plug(&rab->rab_plug);
+}
+
+/*
+ * Queue readahead of a buffer in a batch.  Like xfs_buf_readahead_map(),
+ * this quietly does nothing if the device is congested, the buffer is
+ * locked or it is already up to date.
+ */
+void
+xfs_buf_ra_batch_map(
+	struct xfs_buf_ra_batch	*rab,
+	struct xfs_buftarg	*target,
+	struct xfs_buf_map	*map,
+	int			nmaps,
+	const struct xfs_buf_ops *ops)
+{
+	xfs_buf_flags_t		flags;
+	struct xfs_buf		*bp;
+
+	if (bdi_read_congested(target->bt_bdev->bd_bdi))
+		return;
+
+	flags = XBF_TRYLOCK | XBF_ASYNC | XBF_READ_AHEAD | XBF_READ;
+	bp = xfs_buf_get_map(target, map, nmaps, flags);
+	if (!bp)
+		return;
+	trace_xfs_buf_read(bp, flags, _RET_IP_);
+
+	if (bp->b_flags & XBF_DONE) {
+		xfs_buf_relse(bp);
+		return;
+	}
+
+	XFS_STATS_INC(target->bt_mount, xb_get_read);
+	bp->b_ops = ops;
+	bp->b_flags &= ~(XBF_WRITE | XBF_IDLE_IO);
+	bp->b_flags |= XBF_READ | XBF_ASYNC | XBF_READ_AHEAD;
+	xfs_buf_cluster_add(&rab->rab_cluster, bp);
+}
+
+void
+xfs_buf_ra_batch_finish(
+	struct xfs_buf_ra_batch	*rab)
+{
+	if (rab->rab_cluster.bc_count)
+		xfs_buf_cluster_submit(&rab->rab_cluster);
+	blk_finish_plug(&rab->rab_plug);
+}
+
 /*
  * submit buffers for write.
  *
@@ -1939,17 +2748,20 @@ xfs_buf_cmp(
  *
  * To do this, we sort the buffer list before we walk the list to lock and
  * submit buffers, and we plug and unplug around each group of buffers we
- * submit.
+ * submit.  Runs of buffers that are adjacent on disk are written with a
+ * single bio, see xfs_buf_cluster_add().
  */
 static int
 xfs_buf_delwri_submit_buffers(
 	struct list_head	*buffer_list,
-	struct list_head	*wait_list)
+	struct list_head	*wait_list,
+	xfs_buf_flags_t		io_flags)
 {
 	struct xfs_buf		*bp, *n;
 	LIST_HEAD		(submit_list);
 	int			pinned = 0;
 	struct blk_plug		plug;
+	struct xfs_buf_cluster	bc = { 0 };
 
 	list_sort(NULL, buffer_list, xfs_buf_cmp);
 
@@ -1962,7 +2774,13 @@ xfs_buf_delwri_submit_buffers(
 			}
 			if (!xfs_buf_trylock(bp))
 				continue;
-		} else {
+		} else if (!xfs_buf_trylock(bp)) {
+			/*
+			 * Don't sleep on a buffer lock while holding the
+			 * locks of buffers we haven't written yet.
+			 */
+			if (bc.bc_count)
+				xfs_buf_cluster_submit(&bc);
 			xfs_buf_lock(bp);
 		}
 
@@ -1988,15 +2806,17 @@ xfs_buf_delwri_submit_buffers(
 		 * at this point so the caller can still access it.
 		 */
 		bp->b_flags &= ~(_XBF_DELWRI_Q | XBF_WRITE_FAIL);
-		bp->b_flags |= XBF_WRITE | XBF_ASYNC;
+		bp->b_flags |= XBF_WRITE | XBF_ASYNC | io_flags;
 		if (wait_list) {
 			xfs_buf_hold(bp);
 			list_move_tail(&bp->b_list, wait_list);
 		} else
 			list_del_init(&bp->b_list);
 
-		xfs_buf_submit(bp);
+		xfs_buf_cluster_add(&bc, bp);
 	}
+	if (bc.bc_count)
+		xfs_buf_cluster_submit(&bc);
 	blk_finish_plug(&plug);
 
 	return pinned;
@@ -2010,12 +2830,17 @@ xfs_buf_delwri_submit_buffers(
  * is only safely useable for callers that can track I/O completion by higher
  * level means, e.g. AIL pushing as the @buffer_list is consumed in this
  * function.
+ *
+ * @urgent marks the writes as something other tasks are blocked on rather
+ * than background writeback, so the block layer can prioritise them.
  */
 int
 xfs_buf_delwri_submit_nowait(
-	struct list_head	*buffer_list)
+	struct list_head	*buffer_list,
+	bool			urgent)
 {
-	return xfs_buf_delwri_submit_buffers(buffer_list, NULL);
+	return xfs_buf_delwri_submit_buffers(buffer_list, NULL,
+			urgent ? XBF_PRIO_IO : XBF_BG_IO);
 }
 
 /*
@@ -2034,7 +2859,7 @@ xfs_buf_delwri_submit(
 	int			error = 0, error2;
 	struct xfs_buf		*bp;
 
-	xfs_buf_delwri_submit_buffers(buffer_list, &wait_list);
+	xfs_buf_delwri_submit_buffers(buffer_list, &wait_list, 0);
 
 	/* Wait for IO to complete. */
 	while (!list_empty(&wait_list)) {
@@ -2094,7 +2919,7 @@ xfs_buf_delwri_pushbuf(
 	 * bounce the buffer from a local wait list back to the original list
 	 * after I/O completion, reuse the original list as the wait list.
 	 */
-	xfs_buf_delwri_submit_buffers(&submit_list, buffer_list);
+	xfs_buf_delwri_submit_buffers(&submit_list, buffer_list, 0);
 
 	/*
 	 * The buffer is now under I/O and wait listed as during typical delwri
@@ -2116,13 +2941,31 @@ xfs_buf_delwri_pushbuf(
 int __init
 xfs_buf_init(void)
 {
+	int			i;
+
 	xfs_buf_zone = kmem_zone_init_flags(sizeof(xfs_buf_t), "xfs_buf",
-						KM_ZONE_HWALIGN, NULL);
+					KM_ZONE_HWALIGN | KM_ZONE_ACCOUNT, NULL);
 	if (!xfs_buf_zone)
 		goto out;
 
+	for (i = 0; i < XFS_BUF_DATA_ZONES; i++) {
+		size_t		size = BBSIZE << i;
+
+		snprintf(xfs_buf_data_zone_name[i],
+			 sizeof(xfs_buf_data_zone_name[i]),
+			 "xfs_buf_data-%zu", size);
+		xfs_buf_data_zone[i] = kmem_cache_create(
+				xfs_buf_data_zone_name[i], size, size, 0, NULL);
+		if (!xfs_buf_data_zone[i])
+			goto out_destroy_data_zones;
+	}
+
 	return 0;
 
+ out_destroy_data_zones:
+	while (--i >= 0)
+		kmem_zone_destroy(xfs_buf_data_zone[i]);
+	kmem_zone_destroy(xfs_buf_zone);
  out:
 	return -ENOMEM;
 }
@@ -2130,5 +2973,9 @@ xfs_buf_init(void)
 void
 xfs_buf_terminate(void)
 {
+	int			i;
+
+	for (i = 0; i < XFS_BUF_DATA_ZONES; i++)
+		kmem_zone_destroy(xfs_buf_data_zone[i]);
 	kmem_zone_destroy(xfs_buf_zone);
 }
@@ -53,6 +53,9 @@ typedef enum {
 #define XBF_SYNCIO	 (1 << 10)/* treat this buffer as synchronous I/O */
 #define XBF_FUA		 (1 << 11)/* force cache write through mode */
 #define XBF_FLUSH	 (1 << 12)/* flush the disk cache before a write */
+#define XBF_IDLE_IO	 (1 << 13)/* read at idle I/O priority */
+#define XBF_PRIO_IO	 (1 << 14)/* I/O is on a critical path */
+#define XBF_BG_IO	 (1 << 15)/* background metadata writeback */
 
 /* flags used only as arguments to access routines */
 #define XBF_TRYLOCK	 (1 << 16)/* lock requested, but do not wait */
@@ -63,6 +66,9 @@ typedef enum {
 #define _XBF_KMEM	 (1 << 21)/* backed by heap memory */
 #define _XBF_DELWRI_Q	 (1 << 22)/* buffer on a delwri queue */
 #define _XBF_COMPOUND	 (1 << 23)/* compound buffer */
+#define _XBF_CONTIG	 (1 << 25)/* pages are physically contiguous */
+#define _XBF_POLL	 (1 << 26)/* submitter polls for I/O completion */
+#define _XBF_VERIFIED	 (1 << 27)/* unchanged since last write verify */
 
 typedef unsigned int xfs_buf_flags_t;
 
@@ -78,12 +84,18 @@ typedef unsigned int xfs_buf_flags_t;
 	{ XBF_SYNCIO,		"SYNCIO" }, \
 	{ XBF_FUA,		"FUA" }, \
 	{ XBF_FLUSH,		"FLUSH" }, \
+	{ XBF_IDLE_IO,		"IDLE_IO" }, \
+	{ XBF_PRIO_IO,		"PRIO_IO" }, \
+	{ XBF_BG_IO,		"BG_IO" }, \
 	{ XBF_TRYLOCK,		"TRYLOCK" },	/* should never be set */\
 	{ XBF_UNMAPPED,		"UNMAPPED" },	/* ditto */\
 	{ _XBF_PAGES,		"PAGES" }, \
 	{ _XBF_KMEM,		"KMEM" }, \
 	{ _XBF_DELWRI_Q,	"DELWRI_Q" }, \
-	{ _XBF_COMPOUND,	"COMPOUND" }
+	{ _XBF_COMPOUND,	"COMPOUND" }, \
+	{ _XBF_CONTIG,		"CONTIG" }, \
+	{ _XBF_POLL,		"POLL" }, \
+	{ _XBF_VERIFIED,	"VERIFIED" }
 
 
 /*
@@ -119,8 +131,46 @@ typedef struct xfs_buftarg {
 	struct list_lru		bt_lru;
 
 	struct percpu_counter	bt_io_count;
+
+	/* cache of vmapped buffer memory for reuse */
+	spinlock_t		bt_vmap_lock;
+	struct list_head	bt_vmap_cache;
+	int			bt_vmap_count;
+
+	/*
+	 * Cache flush tracking: bt_write_seq counts completed writes that may
+	 * still be in the device's volatile write cache, and bt_flush_seq is
+	 * the value it had when the last successful cache flush was issued.
+	 */
+	atomic_t		bt_write_seq;
+	atomic_t		bt_flush_seq;
 } xfs_buftarg_t;
 
+/* Note that a write to the device completed without FUA. */
+static inline void
+xfs_buftarg_write_done(
+	struct xfs_buftarg	*btp)
+{
+	atomic_inc(&btp->bt_write_seq);
+	smp_mb__after_atomic();
+}
+
+/*
+ * Does the device cache hold completed writes that no flush has covered yet?
+ * *seq is what to pass to xfs_buftarg_flushed once such a flush completes.
+ */
+static inline bool
+xfs_buftarg_needs_flush(
+	struct xfs_buftarg	*btp,
+	int			*seq)
+{
+	smp_mb();
+	*seq = atomic_read(&btp->bt_write_seq);
+	return *seq != atomic_read(&btp->bt_flush_seq);
+}
+
+extern void xfs_buftarg_flushed(struct xfs_buftarg *, int);
+
 struct xfs_buf;
 typedef void (*xfs_buf_iodone_t)(struct xfs_buf *);
 
@@ -141,6 +191,30 @@ struct xfs_buf_ops {
 	void (*verify_write)(struct xfs_buf *);
 };
 
+/*
+ * Async write failure retry state. Only buffers whose writes have failed need
+ * this, so it is allocated on the first failure and freed again once the
+ * buffer has been written successfully.
+ *
+ * br_retries is zero on the first failure, then when it exceeds the maximum
+ * configured without a success the write is considered to be failed
+ * permanently and the iodone handler will take appropriate action.
+ *
+ * For retry timeouts, we record the jiffie of the first failure. This means
+ * that we can change the retry timeout for buffers already under I/O and thus
+ * avoid getting stuck in a retry loop with a long timeout.
+ *
+ * br_last_error is used to ensure that we are getting repeated errors, not
+ * different errors. e.g. a block device might change ENOSPC to EIO when a
+ * failure timeout occurs, so we want to re-initialise the error retry
+ * behaviour appropriately when that happens.
+ */
+struct xfs_buf_retry {
+	int			br_retries;
+	int			br_last_error;
+	unsigned long		br_first_retry_time; /* in jiffies */
+};
+
 typedef struct xfs_buf {
 	/*
 	 * first cacheline holds all the fields needed for an uncontended cache
@@ -165,7 +239,6 @@ typedef struct xfs_buf {
 	spinlock_t		b_lock;		/* internal state lock */
 	unsigned int		b_state;	/* internal state flags */
 	int			b_io_error;	/* internal IO error state */
-	wait_queue_head_t	b_waiters;	/* unpin waiters */
 	struct list_head	b_list;
 	struct xfs_perag	*b_pag;		/* contains rbtree root */
 	xfs_buftarg_t		*b_target;	/* buffer target (device) */
@@ -182,30 +255,16 @@ typedef struct xfs_buf {
 	struct xfs_buf_map	__b_map;	/* inline compound buffer map */
 	int			b_map_count;
 	int			b_io_length;	/* IO size in BBs */
+	ktime_t			b_io_start;	/* IO submission time */
+	int			b_io_cpu;	/* CPU the IO was submitted on */
 	atomic_t		b_pin_count;	/* pin count */
 	atomic_t		b_io_remaining;	/* #outstanding I/O requests */
+	blk_qc_t		b_io_cookie;	/* last bio, for polling */
 	unsigned int		b_page_count;	/* size of page array */
 	unsigned int		b_offset;	/* page offset in first page */
 	int			b_error;	/* error code on I/O */
-
-	/*
-	 * async write failure retry count. Initialised to zero on the first
-	 * failure, then when it exceeds the maximum configured without a
-	 * success the write is considered to be failed permanently and the
-	 * iodone handler will take appropriate action.
-	 *
-	 * For retry timeouts, we record the jiffie of the first failure. This
-	 * means that we can change the retry timeout for buffers already under
-	 * I/O and thus avoid getting stuck in a retry loop with a long timeout.
-	 *
-	 * last_error is used to ensure that we are getting repeated errors, not
-	 * different errors. e.g. a block device might change ENOSPC to EIO when
-	 * a failure timeout occurs, so we want to re-initialise the error
-	 * retry behaviour appropriately when that happens.
-	 */
-	int			b_retries;
-	unsigned long		b_first_retry_time; /* in jiffies */
-	int			b_last_error;
+	int			b_nid;		/* NUMA node for memory */
+	struct xfs_buf_retry	*b_retry;	/* async write retry state */
 
 	const struct xfs_buf_ops	*b_ops;
 
@@ -255,6 +314,42 @@ struct xfs_buf *xfs_buf_read_map(struct xfs_buftarg *target,
 void xfs_buf_readahead_map(struct xfs_buftarg *target,
 			       struct xfs_buf_map *map, int nmaps,
 			       const struct xfs_buf_ops *ops);
+void xfs_buf_readahead_idle(struct xfs_buftarg *target, xfs_daddr_t blkno,
+			    size_t numblks, const struct xfs_buf_ops *ops);
+
+/*
+ * A run of buffers adjacent on disk that is issued with a single bio, see
+ * xfs_buf_cluster_add().
+ */
+#define XFS_BUF_CLUSTER_MAX	16
+
+struct xfs_buf_cluster {
+	int		bc_count;
+	int		bc_pages;
+	int		bc_op;
+	int		bc_op_flags;
+	xfs_daddr_t	bc_next;	/* daddr after the last buffer */
+	struct xfs_buf	*bc_bufs[XFS_BUF_CLUSTER_MAX];
+};
+
+/*
+ * Batched readahead.  Readahead queued between xfs_buf_ra_batch_start() and
+ * xfs_buf_ra_batch_finish() is issued under a single plug, and buffers that
+ * are adjacent on disk are read with one bio.  Queued buffers may stay
+ * locked until the batch is finished, so the caller must not try to read
+ * them before then.
+ */
+struct xfs_buf_ra_batch {
+	struct blk_plug		rab_plug;
+	struct xfs_buf_cluster	rab_cluster;
+};
+
+void xfs_buf_ra_batch_start(struct xfs_buf_ra_batch *rab);
+void xfs_buf_ra_batch_map(struct xfs_buf_ra_batch *rab,
+			  struct xfs_buftarg *target,
+			  struct xfs_buf_map *map, int nmaps,
+			  const struct xfs_buf_ops *ops);
+void xfs_buf_ra_batch_finish(struct xfs_buf_ra_batch *rab);
 
 static inline struct xfs_buf *
 xfs_buf_get(
@@ -290,6 +385,18 @@ xfs_buf_readahead(
 	return xfs_buf_readahead_map(target, &map, 1, ops);
 }
 
+static inline void
+xfs_buf_ra_batch_add(
+	struct xfs_buf_ra_batch	*rab,
+	struct xfs_buftarg	*target,
+	xfs_daddr_t		blkno,
+	size_t			numblks,
+	const struct xfs_buf_ops *ops)
+{
+	DEFINE_SINGLE_BUF_MAP(map, blkno, numblks);
+	xfs_buf_ra_batch_map(rab, target, &map, 1, ops);
+}
+
 void xfs_buf_set_empty(struct xfs_buf *bp, size_t numblks);
 int xfs_buf_associate_memory(struct xfs_buf *bp, void *mem, size_t length);
 
@@ -331,12 +438,13 @@ extern void xfs_buf_stale(struct xfs_buf *bp);
 extern void xfs_buf_delwri_cancel(struct list_head *);
 extern bool xfs_buf_delwri_queue(struct xfs_buf *, struct list_head *);
 extern int xfs_buf_delwri_submit(struct list_head *);
-extern int xfs_buf_delwri_submit_nowait(struct list_head *);
+extern int xfs_buf_delwri_submit_nowait(struct list_head *, bool);
 extern int xfs_buf_delwri_pushbuf(struct xfs_buf *, struct list_head *);
 
 /* Buffer Daemon Setup Routines */
 extern int xfs_buf_init(void);
 extern void xfs_buf_terminate(void);
+extern const char *xfs_buf_io_type_name(int type);
 
 /*
  * These macros use the IO block map rather than b_bn. b_bn is now really
@@ -387,6 +495,7 @@ xfs_buf_update_cksum(struct xfs_buf *bp, unsigned long cksum_offset)
 extern xfs_buftarg_t *xfs_alloc_buftarg(struct xfs_mount *,
 			struct block_device *);
 extern void xfs_free_buftarg(struct xfs_mount *, struct xfs_buftarg *);
+extern void xfs_buftarg_wait_io(struct xfs_buftarg *);
 extern void xfs_wait_buftarg(xfs_buftarg_t *);
 extern int xfs_setsize_buftarg(xfs_buftarg_t *, unsigned int);
 
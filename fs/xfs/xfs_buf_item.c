@@ -32,6 +32,7 @@
 
 
 kmem_zone_t	*xfs_buf_item_zone;
+mempool_t	*xfs_buf_item_pool;
 
 static inline struct xfs_buf_log_item *BUF_ITEM(struct xfs_log_item *lip)
 {
@@ -73,6 +74,28 @@ xfs_buf_item_size_segment(
 	if (last_bit == -1)
 		return;
 
+	/*
+	 * A mapped buffer is virtually contiguous, so every run of dirty
+	 * chunks becomes exactly one region and we can count whole runs at a
+	 * time instead of scanning the bitmap bit by bit.
+	 */
+	if (bp->b_addr) {
+		int		nbits;
+
+		*nvecs += 1;
+		*nbytes += xfs_buf_log_format_size(blfp);
+		do {
+			nbits = xfs_contig_bits(blfp->blf_data_map,
+					blfp->blf_map_size, last_bit);
+			ASSERT(nbits > 0);
+			(*nvecs)++;
+			*nbytes += nbits * XFS_BLF_CHUNK;
+			last_bit = xfs_next_bit(blfp->blf_data_map,
+					blfp->blf_map_size, last_bit + nbits);
+		} while (last_bit != -1);
+		return;
+	}
+
 	/*
 	 * initial count for a dirty buffer is 2 vectors - the format structure
 	 * and the first dirty region.
@@ -259,8 +282,23 @@ xfs_buf_item_format_segment(
 
 
 	/*
-	 * Fill in an iovec for each set of contiguous chunks.
+	 * Fill in an iovec for each set of contiguous chunks.  Runs in a
+	 * mapped buffer can't straddle a page boundary, so copy them whole.
 	 */
+	if (bp->b_addr) {
+		do {
+			nbits = xfs_contig_bits(blfp->blf_data_map,
+					blfp->blf_map_size, first_bit);
+			ASSERT(nbits > 0);
+			xfs_buf_item_copy_iovec(lv, vecp, bp, offset,
+						first_bit, nbits);
+			blfp->blf_size++;
+			first_bit = xfs_next_bit(blfp->blf_data_map,
+					blfp->blf_map_size, first_bit + nbits);
+		} while (first_bit != -1);
+		return;
+	}
+
 	last_bit = first_bit;
 	nbits = 1;
 	for (;;) {
@@ -426,7 +464,7 @@ xfs_buf_item_unpin(
 	freed = atomic_dec_and_test(&bip->bli_refcount);
 
 	if (atomic_dec_and_test(&bp->b_pin_count))
-		wake_up_all(&bp->b_waiters);
+		wake_up_atomic_t(&bp->b_pin_count);
 
 	if (freed && stale) {
 		ASSERT(bip->bli_flags & XFS_BLI_STALE);
@@ -698,6 +736,18 @@ xfs_buf_item_committing(
 {
 }
 
+/*
+ * The buffer is locked for the duration of the I/O and so cannot have been
+ * relogged while it was being written. Hence a completed write always cleans
+ * the buf log item and it can always be removed from the AIL.
+ */
+STATIC bool
+xfs_buf_item_written(
+	struct xfs_log_item	*lip)
+{
+	return true;
+}
+
 /*
  * This is the ops vector shared by all buf log items.
  */
@@ -709,7 +759,8 @@ static const struct xfs_item_ops xfs_buf_item_ops = {
 	.iop_unlock	= xfs_buf_item_unlock,
 	.iop_committed	= xfs_buf_item_committed,
 	.iop_push	= xfs_buf_item_push,
-	.iop_committing = xfs_buf_item_committing
+	.iop_committing = xfs_buf_item_committing,
+	.iop_written	= xfs_buf_item_written,
 };
 
 STATIC int
@@ -771,7 +822,7 @@ xfs_buf_item_init(
 	if (lip != NULL && lip->li_type == XFS_LI_BUF)
 		return 0;
 
-	bip = kmem_zone_zalloc(xfs_buf_item_zone, KM_SLEEP);
+	bip = kmem_pool_zalloc(xfs_buf_item_pool, sizeof(*bip), KM_SLEEP);
 	xfs_log_item_init(mp, &bip->bli_item, XFS_LI_BUF, &xfs_buf_item_ops);
 	bip->bli_buf = bp;
 
@@ -787,7 +838,7 @@ xfs_buf_item_init(
 	error = xfs_buf_item_get_format(bip, bp->b_map_count);
 	ASSERT(error == 0);
 	if (error) {	/* to stop gcc throwing set-but-unused warnings */
-		kmem_zone_free(xfs_buf_item_zone, bip);
+		kmem_pool_free(xfs_buf_item_pool, bip);
 		return error;
 	}
 
@@ -961,7 +1012,7 @@ xfs_buf_item_free(
 {
 	xfs_buf_item_free_format(bip);
 	kmem_free(bip->bli_item.li_lv_shadow);
-	kmem_zone_free(xfs_buf_item_zone, bip);
+	kmem_pool_free(xfs_buf_item_pool, bip);
 }
 
 /*
@@ -1023,16 +1074,66 @@ xfs_buf_attach_iodone(
 }
 
 /*
- * We can have many callbacks on a buffer. Running the callbacks individually
- * can cause a lot of contention on the AIL lock, so we allow for a single
- * callback to be able to scan the remaining lip->li_bio_list for other items
- * of the same type and callback to be processed in the first call.
+ * Remove all the log items attached to the buffer that were cleaned by the
+ * write from the AIL.
+ *
+ * We can have many items attached to a buffer, and removing them from the AIL
+ * individually in each item's callback causes a lot of contention on the AIL
+ * lock. Instead, we ask each item whether the write cleaned it via
+ * ->iop_written and remove all the clean items in a single AIL lock round
+ * trip, moving the log tail at most once for the whole buffer. The item
+ * callbacks run afterwards and only need to clean up the rest of their state.
+ *
+ * An item that claims to have been cleaned but is not in the AIL indicates
+ * in-memory corruption unless we are already shutting down, as a forced
+ * shutdown may have removed items from the AIL before their I/O completed.
+ */
+STATIC void
+xfs_buf_ail_delete_items(
+	struct xfs_buf		*bp)
+{
+	struct xfs_log_item	*lip = bp->b_fspriv;
+	struct xfs_mount	*mp;
+	struct xfs_ail		*ailp;
+	bool			mlip_changed = false;
+	bool			missing = false;
+
+	if (!lip)
+		return;
+	mp = lip->li_mountp;
+	ailp = lip->li_ailp;
+
+	spin_lock(&ailp->xa_lock);
+	for (; lip; lip = lip->li_bio_list) {
+		if (!lip->li_ops->iop_written ||
+		    !lip->li_ops->iop_written(lip))
+			continue;
+		if (!(lip->li_flags & XFS_LI_IN_AIL)) {
+			missing = true;
+			continue;
+		}
+		mlip_changed |= xfs_ail_delete_one(ailp, lip);
+	}
+	xfs_ail_update_finish(ailp, mlip_changed);
+
+	if (missing && !XFS_FORCED_SHUTDOWN(mp)) {
+		xfs_alert_tag(mp, XFS_PTAG_AILDELETE,
+	"%s: attempting to delete a log item that is not in the AIL",
+				__func__);
+		xfs_force_shutdown(mp, SHUTDOWN_CORRUPT_INCORE);
+	}
+}
+
+/*
+ * Run the I/O completion callbacks of all the items attached to the buffer.
+ * All the AIL removals for the buffer are done up front in one batch, so the
+ * callbacks themselves do not need to touch the AIL.
  *
- * As a result, the loop walking the callback list below will also modify the
- * list. it removes the first item from the list and then runs the callback.
- * The loop then restarts from the new head of the list. This allows the
- * callback to scan and modify the list attached to the buffer and we don't
- * have to care about maintaining a next item pointer.
+ * The loop walking the callback list below also modifies the list: it removes
+ * the first item from the list and then runs the callback. The loop then
+ * restarts from the new head of the list. This allows a callback to scan and
+ * modify the list attached to the buffer and we don't have to care about
+ * maintaining a next item pointer.
  */
 STATIC void
 xfs_buf_do_callbacks(
@@ -1040,6 +1141,8 @@ xfs_buf_do_callbacks(
 {
 	struct xfs_log_item	*lip;
 
+	xfs_buf_ail_delete_items(bp);
+
 	while ((lip = bp->b_fspriv) != NULL) {
 		bp->b_fspriv = lip->li_bio_list;
 		ASSERT(lip->li_cb != NULL);
@@ -1063,6 +1166,7 @@ xfs_buf_iodone_callback_error(
 	static ulong		lasttime;
 	static xfs_buftarg_t	*lasttarg;
 	struct xfs_error_cfg	*cfg;
+	struct xfs_buf_retry	*retry;
 
 	/*
 	 * If we've already decided to shutdown the filesystem because of
@@ -1087,20 +1191,37 @@ xfs_buf_iodone_callback_error(
 
 	cfg = xfs_error_get_cfg(mp, XFS_ERR_METADATA, bp->b_error);
 
+	/*
+	 * Retry state is only allocated once a write has failed. If we can't
+	 * get the memory for it, leave the error as a transient one and let
+	 * the higher layers retry the write - we'll try again then.
+	 */
+	if (!bp->b_retry)
+		bp->b_retry = kmem_zalloc(sizeof(struct xfs_buf_retry),
+					  KM_NOFS | KM_MAYFAIL);
+	retry = bp->b_retry;
+	if (!retry)
+		goto out_transient;
+
 	/*
 	 * If the write was asynchronous then no one will be looking for the
 	 * error.  If this is the first failure of this type, clear the error
 	 * state and write the buffer out again. This means we always retry an
 	 * async write failure at least once, but we also need to set the buffer
 	 * up to behave correctly now for repeated failures.
+	 *
+	 * The buffer has stayed locked since the write verifier ran on it, so
+	 * the resubmission can skip the verifier and CRC calculation.
 	 */
 	if (!(bp->b_flags & (XBF_STALE | XBF_WRITE_FAIL)) ||
-	     bp->b_last_error != bp->b_error) {
+	     retry->br_last_error != bp->b_error) {
 		bp->b_flags |= (XBF_WRITE | XBF_DONE | XBF_WRITE_FAIL);
-		bp->b_last_error = bp->b_error;
+		if (bp->b_ops)
+			bp->b_flags |= _XBF_VERIFIED;
+		retry->br_last_error = bp->b_error;
 		if (cfg->retry_timeout != XFS_ERR_RETRY_FOREVER &&
-		    !bp->b_first_retry_time)
-			bp->b_first_retry_time = jiffies;
+		    !retry->br_first_retry_time)
+			retry->br_first_retry_time = jiffies;
 
 		xfs_buf_ioerror(bp, 0);
 		xfs_buf_submit(bp);
@@ -1113,10 +1234,11 @@ xfs_buf_iodone_callback_error(
 	 */
 
 	if (cfg->max_retries != XFS_ERR_RETRY_FOREVER &&
-	    ++bp->b_retries > cfg->max_retries)
+	    ++retry->br_retries > cfg->max_retries)
 			goto permanent_error;
 	if (cfg->retry_timeout != XFS_ERR_RETRY_FOREVER &&
-	    time_after(jiffies, cfg->retry_timeout + bp->b_first_retry_time))
+	    time_after(jiffies,
+		       cfg->retry_timeout + retry->br_first_retry_time))
 			goto permanent_error;
 
 	/* At unmount we may treat errors differently */
@@ -1124,6 +1246,7 @@ xfs_buf_iodone_callback_error(
 		goto permanent_error;
 
 	/* still a transient error, higher layers will retry */
+out_transient:
 	xfs_buf_ioerror(bp, 0);
 	xfs_buf_relse(bp);
 	return true;
@@ -1163,9 +1286,10 @@ xfs_buf_iodone_callbacks(
 	 * Successful IO or permanent error. Either way, we can clear the
 	 * retry state here in preparation for the next error that may occur.
 	 */
-	bp->b_last_error = 0;
-	bp->b_retries = 0;
-	bp->b_first_retry_time = 0;
+	if (bp->b_retry) {
+		kmem_free(bp->b_retry);
+		bp->b_retry = NULL;
+	}
 
 	xfs_buf_do_callbacks(bp);
 	bp->b_fspriv = NULL;
@@ -1176,31 +1300,25 @@ xfs_buf_iodone_callbacks(
 /*
  * This is the iodone() function for buffers which have been
  * logged.  It is called when they are eventually flushed out.
- * It should remove the buf item from the AIL, and free the buf item.
- * It is called by xfs_buf_iodone_callbacks() above which will take
- * care of cleaning up the buffer itself.
+ * It should free the buf item. It is called by xfs_buf_do_callbacks()
+ * above, which has already removed the buf item from the AIL, and
+ * xfs_buf_iodone_callbacks() will take care of cleaning up the buffer
+ * itself.
+ *
+ * If we are forcibly shutting down, the item may well have been off the
+ * AIL already. That's because we simulate the log-committed callbacks to
+ * unpin these buffers. Or we may never have put this item on AIL because
+ * of the transaction was aborted forcibly. xfs_buf_ail_delete_items()
+ * takes care of these.
  */
 void
 xfs_buf_iodone(
 	struct xfs_buf		*bp,
 	struct xfs_log_item	*lip)
 {
-	struct xfs_ail		*ailp = lip->li_ailp;
-
 	ASSERT(BUF_ITEM(lip)->bli_buf == bp);
+	ASSERT(!(lip->li_flags & XFS_LI_IN_AIL));
 
 	xfs_buf_rele(bp);
-
-	/*
-	 * If we are forcibly shutting down, this may well be
-	 * off the AIL already. That's because we simulate the
-	 * log-committed callbacks to unpin these buffers. Or we may never
-	 * have put this item on AIL because of the transaction was
-	 * aborted forcibly. xfs_trans_ail_delete() takes care of these.
-	 *
-	 * Either way, AIL is useless if we're forcing a shutdown.
-	 */
-	spin_lock(&ailp->xa_lock);
-	xfs_trans_ail_delete(ailp, lip, SHUTDOWN_CORRUPT_INCORE);
 	xfs_buf_item_free(BUF_ITEM(lip));
 }
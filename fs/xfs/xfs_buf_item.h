@@ -72,5 +72,6 @@ void	xfs_buf_iodone_callbacks(struct xfs_buf *);
 void	xfs_buf_iodone(struct xfs_buf *, struct xfs_log_item *);
 
 extern kmem_zone_t	*xfs_buf_item_zone;
+extern mempool_t	*xfs_buf_item_pool;
 
 #endif	/* __XFS_BUF_ITEM_H__ */
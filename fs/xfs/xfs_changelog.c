@@ -0,0 +1,189 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_log.h"
+#include "xfs_log_priv.h"
+#include "xfs_changelog.h"
+
+/*
+ * Change tracking.
+ *
+ * When mounted with the changelog option, every inode that is part of a
+ * checkpoint is recorded in a per-mount ring together with the LSN of the
+ * checkpoint once that checkpoint is on stable storage.  Checkpoints complete
+ * in LSN order, so the ring is sorted by LSN and a consumer can keep its
+ * place with just an LSN and a count of the changes it has already seen at
+ * that LSN.  Because LSNs keep increasing across mounts, a consumer can store
+ * that cursor and carry on from it after a remount.
+ *
+ * The ring lives in memory only.  Changes made before it was set up at mount
+ * time or pushed out of it by newer changes are lost; cl_lost_lsn tracks the
+ * oldest LSN from which the ring is still complete, and a consumer whose
+ * cursor is older than that is told to fall back to a full scan.
+ */
+
+/*
+ * Set up the ring after the log is running.  The current log head is the
+ * boundary: checkpoints still in flight below it may complete before the
+ * ring is published and so might be missed.
+ */
+int
+xfs_changelog_init(
+	struct xfs_mount	*mp)
+{
+	struct xfs_changelog	*cl;
+	struct xlog		*log = mp->m_log;
+
+	if (!(mp->m_flags & XFS_MOUNT_CHANGELOG))
+		return 0;
+
+	cl = kmem_zalloc(sizeof(*cl), KM_SLEEP);
+	cl->cl_size = XFS_CHANGELOG_RECS;
+	cl->cl_recs = kmem_zalloc_large(cl->cl_size * sizeof(*cl->cl_recs),
+			KM_SLEEP | KM_MAYFAIL);
+	if (!cl->cl_recs) {
+		kmem_free(cl);
+		return -ENOMEM;
+	}
+	spin_lock_init(&cl->cl_lock);
+
+	spin_lock(&log->l_icloglock);
+	cl->cl_lost_lsn = xlog_assign_lsn(log->l_curr_cycle,
+			log->l_curr_block);
+	spin_unlock(&log->l_icloglock);
+
+	smp_store_release(&mp->m_changelog, cl);
+	return 0;
+}
+
+/* Tear down the ring once no more checkpoints can complete. */
+void
+xfs_changelog_free(
+	struct xfs_mount	*mp)
+{
+	struct xfs_changelog	*cl = mp->m_changelog;
+
+	if (!cl)
+		return;
+	mp->m_changelog = NULL;
+	kmem_free(cl->cl_recs);
+	kmem_free(cl);
+}
+
+void
+__xfs_changelog_add(
+	struct xfs_changelog	*cl,
+	xfs_ino_t		ino,
+	xfs_lsn_t		lsn)
+{
+	struct xfs_changelog_rec *rec;
+
+	spin_lock(&cl->cl_lock);
+	rec = &cl->cl_recs[cl->cl_head & (cl->cl_size - 1)];
+	if (cl->cl_head >= cl->cl_size &&
+	    XFS_LSN_CMP(rec->lsn, cl->cl_lost_lsn) >= 0)
+		cl->cl_lost_lsn = rec->lsn + 1;
+	rec->lsn = lsn;
+	rec->ino = ino;
+	cl->cl_head++;
+	spin_unlock(&cl->cl_lock);
+}
+
+static inline struct xfs_changelog_rec *
+xfs_changelog_rec(
+	struct xfs_changelog	*cl,
+	uint64_t		seq)
+{
+	return &cl->cl_recs[seq & (cl->cl_size - 1)];
+}
+
+/*
+ * Copy out up to *count changes after the cursor (*lsn, *offset) and advance
+ * the cursor past them.  XFS_CHANGES_LOST is set in *flags if changes after
+ * the cursor have been lost, and XFS_CHANGES_DONE once the consumer has
+ * caught up with the ring.
+ */
+int
+xfs_changelog_read(
+	struct xfs_mount	*mp,
+	xfs_lsn_t		*lsn,
+	__u32			*offset,
+	struct xfs_change	*changes,
+	__u32			*count,
+	__u32			*flags)
+{
+	struct xfs_changelog	*cl = mp->m_changelog;
+	struct xfs_changelog_rec *rec;
+	uint64_t		first;
+	uint64_t		lo, hi, mid;
+	uint64_t		seq;
+	__u32			skip = *offset;
+	__u32			nr = 0;
+
+	if (!cl)
+		return -EOPNOTSUPP;
+
+	*flags = 0;
+	spin_lock(&cl->cl_lock);
+	first = cl->cl_head > cl->cl_size ? cl->cl_head - cl->cl_size : 0;
+	if (XFS_LSN_CMP(*lsn, cl->cl_lost_lsn) < 0) {
+		*flags |= XFS_CHANGES_LOST;
+		skip = 0;
+	}
+
+	/* Find the first change at or after the cursor LSN. */
+	lo = first;
+	hi = cl->cl_head;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (XFS_LSN_CMP(xfs_changelog_rec(cl, mid)->lsn, *lsn) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (seq = lo; skip && seq < cl->cl_head; seq++, skip--) {
+		if (xfs_changelog_rec(cl, seq)->lsn != *lsn)
+			break;
+	}
+
+	for (; nr < *count && seq < cl->cl_head; seq++, nr++) {
+		rec = xfs_changelog_rec(cl, seq);
+		changes[nr].ch_lsn = rec->lsn;
+		changes[nr].ch_ino = rec->ino;
+	}
+
+	/* The new offset counts every change at the last LSN handed out. */
+	if (nr) {
+		*lsn = changes[nr - 1].ch_lsn;
+		for (*offset = 0; seq > first; seq--, (*offset)++) {
+			if (xfs_changelog_rec(cl, seq - 1)->lsn != *lsn)
+				break;
+		}
+		seq += *offset;
+	}
+	if (seq == cl->cl_head)
+		*flags |= XFS_CHANGES_DONE;
+	spin_unlock(&cl->cl_lock);
+
+	*count = nr;
+	return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef __XFS_CHANGELOG_H__
+#define __XFS_CHANGELOG_H__
+
+struct xfs_mount;
+struct xfs_change;
+
+/* Number of records kept when the changelog mount option is given. */
+#define XFS_CHANGELOG_RECS	(1U << 18)
+
+/* Most changes returned by one XFS_IOC_GET_CHANGES call. */
+#define XFS_CHANGES_MAX		4096
+
+struct xfs_changelog_rec {
+	xfs_lsn_t		lsn;
+	xfs_ino_t		ino;
+};
+
+struct xfs_changelog {
+	spinlock_t		cl_lock;
+	struct xfs_changelog_rec *cl_recs;
+	unsigned int		cl_size;	/* records, power of two */
+	uint64_t		cl_head;	/* records ever added */
+	xfs_lsn_t		cl_lost_lsn;	/* all changes at or after
+						 * this are in the ring */
+};
+
+int xfs_changelog_init(struct xfs_mount *mp);
+void xfs_changelog_free(struct xfs_mount *mp);
+void __xfs_changelog_add(struct xfs_changelog *cl, xfs_ino_t ino,
+		xfs_lsn_t lsn);
+int xfs_changelog_read(struct xfs_mount *mp, xfs_lsn_t *lsn, __u32 *offset,
+		struct xfs_change *changes, __u32 *count, __u32 *flags);
+
+/* Record that the inode changed in the checkpoint committed at lsn. */
+static inline void
+xfs_changelog_add(
+	struct xfs_mount	*mp,
+	xfs_ino_t		ino,
+	xfs_lsn_t		lsn)
+{
+	struct xfs_changelog	*cl = smp_load_acquire(&mp->m_changelog);
+
+	if (cl)
+		__xfs_changelog_add(cl, ino, lsn);
+}
+
+#endif	/* __XFS_CHANGELOG_H__ */
@@ -0,0 +1,328 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_sb.h"
+#include "xfs_mount.h"
+#include "xfs_defer.h"
+#include "xfs_inode.h"
+#include "xfs_btree.h"
+#include "xfs_alloc_btree.h"
+#include "xfs_alloc.h"
+#include "xfs_rmap.h"
+#include "xfs_rmap_btree.h"
+#include "xfs_bmap.h"
+#include "xfs_icache.h"
+#include "xfs_reflink.h"
+#include "xfs_compact.h"
+#include "xfs_trace.h"
+
+/*
+ * Free space compaction.
+ *
+ * An aged AG often has plenty of free space but no long free extents,
+ * because the free space is chopped up by small extents of file data.
+ * We walk the by-block free space btree looking for short runs of used
+ * blocks sitting between two free extents, ask the rmapbt who owns them
+ * and, if they are all plain written file data, move that data to another
+ * AG through the CoW fork.  Once the old blocks are freed the free extents
+ * on either side merge into one.
+ *
+ * The AGF is only held while a batch of candidates is gathered; the data
+ * is moved with no AG headers locked, and the inode is rechecked under its
+ * own locks before anything is moved, so the service coexists with normal
+ * allocation in the AG.
+ */
+
+/* Maximum number of extents gathered for relocation in one batch. */
+#define XFS_COMPACT_BATCH	64
+
+/* Maximum number of free space records looked at with the AGF locked. */
+#define XFS_COMPACT_SCAN	1024
+
+/* Default size of the largest used run we'll move to merge free space. */
+#define XFS_COMPACT_MAXGAP	16
+
+struct xfs_compact_ext {
+	xfs_ino_t		ce_ino;
+	struct xfs_bmbt_irec	ce_irec;
+};
+
+struct xfs_compact_info {
+	struct xfs_compact_ext	*exts;
+	xfs_agnumber_t		agno;
+	int			nr;
+	bool			movable;
+};
+
+/* Collect the owners of one used run, or decide that we can't move it. */
+STATIC int
+xfs_compact_gap_helper(
+	struct xfs_btree_cur	*cur,
+	struct xfs_rmap_irec	*rec,
+	void			*priv)
+{
+	struct xfs_compact_info	*info = priv;
+	struct xfs_compact_ext	*ce;
+
+	if (XFS_RMAP_NON_INODE_OWNER(rec->rm_owner) ||
+	    (rec->rm_flags & (XFS_RMAP_ATTR_FORK | XFS_RMAP_BMBT_BLOCK |
+			      XFS_RMAP_UNWRITTEN)) ||
+	    info->nr == XFS_COMPACT_BATCH) {
+		info->movable = false;
+		return XFS_BTREE_QUERY_RANGE_ABORT;
+	}
+
+	ce = &info->exts[info->nr++];
+	ce->ce_ino = rec->rm_owner;
+	ce->ce_irec.br_startoff = rec->rm_offset;
+	ce->ce_irec.br_startblock = XFS_AGB_TO_FSB(cur->bc_mp, info->agno,
+			rec->rm_startblock);
+	ce->ce_irec.br_blockcount = rec->rm_blockcount;
+	ce->ce_irec.br_state = XFS_EXT_NORM;
+	return 0;
+}
+
+/*
+ * Walk the by-block free space btree from *agbno and gather the file data
+ * extents in used runs of no more than maxgap blocks that sit between two
+ * free extents and are no longer than the free space they would join.  On
+ * return *agbno is where the next batch should start, or NULLAGBLOCK if
+ * we've reached the end of the AG.
+ */
+STATIC int
+xfs_compact_gather(
+	struct xfs_mount	*mp,
+	struct xfs_compact_info	*info,
+	xfs_extlen_t		maxgap,
+	xfs_agblock_t		*agbno)
+{
+	struct xfs_rmap_irec	low = { 0 };
+	struct xfs_rmap_irec	high;
+	struct xfs_btree_cur	*cur;
+	struct xfs_btree_cur	*rcur;
+	struct xfs_buf		*agbp;
+	xfs_agblock_t		pbno;
+	xfs_extlen_t		plen;
+	xfs_agblock_t		fbno;
+	xfs_extlen_t		flen;
+	xfs_agblock_t		gbno;
+	xfs_extlen_t		glen;
+	int			scan = XFS_COMPACT_SCAN;
+	int			nr;
+	int			i;
+	int			error;
+
+	info->nr = 0;
+	error = xfs_alloc_read_agf(mp, NULL, info->agno, 0, &agbp);
+	if (error)
+		return error;
+	if (!agbp) {
+		*agbno = NULLAGBLOCK;
+		return 0;
+	}
+
+	cur = xfs_allocbt_init_cursor(mp, NULL, agbp, info->agno,
+			XFS_BTNUM_BNO);
+	rcur = xfs_rmapbt_init_cursor(mp, NULL, agbp, info->agno);
+
+	error = xfs_alloc_lookup_ge(cur, *agbno, 0, &i);
+	if (error)
+		goto out_del_cursors;
+	if (!i) {
+		*agbno = NULLAGBLOCK;
+		goto out_del_cursors;
+	}
+	error = xfs_alloc_get_rec(cur, &pbno, &plen, &i);
+	if (error)
+		goto out_del_cursors;
+	XFS_WANT_CORRUPTED_GOTO(mp, i == 1, out_del_cursors);
+
+	memset(&high, 0xFF, sizeof(high));
+	while (--scan >= 0) {
+		*agbno = pbno;
+		error = xfs_btree_increment(cur, 0, &i);
+		if (error)
+			goto out_del_cursors;
+		if (!i) {
+			*agbno = NULLAGBLOCK;
+			break;
+		}
+		error = xfs_alloc_get_rec(cur, &fbno, &flen, &i);
+		if (error)
+			goto out_del_cursors;
+		XFS_WANT_CORRUPTED_GOTO(mp, i == 1, out_del_cursors);
+
+		gbno = pbno + plen;
+		glen = fbno - gbno;
+		if (glen > maxgap || glen > plen + flen)
+			goto next;
+
+		/* Stop here if the batch might not have room for the run. */
+		if (info->nr + glen > XFS_COMPACT_BATCH && info->nr > 0)
+			break;
+
+		low.rm_startblock = gbno;
+		high.rm_startblock = fbno - 1;
+		nr = info->nr;
+		info->movable = true;
+		error = xfs_rmap_query_range(rcur, &low, &high,
+				xfs_compact_gap_helper, info);
+		if (error && error != XFS_BTREE_QUERY_RANGE_ABORT)
+			goto out_del_cursors;
+		error = 0;
+		if (!info->movable) {
+			info->nr = nr;
+			goto next;
+		}
+		trace_xfs_compact_gap(mp, info->agno, gbno, glen);
+next:
+		pbno = fbno;
+		plen = flen;
+	}
+
+out_del_cursors:
+	xfs_btree_del_cursor(rcur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	xfs_buf_relse(agbp);
+	return error;
+}
+
+/* Pick the AG with the most free space, other than the one we're emptying. */
+STATIC xfs_agnumber_t
+xfs_compact_pick_dest(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno)
+{
+	struct xfs_perag	*pag;
+	xfs_agnumber_t		best = (agno + 1) % mp->m_sb.sb_agcount;
+	xfs_extlen_t		best_free = 0;
+	xfs_agnumber_t		i;
+
+	for (i = 0; i < mp->m_sb.sb_agcount; i++) {
+		if (i == agno)
+			continue;
+		pag = xfs_perag_get(mp, i);
+		if (pag->pagf_init && pag->pagf_freeblks > best_free) {
+			best = i;
+			best_free = pag->pagf_freeblks;
+		}
+		xfs_perag_put(pag);
+	}
+	return best;
+}
+
+/* Move every extent gathered in one batch out of the AG. */
+STATIC int
+xfs_compact_move_batch(
+	struct xfs_mount	*mp,
+	struct xfs_compact_info	*info,
+	uint64_t		*moved)
+{
+	struct xfs_compact_ext	*ce;
+	struct xfs_inode	*ip;
+	xfs_fsblock_t		target;
+	xfs_filblks_t		len;
+	int			i;
+	int			error;
+
+	target = XFS_AGB_TO_FSB(mp, xfs_compact_pick_dest(mp, info->agno), 0);
+	for (i = 0, ce = info->exts; i < info->nr; i++, ce++) {
+		/* The file may have gone away since we looked. */
+		error = xfs_iget(mp, NULL, ce->ce_ino,
+				XFS_IGET_UNTRUSTED | XFS_IGET_DONTCACHE, 0,
+				&ip);
+		if (error == -ENOENT || error == -EINVAL)
+			continue;
+		if (error)
+			return error;
+
+		error = xfs_reflink_relocate_extent(ip, &ce->ce_irec, target,
+				&len);
+		IRELE(ip);
+		if (error)
+			return error;
+		*moved += len;
+
+		if (fatal_signal_pending(current))
+			break;
+	}
+	return 0;
+}
+
+/*
+ * Compact the free space in one AG, a batch at a time.  Unless asked not
+ * to, sleep for as long as each batch took to move so that we only use
+ * about half of the disk's time.  On return ca_agbno is where to resume.
+ */
+int
+xfs_compact_ag(
+	struct xfs_mount	*mp,
+	struct xfs_compact_ag	*ca)
+{
+	struct xfs_compact_info	info;
+	xfs_extlen_t		maxgap;
+	xfs_agblock_t		agbno;
+	unsigned long		stamp;
+	uint64_t		moved;
+	int			error = 0;
+
+	if (!xfs_sb_version_hasrmapbt(&mp->m_sb) ||
+	    !xfs_sb_version_hasreflink(&mp->m_sb))
+		return -EOPNOTSUPP;
+	if (ca->ca_flags & ~XFS_COMPACT_FLAGS)
+		return -EINVAL;
+	if (ca->ca_agno >= mp->m_sb.sb_agcount || mp->m_sb.sb_agcount < 2)
+		return -EINVAL;
+
+	maxgap = ca->ca_maxgap ? ca->ca_maxgap : XFS_COMPACT_MAXGAP;
+	maxgap = min_t(xfs_extlen_t, maxgap, MAXEXTLEN);
+	ca->ca_moved = 0;
+	if (ca->ca_agbno >= mp->m_sb.sb_agblocks)
+		return 0;
+	agbno = ca->ca_agbno;
+
+	info.agno = ca->ca_agno;
+	info.exts = kmem_alloc(XFS_COMPACT_BATCH * sizeof(*info.exts),
+			KM_SLEEP);
+
+	do {
+		stamp = jiffies;
+		moved = 0;
+
+		error = xfs_compact_gather(mp, &info, maxgap, &agbno);
+		if (error)
+			break;
+		error = xfs_compact_move_batch(mp, &info, &moved);
+		ca->ca_moved += moved;
+		if (error)
+			break;
+
+		if (fatal_signal_pending(current))
+			break;
+		if (moved && !(ca->ca_flags & XFS_COMPACT_NOTHROTTLE))
+			schedule_timeout_killable(jiffies - stamp);
+		cond_resched();
+	} while (agbno != NULLAGBLOCK);
+
+	kmem_free(info.exts);
+	ca->ca_agbno = agbno == NULLAGBLOCK ? mp->m_sb.sb_agblocks : agbno;
+	return error;
+}
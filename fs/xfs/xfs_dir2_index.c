@@ -0,0 +1,658 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_da_format.h"
+#include "xfs_da_btree.h"
+#include "xfs_inode.h"
+#include "xfs_bmap.h"
+#include "xfs_dir2.h"
+#include "xfs_dir2_priv.h"
+#include "xfs_dir2_index.h"
+#include "xfs_trans.h"
+
+/*
+ * In-memory name hash index for node format directories.
+ *
+ * A lookup in a large directory walks the da-btree from the root down to a
+ * leaf block and then reads the data block each matching hash points at.  With
+ * the dirindex mount option we instead keep an in-memory copy of the leaf hash
+ * entries, (name hash, data address) pairs, in an open addressing hash table
+ * hanging off the directory inode.  Negative lookups then need no I/O at all,
+ * and positive ones read just the data block holding the entry.
+ *
+ * The index is built from the data blocks a few at a time by the lookups that
+ * find the directory in node format, and kept up to date as leaf entries are
+ * added and removed.  It is protected by the directory ILOCK: lookups hold it
+ * shared and modifications exclusive.  The data addresses of entries don't
+ * change while the directory stays in node format; it is thrown away when the
+ * directory shrinks back to leaf format and when the inode is evicted.  The
+ * tables of all directories together may use at most 1/64th of memory; if we
+ * ever fail to allocate memory for one we stop indexing that directory and
+ * fall back to the da-btree.
+ */
+struct xfs_dir2_index_ent {
+	xfs_dahash_t		hash;
+	xfs_dir2_dataptr_t	ptr;
+};
+
+struct xfs_dir2_index {
+	unsigned long		di_flags;	/* XFS_DIR2_INDEX_* bits */
+	xfs_dablk_t		di_next_da;	/* first block not yet indexed */
+	unsigned int		di_mask;	/* number of slots - 1 */
+	unsigned int		di_used;	/* live and deleted slots */
+	unsigned int		di_live;	/* live slots */
+	struct xfs_dir2_index_ent *di_ents;
+};
+
+/* di_flags bits */
+#define XFS_DIR2_INDEX_BUILDING	0	/* a lookup is adding blocks */
+#define XFS_DIR2_INDEX_READY	1	/* every data block is indexed */
+#define XFS_DIR2_INDEX_BROKEN	2	/* out of memory, don't index */
+
+/* Data address zero is the data block header, so it marks an empty slot. */
+#define XFS_DIR2_INDEX_EMPTY	0
+#define XFS_DIR2_INDEX_DELETED	XFS_DIR2_NULL_DATAPTR
+
+#define XFS_DIR2_INDEX_MIN_SLOTS	1024
+
+/* Number of data blocks a single lookup adds to an incomplete index. */
+#define XFS_DIR2_INDEX_BUILD_BLOCKS	16
+
+/* Memory used by the hash tables of all directory indexes. */
+static atomic_long_t	xfs_dir2_index_bytes = ATOMIC_LONG_INIT(0);
+
+static inline bool
+xfs_dir2_index_enabled(
+	struct xfs_inode	*dp)
+{
+	return (dp->i_mount->m_flags & XFS_MOUNT_DIRINDEX) &&
+	       !xfs_sb_version_hasasciici(&dp->i_mount->m_sb);
+}
+
+static struct xfs_dir2_index_ent *
+xfs_dir2_index_alloc_ents(
+	unsigned int		nslots)
+{
+	struct xfs_dir2_index_ent *ents;
+	size_t			size = nslots * sizeof(*ents);
+
+	if (atomic_long_add_return(size, &xfs_dir2_index_bytes) >
+	    (totalram_pages << PAGE_SHIFT) / 64)
+		goto out_unaccount;
+	ents = kmem_zalloc_large(size, KM_NOFS | KM_MAYFAIL);
+	if (!ents)
+		goto out_unaccount;
+	return ents;
+
+out_unaccount:
+	atomic_long_sub(size, &xfs_dir2_index_bytes);
+	return NULL;
+}
+
+static void
+xfs_dir2_index_free_ents(
+	struct xfs_dir2_index_ent *ents,
+	unsigned int		nslots)
+{
+	if (!ents)
+		return;
+	kmem_free(ents);
+	atomic_long_sub(nslots * sizeof(*ents), &xfs_dir2_index_bytes);
+}
+
+static struct xfs_dir2_index *
+xfs_dir2_index_alloc(void)
+{
+	struct xfs_dir2_index	*idx;
+
+	idx = kmem_zalloc(sizeof(*idx), KM_NOFS | KM_MAYFAIL);
+	if (!idx)
+		return NULL;
+	idx->di_ents = xfs_dir2_index_alloc_ents(XFS_DIR2_INDEX_MIN_SLOTS);
+	if (!idx->di_ents) {
+		kmem_free(idx);
+		return NULL;
+	}
+	idx->di_mask = XFS_DIR2_INDEX_MIN_SLOTS - 1;
+	return idx;
+}
+
+/* Give up on indexing this directory until the index is freed. */
+static void
+xfs_dir2_index_break(
+	struct xfs_dir2_index	*idx)
+{
+	xfs_dir2_index_free_ents(idx->di_ents, idx->di_mask + 1);
+	idx->di_ents = NULL;
+	set_bit(XFS_DIR2_INDEX_BROKEN, &idx->di_flags);
+}
+
+/* Does the index cover entries in the data block at this address? */
+static inline bool
+xfs_dir2_index_covers(
+	struct xfs_inode	*dp,
+	struct xfs_dir2_index	*idx,
+	xfs_dir2_dataptr_t	ptr)
+{
+	struct xfs_da_geometry	*geo = dp->i_mount->m_dir_geo;
+
+	if (test_bit(XFS_DIR2_INDEX_BROKEN, &idx->di_flags))
+		return false;
+	return xfs_dir2_db_to_da(geo, xfs_dir2_dataptr_to_db(geo, ptr)) <
+			idx->di_next_da;
+}
+
+/* Insert an entry, which must fit without growing the table. */
+static void
+xfs_dir2_index_insert(
+	struct xfs_dir2_index	*idx,
+	xfs_dahash_t		hash,
+	xfs_dir2_dataptr_t	ptr)
+{
+	unsigned int		i = hash_32(hash, 32) & idx->di_mask;
+
+	while (idx->di_ents[i].ptr != XFS_DIR2_INDEX_EMPTY &&
+	       idx->di_ents[i].ptr != XFS_DIR2_INDEX_DELETED)
+		i = (i + 1) & idx->di_mask;
+	if (idx->di_ents[i].ptr == XFS_DIR2_INDEX_EMPTY)
+		idx->di_used++;
+	idx->di_live++;
+	idx->di_ents[i].hash = hash;
+	idx->di_ents[i].ptr = ptr;
+}
+
+/* Rehash all live entries into a new table, dropping deleted slots. */
+static int
+xfs_dir2_index_resize(
+	struct xfs_dir2_index	*idx,
+	unsigned int		nslots)
+{
+	struct xfs_dir2_index_ent *oents = idx->di_ents;
+	unsigned int		omask = idx->di_mask;
+	unsigned int		i;
+
+	idx->di_ents = xfs_dir2_index_alloc_ents(nslots);
+	if (!idx->di_ents) {
+		idx->di_ents = oents;
+		return -ENOMEM;
+	}
+	idx->di_mask = nslots - 1;
+	idx->di_used = 0;
+	idx->di_live = 0;
+	for (i = 0; i <= omask; i++) {
+		if (oents[i].ptr == XFS_DIR2_INDEX_EMPTY ||
+		    oents[i].ptr == XFS_DIR2_INDEX_DELETED)
+			continue;
+		xfs_dir2_index_insert(idx, oents[i].hash, oents[i].ptr);
+	}
+	xfs_dir2_index_free_ents(oents, omask + 1);
+	return 0;
+}
+
+/*
+ * Make room for one more entry once the table is three quarters full of live
+ * and deleted slots.  If less than half the slots are live, rehashing at the
+ * same size gets rid of enough deleted slots; otherwise double the table.
+ */
+static int
+xfs_dir2_index_make_room(
+	struct xfs_dir2_index	*idx)
+{
+	unsigned int		nslots = idx->di_mask + 1;
+
+	if ((idx->di_used + 1) * 4 < nslots * 3)
+		return 0;
+	if ((idx->di_live + 1) * 2 < nslots)
+		return xfs_dir2_index_resize(idx, nslots);
+	return xfs_dir2_index_resize(idx, nslots * 2);
+}
+
+/* Add every entry in a data block to the index. */
+STATIC int
+xfs_dir2_index_add_block(
+	struct xfs_inode	*dp,
+	struct xfs_dir2_index	*idx,
+	struct xfs_buf		*bp,
+	xfs_dir2_db_t		db)
+{
+	struct xfs_mount	*mp = dp->i_mount;
+	struct xfs_da_geometry	*geo = mp->m_dir_geo;
+	char			*hdr = bp->b_addr;
+	char			*ptr = hdr + dp->d_ops->data_entry_offset;
+	char			*endptr = hdr + geo->blksize;
+	struct xfs_dir2_data_unused *dup;
+	struct xfs_dir2_data_entry *dep;
+	struct xfs_name		name;
+	xfs_dahash_t		hash;
+	int			length;
+	int			error;
+
+	while (ptr < endptr) {
+		dup = (struct xfs_dir2_data_unused *)ptr;
+		if (be16_to_cpu(dup->freetag) == XFS_DIR2_DATA_FREE_TAG) {
+			length = be16_to_cpu(dup->length);
+		} else {
+			dep = (struct xfs_dir2_data_entry *)ptr;
+			name.name = dep->name;
+			name.len = dep->namelen;
+			hash = mp->m_dirnameops->hashname(&name);
+
+			error = xfs_dir2_index_make_room(idx);
+			if (error)
+				return error;
+			xfs_dir2_index_insert(idx, hash,
+				xfs_dir2_db_off_to_dataptr(geo, db, ptr - hdr));
+			length = dp->d_ops->data_entsize(dep->namelen);
+		}
+		if (length <= 0)
+			return -EFSCORRUPTED;
+		ptr += length;
+	}
+	return 0;
+}
+
+/*
+ * Index the next few data blocks of a directory.  Indexing all of them in one
+ * go would make whichever lookup comes first read every data block of what
+ * may be a huge directory with the ILOCK held, so each lookup that finds the
+ * index incomplete adds at most XFS_DIR2_INDEX_BUILD_BLOCKS blocks to it and
+ * then does a regular lookup.  Entries added to or removed from blocks before
+ * the cursor are applied to the index as they happen, the rest are picked up
+ * when the cursor gets to them.  The caller holds XFS_DIR2_INDEX_BUILDING.
+ */
+STATIC void
+xfs_dir2_index_build_step(
+	struct xfs_inode	*dp,
+	struct xfs_dir2_index	*idx)
+{
+	struct xfs_da_geometry	*geo = dp->i_mount->m_dir_geo;
+	struct xfs_bmbt_irec	map;
+	struct xfs_buf		*bp;
+	xfs_dablk_t		da = idx->di_next_da;
+	xfs_dablk_t		end;
+	int			nblocks = 0;
+	int			nmap;
+	int			error;
+
+	while (da < geo->leafblk) {
+		nmap = 1;
+		error = xfs_bmapi_read(dp, da, geo->leafblk - da, &map, &nmap,
+				0);
+		if (error || !nmap)
+			goto out_break;
+		end = map.br_startoff + map.br_blockcount;
+		if (map.br_startblock == HOLESTARTBLOCK) {
+			da = end;
+			continue;
+		}
+
+		/* Directory blocks are aligned to their size. */
+		da = round_down(map.br_startoff, geo->fsbcount);
+		if (da < map.br_startoff)
+			da += geo->fsbcount;
+		for (; da < end && da < geo->leafblk; da += geo->fsbcount) {
+			if (nblocks++ == XFS_DIR2_INDEX_BUILD_BLOCKS) {
+				idx->di_next_da = da;
+				return;
+			}
+			error = xfs_dir3_data_read(NULL, dp, da, -1, &bp);
+			if (error)
+				goto out_break;
+			error = xfs_dir2_index_add_block(dp, idx, bp,
+					xfs_dir2_da_to_db(geo, da));
+			xfs_trans_brelse(NULL, bp);
+			if (error)
+				goto out_break;
+		}
+	}
+	idx->di_next_da = geo->leafblk;
+	smp_mb__before_atomic();
+	set_bit(XFS_DIR2_INDEX_READY, &idx->di_flags);
+	return;
+
+out_break:
+	xfs_dir2_index_break(idx);
+}
+
+/*
+ * Look a name up in a node format directory using the index, extending it
+ * first if it isn't complete yet.  Returns -EEXIST with the inode number filled
+ * in if the name was found, -ENOENT if it doesn't exist, or -EAGAIN if the
+ * caller should do a regular da-btree lookup instead.
+ */
+int
+xfs_dir2_index_lookup(
+	struct xfs_da_args	*args)
+{
+	struct xfs_inode	*dp = args->dp;
+	struct xfs_da_geometry	*geo = args->geo;
+	struct xfs_dir2_index	*idx;
+	struct xfs_dir2_data_entry *dep;
+	struct xfs_buf		*bp;
+	xfs_dir2_dataptr_t	ptr;
+	unsigned int		i;
+	int			error;
+
+	if (!xfs_dir2_index_enabled(dp))
+		return -EAGAIN;
+
+	idx = READ_ONCE(dp->i_dir_index);
+	if (!idx) {
+		/* Don't pile directory scans into a transaction. */
+		if (args->trans)
+			return -EAGAIN;
+		idx = xfs_dir2_index_alloc();
+		if (!idx)
+			return -EAGAIN;
+		/* Lookups may race to set it up under the shared ILOCK. */
+		if (cmpxchg(&dp->i_dir_index, NULL, idx) != NULL) {
+			xfs_dir2_index_free_ents(idx->di_ents,
+					idx->di_mask + 1);
+			kmem_free(idx);
+			idx = READ_ONCE(dp->i_dir_index);
+		}
+	}
+
+	if (!test_bit(XFS_DIR2_INDEX_READY, &idx->di_flags)) {
+		/* Only one lookup at a time gets to extend the index. */
+		if (args->trans ||
+		    test_bit(XFS_DIR2_INDEX_BROKEN, &idx->di_flags) ||
+		    test_and_set_bit_lock(XFS_DIR2_INDEX_BUILDING,
+					  &idx->di_flags))
+			return -EAGAIN;
+		xfs_dir2_index_build_step(dp, idx);
+		clear_bit_unlock(XFS_DIR2_INDEX_BUILDING, &idx->di_flags);
+		if (!test_bit(XFS_DIR2_INDEX_READY, &idx->di_flags))
+			return -EAGAIN;
+	}
+	smp_rmb();
+
+	for (i = hash_32(args->hashval, 32) & idx->di_mask;
+	     idx->di_ents[i].ptr != XFS_DIR2_INDEX_EMPTY;
+	     i = (i + 1) & idx->di_mask) {
+		ptr = idx->di_ents[i].ptr;
+		if (ptr == XFS_DIR2_INDEX_DELETED ||
+		    idx->di_ents[i].hash != args->hashval)
+			continue;
+
+		error = xfs_dir3_data_read(args->trans, dp,
+				xfs_dir2_db_to_da(geo,
+					xfs_dir2_dataptr_to_db(geo, ptr)),
+				-1, &bp);
+		if (error)
+			return error;
+		dep = (struct xfs_dir2_data_entry *)((char *)bp->b_addr +
+				xfs_dir2_dataptr_to_off(geo, ptr));
+		if (dp->i_mount->m_dirnameops->compname(args, dep->name,
+				dep->namelen) == XFS_CMP_EXACT) {
+			args->cmpresult = XFS_CMP_EXACT;
+			args->inumber = be64_to_cpu(dep->inumber);
+			args->filetype = dp->d_ops->data_get_ftype(dep);
+			xfs_trans_brelse(args->trans, bp);
+			return -EEXIST;
+		}
+		xfs_trans_brelse(args->trans, bp);
+	}
+	return -ENOENT;
+}
+
+/* A leaf entry was added to a node format directory. */
+void
+xfs_dir2_index_add(
+	struct xfs_inode	*dp,
+	xfs_dahash_t		hash,
+	xfs_dir2_dataptr_t	ptr)
+{
+	struct xfs_dir2_index	*idx = dp->i_dir_index;
+
+	ASSERT(xfs_isilocked(dp, XFS_ILOCK_EXCL));
+
+	if (!idx || !xfs_dir2_index_covers(dp, idx, ptr))
+		return;
+	if (xfs_dir2_index_make_room(idx)) {
+		xfs_dir2_index_break(idx);
+		return;
+	}
+	xfs_dir2_index_insert(idx, hash, ptr);
+}
+
+/* A leaf entry was removed from a node format directory. */
+void
+xfs_dir2_index_remove(
+	struct xfs_inode	*dp,
+	xfs_dahash_t		hash,
+	xfs_dir2_dataptr_t	ptr)
+{
+	struct xfs_dir2_index	*idx = dp->i_dir_index;
+	unsigned int		i;
+
+	ASSERT(xfs_isilocked(dp, XFS_ILOCK_EXCL));
+
+	if (!idx || !xfs_dir2_index_covers(dp, idx, ptr))
+		return;
+	for (i = hash_32(hash, 32) & idx->di_mask;
+	     idx->di_ents[i].ptr != XFS_DIR2_INDEX_EMPTY;
+	     i = (i + 1) & idx->di_mask) {
+		if (idx->di_ents[i].ptr == ptr) {
+			idx->di_ents[i].ptr = XFS_DIR2_INDEX_DELETED;
+			idx->di_live--;
+			return;
+		}
+	}
+
+	/* The index doesn't match the directory; stop using it. */
+	ASSERT(0);
+	xfs_dir2_index_break(idx);
+}
+
+void
+xfs_dir2_index_free(
+	struct xfs_inode	*dp)
+{
+	struct xfs_dir2_index	*idx = dp->i_dir_index;
+
+	if (!idx)
+		return;
+	xfs_dir2_index_free_ents(idx->di_ents, idx->di_mask + 1);
+	kmem_free(idx);
+	dp->i_dir_index = NULL;
+}
+
+/*
+ * In-memory free space map for node format directories.
+ *
+ * To find a data block with room for a new entry, xfs_dir2_node_addname_int
+ * has to read the freespace blocks and walk their bests[] arrays until it hits
+ * one that is big enough.  In a directory with millions of entries that is a
+ * lot of blocks to look at for every create.  With the dirindex mount option
+ * we keep a copy of the bests[] values in memory, along with a bitmap of data
+ * blocks for each power of two size bucket, so that a block with enough room
+ * can be found by looking at a handful of bitmap words.
+ *
+ * The map is built the first time addname has to go looking for space, and is
+ * updated whenever a bests[] entry is logged.  Like the name hash index it is
+ * protected by the exclusive directory ILOCK and thrown away when we can't
+ * allocate memory for it, when the directory shrinks back to leaf format and
+ * when the inode is evicted.  Callers check what it tells them against the
+ * freespace block they read anyway, so a stale map costs us a scan rather
+ * than a corrupt directory.
+ */
+#define XFS_DIR2_FREEMAP_BUCKETS	16	/* one per bit of a uint16_t */
+#define XFS_DIR2_FREEMAP_MIN_BLOCKS	BITS_PER_LONG
+
+struct xfs_dir2_freemap {
+	xfs_dir2_db_t		fm_nblocks;	/* data blocks covered */
+	unsigned long		*fm_buckets[XFS_DIR2_FREEMAP_BUCKETS];
+	uint16_t		fm_bests[];	/* longest free, or NULLDATAOFF */
+};
+
+/* Blocks with no free space or no block at all are in no bucket. */
+static inline int
+xfs_dir2_freemap_bucket(
+	uint16_t		best)
+{
+	if (best == 0 || best == NULLDATAOFF)
+		return -1;
+	return ilog2(best);
+}
+
+static struct xfs_dir2_freemap *
+xfs_dir2_freemap_alloc(
+	xfs_dir2_db_t		nblocks)
+{
+	struct xfs_dir2_freemap	*fm;
+	unsigned long		*map;
+	size_t			mapsize;
+	int			i;
+
+	/* nblocks is a multiple of BITS_PER_LONG, so the bitmaps are aligned */
+	mapsize = BITS_TO_LONGS(nblocks) * sizeof(unsigned long);
+	fm = kmem_zalloc_large(sizeof(*fm) + nblocks * sizeof(uint16_t) +
+			XFS_DIR2_FREEMAP_BUCKETS * mapsize,
+			KM_NOFS | KM_MAYFAIL);
+	if (!fm)
+		return NULL;
+	fm->fm_nblocks = nblocks;
+	memset(fm->fm_bests, 0xff, nblocks * sizeof(uint16_t));
+	map = (unsigned long *)&fm->fm_bests[nblocks];
+	for (i = 0; i < XFS_DIR2_FREEMAP_BUCKETS; i++)
+		fm->fm_buckets[i] = map + i * BITS_TO_LONGS(nblocks);
+	return fm;
+}
+
+/* Set up an empty map, to be filled in by the caller. */
+int
+xfs_dir2_freemap_init(
+	struct xfs_inode	*dp)
+{
+	ASSERT(xfs_isilocked(dp, XFS_ILOCK_EXCL));
+	ASSERT(!dp->i_dir_freemap);
+
+	if (!(dp->i_mount->m_flags & XFS_MOUNT_DIRINDEX))
+		return -EAGAIN;
+	dp->i_dir_freemap = xfs_dir2_freemap_alloc(XFS_DIR2_FREEMAP_MIN_BLOCKS);
+	if (!dp->i_dir_freemap)
+		return -EAGAIN;
+	return 0;
+}
+
+/*
+ * Find a data block whose longest free region can hold length bytes.  Returns
+ * -ENOSPC if there isn't one, or -EAGAIN if there is no map to ask.  We take
+ * the smallest size bucket that is certain to fit before wading through the
+ * bucket that only might, which also keeps the big holes for big names.
+ */
+int
+xfs_dir2_freemap_find(
+	struct xfs_inode	*dp,
+	int			length,
+	xfs_dir2_db_t		*dbp)
+{
+	struct xfs_dir2_freemap	*fm = dp->i_dir_freemap;
+	int			bucket = ilog2(length);
+	unsigned long		db;
+	int			i;
+
+	ASSERT(xfs_isilocked(dp, XFS_ILOCK_EXCL));
+
+	if (!fm)
+		return -EAGAIN;
+
+	for (i = bucket + 1; i < XFS_DIR2_FREEMAP_BUCKETS; i++) {
+		db = find_first_bit(fm->fm_buckets[i], fm->fm_nblocks);
+		if (db < fm->fm_nblocks) {
+			*dbp = db;
+			return 0;
+		}
+	}
+	for_each_set_bit(db, fm->fm_buckets[bucket], fm->fm_nblocks) {
+		if (fm->fm_bests[db] >= length) {
+			*dbp = db;
+			return 0;
+		}
+	}
+	return -ENOSPC;
+}
+
+/* Double the map until it covers db. */
+static struct xfs_dir2_freemap *
+xfs_dir2_freemap_grow(
+	struct xfs_dir2_freemap	*fm,
+	xfs_dir2_db_t		db)
+{
+	struct xfs_dir2_freemap	*nfm;
+	xfs_dir2_db_t		nblocks = fm->fm_nblocks;
+	int			i;
+
+	while (nblocks <= db)
+		nblocks *= 2;
+	nfm = xfs_dir2_freemap_alloc(nblocks);
+	if (!nfm)
+		return NULL;
+	memcpy(nfm->fm_bests, fm->fm_bests, fm->fm_nblocks * sizeof(uint16_t));
+	for (i = 0; i < XFS_DIR2_FREEMAP_BUCKETS; i++)
+		bitmap_copy(nfm->fm_buckets[i], fm->fm_buckets[i],
+				fm->fm_nblocks);
+	kmem_free(fm);
+	return nfm;
+}
+
+/* A bests[] entry for data block db has changed. */
+void
+xfs_dir2_freemap_set(
+	struct xfs_inode	*dp,
+	xfs_dir2_db_t		db,
+	uint16_t		best)
+{
+	struct xfs_dir2_freemap	*fm = dp->i_dir_freemap;
+	int			bucket;
+
+	ASSERT(xfs_isilocked(dp, XFS_ILOCK_EXCL));
+
+	if (!fm)
+		return;
+	if (db >= fm->fm_nblocks) {
+		if (best == NULLDATAOFF)
+			return;
+		dp->i_dir_freemap = xfs_dir2_freemap_grow(fm, db);
+		if (!dp->i_dir_freemap) {
+			kmem_free(fm);
+			return;
+		}
+		fm = dp->i_dir_freemap;
+	}
+
+	bucket = xfs_dir2_freemap_bucket(fm->fm_bests[db]);
+	if (bucket >= 0)
+		__clear_bit(db, fm->fm_buckets[bucket]);
+	fm->fm_bests[db] = best;
+	bucket = xfs_dir2_freemap_bucket(best);
+	if (bucket >= 0)
+		__set_bit(db, fm->fm_buckets[bucket]);
+}
+
+void
+xfs_dir2_freemap_free(
+	struct xfs_inode	*dp)
+{
+	kmem_free(dp->i_dir_freemap);
+	dp->i_dir_freemap = NULL;
+}
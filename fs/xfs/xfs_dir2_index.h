@@ -0,0 +1,36 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef __XFS_DIR2_INDEX_H__
+#define __XFS_DIR2_INDEX_H__
+
+struct xfs_inode;
+struct xfs_da_args;
+
+int xfs_dir2_index_lookup(struct xfs_da_args *args);
+void xfs_dir2_index_add(struct xfs_inode *dp, xfs_dahash_t hash,
+		xfs_dir2_dataptr_t ptr);
+void xfs_dir2_index_remove(struct xfs_inode *dp, xfs_dahash_t hash,
+		xfs_dir2_dataptr_t ptr);
+void xfs_dir2_index_free(struct xfs_inode *dp);
+
+int xfs_dir2_freemap_init(struct xfs_inode *dp);
+int xfs_dir2_freemap_find(struct xfs_inode *dp, int length,
+		xfs_dir2_db_t *dbp);
+void xfs_dir2_freemap_set(struct xfs_inode *dp, xfs_dir2_db_t db,
+		uint16_t best);
+void xfs_dir2_freemap_free(struct xfs_inode *dp);
+
+#endif	/* __XFS_DIR2_INDEX_H__ */
@@ -18,6 +18,7 @@
  */
 #include "xfs.h"
 #include "xfs_fs.h"
+#include "xfs_shared.h"
 #include "xfs_format.h"
 #include "xfs_log_format.h"
 #include "xfs_trans_resv.h"
@@ -32,6 +33,7 @@
 #include "xfs_trace.h"
 #include "xfs_bmap.h"
 #include "xfs_trans.h"
+#include "xfs_ialloc.h"
 
 /*
  * Directory file type support functions
@@ -245,13 +247,13 @@ xfs_dir2_block_getdents(
 
 /*
  * Read a directory block and initiate readahead for blocks beyond that.
- * We maintain a sliding readahead window of the remaining space in the
- * buffer rounded up to the nearest block.
+ * We maintain a sliding readahead window of ra_want filesystem blocks past
+ * the block we are reading.
  */
 STATIC int
 xfs_dir2_leaf_readbuf(
 	struct xfs_da_args	*args,
-	size_t			bufsize,
+	int			ra_want,
 	xfs_dir2_off_t		*cur_off,
 	xfs_dablk_t		*ra_blk,
 	struct xfs_buf		**bpp)
@@ -267,7 +269,6 @@ xfs_dir2_leaf_readbuf(
 	xfs_dablk_t		map_off;
 	xfs_dablk_t		last_da;
 	xfs_extnum_t		idx;
-	int			ra_want;
 	int			error = 0;
 
 	if (!(ifp->if_flags & XFS_IFEXTENTS)) {
@@ -298,11 +299,10 @@ xfs_dir2_leaf_readbuf(
 		goto out;
 
 	/*
-	 * Start readahead for the next bufsize's worth of dir data blocks.
-	 * We may have already issued readahead for some of that range;
-	 * ra_blk tracks the last block we tried to read(ahead).
+	 * Start readahead for the next ra_want blocks' worth of dir data
+	 * blocks.  We may have already issued readahead for some of that
+	 * range; ra_blk tracks the last block we tried to read(ahead).
 	 */
-	ra_want = howmany(bufsize + geo->blksize, (1 << geo->fsblog));
 	if (*ra_blk >= last_da)
 		goto out;
 	else if (*ra_blk == 0)
@@ -349,6 +349,67 @@ xfs_dir2_leaf_readbuf(
 	goto out;
 }
 
+/*
+ * Readdir readahead state is kept in the file's readahead structure, which
+ * directories have no other use for: ra->start is the last directory block we
+ * issued readahead for, ra->size the current window in filesystem blocks, and
+ * ra->prev_pos the offset the previous getdents call stopped at.  Each call
+ * that carries on where the last one stopped doubles the window, up to
+ * whichever is the larger of the device readahead size and a megabyte.
+ */
+#define XFS_READDIR_RA_MAX	(1024 * 1024)
+
+static int
+xfs_dir2_leaf_ra_window(
+	struct xfs_da_geometry	*geo,
+	struct dir_context	*ctx,
+	struct file_ra_state	*ra,
+	xfs_dablk_t		*ra_blk)
+{
+	int			max_ra;
+
+	if (!ra || ra->prev_pos != ctx->pos || !ra->size) {
+		*ra_blk = 0;
+		return 0;
+	}
+
+	max_ra = max_t(unsigned long, XFS_READDIR_RA_MAX,
+			ra->ra_pages << PAGE_SHIFT) >> geo->fsblog;
+	*ra_blk = ra->start;
+	return min_t(int, ra->size * 2, max_ra);
+}
+
+/*
+ * Most readdir calls are followed by a stat of every name returned, so start
+ * reading the inode cluster buffers while we're still busy with the directory.
+ * Only do this when the location of the cluster is simple arithmetic; we don't
+ * want to be doing inobt lookups for inodes nobody may ever look at.  If the
+ * caller passes a readahead batch, the read is queued in that.
+ */
+void
+xfs_dir2_inode_readahead(
+	struct xfs_mount	*mp,
+	xfs_ino_t		ino,
+	xfs_daddr_t		*last_blkno,
+	struct xfs_buf_ra_batch	*rab)
+{
+	struct xfs_imap		imap;
+
+	if (xfs_icluster_size_fsb(mp) > 1 && !mp->m_inoalign_mask)
+		return;
+	if (xfs_imap(mp, NULL, ino, &imap, 0))
+		return;
+	if (imap.im_blkno == *last_blkno)
+		return;
+	*last_blkno = imap.im_blkno;
+	if (rab)
+		xfs_buf_ra_batch_add(rab, mp->m_ddev_targp, imap.im_blkno,
+				imap.im_len, &xfs_inode_buf_ra_ops);
+	else
+		xfs_buf_readahead(mp->m_ddev_targp, imap.im_blkno,
+				imap.im_len, &xfs_inode_buf_ra_ops);
+}
+
 /*
  * Getdents (readdir) for leaf and node directories.
  * This reads the data blocks only, so is the same for both forms.
@@ -357,7 +418,8 @@ STATIC int
 xfs_dir2_leaf_getdents(
 	struct xfs_da_args	*args,
 	struct dir_context	*ctx,
-	size_t			bufsize)
+	size_t			bufsize,
+	struct file_ra_state	*ra)
 {
 	struct xfs_inode	*dp = args->dp;
 	struct xfs_buf		*bp = NULL;	/* data block buffer */
@@ -366,7 +428,10 @@ xfs_dir2_leaf_getdents(
 	xfs_dir2_data_unused_t	*dup;		/* unused entry */
 	char			*ptr = NULL;	/* pointer to current data */
 	struct xfs_da_geometry	*geo = args->geo;
-	xfs_dablk_t		rablk = 0;	/* current readahead block */
+	xfs_dablk_t		rablk;		/* current readahead block */
+	int			ra_window;	/* readahead window in fsbs */
+	int			ra_want;
+	xfs_daddr_t		ino_blkno = 0;	/* last inode cluster ra */
 	xfs_dir2_off_t		curoff;		/* current overall offset */
 	int			length;		/* temporary length value */
 	int			byteoff;	/* offset in current block */
@@ -385,6 +450,7 @@ xfs_dir2_leaf_getdents(
 	 * in the directory file.
 	 */
 	curoff = xfs_dir2_dataptr_to_byte(ctx->pos);
+	ra_window = xfs_dir2_leaf_ra_window(geo, ctx, ra, &rablk);
 
 	/*
 	 * Loop over directory entries until we reach the end offset.
@@ -403,8 +469,11 @@ xfs_dir2_leaf_getdents(
 				bp = NULL;
 			}
 
+			ra_want = max_t(int, ra_window,
+				howmany(bufsize + geo->blksize,
+					1 << geo->fsblog));
 			lock_mode = xfs_ilock_data_map_shared(dp);
-			error = xfs_dir2_leaf_readbuf(args, bufsize, &curoff,
+			error = xfs_dir2_leaf_readbuf(args, ra_want, &curoff,
 					&rablk, &bp);
 			xfs_iunlock(dp, lock_mode);
 			if (error || !bp)
@@ -473,6 +542,10 @@ xfs_dir2_leaf_getdents(
 		filetype = dp->d_ops->data_get_ftype(dep);
 
 		ctx->pos = xfs_dir2_byte_to_dataptr(curoff) & 0x7fffffff;
+		if (ra)
+			xfs_dir2_inode_readahead(dp->i_mount,
+					be64_to_cpu(dep->inumber), &ino_blkno,
+					NULL);
 		if (!dir_emit(ctx, (char *)dep->name, dep->namelen,
 			    be64_to_cpu(dep->inumber),
 			    xfs_dir3_get_dtype(dp->i_mount, filetype)))
@@ -496,6 +569,15 @@ xfs_dir2_leaf_getdents(
 		ctx->pos = xfs_dir2_byte_to_dataptr(curoff) & 0x7fffffff;
 	if (bp)
 		xfs_trans_brelse(args->trans, bp);
+
+	/* Remember where readahead got to for the next call. */
+	if (ra) {
+		ra->start = rablk;
+		ra->size = max_t(int, ra_window,
+				howmany(bufsize + geo->blksize,
+					1 << geo->fsblog));
+		ra->prev_pos = ctx->pos;
+	}
 	return error;
 }
 
@@ -505,14 +587,16 @@ xfs_dir2_leaf_getdents(
  * If supplied, the transaction collects locked dir buffers to avoid
  * nested buffer deadlocks.  This function does not dirty the
  * transaction.  The caller should ensure that the inode is locked
- * before calling this function.
+ * before calling this function.  If supplied, ra carries readahead state
+ * from one call to the next on the same open file.
  */
 int
 xfs_readdir(
 	struct xfs_trans	*tp,
 	struct xfs_inode	*dp,
 	struct dir_context	*ctx,
-	size_t			bufsize)
+	size_t			bufsize,
+	struct file_ra_state	*ra)
 {
 	struct xfs_da_args	args = { NULL };
 	int			rval;
@@ -537,7 +621,7 @@ xfs_readdir(
 	else if (v)
 		rval = xfs_dir2_block_getdents(&args, ctx);
 	else
-		rval = xfs_dir2_leaf_getdents(&args, ctx, bufsize);
+		rval = xfs_dir2_leaf_getdents(&args, ctx, bufsize, ra);
 
 	return rval;
 }
@@ -32,48 +32,87 @@
 #include "xfs_trace.h"
 #include "xfs_log.h"
 
+/*
+ * Maximum number of free space records examined with the AGF locked before it
+ * is dropped to discard what was found.  Keeping the batches small means that
+ * a FITRIM of a large AG does not stall allocation in that AG for the whole
+ * scan.
+ */
+#define XFS_TRIM_BATCH		128
+
+/*
+ * Walk the by-size free space btree from the record in @tcur downwards and
+ * collect up to XFS_TRIM_BATCH extents to discard on @extents.  Each extent
+ * collected is inserted into the busy extent tree marked as being discarded
+ * so that nobody can allocate it once we drop the AGF.  On return @tcur holds
+ * the last record examined so that the next batch can pick up from there, or
+ * has a zero block count if there is nothing left to look at.
+ */
 STATIC int
-xfs_trim_extents(
-	struct xfs_mount	*mp,
-	xfs_agnumber_t		agno,
-	xfs_daddr_t		start,
-	xfs_daddr_t		end,
-	xfs_daddr_t		minlen,
-	uint64_t		*blocks_trimmed)
+xfs_trim_gather_extents(
+	struct xfs_mount		*mp,
+	xfs_agnumber_t			agno,
+	xfs_daddr_t			start,
+	xfs_daddr_t			end,
+	xfs_daddr_t			minlen,
+	struct xfs_alloc_rec_incore	*tcur,
+	struct list_head		*extents)
 {
-	struct block_device	*bdev = mp->m_ddev_targp->bt_bdev;
-	struct xfs_btree_cur	*cur;
-	struct xfs_buf		*agbp;
-	struct xfs_perag	*pag;
-	int			error;
-	int			i;
-
-	pag = xfs_perag_get(mp, agno);
+	struct xfs_btree_cur		*cur;
+	struct xfs_buf			*agbp;
+	int				batch = XFS_TRIM_BATCH;
+	int				error;
+	int				i;
 
 	error = xfs_alloc_read_agf(mp, NULL, agno, 0, &agbp);
-	if (error || !agbp)
-		goto out_put_perag;
+	if (error)
+		return error;
+	if (!agbp) {
+		tcur->ar_blockcount = 0;
+		return 0;
+	}
 
 	cur = xfs_allocbt_init_cursor(mp, NULL, agbp, agno, XFS_BTNUM_CNT);
 
-	/*
-	 * Force out the log.  This means any transactions that might have freed
-	 * space before we took the AGF buffer lock are now on disk, and the
-	 * volatile disk cache is flushed.
-	 */
-	xfs_log_force(mp, XFS_LOG_SYNC);
+	if (tcur->ar_startblock == NULLAGBLOCK) {
+		/*
+		 * Force out the log.  This means any transactions that might
+		 * have freed space before we took the AGF buffer lock are now
+		 * on disk, and the volatile disk cache is flushed.
+		 */
+		xfs_log_force(mp, XFS_LOG_SYNC);
 
-	/*
-	 * Look up the longest btree in the AGF and start with it.
-	 */
-	error = xfs_alloc_lookup_ge(cur, 0,
-			    be32_to_cpu(XFS_BUF_TO_AGF(agbp)->agf_longest), &i);
+		/*
+		 * Look up the longest btree in the AGF and start with it.
+		 */
+		tcur->ar_blockcount =
+			be32_to_cpu(XFS_BUF_TO_AGF(agbp)->agf_longest);
+		error = xfs_alloc_lookup_ge(cur, 0, tcur->ar_blockcount, &i);
+	} else {
+		/*
+		 * Pick up where the last batch left off.  If the last record
+		 * we looked at is still there, step past it.
+		 */
+		error = xfs_alloc_lookup_le(cur, tcur->ar_startblock,
+					    tcur->ar_blockcount, &i);
+		if (!error && i) {
+			xfs_agblock_t	fbno;
+			xfs_extlen_t	flen;
+
+			error = xfs_alloc_get_rec(cur, &fbno, &flen, &i);
+			if (!error && i && fbno == tcur->ar_startblock &&
+			    flen == tcur->ar_blockcount)
+				error = xfs_btree_decrement(cur, 0, &i);
+		}
+	}
 	if (error)
 		goto out_del_cursor;
+	if (!i)
+		tcur->ar_blockcount = 0;
 
 	/*
 	 * Loop until we are done with all extents that are large
-	 * enough to be worth discarding.
+	 * enough to be worth discarding or the batch is full.
 	 */
 	while (i) {
 		xfs_agblock_t	fbno;
@@ -81,12 +120,18 @@ xfs_trim_extents(
 		xfs_daddr_t	dbno;
 		xfs_extlen_t	dlen;
 
+		if (--batch < 0)
+			break;
+
 		error = xfs_alloc_get_rec(cur, &fbno, &flen, &i);
 		if (error)
 			goto out_del_cursor;
 		XFS_WANT_CORRUPTED_GOTO(mp, i == 1, out_del_cursor);
 		ASSERT(flen <= be32_to_cpu(XFS_BUF_TO_AGF(agbp)->agf_longest));
 
+		tcur->ar_startblock = fbno;
+		tcur->ar_blockcount = flen;
+
 		/*
 		 * use daddr format for all range/len calculations as that is
 		 * the format the range/len variables are supplied in by
@@ -100,7 +145,8 @@ xfs_trim_extents(
 		 */
 		if (dlen < minlen) {
 			trace_xfs_discard_toosmall(mp, agno, fbno, flen);
-			goto out_del_cursor;
+			tcur->ar_blockcount = 0;
+			break;
 		}
 
 		/*
@@ -122,28 +168,141 @@ xfs_trim_extents(
 			goto next_extent;
 		}
 
-		trace_xfs_discard_extent(mp, agno, fbno, flen);
-		error = blkdev_issue_discard(bdev, dbno, dlen, GFP_NOFS, 0);
-		if (error)
-			goto out_del_cursor;
-		*blocks_trimmed += flen;
+		xfs_extent_busy_insert_discard(mp, agno, fbno, flen, extents);
 
 next_extent:
 		error = xfs_btree_decrement(cur, 0, &i);
 		if (error)
 			goto out_del_cursor;
-
-		if (fatal_signal_pending(current)) {
-			error = -ERESTARTSYS;
-			goto out_del_cursor;
-		}
+		if (!i)
+			tcur->ar_blockcount = 0;
 	}
 
 out_del_cursor:
 	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
 	xfs_buf_relse(agbp);
-out_put_perag:
-	xfs_perag_put(pag);
+	return error;
+}
+
+/*
+ * Issue discards for all the extents gathered by xfs_trim_gather_extents() in
+ * one go and wait for them to complete, then drop the busy extents again so
+ * that the space can be allocated.
+ */
+STATIC int
+xfs_trim_discard_extents(
+	struct xfs_mount	*mp,
+	struct list_head	*extents,
+	uint64_t		*blocks_trimmed,
+	unsigned int		*nr_discards)
+{
+	struct block_device	*bdev = mp->m_ddev_targp->bt_bdev;
+	struct xfs_extent_busy	*busyp;
+	struct bio		*bio = NULL;
+	struct blk_plug		plug;
+	int			error = 0;
+
+	blk_start_plug(&plug);
+	list_for_each_entry(busyp, extents, list) {
+		trace_xfs_discard_extent(mp, busyp->agno, busyp->bno,
+					 busyp->length);
+		error = __blkdev_issue_discard(bdev,
+				XFS_AGB_TO_DADDR(mp, busyp->agno, busyp->bno),
+				XFS_FSB_TO_BB(mp, busyp->length),
+				GFP_NOFS, 0, &bio);
+		if (error)
+			break;
+		*blocks_trimmed += busyp->length;
+		(*nr_discards)++;
+	}
+
+	if (bio) {
+		int	error2 = submit_bio_wait(bio);
+
+		if (!error)
+			error = error2;
+		bio_put(bio);
+	}
+	blk_finish_plug(&plug);
+
+	xfs_extent_busy_clear(mp, extents, false);
+	return error;
+}
+
+/*
+ * Sleep as long as needed to keep a FITRIM under the configured bandwidth and
+ * discard rate caps.
+ */
+STATIC void
+xfs_trim_throttle(
+	struct xfs_mount	*mp,
+	unsigned long		stamp,
+	uint64_t		blocks,
+	unsigned int		nr_discards)
+{
+	unsigned long		elapsed = jiffies - stamp;
+	unsigned long		wait = 0;
+	int			mbps = xfs_trim_mbps;
+	int			iops = xfs_trim_iops;
+
+	if (mbps)
+		wait = msecs_to_jiffies(div64_u64(
+				XFS_FSB_TO_B(mp, blocks) * MSEC_PER_SEC,
+				(uint64_t)mbps << 20));
+	if (iops)
+		wait = max(wait, msecs_to_jiffies(
+				nr_discards * MSEC_PER_SEC / iops));
+	if (wait > elapsed)
+		schedule_timeout_killable(wait - elapsed);
+}
+
+/*
+ * Discard the free space in one AG in batches, dropping the AGF between them
+ * so that allocation can carry on while the discards are in flight.
+ */
+STATIC int
+xfs_trim_extents(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
+	xfs_daddr_t		start,
+	xfs_daddr_t		end,
+	xfs_daddr_t		minlen,
+	uint64_t		*blocks_trimmed)
+{
+	struct xfs_alloc_rec_incore tcur = {
+		.ar_startblock	= NULLAGBLOCK,
+	};
+	int			error;
+
+	do {
+		LIST_HEAD		(extents);
+		unsigned long		stamp = jiffies;
+		uint64_t		blocks = 0;
+		unsigned int		nr_discards = 0;
+
+		error = xfs_trim_gather_extents(mp, agno, start, end, minlen,
+						&tcur, &extents);
+		if (error) {
+			xfs_extent_busy_clear(mp, &extents, false);
+			break;
+		}
+
+		if (!list_empty(&extents)) {
+			error = xfs_trim_discard_extents(mp, &extents, &blocks,
+							 &nr_discards);
+			*blocks_trimmed += blocks;
+			if (error)
+				break;
+			xfs_trim_throttle(mp, stamp, blocks, nr_discards);
+		}
+
+		if (fatal_signal_pending(current)) {
+			error = -ERESTARTSYS;
+			break;
+		}
+		cond_resched();
+	} while (tcur.ar_blockcount);
+
 	return error;
 }
 
@@ -216,3 +375,173 @@ xfs_ioc_trim(
 		return -EFAULT;
 	return 0;
 }
+
+/*
+ * Online discard.
+ *
+ * Extents freed by a checkpoint are not discarded as soon as the checkpoint
+ * commits.  Instead they stay in the busy extent tree, and hence unallocatable,
+ * on a per-AG queue where adjacent ranges from different checkpoints are
+ * merged.  The queues are flushed by a delayed work item every
+ * xfs_discard_centisecs, or immediately once an AG has XFS_DISCARD_QUEUE_BYTES
+ * queued or an allocator is waiting for queued space.
+ */
+#define XFS_DISCARD_QUEUE_BYTES	(128 * 1024 * 1024)
+
+struct xfs_discard_batch {
+	struct xfs_mount	*mp;
+	struct list_head	extents;
+	struct work_struct	endio_work;
+};
+
+static void
+xfs_discard_endio_work(
+	struct work_struct	*work)
+{
+	struct xfs_discard_batch *batch =
+		container_of(work, struct xfs_discard_batch, endio_work);
+
+	xfs_extent_busy_clear(batch->mp, &batch->extents, false);
+	kmem_free(batch);
+}
+
+/*
+ * Queue up the actual completion to a thread to avoid IRQ-safe locking for
+ * pagb_lock.  Note that we need a unbounded workqueue, otherwise we might
+ * get the execution delayed up to 30 seconds for weird reasons.
+ */
+static void
+xfs_discard_endio(
+	struct bio		*bio)
+{
+	struct xfs_discard_batch *batch = bio->bi_private;
+
+	INIT_WORK(&batch->endio_work, xfs_discard_endio_work);
+	queue_work(xfs_discard_wq, &batch->endio_work);
+	bio_put(bio);
+}
+
+/*
+ * Discard the queued extents of one AG as a single chain of bios.  Each range
+ * is trimmed to the discard granularity of the device so that we only send
+ * requests the device can act on.
+ */
+STATIC void
+xfs_discard_issue(
+	struct xfs_mount	*mp,
+	struct xfs_discard_batch *batch)
+{
+	struct block_device	*bdev = mp->m_ddev_targp->bt_bdev;
+	struct request_queue	*q = bdev_get_queue(bdev);
+	uint32_t		gran = max(q->limits.discard_granularity >> 9,
+					   1U);
+	struct xfs_extent_busy	*busyp;
+	struct bio		*bio = NULL;
+	struct blk_plug		plug;
+	int			error = 0;
+
+	blk_start_plug(&plug);
+	list_for_each_entry(busyp, &batch->extents, list) {
+		xfs_daddr_t	dbno;
+		xfs_daddr_t	dend;
+		uint32_t	rem;
+
+		dbno = XFS_AGB_TO_DADDR(mp, busyp->agno, busyp->bno);
+		dend = dbno + XFS_FSB_TO_BB(mp, busyp->length);
+		div_u64_rem(dbno, gran, &rem);
+		if (rem)
+			dbno += gran - rem;
+		div_u64_rem(dend, gran, &rem);
+		dend -= rem;
+		if (dend <= dbno)
+			continue;
+
+		trace_xfs_discard_extent(mp, busyp->agno, busyp->bno,
+					 busyp->length);
+
+		error = __blkdev_issue_discard(bdev, dbno, dend - dbno,
+					       GFP_NOFS, 0, &bio);
+		if (error && error != -EOPNOTSUPP) {
+			xfs_info(mp,
+	 "discard failed for extent [0x%llx,%u], error %d",
+				 (unsigned long long)busyp->bno,
+				 busyp->length,
+				 error);
+			break;
+		}
+	}
+
+	if (bio) {
+		bio->bi_private = batch;
+		bio->bi_end_io = xfs_discard_endio;
+		submit_bio(bio);
+	} else {
+		xfs_discard_endio_work(&batch->endio_work);
+	}
+	blk_finish_plug(&plug);
+}
+
+void
+xfs_discard_worker(
+	struct work_struct	*work)
+{
+	struct xfs_mount	*mp = container_of(to_delayed_work(work),
+					struct xfs_mount, m_discard_work);
+	xfs_agnumber_t		agno;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		struct xfs_perag	*pag = xfs_perag_get(mp, agno);
+		struct xfs_discard_batch *batch;
+		LIST_HEAD		(extents);
+
+		if (xfs_extent_busy_grab_discard(pag, &extents)) {
+			batch = kmem_alloc(sizeof(*batch), KM_SLEEP | KM_NOFS);
+			batch->mp = mp;
+			INIT_LIST_HEAD(&batch->extents);
+			list_splice(&extents, &batch->extents);
+			xfs_discard_issue(mp, batch);
+		}
+		xfs_perag_put(pag);
+	}
+}
+
+/*
+ * Add the extents freed by a checkpoint to the discard queues and make sure
+ * the worker will get to them.
+ */
+void
+xfs_discard_queue_extents(
+	struct xfs_mount	*mp,
+	struct list_head	*list)
+{
+	ASSERT(mp->m_flags & XFS_MOUNT_DISCARD);
+
+	if (xfs_extent_busy_queue_discard(mp, list,
+			XFS_B_TO_FSBT(mp, XFS_DISCARD_QUEUE_BYTES)))
+		xfs_discard_kick(mp);
+	else
+		queue_delayed_work(xfs_discard_wq, &mp->m_discard_work,
+				msecs_to_jiffies(xfs_discard_centisecs * 10));
+}
+
+/*
+ * Issue everything that is queued now rather than when the timer expires.
+ */
+void
+xfs_discard_kick(
+	struct xfs_mount	*mp)
+{
+	mod_delayed_work(xfs_discard_wq, &mp->m_discard_work, 0);
+}
+
+/*
+ * Issue all queued discards and wait for the worker to finish.  The discards
+ * themselves may still be in flight; xfs_extent_busy_wait_all() waits for
+ * them.
+ */
+void
+xfs_discard_flush(
+	struct xfs_mount	*mp)
+{
+	flush_delayed_work(&mp->m_discard_work);
+}
@@ -4,6 +4,13 @@
 struct fstrim_range;
 struct list_head;
 
+struct work_struct;
+
 extern int	xfs_ioc_trim(struct xfs_mount *, struct fstrim_range __user *);
 
+extern void	xfs_discard_worker(struct work_struct *);
+extern void	xfs_discard_queue_extents(struct xfs_mount *, struct list_head *);
+extern void	xfs_discard_kick(struct xfs_mount *);
+extern void	xfs_discard_flush(struct xfs_mount *);
+
 #endif /* XFS_DISCARD_H */
@@ -76,12 +76,263 @@ xfs_qm_dqdestroy(
 	ASSERT(list_empty(&dqp->q_lru));
 
 	kmem_free(dqp->q_logitem.qli_item.li_lv_shadow);
+	free_percpu(dqp->q_slack);
 	mutex_destroy(&dqp->q_qlock);
 
 	XFS_STATS_DEC(dqp->q_mount, xs_qm_dquot);
 	kmem_zone_free(xfs_qm_dqzone, dqp);
 }
 
+/*
+ * Per-cpu block reservation slack.
+ *
+ * Block reservations against a busy dquot (e.g. one project shared by many
+ * writers) all serialise on the dquot lock.  To avoid that, the locked
+ * reservation path hands each CPU a batch of extra blocks when the dquot is
+ * far enough away from its limits.  These blocks are already accounted in
+ * q_res_bcount, so later reservations on that CPU can be taken from the slack
+ * without the dquot lock, and released reservations can be dropped back into
+ * it.  Because the slack is part of q_res_bcount, it can never push the dquot
+ * over a limit.  Anything that needs an exact q_res_bcount (limit checks close
+ * to the limit, reporting, limit changes) drains the slack back into the
+ * dquot under the dquot lock first.
+ *
+ * The per-cpu counters are only allocated by the first block reservation
+ * against an enforced limit, so the many dquots that are only ever read in or
+ * charged for the odd block don't pay for them.  Dquots that had slack set up
+ * but have no limit to enforce any more get much bigger batches, as the only
+ * cost of slack there is a slightly overstated usage snapshot.
+ */
+#define XFS_DQ_SLACK_BATCH	256	/* blocks handed to a CPU at a time */
+#define XFS_DQ_SLACK_BATCH_NOLIMIT (16 * XFS_DQ_SLACK_BATCH)
+
+/* Take @nblks from this CPU's slack.  Returns false if there isn't enough. */
+bool
+xfs_dqslack_get(
+	struct xfs_dquot	*dqp,
+	long			nblks)
+{
+	atomic64_t __percpu	*pcp = READ_ONCE(dqp->q_slack);
+	atomic64_t		*slack;
+	int64_t			old, cur;
+	bool			ret = false;
+
+	if (!pcp)
+		return false;
+
+	slack = get_cpu_ptr(pcp);
+	cur = atomic64_read(slack);
+	while (cur >= nblks) {
+		old = atomic64_cmpxchg(slack, cur, cur - nblks);
+		if (old == cur) {
+			ret = true;
+			break;
+		}
+		cur = old;
+	}
+	put_cpu_ptr(pcp);
+	return ret;
+}
+
+/* Give @nblks back to this CPU's slack, if it isn't already full. */
+bool
+xfs_dqslack_put(
+	struct xfs_dquot	*dqp,
+	long			nblks)
+{
+	atomic64_t __percpu	*pcp = READ_ONCE(dqp->q_slack);
+	atomic64_t		*slack;
+	int64_t			old, cur;
+	bool			ret = false;
+
+	if (!pcp)
+		return false;
+
+	slack = get_cpu_ptr(pcp);
+	cur = atomic64_read(slack);
+	while (cur + nblks <= 2 * READ_ONCE(dqp->q_slack_batch)) {
+		old = atomic64_cmpxchg(slack, cur, cur + nblks);
+		if (old == cur) {
+			ret = true;
+			break;
+		}
+		cur = old;
+	}
+	put_cpu_ptr(pcp);
+	return ret;
+}
+
+/*
+ * Top up this CPU's slack from the dquot if there is room below @limit (zero
+ * means no limit).  Called with the dquot locked.
+ */
+void
+xfs_dqslack_refill(
+	struct xfs_dquot	*dqp,
+	xfs_qcnt_t		limit)
+{
+	atomic64_t __percpu	*pcp;
+	atomic64_t		*slack;
+	int64_t			cur;
+	int			batch;
+
+	ASSERT(XFS_DQ_IS_LOCKED(dqp));
+
+	if (!dqp->q_slack) {
+		if (!limit)
+			return;
+		/* if this fails all reservations just take the dquot lock */
+		pcp = alloc_percpu_gfp(atomic64_t, GFP_NOFS);
+		if (!pcp)
+			return;
+		/* lockless users must see the zeroed counters */
+		smp_store_release(&dqp->q_slack, pcp);
+	}
+	batch = limit ? XFS_DQ_SLACK_BATCH : XFS_DQ_SLACK_BATCH_NOLIMIT;
+	WRITE_ONCE(dqp->q_slack_batch, batch);
+	if (limit && dqp->q_res_bcount + batch > limit)
+		return;
+
+	slack = get_cpu_ptr(dqp->q_slack);
+	cur = atomic64_read(slack);
+	if (cur < batch) {
+		atomic64_add(batch, slack);
+		dqp->q_res_bcount += batch;
+	}
+	put_cpu_ptr(dqp->q_slack);
+}
+
+/* Return all the per-cpu slack to the dquot.  Called with the dquot locked. */
+void
+xfs_dqslack_drain(
+	struct xfs_dquot	*dqp)
+{
+	int			cpu;
+
+	ASSERT(XFS_DQ_IS_LOCKED(dqp));
+
+	if (!dqp->q_slack)
+		return;
+
+	for_each_possible_cpu(cpu)
+		dqp->q_res_bcount -= atomic64_xchg(per_cpu_ptr(dqp->q_slack,
+							       cpu), 0);
+	ASSERT(dqp->q_res_bcount >= be64_to_cpu(dqp->q_core.d_bcount));
+}
+
+/*
+ * Project usage snapshots.
+ *
+ * statfs on a project quota directory and project usage reports only need
+ * a recent view of a project's usage and limits.  Rather than looking up and
+ * locking the dquot for each of them, project dquots publish their counters
+ * into a snapshot in qi_psnap_tree every time they are unlocked, which
+ * covers transaction commits, reservations and limit changes.  Readers look
+ * the snapshot up under RCU and copy it out under its seqcount.
+ *
+ * The block count includes any per-cpu slack (see above) that hasn't been
+ * handed out yet, so usage can be overstated by a few batches; callers that
+ * need an exact figure still go to the dquot.
+ */
+
+/* Copy the dquot's counters into a snapshot.  Called with the dquot locked. */
+void
+xfs_dqsnap_fill(
+	struct xfs_dquot	*dqp,
+	struct xfs_dqsnap	*snap)
+{
+	snap->ds_bcount = dqp->q_res_bcount;
+	snap->ds_icount = dqp->q_res_icount;
+	snap->ds_blk_softlimit = be64_to_cpu(dqp->q_core.d_blk_softlimit);
+	snap->ds_blk_hardlimit = be64_to_cpu(dqp->q_core.d_blk_hardlimit);
+	snap->ds_ino_softlimit = be64_to_cpu(dqp->q_core.d_ino_softlimit);
+	snap->ds_ino_hardlimit = be64_to_cpu(dqp->q_core.d_ino_hardlimit);
+}
+
+/* Publish the dquot's counters.  Called with the dquot locked. */
+void
+xfs_dqsnap_update(
+	struct xfs_dquot	*dqp)
+{
+	struct xfs_dqsnap	*snap = dqp->q_snap;
+
+	ASSERT(XFS_DQ_IS_LOCKED(dqp));
+
+	write_seqcount_begin(&snap->ds_seq);
+	xfs_dqsnap_fill(dqp, snap);
+	write_seqcount_end(&snap->ds_seq);
+}
+
+/*
+ * Hook a newly cached project dquot up to its snapshot, creating the
+ * snapshot the first time the project is seen.  Called with the dquot and
+ * qi_tree_lock held.  If we can't allocate a snapshot the project is simply
+ * read the slow way.
+ */
+void
+xfs_dqsnap_attach(
+	struct xfs_quotainfo	*qi,
+	struct xfs_dquot	*dqp)
+{
+	xfs_dqid_t		id = be32_to_cpu(dqp->q_core.d_id);
+	struct xfs_dqsnap	*snap;
+
+	ASSERT(XFS_QM_ISPDQ(dqp));
+
+	snap = radix_tree_lookup(&qi->qi_psnap_tree, id);
+	if (!snap) {
+		snap = kmem_zalloc(sizeof(*snap), KM_NOFS | KM_MAYFAIL);
+		if (!snap)
+			return;
+		seqcount_init(&snap->ds_seq);
+		snap->ds_id = id;
+		xfs_dqsnap_fill(dqp, snap);
+		if (radix_tree_insert(&qi->qi_psnap_tree, id, snap)) {
+			kmem_free(snap);
+			return;
+		}
+	}
+	dqp->q_snap = snap;
+	xfs_dqsnap_update(dqp);
+}
+
+/* Take a consistent copy of a snapshot.  Called under rcu_read_lock. */
+void
+xfs_dqsnap_copy(
+	struct xfs_dqsnap	*snap,
+	struct xfs_dqsnap	*out)
+{
+	unsigned int		seq;
+
+	do {
+		seq = read_seqcount_begin(&snap->ds_seq);
+		out->ds_id = snap->ds_id;
+		out->ds_bcount = snap->ds_bcount;
+		out->ds_icount = snap->ds_icount;
+		out->ds_blk_softlimit = snap->ds_blk_softlimit;
+		out->ds_blk_hardlimit = snap->ds_blk_hardlimit;
+		out->ds_ino_softlimit = snap->ds_ino_softlimit;
+		out->ds_ino_hardlimit = snap->ds_ino_hardlimit;
+	} while (read_seqcount_retry(&snap->ds_seq, seq));
+}
+
+/* Copy out the snapshot for project @id.  Returns false if there is none. */
+bool
+xfs_dqsnap_read(
+	struct xfs_mount	*mp,
+	xfs_dqid_t		id,
+	struct xfs_dqsnap	*out)
+{
+	struct xfs_dqsnap	*snap;
+
+	rcu_read_lock();
+	snap = radix_tree_lookup(&mp->m_quotainfo->qi_psnap_tree, id);
+	if (snap)
+		xfs_dqsnap_copy(snap, out);
+	rcu_read_unlock();
+	return snap != NULL;
+}
+
 /*
  * If default limits are in force, push them into the dquot now.
  * We overwrite the dquot limits only if they are zero and this
@@ -583,6 +834,7 @@ xfs_qm_dqread(
 	INIT_LIST_HEAD(&dqp->q_lru);
 	mutex_init(&dqp->q_qlock);
 	init_waitqueue_head(&dqp->q_pinwait);
+	dqp->q_slack_batch = XFS_DQ_SLACK_BATCH;
 
 	/*
 	 * Because we want to use a counting completion, complete
@@ -892,6 +1144,8 @@ xfs_qm_dqget(
 	 */
 	xfs_dqlock(dqp);
 	dqp->q_nrefs = 1;
+	if (type == XFS_DQ_PROJ)
+		xfs_dqsnap_attach(qi, dqp);
 
 	qi->qi_dquots++;
 	mutex_unlock(&qi->qi_tree_lock);
@@ -965,9 +1219,10 @@ xfs_qm_dqrele(
 /*
  * This is the dquot flushing I/O completion routine.  It is called
  * from interrupt level when the buffer containing the dquot is
- * flushed to disk.  It is responsible for removing the dquot logitem
- * from the AIL if it has not been re-logged, and unlocking the dquot's
- * flush lock. This behavior is very similar to that of inodes..
+ * flushed to disk.  It is responsible for unlocking the dquot's
+ * flush lock. The dquot logitem has already been removed from the AIL
+ * by xfs_buf_do_callbacks() if it had not been re-logged, just like
+ * inodes.
  */
 STATIC void
 xfs_qm_dqflush_done(
@@ -975,32 +1230,151 @@ xfs_qm_dqflush_done(
 	struct xfs_log_item	*lip)
 {
 	xfs_dq_logitem_t	*qip = (struct xfs_dq_logitem *)lip;
-	xfs_dquot_t		*dqp = qip->qli_dquot;
-	struct xfs_ail		*ailp = lip->li_ailp;
 
 	/*
-	 * We only want to pull the item from the AIL if its
-	 * location in the log has not changed since we started the flush.
-	 * Thus, we only bother if the dquot's lsn has
-	 * not changed. First we check the lsn outside the lock
-	 * since it's cheaper, and then we recheck while
-	 * holding the lock before removing the dquot from the AIL.
+	 * Release the dq's flush lock since we're done with it.
+	 */
+	xfs_dqfunlock(qip->qli_dquot);
+}
+
+/*
+ * Copy a locked and flush locked dquot into its buffer and attach it to the
+ * buffer so the flush lock is dropped once the buffer has been written.
+ */
+STATIC int
+xfs_qm_dqflush_int(
+	struct xfs_dquot	*dqp,
+	struct xfs_buf		*bp)
+{
+	struct xfs_mount	*mp = dqp->q_mount;
+	struct xfs_disk_dquot	*ddqp;
+	int			error;
+
+	/*
+	 * Calculate the location of the dquot inside the buffer.
+	 */
+	ddqp = bp->b_addr + dqp->q_bufoffset;
+
+	/*
+	 * A simple sanity check in case we got a corrupted dquot..
+	 */
+	error = xfs_dqcheck(mp, &dqp->q_core, be32_to_cpu(ddqp->d_id), 0,
+			   XFS_QMOPT_DOWARN, "dqflush (incore copy)");
+	if (error)
+		return error;
+
+	/* This is the only portion of data that needs to persist */
+	memcpy(ddqp, &dqp->q_core, sizeof(xfs_disk_dquot_t));
+
+	/*
+	 * Clear the dirty field and remember the flush lsn for later use.
+	 */
+	dqp->dq_flags &= ~XFS_DQ_DIRTY;
+
+	xfs_trans_ail_copy_lsn(mp->m_ail, &dqp->q_logitem.qli_flush_lsn,
+					&dqp->q_logitem.qli_item.li_lsn);
+
+	/*
+	 * copy the lsn into the on-disk dquot now while we have the in memory
+	 * dquot here. This can't be done later in the write verifier as we
+	 * can't get access to the log item at that point in time.
+	 *
+	 * We also calculate the CRC here so that the on-disk dquot in the
+	 * buffer always has a valid CRC. This ensures there is no possibility
+	 * of a dquot without an up-to-date CRC getting to disk.
 	 */
-	if ((lip->li_flags & XFS_LI_IN_AIL) &&
-	    lip->li_lsn == qip->qli_flush_lsn) {
-
-		/* xfs_trans_ail_delete() drops the AIL lock. */
-		spin_lock(&ailp->xa_lock);
-		if (lip->li_lsn == qip->qli_flush_lsn)
-			xfs_trans_ail_delete(ailp, lip, SHUTDOWN_CORRUPT_INCORE);
-		else
-			spin_unlock(&ailp->xa_lock);
+	if (xfs_sb_version_hascrc(&mp->m_sb)) {
+		struct xfs_dqblk *dqb = (struct xfs_dqblk *)ddqp;
+
+		dqb->dd_lsn = cpu_to_be64(dqp->q_logitem.qli_item.li_lsn);
+		xfs_update_cksum((char *)dqb, sizeof(struct xfs_dqblk),
+				 XFS_DQUOT_CRC_OFF);
 	}
 
 	/*
-	 * Release the dq's flush lock since we're done with it.
+	 * Attach an iodone routine so that we can remove this dquot from the
+	 * AIL and release the flush lock once the dquot is synced to disk.
 	 */
-	xfs_dqfunlock(dqp);
+	xfs_buf_attach_iodone(bp, xfs_qm_dqflush_done,
+				  &dqp->q_logitem.qli_item);
+	return 0;
+}
+
+#define XFS_DQFLUSH_BATCH	32
+
+/*
+ * Flush the other dirty dquots that live in the same buffer as dqp, the way
+ * xfs_iflush_cluster does for inodes.  The AIL would otherwise push each of
+ * them separately, with a buffer lookup and lock for every single dquot;
+ * once they are flush locked here those pushes just skip them.
+ *
+ * The tree lock nests outside the dquot locks and we already hold one, so
+ * this is purely opportunistic: if anything is contended we skip it.
+ */
+STATIC void
+xfs_qm_dqflush_cluster(
+	struct xfs_dquot	*dqp,
+	struct xfs_buf		*bp)
+{
+	struct xfs_mount	*mp = dqp->q_mount;
+	struct xfs_quotainfo	*qi = mp->m_quotainfo;
+	struct radix_tree_root	*tree;
+	struct xfs_dquot	*batch[XFS_DQFLUSH_BATCH];
+	xfs_dqid_t		id = be32_to_cpu(dqp->q_core.d_id);
+	xfs_dqid_t		next_id;
+	xfs_dqid_t		end_id;
+	int			nr_found;
+	int			i;
+
+	tree = xfs_dquot_tree(qi, dqp->dq_flags & XFS_DQ_ALLTYPES);
+	next_id = id - (id % qi->qi_dqperchunk);
+	end_id = next_id + qi->qi_dqperchunk;
+
+	if (!mutex_trylock(&qi->qi_tree_lock))
+		return;
+
+	while (next_id < end_id) {
+		nr_found = radix_tree_gang_lookup(tree, (void **)batch,
+				next_id, XFS_DQFLUSH_BATCH);
+		if (!nr_found)
+			break;
+
+		for (i = 0; i < nr_found; i++) {
+			struct xfs_dquot *cdqp = batch[i];
+
+			next_id = be32_to_cpu(cdqp->q_core.d_id) + 1;
+			if (next_id > end_id || next_id == 0) {
+				next_id = end_id;
+				break;
+			}
+			if (cdqp == dqp || cdqp->q_blkno != dqp->q_blkno)
+				continue;
+
+			/* unlocked check first, then again under the locks */
+			if (!XFS_DQ_IS_DIRTY(cdqp) ||
+			    atomic_read(&cdqp->q_pincount))
+				continue;
+			if (!xfs_dqlock_nowait(cdqp))
+				continue;
+			if ((cdqp->dq_flags & XFS_DQ_FREEING) ||
+			    !XFS_DQ_IS_DIRTY(cdqp) ||
+			    atomic_read(&cdqp->q_pincount) ||
+			    !xfs_dqflock_nowait(cdqp)) {
+				xfs_dqunlock(cdqp);
+				continue;
+			}
+
+			if (xfs_qm_dqflush_int(cdqp, bp)) {
+				xfs_dqfunlock(cdqp);
+				xfs_dqunlock(cdqp);
+				xfs_force_shutdown(mp, SHUTDOWN_CORRUPT_INCORE);
+				goto out_unlock;
+			}
+			xfs_dqunlock(cdqp);
+		}
+	}
+out_unlock:
+	mutex_unlock(&qi->qi_tree_lock);
 }
 
 /*
@@ -1018,7 +1392,6 @@ xfs_qm_dqflush(
 {
 	struct xfs_mount	*mp = dqp->q_mount;
 	struct xfs_buf		*bp;
-	struct xfs_disk_dquot	*ddqp;
 	int			error;
 
 	ASSERT(XFS_DQ_IS_LOCKED(dqp));
@@ -1057,16 +1430,7 @@ xfs_qm_dqflush(
 	if (error)
 		goto out_unlock;
 
-	/*
-	 * Calculate the location of the dquot inside the buffer.
-	 */
-	ddqp = bp->b_addr + dqp->q_bufoffset;
-
-	/*
-	 * A simple sanity check in case we got a corrupted dquot..
-	 */
-	error = xfs_dqcheck(mp, &dqp->q_core, be32_to_cpu(ddqp->d_id), 0,
-			   XFS_QMOPT_DOWARN, "dqflush (incore copy)");
+	error = xfs_qm_dqflush_int(dqp, bp);
 	if (error) {
 		xfs_buf_relse(bp);
 		xfs_dqfunlock(dqp);
@@ -1074,40 +1438,7 @@ xfs_qm_dqflush(
 		return -EIO;
 	}
 
-	/* This is the only portion of data that needs to persist */
-	memcpy(ddqp, &dqp->q_core, sizeof(xfs_disk_dquot_t));
-
-	/*
-	 * Clear the dirty field and remember the flush lsn for later use.
-	 */
-	dqp->dq_flags &= ~XFS_DQ_DIRTY;
-
-	xfs_trans_ail_copy_lsn(mp->m_ail, &dqp->q_logitem.qli_flush_lsn,
-					&dqp->q_logitem.qli_item.li_lsn);
-
-	/*
-	 * copy the lsn into the on-disk dquot now while we have the in memory
-	 * dquot here. This can't be done later in the write verifier as we
-	 * can't get access to the log item at that point in time.
-	 *
-	 * We also calculate the CRC here so that the on-disk dquot in the
-	 * buffer always has a valid CRC. This ensures there is no possibility
-	 * of a dquot without an up-to-date CRC getting to disk.
-	 */
-	if (xfs_sb_version_hascrc(&mp->m_sb)) {
-		struct xfs_dqblk *dqb = (struct xfs_dqblk *)ddqp;
-
-		dqb->dd_lsn = cpu_to_be64(dqp->q_logitem.qli_item.li_lsn);
-		xfs_update_cksum((char *)dqb, sizeof(struct xfs_dqblk),
-				 XFS_DQUOT_CRC_OFF);
-	}
-
-	/*
-	 * Attach an iodone routine so that we can remove this dquot from the
-	 * AIL and release the flush lock once the dquot is synced to disk.
-	 */
-	xfs_buf_attach_iodone(bp, xfs_qm_dqflush_done,
-				  &dqp->q_logitem.qli_item);
+	xfs_qm_dqflush_cluster(dqp, bp);
 
 	/*
 	 * If the buffer is pinned then push on the log so we won't
@@ -31,6 +31,7 @@
 
 struct xfs_mount;
 struct xfs_trans;
+struct xfs_quotainfo;
 
 enum {
 	XFS_QLOWSP_1_PCNT = 0,
@@ -42,6 +43,24 @@ enum {
 /*
  * The incore dquot structure
  */
+/*
+ * Usage and limits of a project dquot, kept up to date each time the dquot
+ * is unlocked so that statfs and usage reports can read them under RCU
+ * without looking up or locking the dquot.  Snapshots outlive their dquots
+ * and are only freed with the quotainfo.
+ */
+struct xfs_dqsnap {
+	seqcount_t	ds_seq;
+	xfs_dqid_t	ds_id;		/* project id */
+	xfs_qcnt_t	ds_bcount;	/* blocks used and reserved */
+	xfs_qcnt_t	ds_icount;	/* inodes used and reserved */
+	xfs_qcnt_t	ds_blk_softlimit;
+	xfs_qcnt_t	ds_blk_hardlimit;
+	xfs_qcnt_t	ds_ino_softlimit;
+	xfs_qcnt_t	ds_ino_hardlimit;
+	struct rcu_head	ds_rcu;
+};
+
 typedef struct xfs_dquot {
 	uint		 dq_flags;	/* various flags (XFS_DQ_*) */
 	struct list_head q_lru;		/* global free list of dquots */
@@ -55,8 +74,11 @@ typedef struct xfs_dquot {
 	xfs_disk_dquot_t q_core;	/* actual usage & quotas */
 	xfs_dq_logitem_t q_logitem;	/* dquot log item */
 	xfs_qcnt_t	 q_res_bcount;	/* total regular nblks used+reserved */
+	atomic64_t __percpu *q_slack;	/* per-cpu unused part of res_bcount */
+	int		 q_slack_batch;	/* current slack refill size */
 	xfs_qcnt_t	 q_res_icount;	/* total inos allocd+reserved */
 	xfs_qcnt_t	 q_res_rtbcount;/* total realtime blks used+reserved */
+	struct xfs_dqsnap *q_snap;	/* lockless usage snapshot */
 	xfs_qcnt_t	 q_prealloc_lo_wmark;/* prealloc throttle wmark */
 	xfs_qcnt_t	 q_prealloc_hi_wmark;/* prealloc disabled wmark */
 	int64_t		 q_low_space[XFS_QLOWSP_MAX];
@@ -106,8 +128,12 @@ static inline void xfs_dqlock(struct xfs_dquot *dqp)
 	mutex_lock(&dqp->q_qlock);
 }
 
+extern void		xfs_dqsnap_update(struct xfs_dquot *);
+
 static inline void xfs_dqunlock(struct xfs_dquot *dqp)
 {
+	if (dqp->q_snap)
+		xfs_dqsnap_update(dqp);
 	mutex_unlock(&dqp->q_qlock);
 }
 
@@ -177,6 +203,19 @@ extern void		xfs_dqlock2(struct xfs_dquot *, struct xfs_dquot *);
 
 extern void		xfs_dquot_set_prealloc_limits(struct xfs_dquot *);
 
+extern bool		xfs_dqslack_get(struct xfs_dquot *, long);
+extern bool		xfs_dqslack_put(struct xfs_dquot *, long);
+extern void		xfs_dqslack_refill(struct xfs_dquot *, xfs_qcnt_t);
+extern void		xfs_dqslack_drain(struct xfs_dquot *);
+extern void		xfs_dqsnap_fill(struct xfs_dquot *,
+					struct xfs_dqsnap *);
+extern void		xfs_dqsnap_attach(struct xfs_quotainfo *,
+					  struct xfs_dquot *);
+extern void		xfs_dqsnap_copy(struct xfs_dqsnap *,
+					struct xfs_dqsnap *);
+extern bool		xfs_dqsnap_read(struct xfs_mount *, xfs_dqid_t,
+					struct xfs_dqsnap *);
+
 static inline struct xfs_dquot *xfs_qm_dqhold(struct xfs_dquot *dqp)
 {
 	xfs_dqlock(dqp);
@@ -231,6 +231,21 @@ xfs_qm_dquot_logitem_committing(
 {
 }
 
+/*
+ * Called with the AIL lock held when the buffer the dquot was flushed to has
+ * been written. We only want to pull the item from the AIL if its location in
+ * the log has not changed since we started the flush.
+ */
+STATIC bool
+xfs_qm_dquot_logitem_written(
+	struct xfs_log_item	*lip)
+{
+	struct xfs_dq_logitem	*qlip = DQUOT_ITEM(lip);
+
+	return (lip->li_flags & XFS_LI_IN_AIL) &&
+	       lip->li_lsn == qlip->qli_flush_lsn;
+}
+
 /*
  * This is the ops vector for dquots
  */
@@ -242,7 +257,8 @@ static const struct xfs_item_ops xfs_dquot_item_ops = {
 	.iop_unlock	= xfs_qm_dquot_logitem_unlock,
 	.iop_committed	= xfs_qm_dquot_logitem_committed,
 	.iop_push	= xfs_qm_dquot_logitem_push,
-	.iop_committing = xfs_qm_dquot_logitem_committing
+	.iop_committing = xfs_qm_dquot_logitem_committing,
+	.iop_written	= xfs_qm_dquot_logitem_written,
 };
 
 /*
@@ -133,6 +133,27 @@ xfs_nfs_get_inode(
 	if (ino == 0)
 		return ERR_PTR(-ESTALE);
 
+	/*
+	 * Hot file handles usually refer to inodes that are still in the
+	 * inode cache.  An inode we find there has already been read and
+	 * verified, so if it is allocated we can trust the inode number
+	 * without walking the inobt and check the generation directly.  A
+	 * cached inode with a different generation means the handle is
+	 * stale.  Anything else (a miss, or an inode that is being set up
+	 * or torn down) falls back to the fully validated lookup below.
+	 */
+	error = xfs_iget(mp, NULL, ino, XFS_IGET_UNTRUSTED | XFS_IGET_INCORE,
+			 0, &ip);
+	if (!error) {
+		if (VFS_I(ip)->i_generation != generation) {
+			IRELE(ip);
+			return ERR_PTR(-ESTALE);
+		}
+		return VFS_I(ip);
+	}
+	if (error == -EINVAL)
+		return ERR_PTR(-ESTALE);
+
 	/*
 	 * The XFS_IGET_UNTRUSTED means that an invalid inode number is just
 	 * fine and not an indication of a corrupted filesystem as clients can
@@ -27,17 +27,93 @@
 #include "xfs_mount.h"
 #include "xfs_alloc.h"
 #include "xfs_extent_busy.h"
+#include "xfs_discard.h"
 #include "xfs_trace.h"
 #include "xfs_trans.h"
 #include "xfs_log.h"
 
-void
-xfs_extent_busy_insert(
-	struct xfs_trans	*tp,
+/*
+ * The busy extent tree is modified under pagb_lock, with every change to the
+ * tree topology or to the range of an extent in it wrapped in pagb_seq.  Busy
+ * extents are freed by RCU, so the tree can be searched without the lock by
+ * retrying the walk if pagb_seq changed underneath it.
+ */
+STATIC void
+xfs_extent_busy_free_rcu(
+	struct rcu_head		*head)
+{
+	kmem_free(container_of(head, struct xfs_extent_busy, rcu));
+}
+
+STATIC void
+xfs_extent_busy_free(
+	struct xfs_extent_busy	*busyp)
+{
+	call_rcu(&busyp->rcu, xfs_extent_busy_free_rcu);
+}
+
+/*
+ * Search the busy extent tree for [bno, bno + len) without taking pagb_lock.
+ * Returns 0 for no overlapping busy extent, -1 for an overlapping but not
+ * exact busy extent, and 1 for an exact match.
+ *
+ * New busy extents are only inserted by transactions holding the AGF buffer
+ * lock, so a caller that holds the AGF can rely on a zero return until it
+ * drops the lock; extents may only disappear from the tree underneath it.
+ */
+STATIC int
+xfs_extent_busy_lookup(
+	struct xfs_perag	*pag,
+	xfs_agblock_t		bno,
+	xfs_extlen_t		len)
+{
+	struct rb_node		*rbp;
+	struct xfs_extent_busy	*busyp;
+	unsigned int		seq;
+	int			match;
+
+	if (!READ_ONCE(pag->pagb_tree.rb_node))
+		return 0;
+
+	rcu_read_lock();
+	do {
+		seq = read_seqcount_begin(&pag->pagb_seq);
+		match = 0;
+		rbp = READ_ONCE(pag->pagb_tree.rb_node);
+
+		/* find closest start bno overlap */
+		while (rbp) {
+			busyp = rb_entry(rbp, struct xfs_extent_busy, rb_node);
+			if (bno < busyp->bno) {
+				/* may overlap, but exact start block is lower */
+				if (bno + len > busyp->bno)
+					match = -1;
+				rbp = READ_ONCE(rbp->rb_left);
+			} else if (bno > busyp->bno) {
+				/* may overlap, but exact start block is higher */
+				if (bno < busyp->bno + busyp->length)
+					match = -1;
+				rbp = READ_ONCE(rbp->rb_right);
+			} else {
+				/* bno matches busyp, length determines exact match */
+				match = (busyp->length == len) ? 1 : -1;
+				break;
+			}
+		}
+	} while (read_seqcount_retry(&pag->pagb_seq, seq));
+	rcu_read_unlock();
+
+	return match;
+}
+
+STATIC void
+xfs_extent_busy_insert_list(
+	struct xfs_mount	*mp,
 	xfs_agnumber_t		agno,
 	xfs_agblock_t		bno,
 	xfs_extlen_t		len,
-	unsigned int		flags)
+	unsigned int		flags,
+	struct list_head	*busy_list)
 {
 	struct xfs_extent_busy	*new;
 	struct xfs_extent_busy	*busyp;
@@ -53,9 +129,9 @@ xfs_extent_busy_insert(
 	new->flags = flags;
 
 	/* trace before insert to be able to see failed inserts */
-	trace_xfs_extent_busy(tp->t_mountp, agno, bno, len);
+	trace_xfs_extent_busy(mp, agno, bno, len);
 
-	pag = xfs_perag_get(tp->t_mountp, new->agno);
+	pag = xfs_perag_get(mp, new->agno);
 	spin_lock(&pag->pagb_lock);
 	rbp = &pag->pagb_tree.rb_node;
 	while (*rbp) {
@@ -73,22 +149,53 @@ xfs_extent_busy_insert(
 		}
 	}
 
-	rb_link_node(&new->rb_node, parent, rbp);
+	write_seqcount_begin(&pag->pagb_seq);
+	rb_link_node_rcu(&new->rb_node, parent, rbp);
 	rb_insert_color(&new->rb_node, &pag->pagb_tree);
+	write_seqcount_end(&pag->pagb_seq);
 
-	list_add(&new->list, &tp->t_busy);
+	list_add(&new->list, busy_list);
 	spin_unlock(&pag->pagb_lock);
 	xfs_perag_put(pag);
 }
 
+void
+xfs_extent_busy_insert(
+	struct xfs_trans	*tp,
+	xfs_agnumber_t		agno,
+	xfs_agblock_t		bno,
+	xfs_extlen_t		len,
+	unsigned int		flags)
+{
+	xfs_extent_busy_insert_list(tp->t_mountp, agno, bno, len, flags,
+				    &tp->t_busy);
+}
+
+/*
+ * Mark a free extent as undergoing a discard so that allocators leave it
+ * alone until the discard has completed and the extent is removed again with
+ * xfs_extent_busy_clear().  The caller must hold the AGF buffer lock and must
+ * have checked that the range does not overlap any existing busy extent.
+ */
+void
+xfs_extent_busy_insert_discard(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
+	xfs_agblock_t		bno,
+	xfs_extlen_t		len,
+	struct list_head	*busy_list)
+{
+	xfs_extent_busy_insert_list(mp, agno, bno, len,
+				    XFS_EXTENT_BUSY_DISCARDED, busy_list);
+}
+
 /*
  * Search for a busy extent within the range of the extent we are about to
- * allocate.  You need to be holding the busy extent tree lock when calling
- * xfs_extent_busy_search(). This function returns 0 for no overlapping busy
- * extent, -1 for an overlapping but not exact busy extent, and 1 for an exact
- * match. This is done so that a non-zero return indicates an overlap that
- * will require a synchronous transaction, but it can still be
- * used to distinguish between a partial or exact match.
+ * allocate.  This function returns 0 for no overlapping busy extent, -1 for an
+ * overlapping but not exact busy extent, and 1 for an exact match. This is
+ * done so that a non-zero return indicates an overlap that will require a
+ * synchronous transaction, but it can still be used to distinguish between a
+ * partial or exact match.  The search does not take the busy extent tree lock.
  */
 int
 xfs_extent_busy_search(
@@ -98,35 +205,10 @@ xfs_extent_busy_search(
 	xfs_extlen_t		len)
 {
 	struct xfs_perag	*pag;
-	struct rb_node		*rbp;
-	struct xfs_extent_busy	*busyp;
-	int			match = 0;
+	int			match;
 
 	pag = xfs_perag_get(mp, agno);
-	spin_lock(&pag->pagb_lock);
-
-	rbp = pag->pagb_tree.rb_node;
-
-	/* find closest start bno overlap */
-	while (rbp) {
-		busyp = rb_entry(rbp, struct xfs_extent_busy, rb_node);
-		if (bno < busyp->bno) {
-			/* may overlap, but exact start block is lower */
-			if (bno + len > busyp->bno)
-				match = -1;
-			rbp = rbp->rb_left;
-		} else if (bno > busyp->bno) {
-			/* may overlap, but exact start block is higher */
-			if (bno < busyp->bno + busyp->length)
-				match = -1;
-			rbp = rbp->rb_right;
-		} else {
-			/* bno matches busyp, length determines exact match */
-			match = (busyp->length == len) ? 1 : -1;
-			break;
-		}
-	}
-	spin_unlock(&pag->pagb_lock);
+	match = xfs_extent_busy_lookup(pag, bno, len);
 	xfs_perag_put(pag);
 	return match;
 }
@@ -163,6 +245,8 @@ xfs_extent_busy_update_extent(
 	 */
 	if (busyp->flags & XFS_EXTENT_BUSY_DISCARDED) {
 		spin_unlock(&pag->pagb_lock);
+		if (busyp->flags & XFS_EXTENT_BUSY_DISCARD_PENDING)
+			xfs_discard_kick(mp);
 		delay(1);
 		spin_lock(&pag->pagb_lock);
 		return false;
@@ -237,8 +321,10 @@ xfs_extent_busy_update_extent(
 		 * tree root, because erasing the node can rearrange the
 		 * tree topology.
 		 */
+		write_seqcount_begin(&pag->pagb_seq);
 		rb_erase(&busyp->rb_node, &pag->pagb_tree);
 		busyp->length = 0;
+		write_seqcount_end(&pag->pagb_seq);
 		return false;
 	} else if (fend < bend) {
 		/*
@@ -255,7 +341,10 @@ xfs_extent_busy_update_extent(
 		 *    fbno            fend
 		 *
 		 */
+		write_seqcount_begin(&pag->pagb_seq);
+		busyp->length = bend - fend;
 		busyp->bno = fend;
+		write_seqcount_end(&pag->pagb_seq);
 	} else if (bbno < fbno) {
 		/*
 		 * Case 8:
@@ -270,7 +359,9 @@ xfs_extent_busy_update_extent(
 		 *        +----------------------+
 		 *        fbno                fend
 		 */
+		write_seqcount_begin(&pag->pagb_seq);
 		busyp->length = fbno - busyp->bno;
+		write_seqcount_end(&pag->pagb_seq);
 	} else {
 		ASSERT(0);
 	}
@@ -304,6 +395,11 @@ xfs_extent_busy_reuse(
 	ASSERT(flen > 0);
 
 	pag = xfs_perag_get(mp, agno);
+	if (!xfs_extent_busy_lookup(pag, fbno, flen)) {
+		xfs_perag_put(pag);
+		return;
+	}
+
 	spin_lock(&pag->pagb_lock);
 restart:
 	rbp = pag->pagb_tree.rb_node;
@@ -355,6 +451,10 @@ xfs_extent_busy_trim(
 
 	ASSERT(*len > 0);
 
+	/* Nothing busy in this range, which is the common case. */
+	if (!xfs_extent_busy_lookup(args->pag, *bno, *len))
+		return false;
+
 	spin_lock(&args->pag->pagb_lock);
 restart:
 	fbno = *bno;
@@ -375,6 +475,10 @@ xfs_extent_busy_trim(
 			continue;
 		}
 
+		/* Remember what we hit so xfs_extent_busy_flush can wait on it */
+		args->busy_start = min(args->busy_start, bbno);
+		args->busy_end = max(args->busy_end, bend);
+
 		/*
 		 * If this is a metadata allocation, try to reuse the busy
 		 * extent instead of trimming the allocation.
@@ -540,22 +644,33 @@ xfs_extent_busy_clear_one(
 	if (busyp->length) {
 		trace_xfs_extent_busy_clear(mp, busyp->agno, busyp->bno,
 						busyp->length);
+		write_seqcount_begin(&pag->pagb_seq);
 		rb_erase(&busyp->rb_node, &pag->pagb_tree);
+		write_seqcount_end(&pag->pagb_seq);
 	}
 
 	list_del_init(&busyp->list);
-	kmem_free(busyp);
+	xfs_extent_busy_free(busyp);
 }
 
+/*
+ * Range of blocks cleared from the busy extent tree, passed as the wakeup key
+ * to xfs_extent_busy_wake().
+ */
+struct xfs_extent_busy_range {
+	xfs_agblock_t		bno;
+	xfs_agblock_t		end;
+};
+
 static void
 xfs_extent_busy_put_pag(
 	struct xfs_perag	*pag,
-	bool			wakeup)
+	struct xfs_extent_busy_range *cleared)
 		__releases(pag->pagb_lock)
 {
-	if (wakeup) {
+	if (cleared->end) {
 		pag->pagb_gen++;
-		wake_up_all(&pag->pagb_wait);
+		__wake_up(&pag->pagb_wait, TASK_NORMAL, 0, cleared);
 	}
 
 	spin_unlock(&pag->pagb_lock);
@@ -576,56 +691,245 @@ xfs_extent_busy_clear(
 	struct xfs_extent_busy	*busyp, *n;
 	struct xfs_perag	*pag = NULL;
 	xfs_agnumber_t		agno = NULLAGNUMBER;
-	bool			wakeup = false;
+	struct xfs_extent_busy_range cleared = { NULLAGBLOCK, 0 };
 
 	list_for_each_entry_safe(busyp, n, list, list) {
 		if (busyp->agno != agno) {
 			if (pag)
-				xfs_extent_busy_put_pag(pag, wakeup);
+				xfs_extent_busy_put_pag(pag, &cleared);
 			agno = busyp->agno;
 			pag = xfs_perag_get(mp, agno);
 			spin_lock(&pag->pagb_lock);
-			wakeup = false;
+			cleared.bno = NULLAGBLOCK;
+			cleared.end = 0;
 		}
 
 		if (do_discard && busyp->length &&
 		    !(busyp->flags & XFS_EXTENT_BUSY_SKIP_DISCARD)) {
 			busyp->flags = XFS_EXTENT_BUSY_DISCARDED;
 		} else {
+			/*
+			 * Extents already trimmed out of the tree still count
+			 * as a change for waiters that watch the whole AG.
+			 */
+			cleared.bno = min(cleared.bno, busyp->bno);
+			cleared.end = max_t(xfs_agblock_t, cleared.end,
+					    busyp->bno + max_t(xfs_extlen_t,
+							busyp->length, 1));
 			xfs_extent_busy_clear_one(mp, pag, busyp);
-			wakeup = true;
 		}
 	}
 
 	if (pag)
-		xfs_extent_busy_put_pag(pag, wakeup);
+		xfs_extent_busy_put_pag(pag, &cleared);
 }
 
 /*
- * Flush out all busy extents for this AG.
+ * Try to merge @busyp, which is about to be queued for discard, with the
+ * queued extents directly before and after it in the tree.  Returns the extent
+ * that now covers the range of @busyp, which may have been freed.
  */
-void
-xfs_extent_busy_flush(
+STATIC struct xfs_extent_busy *
+xfs_extent_busy_merge_discard(
+	struct xfs_perag	*pag,
+	struct xfs_extent_busy	*busyp)
+{
+	struct xfs_extent_busy	*left = NULL;
+	struct xfs_extent_busy	*right = NULL;
+	struct rb_node		*rbp;
+
+	rbp = rb_prev(&busyp->rb_node);
+	if (rbp) {
+		left = rb_entry(rbp, struct xfs_extent_busy, rb_node);
+		if (!(left->flags & XFS_EXTENT_BUSY_DISCARD_PENDING) ||
+		    left->bno + left->length != busyp->bno)
+			left = NULL;
+	}
+	rbp = rb_next(&busyp->rb_node);
+	if (rbp) {
+		right = rb_entry(rbp, struct xfs_extent_busy, rb_node);
+		if (!(right->flags & XFS_EXTENT_BUSY_DISCARD_PENDING) ||
+		    busyp->bno + busyp->length != right->bno)
+			right = NULL;
+	}
+
+	if (!left && !right)
+		return busyp;
+
+	write_seqcount_begin(&pag->pagb_seq);
+	if (left) {
+		left->length += busyp->length;
+		rb_erase(&busyp->rb_node, &pag->pagb_tree);
+		xfs_extent_busy_free(busyp);
+		busyp = left;
+	}
+	if (right) {
+		right->bno = busyp->bno;
+		right->length += busyp->length;
+		rb_erase(&busyp->rb_node, &pag->pagb_tree);
+		list_del(&busyp->list);
+		xfs_extent_busy_free(busyp);
+		busyp = right;
+	}
+	write_seqcount_end(&pag->pagb_seq);
+	return busyp;
+}
+
+/*
+ * Move the extents that xfs_extent_busy_clear() marked for discard from the
+ * checkpoint's busy list onto the per-AG discard queues.  They stay in the
+ * busy extent tree and hence cannot be allocated until the discard has been
+ * issued and completed, and adjacent queued ranges are merged so that frees
+ * spread over many small checkpoints end up as a few large discards.
+ *
+ * Returns true if any AG has more than @threshold blocks queued.
+ */
+bool
+xfs_extent_busy_queue_discard(
 	struct xfs_mount	*mp,
+	struct list_head	*list,
+	xfs_extlen_t		threshold)
+{
+	struct xfs_extent_busy	*busyp, *n;
+	struct xfs_perag	*pag = NULL;
+	xfs_agnumber_t		agno = NULLAGNUMBER;
+	bool			full = false;
+
+	list_for_each_entry_safe(busyp, n, list, list) {
+		if (busyp->agno != agno) {
+			if (pag) {
+				spin_unlock(&pag->pagb_lock);
+				xfs_perag_put(pag);
+			}
+			agno = busyp->agno;
+			pag = xfs_perag_get(mp, agno);
+			spin_lock(&pag->pagb_lock);
+		}
+
+		ASSERT(busyp->flags & XFS_EXTENT_BUSY_DISCARDED);
+		ASSERT(busyp->length);
+
+		list_del_init(&busyp->list);
+		busyp->flags |= XFS_EXTENT_BUSY_DISCARD_PENDING;
+		pag->pagb_discard_blocks += busyp->length;
+
+		if (xfs_extent_busy_merge_discard(pag, busyp) == busyp)
+			list_add_tail(&busyp->list, &pag->pagb_discard);
+		if (pag->pagb_discard_blocks > threshold)
+			full = true;
+	}
+
+	if (pag) {
+		spin_unlock(&pag->pagb_lock);
+		xfs_perag_put(pag);
+	}
+	return full;
+}
+
+/*
+ * Take all the extents queued for discard in this AG.  Once taken they can no
+ * longer be merged with, and the caller must remove them from the busy extent
+ * tree with xfs_extent_busy_clear() when the discard is done.
+ */
+bool
+xfs_extent_busy_grab_discard(
 	struct xfs_perag	*pag,
+	struct list_head	*list)
+{
+	struct xfs_extent_busy	*busyp;
+
+	if (!pag->pagf_init)
+		return false;
+
+	spin_lock(&pag->pagb_lock);
+	list_for_each_entry(busyp, &pag->pagb_discard, list)
+		busyp->flags &= ~XFS_EXTENT_BUSY_DISCARD_PENDING;
+	list_splice_init(&pag->pagb_discard, list);
+	pag->pagb_discard_blocks = 0;
+	spin_unlock(&pag->pagb_lock);
+
+	return !list_empty(list);
+}
+
+struct xfs_extent_busy_wait {
+	wait_queue_entry_t	wait;
+	xfs_agblock_t		bno;
+	xfs_agblock_t		end;
+};
+
+/*
+ * Only wake waiters in xfs_extent_busy_flush() if the range that was cleared
+ * overlaps the busy extents that held up their allocation.
+ */
+STATIC int
+xfs_extent_busy_wake(
+	wait_queue_entry_t	*wait,
+	unsigned int		mode,
+	int			sync,
+	void			*key)
+{
+	struct xfs_extent_busy_wait *bw =
+		container_of(wait, struct xfs_extent_busy_wait, wait);
+	struct xfs_extent_busy_range *cleared = key;
+
+	if (cleared && (cleared->end <= bw->bno || cleared->bno >= bw->end))
+		return 0;
+	return autoremove_wake_function(wait, mode, sync, key);
+}
+
+/*
+ * Flush out the busy extents that got in the way of the allocation described
+ * by @args and wait for some of them to be cleared.
+ */
+void
+xfs_extent_busy_flush(
+	struct xfs_alloc_arg	*args,
 	unsigned		busy_gen)
 {
-	DEFINE_WAIT		(wait);
+	struct xfs_mount	*mp = args->mp;
+	struct xfs_perag	*pag = args->pag;
+	struct xfs_extent_busy_wait bw = {
+		.wait	= {
+			.private	= current,
+			.func		= xfs_extent_busy_wake,
+			.entry		= LIST_HEAD_INIT(bw.wait.entry),
+		},
+		.bno	= 0,
+		.end	= NULLAGBLOCK,
+	};
 	int			log_flushed = 0, error;
 
+	if (args->busy_end) {
+		bw.bno = args->busy_start;
+		bw.end = args->busy_end;
+	}
+
+	XFS_AG_STATS_INC(pag, as_busy_stalls);
+
 	trace_xfs_log_force(mp, 0, _THIS_IP_);
 	error = _xfs_log_force(mp, XFS_LOG_SYNC, &log_flushed);
 	if (error)
 		return;
 
+	/* Don't wait on space that is only held back by the discard queue. */
+	if (mp->m_flags & XFS_MOUNT_DISCARD)
+		xfs_discard_kick(mp);
+
+	/*
+	 * The extents we hit can also go away by being reused by another
+	 * allocation, which does not wake anyone, so don't sleep for too long
+	 * before checking the generation count again.
+	 */
 	do {
-		prepare_to_wait(&pag->pagb_wait, &wait, TASK_KILLABLE);
+		prepare_to_wait(&pag->pagb_wait, &bw.wait, TASK_KILLABLE);
 		if  (busy_gen != READ_ONCE(pag->pagb_gen))
 			break;
-		schedule();
+		if (fatal_signal_pending(current))
+			break;
+		schedule_timeout(HZ / 10);
 	} while (1);
 
-	finish_wait(&pag->pagb_wait, &wait);
+	finish_wait(&pag->pagb_wait, &bw.wait);
 }
 
 void
@@ -39,6 +39,7 @@
 #include "xfs_pnfs.h"
 #include "xfs_iomap.h"
 #include "xfs_reflink.h"
+#include "xfs_heat.h"
 
 #include <linux/dcache.h>
 #include <linux/falloc.h>
@@ -181,7 +182,7 @@ xfs_file_fsync(
 	}
 
 	if (lsn) {
-		error = _xfs_log_force_lsn(mp, lsn, XFS_LOG_SYNC, &log_flushed);
+		error = xfs_log_force_lsn_group(mp, lsn, &log_flushed);
 		ip->i_itemp->ili_fsync_fields = 0;
 	}
 	xfs_iunlock(ip, XFS_ILOCK_SHARED);
@@ -200,6 +201,106 @@ xfs_file_fsync(
 	return error;
 }
 
+/*
+ * With the hipri mount option, have iomap_dio_rw poll the device for the
+ * completion of synchronous direct I/O instead of sleeping until the interrupt
+ * and the completion work have run.  AIO completions are still reaped by
+ * interrupt.
+ */
+static inline void
+xfs_file_dio_hipri(
+	struct kiocb		*iocb,
+	struct xfs_mount	*mp)
+{
+	if ((mp->m_flags & XFS_MOUNT_HIPRI) && is_sync_kiocb(iocb))
+		iocb->ki_flags |= IOCB_HIPRI;
+}
+
+/*
+ * With the sharedwrite mount option, buffered writes that neither append nor
+ * extend the file only take the iolock shared, so that threads writing to
+ * different parts of a file don't serialise on it.  Truncate and extending
+ * writes still take it exclusively and so keep i_size stable for us.  DAX
+ * overwrites do the same on any mount.  To keep each write atomic with respect
+ * to other I/O, every shared iolock holder that could overlap such a write
+ * also locks the byte range it works on for the duration of the copy or the
+ * direct I/O submission: writers exclusively, readers shared.
+ */
+struct xfs_wrange {
+	struct list_head	wr_list;
+	xfs_off_t		wr_start;
+	xfs_off_t		wr_end;		/* exclusive */
+	bool			wr_write;
+};
+
+static inline bool
+xfs_file_ranged_io(
+	struct xfs_inode	*ip)
+{
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
+
+	return (ip->i_mount->m_flags & XFS_MOUNT_SHAREDWRITE) ||
+	       IS_DAX(VFS_I(ip)) ||
+	       (io && !list_empty_careful(&io->iio_wranges));
+}
+
+static bool
+xfs_wrange_trylock(
+	struct xfs_inode_io	*io,
+	struct xfs_wrange	*wr)
+{
+	struct xfs_wrange	*cur;
+
+	spin_lock(&io->iio_wrange_wait.lock);
+	list_for_each_entry(cur, &io->iio_wranges, wr_list) {
+		if ((wr->wr_write || cur->wr_write) &&
+		    cur->wr_start < wr->wr_end && wr->wr_start < cur->wr_end) {
+			spin_unlock(&io->iio_wrange_wait.lock);
+			return false;
+		}
+	}
+	list_add_tail(&wr->wr_list, &io->iio_wranges);
+	spin_unlock(&io->iio_wrange_wait.lock);
+	return true;
+}
+
+/*
+ * Lock [pos, pos + count) against overlapping I/O, exclusively for writes.
+ * Returns -EAGAIN instead of sleeping for nowait I/O.
+ */
+STATIC int
+xfs_wrange_lock(
+	struct xfs_inode	*ip,
+	struct xfs_wrange	*wr,
+	xfs_off_t		pos,
+	size_t			count,
+	bool			write,
+	bool			nowait)
+{
+	struct xfs_inode_io	*io = xfs_inode_io_get(ip);
+
+	wr->wr_start = pos;
+	wr->wr_end = pos + count;
+	wr->wr_write = write;
+	if (nowait)
+		return xfs_wrange_trylock(io, wr) ? 0 : -EAGAIN;
+	wait_event(io->iio_wrange_wait, xfs_wrange_trylock(io, wr));
+	return 0;
+}
+
+STATIC void
+xfs_wrange_unlock(
+	struct xfs_inode	*ip,
+	struct xfs_wrange	*wr)
+{
+	struct xfs_inode_io	*io = ip->i_io;
+
+	spin_lock(&io->iio_wrange_wait.lock);
+	list_del_init(&wr->wr_list);
+	wake_up_locked(&io->iio_wrange_wait);
+	spin_unlock(&io->iio_wrange_wait.lock);
+}
+
 STATIC ssize_t
 xfs_file_dio_aio_read(
 	struct kiocb		*iocb,
@@ -207,6 +308,8 @@ xfs_file_dio_aio_read(
 {
 	struct xfs_inode	*ip = XFS_I(file_inode(iocb->ki_filp));
 	size_t			count = iov_iter_count(to);
+	struct xfs_wrange	wrange;
+	bool			ranged = false;
 	ssize_t			ret;
 
 	trace_xfs_file_direct_read(ip, count, iocb->ki_pos);
@@ -215,9 +318,20 @@ xfs_file_dio_aio_read(
 		return 0; /* skip atime */
 
 	file_accessed(iocb->ki_filp);
+	xfs_file_dio_hipri(iocb, ip->i_mount);
 
 	xfs_ilock(ip, XFS_IOLOCK_SHARED);
+	if (xfs_file_ranged_io(ip)) {
+		ret = xfs_wrange_lock(ip, &wrange, iocb->ki_pos, count, false,
+				iocb->ki_flags & IOCB_NOWAIT);
+		if (ret)
+			goto out_unlock;
+		ranged = true;
+	}
 	ret = iomap_dio_rw(iocb, to, &xfs_iomap_ops, NULL);
+	if (ranged)
+		xfs_wrange_unlock(ip, &wrange);
+out_unlock:
 	xfs_iunlock(ip, XFS_IOLOCK_SHARED);
 
 	return ret;
@@ -230,6 +344,7 @@ xfs_file_dax_read(
 {
 	struct xfs_inode	*ip = XFS_I(iocb->ki_filp->f_mapping->host);
 	size_t			count = iov_iter_count(to);
+	struct xfs_wrange	wrange;
 	ssize_t			ret = 0;
 
 	trace_xfs_file_dax_read(ip, count, iocb->ki_pos);
@@ -242,7 +357,15 @@ xfs_file_dax_read(
 			return -EAGAIN;
 		xfs_ilock(ip, XFS_IOLOCK_SHARED);
 	}
+	/* DAX overwrites only hold the iolock shared, see xfs_wrange. */
+	ret = xfs_wrange_lock(ip, &wrange, iocb->ki_pos, count, false,
+			iocb->ki_flags & IOCB_NOWAIT);
+	if (ret) {
+		xfs_iunlock(ip, XFS_IOLOCK_SHARED);
+		return ret;
+	}
 	ret = dax_iomap_rw(iocb, to, &xfs_iomap_ops);
+	xfs_wrange_unlock(ip, &wrange);
 	xfs_iunlock(ip, XFS_IOLOCK_SHARED);
 
 	file_accessed(iocb->ki_filp);
@@ -255,12 +378,25 @@ xfs_file_buffered_aio_read(
 	struct iov_iter		*to)
 {
 	struct xfs_inode	*ip = XFS_I(file_inode(iocb->ki_filp));
+	struct xfs_wrange	wrange;
+	bool			ranged = false;
 	ssize_t			ret;
 
 	trace_xfs_file_buffered_read(ip, iov_iter_count(to), iocb->ki_pos);
 
 	xfs_ilock(ip, XFS_IOLOCK_SHARED);
+	if (xfs_file_ranged_io(ip)) {
+		ret = xfs_wrange_lock(ip, &wrange, iocb->ki_pos,
+				iov_iter_count(to), false,
+				iocb->ki_flags & IOCB_NOWAIT);
+		if (ret)
+			goto out_unlock;
+		ranged = true;
+	}
 	ret = generic_file_read_iter(iocb, to);
+	if (ranged)
+		xfs_wrange_unlock(ip, &wrange);
+out_unlock:
 	xfs_iunlock(ip, XFS_IOLOCK_SHARED);
 
 	return ret;
@@ -287,8 +423,19 @@ xfs_file_read_iter(
 	else
 		ret = xfs_file_buffered_aio_read(iocb, to);
 
-	if (ret > 0)
+	/*
+	 * Inline files have no blocks to read directly, so serve direct reads
+	 * of them from the page cache instead.
+	 */
+	if (ret == -ENOTBLK) {
+		iocb->ki_flags &= ~IOCB_DIRECT;
+		ret = xfs_file_buffered_aio_read(iocb, to);
+	}
+
+	if (ret > 0) {
 		XFS_STATS_ADD(mp, xs_read_bytes, ret);
+		xfs_heat_update(XFS_I(inode), ret, false);
+	}
 	return ret;
 }
 
@@ -322,7 +469,7 @@ xfs_zero_eof(
  *
  * Called with the iolocked held either shared and exclusive according to
  * @iolock, and returns with it held.  Might upgrade the iolock to exclusive
- * if called for a direct write beyond i_size.
+ * if called for a shared direct or buffered write beyond i_size.
  */
 STATIC ssize_t
 xfs_file_aio_write_checks(
@@ -351,6 +498,8 @@ xfs_file_aio_write_checks(
 	 * exclusively.
 	 */
 	if (*iolock == XFS_IOLOCK_SHARED && !IS_NOSEC(inode)) {
+		if (iocb->ki_flags & IOCB_NOWAIT)
+			return -EAGAIN;
 		xfs_iunlock(ip, *iolock);
 		*iolock = XFS_IOLOCK_EXCL;
 		xfs_ilock(ip, *iolock);
@@ -376,6 +525,9 @@ xfs_file_aio_write_checks(
 		bool	zero = false;
 
 		spin_unlock(&ip->i_flags_lock);
+		/* Zeroing out to the new EOF can't be done without blocking. */
+		if (iocb->ki_flags & IOCB_NOWAIT)
+			return -EAGAIN;
 		if (!drained_dio) {
 			if (*iolock == XFS_IOLOCK_SHARED) {
 				xfs_iunlock(ip, *iolock);
@@ -423,8 +575,22 @@ xfs_file_aio_write_checks(
 	return 0;
 }
 
+STATIC void xfs_dio_sync_complete(struct kiocb *iocb, long res, long res2);
+
+/*
+ * Will this write be synced as soon as it completes?  Async O_[D]SYNC writes
+ * have had their sync flags hidden by xfs_dio_sync_start.
+ */
+static inline bool
+xfs_dio_write_is_sync(
+	struct kiocb		*iocb)
+{
+	return is_sync_kiocb(iocb) || (iocb->ki_flags & IOCB_DSYNC) ||
+	       iocb->ki_complete == xfs_dio_sync_complete;
+}
+
 static int
-xfs_dio_write_end_io(
+xfs_dio_write_complete(
 	struct kiocb		*iocb,
 	ssize_t			size,
 	unsigned		flags)
@@ -437,6 +603,9 @@ xfs_dio_write_end_io(
 
 	trace_xfs_end_io_direct_write(ip, offset, size);
 
+	xfs_buftarg_write_done(XFS_IS_REALTIME_INODE(ip) ?
+			ip->i_mount->m_rtdev_targp : ip->i_mount->m_ddev_targp);
+
 	if (XFS_FORCED_SHUTDOWN(ip->i_mount))
 		return -EIO;
 
@@ -468,13 +637,199 @@ xfs_dio_write_end_io(
 	}
 
 	if (flags & IOMAP_DIO_UNWRITTEN)
-		error = xfs_iomap_write_unwritten(ip, offset, size);
+		error = xfs_iomap_write_unwritten_batch(ip, offset, size,
+				xfs_dio_write_is_sync(iocb));
 	else if (update_size)
 		error = xfs_setfilesize(ip, offset, size);
 
 	return error;
 }
 
+/*
+ * O_[D]SYNC AIO direct writes.
+ *
+ * Left to iomap_dio_rw, the data integrity sync runs from the dio completion
+ * work and sleeps there in xfs_file_fsync until the log force is done.
+ * Instead we hide the sync flags from iomap, intercept the iocb completion
+ * and finish it from log I/O completion via an asynchronous log force, or
+ * from a cache flush bio for pure overwrites that logged nothing.  That way
+ * nothing sleeps on the integrity I/O and one thread can keep many durable
+ * writes in flight.
+ *
+ * The data device must also hold the log so that the iclog write's cache
+ * flush covers the file data; other configurations use the synchronous path.
+ */
+struct xfs_dio_sync {
+	struct xfs_log_callback	ds_cb;
+	struct kiocb		*ds_iocb;
+	struct xfs_dio_range	*ds_range;	/* iocb->private is ours */
+	void			(*ds_complete)(struct kiocb *, long, long);
+	int			ds_flags;
+	long			ds_res;
+};
+
+STATIC void
+xfs_dio_sync_done(
+	struct xfs_dio_sync	*ds,
+	int			error)
+{
+	struct kiocb		*iocb = ds->ds_iocb;
+	long			res = error ? error : ds->ds_res;
+
+	iocb->ki_complete = ds->ds_complete;
+	kmem_free(ds);
+	iocb->ki_complete(iocb, res, 0);
+}
+
+STATIC void
+xfs_dio_sync_log_done(
+	void			*arg,
+	int			abort)
+{
+	xfs_dio_sync_done(arg, abort ? -EIO : 0);
+}
+
+STATIC void
+xfs_dio_sync_flush_done(
+	struct bio		*bio)
+{
+	int			error = blk_status_to_errno(bio->bi_status);
+
+	xfs_dio_sync_done(bio->bi_private, error);
+	bio_put(bio);
+}
+
+STATIC void
+xfs_dio_sync_complete(
+	struct kiocb		*iocb,
+	long			res,
+	long			res2)
+{
+	struct xfs_dio_sync	*ds = iocb->private;
+	struct xfs_inode	*ip = XFS_I(file_inode(iocb->ki_filp));
+	struct xfs_mount	*mp = ip->i_mount;
+	struct bio		*bio;
+	xfs_lsn_t		lsn = 0;
+
+	ds->ds_res = res;
+	if (res <= 0) {
+		xfs_dio_sync_done(ds, 0);
+		return;
+	}
+	if (XFS_FORCED_SHUTDOWN(mp)) {
+		xfs_dio_sync_done(ds, -EIO);
+		return;
+	}
+
+	/*
+	 * Same test as xfs_file_fsync.  ili_fsync_fields is left alone as we
+	 * can't hold the ILOCK until the force completes, which only means a
+	 * later fsync may force the log needlessly.
+	 */
+	xfs_ilock(ip, XFS_ILOCK_SHARED);
+	if (xfs_ipincount(ip)) {
+		if ((ds->ds_flags & IOCB_SYNC) ||
+		    (ip->i_itemp->ili_fsync_fields & ~XFS_ILOG_TIMESTAMP))
+			lsn = ip->i_itemp->ili_last_lsn;
+	}
+	xfs_iunlock(ip, XFS_ILOCK_SHARED);
+
+	if (lsn) {
+		ds->ds_cb.cb_func = xfs_dio_sync_log_done;
+		ds->ds_cb.cb_arg = ds;
+		xfs_log_force_lsn_async(mp, lsn, &ds->ds_cb);
+		return;
+	}
+
+	bio = bio_alloc(GFP_NOFS, 0);
+	bio->bi_bdev = mp->m_ddev_targp->bt_bdev;
+	bio->bi_opf = REQ_OP_WRITE | REQ_PREFLUSH;
+	bio->bi_private = ds;
+	bio->bi_end_io = xfs_dio_sync_flush_done;
+	submit_bio(bio);
+}
+
+/*
+ * Set up an O_[D]SYNC AIO direct write for asynchronous completion.  Returns
+ * NULL if the write has to take the synchronous path.
+ */
+STATIC struct xfs_dio_sync *
+xfs_dio_sync_start(
+	struct kiocb		*iocb)
+{
+	struct xfs_inode	*ip = XFS_I(file_inode(iocb->ki_filp));
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_dio_sync	*ds;
+
+	if (!(iocb->ki_flags & IOCB_DSYNC) || is_sync_kiocb(iocb) ||
+	    XFS_IS_REALTIME_INODE(ip) ||
+	    mp->m_logdev_targp != mp->m_ddev_targp)
+		return NULL;
+
+	ds = kmem_alloc(sizeof(*ds), KM_NOFS | KM_MAYFAIL);
+	if (!ds)
+		return NULL;
+	ds->ds_iocb = iocb;
+	ds->ds_range = NULL;
+	ds->ds_complete = iocb->ki_complete;
+	ds->ds_flags = iocb->ki_flags;
+
+	iocb->private = ds;
+	iocb->ki_complete = xfs_dio_sync_complete;
+	iocb->ki_flags &= ~(IOCB_DSYNC | IOCB_SYNC);
+	return ds;
+}
+
+/*
+ * Undo xfs_dio_sync_start if iomap_dio_rw did not queue the I/O, in which case
+ * the caller gets the result directly and we have to sync synchronously.  Once
+ * the I/O is queued the iocb belongs to the completion and must not be touched.
+ */
+STATIC ssize_t
+xfs_dio_sync_finish(
+	struct kiocb		*iocb,
+	struct xfs_dio_sync	*ds,
+	ssize_t			ret)
+{
+	if (ret == -EIOCBQUEUED)
+		return ret;
+
+	iocb->ki_complete = ds->ds_complete;
+	iocb->ki_flags = ds->ds_flags;
+	kmem_free(ds);
+	if (ret > 0)
+		ret = generic_write_sync(iocb, ret);
+	return ret;
+}
+
+/*
+ * The block range registered for a direct write lives in iocb->private, or
+ * in the O_[D]SYNC completion state if that has claimed it.
+ */
+static inline struct xfs_dio_range *
+xfs_dio_write_range(
+	struct kiocb		*iocb)
+{
+	if (iocb->ki_complete == xfs_dio_sync_complete)
+		return ((struct xfs_dio_sync *)iocb->private)->ds_range;
+	return iocb->private;
+}
+
+static int
+xfs_dio_write_end_io(
+	struct kiocb		*iocb,
+	ssize_t			size,
+	unsigned		flags)
+{
+	struct xfs_dio_range	*dr = xfs_dio_write_range(iocb);
+	int			error;
+
+	error = xfs_dio_write_complete(iocb, size, flags);
+	if (dr)
+		xfs_iomap_dio_range_end(XFS_I(file_inode(iocb->ki_filp)), dr);
+	return error;
+}
+
 /*
  * xfs_file_dio_aio_write - handle direct IO writes
  *
@@ -494,8 +849,10 @@ xfs_dio_write_end_io(
  * submission of the unaligned IOs so that we don't get racing block zeroing in
  * the dio layer.  To avoid the problem with aio, we also need to wait for
  * outstanding IOs to complete so that unwritten extent conversion is completed
- * before we try to map the overlapping block. This is currently implemented by
- * hitting it with a big hammer (i.e. inode_dio_wait()).
+ * before we try to map the overlapping block.  The first unaligned write to a
+ * file does this by hitting it with a big hammer (i.e. inode_dio_wait()) and
+ * then turns on tracking of the blocks under direct write, after which
+ * unaligned writes only wait for the writes to their own blocks.
  *
  * Returns with locks held indicated by @iolock and errors indicated by
  * negative return values.
@@ -512,8 +869,13 @@ xfs_file_dio_aio_write(
 	struct xfs_mount	*mp = ip->i_mount;
 	ssize_t			ret = 0;
 	int			unaligned_io = 0;
+	bool			overwrite = false;
 	int			iolock;
 	size_t			count = iov_iter_count(from);
+	struct xfs_dio_sync	*ds;
+	struct xfs_dio_range	*dr;
+	struct xfs_wrange	wrange;
+	bool			ranged = false;
 	struct xfs_buftarg      *target = XFS_IS_REALTIME_INODE(ip) ?
 					mp->m_rtdev_targp : mp->m_ddev_targp;
 
@@ -540,43 +902,109 @@ xfs_file_dio_aio_write(
 			trace_xfs_reflink_bounce_dio_write(ip, iocb->ki_pos, count);
 			return -EREMCHG;
 		}
-		iolock = XFS_IOLOCK_EXCL;
+
+		/* Block tracking is never turned off again once it is on. */
+		if (ip->i_io && READ_ONCE(ip->i_io->iio_dio_blocks))
+			iolock = XFS_IOLOCK_SHARED;
+		else
+			iolock = XFS_IOLOCK_EXCL;
 	} else {
 		iolock = XFS_IOLOCK_SHARED;
 	}
 
+	/*
+	 * Unaligned overwrites of written blocks inside EOF don't need any
+	 * sub-block zeroing, so they can run in parallel with other I/O to the
+	 * file just like aligned ones.  Check that under the shared iolock and
+	 * only fall back to exclusive, serialised I/O if it doesn't hold.
+	 */
+	if (unaligned_io && !(iocb->ki_flags & IOCB_NOWAIT)) {
+		xfs_ilock(ip, XFS_IOLOCK_SHARED);
+		if (iocb->ki_pos + count <= i_size_read(inode) &&
+		    xfs_iomap_dio_written(ip, iocb->ki_pos, count)) {
+			unaligned_io = 0;
+			overwrite = true;
+			iolock = XFS_IOLOCK_SHARED;
+			goto locked;
+		}
+		xfs_iunlock(ip, XFS_IOLOCK_SHARED);
+	}
+
 	if (!xfs_ilock_nowait(ip, iolock)) {
 		if (iocb->ki_flags & IOCB_NOWAIT)
 			return -EAGAIN;
 		xfs_ilock(ip, iolock);
 	}
 
+locked:
 	ret = xfs_file_aio_write_checks(iocb, from, &iolock);
 	if (ret)
 		goto out;
 	count = iov_iter_count(from);
 
 	/*
-	 * If we are doing unaligned IO, wait for all other IO to drain,
+	 * If the checks had to cycle the iolock to take it exclusively, an
+	 * unaligned overwrite may no longer be one.  Serialise it as usual.
+	 */
+	if (overwrite && iolock == XFS_IOLOCK_EXCL)
+		unaligned_io = 1;
+
+	/*
+	 * If we are doing unaligned IO under the exclusive lock, wait for all
+	 * other IO to drain and start tracking blocks under direct write,
 	 * otherwise demote the lock if we had to take the exclusive lock
 	 * for other reasons in xfs_file_aio_write_checks.
 	 */
-	if (unaligned_io) {
+	if (unaligned_io && iolock == XFS_IOLOCK_EXCL) {
 		/* If we are going to wait for other DIO to finish, bail */
 		if (iocb->ki_flags & IOCB_NOWAIT) {
-			if (atomic_read(&inode->i_dio_count))
-				return -EAGAIN;
+			if (atomic_read(&inode->i_dio_count)) {
+				ret = -EAGAIN;
+				goto out;
+			}
 		} else {
 			inode_dio_wait(inode);
 		}
+		xfs_iomap_dio_blocks_init(ip);
 	} else if (iolock == XFS_IOLOCK_EXCL) {
 		xfs_ilock_demote(ip, XFS_IOLOCK_EXCL);
 		iolock = XFS_IOLOCK_SHARED;
 	}
 
+	/* Keep shared buffered writers and readers off the range we write. */
+	if (iolock == XFS_IOLOCK_SHARED && xfs_file_ranged_io(ip)) {
+		ret = xfs_wrange_lock(ip, &wrange, iocb->ki_pos, count, true,
+				iocb->ki_flags & IOCB_NOWAIT);
+		if (ret)
+			goto out;
+		ranged = true;
+	}
+
+	/*
+	 * Register the blocks we write if the inode tracks them, which waits
+	 * for conflicting writes to the same blocks.  The I/O stays registered
+	 * until its completion has run, so the completion needs to find it.
+	 */
+	ret = xfs_iomap_dio_range_start(ip, iocb->ki_pos, count, unaligned_io,
+			iocb->ki_flags & IOCB_NOWAIT, &dr);
+	if (ret)
+		goto out;
+
 	trace_xfs_file_direct_write(ip, count, iocb->ki_pos);
+	xfs_file_dio_hipri(iocb, mp);
+	ds = xfs_dio_sync_start(iocb);
+	if (ds)
+		ds->ds_range = dr;
+	else
+		iocb->private = dr;
 	ret = iomap_dio_rw(iocb, from, &xfs_iomap_ops, xfs_dio_write_end_io);
+	if (dr)
+		xfs_iomap_dio_range_finish(ip, dr, ret == -EIOCBQUEUED);
+	if (ds)
+		ret = xfs_dio_sync_finish(iocb, ds, ret);
 out:
+	if (ranged)
+		xfs_wrange_unlock(ip, &wrange);
 	xfs_iunlock(ip, iolock);
 
 	/*
@@ -587,6 +1015,25 @@ xfs_file_dio_aio_write(
 	return ret;
 }
 
+/*
+ * DAX overwrites of written blocks inside EOF neither allocate nor change the
+ * file size, so like aligned direct I/O they only need the iolock shared and
+ * threads can copy into disjoint ranges of one file in parallel.  Overlapping
+ * writers are still kept from interleaving by the range lock.
+ */
+static inline bool
+xfs_file_dax_write_shared(
+	struct kiocb		*iocb,
+	struct iov_iter		*from)
+{
+	struct inode		*inode = file_inode(iocb->ki_filp);
+	size_t			count = iov_iter_count(from);
+
+	return !(iocb->ki_flags & IOCB_APPEND) &&
+	       iocb->ki_pos + count <= i_size_read(inode) &&
+	       xfs_iomap_dio_written(XFS_I(inode), iocb->ki_pos, count);
+}
+
 static noinline ssize_t
 xfs_file_dax_write(
 	struct kiocb		*iocb,
@@ -594,7 +1041,9 @@ xfs_file_dax_write(
 {
 	struct inode		*inode = iocb->ki_filp->f_mapping->host;
 	struct xfs_inode	*ip = XFS_I(inode);
-	int			iolock = XFS_IOLOCK_EXCL;
+	struct xfs_wrange	wrange;
+	bool			ranged = false;
+	int			iolock = XFS_IOLOCK_SHARED;
 	ssize_t			ret, error = 0;
 	size_t			count;
 	loff_t			pos;
@@ -605,6 +1054,16 @@ xfs_file_dax_write(
 		xfs_ilock(ip, iolock);
 	}
 
+	if (!xfs_file_dax_write_shared(iocb, from)) {
+		xfs_iunlock(ip, iolock);
+		iolock = XFS_IOLOCK_EXCL;
+		if (!xfs_ilock_nowait(ip, iolock)) {
+			if (iocb->ki_flags & IOCB_NOWAIT)
+				return -EAGAIN;
+			xfs_ilock(ip, iolock);
+		}
+	}
+
 	ret = xfs_file_aio_write_checks(iocb, from, &iolock);
 	if (ret)
 		goto out;
@@ -612,17 +1071,40 @@ xfs_file_dax_write(
 	pos = iocb->ki_pos;
 	count = iov_iter_count(from);
 
+	if (iolock == XFS_IOLOCK_SHARED) {
+		ret = xfs_wrange_lock(ip, &wrange, pos, count, true,
+				iocb->ki_flags & IOCB_NOWAIT);
+		if (ret)
+			goto out;
+		ranged = true;
+	}
+
 	trace_xfs_file_dax_write(ip, count, pos);
 	ret = dax_iomap_rw(iocb, from, &xfs_iomap_ops);
 	if (ret > 0 && iocb->ki_pos > i_size_read(inode)) {
+		ASSERT(iolock == XFS_IOLOCK_EXCL);
 		i_size_write(inode, iocb->ki_pos);
 		error = xfs_setfilesize(ip, pos, ret);
 	}
 out:
+	if (ranged)
+		xfs_wrange_unlock(ip, &wrange);
 	xfs_iunlock(ip, iolock);
 	return error ? error : ret;
 }
 
+static inline bool
+xfs_file_buffered_write_shared(
+	struct kiocb		*iocb,
+	struct iov_iter		*from)
+{
+	struct inode		*inode = file_inode(iocb->ki_filp);
+
+	return (XFS_I(inode)->i_mount->m_flags & XFS_MOUNT_SHAREDWRITE) &&
+	       !(iocb->ki_flags & IOCB_APPEND) &&
+	       iocb->ki_pos + iov_iter_count(from) <= i_size_read(inode);
+}
+
 STATIC ssize_t
 xfs_file_buffered_aio_write(
 	struct kiocb		*iocb,
@@ -632,18 +1114,45 @@ xfs_file_buffered_aio_write(
 	struct address_space	*mapping = file->f_mapping;
 	struct inode		*inode = mapping->host;
 	struct xfs_inode	*ip = XFS_I(inode);
+	struct xfs_wrange	wrange;
+	bool			ranged = false;
 	ssize_t			ret;
 	int			enospc = 0;
 	int			iolock;
 
 write_retry:
 	iolock = XFS_IOLOCK_EXCL;
-	xfs_ilock(ip, iolock);
+	if (xfs_file_buffered_write_shared(iocb, from))
+		iolock = XFS_IOLOCK_SHARED;
+	if (!xfs_ilock_nowait(ip, iolock)) {
+		if (iocb->ki_flags & IOCB_NOWAIT)
+			return -EAGAIN;
+		xfs_ilock(ip, iolock);
+	}
+
+	/* Recheck now that extending writes and truncate are locked out. */
+	if (iolock == XFS_IOLOCK_SHARED &&
+	    !xfs_file_buffered_write_shared(iocb, from)) {
+		xfs_iunlock(ip, iolock);
+		if (iocb->ki_flags & IOCB_NOWAIT)
+			return -EAGAIN;
+		iolock = XFS_IOLOCK_EXCL;
+		xfs_ilock(ip, iolock);
+	}
 
 	ret = xfs_file_aio_write_checks(iocb, from, &iolock);
 	if (ret)
 		goto out;
 
+	if (iolock == XFS_IOLOCK_SHARED) {
+		ret = xfs_wrange_lock(ip, &wrange, iocb->ki_pos,
+				iov_iter_count(from), true,
+				iocb->ki_flags & IOCB_NOWAIT);
+		if (ret)
+			goto out;
+		ranged = true;
+	}
+
 	/* We can write back this queue in page reclaim */
 	current->backing_dev_info = inode_to_bdi(inode);
 
@@ -661,6 +1170,10 @@ xfs_file_buffered_aio_write(
 	 * also behaves as a filter to prevent too many eofblocks scans from
 	 * running at the same time.
 	 */
+	if (ranged && (ret == -EDQUOT || ret == -ENOSPC) && !enospc) {
+		xfs_wrange_unlock(ip, &wrange);
+		ranged = false;
+	}
 	if (ret == -EDQUOT && !enospc) {
 		xfs_iunlock(ip, iolock);
 		enospc = xfs_inode_free_quota_eofblocks(ip);
@@ -678,6 +1191,9 @@ xfs_file_buffered_aio_write(
 
 		xfs_iunlock(ip, iolock);
 		eofb.eof_flags = XFS_EOF_FLAGS_SYNC;
+		eofb.eof_free_goal = XFS_B_TO_FSB(ip->i_mount,
+				iov_iter_count(from)) +
+				ip->i_mount->m_writeio_blocks;
 		xfs_icache_free_eofblocks(ip->i_mount, &eofb);
 		xfs_icache_free_cowblocks(ip->i_mount, &eofb);
 		goto write_retry;
@@ -685,6 +1201,8 @@ xfs_file_buffered_aio_write(
 
 	current->backing_dev_info = NULL;
 out:
+	if (ranged)
+		xfs_wrange_unlock(ip, &wrange);
 	if (iolock)
 		xfs_iunlock(ip, iolock);
 	return ret;
@@ -710,6 +1228,9 @@ xfs_file_write_iter(
 	if (XFS_FORCED_SHUTDOWN(ip->i_mount))
 		return -EIO;
 
+	/* Get any layout recall going before we queue up for the iolock. */
+	xfs_recall_layouts(inode);
+
 	if (IS_DAX(inode))
 		ret = xfs_file_dax_write(iocb, from);
 	else if (iocb->ki_flags & IOCB_DIRECT) {
@@ -722,6 +1243,13 @@ xfs_file_write_iter(
 		ret = xfs_file_dio_aio_write(iocb, from);
 		if (ret == -EREMCHG)
 			goto buffered;
+
+		/* iomap_dio_rw handles O_[D]SYNC for direct writes itself. */
+		if (ret > 0) {
+			XFS_STATS_ADD(ip->i_mount, xs_write_bytes, ret);
+			xfs_heat_update(ip, ret, true);
+		}
+		return ret;
 	} else {
 buffered:
 		ret = xfs_file_buffered_aio_write(iocb, from);
@@ -729,6 +1257,7 @@ xfs_file_write_iter(
 
 	if (ret > 0) {
 		XFS_STATS_ADD(ip->i_mount, xs_write_bytes, ret);
+		xfs_heat_update(ip, ret, true);
 
 		/* Handle various SYNC-type writes */
 		ret = generic_write_sync(iocb, ret);
@@ -761,6 +1290,7 @@ xfs_file_fallocate(
 	if (mode & ~XFS_FALLOC_FL_SUPPORTED)
 		return -EOPNOTSUPP;
 
+	xfs_recall_layouts(inode);
 	xfs_ilock(ip, iolock);
 	error = xfs_break_layouts(inode, &iolock);
 	if (error)
@@ -769,6 +1299,11 @@ xfs_file_fallocate(
 	xfs_ilock(ip, XFS_MMAPLOCK_EXCL);
 	iolock |= XFS_MMAPLOCK_EXCL;
 
+	/* All of the space manipulation below works on extents. */
+	error = xfs_inline_data_to_extents(ip);
+	if (error)
+		goto out_unlock;
+
 	if (mode & FALLOC_FL_PUNCH_HOLE) {
 		error = xfs_free_file_space(ip, offset, len);
 		if (error)
@@ -886,6 +1421,113 @@ xfs_file_clone_range(
 				     len, false);
 }
 
+/*
+ * Size of the bounce buffer used to copy file ranges that can't be cloned.
+ */
+#define XFS_COPY_RANGE_PAGES	256
+
+/*
+ * Copy a file range that we couldn't clone with direct I/O through a private
+ * bounce buffer rather than through the page cache as splice would.  The data
+ * still passes through memory, but the copy neither pollutes the page cache
+ * of either file nor waits for writeback, and unlike splice it goes in large
+ * chunks.  Only whole blocks are copied this way; anything we can't or don't
+ * want to do is left to the VFS fallback by returning -EOPNOTSUPP, or by
+ * returning a short copy.
+ */
+STATIC ssize_t
+xfs_file_copy_range(
+	struct file		*file_in,
+	loff_t			pos_in,
+	struct file		*file_out,
+	loff_t			pos_out,
+	size_t			len,
+	unsigned int		flags)
+{
+	struct xfs_inode	*src = XFS_I(file_inode(file_in));
+	struct xfs_inode	*dest = XFS_I(file_inode(file_out));
+	struct xfs_mount	*mp = dest->i_mount;
+	struct bio_vec		*bvec;
+	struct iov_iter		iter;
+	struct kiocb		kiocb;
+	loff_t			isize;
+	size_t			count;
+	ssize_t			copied = 0;
+	ssize_t			ret = 0;
+	int			nr_pages;
+	int			i;
+
+	if (IS_DAX(VFS_I(src)) || IS_DAX(VFS_I(dest)) ||
+	    XFS_IS_REALTIME_INODE(src) || XFS_IS_REALTIME_INODE(dest))
+		return -EOPNOTSUPP;
+	if ((pos_in | pos_out) & mp->m_blockmask)
+		return -EOPNOTSUPP;
+
+	isize = i_size_read(VFS_I(src));
+	if (pos_in >= isize)
+		return 0;
+	len = min_t(loff_t, len, isize - pos_in) & ~(loff_t)mp->m_blockmask;
+	if (!len)
+		return -EOPNOTSUPP;
+
+	nr_pages = min_t(size_t, DIV_ROUND_UP(len, PAGE_SIZE),
+			 XFS_COPY_RANGE_PAGES);
+	bvec = kmem_zalloc(nr_pages * sizeof(*bvec), KM_MAYFAIL);
+	if (!bvec)
+		return -EOPNOTSUPP;
+	for (i = 0; i < nr_pages; i++) {
+		bvec[i].bv_page = alloc_page(GFP_KERNEL);
+		if (!bvec[i].bv_page) {
+			ret = -EOPNOTSUPP;
+			goto out_free;
+		}
+		bvec[i].bv_len = PAGE_SIZE;
+	}
+
+	while (len) {
+		count = min_t(size_t, len, (size_t)nr_pages << PAGE_SHIFT);
+
+		init_sync_kiocb(&kiocb, file_in);
+		kiocb.ki_pos = pos_in;
+		kiocb.ki_flags |= IOCB_DIRECT;
+		iov_iter_bvec(&iter, ITER_BVEC | READ, bvec, nr_pages, count);
+		ret = xfs_file_dio_aio_read(&kiocb, &iter);
+		if (ret <= 0)
+			break;
+
+		/* the source may have been truncated under us */
+		count = ret & ~(ssize_t)mp->m_blockmask;
+		if (!count)
+			break;
+
+		init_sync_kiocb(&kiocb, file_out);
+		kiocb.ki_pos = pos_out;
+		kiocb.ki_flags |= IOCB_DIRECT;
+		iov_iter_bvec(&iter, ITER_BVEC | WRITE, bvec, nr_pages, count);
+		ret = xfs_file_dio_aio_write(&kiocb, &iter);
+		if (ret <= 0)
+			break;
+
+		/* Honour O_[D]SYNC on the destination for every chunk. */
+		ret = generic_write_sync(&kiocb, ret);
+		if (ret <= 0)
+			break;
+
+		pos_in += ret;
+		pos_out += ret;
+		copied += ret;
+		len -= ret;
+		if (ret < count || fatal_signal_pending(current))
+			break;
+	}
+
+out_free:
+	for (i = 0; i < nr_pages && bvec[i].bv_page; i++)
+		__free_page(bvec[i].bv_page);
+	kmem_free(bvec);
+	return copied ? copied : ret;
+}
+
 STATIC ssize_t
 xfs_file_dedupe_range(
 	struct file	*src_file,
@@ -971,7 +1613,181 @@ xfs_file_readdir(
 	 */
 	bufsize = (size_t)min_t(loff_t, 32768, ip->i_d.di_size);
 
-	return xfs_readdir(NULL, ip, ctx, bufsize);
+	return xfs_readdir(NULL, ip, ctx, bufsize, &file->f_ra);
+}
+
+/*
+ * Return the first page index at or after @index that carries @tag, or @end
+ * if there is none before @end.
+ */
+STATIC pgoff_t
+xfs_seek_first_tagged(
+	struct address_space	*mapping,
+	pgoff_t			index,
+	pgoff_t			end,
+	int			tag)
+{
+	struct page		*page;
+
+	if (!find_get_pages_tag(mapping, &index, tag, 1, &page))
+		return end;
+	index = page->index;
+	put_page(page);
+	return min(index, end);
+}
+
+/*
+ * Return the end of the run of contiguous pages carrying @tag that starts at
+ * @index, capped at @end.  Returns @index if that page isn't tagged.
+ */
+STATIC pgoff_t
+xfs_seek_tagged_run(
+	struct address_space	*mapping,
+	pgoff_t			index,
+	pgoff_t			end,
+	int			tag)
+{
+	struct page		*pages[PAGEVEC_SIZE];
+	unsigned int		want, nr, i, j;
+	pgoff_t			next;
+
+	while (index < end) {
+		want = min_t(pgoff_t, end - index, PAGEVEC_SIZE);
+		next = index;
+		nr = find_get_pages_tag(mapping, &next, tag, want, pages);
+		for (i = 0; i < nr && pages[i]->index == index; i++)
+			index++;
+		for (j = 0; j < nr; j++)
+			put_page(pages[j]);
+		if (i < want)
+			break;
+	}
+	return min(index, end);
+}
+
+/*
+ * An unwritten extent only holds data where the page cache has dirty pages or
+ * pages under writeback; everything else reads back as zeroes.  Use the page
+ * cache tags to find the first such page (SEEK_DATA) or the first page that
+ * isn't (SEEK_HOLE) in the byte range [start, end) rather than locking and
+ * probing each page in turn.
+ *
+ * Returns the offset found, or -ENOENT if there is none in the range.
+ */
+STATIC loff_t
+xfs_seek_unwritten(
+	struct inode		*inode,
+	loff_t			start,
+	loff_t			end,
+	int			whence)
+{
+	struct address_space	*mapping = inode->i_mapping;
+	pgoff_t			index = start >> PAGE_SHIFT;
+	pgoff_t			last = DIV_ROUND_UP(end, PAGE_SIZE);
+	pgoff_t			dirty, wb;
+
+	if (whence == SEEK_DATA) {
+		dirty = xfs_seek_first_tagged(mapping, index, last,
+				PAGECACHE_TAG_DIRTY);
+		wb = xfs_seek_first_tagged(mapping, index, min(dirty, last),
+				PAGECACHE_TAG_WRITEBACK);
+		index = min(dirty, wb);
+	} else {
+		for (;;) {
+			dirty = xfs_seek_tagged_run(mapping, index, last,
+					PAGECACHE_TAG_DIRTY);
+			wb = xfs_seek_tagged_run(mapping, index, last,
+					PAGECACHE_TAG_WRITEBACK);
+			if (dirty == index && wb == index)
+				break;
+			index = max(dirty, wb);
+		}
+	}
+
+	if (index >= last)
+		return -ENOENT;
+	return max_t(loff_t, start, (loff_t)index << PAGE_SHIFT);
+}
+
+/*
+ * Find the next data or hole offset at or after @start by walking the in-core
+ * data fork extent list under the ILOCK, instead of mapping one extent at a
+ * time through ->iomap_begin.  Delalloc extents are data; unwritten extents
+ * are resolved against the page cache tags.  There is always an implicit
+ * hole at EOF.
+ */
+STATIC loff_t
+xfs_seek_hole_data(
+	struct inode		*inode,
+	loff_t			start,
+	int			whence)
+{
+	struct xfs_inode	*ip = XFS_I(inode);
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_ifork	*ifp = XFS_IFORK_PTR(ip, XFS_DATA_FORK);
+	struct xfs_bmbt_irec	got;
+	xfs_extnum_t		idx;
+	loff_t			isize = i_size_read(inode);
+	loff_t			pos = start;
+	loff_t			estart, eend, found;
+	uint			lockmode;
+	int			error;
+
+	/* Nothing to be found before or beyond the end of the file. */
+	if (start < 0 || start >= isize)
+		return -ENXIO;
+
+	lockmode = xfs_ilock_data_map_shared(ip);
+
+	/* An inline file is all data. */
+	if (xfs_is_inline_data_inode(ip)) {
+		if (whence == SEEK_HOLE)
+			pos = isize;
+		goto out_unlock;
+	}
+
+	if (!(ifp->if_flags & XFS_IFEXTENTS)) {
+		error = xfs_iread_extents(NULL, ip, XFS_DATA_FORK);
+		if (error) {
+			pos = error;
+			goto out_unlock;
+		}
+	}
+
+	if (!xfs_iext_lookup_extent(ip, ifp, XFS_B_TO_FSBT(mp, start), &idx,
+			&got))
+		goto out_eof;
+
+	do {
+		estart = XFS_FSB_TO_B(mp, got.br_startoff);
+		if (estart >= isize)
+			break;
+		if (estart > pos) {
+			if (whence == SEEK_HOLE)
+				goto out_unlock;
+			pos = estart;
+		}
+		eend = min_t(loff_t, isize,
+			XFS_FSB_TO_B(mp, got.br_startoff + got.br_blockcount));
+
+		if (got.br_state == XFS_EXT_UNWRITTEN) {
+			found = xfs_seek_unwritten(inode, pos, eend, whence);
+			if (found >= 0) {
+				pos = found;
+				goto out_unlock;
+			}
+		} else if (whence == SEEK_DATA) {
+			goto out_unlock;
+		}
+		pos = eend;
+	} while (pos < isize && xfs_iext_get_extent(ifp, ++idx, &got));
+
+out_eof:
+	if (whence == SEEK_DATA)
+		pos = -ENXIO;
+out_unlock:
+	xfs_iunlock(ip, lockmode);
+	return pos;
 }
 
 STATIC loff_t
@@ -989,10 +1805,8 @@ xfs_file_llseek(
 	default:
 		return generic_file_llseek(file, offset, whence);
 	case SEEK_HOLE:
-		offset = iomap_seek_hole(inode, offset, &xfs_iomap_ops);
-		break;
 	case SEEK_DATA:
-		offset = iomap_seek_data(inode, offset, &xfs_iomap_ops);
+		offset = xfs_seek_hole_data(inode, offset, whence);
 		break;
 	}
 
@@ -1012,6 +1826,137 @@ xfs_file_llseek(
  *         i_lock (XFS - extent map serialisation)
  */
 
+/*
+ * Number of pages, and alignment, of the run around a write fault on a hole
+ * that we reserve delalloc blocks for together.
+ */
+#define XFS_MKWRITE_AROUND	16
+
+/*
+ * Grab a neighbour of a faulting page if it has already been dirtied, so that
+ * reserving blocks for it doesn't allocate anything the application hasn't
+ * written to.  We never wait for the page lock as we are about to hold several.
+ */
+static bool
+xfs_filemap_mkwrite_grab(
+	struct address_space	*mapping,
+	pgoff_t			index,
+	struct page		**pagep)
+{
+	struct page		*page;
+
+	page = find_get_page(mapping, index);
+	if (!page)
+		return false;
+	if (!trylock_page(page))
+		goto out_put;
+	if (page->mapping != mapping || !PageUptodate(page) ||
+	    !PageDirty(page) || PageWriteback(page))
+		goto out_unlock;
+	*pagep = page;
+	return true;
+
+out_unlock:
+	unlock_page(page);
+out_put:
+	put_page(page);
+	return false;
+}
+
+/*
+ * Mark all buffers of a dirty page over freshly reserved delalloc blocks the
+ * same way iomap does for a buffered write.
+ */
+static void
+xfs_filemap_mkwrite_dirty(
+	struct inode		*inode,
+	struct page		*page)
+{
+	struct buffer_head	*bh, *head;
+
+	if (!page_has_buffers(page))
+		create_empty_buffers(page, i_blocksize(inode), 0);
+	bh = head = page_buffers(page);
+	do {
+		ASSERT(!buffer_mapped(bh));
+		bh->b_bdev = xfs_find_bdev_for_inode(inode);
+		set_buffer_uptodate(bh);
+		set_buffer_mapped(bh);
+		set_buffer_delay(bh);
+	} while ((bh = bh->b_this_page) != head);
+	block_commit_write(page, 0, PAGE_SIZE);
+}
+
+/*
+ * When a write fault lands in a hole, reserve delalloc blocks for the aligned
+ * run of neighbouring pages that are already dirty but still sit over the
+ * hole with a single call, so they end up in one delalloc extent with the
+ * faulting page.  Clean neighbours are never touched: the application may
+ * never write to them, and reserving blocks for them would fill in holes of a
+ * sparse file behind its back.
+ *
+ * The caller's MMAPLOCK keeps truncate and hole punching away, and neighbours
+ * are only trylocked, so all we wait for here is the ILOCK.
+ */
+STATIC void
+xfs_filemap_mkwrite_around(
+	struct vm_fault		*vmf,
+	struct inode		*inode)
+{
+	struct xfs_inode	*ip = XFS_I(inode);
+	struct xfs_mount	*mp = ip->i_mount;
+	struct address_space	*mapping = inode->i_mapping;
+	struct page		*pages[XFS_MKWRITE_AROUND];
+	pgoff_t			index = vmf->pgoff;
+	pgoff_t			start, end;
+	pgoff_t			first = index;
+	pgoff_t			last = index;
+	xfs_fileoff_t		start_fsb, end_fsb;
+	xfs_off_t		offset;
+	int			nr = 0;
+	int			i;
+
+	if (XFS_IS_REALTIME_INODE(ip) || xfs_get_extsz_hint(ip) ||
+	    xfs_is_inline_data_inode(ip))
+		return;
+
+	/* only pages entirely inside EOF */
+	start = round_down(index, XFS_MKWRITE_AROUND);
+	end = min_t(pgoff_t, start + XFS_MKWRITE_AROUND,
+		    i_size_read(inode) >> PAGE_SHIFT);
+	if (index >= end)
+		return;
+
+	while (first > start &&
+	       xfs_filemap_mkwrite_grab(mapping, first - 1, &pages[nr])) {
+		first--;
+		nr++;
+	}
+	while (last + 1 < end &&
+	       xfs_filemap_mkwrite_grab(mapping, last + 1, &pages[nr])) {
+		last++;
+		nr++;
+	}
+	if (!nr)
+		return;
+
+	start_fsb = XFS_B_TO_FSBT(mp, (xfs_off_t)first << PAGE_SHIFT);
+	end_fsb = XFS_B_TO_FSB(mp, (xfs_off_t)(last + 1) << PAGE_SHIFT);
+	if (xfs_iomap_reserve_fault_run(ip,
+			XFS_B_TO_FSBT(mp, (xfs_off_t)index << PAGE_SHIFT),
+			&start_fsb, &end_fsb))
+		end_fsb = start_fsb;
+
+	for (i = 0; i < nr; i++) {
+		offset = page_offset(pages[i]);
+		if (XFS_B_TO_FSBT(mp, offset) >= start_fsb &&
+		    XFS_B_TO_FSB(mp, offset + PAGE_SIZE) <= end_fsb)
+			xfs_filemap_mkwrite_dirty(inode, pages[i]);
+		unlock_page(pages[i]);
+		put_page(pages[i]);
+	}
+}
+
 /*
  * mmap()d file has taken write protection fault and is being made writable. We
  * can set the page state up correctly for a writable page, which means we can
@@ -1026,6 +1971,7 @@ xfs_filemap_page_mkwrite(
 	int			ret;
 
 	trace_xfs_filemap_page_mkwrite(XFS_I(inode));
+	xfs_heat_update(XFS_I(inode), PAGE_SIZE, true);
 
 	sb_start_pagefault(inode->i_sb);
 	file_update_time(vmf->vma->vm_file);
@@ -1034,6 +1980,7 @@ xfs_filemap_page_mkwrite(
 	if (IS_DAX(inode)) {
 		ret = dax_iomap_fault(vmf, PE_SIZE_PTE, &xfs_iomap_ops);
 	} else {
+		xfs_filemap_mkwrite_around(vmf, inode);
 		ret = iomap_page_mkwrite(vmf, &xfs_iomap_ops);
 		ret = block_page_mkwrite_return(ret);
 	}
@@ -1057,6 +2004,8 @@ xfs_filemap_fault(
 	if ((vmf->flags & FAULT_FLAG_WRITE) && IS_DAX(inode))
 		return xfs_filemap_page_mkwrite(vmf);
 
+	xfs_heat_update(XFS_I(inode), PAGE_SIZE, false);
+
 	xfs_ilock(XFS_I(inode), XFS_MMAPLOCK_SHARED);
 	if (IS_DAX(inode))
 		ret = dax_iomap_fault(vmf, PE_SIZE_PTE, &xfs_iomap_ops);
@@ -1173,6 +2122,7 @@ const struct file_operations xfs_file_operations = {
 	.fsync		= xfs_file_fsync,
 	.get_unmapped_area = thp_get_unmapped_area,
 	.fallocate	= xfs_file_fallocate,
+	.copy_file_range = xfs_file_copy_range,
 	.clone_file_range = xfs_file_clone_range,
 	.dedupe_file_range = xfs_file_dedupe_range,
 };
@@ -36,6 +36,7 @@ struct xfs_fstrm_item {
 	struct xfs_mru_cache_elem	mru;
 	struct xfs_inode		*ip;
 	xfs_agnumber_t			ag; /* AG in use for this directory */
+	struct rcu_head			rcu;
 };
 
 enum xfs_fstrm_alloc {
@@ -71,7 +72,7 @@ enum xfs_fstrm_alloc {
  * With a shrinkfs feature, the above scenario could panic the system.
  *
  * All other uses of the following macros should be protected by either the
- * m_peraglock held in read mode, or the cache's internal locking exposed by the
+ * m_peraglock held in read mode, or the RCU read lock held by the cache in the
  * interval between a call to xfs_mru_cache_lookup() and a call to
  * xfs_mru_cache_done().  In addition, the m_peraglock must be held in read mode
  * when new elements are added to the cache.
@@ -131,12 +132,54 @@ xfs_fstrm_free_func(
 
 	trace_xfs_filestream_free(item->ip, item->ag);
 
-	kmem_free(item);
+	/* lockless cache lookups may still be looking at it */
+	kfree_rcu(item, rcu);
+}
+
+#define XFS_FSTRM_BW_INTERVAL	HZ
+
+/*
+ * Return a moving average of the rate at which user data is being allocated
+ * in the AG, in blocks per second.  The sample is only updated once per
+ * interval by whoever wins the cmpxchg on the stamp.
+ */
+static unsigned int
+xfs_filestream_ag_rate(
+	struct xfs_perag	*pag)
+{
+	unsigned long		stamp = READ_ONCE(pag->pag_bw_stamp);
+	unsigned long		now = jiffies;
+	int64_t			blocks;
+	uint64_t		rate;
+
+	if (time_before(now, stamp + XFS_FSTRM_BW_INTERVAL))
+		return READ_ONCE(pag->pag_bw_rate);
+	if (cmpxchg(&pag->pag_bw_stamp, stamp, now) != stamp)
+		return READ_ONCE(pag->pag_bw_rate);
+
+	blocks = atomic64_read(&pag->pag_data_blocks);
+	rate = div_u64((uint64_t)(blocks - pag->pag_bw_blocks) * HZ,
+		       now - stamp);
+	pag->pag_bw_blocks = blocks;
+
+	/* after a long gap the old average says nothing about the AG */
+	if (now - stamp > 4 * XFS_FSTRM_BW_INTERVAL)
+		rate = min_t(uint64_t, rate, UINT_MAX);
+	else
+		rate = min_t(uint64_t, (pag->pag_bw_rate * 3ULL + rate) >> 2,
+			     UINT_MAX);
+	WRITE_ONCE(pag->pag_bw_rate, rate);
+	return rate;
 }
 
 /*
  * Scan the AGs starting at startag looking for an AG that isn't in use and has
  * at least minlen blocks free.
+ *
+ * Of the AGs that qualify, the one with the lowest recent user data allocation
+ * rate is picked, so that concurrent streams end up on AGs that aren't busy
+ * with other writers.  On a filesystem with a stripe width, a new stream also
+ * wants a free extent of at least a full stripe so it can write full stripes.
  */
 static int
 xfs_filestream_pick_ag(
@@ -150,13 +193,19 @@ xfs_filestream_pick_ag(
 	struct xfs_fstrm_item	*item;
 	struct xfs_perag	*pag;
 	xfs_extlen_t		longest, free = 0, minfree, maxfree = 0;
+	xfs_extlen_t		minlongest = 0;
 	xfs_agnumber_t		ag, max_ag = NULLAGNUMBER;
+	xfs_agnumber_t		best_ag = NULLAGNUMBER;
+	xfs_extlen_t		best_free = 0;
+	unsigned int		rate, best_rate = 0;
 	int			err, trylock, nscan;
 
 	ASSERT(S_ISDIR(VFS_I(ip)->i_mode));
 
 	/* 2% of an AG's blocks must be free for it to be chosen. */
 	minfree = mp->m_sb.sb_agblocks / 50;
+	if (!minlen && (flags & XFS_PICK_USERDATA))
+		minlongest = mp->m_swidth;
 
 	ag = startag;
 	*agp = NULLAGNUMBER;
@@ -202,15 +251,29 @@ xfs_filestream_pick_ag(
 				xfs_alloc_min_freelist(mp, pag),
 				xfs_ag_resv_needed(pag, XFS_AG_RESV_NONE));
 		if (((minlen && longest >= minlen) ||
-		     (!minlen && pag->pagf_freeblks >= minfree)) &&
+		     (!minlen && pag->pagf_freeblks >= minfree &&
+		      (longest >= minlongest || (flags & XFS_PICK_LOWSPACE)))) &&
 		    (!pag->pagf_metadata || !(flags & XFS_PICK_USERDATA) ||
 		     (flags & XFS_PICK_LOWSPACE))) {
-
-			/* Break out, retaining the reference on the AG. */
-			free = pag->pagf_freeblks;
-			xfs_perag_put(pag);
-			*agp = ag;
-			break;
+			rate = xfs_filestream_ag_rate(pag);
+
+			/*
+			 * Keep the reference on the least busy AG seen so far
+			 * and drop the one we had before.  An idle AG can't be
+			 * beaten, so take it straight away.
+			 */
+			if (best_ag == NULLAGNUMBER || rate < best_rate) {
+				if (best_ag != NULLAGNUMBER)
+					xfs_filestream_put_ag(mp, best_ag);
+				best_ag = ag;
+				best_rate = rate;
+				best_free = pag->pagf_freeblks;
+				if (!rate) {
+					xfs_perag_put(pag);
+					break;
+				}
+				goto next_ag;
+			}
 		}
 
 		/* Drop the reference on this AG, it's not usable. */
@@ -225,6 +288,10 @@ xfs_filestream_pick_ag(
 		if (ag != startag)
 			continue;
 
+		/* Take the least busy AG found in this pass, if any. */
+		if (best_ag != NULLAGNUMBER)
+			break;
+
 		/* Allow sleeping in xfs_alloc_pagf_init() on the 2nd pass. */
 		if (trylock != 0) {
 			trylock = 0;
@@ -254,6 +321,11 @@ xfs_filestream_pick_ag(
 		return 0;
 	}
 
+	if (best_ag != NULLAGNUMBER) {
+		*agp = best_ag;
+		free = best_free;
+	}
+
 	trace_xfs_filestream_pick(ip, *agp, free, nscan);
 
 	if (*agp == NULLAGNUMBER)
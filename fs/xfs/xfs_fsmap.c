@@ -175,6 +175,10 @@ struct xfs_getfsmap_info {
 	xfs_fsmap_format_t	formatter;	/* formatting fn */
 	void			*format_arg;	/* format buffer */
 	struct xfs_buf		*agf_bp;	/* AGF, for refcount queries */
+	struct xfs_btree_cur	*refc_cur;	/* refcountbt cursor */
+	xfs_agblock_t		refc_from;	/* last shared lookup start */
+	xfs_agblock_t		refc_fbno;	/* next shared extent after that */
+	xfs_extlen_t		refc_flen;
 	xfs_daddr_t		next_daddr;	/* next daddr we expect */
 	u64			missing_owner;	/* owner of holes */
 	u32			dev;		/* device id */
@@ -204,7 +208,29 @@ xfs_getfsmap_dev_compare(
 	return d1->dev - d2->dev;
 }
 
-/* Decide if this mapping is shared. */
+/* Drop the refcountbt cursor before we let go of the AGF. */
+static void
+xfs_getfsmap_del_refc_cur(
+	struct xfs_getfsmap_info	*info,
+	int				error)
+{
+	if (!info->refc_cur)
+		return;
+	xfs_btree_del_cursor(info->refc_cur,
+			error < 0 ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	info->refc_cur = NULL;
+}
+
+/*
+ * Decide if this mapping is shared.
+ *
+ * The rmapbt hands us records in increasing startblock order, so we
+ * keep one refcountbt cursor for the whole AG and remember the first
+ * shared extent at or after the last place we looked.  Until the query
+ * moves past that extent every record can be answered without touching
+ * the refcountbt, so we only descend the tree once per shared extent
+ * instead of once per record.
+ */
 STATIC int
 xfs_getfsmap_is_shared(
 	struct xfs_trans		*tp,
@@ -213,9 +239,8 @@ xfs_getfsmap_is_shared(
 	bool				*stat)
 {
 	struct xfs_mount		*mp = tp->t_mountp;
-	struct xfs_btree_cur		*cur;
-	xfs_agblock_t			fbno;
-	xfs_extlen_t			flen;
+	xfs_agblock_t			agbno = rec->rm_startblock;
+	xfs_agblock_t			eoag;
 	int				error;
 
 	*stat = false;
@@ -225,19 +250,36 @@ xfs_getfsmap_is_shared(
 	if (info->agno == NULLAGNUMBER)
 		return 0;
 
-	/* Are there any shared blocks here? */
-	flen = 0;
-	cur = xfs_refcountbt_init_cursor(mp, tp, info->agf_bp,
-			info->agno, NULL);
-
-	error = xfs_refcount_find_shared(cur, rec->rm_startblock,
-			rec->rm_blockcount, &fbno, &flen, false);
+	if (!info->refc_cur) {
+		info->refc_cur = xfs_refcountbt_init_cursor(mp, tp,
+				info->agf_bp, info->agno, NULL);
+		goto lookup;
+	}
+	if (agbno < info->refc_from)
+		goto lookup;
+	if (info->refc_fbno == NULLAGBLOCK)
+		return 0;
+	if (info->refc_fbno + info->refc_flen > agbno)
+		goto out;
 
-	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
-	if (error)
+lookup:
+	/* Find the next shared extent between here and the end of the AG. */
+	eoag = be32_to_cpu(XFS_BUF_TO_AGF(info->agf_bp)->agf_length);
+	info->refc_from = agbno;
+	info->refc_fbno = NULLAGBLOCK;
+	info->refc_flen = 0;
+	if (agbno >= eoag)
+		return 0;
+	error = xfs_refcount_find_shared(info->refc_cur, agbno, eoag - agbno,
+			&info->refc_fbno, &info->refc_flen, false);
+	if (error) {
+		xfs_getfsmap_del_refc_cur(info, error);
 		return error;
-
-	*stat = flen > 0;
+	}
+	if (info->refc_fbno == NULLAGBLOCK)
+		return 0;
+out:
+	*stat = info->refc_fbno < agbno + rec->rm_blockcount;
 	return 0;
 }
 
@@ -633,6 +675,7 @@ __xfs_getfsmap_datadev(
 		if (bt_cur) {
 			xfs_btree_del_cursor(bt_cur, XFS_BTREE_NOERROR);
 			bt_cur = NULL;
+			xfs_getfsmap_del_refc_cur(info, 0);
 			xfs_trans_brelse(tp, info->agf_bp);
 			info->agf_bp = NULL;
 		}
@@ -672,6 +715,7 @@ __xfs_getfsmap_datadev(
 	if (bt_cur)
 		xfs_btree_del_cursor(bt_cur, error < 0 ? XFS_BTREE_ERROR :
 							 XFS_BTREE_NOERROR);
+	xfs_getfsmap_del_refc_cur(info, error);
 	if (info->agf_bp) {
 		xfs_trans_brelse(tp, info->agf_bp);
 		info->agf_bp = NULL;
@@ -699,6 +743,333 @@ xfs_getfsmap_datadev_rmapbt_query(
 			xfs_getfsmap_datadev_helper, info);
 }
 
+/*
+ * Parallel rmapbt queries.
+ *
+ * Walking the rmapbt of a large filesystem one AG at a time is slow, so
+ * when a query spans several AGs we hand each AG in a window to its own
+ * worker.  The workers can't call the formatter (it copies to userspace)
+ * so each one collects its records in a private buffer; the caller then
+ * feeds the buffers to the formatter in AG order.  Each worker reports
+ * the free space gap at the end of its AG itself, so the caller sees
+ * exactly the same sequence of records that a serial walk would have
+ * produced and key-based resumption works unchanged.
+ */
+#define XFS_GETFSMAP_WORKERS	4
+#define XFS_GETFSMAP_AG_MAXRECS	8192
+
+struct xfs_getfsmap_ag {
+	struct work_struct		work;
+	struct xfs_mount		*mp;
+	struct xfs_fsmap		*keys;
+	struct xfs_getfsmap_info	*parent;
+	struct xfs_getfsmap_info	info;
+	struct xfs_fsmap_head		head;
+	struct xfs_fsmap		*recs;
+	xfs_agnumber_t			start_ag;
+	xfs_agnumber_t			end_ag;
+	int				error;
+	bool				truncated;
+};
+
+/* Stash a mapping in the worker's record buffer. */
+STATIC int
+xfs_getfsmap_ag_format(
+	struct xfs_fsmap		*xfm,
+	void				*priv)
+{
+	struct xfs_getfsmap_ag		*ga = priv;
+
+	ga->recs[ga->head.fmh_entries] = *xfm;
+	return 0;
+}
+
+/* Query one AG's rmapbt, including the gap at the end of the AG. */
+STATIC int
+xfs_getfsmap_ag_query(
+	struct xfs_getfsmap_ag		*ga,
+	struct xfs_trans		*tp)
+{
+	struct xfs_mount		*mp = ga->mp;
+	struct xfs_getfsmap_info	*info = &ga->info;
+	struct xfs_fsmap		*keys = ga->keys;
+	struct xfs_btree_cur		*cur = NULL;
+	xfs_agnumber_t			agno = info->agno;
+	int				error;
+
+	if (agno == ga->start_ag) {
+		info->low.rm_startblock = XFS_FSB_TO_AGBNO(mp,
+				XFS_DADDR_TO_FSB(mp, keys[0].fmr_physical));
+		info->low.rm_offset = XFS_BB_TO_FSBT(mp, keys[0].fmr_offset);
+		error = xfs_fsmap_owner_to_rmap(&info->low, &keys[0]);
+		if (error)
+			return error;
+		info->low.rm_blockcount = 0;
+		xfs_getfsmap_set_irec_flags(&info->low, &keys[0]);
+	}
+
+	if (agno == ga->end_ag) {
+		info->high.rm_startblock = XFS_FSB_TO_AGBNO(mp,
+				XFS_DADDR_TO_FSB(mp, keys[1].fmr_physical));
+		info->high.rm_offset = XFS_BB_TO_FSBT(mp, keys[1].fmr_offset);
+		error = xfs_fsmap_owner_to_rmap(&info->high, &keys[1]);
+		if (error)
+			return error;
+		info->high.rm_blockcount = 0;
+		xfs_getfsmap_set_irec_flags(&info->high, &keys[1]);
+	} else {
+		info->high.rm_startblock = -1U;
+		info->high.rm_owner = ULLONG_MAX;
+		info->high.rm_offset = ULLONG_MAX;
+		info->high.rm_blockcount = 0;
+		info->high.rm_flags = XFS_RMAP_KEY_FLAGS | XFS_RMAP_REC_FLAGS;
+	}
+
+	error = xfs_alloc_read_agf(mp, tp, agno, 0, &info->agf_bp);
+	if (error)
+		return error;
+
+	trace_xfs_fsmap_low_key(mp, info->dev, agno, &info->low);
+	trace_xfs_fsmap_high_key(mp, info->dev, agno, &info->high);
+
+	cur = xfs_rmapbt_init_cursor(mp, tp, info->agf_bp, agno);
+	error = xfs_rmap_query_range(cur, &info->low, &info->high,
+			xfs_getfsmap_datadev_helper, info);
+	if (error == XFS_BTREE_QUERY_RANGE_ABORT) {
+		ga->truncated = true;
+		error = 0;
+		goto out;
+	}
+	if (error)
+		goto out;
+
+	/*
+	 * A serial walk reports free space at the end of this AG when it
+	 * sees the first record of the next AG, which is always the AG
+	 * header at block zero.  Report it against the end of the AG here.
+	 */
+	if (agno != ga->end_ag) {
+		if (agno == mp->m_sb.sb_agcount - 1)
+			info->high.rm_startblock = mp->m_sb.sb_dblocks -
+					(xfs_rfsblock_t)agno * mp->m_sb.sb_agblocks;
+		else
+			info->high.rm_startblock = mp->m_sb.sb_agblocks;
+	}
+	info->last = true;
+	error = xfs_getfsmap_datadev_helper(cur, &info->high, info);
+	if (error == XFS_BTREE_QUERY_RANGE_ABORT) {
+		ga->truncated = true;
+		error = 0;
+	}
+out:
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	xfs_getfsmap_del_refc_cur(info, error);
+	xfs_trans_brelse(tp, info->agf_bp);
+	info->agf_bp = NULL;
+	return error;
+}
+
+/* Run a single AG query in its own transaction. */
+STATIC void
+xfs_getfsmap_ag_worker(
+	struct work_struct		*work)
+{
+	struct xfs_getfsmap_ag		*ga;
+	struct xfs_trans		*tp;
+
+	ga = container_of(work, struct xfs_getfsmap_ag, work);
+	ga->error = xfs_trans_alloc_empty(ga->mp, &tp);
+	if (ga->error)
+		return;
+	ga->error = xfs_getfsmap_ag_query(ga, tp);
+	xfs_trans_cancel(tp);
+}
+
+/* Set up a worker to query an AG and collect at most @maxrecs records. */
+STATIC void
+xfs_getfsmap_ag_init(
+	struct xfs_getfsmap_ag		*ga,
+	xfs_agnumber_t			agno,
+	unsigned int			maxrecs)
+{
+	struct xfs_mount		*mp = ga->mp;
+	struct xfs_getfsmap_info	*info = &ga->info;
+
+	memset(info, 0, sizeof(*info));
+	memset(&ga->head, 0, sizeof(ga->head));
+	ga->head.fmh_count = maxrecs;
+	ga->error = 0;
+	ga->truncated = false;
+
+	info->head = &ga->head;
+	info->formatter = xfs_getfsmap_ag_format;
+	info->format_arg = ga;
+	info->dev = ga->parent->dev;
+	info->missing_owner = ga->parent->missing_owner;
+	info->agno = agno;
+	if (agno == ga->start_ag)
+		info->next_daddr = ga->parent->next_daddr;
+	else
+		info->next_daddr = XFS_AGB_TO_DADDR(mp, agno, 0);
+}
+
+/*
+ * Guess how many records the next few AGs hold so that we don't start
+ * workers on AGs whose records won't fit in the caller's buffer.  The
+ * rmapbt block count times the minimum leaf occupancy is a decent lower
+ * bound, and that's good enough to stop us doing work we'll throw away.
+ */
+STATIC unsigned int
+xfs_getfsmap_par_width(
+	struct xfs_trans		*tp,
+	xfs_agnumber_t			agno,
+	xfs_agnumber_t			end_ag,
+	unsigned int			nr_workers,
+	unsigned int			room)
+{
+	struct xfs_mount		*mp = tp->t_mountp;
+	struct xfs_buf			*agf_bp;
+	uint64_t			guess = 0;
+	unsigned int			nr = 0;
+	int				error;
+
+	while (nr < nr_workers && agno + nr <= end_ag) {
+		nr++;
+		if (room == 0)
+			continue;
+		error = xfs_alloc_read_agf(mp, tp, agno + nr - 1, 0, &agf_bp);
+		if (error || !agf_bp)
+			break;
+		guess += (uint64_t)be32_to_cpu(
+				XFS_BUF_TO_AGF(agf_bp)->agf_rmap_blocks) *
+				mp->m_rmap_mnr[0];
+		xfs_trans_brelse(tp, agf_bp);
+		if (guess >= room)
+			break;
+	}
+	return nr;
+}
+
+/*
+ * Query the rmapbt of several AGs at once.  If we can't get the memory
+ * for the workers, fall back to walking the AGs one at a time.
+ */
+STATIC int
+xfs_getfsmap_datadev_rmapbt_par(
+	struct xfs_trans		*tp,
+	struct xfs_fsmap		*keys,
+	struct xfs_getfsmap_info	*info,
+	xfs_agnumber_t			start_ag,
+	xfs_agnumber_t			end_ag,
+	unsigned int			nr_workers)
+{
+	struct xfs_mount		*mp = tp->t_mountp;
+	struct xfs_fsmap_head		*head = info->head;
+	struct xfs_getfsmap_ag		*gas;
+	struct workqueue_struct		*wq;
+	xfs_agnumber_t			agno = start_ag;
+	unsigned int			maxrecs;
+	unsigned int			nr;
+	unsigned int			i, j;
+	int				error = 0;
+
+	gas = kmem_zalloc(nr_workers * sizeof(*gas), KM_MAYFAIL);
+	if (!gas)
+		goto serial;
+
+	maxrecs = min_t(unsigned int, head->fmh_count,
+			XFS_GETFSMAP_AG_MAXRECS);
+	for (i = 0; i < nr_workers; i++) {
+		gas[i].mp = mp;
+		gas[i].keys = keys;
+		gas[i].parent = info;
+		gas[i].start_ag = start_ag;
+		gas[i].end_ag = end_ag;
+		INIT_WORK(&gas[i].work, xfs_getfsmap_ag_worker);
+		if (!maxrecs)
+			continue;
+		gas[i].recs = kmem_zalloc_large(maxrecs * sizeof(*gas[i].recs),
+				KM_MAYFAIL);
+		if (!gas[i].recs)
+			goto out_serial;
+	}
+
+	wq = alloc_workqueue("xfs-fsmap/%s", WQ_UNBOUND | WQ_FREEZABLE,
+			nr_workers, mp->m_fsname);
+	if (!wq)
+		goto out_serial;
+
+	while (agno <= end_ag) {
+		unsigned int		room = 0;
+
+		if (head->fmh_count) {
+			room = head->fmh_count - head->fmh_entries;
+			maxrecs = min_t(unsigned int, room,
+					XFS_GETFSMAP_AG_MAXRECS);
+		}
+		nr = xfs_getfsmap_par_width(tp, agno, end_ag, nr_workers,
+				room);
+
+		/* The caller does the first AG itself. */
+		for (i = 0; i < nr; i++) {
+			xfs_getfsmap_ag_init(&gas[i], agno + i, maxrecs);
+			if (i > 0)
+				queue_work(wq, &gas[i].work);
+		}
+		gas[0].error = xfs_getfsmap_ag_query(&gas[0], tp);
+		for (i = 1; i < nr; i++)
+			flush_work(&gas[i].work);
+
+		/* Hand the records to the formatter in AG order. */
+		for (i = 0; i < nr; i++) {
+			struct xfs_getfsmap_ag	*ga = &gas[i];
+
+			error = ga->error;
+			if (error)
+				goto out_wq;
+			if (fatal_signal_pending(current)) {
+				error = -EINTR;
+				goto out_wq;
+			}
+			if (head->fmh_count == 0) {
+				head->fmh_entries += ga->head.fmh_entries;
+				continue;
+			}
+			for (j = 0; j < ga->head.fmh_entries; j++) {
+				if (head->fmh_entries >= head->fmh_count) {
+					error = XFS_BTREE_QUERY_RANGE_ABORT;
+					goto out_wq;
+				}
+				error = info->formatter(&ga->recs[j],
+						info->format_arg);
+				if (error)
+					goto out_wq;
+				head->fmh_entries++;
+			}
+			if (ga->truncated) {
+				error = XFS_BTREE_QUERY_RANGE_ABORT;
+				goto out_wq;
+			}
+		}
+		agno += nr;
+	}
+
+out_wq:
+	destroy_workqueue(wq);
+	for (i = 0; i < nr_workers; i++)
+		kmem_free(gas[i].recs);
+	kmem_free(gas);
+	return error;
+
+out_serial:
+	for (i = 0; i < nr_workers; i++)
+		kmem_free(gas[i].recs);
+	kmem_free(gas);
+serial:
+	return __xfs_getfsmap_datadev(tp, keys, info,
+			xfs_getfsmap_datadev_rmapbt_query, NULL);
+}
+
 /* Execute a getfsmap query against the regular data device rmapbt. */
 STATIC int
 xfs_getfsmap_datadev_rmapbt(
@@ -706,7 +1077,31 @@ xfs_getfsmap_datadev_rmapbt(
 	struct xfs_fsmap		*keys,
 	struct xfs_getfsmap_info	*info)
 {
+	struct xfs_mount		*mp = tp->t_mountp;
+	xfs_agnumber_t			start_ag;
+	xfs_agnumber_t			end_ag;
+	xfs_daddr_t			eofs;
+	unsigned int			nr_workers;
+
 	info->missing_owner = XFS_FMR_OWN_FREE;
+
+	eofs = XFS_FSB_TO_BB(mp, mp->m_sb.sb_dblocks);
+	if (keys[0].fmr_physical >= eofs)
+		return 0;
+	if (keys[1].fmr_physical >= eofs)
+		keys[1].fmr_physical = eofs - 1;
+	start_ag = XFS_FSB_TO_AGNO(mp,
+			XFS_DADDR_TO_FSB(mp, keys[0].fmr_physical));
+	end_ag = XFS_FSB_TO_AGNO(mp,
+			XFS_DADDR_TO_FSB(mp, keys[1].fmr_physical));
+
+	nr_workers = min_t(unsigned int, XFS_GETFSMAP_WORKERS,
+			num_online_cpus());
+	nr_workers = min_t(unsigned int, nr_workers, end_ag - start_ag + 1);
+	if (nr_workers > 1)
+		return xfs_getfsmap_datadev_rmapbt_par(tp, keys, info,
+				start_ag, end_ag, nr_workers);
+
 	return __xfs_getfsmap_datadev(tp, keys, info,
 			xfs_getfsmap_datadev_rmapbt_query, NULL);
 }
@@ -30,5 +30,6 @@ extern int xfs_fs_get_ag_reserve_blocks(struct xfs_mount *mp,
 
 extern int xfs_fs_reserve_ag_blocks(struct xfs_mount *mp);
 extern int xfs_fs_unreserve_ag_blocks(struct xfs_mount *mp);
+extern void xfs_fs_reserve_ag_worker(struct work_struct *work);
 
 #endif	/* __XFS_FSOPS_H__ */
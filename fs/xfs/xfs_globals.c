@@ -22,7 +22,9 @@
  * Tunable XFS parameters.  xfs_params is required even when CONFIG_SYSCTL=n,
  * other XFS code uses these values.  Times are measured in centisecs (i.e.
  * 100ths of a second) with the exception of eofb_timer and cowb_timer, which
- * are measured in seconds.
+ * are measured in seconds, and the FITRIM caps which are in MiB/s and discard
+ * requests per second.  lazytime_age is in seconds too, and cil_push_lat_ms
+ * and statfs_ms are in milliseconds.
  */
 xfs_param_t xfs_params = {
 			  /*	MIN		DFLT		MAX	*/
@@ -43,6 +45,15 @@ xfs_param_t xfs_params = {
 	.fstrm_timer	= {	1,		30*100,		3600*100},
 	.eofb_timer	= {	1,		300,		3600*24},
 	.cowb_timer	= {	1,		1800,		3600*24},
+	.trim_mbps	= {	0,		0,		1024*1024},
+	.trim_iops	= {	0,		0,		1024*1024},
+	.discard_timer	= {	1,		100,		60*100	},
+	.scrub_idle_io	= {	0,		0,		1	},
+	.scrub_lat_ms	= {	0,		0,		60*1000	},
+	.scrub_frag_ext	= {	0,		64,		INT_MAX	},
+	.lazytime_age	= {	1,		3600,		3600*12	},
+	.cil_push_lat_ms = {	0,		0,		60*1000	},
+	.statfs_ms	= {	0,		0,		60*1000	},
 };
 
 struct xfs_globals xfs_globals = {
@@ -0,0 +1,224 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_inode.h"
+#include "xfs_icache.h"
+#include "xfs_heat.h"
+
+/*
+ * I/O heat tracking.
+ *
+ * When mounted with the ioheat option, every read, write and page fault adds
+ * the number of pages it touched to a read or write counter kept with the
+ * inode's data I/O state.
+ * The counters halve for every XFS_HEAT_PERIOD that passes, so they measure
+ * recent I/O rather than all I/O since the inode was cached.  Decay is done
+ * lazily: the next update or query that finds the counters older than a
+ * period shifts them down by the number of periods that passed.
+ *
+ * The counters are updated without any locking.  Racing updates can lose a
+ * few pages worth of heat, which doesn't matter for a placement heuristic
+ * and costs much less than a lock in every read.  Readers of one file from
+ * many CPUs still bounce the cacheline, which is why this is a mount option.
+ *
+ * The heat lives in the in-core inode only, so it is lost when an inode is
+ * reclaimed; an inode that is hot enough to matter stays cached.
+ */
+
+static inline unsigned int
+xfs_heat_decay(
+	unsigned int		heat,
+	unsigned long		periods)
+{
+	return periods >= 32 ? 0 : heat >> periods;
+}
+
+void
+__xfs_heat_update(
+	struct xfs_inode	*ip,
+	size_t			count,
+	bool			write)
+{
+	struct xfs_inode_io	*io = xfs_inode_io_get(ip);
+	unsigned long		now = jiffies;
+	unsigned long		stamp = READ_ONCE(io->iio_heat_stamp);
+	unsigned int		*heat;
+	uint64_t		new;
+
+	if (time_after_eq(now, stamp + XFS_HEAT_PERIOD)) {
+		unsigned long	periods = (now - stamp) / XFS_HEAT_PERIOD;
+		unsigned int	r = READ_ONCE(io->iio_heat_read);
+		unsigned int	w = READ_ONCE(io->iio_heat_write);
+
+		WRITE_ONCE(io->iio_heat_read, xfs_heat_decay(r, periods));
+		WRITE_ONCE(io->iio_heat_write, xfs_heat_decay(w, periods));
+		WRITE_ONCE(io->iio_heat_stamp,
+			   stamp + periods * XFS_HEAT_PERIOD);
+	}
+
+	heat = write ? &io->iio_heat_write : &io->iio_heat_read;
+	new = (uint64_t)READ_ONCE(*heat) + max_t(size_t, 1,
+			DIV_ROUND_UP(count, PAGE_SIZE));
+	WRITE_ONCE(*heat, min_t(uint64_t, new, UINT_MAX));
+}
+
+/*
+ * Finding the hottest inodes.  We walk the inode cache keeping the hottest
+ * inodes seen so far in a min-heap, so that the coldest of them is at the
+ * top and can be replaced in O(log n) when we find a hotter one.
+ */
+struct xfs_heat_scan {
+	struct xfs_inode_heat	*heap;
+	unsigned int		nr;
+	unsigned int		max;
+	unsigned int		flags;
+	unsigned long		now;
+};
+
+static inline uint64_t
+xfs_heat_rank(
+	struct xfs_heat_scan	*hs,
+	struct xfs_inode_heat	*h)
+{
+	uint64_t		rank = 0;
+
+	if (hs->flags & XFS_HOT_READ)
+		rank += h->ih_read;
+	if (hs->flags & XFS_HOT_WRITE)
+		rank += h->ih_write;
+	return rank;
+}
+
+/* Push heap[i] down until it is no hotter than its children. */
+static void
+xfs_heat_sift_down(
+	struct xfs_heat_scan	*hs,
+	unsigned int		nr,
+	unsigned int		i)
+{
+	struct xfs_inode_heat	*heap = hs->heap;
+
+	for (;;) {
+		unsigned int	l = 2 * i + 1;
+		unsigned int	min = i;
+
+		if (l < nr && xfs_heat_rank(hs, &heap[l]) <
+			      xfs_heat_rank(hs, &heap[min]))
+			min = l;
+		if (l + 1 < nr && xfs_heat_rank(hs, &heap[l + 1]) <
+				  xfs_heat_rank(hs, &heap[min]))
+			min = l + 1;
+		if (min == i)
+			return;
+		swap(heap[i], heap[min]);
+		i = min;
+	}
+}
+
+/* Pull heap[i] up until its parent is no hotter than it. */
+static void
+xfs_heat_sift_up(
+	struct xfs_heat_scan	*hs,
+	unsigned int		i)
+{
+	struct xfs_inode_heat	*heap = hs->heap;
+
+	while (i > 0) {
+		unsigned int	parent = (i - 1) / 2;
+
+		if (xfs_heat_rank(hs, &heap[parent]) <=
+		    xfs_heat_rank(hs, &heap[i]))
+			return;
+		swap(heap[i], heap[parent]);
+		i = parent;
+	}
+}
+
+STATIC int
+xfs_heat_scan_inode(
+	struct xfs_inode	*ip,
+	int			flags,
+	void			*args)
+{
+	struct xfs_heat_scan	*hs = args;
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
+	struct xfs_inode_heat	h = { 0 };
+	unsigned long		periods;
+	uint64_t		rank;
+
+	/* Inodes that were never read or written have no heat. */
+	if (!io)
+		return 0;
+
+	periods = (hs->now - READ_ONCE(io->iio_heat_stamp)) / XFS_HEAT_PERIOD;
+	h.ih_read = xfs_heat_decay(READ_ONCE(io->iio_heat_read), periods);
+	h.ih_write = xfs_heat_decay(READ_ONCE(io->iio_heat_write), periods);
+
+	rank = xfs_heat_rank(hs, &h);
+	if (rank == 0)
+		return 0;
+	if (hs->nr == hs->max && rank <= xfs_heat_rank(hs, &hs->heap[0]))
+		return 0;
+
+	h.ih_ino = ip->i_ino;
+	h.ih_gen = VFS_I(ip)->i_generation;
+	if (hs->nr < hs->max) {
+		hs->heap[hs->nr] = h;
+		xfs_heat_sift_up(hs, hs->nr++);
+	} else {
+		hs->heap[0] = h;
+		xfs_heat_sift_down(hs, hs->nr, 0);
+	}
+	return 0;
+}
+
+/*
+ * Fill out heats with the *count hottest cached inodes, hottest first, and
+ * set *count to the number found.
+ */
+int
+xfs_heat_hottest(
+	struct xfs_mount	*mp,
+	unsigned int		flags,
+	struct xfs_inode_heat	*heats,
+	__u32			*count)
+{
+	struct xfs_heat_scan	hs = {
+		.heap		= heats,
+		.max		= *count,
+		.flags		= flags,
+		.now		= jiffies,
+	};
+	unsigned int		i;
+	int			error;
+
+	error = xfs_inode_ag_iterator(mp, xfs_heat_scan_inode, 0, &hs);
+	if (error)
+		return error;
+
+	/* Heapsort: moving the coldest to the end leaves the hottest first. */
+	for (i = hs.nr; i > 1; i--) {
+		swap(heats[0], heats[i - 1]);
+		xfs_heat_sift_down(&hs, i - 1, 0);
+	}
+	*count = hs.nr;
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef __XFS_HEAT_H__
+#define __XFS_HEAT_H__
+
+struct xfs_inode;
+struct xfs_inode_heat;
+
+/* Heat halves every period without I/O. */
+#define XFS_HEAT_PERIOD		(60 * HZ)
+
+/* Most inodes returned by one XFS_IOC_GET_HOT_INODES call. */
+#define XFS_HOT_INODES_MAX	1024
+
+void __xfs_heat_update(struct xfs_inode *ip, size_t count, bool write);
+int xfs_heat_hottest(struct xfs_mount *mp, unsigned int flags,
+		struct xfs_inode_heat *heats, __u32 *count);
+
+/* Account count bytes of I/O to the inode if heat tracking is on. */
+static inline void
+xfs_heat_update(
+	struct xfs_inode	*ip,
+	size_t			count,
+	bool			write)
+{
+	if (ip->i_mount->m_flags & XFS_MOUNT_IOHEAT)
+		__xfs_heat_update(ip, count, write);
+}
+
+#endif	/* __XFS_HEAT_H__ */
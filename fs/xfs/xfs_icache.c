@@ -17,6 +17,7 @@
  */
 #include "xfs.h"
 #include "xfs_fs.h"
+#include "xfs_shared.h"
 #include "xfs_format.h"
 #include "xfs_log_format.h"
 #include "xfs_trans_resv.h"
@@ -34,9 +35,14 @@
 #include "xfs_dquot_item.h"
 #include "xfs_dquot.h"
 #include "xfs_reflink.h"
+#include "xfs_aops.h"
+#include "xfs_btree.h"
+#include "xfs_ialloc.h"
+#include "xfs_ialloc_btree.h"
 
 #include <linux/kthread.h>
 #include <linux/freezer.h>
+#include <linux/list_sort.h>
 
 /*
  * Allocate and initialise an xfs_inode.
@@ -77,6 +83,11 @@ xfs_inode_alloc(
 	ip->i_cowfp = NULL;
 	ip->i_cnextents = 0;
 	ip->i_cformat = XFS_DINODE_FMT_EXTENTS;
+	ip->i_io = NULL;
+	INIT_LIST_HEAD(&ip->i_reclaim_lru);
+	ip->i_dir_index = NULL;
+	ip->i_dir_freemap = NULL;
+	ip->i_attr_cache = NULL;
 	memset(&ip->i_df, 0, sizeof(xfs_ifork_t));
 	ip->i_flags = 0;
 	ip->i_delayed_blks = 0;
@@ -85,6 +96,38 @@ xfs_inode_alloc(
 	return ip;
 }
 
+/*
+ * Return the data I/O state of an inode, allocating it on first use.  Must be
+ * called from a context that can sleep; the allocation does not fail.
+ */
+struct xfs_inode_io *
+xfs_inode_io_get(
+	struct xfs_inode	*ip)
+{
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
+
+	if (io)
+		return io;
+
+	io = kmem_zalloc(sizeof(*io), KM_SLEEP | KM_NOFS);
+	io->iio_inode = ip;
+	spin_lock_init(&io->iio_ioend_lock);
+	INIT_WORK(&io->iio_ioend_work, xfs_end_io);
+	INIT_LIST_HEAD(&io->iio_ioend_list);
+	init_waitqueue_head(&io->iio_wrange_wait);
+	INIT_LIST_HEAD(&io->iio_wranges);
+	seqcount_init(&io->iio_dio_mapseq);
+	io->iio_cowextsz_auto = XFS_DEFAULT_COWEXTSZ_HINT;
+	io->iio_cow_next = NULLFILEOFF;
+	io->iio_heat_stamp = jiffies;
+
+	if (cmpxchg(&ip->i_io, NULL, io) != NULL) {
+		kmem_free(io);
+		io = READ_ONCE(ip->i_io);
+	}
+	return io;
+}
+
 STATIC void
 xfs_inode_free_callback(
 	struct rcu_head		*head)
@@ -111,6 +154,7 @@ xfs_inode_free_callback(
 		ip->i_itemp = NULL;
 	}
 
+	kmem_free(ip->i_io);
 	kmem_zone_free(xfs_inode_zone, ip);
 }
 
@@ -130,6 +174,8 @@ xfs_inode_free(
 	struct xfs_inode	*ip)
 {
 	ASSERT(!xfs_isiflocked(ip));
+	ASSERT(!ip->i_io || list_empty(&ip->i_io->iio_ioend_list));
+	ASSERT(list_empty(&ip->i_reclaim_lru));
 
 	/*
 	 * Because we use RCU freeing we need to ensure the inode always
@@ -157,20 +203,35 @@ xfs_reclaim_work_queue(
 	struct xfs_mount        *mp)
 {
 
-	rcu_read_lock();
-	if (radix_tree_tagged(&mp->m_perag_tree, XFS_ICI_RECLAIM_TAG)) {
+	if (atomic_read(&mp->m_ici_tagged[XFS_ICI_RECLAIM_TAG])) {
 		queue_delayed_work(mp->m_reclaim_workqueue, &mp->m_reclaim_work,
 			msecs_to_jiffies(xfs_syncd_centisecs / 6 * 10));
 	}
-	rcu_read_unlock();
+}
+
+/*
+ * Kick the per-AG reclaim workers for every AG that has reclaimable inodes.
+ */
+static void
+xfs_reclaim_ag_queue_all(
+	struct xfs_mount	*mp)
+{
+	struct xfs_perag	*pag;
+	xfs_agnumber_t		ag = 0;
+
+	while ((pag = xfs_perag_get_tag(mp, ag, XFS_ICI_RECLAIM_TAG))) {
+		ag = pag->pag_agno + 1;
+		queue_work(mp->m_reclaim_workqueue, &pag->pag_reclaim_work);
+		xfs_perag_put(pag);
+	}
 }
 
 /*
  * This is a fast pass over the inode cache to try to get reclaim moving on as
  * many inodes as possible in a short period of time. It kicks itself every few
  * seconds, as well as being kicked by the inode cache shrinker when memory
- * goes low. It scans as quickly as possible avoiding locked inodes or those
- * already being flushed, and once done schedules a future pass.
+ * goes low. The actual scanning is done by the per-AG workers so that AGs are
+ * reclaimed in parallel, and once they are kicked we schedule a future pass.
  */
 void
 xfs_reclaim_worker(
@@ -179,26 +240,140 @@ xfs_reclaim_worker(
 	struct xfs_mount *mp = container_of(to_delayed_work(work),
 					struct xfs_mount, m_reclaim_work);
 
-	xfs_reclaim_inodes(mp, SYNC_TRYLOCK);
+	xfs_reclaim_ag_queue_all(mp);
 	xfs_reclaim_work_queue(mp);
 }
 
+/*
+ * Stop background reclaim, including any per-AG workers it kicked.
+ */
+void
+xfs_reclaim_work_cancel(
+	struct xfs_mount	*mp)
+{
+	struct xfs_perag	*pag;
+	xfs_agnumber_t		agno;
+
+	cancel_delayed_work_sync(&mp->m_reclaim_work);
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		pag = xfs_perag_get(mp, agno);
+		cancel_work_sync(&pag->pag_reclaim_work);
+		xfs_perag_put(pag);
+	}
+}
+
+/*
+ * Look up to @nr cached inodes at or after @first_index, optionally only those
+ * with @tag set.  The shards cover ascending agino ranges, so walking them in
+ * order from the one @first_index falls into returns inodes in agino order
+ * just like a lookup in a single tree would.  Must be called under RCU.
+ */
+int
+xfs_ici_gang_lookup(
+	struct xfs_perag	*pag,
+	struct xfs_inode	**batch,
+	xfs_agino_t		first_index,
+	unsigned int		nr,
+	int			tag)
+{
+	unsigned int		i;
+	int			nr_found;
+
+	for (i = first_index >> pag->pag_ici_shard_shift;
+	     i < XFS_ICI_SHARDS; i++) {
+		struct radix_tree_root	*root = &pag->pag_ici_shards[i].root;
+
+		if (tag == XFS_ICI_NO_TAG)
+			nr_found = radix_tree_gang_lookup(root, (void **)batch,
+					first_index, nr);
+		else
+			nr_found = radix_tree_gang_lookup_tag(root,
+					(void **)batch, first_index, nr, tag);
+		if (nr_found)
+			return nr_found;
+	}
+	return 0;
+}
+
+/*
+ * Propagate a tag change in a shard up to the AG and the mount.  Each AG
+ * counts the shards carrying each tag, and the AG tag bit and the per-mount
+ * count of tagged AGs only change when that count moves between zero and one.
+ * Shards update the count without a common lock, so settle the AG bit under
+ * pag_ici_tag_lock by the count seen there; whoever gets the lock last sees
+ * the final count.  Called with the shard lock held after the tag change.
+ *
+ * Returns true if the AG tag bit changed.
+ */
+static bool
+xfs_ici_tag_changed(
+	struct xfs_perag	*pag,
+	struct xfs_ici_shard	*shard,
+	int			tag,
+	bool			was_tagged)
+{
+	struct xfs_mount	*mp = pag->pag_mount;
+	bool			changed = false;
+
+	lockdep_assert_held(&shard->lock);
+	if (radix_tree_tagged(&shard->root, tag)) {
+		if (was_tagged ||
+		    atomic_inc_return(&pag->pag_ici_tagged[tag]) != 1)
+			return false;
+	} else {
+		if (!was_tagged ||
+		    !atomic_dec_and_test(&pag->pag_ici_tagged[tag]))
+			return false;
+	}
+
+	spin_lock(&pag->pag_ici_tag_lock);
+	if (atomic_read(&pag->pag_ici_tagged[tag])) {
+		if (!test_and_set_bit(tag, &pag->pag_ici_tags)) {
+			atomic_inc(&mp->m_ici_tagged[tag]);
+			changed = true;
+		}
+	} else if (test_and_clear_bit(tag, &pag->pag_ici_tags)) {
+		atomic_dec(&mp->m_ici_tagged[tag]);
+		changed = true;
+	}
+	spin_unlock(&pag->pag_ici_tag_lock);
+	return changed;
+}
+
+/*
+ * Remove an inode from its cache shard.  The entry takes any tags it still
+ * carries with it, so propagate those too.
+ */
+static struct xfs_inode *
+xfs_ici_delete(
+	struct xfs_perag	*pag,
+	struct xfs_ici_shard	*shard,
+	xfs_agino_t		agino)
+{
+	bool			was_tagged[RADIX_TREE_MAX_TAGS];
+	struct xfs_inode	*ip;
+	int			tag;
+
+	for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++)
+		was_tagged[tag] = radix_tree_tagged(&shard->root, tag);
+	ip = radix_tree_delete(&shard->root, agino);
+	for (tag = 0; tag < RADIX_TREE_MAX_TAGS; tag++)
+		xfs_ici_tag_changed(pag, shard, tag, was_tagged[tag]);
+	return ip;
+}
+
 static void
 xfs_perag_set_reclaim_tag(
-	struct xfs_perag	*pag)
+	struct xfs_perag	*pag,
+	struct xfs_ici_shard	*shard,
+	bool			was_tagged)
 {
 	struct xfs_mount	*mp = pag->pag_mount;
 
-	lockdep_assert_held(&pag->pag_ici_lock);
-	if (pag->pag_ici_reclaimable++)
+	atomic_inc(&pag->pag_ici_reclaimable);
+	if (!xfs_ici_tag_changed(pag, shard, XFS_ICI_RECLAIM_TAG, was_tagged))
 		return;
 
-	/* propagate the reclaim tag up into the perag radix tree */
-	spin_lock(&mp->m_perag_lock);
-	radix_tree_tag_set(&mp->m_perag_tree, pag->pag_agno,
-			   XFS_ICI_RECLAIM_TAG);
-	spin_unlock(&mp->m_perag_lock);
-
 	/* schedule periodic background inode reclaim */
 	xfs_reclaim_work_queue(mp);
 
@@ -207,23 +382,130 @@ xfs_perag_set_reclaim_tag(
 
 static void
 xfs_perag_clear_reclaim_tag(
-	struct xfs_perag	*pag)
+	struct xfs_perag	*pag,
+	struct xfs_ici_shard	*shard,
+	bool			was_tagged)
 {
 	struct xfs_mount	*mp = pag->pag_mount;
 
-	lockdep_assert_held(&pag->pag_ici_lock);
-	if (--pag->pag_ici_reclaimable)
+	atomic_dec(&pag->pag_ici_reclaimable);
+	if (!xfs_ici_tag_changed(pag, shard, XFS_ICI_RECLAIM_TAG, was_tagged))
 		return;
-
-	/* clear the reclaim tag from the perag radix tree */
-	spin_lock(&mp->m_perag_lock);
-	radix_tree_tag_clear(&mp->m_perag_tree, pag->pag_agno,
-			     XFS_ICI_RECLAIM_TAG);
-	spin_unlock(&mp->m_perag_lock);
 	trace_xfs_perag_clear_reclaim(mp, pag->pag_agno, -1, _RET_IP_);
 }
 
 
+/*
+ * Inactivating an unlinked inode truncates its extents and frees it, which
+ * can take a long time for large files and adds up when removing a large
+ * tree.  Rather than doing that in the context that dropped the last
+ * reference, queue the inode for a per-AG worker.  If too many inodes are
+ * already queued for the AG, the caller does the work itself, which keeps
+ * the amount of unreclaimed space and memory bounded.
+ */
+#define XFS_INACTIVE_MAX_QUEUED	1024
+
+bool
+xfs_inactive_queue(
+	struct xfs_inode	*ip)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_perag	*pag;
+	bool			queued = false;
+
+	/*
+	 * Only unlinked inodes have enough work to be worth deferring.
+	 * Inodes released during mount (log recovery) or unmount are
+	 * inactivated right away so that nothing is left queued.
+	 */
+	if (VFS_I(ip)->i_nlink || VFS_I(ip)->i_mode == 0)
+		return false;
+	if (!(mp->m_super->s_flags & MS_ACTIVE) ||
+	    (mp->m_flags & XFS_MOUNT_RDONLY) || XFS_FORCED_SHUTDOWN(mp))
+		return false;
+
+	pag = xfs_perag_get(mp, XFS_INO_TO_AGNO(mp, ip->i_ino));
+	spin_lock(&pag->pag_inactive_lock);
+	if (pag->pag_inactive_count < XFS_INACTIVE_MAX_QUEUED) {
+		list_add_tail(&ip->i_inactive_list, &pag->pag_inactive_list);
+		pag->pag_inactive_count++;
+		queued = true;
+	}
+	spin_unlock(&pag->pag_inactive_lock);
+	if (queued)
+		queue_work(mp->m_inactive_workqueue, &pag->pag_inactive_work);
+	xfs_perag_put(pag);
+	return queued;
+}
+
+static int
+xfs_inactive_ino_cmp(
+	void			*priv,
+	struct list_head	*a,
+	struct list_head	*b)
+{
+	struct xfs_inode	*ia = list_entry(a, struct xfs_inode,
+						 i_inactive_list);
+	struct xfs_inode	*ib = list_entry(b, struct xfs_inode,
+						 i_inactive_list);
+
+	if (ia->i_ino < ib->i_ino)
+		return -1;
+	return ia->i_ino > ib->i_ino;
+}
+
+/*
+ * Inactivate the queued inodes in inode number order, so that inodes that
+ * share cluster buffers and inode chunks are freed together, then hand them
+ * over to reclaim just as xfs_fs_destroy_inode does.
+ */
+void
+xfs_inactive_worker(
+	struct work_struct	*work)
+{
+	struct xfs_perag	*pag = container_of(work, struct xfs_perag,
+						    pag_inactive_work);
+	struct xfs_inode	*ip;
+	struct xfs_inode	*n;
+	LIST_HEAD(batch);
+
+	spin_lock(&pag->pag_inactive_lock);
+	list_splice_init(&pag->pag_inactive_list, &batch);
+	spin_unlock(&pag->pag_inactive_lock);
+
+	list_sort(NULL, &batch, xfs_inactive_ino_cmp);
+	list_for_each_entry_safe(ip, n, &batch, i_inactive_list) {
+		list_del_init(&ip->i_inactive_list);
+		xfs_inactive(ip);
+
+		ASSERT(XFS_FORCED_SHUTDOWN(ip->i_mount) ||
+		       ip->i_delayed_blks == 0);
+		XFS_STATS_INC(ip->i_mount, vn_reclaim);
+		ASSERT_ALWAYS(!xfs_iflags_test(ip, XFS_IRECLAIMABLE));
+		ASSERT_ALWAYS(!xfs_iflags_test(ip, XFS_IRECLAIM));
+		xfs_inode_set_reclaim_tag(ip);
+
+		spin_lock(&pag->pag_inactive_lock);
+		pag->pag_inactive_count--;
+		spin_unlock(&pag->pag_inactive_lock);
+	}
+}
+
+/* Wait for all queued inodes to be inactivated. */
+void
+xfs_inactive_flush(
+	struct xfs_mount	*mp)
+{
+	struct xfs_perag	*pag;
+	xfs_agnumber_t		agno;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		pag = xfs_perag_get(mp, agno);
+		flush_work(&pag->pag_inactive_work);
+		xfs_perag_put(pag);
+	}
+}
+
 /*
  * We set the inode flag atomically with the radix tree tag.
  * Once we get tag lookups on the radix tree, this inode flag
@@ -234,19 +516,24 @@ xfs_inode_set_reclaim_tag(
 	struct xfs_inode	*ip)
 {
 	struct xfs_mount	*mp = ip->i_mount;
+	xfs_agino_t		agino = XFS_INO_TO_AGINO(mp, ip->i_ino);
 	struct xfs_perag	*pag;
+	struct xfs_ici_shard	*shard;
+	bool			was_tagged;
 
 	pag = xfs_perag_get(mp, XFS_INO_TO_AGNO(mp, ip->i_ino));
-	spin_lock(&pag->pag_ici_lock);
+	shard = xfs_ici_shard(pag, agino);
+	spin_lock(&shard->lock);
 	spin_lock(&ip->i_flags_lock);
 
-	radix_tree_tag_set(&pag->pag_ici_root, XFS_INO_TO_AGINO(mp, ip->i_ino),
-			   XFS_ICI_RECLAIM_TAG);
-	xfs_perag_set_reclaim_tag(pag);
+	was_tagged = radix_tree_tagged(&shard->root, XFS_ICI_RECLAIM_TAG);
+	radix_tree_tag_set(&shard->root, agino, XFS_ICI_RECLAIM_TAG);
+	xfs_perag_set_reclaim_tag(pag, shard, was_tagged);
 	__xfs_iflags_set(ip, XFS_IRECLAIMABLE);
+	list_lru_add(&mp->m_reclaim_lru, &ip->i_reclaim_lru);
 
 	spin_unlock(&ip->i_flags_lock);
-	spin_unlock(&pag->pag_ici_lock);
+	spin_unlock(&shard->lock);
 	xfs_perag_put(pag);
 }
 
@@ -255,10 +542,13 @@ xfs_inode_clear_reclaim_tag(
 	struct xfs_perag	*pag,
 	xfs_ino_t		ino)
 {
-	radix_tree_tag_clear(&pag->pag_ici_root,
-			     XFS_INO_TO_AGINO(pag->pag_mount, ino),
-			     XFS_ICI_RECLAIM_TAG);
-	xfs_perag_clear_reclaim_tag(pag);
+	xfs_agino_t		agino = XFS_INO_TO_AGINO(pag->pag_mount, ino);
+	struct xfs_ici_shard	*shard = xfs_ici_shard(pag, agino);
+	bool			was_tagged;
+
+	was_tagged = radix_tree_tagged(&shard->root, XFS_ICI_RECLAIM_TAG);
+	radix_tree_tag_clear(&shard->root, agino, XFS_ICI_RECLAIM_TAG);
+	xfs_perag_clear_reclaim_tag(pag, shard, was_tagged);
 }
 
 static void
@@ -305,6 +595,58 @@ xfs_reinit_inode(
 	return error;
 }
 
+#define XFS_IGET_TRANSIENT_FLAGS \
+	(XFS_INEW | XFS_IRECLAIM | XFS_IRECLAIMABLE)
+
+/*
+ * Lockless cache hit for the common case of a live, fully set up inode.
+ *
+ * An inode can only change identity or go through the new/reclaim states
+ * after its VFS reference count has dropped to zero, so once we hold a
+ * reference we only need to check that nothing changed between the unlocked
+ * checks and taking it.  If something did, we raced with the inode being torn
+ * down and recycled: drop the reference again and let the locked path sort
+ * it out.
+ *
+ * Returns 1 with a reference held, 0 if the caller should fall back to the
+ * locked checks, or -EAGAIN if the RCU read lock was dropped to release the
+ * reference and the lookup must be retried.
+ */
+static int
+xfs_iget_cache_hit_fast(
+	struct xfs_inode	*ip,
+	xfs_ino_t		ino,
+	int			flags)
+{
+	struct inode		*inode = VFS_I(ip);
+
+	if (flags & XFS_IGET_CREATE)
+		return 0;
+	if (READ_ONCE(ip->i_ino) != ino ||
+	    (READ_ONCE(ip->i_flags) & XFS_IGET_TRANSIENT_FLAGS) ||
+	    inode->i_mode == 0)
+		return 0;
+
+	/* A zero count means the inode is on its way out, or on the LRU. */
+	if (!atomic_inc_not_zero(&inode->i_count))
+		return 0;
+
+	if (READ_ONCE(ip->i_ino) == ino &&
+	    !(READ_ONCE(ip->i_flags) & XFS_IGET_TRANSIENT_FLAGS))
+		return 1;
+
+	/*
+	 * We can't iput() under the RCU read lock.  If ours is the last
+	 * reference the inode is live, so it is safe to drop the RCU read lock
+	 * before releasing it.
+	 */
+	if (atomic_add_unless(&inode->i_count, -1, 1))
+		return 0;
+	rcu_read_unlock();
+	iput(inode);
+	return -EAGAIN;
+}
+
 /*
  * Check the validity of the inode we just found it the cache
  */
@@ -318,8 +660,18 @@ xfs_iget_cache_hit(
 {
 	struct inode		*inode = VFS_I(ip);
 	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_ici_shard	*shard;
 	int			error;
 
+	error = xfs_iget_cache_hit_fast(ip, ino, flags);
+	if (error < 0)
+		return error;
+	if (error > 0) {
+		rcu_read_unlock();
+		trace_xfs_iget_hit(ip);
+		goto out_found;
+	}
+
 	/*
 	 * check for re-use of an inode within an RCU grace period due to the
 	 * radix tree nodes not being updated yet. We monitor for this by
@@ -377,7 +729,7 @@ xfs_iget_cache_hit(
 		 * We need to set XFS_IRECLAIM to prevent xfs_reclaim_inode
 		 * from stomping over us while we recycle the inode.  We can't
 		 * clear the radix tree reclaimable tag yet as it requires
-		 * pag_ici_lock to be held exclusive.
+		 * the inode cache shard lock to be held exclusive.
 		 */
 		ip->i_flags |= XFS_IRECLAIM;
 
@@ -402,7 +754,8 @@ xfs_iget_cache_hit(
 			goto out_error;
 		}
 
-		spin_lock(&pag->pag_ici_lock);
+		shard = xfs_ici_shard(pag, XFS_INO_TO_AGINO(mp, ino));
+		spin_lock(&shard->lock);
 		spin_lock(&ip->i_flags_lock);
 
 		/*
@@ -413,13 +766,14 @@ xfs_iget_cache_hit(
 		ip->i_flags &= ~XFS_IRECLAIM_RESET_FLAGS;
 		ip->i_flags |= XFS_INEW;
 		xfs_inode_clear_reclaim_tag(pag, ip->i_ino);
+		list_lru_del(&mp->m_reclaim_lru, &ip->i_reclaim_lru);
 		inode->i_state = I_NEW;
 
 		ASSERT(!rwsem_is_locked(&inode->i_rwsem));
 		init_rwsem(&inode->i_rwsem);
 
 		spin_unlock(&ip->i_flags_lock);
-		spin_unlock(&pag->pag_ici_lock);
+		spin_unlock(&shard->lock);
 	} else {
 		/* If the VFS inode is being torn down, pause and try again. */
 		if (!igrab(inode)) {
@@ -434,10 +788,13 @@ xfs_iget_cache_hit(
 		trace_xfs_iget_hit(ip);
 	}
 
+out_found:
 	if (lock_flags != 0)
 		xfs_ilock(ip, lock_flags);
 
-	if (!(flags & XFS_IGET_INCORE))
+	/* Avoid the i_flags_lock unless there is something to clear. */
+	if (!(flags & XFS_IGET_INCORE) &&
+	    (READ_ONCE(ip->i_flags) & (XFS_ISTALE | XFS_IDONTCACHE)))
 		xfs_iflags_clear(ip, XFS_ISTALE | XFS_IDONTCACHE);
 	XFS_STATS_INC(mp, xs_ig_found);
 
@@ -461,6 +818,7 @@ xfs_iget_cache_miss(
 	int			lock_flags)
 {
 	struct xfs_inode	*ip;
+	struct xfs_ici_shard	*shard;
 	int			error;
 	xfs_agino_t		agino = XFS_INO_TO_AGINO(mp, ino);
 	int			iflags;
@@ -518,22 +876,23 @@ xfs_iget_cache_miss(
 	xfs_iflags_set(ip, iflags);
 
 	/* insert the new inode */
-	spin_lock(&pag->pag_ici_lock);
-	error = radix_tree_insert(&pag->pag_ici_root, agino, ip);
+	shard = xfs_ici_shard(pag, agino);
+	spin_lock(&shard->lock);
+	error = radix_tree_insert(&shard->root, agino, ip);
 	if (unlikely(error)) {
 		WARN_ON(error != -EEXIST);
 		XFS_STATS_INC(mp, xs_ig_dup);
 		error = -EAGAIN;
 		goto out_preload_end;
 	}
-	spin_unlock(&pag->pag_ici_lock);
+	spin_unlock(&shard->lock);
 	radix_tree_preload_end();
 
 	*ipp = ip;
 	return 0;
 
 out_preload_end:
-	spin_unlock(&pag->pag_ici_lock);
+	spin_unlock(&shard->lock);
 	radix_tree_preload_end();
 	if (lock_flags)
 		xfs_iunlock(ip, lock_flags);
@@ -543,6 +902,145 @@ xfs_iget_cache_miss(
 	return error;
 }
 
+/*
+ * Add an inode of a cluster buffer we have locked to the cache as a clean,
+ * reclaimable inode, unless it is cached already.
+ */
+STATIC void
+xfs_iget_prefetch_one(
+	struct xfs_mount	*mp,
+	struct xfs_perag	*pag,
+	struct xfs_imap		*imap,
+	xfs_agino_t		agino,
+	struct xfs_dinode	*dip)
+{
+	struct xfs_ici_shard	*shard = xfs_ici_shard(pag, agino);
+	xfs_ino_t		ino = XFS_AGINO_TO_INO(mp, pag->pag_agno, agino);
+	struct xfs_inode	*ip;
+	bool			was_tagged;
+
+	rcu_read_lock();
+	ip = xfs_ici_lookup(pag, agino);
+	rcu_read_unlock();
+	if (ip)
+		return;
+	if (!dip->di_mode || !xfs_dinode_verify(mp, ino, dip))
+		return;
+
+	ip = xfs_inode_alloc(mp, ino);
+	if (!ip)
+		return;
+	ip->i_imap = *imap;
+	xfs_inode_from_disk(ip, dip);
+	if (xfs_iformat_fork(ip, dip)) {
+		__destroy_inode(VFS_I(ip));
+		goto out_free;
+	}
+	ip->i_delayed_blks = 0;
+	ip->i_udquot = NULL;
+	ip->i_gdquot = NULL;
+	ip->i_pdquot = NULL;
+
+	/*
+	 * Put the inode into the state the VFS leaves it in when it is done
+	 * with it, so that the usual cache hit and reclaim paths deal with it.
+	 * The reclaim tag has to be set under the same shard lock as the
+	 * insertion, so that nobody can recycle the inode before it is tagged.
+	 */
+	__destroy_inode(VFS_I(ip));
+	__xfs_iflags_set(ip, XFS_IRECLAIMABLE);
+
+	if (radix_tree_preload(GFP_NOFS))
+		goto out_free;
+	spin_lock(&shard->lock);
+	if (radix_tree_insert(&shard->root, agino, ip)) {
+		spin_unlock(&shard->lock);
+		radix_tree_preload_end();
+		goto out_free;
+	}
+	was_tagged = radix_tree_tagged(&shard->root, XFS_ICI_RECLAIM_TAG);
+	radix_tree_tag_set(&shard->root, agino, XFS_ICI_RECLAIM_TAG);
+	xfs_perag_set_reclaim_tag(pag, shard, was_tagged);
+	list_lru_add(&mp->m_reclaim_lru, &ip->i_reclaim_lru);
+	spin_unlock(&shard->lock);
+	radix_tree_preload_end();
+	return;
+
+out_free:
+	xfs_inode_free(ip);
+}
+
+/*
+ * Reading an inode from disk has just brought its whole cluster buffer into
+ * memory.  If the "iprefetch" mount option is set, instantiate the other
+ * allocated inodes of the cluster while the buffer is at hand, so that a find
+ * or du walking the tree doesn't have to look the buffer up again for each
+ * of them.  They are cached as clean, reclaimable inodes just like ones the
+ * VFS has finished with: a lookup recycles them without touching the buffer,
+ * and background reclaim frees them if nobody does.
+ *
+ * The inobt record for the cluster tells us which inodes are allocated.  This
+ * is purely opportunistic, so we only ever trylock the AGI and the cluster
+ * buffer, and give up on any error.
+ */
+STATIC void
+xfs_iget_prefetch_cluster(
+	struct xfs_mount	*mp,
+	struct xfs_perag	*pag,
+	struct xfs_inode	*ip)
+{
+	xfs_agnumber_t		agno = pag->pag_agno;
+	xfs_agino_t		agino = XFS_INO_TO_AGINO(mp, ip->i_ino);
+	int			inodelog = mp->m_sb.sb_inodelog;
+	struct xfs_inobt_rec_incore rec;
+	struct xfs_imap		imap = ip->i_imap;
+	struct xfs_btree_cur	*cur;
+	struct xfs_buf		*agbp;
+	struct xfs_buf		*bp;
+	struct xfs_dinode	*dip;
+	xfs_agino_t		first;
+	xfs_agino_t		start;
+	xfs_agino_t		end;
+	xfs_agino_t		i;
+	int			stat;
+	int			error;
+
+	first = agino - (imap.im_boffset >> inodelog);
+
+	error = xfs_trans_read_buf(mp, NULL, mp->m_ddev_targp,
+			XFS_AG_DADDR(mp, agno, XFS_AGI_DADDR(mp)),
+			XFS_FSS_TO_BB(mp, 1), XBF_TRYLOCK, &agbp,
+			&xfs_agi_buf_ops);
+	if (error)
+		return;
+	cur = xfs_inobt_init_cursor(mp, NULL, agbp, agno, XFS_BTNUM_INO);
+	error = xfs_inobt_lookup(cur, agino, XFS_LOOKUP_LE, &stat);
+	if (!error && stat)
+		error = xfs_inobt_get_rec(cur, &rec, &stat);
+	xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	xfs_buf_relse(agbp);
+	if (error || !stat ||
+	    agino >= rec.ir_startino + XFS_INODES_PER_CHUNK)
+		return;
+
+	start = max(first, rec.ir_startino);
+	end = min_t(xfs_agino_t, first + (BBTOB(imap.im_len) >> inodelog),
+		    rec.ir_startino + XFS_INODES_PER_CHUNK);
+
+	error = xfs_imap_to_bp(mp, NULL, &imap, &dip, &bp, XBF_TRYLOCK, 0);
+	if (error)
+		return;
+	for (i = start; i < end; i++) {
+		if (i == agino ||
+		    (rec.ir_free & XFS_INOBT_MASK(i - rec.ir_startino)))
+			continue;
+		imap.im_boffset = (i - first) << inodelog;
+		dip = xfs_buf_offset(bp, imap.im_boffset);
+		xfs_iget_prefetch_one(mp, pag, &imap, i, dip);
+	}
+	xfs_buf_relse(bp);
+}
+
 /*
  * Look up an inode by number in the given file system.
  * The inode is looked up in the cache held in each AG.
@@ -578,6 +1076,7 @@ xfs_iget(
 	int		error;
 	xfs_perag_t	*pag;
 	xfs_agino_t	agino;
+	ktime_t		start;
 
 	/*
 	 * xfs_reclaim_inode() uses the ILOCK to ensure an inode
@@ -601,7 +1100,7 @@ xfs_iget(
 again:
 	error = 0;
 	rcu_read_lock();
-	ip = radix_tree_lookup(&pag->pag_ici_root, agino);
+	ip = xfs_ici_lookup(pag, agino);
 
 	if (ip) {
 		error = xfs_iget_cache_hit(pag, ip, ino, flags, lock_flags);
@@ -615,10 +1114,18 @@ xfs_iget(
 		}
 		XFS_STATS_INC(mp, xs_ig_missed);
 
+		start = ktime_get();
 		error = xfs_iget_cache_miss(mp, pag, tp, ino, &ip,
 							flags, lock_flags);
 		if (error)
 			goto out_error_or_again;
+		XFS_STATS_LAT(mp, XFS_LAT_IGET_MISS, start);
+
+		if ((mp->m_flags & XFS_MOUNT_IPREFETCH) && !tp &&
+		    !(flags & (XFS_IGET_CREATE | XFS_IGET_UNTRUSTED |
+			       XFS_IGET_DONTCACHE)) &&
+		    VFS_I(ip)->i_mode && !XFS_FORCED_SHUTDOWN(mp))
+			xfs_iget_prefetch_cluster(mp, pag, ip);
 	}
 	xfs_perag_put(pag);
 
@@ -748,6 +1255,7 @@ xfs_inode_ag_walk(
 	int			skipped;
 	int			done;
 	int			nr_found;
+	bool			cancelled = false;
 
 restart:
 	done = 0;
@@ -761,15 +1269,8 @@ xfs_inode_ag_walk(
 
 		rcu_read_lock();
 
-		if (tag == -1)
-			nr_found = radix_tree_gang_lookup(&pag->pag_ici_root,
-					(void **)batch, first_index,
-					XFS_LOOKUP_BATCH);
-		else
-			nr_found = radix_tree_gang_lookup_tag(
-					&pag->pag_ici_root,
-					(void **) batch, first_index,
-					XFS_LOOKUP_BATCH, tag);
+		nr_found = xfs_ici_gang_lookup(pag, batch, first_index,
+				XFS_LOOKUP_BATCH, tag);
 
 		if (!nr_found) {
 			rcu_read_unlock();
@@ -814,12 +1315,23 @@ xfs_inode_ag_walk(
 			if ((iter_flags & XFS_AGITER_INEW_WAIT) &&
 			    xfs_iflags_test(batch[i], XFS_INEW))
 				xfs_inew_wait(batch[i]);
+			if (cancelled) {
+				IRELE(batch[i]);
+				continue;
+			}
 			error = execute(batch[i], flags, args);
 			IRELE(batch[i]);
 			if (error == -EAGAIN) {
 				skipped++;
 				continue;
 			}
+			/* the scan has done what the caller asked for */
+			if (error == -ECANCELED) {
+				cancelled = true;
+				done = 1;
+				error = 0;
+				continue;
+			}
 			if (error && last_error != -EFSCORRUPTED)
 				last_error = error;
 		}
@@ -832,7 +1344,7 @@ xfs_inode_ag_walk(
 
 	} while (nr_found && !done);
 
-	if (skipped) {
+	if (skipped && !cancelled) {
 		delay(1);
 		goto restart;
 	}
@@ -847,12 +1359,10 @@ void
 xfs_queue_eofblocks(
 	struct xfs_mount *mp)
 {
-	rcu_read_lock();
-	if (radix_tree_tagged(&mp->m_perag_tree, XFS_ICI_EOFBLOCKS_TAG))
+	if (atomic_read(&mp->m_ici_tagged[XFS_ICI_EOFBLOCKS_TAG]))
 		queue_delayed_work(mp->m_eofblocks_workqueue,
 				   &mp->m_eofblocks_work,
 				   msecs_to_jiffies(xfs_eofb_secs * 1000));
-	rcu_read_unlock();
 }
 
 void
@@ -874,12 +1384,10 @@ STATIC void
 xfs_queue_cowblocks(
 	struct xfs_mount *mp)
 {
-	rcu_read_lock();
-	if (radix_tree_tagged(&mp->m_perag_tree, XFS_ICI_COWBLOCKS_TAG))
+	if (atomic_read(&mp->m_ici_tagged[XFS_ICI_COWBLOCKS_TAG]))
 		queue_delayed_work(mp->m_eofblocks_workqueue,
 				   &mp->m_cowblocks_work,
 				   msecs_to_jiffies(xfs_cowb_secs * 1000));
-	rcu_read_unlock();
 }
 
 void
@@ -961,6 +1469,80 @@ xfs_inode_ag_iterator_tag(
 	return last_error;
 }
 
+struct xfs_ag_scan {
+	struct work_struct	as_work;
+	struct xfs_mount	*as_mp;
+	struct xfs_perag	*as_pag;
+	int			(*as_execute)(struct xfs_inode *ip, int flags,
+					      void *args);
+	int			as_flags;
+	void			*as_args;
+	int			as_tag;
+	int			as_error;
+};
+
+static void
+xfs_inode_ag_scan_worker(
+	struct work_struct	*work)
+{
+	struct xfs_ag_scan	*scan = container_of(work,
+					struct xfs_ag_scan, as_work);
+
+	scan->as_error = xfs_inode_ag_walk(scan->as_mp, scan->as_pag,
+			scan->as_execute, scan->as_flags, scan->as_args,
+			scan->as_tag, 0);
+}
+
+/*
+ * Walk the tagged inodes of every tagged AG at the same time, one work item
+ * per AG on the unbound blockgc workqueue, and wait for them all to finish.
+ * If we can't allocate the work items, fall back to a serial walk.
+ */
+STATIC int
+xfs_inode_ag_iterator_tag_parallel(
+	struct xfs_mount	*mp,
+	int			(*execute)(struct xfs_inode *ip, int flags,
+					   void *args),
+	int			flags,
+	void			*args,
+	int			tag)
+{
+	struct xfs_ag_scan	*scans;
+	struct xfs_perag	*pag;
+	xfs_agnumber_t		agcount = mp->m_sb.sb_agcount;
+	xfs_agnumber_t		ag = 0;
+	xfs_agnumber_t		nr = 0;
+	xfs_agnumber_t		i;
+	int			last_error = 0;
+
+	scans = kmem_zalloc(agcount * sizeof(*scans), KM_MAYFAIL);
+	if (!scans)
+		return xfs_inode_ag_iterator_tag(mp, execute, flags, args, tag);
+
+	while (nr < agcount && (pag = xfs_perag_get_tag(mp, ag, tag))) {
+		struct xfs_ag_scan	*scan = &scans[nr++];
+
+		ag = pag->pag_agno + 1;
+		scan->as_mp = mp;
+		scan->as_pag = pag;
+		scan->as_execute = execute;
+		scan->as_flags = flags;
+		scan->as_args = args;
+		scan->as_tag = tag;
+		INIT_WORK(&scan->as_work, xfs_inode_ag_scan_worker);
+		queue_work(mp->m_blockgc_workqueue, &scan->as_work);
+	}
+
+	for (i = 0; i < nr; i++) {
+		flush_work(&scans[i].as_work);
+		xfs_perag_put(scans[i].as_pag);
+		if (scans[i].as_error && last_error != -EFSCORRUPTED)
+			last_error = scans[i].as_error;
+	}
+	kmem_free(scans);
+	return last_error;
+}
+
 /*
  * Grab the inode for reclaim exclusively.
  * Return 0 if we grabbed it, non-zero otherwise.
@@ -1054,6 +1636,7 @@ xfs_reclaim_inode(
 {
 	struct xfs_buf		*bp = NULL;
 	xfs_ino_t		ino = ip->i_ino; /* for radix_tree_delete */
+	struct xfs_ici_shard	*shard;
 	int			error;
 
 restart:
@@ -1134,6 +1717,7 @@ xfs_reclaim_inode(
 	ip->i_flags = XFS_IRECLAIM;
 	ip->i_ino = 0;
 	spin_unlock(&ip->i_flags_lock);
+	list_lru_del(&ip->i_mount->m_reclaim_lru, &ip->i_reclaim_lru);
 
 	xfs_iunlock(ip, XFS_ILOCK_EXCL);
 
@@ -1145,12 +1729,12 @@ xfs_reclaim_inode(
 	 * added to the tree assert that it's been there before to catch
 	 * problems with the inode life time early on.
 	 */
-	spin_lock(&pag->pag_ici_lock);
-	if (!radix_tree_delete(&pag->pag_ici_root,
-				XFS_INO_TO_AGINO(ip->i_mount, ino)))
+	shard = xfs_ici_shard(pag, XFS_INO_TO_AGINO(ip->i_mount, ino));
+	spin_lock(&shard->lock);
+	if (!xfs_ici_delete(pag, shard, XFS_INO_TO_AGINO(ip->i_mount, ino)))
 		ASSERT(0);
-	xfs_perag_clear_reclaim_tag(pag);
-	spin_unlock(&pag->pag_ici_lock);
+	atomic_dec(&pag->pag_ici_reclaimable);
+	spin_unlock(&shard->lock);
 
 	/*
 	 * Here we do an (almost) spurious inode lock in order to coordinate
@@ -1170,6 +1754,8 @@ xfs_reclaim_inode(
 out_ifunlock:
 	xfs_ifunlock(ip);
 out:
+	/* Put it back on the memcg list if a memcg shrinker took it off. */
+	list_lru_add(&ip->i_mount->m_reclaim_lru, &ip->i_reclaim_lru);
 	xfs_iflags_clear(ip, XFS_IRECLAIM);
 	xfs_iunlock(ip, XFS_ILOCK_EXCL);
 	/*
@@ -1182,6 +1768,101 @@ xfs_reclaim_inode(
 	return 0;
 }
 
+/*
+ * Reclaim the inodes in a single AG.  If @trylock is set and somebody else is
+ * already reclaiming this AG, return -EAGAIN without doing anything.
+ */
+STATIC int
+xfs_reclaim_inodes_pag(
+	struct xfs_perag	*pag,
+	int			flags,
+	int			trylock,
+	int			*nr_to_scan)
+{
+	struct xfs_mount	*mp = pag->pag_mount;
+	unsigned long		first_index = 0;
+	int			done = 0;
+	int			nr_found = 0;
+	int			error;
+	int			last_error = 0;
+
+	if (trylock) {
+		if (!mutex_trylock(&pag->pag_ici_reclaim_lock))
+			return -EAGAIN;
+		first_index = pag->pag_ici_reclaim_cursor;
+	} else
+		mutex_lock(&pag->pag_ici_reclaim_lock);
+
+	do {
+		struct xfs_inode *batch[XFS_LOOKUP_BATCH];
+		int	i;
+
+		rcu_read_lock();
+		nr_found = xfs_ici_gang_lookup(pag, batch, first_index,
+				XFS_LOOKUP_BATCH, XFS_ICI_RECLAIM_TAG);
+		if (!nr_found) {
+			done = 1;
+			rcu_read_unlock();
+			break;
+		}
+
+		/*
+		 * Grab the inodes before we drop the lock. if we found
+		 * nothing, nr == 0 and the loop will be skipped.
+		 */
+		for (i = 0; i < nr_found; i++) {
+			struct xfs_inode *ip = batch[i];
+
+			if (done || xfs_reclaim_inode_grab(ip, flags))
+				batch[i] = NULL;
+
+			/*
+			 * Update the index for the next lookup. Catch
+			 * overflows into the next AG range which can
+			 * occur if we have inodes in the last block of
+			 * the AG and we are currently pointing to the
+			 * last inode.
+			 *
+			 * Because we may see inodes that are from the
+			 * wrong AG due to RCU freeing and
+			 * reallocation, only update the index if it
+			 * lies in this AG. It was a race that lead us
+			 * to see this inode, so another lookup from
+			 * the same index will not find it again.
+			 */
+			if (XFS_INO_TO_AGNO(mp, ip->i_ino) !=
+							pag->pag_agno)
+				continue;
+			first_index = XFS_INO_TO_AGINO(mp, ip->i_ino + 1);
+			if (first_index < XFS_INO_TO_AGINO(mp, ip->i_ino))
+				done = 1;
+		}
+
+		/* unlock now we've grabbed the inodes. */
+		rcu_read_unlock();
+
+		for (i = 0; i < nr_found; i++) {
+			if (!batch[i])
+				continue;
+			error = xfs_reclaim_inode(batch[i], pag, flags);
+			if (error && last_error != -EFSCORRUPTED)
+				last_error = error;
+		}
+
+		*nr_to_scan -= XFS_LOOKUP_BATCH;
+
+		cond_resched();
+
+	} while (nr_found && !done && *nr_to_scan > 0);
+
+	if (trylock && !done)
+		pag->pag_ici_reclaim_cursor = first_index;
+	else
+		pag->pag_ici_reclaim_cursor = 0;
+	mutex_unlock(&pag->pag_ici_reclaim_lock);
+	return last_error;
+}
+
 /*
  * Walk the AGs and reclaim the inodes in them. Even if the filesystem is
  * corrupted, we still want to try to reclaim all the inodes. If we don't,
@@ -1205,93 +1886,16 @@ xfs_reclaim_inodes_ag(
 	ag = 0;
 	skipped = 0;
 	while ((pag = xfs_perag_get_tag(mp, ag, XFS_ICI_RECLAIM_TAG))) {
-		unsigned long	first_index = 0;
-		int		done = 0;
-		int		nr_found = 0;
-
 		ag = pag->pag_agno + 1;
 
-		if (trylock) {
-			if (!mutex_trylock(&pag->pag_ici_reclaim_lock)) {
-				skipped++;
-				xfs_perag_put(pag);
-				continue;
-			}
-			first_index = pag->pag_ici_reclaim_cursor;
-		} else
-			mutex_lock(&pag->pag_ici_reclaim_lock);
-
-		do {
-			struct xfs_inode *batch[XFS_LOOKUP_BATCH];
-			int	i;
-
-			rcu_read_lock();
-			nr_found = radix_tree_gang_lookup_tag(
-					&pag->pag_ici_root,
-					(void **)batch, first_index,
-					XFS_LOOKUP_BATCH,
-					XFS_ICI_RECLAIM_TAG);
-			if (!nr_found) {
-				done = 1;
-				rcu_read_unlock();
-				break;
-			}
-
-			/*
-			 * Grab the inodes before we drop the lock. if we found
-			 * nothing, nr == 0 and the loop will be skipped.
-			 */
-			for (i = 0; i < nr_found; i++) {
-				struct xfs_inode *ip = batch[i];
-
-				if (done || xfs_reclaim_inode_grab(ip, flags))
-					batch[i] = NULL;
-
-				/*
-				 * Update the index for the next lookup. Catch
-				 * overflows into the next AG range which can
-				 * occur if we have inodes in the last block of
-				 * the AG and we are currently pointing to the
-				 * last inode.
-				 *
-				 * Because we may see inodes that are from the
-				 * wrong AG due to RCU freeing and
-				 * reallocation, only update the index if it
-				 * lies in this AG. It was a race that lead us
-				 * to see this inode, so another lookup from
-				 * the same index will not find it again.
-				 */
-				if (XFS_INO_TO_AGNO(mp, ip->i_ino) !=
-								pag->pag_agno)
-					continue;
-				first_index = XFS_INO_TO_AGINO(mp, ip->i_ino + 1);
-				if (first_index < XFS_INO_TO_AGINO(mp, ip->i_ino))
-					done = 1;
-			}
-
-			/* unlock now we've grabbed the inodes. */
-			rcu_read_unlock();
-
-			for (i = 0; i < nr_found; i++) {
-				if (!batch[i])
-					continue;
-				error = xfs_reclaim_inode(batch[i], pag, flags);
-				if (error && last_error != -EFSCORRUPTED)
-					last_error = error;
-			}
-
-			*nr_to_scan -= XFS_LOOKUP_BATCH;
-
-			cond_resched();
-
-		} while (nr_found && !done && *nr_to_scan > 0);
-
-		if (trylock && !done)
-			pag->pag_ici_reclaim_cursor = first_index;
-		else
-			pag->pag_ici_reclaim_cursor = 0;
-		mutex_unlock(&pag->pag_ici_reclaim_lock);
+		error = xfs_reclaim_inodes_pag(pag, flags, trylock, nr_to_scan);
 		xfs_perag_put(pag);
+		if (error == -EAGAIN) {
+			skipped++;
+			continue;
+		}
+		if (error && last_error != -EFSCORRUPTED)
+			last_error = error;
 	}
 
 	/*
@@ -1308,6 +1912,22 @@ xfs_reclaim_inodes_ag(
 	return last_error;
 }
 
+/*
+ * Background reclaim of a single AG.  This never waits on inode locks, flush
+ * locks or I/O, so it only frees inodes that are already clean.  Dirty ones
+ * are written back by AIL pushing and picked up on a later pass.
+ */
+void
+xfs_reclaim_ag_worker(
+	struct work_struct	*work)
+{
+	struct xfs_perag	*pag = container_of(work, struct xfs_perag,
+						    pag_reclaim_work);
+	int			nr_to_scan = INT_MAX;
+
+	xfs_reclaim_inodes_pag(pag, SYNC_TRYLOCK, 1, &nr_to_scan);
+}
+
 int
 xfs_reclaim_inodes(
 	xfs_mount_t	*mp,
@@ -1321,22 +1941,83 @@ xfs_reclaim_inodes(
 /*
  * Scan a certain number of inodes for reclaim.
  *
- * When called we make sure that there is a background (fast) inode reclaim in
- * progress, while we will throttle the speed of reclaim via doing synchronous
- * reclaim of inodes. That means if we come across dirty inodes, we wait for
- * them to be cleaned, which we hope will not be very long due to the
- * background walker having already kicked the IO off on those dirty inodes.
+ * This is called from direct reclaim, so it must not stall the caller on
+ * inode flushing or buffer I/O.  We push the AIL to get dirty inodes written
+ * back, kick the per-AG reclaim workers to free them once they are clean, and
+ * only reclaim the inodes that are already clean and unlocked here.
  */
 long
 xfs_reclaim_inodes_nr(
 	struct xfs_mount	*mp,
 	int			nr_to_scan)
 {
-	/* kick background reclaimer and push the AIL */
+	/* kick background reclaimers and push the AIL */
+	xfs_ail_push_all(mp->m_ail);
+	xfs_reclaim_ag_queue_all(mp);
 	xfs_reclaim_work_queue(mp);
+
+	return xfs_reclaim_inodes_ag(mp, SYNC_TRYLOCK, &nr_to_scan);
+}
+
+/*
+ * Reclaim on behalf of a memory cgroup.
+ *
+ * Reclaimable inodes are also kept on a memcg aware list_lru, on the list of
+ * the cgroup the inode memory is charged to.  When the superblock shrinker
+ * runs for a cgroup, only that cgroup's reclaimable inodes are freed, so that
+ * a container churning through inodes doesn't evict everybody else's.  As
+ * for direct reclaim, dirty inodes are left for the AIL and background
+ * reclaim and only clean ones are freed here.
+ */
+static enum lru_status
+xfs_reclaim_inode_isolate(
+	struct list_head	*item,
+	struct list_lru_one	*lru,
+	spinlock_t		*lru_lock,
+	void			*arg)
+{
+	struct xfs_inode	*ip = container_of(item, struct xfs_inode,
+						   i_reclaim_lru);
+	struct list_head	*dispose = arg;
+
+	/* Inverted lock order against adding to the list, so trylock. */
+	if (!spin_trylock(&ip->i_flags_lock))
+		return LRU_SKIP;
+	if (__xfs_iflags_test(ip, XFS_IRECLAIM | XFS_IFLOCK)) {
+		spin_unlock(&ip->i_flags_lock);
+		return LRU_ROTATE;
+	}
+	ASSERT(__xfs_iflags_test(ip, XFS_IRECLAIMABLE));
+	__xfs_iflags_set(ip, XFS_IRECLAIM);
+	spin_unlock(&ip->i_flags_lock);
+
+	list_lru_isolate_move(lru, item, dispose);
+	return LRU_REMOVED;
+}
+
+long
+xfs_reclaim_inodes_memcg(
+	struct xfs_mount	*mp,
+	struct shrink_control	*sc)
+{
+	struct xfs_inode	*ip;
+	struct xfs_perag	*pag;
+	LIST_HEAD(dispose);
+	long			freed;
+
 	xfs_ail_push_all(mp->m_ail);
 
-	return xfs_reclaim_inodes_ag(mp, SYNC_TRYLOCK | SYNC_WAIT, &nr_to_scan);
+	freed = list_lru_shrink_walk(&mp->m_reclaim_lru, sc,
+			xfs_reclaim_inode_isolate, &dispose);
+	while (!list_empty(&dispose)) {
+		ip = list_first_entry(&dispose, struct xfs_inode,
+				      i_reclaim_lru);
+		list_del_init(&ip->i_reclaim_lru);
+		pag = xfs_perag_get(mp, XFS_INO_TO_AGNO(mp, ip->i_ino));
+		xfs_reclaim_inode(ip, pag, SYNC_TRYLOCK);
+		xfs_perag_put(pag);
+	}
+	return freed;
 }
 
 /*
@@ -1353,7 +2034,7 @@ xfs_reclaim_inodes_count(
 
 	while ((pag = xfs_perag_get_tag(mp, ag, XFS_ICI_RECLAIM_TAG))) {
 		ag = pag->pag_agno + 1;
-		reclaimable += pag->pag_ici_reclaimable;
+		reclaimable += atomic_read(&pag->pag_ici_reclaimable);
 		xfs_perag_put(pag);
 	}
 	return reclaimable;
@@ -1403,6 +2084,22 @@ xfs_inode_match_id_union(
 	return 0;
 }
 
+/*
+ * Scans run to relieve ENOSPC set a free space goal so that the writer can
+ * retry as soon as enough space has been returned, rather than waiting for
+ * every AG to be scanned.
+ */
+static inline bool
+xfs_eofblocks_goal_met(
+	struct xfs_mount	*mp,
+	struct xfs_eofblocks	*eofb)
+{
+	if (!eofb || !eofb->eof_free_goal)
+		return false;
+	return percpu_counter_read_positive(&mp->m_fdblocks) >=
+		eofb->eof_free_goal + mp->m_alloc_set_aside;
+}
+
 STATIC int
 xfs_inode_free_eofblocks(
 	struct xfs_inode	*ip,
@@ -1413,6 +2110,9 @@ xfs_inode_free_eofblocks(
 	struct xfs_eofblocks *eofb = args;
 	int match;
 
+	if (xfs_eofblocks_goal_met(ip->i_mount, eofb))
+		return -ECANCELED;
+
 	if (!xfs_can_free_eofblocks(ip, false)) {
 		/* inode could be preallocated or append-only */
 		trace_xfs_inode_free_eofblocks_invalid(ip);
@@ -1440,6 +2140,13 @@ xfs_inode_free_eofblocks(
 		if (eofb->eof_flags & XFS_EOF_FLAGS_MINFILESIZE &&
 		    XFS_ISIZE(ip) < eofb->eof_min_file_size)
 			return 0;
+	} else if (xfs_inode_append_steady(ip)) {
+		/*
+		 * The background scan leaves files that are still being
+		 * appended to alone until they have been idle for a full scan
+		 * interval.
+		 */
+		return 0;
 	}
 
 	/*
@@ -1470,8 +2177,8 @@ __xfs_icache_free_eofblocks(
 	if (eofb && (eofb->eof_flags & XFS_EOF_FLAGS_SYNC))
 		flags = SYNC_WAIT;
 
-	return xfs_inode_ag_iterator_tag(mp, execute, flags,
-					 eofb, tag);
+	return xfs_inode_ag_iterator_tag_parallel(mp, execute, flags,
+						  eofb, tag);
 }
 
 int
@@ -1545,8 +2252,10 @@ __xfs_inode_set_eofblocks_tag(
 	int		tag)
 {
 	struct xfs_mount *mp = ip->i_mount;
+	xfs_agino_t agino = XFS_INO_TO_AGINO(mp, ip->i_ino);
 	struct xfs_perag *pag;
-	int tagged;
+	struct xfs_ici_shard *shard;
+	bool tagged;
 
 	/*
 	 * Don't bother locking the AG and looking up in the radix trees
@@ -1559,26 +2268,19 @@ __xfs_inode_set_eofblocks_tag(
 	spin_unlock(&ip->i_flags_lock);
 
 	pag = xfs_perag_get(mp, XFS_INO_TO_AGNO(mp, ip->i_ino));
-	spin_lock(&pag->pag_ici_lock);
-
-	tagged = radix_tree_tagged(&pag->pag_ici_root, tag);
-	radix_tree_tag_set(&pag->pag_ici_root,
-			   XFS_INO_TO_AGINO(ip->i_mount, ip->i_ino), tag);
-	if (!tagged) {
-		/* propagate the eofblocks tag up into the perag radix tree */
-		spin_lock(&ip->i_mount->m_perag_lock);
-		radix_tree_tag_set(&ip->i_mount->m_perag_tree,
-				   XFS_INO_TO_AGNO(ip->i_mount, ip->i_ino),
-				   tag);
-		spin_unlock(&ip->i_mount->m_perag_lock);
+	shard = xfs_ici_shard(pag, agino);
+	spin_lock(&shard->lock);
 
+	tagged = radix_tree_tagged(&shard->root, tag);
+	radix_tree_tag_set(&shard->root, agino, tag);
+	if (xfs_ici_tag_changed(pag, shard, tag, tagged)) {
 		/* kick off background trimming */
-		execute(ip->i_mount);
+		execute(mp);
 
-		set_tp(ip->i_mount, pag->pag_agno, -1, _RET_IP_);
+		set_tp(mp, pag->pag_agno, -1, _RET_IP_);
 	}
 
-	spin_unlock(&pag->pag_ici_lock);
+	spin_unlock(&shard->lock);
 	xfs_perag_put(pag);
 }
 
@@ -1600,28 +2302,25 @@ __xfs_inode_clear_eofblocks_tag(
 	int		tag)
 {
 	struct xfs_mount *mp = ip->i_mount;
+	xfs_agino_t agino = XFS_INO_TO_AGINO(mp, ip->i_ino);
 	struct xfs_perag *pag;
+	struct xfs_ici_shard *shard;
+	bool tagged;
 
 	spin_lock(&ip->i_flags_lock);
 	ip->i_flags &= ~XFS_IEOFBLOCKS;
 	spin_unlock(&ip->i_flags_lock);
 
 	pag = xfs_perag_get(mp, XFS_INO_TO_AGNO(mp, ip->i_ino));
-	spin_lock(&pag->pag_ici_lock);
-
-	radix_tree_tag_clear(&pag->pag_ici_root,
-			     XFS_INO_TO_AGINO(ip->i_mount, ip->i_ino), tag);
-	if (!radix_tree_tagged(&pag->pag_ici_root, tag)) {
-		/* clear the eofblocks tag from the perag radix tree */
-		spin_lock(&ip->i_mount->m_perag_lock);
-		radix_tree_tag_clear(&ip->i_mount->m_perag_tree,
-				     XFS_INO_TO_AGNO(ip->i_mount, ip->i_ino),
-				     tag);
-		spin_unlock(&ip->i_mount->m_perag_lock);
-		clear_tp(ip->i_mount, pag->pag_agno, -1, _RET_IP_);
-	}
+	shard = xfs_ici_shard(pag, agino);
+	spin_lock(&shard->lock);
 
-	spin_unlock(&pag->pag_ici_lock);
+	tagged = radix_tree_tagged(&shard->root, tag);
+	radix_tree_tag_clear(&shard->root, agino, tag);
+	if (xfs_ici_tag_changed(pag, shard, tag, tagged))
+		clear_tp(mp, pag->pag_agno, -1, _RET_IP_);
+
+	spin_unlock(&shard->lock);
 	xfs_perag_put(pag);
 }
 
@@ -1657,6 +2356,9 @@ xfs_inode_free_cowblocks(
 	int match;
 	struct xfs_ifork	*ifp = XFS_IFORK_PTR(ip, XFS_COW_FORK);
 
+	if (xfs_eofblocks_goal_met(ip->i_mount, eofb))
+		return -ECANCELED;
+
 	/*
 	 * Just clear the tag if we have an empty cow fork or none at all. It's
 	 * possible the inode was fully unshared since it was originally tagged.
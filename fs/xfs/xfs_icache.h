@@ -27,6 +27,7 @@ struct xfs_eofblocks {
 	kgid_t		eof_gid;
 	prid_t		eof_prid;
 	__u64		eof_min_file_size;
+	__u64		eof_free_goal;	/* stop once this many blocks free */
 };
 
 #define SYNC_WAIT		0x0001	/* wait for i/o to complete */
@@ -57,18 +58,45 @@ struct xfs_eofblocks {
 int xfs_iget(struct xfs_mount *mp, struct xfs_trans *tp, xfs_ino_t ino,
 	     uint flags, uint lock_flags, xfs_inode_t **ipp);
 
+/* Find the inode cache shard that covers an AG inode number. */
+static inline struct xfs_ici_shard *
+xfs_ici_shard(
+	struct xfs_perag	*pag,
+	xfs_agino_t		agino)
+{
+	return &pag->pag_ici_shards[agino >> pag->pag_ici_shard_shift];
+}
+
+static inline struct xfs_inode *
+xfs_ici_lookup(
+	struct xfs_perag	*pag,
+	xfs_agino_t		agino)
+{
+	return radix_tree_lookup(&xfs_ici_shard(pag, agino)->root, agino);
+}
+
+int xfs_ici_gang_lookup(struct xfs_perag *pag, struct xfs_inode **batch,
+		xfs_agino_t first_index, unsigned int nr, int tag);
+
 /* recovery needs direct inode allocation capability */
 struct xfs_inode * xfs_inode_alloc(struct xfs_mount *mp, xfs_ino_t ino);
 void xfs_inode_free(struct xfs_inode *ip);
 
 void xfs_reclaim_worker(struct work_struct *work);
+void xfs_reclaim_ag_worker(struct work_struct *work);
+void xfs_reclaim_work_cancel(struct xfs_mount *mp);
 
 int xfs_reclaim_inodes(struct xfs_mount *mp, int mode);
 int xfs_reclaim_inodes_count(struct xfs_mount *mp);
 long xfs_reclaim_inodes_nr(struct xfs_mount *mp, int nr_to_scan);
+long xfs_reclaim_inodes_memcg(struct xfs_mount *mp, struct shrink_control *sc);
 
 void xfs_inode_set_reclaim_tag(struct xfs_inode *ip);
 
+bool xfs_inactive_queue(struct xfs_inode *ip);
+void xfs_inactive_worker(struct work_struct *work);
+void xfs_inactive_flush(struct xfs_mount *mp);
+
 void xfs_inode_set_eofblocks_tag(struct xfs_inode *ip);
 void xfs_inode_clear_eofblocks_tag(struct xfs_inode *ip);
 int xfs_icache_free_eofblocks(struct xfs_mount *, struct xfs_eofblocks *);
@@ -110,6 +138,7 @@ xfs_fs_eofblocks_from_user(
 	dst->eof_flags = src->eof_flags;
 	dst->eof_prid = src->eof_prid;
 	dst->eof_min_file_size = src->eof_min_file_size;
+	dst->eof_free_goal = 0;
 
 	dst->eof_uid = INVALID_UID;
 	if (src->eof_flags & XFS_EOF_FLAGS_UID) {
@@ -78,16 +78,49 @@ xfs_get_extsz_hint(
 	return 0;
 }
 
+/*
+ * Allocation alignment for DAX files.  Faults can only be served with PMD
+ * mappings if the file's blocks are physically aligned to PMD_SIZE and
+ * allocated that many at a time, so unless the file has an extent size hint
+ * that says otherwise we allocate DAX file data in aligned PMD-sized chunks.
+ */
+xfs_extlen_t
+xfs_get_dax_align(
+	struct xfs_inode	*ip)
+{
+#ifdef CONFIG_FS_DAX_PMD
+	struct xfs_mount	*mp = ip->i_mount;
+	xfs_extlen_t		align = XFS_B_TO_FSBT(mp, PMD_SIZE);
+	xfs_extlen_t		extsz;
+
+	if (!IS_DAX(VFS_I(ip)) || XFS_IS_REALTIME_INODE(ip))
+		return 0;
+
+	/* Don't bother if a few chunks would fill an AG. */
+	if (align > mp->m_sb.sb_agblocks / 4)
+		return 0;
+
+	extsz = xfs_get_extsz_hint(ip);
+	if (extsz && extsz % align)
+		return 0;
+	return align;
+#else
+	return 0;
+#endif
+}
+
 /*
  * Helper function to extract CoW extent size hint from inode.
  * Between the extent size hint and the CoW extent size hint, we
  * return the greater of the two.  If the value is zero (automatic),
- * use the default size.
+ * use the size that xfs_reflink_tune_cowextsz picked for this inode,
+ * or the default if the inode was never written.
  */
 xfs_extlen_t
 xfs_get_cowextsz_hint(
 	struct xfs_inode	*ip)
 {
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
 	xfs_extlen_t		a, b;
 
 	a = 0;
@@ -97,7 +130,7 @@ xfs_get_cowextsz_hint(
 
 	a = max(a, b);
 	if (a == 0)
-		return XFS_DEFAULT_COWEXTSZ_HINT;
+		return io ? io->iio_cowextsz_auto : XFS_DEFAULT_COWEXTSZ_HINT;
 	return a;
 }
 
@@ -931,7 +964,8 @@ xfs_ialloc(
 		ip->i_d.di_format = XFS_DINODE_FMT_EXTENTS;
 		ip->i_df.if_flags = XFS_IFEXTENTS;
 		ip->i_df.if_bytes = ip->i_df.if_real_bytes = 0;
-		ip->i_df.if_u1.if_extents = NULL;
+		ip->i_df.if_u1.if_root = NULL;
+		ip->i_df.if_height = 0;
 		break;
 	default:
 		ASSERT(0);
@@ -955,6 +989,68 @@ xfs_ialloc(
 	return 0;
 }
 
+/*
+ * Allocating and initialising an inode chunk inside a create transaction
+ * makes that create wait for the chunk allocation and the cluster buffer
+ * initialisation.  So when a create leaves an AG with fewer free inodes than
+ * a chunk holds, allocate the next chunk from a worker instead.
+ */
+void
+xfs_inode_prealloc_queue(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno)
+{
+	struct xfs_perag	*pag;
+
+	pag = xfs_perag_get(mp, agno);
+	if (pag->pagi_freecount < mp->m_ialloc_inos)
+		queue_work(mp->m_ialloc_workqueue, &pag->pag_ialloc_work);
+	xfs_perag_put(pag);
+}
+
+void
+xfs_inode_prealloc_worker(
+	struct work_struct	*work)
+{
+	struct xfs_perag	*pag = container_of(work, struct xfs_perag,
+						    pag_ialloc_work);
+	struct xfs_mount	*mp = pag->pag_mount;
+	struct xfs_trans	*tp;
+	int			alloc;
+	int			error;
+
+	if (pag->pagi_freecount >= mp->m_ialloc_inos)
+		return;
+
+	/* Near ENOSPC creates allocate their own chunks as they always did. */
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_create,
+			XFS_IALLOC_SPACE_RES(mp), 0, 0, &tp);
+	if (error)
+		return;
+
+	error = xfs_ialloc_ag_prealloc(tp, pag->pag_agno, &alloc);
+	if (error || !alloc) {
+		xfs_trans_cancel(tp);
+		return;
+	}
+	xfs_trans_commit(tp);
+}
+
+/* Wait for background inode chunk allocation to stop. */
+void
+xfs_inode_prealloc_cancel(
+	struct xfs_mount	*mp)
+{
+	struct xfs_perag	*pag;
+	xfs_agnumber_t		agno;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		pag = xfs_perag_get(mp, agno);
+		cancel_work_sync(&pag->pag_ialloc_work);
+		xfs_perag_put(pag);
+	}
+}
+
 /*
  * Allocates a new inode from disk and return a pointer to the
  * incore copy. This routine will internally commit the current
@@ -1209,19 +1305,22 @@ xfs_create(
 	if (error)
 		goto out_release_inode;
 
-	xfs_ilock(dp, XFS_ILOCK_EXCL | XFS_ILOCK_PARENT);
-	unlock_dp_on_error = true;
-
-	xfs_defer_init(&dfops, &first_block);
-
 	/*
-	 * Reserve disk quota and the inode.
+	 * Reserve disk quota and the inode.  The dquots don't depend on the
+	 * directory, so do this before we lock it: the VFS already serialises
+	 * creates in a directory, and anything we do under the ILOCK also
+	 * holds up lookups and readdir running in parallel.
 	 */
 	error = xfs_trans_reserve_quota(tp, mp, udqp, gdqp,
 						pdqp, resblks, 1, 0);
 	if (error)
 		goto out_trans_cancel;
 
+	xfs_ilock(dp, XFS_ILOCK_EXCL | XFS_ILOCK_PARENT);
+	unlock_dp_on_error = true;
+
+	xfs_defer_init(&dfops, &first_block);
+
 	if (!resblks) {
 		error = xfs_dir_canenter(tp, dp, name);
 		if (error)
@@ -1574,6 +1673,25 @@ xfs_itruncate_extents(
 
 	trace_xfs_itruncate_extents_start(ip, new_size);
 
+	/*
+	 * Inline data owns no blocks, so just trim it.  An empty file goes
+	 * back to being an empty extent list.
+	 */
+	if (whichfork == XFS_DATA_FORK && xfs_is_inline_data_inode(ip)) {
+		struct xfs_ifork	*ifp = &ip->i_df;
+
+		if (new_size >= ifp->if_bytes)
+			return 0;
+		xfs_idata_realloc(ip, new_size - ifp->if_bytes, XFS_DATA_FORK);
+		if (new_size == 0) {
+			ifp->if_flags &= ~XFS_IFINLINE;
+			ifp->if_flags |= XFS_IFEXTENTS;
+			ip->i_d.di_format = XFS_DINODE_FMT_EXTENTS;
+		}
+		xfs_trans_log_inode(tp, ip, XFS_ILOG_CORE | XFS_ILOG_DDATA);
+		return 0;
+	}
+
 	/*
 	 * Since it is possible for space to become allocated beyond
 	 * the end of the file (in a crash where the space is allocated
@@ -1708,6 +1826,16 @@ xfs_release(
 		 */
 		if (xfs_iflags_test(ip, XFS_IDIRTY_RELEASE))
 			return 0;
+
+		/*
+		 * Files that are being appended to at a steady rate (e.g. log
+		 * files that are reopened for every write) keep their
+		 * speculative preallocation too.  The background eofblocks
+		 * scanner trims it once they have gone idle.
+		 */
+		if (xfs_inode_append_steady(ip))
+			return 0;
+
 		/*
 		 * If we can't get the iolock just skip truncating the blocks
 		 * past EOF because we could deadlock with the mmap_sem
@@ -1961,6 +2089,119 @@ xfs_inactive(
 	xfs_qm_dqdetach(ip);
 }
 
+/*
+ * In-memory back pointers for the AGI unlinked lists.
+ *
+ * The on-disk lists are singly linked, so pulling an inode out of the middle
+ * of a bucket means walking the bucket from its head, reading an inode
+ * cluster buffer per step, to find the inode that points at us.  With lots of
+ * open unlinked or O_TMPFILE inodes that makes unlink and close quadratic.
+ *
+ * To avoid that, every inode on an unlinked list that has a predecessor gets
+ * an entry in a per-AG hash mapping its agino to the agino of the inode
+ * pointing at it.  The hash is only a cache: lists that were on disk before
+ * mount have no entries, and a missing or stale entry just sends us back to
+ * walking the list.  All updates happen with the AGI buffer locked.
+ */
+struct xfs_iunlink_backref {
+	struct rhash_head	iu_rhash_head;
+	xfs_agino_t		iu_agino;	/* inode on the list */
+	xfs_agino_t		iu_prev_agino;	/* inode pointing at it */
+};
+
+static const struct rhashtable_params xfs_iunlink_hash_params = {
+	.min_size		= XFS_AGI_UNLINKED_BUCKETS,
+	.key_len		= sizeof(xfs_agino_t),
+	.key_offset		= offsetof(struct xfs_iunlink_backref, iu_agino),
+	.head_offset		= offsetof(struct xfs_iunlink_backref,
+					   iu_rhash_head),
+	.automatic_shrinking	= true,
+};
+
+int
+xfs_iunlink_init(
+	struct xfs_perag	*pag)
+{
+	return rhashtable_init(&pag->pagi_unlinked_hash,
+			       &xfs_iunlink_hash_params);
+}
+
+static void
+xfs_iunlink_free_backref(
+	void			*ptr,
+	void			*arg)
+{
+	kmem_free(ptr);
+}
+
+void
+xfs_iunlink_destroy(
+	struct xfs_perag	*pag)
+{
+	rhashtable_free_and_destroy(&pag->pagi_unlinked_hash,
+				    xfs_iunlink_free_backref, NULL);
+}
+
+/* Return the agino of the inode pointing at @agino, or NULLAGINO. */
+STATIC xfs_agino_t
+xfs_iunlink_lookup_backref(
+	struct xfs_perag	*pag,
+	xfs_agino_t		agino)
+{
+	struct xfs_iunlink_backref *iu;
+
+	iu = rhashtable_lookup_fast(&pag->pagi_unlinked_hash, &agino,
+				    xfs_iunlink_hash_params);
+	return iu ? iu->iu_prev_agino : NULLAGINO;
+}
+
+/*
+ * Record that @prev_agino now points at @agino.  If we can't get memory for
+ * the entry we just go without; removal will walk the list instead.
+ */
+STATIC void
+xfs_iunlink_set_backref(
+	struct xfs_perag	*pag,
+	xfs_agino_t		agino,
+	xfs_agino_t		prev_agino)
+{
+	struct xfs_iunlink_backref *iu;
+
+	iu = rhashtable_lookup_fast(&pag->pagi_unlinked_hash, &agino,
+				    xfs_iunlink_hash_params);
+	if (iu) {
+		iu->iu_prev_agino = prev_agino;
+		return;
+	}
+
+	iu = kmem_zalloc(sizeof(*iu), KM_NOFS | KM_MAYFAIL);
+	if (!iu)
+		return;
+	iu->iu_agino = agino;
+	iu->iu_prev_agino = prev_agino;
+	if (rhashtable_insert_fast(&pag->pagi_unlinked_hash,
+				   &iu->iu_rhash_head,
+				   xfs_iunlink_hash_params))
+		kmem_free(iu);
+}
+
+/* @agino no longer has a predecessor on its unlinked list. */
+STATIC void
+xfs_iunlink_drop_backref(
+	struct xfs_perag	*pag,
+	xfs_agino_t		agino)
+{
+	struct xfs_iunlink_backref *iu;
+
+	iu = rhashtable_lookup_fast(&pag->pagi_unlinked_hash, &agino,
+				    xfs_iunlink_hash_params);
+	if (!iu)
+		return;
+	rhashtable_remove_fast(&pag->pagi_unlinked_hash, &iu->iu_rhash_head,
+			       xfs_iunlink_hash_params);
+	kmem_free(iu);
+}
+
 /*
  * This is called when the inode's link count goes to 0 or we are creating a
  * tmpfile via O_TMPFILE. In the case of a tmpfile, @ignore_linkcount will be
@@ -1977,6 +2218,7 @@ xfs_iunlink(
 	struct xfs_inode *ip)
 {
 	xfs_mount_t	*mp = tp->t_mountp;
+	struct xfs_perag *pag;
 	xfs_agi_t	*agi;
 	xfs_dinode_t	*dip;
 	xfs_buf_t	*agibp;
@@ -2031,6 +2273,13 @@ xfs_iunlink(
 		xfs_trans_log_buf(tp, ibp, offset,
 				  (offset + sizeof(xfs_agino_t) - 1));
 		xfs_inobp_check(mp, ibp);
+
+		/* The old head now has us in front of it. */
+		pag = xfs_perag_get(mp, XFS_INO_TO_AGNO(mp, ip->i_ino));
+		xfs_iunlink_set_backref(pag,
+				be32_to_cpu(agi->agi_unlinked[bucket_index]),
+				agino);
+		xfs_perag_put(pag);
 	}
 
 	/*
@@ -2045,6 +2294,41 @@ xfs_iunlink(
 	return 0;
 }
 
+/*
+ * Read the on-disk inode @agino into @dipp/@bpp so that its unlinked pointer
+ * can be changed.  @offset returns the inode's offset in the buffer.
+ */
+STATIC int
+xfs_iunlink_map_prev(
+	struct xfs_trans	*tp,
+	xfs_agnumber_t		agno,
+	xfs_agino_t		agino,
+	struct xfs_dinode	**dipp,
+	struct xfs_buf		**bpp,
+	int			*offset)
+{
+	struct xfs_mount	*mp = tp->t_mountp;
+	struct xfs_imap		imap;
+	int			error;
+
+	imap.im_blkno = 0;
+	error = xfs_imap(mp, tp, XFS_AGINO_TO_INO(mp, agno, agino), &imap, 0);
+	if (error) {
+		xfs_warn(mp, "%s: xfs_imap returned error %d.",
+			 __func__, error);
+		return error;
+	}
+
+	error = xfs_imap_to_bp(mp, tp, &imap, dipp, bpp, 0, 0);
+	if (error) {
+		xfs_warn(mp, "%s: xfs_imap_to_bp returned error %d.",
+			 __func__, error);
+		return error;
+	}
+	*offset = imap.im_boffset;
+	return 0;
+}
+
 /*
  * Pull the on-disk inode from the AGI unlinked list.
  */
@@ -2053,8 +2337,8 @@ xfs_iunlink_remove(
 	xfs_trans_t	*tp,
 	xfs_inode_t	*ip)
 {
-	xfs_ino_t	next_ino;
 	xfs_mount_t	*mp;
+	struct xfs_perag *pag;
 	xfs_agi_t	*agi;
 	xfs_dinode_t	*dip;
 	xfs_buf_t	*agibp;
@@ -2062,6 +2346,7 @@ xfs_iunlink_remove(
 	xfs_agnumber_t	agno;
 	xfs_agino_t	agino;
 	xfs_agino_t	next_agino;
+	xfs_agino_t	prev_agino;
 	xfs_buf_t	*last_ibp;
 	xfs_dinode_t	*last_dip = NULL;
 	short		bucket_index;
@@ -2133,42 +2418,58 @@ xfs_iunlink_remove(
 			(sizeof(xfs_agino_t) * bucket_index);
 		xfs_trans_log_buf(tp, agibp, offset,
 				  (offset + sizeof(xfs_agino_t) - 1));
+
+		/* The next inode is the new head and has no predecessor. */
+		pag = xfs_perag_get(mp, agno);
+		xfs_iunlink_drop_backref(pag, agino);
+		if (next_agino != NULLAGINO)
+			xfs_iunlink_drop_backref(pag, next_agino);
+		xfs_perag_put(pag);
 	} else {
+		pag = xfs_perag_get(mp, agno);
+
 		/*
-		 * We need to search the list for the inode being freed.
+		 * Find the inode pointing at us.  The back pointer cache
+		 * usually knows it; check that it's right before trusting it.
 		 */
-		next_agino = be32_to_cpu(agi->agi_unlinked[bucket_index]);
 		last_ibp = NULL;
-		while (next_agino != agino) {
-			struct xfs_imap	imap;
-
-			if (last_ibp)
+		prev_agino = xfs_iunlink_lookup_backref(pag, agino);
+		if (prev_agino != NULLAGINO) {
+			error = xfs_iunlink_map_prev(tp, agno, prev_agino,
+					&last_dip, &last_ibp, &last_offset);
+			if (error)
+				goto out_put_pag;
+			if (be32_to_cpu(last_dip->di_next_unlinked) != agino) {
 				xfs_trans_brelse(tp, last_ibp);
-
-			imap.im_blkno = 0;
-			next_ino = XFS_AGINO_TO_INO(mp, agno, next_agino);
-
-			error = xfs_imap(mp, tp, next_ino, &imap, 0);
-			if (error) {
-				xfs_warn(mp,
-	"%s: xfs_imap returned error %d.",
-					 __func__, error);
-				return error;
+				last_ibp = NULL;
 			}
+		}
 
-			error = xfs_imap_to_bp(mp, tp, &imap, &last_dip,
-					       &last_ibp, 0, 0);
-			if (error) {
-				xfs_warn(mp,
-	"%s: xfs_imap_to_bp returned error %d.",
-					__func__, error);
-				return error;
+		/*
+		 * No usable back pointer, so search the list for the inode
+		 * being freed, filling in the cache as we go.
+		 */
+		if (!last_ibp) {
+			next_agino = be32_to_cpu(agi->agi_unlinked[bucket_index]);
+			while (next_agino != agino) {
+				if (last_ibp)
+					xfs_trans_brelse(tp, last_ibp);
+
+				prev_agino = next_agino;
+				error = xfs_iunlink_map_prev(tp, agno,
+						prev_agino, &last_dip,
+						&last_ibp, &last_offset);
+				if (error)
+					goto out_put_pag;
+
+				next_agino =
+					be32_to_cpu(last_dip->di_next_unlinked);
+				ASSERT(next_agino != NULLAGINO);
+				ASSERT(next_agino != 0);
+				if (next_agino != agino)
+					xfs_iunlink_set_backref(pag, next_agino,
+								prev_agino);
 			}
-
-			last_offset = imap.im_boffset;
-			next_agino = be32_to_cpu(last_dip->di_next_unlinked);
-			ASSERT(next_agino != NULLAGINO);
-			ASSERT(next_agino != 0);
 		}
 
 		/*
@@ -2180,7 +2481,7 @@ xfs_iunlink_remove(
 		if (error) {
 			xfs_warn(mp, "%s: xfs_imap_to_bp(2) returned error %d.",
 				__func__, error);
-			return error;
+			goto out_put_pag;
 		}
 		next_agino = be32_to_cpu(dip->di_next_unlinked);
 		ASSERT(next_agino != 0);
@@ -2214,8 +2515,14 @@ xfs_iunlink_remove(
 		xfs_trans_log_buf(tp, last_ibp, offset,
 				  (offset + sizeof(xfs_agino_t) - 1));
 		xfs_inobp_check(mp, last_ibp);
+
+		xfs_iunlink_drop_backref(pag, agino);
+		if (next_agino != NULLAGINO)
+			xfs_iunlink_set_backref(pag, next_agino, prev_agino);
+out_put_pag:
+		xfs_perag_put(pag);
 	}
-	return 0;
+	return error;
 }
 
 /*
@@ -2325,7 +2632,7 @@ xfs_ifree_cluster(
 		for (i = 0; i < inodes_per_cluster; i++) {
 retry:
 			rcu_read_lock();
-			ip = radix_tree_lookup(&pag->pag_ici_root,
+			ip = xfs_ici_lookup(pag,
 					XFS_INO_TO_AGINO(mp, (inum + i)));
 
 			/* Inode not in memory, nothing to do */
@@ -3195,6 +3502,7 @@ xfs_iflush_cluster(
 	struct xfs_inode	*cip;
 	int			nr_found;
 	int			clcount = 0;
+	int			nr_pinned = 0;
 	int			bufwasdelwri;
 	int			i;
 
@@ -3210,8 +3518,8 @@ xfs_iflush_cluster(
 	first_index = XFS_INO_TO_AGINO(mp, ip->i_ino) & mask;
 	rcu_read_lock();
 	/* really need a gang lookup range call here */
-	nr_found = radix_tree_gang_lookup(&pag->pag_ici_root, (void**)cilist,
-					first_index, inodes_per_cluster);
+	nr_found = xfs_ici_gang_lookup(pag, cilist, first_index,
+					inodes_per_cluster, XFS_ICI_NO_TAG);
 	if (nr_found == 0)
 		goto out_free;
 
@@ -3266,6 +3574,7 @@ xfs_iflush_cluster(
 		if (xfs_ipincount(cip)) {
 			xfs_ifunlock(cip);
 			xfs_iunlock(cip, XFS_ILOCK_SHARED);
+			nr_pinned++;
 			continue;
 		}
 
@@ -3308,6 +3617,23 @@ xfs_iflush_cluster(
 out_free:
 	rcu_read_unlock();
 	kmem_free(cilist);
+
+	/*
+	 * Dirty inodes we had to skip because they were pinned would otherwise
+	 * each cost another flush, lookup and cluster write once the log gets
+	 * around to unpinning them.  We hold the cluster buffer lock, so don't
+	 * force the log here; ask the AIL to do it before its next push, as it
+	 * does for pinned items it finds itself.  The skipped inodes are then
+	 * likely to be unpinned when the AIL comes back to this cluster, and
+	 * the next flush can pick them all up in one go.
+	 */
+	if (nr_pinned) {
+		struct xfs_ail	*ailp = mp->m_ail;
+
+		spin_lock(&ailp->xa_lock);
+		ailp->xa_log_flush++;
+		spin_unlock(&ailp->xa_lock);
+	}
 out_put:
 	xfs_perag_put(pag);
 	return 0;
@@ -3498,7 +3824,9 @@ xfs_iflush_int(
 	if (S_ISREG(VFS_I(ip)->i_mode)) {
 		if (XFS_TEST_ERROR(
 		    (ip->i_d.di_format != XFS_DINODE_FMT_EXTENTS) &&
-		    (ip->i_d.di_format != XFS_DINODE_FMT_BTREE),
+		    (ip->i_d.di_format != XFS_DINODE_FMT_BTREE) &&
+		    (ip->i_d.di_format != XFS_DINODE_FMT_LOCAL ||
+		     !xfs_sb_version_hasinlinedata(&mp->m_sb)),
 		    mp, XFS_ERRTAG_IFLUSH_3)) {
 			xfs_alert_tag(mp, XFS_PTAG_IFLUSH,
 				"%s: Bad regular inode %Lu, ptr 0x%p",
@@ -31,9 +31,67 @@ struct xfs_defer_ops;
 struct xfs_bmbt_irec;
 struct xfs_inode_log_item;
 struct xfs_mount;
+struct xfs_perag;
 struct xfs_trans;
 struct xfs_dquot;
 
+struct xfs_shared_cache;
+struct xfs_unwritten_batch;
+struct xfs_dio_blocks;
+
+/*
+ * Data I/O state of a regular file.  Inodes that are only looked up or
+ * stat'ed never need any of this, so the I/O paths allocate it through
+ * xfs_inode_io_get() when they first touch it.  It is only freed along with
+ * the inode.
+ */
+struct xfs_inode_io {
+	struct xfs_inode	*iio_inode;
+
+	/* Completed ioends waiting for unwritten/CoW/size updates. */
+	spinlock_t		iio_ioend_lock;
+	struct work_struct	iio_ioend_work;
+	struct list_head	iio_ioend_list;
+
+	/* Ranges of buffered writes running under the shared iolock. */
+	wait_queue_head_t	iio_wrange_wait; /* lock also protects list */
+	struct list_head	iio_wranges;
+
+	/* Last written data fork mapping used for a direct overwrite. */
+	seqcount_t		iio_dio_mapseq;
+	unsigned int		iio_dio_map_fseq; /* i_df.if_seq at caching */
+	struct xfs_bmbt_irec	iio_dio_map;
+
+	/* Direct I/O unwritten extent conversions waiting to be batched. */
+	struct xfs_unwritten_batch *iio_unwritten_batch;
+	/* Block ranges of in-flight direct writes, once any was unaligned. */
+	struct xfs_dio_blocks	*iio_dio_blocks;
+	/* Recent all-shared or all-unshared ranges, under i_flags_lock. */
+	struct xfs_shared_cache	*iio_shared;
+
+	/* Indirect block reservation shared by all delalloc extents. */
+	xfs_filblks_t		iio_indlen_pool;
+	int			iio_indlen_levels; /* bmbt height reserved */
+
+	/* Adaptive CoW extent size hint. */
+	xfs_extlen_t		iio_cowextsz_auto;
+	xfs_fileoff_t		iio_cow_next;	/* end of last cow reservation */
+
+	/* Append history used to size speculative EOF preallocation. */
+	unsigned long		iio_append_stamp; /* jiffies of last sample */
+	unsigned long		iio_append_last; /* jiffies of last append */
+	xfs_fsize_t		iio_append_size; /* file size at last sample */
+	unsigned int		iio_append_rate; /* bytes/s, averaged */
+
+	/* Decaying I/O counters for the ioheat option, see xfs_heat.c. */
+	unsigned int		iio_heat_read;	/* pages read */
+	unsigned int		iio_heat_write;	/* pages written */
+	unsigned long		iio_heat_stamp;	/* jiffies of last decay */
+
+	/* jiffies when the timestamps were last left dirty on lazytime */
+	unsigned long		iio_lazytime_stamp;
+};
+
 typedef struct xfs_inode {
 	/* Inode linking and identification information. */
 	struct xfs_mount	*i_mount;	/* fs mount struct ptr */
@@ -68,10 +126,45 @@ typedef struct xfs_inode {
 	xfs_extnum_t		i_cnextents;	/* # of extents in cow fork */
 	unsigned int		i_cformat;	/* format of cow fork */
 
+	/* Data I/O state, NULL until the I/O paths first need it. */
+	struct xfs_inode_io	*i_io;
+
+	/* In-memory name hash index of a node format directory. */
+	struct xfs_dir2_index	*i_dir_index;
+	/* In-memory map of data block free space in a node directory. */
+	struct xfs_dir2_freemap	*i_dir_freemap;
+	/* Recently looked up small extended attributes. */
+	struct xfs_attr_cache	*i_attr_cache;
+
+	/*
+	 * An inode is on the per-AG background inactivation queue only until
+	 * xfs_inode_set_reclaim_tag puts it on the reclaim LRU, so the two
+	 * list entries can share their storage.
+	 */
+	union {
+		struct list_head i_inactive_list;
+		struct list_head i_reclaim_lru;	/* per-memcg reclaimable */
+	};
+
 	/* VFS inode */
 	struct inode		i_vnode;	/* embedded VFS inode */
 } xfs_inode_t;
 
+/*
+ * A file that has been appended to at a measurable rate within the last
+ * eofblocks scan interval keeps its post-EOF preallocation across close.
+ */
+static inline bool
+xfs_inode_append_steady(
+	struct xfs_inode	*ip)
+{
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
+
+	return io && READ_ONCE(io->iio_append_rate) &&
+	       time_before(jiffies, READ_ONCE(io->iio_append_last) +
+				    xfs_eofb_secs * HZ);
+}
+
 /* Convert from vfs inode to xfs inode */
 static inline struct xfs_inode *XFS_I(struct inode *inode)
 {
@@ -210,6 +303,13 @@ static inline bool xfs_is_reflink_inode(struct xfs_inode *ip)
 	return ip->i_d.di_flags2 & XFS_DIFLAG2_REFLINK;
 }
 
+/* Does this regular file keep its data in the inode literal area? */
+static inline bool xfs_is_inline_data_inode(struct xfs_inode *ip)
+{
+	return S_ISREG(VFS_I(ip)->i_mode) &&
+		ip->i_d.di_format == XFS_DINODE_FMT_LOCAL;
+}
+
 /*
  * In-core inode flags.
  */
@@ -232,6 +332,7 @@ static inline bool xfs_is_reflink_inode(struct xfs_inode *ip)
  * log recovery to replay a bmap operation on the inode.
  */
 #define XFS_IRECOVERY		(1 << 11)
+#define XFS_ILAZYTIME		(1 << 12)/* lazytime stamps not logged yet */
 
 /*
  * Per-lifetime flags need to be reset when re-using a reclaimable inode during
@@ -240,7 +341,7 @@ static inline bool xfs_is_reflink_inode(struct xfs_inode *ip)
  */
 #define XFS_IRECLAIM_RESET_FLAGS	\
 	(XFS_IRECLAIMABLE | XFS_IRECLAIM | \
-	 XFS_IDIRTY_RELEASE | XFS_ITRUNCATED)
+	 XFS_IDIRTY_RELEASE | XFS_ITRUNCATED | XFS_ILAZYTIME)
 
 /*
  * Synchronize processes attempting to flush the in-core inode back to disk.
@@ -425,11 +526,19 @@ int		xfs_iflush(struct xfs_inode *, struct xfs_buf **);
 void		xfs_lock_two_inodes(xfs_inode_t *, xfs_inode_t *, uint);
 
 xfs_extlen_t	xfs_get_extsz_hint(struct xfs_inode *ip);
+xfs_extlen_t	xfs_get_dax_align(struct xfs_inode *ip);
 xfs_extlen_t	xfs_get_cowextsz_hint(struct xfs_inode *ip);
 
 int		xfs_dir_ialloc(struct xfs_trans **, struct xfs_inode *, umode_t,
 			       xfs_nlink_t, xfs_dev_t, prid_t, int,
 			       struct xfs_inode **, int *);
+void		xfs_inode_prealloc_queue(struct xfs_mount *mp,
+					 xfs_agnumber_t agno);
+void		xfs_inode_prealloc_worker(struct work_struct *work);
+void		xfs_inode_prealloc_cancel(struct xfs_mount *mp);
+
+int		xfs_iunlink_init(struct xfs_perag *pag);
+void		xfs_iunlink_destroy(struct xfs_perag *pag);
 
 /* from xfs_file.c */
 enum xfs_prealloc_flags {
@@ -446,6 +555,9 @@ int	xfs_zero_eof(struct xfs_inode *ip, xfs_off_t offset,
 int	xfs_zero_range(struct xfs_inode *ip, xfs_off_t pos, xfs_off_t count,
 		bool *did_zero);
 
+/* from xfs_icache.c */
+struct xfs_inode_io *xfs_inode_io_get(struct xfs_inode *ip);
+
 /* from xfs_iops.c */
 extern void xfs_setup_inode(struct xfs_inode *ip);
 extern void xfs_setup_iops(struct xfs_inode *ip);
@@ -490,4 +602,8 @@ extern struct kmem_zone	*xfs_inode_zone;
 /* The default CoW extent size hint. */
 #define XFS_DEFAULT_COWEXTSZ_HINT 32
 
+/* Bounds of the automatically tuned CoW extent size hint. */
+#define XFS_MIN_AUTO_COWEXTSZ	1
+#define XFS_MAX_AUTO_COWEXTSZ	8192
+
 #endif	/* __XFS_INODE_H__ */
@@ -28,6 +28,7 @@
 #include "xfs_trace.h"
 #include "xfs_trans_priv.h"
 #include "xfs_log.h"
+#include "xfs_changelog.h"
 
 
 kmem_zone_t	*xfs_ili_zone;		/* inode log item zone */
@@ -117,6 +118,26 @@ xfs_inode_item_attr_fork_size(
 	}
 }
 
+/*
+ * A v3 inode whose core has only had timestamp or size updates since it was
+ * last written back can be logged with a compact core.  ili_fields includes
+ * everything logged since then, so any earlier full core is still holding
+ * the tail of the log and recovery has a complete base to apply this on.
+ */
+static inline bool
+xfs_inode_item_compact_core(
+	struct xfs_inode_log_item *iip)
+{
+	struct xfs_inode	*ip = iip->ili_inode;
+
+	if (ip->i_d.di_version < 3)
+		return false;
+	if (iip->ili_fields & ~(XFS_ILOG_TIMESTAMP | XFS_ILOG_ISIZE))
+		return false;
+	return xfs_sb_has_incompat_log_feature(&ip->i_mount->m_sb,
+					       XFS_SB_FEAT_INCOMPAT_LOG_ICORE);
+}
+
 /*
  * This returns the number of iovecs needed to log the given inode item.
  *
@@ -134,8 +155,12 @@ xfs_inode_item_size(
 	struct xfs_inode	*ip = iip->ili_inode;
 
 	*nvecs += 2;
-	*nbytes += sizeof(struct xfs_inode_log_format) +
-		   xfs_log_dinode_size(ip->i_d.di_version);
+	*nbytes += sizeof(struct xfs_inode_log_format);
+	if (xfs_inode_item_compact_core(iip)) {
+		*nbytes += sizeof(struct xfs_log_dinode_small);
+		return;
+	}
+	*nbytes += xfs_log_dinode_size(ip->i_d.di_version);
 
 	xfs_inode_item_data_fork_size(iip, nvecs, nbytes);
 	if (XFS_IFORK_Q(ip))
@@ -163,7 +188,7 @@ xfs_inode_item_format_data_fork(
 		    ip->i_df.if_bytes > 0) {
 			struct xfs_bmbt_rec *p;
 
-			ASSERT(ip->i_df.if_u1.if_extents != NULL);
+			ASSERT(ip->i_df.if_u1.if_root != NULL);
 			ASSERT(xfs_iext_count(&ip->i_df) > 0);
 
 			p = xlog_prepare_iovec(lv, vecp, XLOG_REG_TYPE_IEXT);
@@ -263,7 +288,7 @@ xfs_inode_item_format_attr_fork(
 
 			ASSERT(xfs_iext_count(ip->i_afp) ==
 				ip->i_d.di_anextents);
-			ASSERT(ip->i_afp->if_u1.if_extents != NULL);
+			ASSERT(ip->i_afp->if_u1.if_root != NULL);
 
 			p = xlog_prepare_iovec(lv, vecp, XLOG_REG_TYPE_IATTR_EXT);
 			data_bytes = xfs_iextents_copy(ip, p, XFS_ATTR_FORK);
@@ -397,6 +422,31 @@ xfs_inode_item_format_core(
 	xlog_finish_iovec(lv, *vecp, xfs_log_dinode_size(ip->i_d.di_version));
 }
 
+static void
+xfs_inode_item_format_compact_core(
+	struct xfs_inode	*ip,
+	struct xfs_log_vec	*lv,
+	struct xfs_log_iovec	**vecp)
+{
+	struct xfs_log_dinode_small *dic;
+	struct inode		*inode = VFS_I(ip);
+
+	dic = xlog_prepare_iovec(lv, vecp, XLOG_REG_TYPE_ICORE);
+	dic->di_magic = XFS_DINODE_MAGIC;
+	memset(dic->di_pad, 0, sizeof(dic->di_pad));
+	dic->di_atime.t_sec = inode->i_atime.tv_sec;
+	dic->di_atime.t_nsec = inode->i_atime.tv_nsec;
+	dic->di_mtime.t_sec = inode->i_mtime.tv_sec;
+	dic->di_mtime.t_nsec = inode->i_mtime.tv_nsec;
+	dic->di_ctime.t_sec = inode->i_ctime.tv_sec;
+	dic->di_ctime.t_nsec = inode->i_ctime.tv_nsec;
+	dic->di_size = ip->i_d.di_size;
+	dic->di_nblocks = ip->i_d.di_nblocks;
+	dic->di_changecount = inode->i_version;
+	dic->di_lsn = ip->i_itemp->ili_item.li_lsn;
+	xlog_finish_iovec(lv, *vecp, sizeof(struct xfs_log_dinode_small));
+}
+
 /*
  * This is called to fill in the vector of log iovecs for the given inode
  * log item.  It fills the first item with an inode log format structure,
@@ -422,8 +472,16 @@ xfs_inode_item_format(
 	ilf->ilf_blkno = ip->i_imap.im_blkno;
 	ilf->ilf_len = ip->i_imap.im_len;
 	ilf->ilf_boffset = ip->i_imap.im_boffset;
-	ilf->ilf_fields = XFS_ILOG_CORE;
 	ilf->ilf_size = 2; /* format + core */
+
+	if (xfs_inode_item_compact_core(iip)) {
+		ilf->ilf_fields = XFS_ILOG_CCORE;
+		xlog_finish_iovec(lv, vecp, sizeof(struct xfs_inode_log_format));
+		xfs_inode_item_format_compact_core(ip, lv, &vecp);
+		return;
+	}
+
+	ilf->ilf_fields = XFS_ILOG_CORE;
 	xlog_finish_iovec(lv, vecp, sizeof(struct xfs_inode_log_format));
 
 	xfs_inode_item_format_core(ip, lv, &vecp);
@@ -436,7 +494,8 @@ xfs_inode_item_format(
 	}
 
 	/* update the format with the exact fields we actually logged */
-	ilf->ilf_fields |= (iip->ili_fields & ~XFS_ILOG_TIMESTAMP);
+	ilf->ilf_fields |= (iip->ili_fields &
+			    ~(XFS_ILOG_TIMESTAMP | XFS_ILOG_ISIZE));
 }
 
 /*
@@ -592,6 +651,9 @@ xfs_inode_item_committed(
 	struct xfs_inode_log_item *iip = INODE_ITEM(lip);
 	struct xfs_inode	*ip = iip->ili_inode;
 
+	if (!(lip->li_flags & XFS_LI_ABORTED))
+		xfs_changelog_add(ip->i_mount, ip->i_ino, lsn);
+
 	if (xfs_iflags_test(ip, XFS_ISTALE)) {
 		xfs_inode_item_unpin(lip, 0);
 		return -1;
@@ -611,6 +673,27 @@ xfs_inode_item_committing(
 	INODE_ITEM(lip)->ili_last_lsn = lsn;
 }
 
+/*
+ * Called with the AIL lock held when the buffer the inode was flushed to has
+ * been written. We only want to pull the item from the AIL if it is actually
+ * there and its location in the log has not changed since we started the
+ * flush.  Thus, we only bother if the ili_logged flag is set and the inode's
+ * lsn has not changed.
+ *
+ * Stale inodes are being aborted rather than written back, so they always come
+ * off the AIL if they are on it.
+ */
+STATIC bool
+xfs_inode_item_written(
+	struct xfs_log_item	*lip)
+{
+	struct xfs_inode_log_item *iip = INODE_ITEM(lip);
+
+	if (lip->li_cb == xfs_istale_done)
+		return lip->li_flags & XFS_LI_IN_AIL;
+	return iip->ili_logged && lip->li_lsn == iip->ili_flush_lsn;
+}
+
 /*
  * This is the ops vector shared by all buf log items.
  */
@@ -622,7 +705,8 @@ static const struct xfs_item_ops xfs_inode_item_ops = {
 	.iop_unlock	= xfs_inode_item_unlock,
 	.iop_committed	= xfs_inode_item_committed,
 	.iop_push	= xfs_inode_item_push,
-	.iop_committing = xfs_inode_item_committing
+	.iop_committing = xfs_inode_item_committing,
+	.iop_written	= xfs_inode_item_written,
 };
 
 
@@ -659,114 +743,29 @@ xfs_inode_item_destroy(
 /*
  * This is the inode flushing I/O completion routine.  It is called
  * from interrupt level when the buffer containing the inode is
- * flushed to disk.  It is responsible for removing the inode item
- * from the AIL if it has not been re-logged, and unlocking the inode's
- * flush lock.
+ * flushed to disk.  It is responsible for unlocking the inode's flush
+ * lock.
  *
- * To reduce AIL lock traffic as much as possible, we scan the buffer log item
- * list for other inodes that will run this function. We remove them from the
- * buffer list so we can process all the inode IO completions in one AIL lock
- * traversal.
+ * The inode item has already been removed from the AIL by
+ * xfs_buf_do_callbacks() if it had not been re-logged since the flush, along
+ * with all the other items attached to the buffer, so we don't need to touch
+ * the AIL here.
  */
 void
 xfs_iflush_done(
 	struct xfs_buf		*bp,
 	struct xfs_log_item	*lip)
 {
-	struct xfs_inode_log_item *iip;
-	struct xfs_log_item	*blip;
-	struct xfs_log_item	*next;
-	struct xfs_log_item	*prev;
-	struct xfs_ail		*ailp = lip->li_ailp;
-	int			need_ail = 0;
-
-	/*
-	 * Scan the buffer IO completions for other inodes being completed and
-	 * attach them to the current inode log item.
-	 */
-	blip = bp->b_fspriv;
-	prev = NULL;
-	while (blip != NULL) {
-		if (blip->li_cb != xfs_iflush_done) {
-			prev = blip;
-			blip = blip->li_bio_list;
-			continue;
-		}
-
-		/* remove from list */
-		next = blip->li_bio_list;
-		if (!prev) {
-			bp->b_fspriv = next;
-		} else {
-			prev->li_bio_list = next;
-		}
-
-		/* add to current list */
-		blip->li_bio_list = lip->li_bio_list;
-		lip->li_bio_list = blip;
-
-		/*
-		 * while we have the item, do the unlocked check for needing
-		 * the AIL lock.
-		 */
-		iip = INODE_ITEM(blip);
-		if (iip->ili_logged && blip->li_lsn == iip->ili_flush_lsn)
-			need_ail++;
-
-		blip = next;
-	}
-
-	/* make sure we capture the state of the initial inode. */
-	iip = INODE_ITEM(lip);
-	if (iip->ili_logged && lip->li_lsn == iip->ili_flush_lsn)
-		need_ail++;
-
-	/*
-	 * We only want to pull the item from the AIL if it is
-	 * actually there and its location in the log has not
-	 * changed since we started the flush.  Thus, we only bother
-	 * if the ili_logged flag is set and the inode's lsn has not
-	 * changed.  First we check the lsn outside
-	 * the lock since it's cheaper, and then we recheck while
-	 * holding the lock before removing the inode from the AIL.
-	 */
-	if (need_ail) {
-		bool			mlip_changed = false;
-
-		/* this is an opencoded batch version of xfs_trans_ail_delete */
-		spin_lock(&ailp->xa_lock);
-		for (blip = lip; blip; blip = blip->li_bio_list) {
-			if (INODE_ITEM(blip)->ili_logged &&
-			    blip->li_lsn == INODE_ITEM(blip)->ili_flush_lsn)
-				mlip_changed |= xfs_ail_delete_one(ailp, blip);
-		}
-
-		if (mlip_changed) {
-			if (!XFS_FORCED_SHUTDOWN(ailp->xa_mount))
-				xlog_assign_tail_lsn_locked(ailp->xa_mount);
-			if (list_empty(&ailp->xa_ail))
-				wake_up_all(&ailp->xa_empty);
-		}
-		spin_unlock(&ailp->xa_lock);
-
-		if (mlip_changed)
-			xfs_log_space_wake(ailp->xa_mount);
-	}
+	struct xfs_inode_log_item *iip = INODE_ITEM(lip);
 
 	/*
 	 * clean up and unlock the flush lock now we are done. We can clear the
 	 * ili_last_fields bits now that we know that the data corresponding to
 	 * them is safely on disk.
 	 */
-	for (blip = lip; blip; blip = next) {
-		next = blip->li_bio_list;
-		blip->li_bio_list = NULL;
-
-		iip = INODE_ITEM(blip);
-		iip->ili_logged = 0;
-		iip->ili_last_fields = 0;
-		xfs_ifunlock(iip->ili_inode);
-	}
+	iip->ili_logged = 0;
+	iip->ili_last_fields = 0;
+	xfs_ifunlock(iip->ili_inode);
 }
 
 /*
@@ -28,6 +28,10 @@
 #include "xfs_rtalloc.h"
 #include "xfs_itable.h"
 #include "xfs_error.h"
+#include "xfs_da_format.h"
+#include "xfs_da_btree.h"
+#include "xfs_dir2.h"
+#include "xfs_dir2_priv.h"
 #include "xfs_attr.h"
 #include "xfs_bmap.h"
 #include "xfs_bmap_util.h"
@@ -45,15 +49,22 @@
 #include <linux/fsmap.h>
 #include "xfs_fsmap.h"
 #include "scrub/xfs_scrub.h"
+#include "xfs_reflink.h"
+#include "xfs_compact.h"
+#include "xfs_changelog.h"
+#include "xfs_heat.h"
+#include "xfs_rmtree.h"
 
 #include <linux/capability.h>
 #include <linux/cred.h>
 #include <linux/dcache.h>
 #include <linux/mount.h>
 #include <linux/namei.h>
+#include <linux/security.h>
 #include <linux/pagemap.h>
 #include <linux/slab.h>
 #include <linux/exportfs.h>
+#include <linux/sort.h>
 
 /*
  * xfs_find_handle maps from userspace xfs_fsop_handlereq structure to
@@ -151,6 +162,29 @@ xfs_handle_acceptable(
 	return 1;
 }
 
+/*
+ * Convert a handle that has already been copied in into a dentry.
+ */
+STATIC struct dentry *
+xfs_khandle_to_dentry(
+	struct file		*parfilp,
+	xfs_handle_t		*handle)
+{
+	struct xfs_fid64	fid;
+
+	if (handle->ha_fid.fid_len !=
+	    sizeof(handle->ha_fid) - sizeof(handle->ha_fid.fid_len))
+		return ERR_PTR(-EINVAL);
+
+	memset(&fid, 0, sizeof(struct fid));
+	fid.ino = handle->ha_fid.fid_ino;
+	fid.gen = handle->ha_fid.fid_gen;
+
+	return exportfs_decode_fh(parfilp->f_path.mnt, (struct fid *)&fid, 3,
+			FILEID_INO32_GEN | XFS_FILEID_TYPE_64FLAG,
+			xfs_handle_acceptable, NULL);
+}
+
 /*
  * Convert userspace handle data into a dentry.
  */
@@ -161,7 +195,6 @@ xfs_handle_to_dentry(
 	u32			hlen)
 {
 	xfs_handle_t		handle;
-	struct xfs_fid64	fid;
 
 	/*
 	 * Only allow handle opens under a directory.
@@ -173,17 +206,8 @@ xfs_handle_to_dentry(
 		return ERR_PTR(-EINVAL);
 	if (copy_from_user(&handle, uhandle, hlen))
 		return ERR_PTR(-EFAULT);
-	if (handle.ha_fid.fid_len !=
-	    sizeof(handle.ha_fid) - sizeof(handle.ha_fid.fid_len))
-		return ERR_PTR(-EINVAL);
-
-	memset(&fid, 0, sizeof(struct fid));
-	fid.ino = handle.ha_fid.fid_ino;
-	fid.gen = handle.ha_fid.fid_gen;
 
-	return exportfs_decode_fh(parfilp->f_path.mnt, (struct fid *)&fid, 3,
-			FILEID_INO32_GEN | XFS_FILEID_TYPE_64FLAG,
-			xfs_handle_acceptable, NULL);
+	return xfs_khandle_to_dentry(parfilp, &handle);
 }
 
 STATIC struct dentry *
@@ -194,29 +218,24 @@ xfs_handlereq_to_dentry(
 	return xfs_handle_to_dentry(parfilp, hreq->ihandle, hreq->ihandlen);
 }
 
-int
-xfs_open_by_handle(
+/*
+ * Open a file for a dentry looked up from a handle.  The dentry reference is
+ * consumed whether or not the open succeeds.
+ */
+STATIC struct file *
+xfs_handle_open_dentry(
 	struct file		*parfilp,
-	xfs_fsop_handlereq_t	*hreq)
+	struct dentry		*dentry,
+	int			oflags)
 {
 	const struct cred	*cred = current_cred();
 	int			error;
-	int			fd;
 	int			permflag;
 	struct file		*filp;
-	struct inode		*inode;
-	struct dentry		*dentry;
+	struct inode		*inode = d_inode(dentry);
 	fmode_t			fmode;
 	struct path		path;
 
-	if (!capable(CAP_SYS_ADMIN))
-		return -EPERM;
-
-	dentry = xfs_handlereq_to_dentry(parfilp, hreq);
-	if (IS_ERR(dentry))
-		return PTR_ERR(dentry);
-	inode = d_inode(dentry);
-
 	/* Restrict xfs_open_by_handle to directories & regular files. */
 	if (!(S_ISREG(inode->i_mode) || S_ISDIR(inode->i_mode))) {
 		error = -EPERM;
@@ -224,10 +243,10 @@ xfs_open_by_handle(
 	}
 
 #if BITS_PER_LONG != 32
-	hreq->oflags |= O_LARGEFILE;
+	oflags |= O_LARGEFILE;
 #endif
 
-	permflag = hreq->oflags;
+	permflag = oflags;
 	fmode = OPEN_FMODE(permflag);
 	if ((!(permflag & O_APPEND) || (permflag & O_TRUNC)) &&
 	    (fmode & FMODE_WRITE) && IS_APPEND(inode)) {
@@ -246,30 +265,317 @@ xfs_open_by_handle(
 		goto out_dput;
 	}
 
+	path.mnt = parfilp->f_path.mnt;
+	path.dentry = dentry;
+	filp = dentry_open(&path, oflags, cred);
+	dput(dentry);
+	if (IS_ERR(filp))
+		return filp;
+
+	if (S_ISREG(inode->i_mode)) {
+		filp->f_flags |= O_NOATIME;
+		filp->f_mode |= FMODE_NOCMTIME;
+	}
+	return filp;
+
+ out_dput:
+	dput(dentry);
+	return ERR_PTR(error);
+}
+
+int
+xfs_open_by_handle(
+	struct file		*parfilp,
+	xfs_fsop_handlereq_t	*hreq)
+{
+	struct dentry		*dentry;
+	struct file		*filp;
+	int			fd;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	dentry = xfs_handlereq_to_dentry(parfilp, hreq);
+	if (IS_ERR(dentry))
+		return PTR_ERR(dentry);
+
 	fd = get_unused_fd_flags(0);
 	if (fd < 0) {
-		error = fd;
-		goto out_dput;
+		dput(dentry);
+		return fd;
 	}
 
-	path.mnt = parfilp->f_path.mnt;
-	path.dentry = dentry;
-	filp = dentry_open(&path, hreq->oflags, cred);
-	dput(dentry);
+	filp = xfs_handle_open_dentry(parfilp, dentry, hreq->oflags);
 	if (IS_ERR(filp)) {
 		put_unused_fd(fd);
 		return PTR_ERR(filp);
 	}
 
-	if (S_ISREG(inode->i_mode)) {
-		filp->f_flags |= O_NOATIME;
-		filp->f_mode |= FMODE_NOCMTIME;
+	fd_install(fd, filp);
+	return fd;
+}
+
+struct xfs_handles_ent {
+	xfs_ino_t		ino;
+	unsigned int		idx;	/* slot in the handle vector */
+};
+
+static int
+xfs_handles_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct xfs_handles_ent *ea = a;
+	const struct xfs_handles_ent *eb = b;
+
+	if (ea->ino < eb->ino)
+		return -1;
+	return ea->ino > eb->ino;
+}
+
+/* Is this handle's inode number worth reading ahead? */
+static bool
+xfs_handles_ino_valid(
+	struct xfs_mount	*mp,
+	xfs_ino_t		ino)
+{
+	xfs_agnumber_t		agno = XFS_INO_TO_AGNO(mp, ino);
+	xfs_agino_t		agino = XFS_INO_TO_AGINO(mp, ino);
+
+	return ino != 0 && agno < mp->m_sb.sb_agcount &&
+	       XFS_AGINO_TO_AGBNO(mp, agino) < mp->m_sb.sb_agblocks &&
+	       ino == XFS_AGINO_TO_INO(mp, agno, agino);
+}
+
+static int
+xfs_handles_set_result(
+	struct xfs_handle_res	__user *res,
+	int			fd,
+	int			error)
+{
+	if (put_user(fd, &res->hr_fd) || put_user(-error, &res->hr_error))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Resolve one handle of an XFS_IOC_OPEN_BY_HANDLES vector.  Failures to
+ * resolve the handle are reported in its result; only a fault on the result
+ * itself is returned.
+ */
+STATIC int
+xfs_handles_resolve_one(
+	struct file		*parfilp,
+	struct xfs_handles_req	*hreq,
+	xfs_handle_t		*handle,
+	struct xfs_handle_res	__user *res)
+{
+	struct xfs_mount	*mp = XFS_I(file_inode(parfilp))->i_mount;
+	struct dentry		*dentry;
+	struct file		*filp;
+	int			stat;
+	int			fd;
+	int			error;
+
+	if (clear_user(res, sizeof(*res)))
+		return -EFAULT;
+
+	dentry = xfs_khandle_to_dentry(parfilp, handle);
+	if (IS_ERR(dentry))
+		return xfs_handles_set_result(res, -1, PTR_ERR(dentry));
+
+	if (hreq->flags & XFS_HANDLES_STAT) {
+		error = xfs_bulkstat_one_v2(mp, XFS_I(d_inode(dentry))->i_ino,
+				&res->hr_bstat, sizeof(res->hr_bstat), NULL,
+				&stat);
+		if (error) {
+			dput(dentry);
+			if (error == -EFAULT)
+				return error;
+			return xfs_handles_set_result(res, -1, error);
+		}
+	}
+
+	if (!(hreq->flags & XFS_HANDLES_OPEN)) {
+		dput(dentry);
+		return xfs_handles_set_result(res, -1, 0);
+	}
+
+	fd = get_unused_fd_flags(0);
+	if (fd < 0) {
+		dput(dentry);
+		return xfs_handles_set_result(res, -1, fd);
+	}
+
+	filp = xfs_handle_open_dentry(parfilp, dentry, hreq->oflags);
+	if (IS_ERR(filp)) {
+		put_unused_fd(fd);
+		return xfs_handles_set_result(res, -1, PTR_ERR(filp));
 	}
 
+	/* Don't publish the fd until userspace has been told about it. */
+	error = xfs_handles_set_result(res, fd, 0);
+	if (error) {
+		fput(filp);
+		put_unused_fd(fd);
+		return error;
+	}
 	fd_install(fd, filp);
-	return fd;
+	return 0;
+}
 
- out_dput:
+/*
+ * Resolve a vector of handles in one call.  The handles are sorted by inode
+ * number and their clusters read ahead before any of them are looked up, so
+ * that handles from bulkstat output cost one cluster read per cluster rather
+ * than one synchronous read per handle.  If the call faults part way through,
+ * descriptors already opened for earlier handles stay open.
+ */
+STATIC int
+xfs_ioc_open_by_handles(
+	struct file		*parfilp,
+	void			__user *arg)
+{
+	struct xfs_mount	*mp = XFS_I(file_inode(parfilp))->i_mount;
+	struct xfs_handles_req	hreq;
+	struct xfs_handle_res	__user *ures;
+	struct xfs_handles_ent	*ents;
+	xfs_handle_t		*handles;
+	xfs_daddr_t		last_blkno = 0;
+	struct xfs_buf_ra_batch	rab;
+	int			i;
+	int			error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (!S_ISDIR(file_inode(parfilp)->i_mode))
+		return -ENOTDIR;
+	if (XFS_FORCED_SHUTDOWN(mp))
+		return -EIO;
+
+	if (copy_from_user(&hreq, arg, sizeof(hreq)))
+		return -EFAULT;
+
+	if (!hreq.flags || (hreq.flags & ~XFS_HANDLES_FLAGS))
+		return -EINVAL;
+	if (hreq.pad || memchr_inv(hreq.reserved, 0, sizeof(hreq.reserved)))
+		return -EINVAL;
+	if (hreq.count == 0 || hreq.count > XFS_HANDLES_MAX)
+		return -EINVAL;
+
+	handles = kmem_alloc_large(hreq.count * sizeof(*handles),
+			KM_SLEEP | KM_MAYFAIL);
+	if (!handles)
+		return -ENOMEM;
+	ents = kmem_alloc_large(hreq.count * sizeof(*ents),
+			KM_SLEEP | KM_MAYFAIL);
+	if (!ents) {
+		error = -ENOMEM;
+		goto out_free_handles;
+	}
+
+	error = -EFAULT;
+	if (copy_from_user(handles, u64_to_user_ptr(hreq.handles),
+			hreq.count * sizeof(*handles)))
+		goto out_free_ents;
+	ures = u64_to_user_ptr(hreq.results);
+
+	for (i = 0; i < hreq.count; i++) {
+		ents[i].ino = handles[i].ha_fid.fid_ino;
+		ents[i].idx = i;
+	}
+	sort(ents, hreq.count, sizeof(*ents), xfs_handles_cmp, NULL);
+	xfs_buf_ra_batch_start(&rab);
+	for (i = 0; i < hreq.count; i++) {
+		if (xfs_handles_ino_valid(mp, ents[i].ino))
+			xfs_dir2_inode_readahead(mp, ents[i].ino, &last_blkno,
+						 &rab);
+	}
+	xfs_buf_ra_batch_finish(&rab);
+
+	for (i = 0; i < hreq.count; i++) {
+		error = xfs_handles_resolve_one(parfilp, &hreq,
+				&handles[ents[i].idx], &ures[ents[i].idx]);
+		if (error)
+			break;
+		cond_resched();
+	}
+
+out_free_ents:
+	kmem_free(ents);
+out_free_handles:
+	kmem_free(handles);
+	return error;
+}
+
+/*
+ * Find a path to the inode named by a handle.  Directory dentries are
+ * reconnected to the root through their '..' entries as the handle is
+ * decoded; for anything else we can only use a name the dcache already
+ * has, since there's no way to find a file's parent short of crawling the
+ * namespace.
+ */
+STATIC int
+xfs_ioc_handle_to_path(
+	struct file		*parfilp,
+	void			__user *arg)
+{
+	struct xfs_handle_path_req req;
+	struct dentry		*dentry;
+	struct dentry		*alias;
+	char			*buf;
+	char			*path;
+	u32			len;
+	int			error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (copy_from_user(&req, arg, sizeof(req)))
+		return -EFAULT;
+	if (req.pad || memchr_inv(req.reserved, 0, sizeof(req.reserved)))
+		return -EINVAL;
+
+	dentry = xfs_handle_to_dentry(parfilp, u64_to_user_ptr(req.handle),
+			sizeof(xfs_handle_t));
+	if (IS_ERR(dentry))
+		return PTR_ERR(dentry);
+
+	/* Swap a disconnected file dentry for a connected alias. */
+	if (dentry->d_flags & DCACHE_DISCONNECTED) {
+		alias = d_find_alias(d_inode(dentry));
+		dput(dentry);
+		dentry = alias;
+	}
+	if (!dentry || (dentry->d_flags & DCACHE_DISCONNECTED) ||
+	    d_unlinked(dentry)) {
+		error = -ENOENT;
+		goto out_dput;
+	}
+
+	buf = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!buf) {
+		error = -ENOMEM;
+		goto out_dput;
+	}
+	path = dentry_path_raw(dentry, buf, PATH_MAX);
+	if (IS_ERR(path)) {
+		error = PTR_ERR(path);
+		goto out_buf;
+	}
+
+	len = strlen(path) + 1;
+	if (len > req.buflen)
+		error = -ERANGE;
+	else if (copy_to_user(u64_to_user_ptr(req.buf), path, len))
+		error = -EFAULT;
+	else
+		error = 0;
+	req.buflen = len;
+	if (error != -EFAULT && copy_to_user(arg, &req, sizeof(req)))
+		error = -EFAULT;
+out_buf:
+	kfree(buf);
+out_dput:
 	dput(dentry);
 	return error;
 }
@@ -439,76 +745,133 @@ xfs_attrlist_by_handle(
 	return error;
 }
 
-int
-xfs_attrmulti_attr_get(
+/*
+ * Run one run of consecutive attribute lookups from an attrmulti request.
+ */
+STATIC void
+xfs_attrmulti_get_run(
 	struct inode		*inode,
-	unsigned char		*name,
-	unsigned char		__user *ubuf,
-	uint32_t		*len,
-	uint32_t		flags)
+	struct xfs_attr_op	*ops,
+	void			__user **uvalues,
+	int			nops)
 {
-	unsigned char		*kbuf;
-	int			error = -EFAULT;
-
-	if (*len > XFS_XATTR_SIZE_MAX)
-		return -EINVAL;
-	kbuf = kmem_zalloc_large(*len, KM_SLEEP);
-	if (!kbuf)
-		return -ENOMEM;
-
-	error = xfs_attr_get(XFS_I(inode), name, kbuf, (int *)len, flags);
-	if (error)
-		goto out_kfree;
+	int			error;
+	int			i;
+
+	for (i = 0; i < nops; i++) {
+		ops[i].xo_value = NULL;
+		if (ops[i].xo_error)
+			continue;
+		if (ops[i].xo_valuelen < 0 ||
+		    ops[i].xo_valuelen > XFS_XATTR_SIZE_MAX) {
+			ops[i].xo_error = -EINVAL;
+			continue;
+		}
+		ops[i].xo_value = kmem_zalloc_large(ops[i].xo_valuelen,
+				KM_SLEEP);
+		if (!ops[i].xo_value)
+			ops[i].xo_error = -ENOMEM;
+	}
 
-	if (copy_to_user(ubuf, kbuf, *len))
-		error = -EFAULT;
+	error = xfs_attr_get_multi(XFS_I(inode), ops, nops);
 
-out_kfree:
-	kmem_free(kbuf);
-	return error;
+	for (i = 0; i < nops; i++) {
+		if (error && !ops[i].xo_error)
+			ops[i].xo_error = error;
+		if (!ops[i].xo_error &&
+		    copy_to_user(uvalues[i], ops[i].xo_value,
+				 ops[i].xo_valuelen))
+			ops[i].xo_error = -EFAULT;
+		kmem_free(ops[i].xo_value);
+	}
 }
 
-int
-xfs_attrmulti_attr_set(
+/*
+ * Run one run of consecutive attribute sets and removes from an attrmulti
+ * request as a single transaction chain.
+ */
+STATIC void
+xfs_attrmulti_set_run(
+	struct file		*parfilp,
 	struct inode		*inode,
-	unsigned char		*name,
-	const unsigned char	__user *ubuf,
-	uint32_t		len,
-	uint32_t		flags)
+	struct xfs_attr_op	*ops,
+	void			__user **uvalues,
+	int			nops)
 {
-	unsigned char		*kbuf;
-	int			error;
+	int			error = 0;
+	int			i;
 
 	if (IS_IMMUTABLE(inode) || IS_APPEND(inode))
-		return -EPERM;
-	if (len > XFS_XATTR_SIZE_MAX)
-		return -EINVAL;
+		error = -EPERM;
 
-	kbuf = memdup_user(ubuf, len);
-	if (IS_ERR(kbuf))
-		return PTR_ERR(kbuf);
+	for (i = 0; i < nops; i++) {
+		ops[i].xo_value = NULL;
+		if (ops[i].xo_error)
+			continue;
+		if (error) {
+			ops[i].xo_error = error;
+			continue;
+		}
+		if (ops[i].xo_opcode != ATTR_OP_SET)
+			continue;
+		if (ops[i].xo_valuelen < 0 ||
+		    ops[i].xo_valuelen > XFS_XATTR_SIZE_MAX) {
+			ops[i].xo_error = -EINVAL;
+			continue;
+		}
+		ops[i].xo_value = memdup_user(uvalues[i], ops[i].xo_valuelen);
+		if (IS_ERR(ops[i].xo_value)) {
+			ops[i].xo_error = PTR_ERR(ops[i].xo_value);
+			ops[i].xo_value = NULL;
+		}
+	}
+	if (error)
+		return;
 
-	error = xfs_attr_set(XFS_I(inode), name, kbuf, len, flags);
-	if (!error)
-		xfs_forget_acl(inode, name, flags);
-	kfree(kbuf);
-	return error;
+	error = mnt_want_write_file(parfilp);
+	if (!error) {
+		error = xfs_attr_set_multi(XFS_I(inode), ops, nops);
+		mnt_drop_write_file(parfilp);
+	}
+
+	for (i = 0; i < nops; i++) {
+		if (error && !ops[i].xo_error)
+			ops[i].xo_error = error;
+		if (!ops[i].xo_error)
+			xfs_forget_acl(inode, ops[i].xo_name, ops[i].xo_flags);
+		kfree(ops[i].xo_value);
+	}
 }
 
-int
-xfs_attrmulti_attr_remove(
+/*
+ * Apply a chunk of attrmulti operations in order.  Consecutive lookups share
+ * one hold of the ILOCK and consecutive sets and removes share one
+ * transaction chain.  Operations with xo_error already set are skipped.
+ */
+void
+xfs_attrmulti_batch(
+	struct file		*parfilp,
 	struct inode		*inode,
-	unsigned char		*name,
-	uint32_t		flags)
+	struct xfs_attr_op	*ops,
+	void			__user **uvalues,
+	int			nops)
 {
-	int			error;
+	bool			get;
+	int			i, n;
 
-	if (IS_IMMUTABLE(inode) || IS_APPEND(inode))
-		return -EPERM;
-	error = xfs_attr_remove(XFS_I(inode), name, flags);
-	if (!error)
-		xfs_forget_acl(inode, name, flags);
-	return error;
+	for (i = 0; i < nops; i += n) {
+		get = ops[i].xo_opcode == ATTR_OP_GET;
+		for (n = 1; i + n < nops; n++) {
+			if ((ops[i + n].xo_opcode == ATTR_OP_GET) != get)
+				break;
+		}
+
+		if (get)
+			xfs_attrmulti_get_run(inode, &ops[i], &uvalues[i], n);
+		else
+			xfs_attrmulti_set_run(parfilp, inode, &ops[i],
+					&uvalues[i], n);
+	}
 }
 
 STATIC int
@@ -519,9 +882,13 @@ xfs_attrmulti_by_handle(
 	int			error;
 	xfs_attr_multiop_t	*ops;
 	xfs_fsop_attrmulti_handlereq_t am_hreq;
+	struct xfs_attr_op	*xops = NULL;
+	void			__user **uvalues = NULL;
 	struct dentry		*dentry;
-	unsigned int		i, size;
+	unsigned int		i, j, k, n, size;
 	unsigned char		*attr_name;
+	unsigned char		*name;
+	long			len;
 
 	if (!capable(CAP_SYS_ADMIN))
 		return -EPERM;
@@ -548,53 +915,58 @@ xfs_attrmulti_by_handle(
 	}
 
 	error = -ENOMEM;
-	attr_name = kmalloc(MAXNAMELEN, GFP_KERNEL);
-	if (!attr_name)
-		goto out_kfree_ops;
+	attr_name = kmalloc(XFS_ATTRMULTI_BATCH * MAXNAMELEN, GFP_KERNEL);
+	xops = kmalloc(XFS_ATTRMULTI_BATCH * sizeof(*xops), GFP_KERNEL);
+	uvalues = kmalloc(XFS_ATTRMULTI_BATCH * sizeof(*uvalues), GFP_KERNEL);
+	if (!attr_name || !xops || !uvalues)
+		goto out_kfree_names;
 
 	error = 0;
-	for (i = 0; i < am_hreq.opcount; i++) {
-		ops[i].am_error = strncpy_from_user((char *)attr_name,
-				ops[i].am_attrname, MAXNAMELEN);
-		if (ops[i].am_error == 0 || ops[i].am_error == MAXNAMELEN)
-			error = -ERANGE;
-		if (ops[i].am_error < 0)
-			break;
-
-		switch (ops[i].am_opcode) {
-		case ATTR_OP_GET:
-			ops[i].am_error = xfs_attrmulti_attr_get(
-					d_inode(dentry), attr_name,
-					ops[i].am_attrvalue, &ops[i].am_length,
-					ops[i].am_flags);
-			break;
-		case ATTR_OP_SET:
-			ops[i].am_error = mnt_want_write_file(parfilp);
-			if (ops[i].am_error)
-				break;
-			ops[i].am_error = xfs_attrmulti_attr_set(
-					d_inode(dentry), attr_name,
-					ops[i].am_attrvalue, ops[i].am_length,
-					ops[i].am_flags);
-			mnt_drop_write_file(parfilp);
-			break;
-		case ATTR_OP_REMOVE:
-			ops[i].am_error = mnt_want_write_file(parfilp);
-			if (ops[i].am_error)
+	for (i = 0; i < am_hreq.opcount; i += n) {
+		n = min_t(unsigned int, am_hreq.opcount - i,
+			  XFS_ATTRMULTI_BATCH);
+		for (j = 0; j < n; j++) {
+			name = attr_name + j * MAXNAMELEN;
+			len = strncpy_from_user((char *)name,
+					ops[i + j].am_attrname, MAXNAMELEN);
+			if (len < 0) {
+				ops[i + j].am_error = len;
 				break;
-			ops[i].am_error = xfs_attrmulti_attr_remove(
-					d_inode(dentry), attr_name,
-					ops[i].am_flags);
-			mnt_drop_write_file(parfilp);
-			break;
-		default:
-			ops[i].am_error = -EINVAL;
+			}
+
+			xops[j].xo_name = name;
+			xops[j].xo_valuelen = ops[i + j].am_length;
+			xops[j].xo_flags = ops[i + j].am_flags;
+			xops[j].xo_opcode = ops[i + j].am_opcode;
+			xops[j].xo_error = 0;
+			uvalues[j] = ops[i + j].am_attrvalue;
+
+			if (len == 0 || len == MAXNAMELEN) {
+				error = -ERANGE;
+				xops[j].xo_error = -ERANGE;
+			} else if (xops[j].xo_opcode != ATTR_OP_GET &&
+				   xops[j].xo_opcode != ATTR_OP_SET &&
+				   xops[j].xo_opcode != ATTR_OP_REMOVE) {
+				xops[j].xo_error = -EINVAL;
+			}
+		}
+
+		xfs_attrmulti_batch(parfilp, d_inode(dentry), xops, uvalues, j);
+		for (k = 0; k < j; k++) {
+			ops[i + k].am_error = xops[k].xo_error;
+			if (xops[k].xo_opcode == ATTR_OP_GET)
+				ops[i + k].am_length = xops[k].xo_valuelen;
 		}
+		if (j < n)
+			break;
 	}
 
 	if (copy_to_user(am_hreq.ops, ops, size))
 		error = -EFAULT;
 
+ out_kfree_names:
+	kfree(uvalues);
+	kfree(xops);
 	kfree(attr_name);
  out_kfree_ops:
 	kfree(ops);
@@ -642,6 +1014,7 @@ xfs_ioc_space(
 	if (error)
 		return error;
 
+	xfs_recall_layouts(inode);
 	xfs_ilock(ip, iolock);
 	error = xfs_break_layouts(inode, &iolock);
 	if (error)
@@ -721,84 +1094,554 @@ xfs_ioc_space(
 				goto out_unlock;
 		}
 
-		iattr.ia_valid = ATTR_SIZE;
-		iattr.ia_size = bf->l_start;
+		iattr.ia_valid = ATTR_SIZE;
+		iattr.ia_size = bf->l_start;
+
+		error = xfs_vn_setattr_size(file_dentry(filp), &iattr);
+		break;
+	default:
+		ASSERT(0);
+		error = -EINVAL;
+	}
+
+	if (error)
+		goto out_unlock;
+
+	error = xfs_update_prealloc_flags(ip, flags);
+
+out_unlock:
+	xfs_iunlock(ip, iolock);
+	mnt_drop_write_file(filp);
+	return error;
+}
+
+STATIC int
+xfs_ioc_bulkstat(
+	xfs_mount_t		*mp,
+	unsigned int		cmd,
+	void			__user *arg)
+{
+	xfs_fsop_bulkreq_t	bulkreq;
+	int			count;	/* # of records returned */
+	xfs_ino_t		inlast;	/* last inode number */
+	int			done;
+	int			error;
+
+	/* done = 1 if there are more stats to get and if bulkstat */
+	/* should be called again (unused here, but used in dmapi) */
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (XFS_FORCED_SHUTDOWN(mp))
+		return -EIO;
+
+	if (copy_from_user(&bulkreq, arg, sizeof(xfs_fsop_bulkreq_t)))
+		return -EFAULT;
+
+	if (copy_from_user(&inlast, bulkreq.lastip, sizeof(__s64)))
+		return -EFAULT;
+
+	if ((count = bulkreq.icount) <= 0)
+		return -EINVAL;
+
+	if (bulkreq.ubuffer == NULL)
+		return -EINVAL;
+
+	if (cmd == XFS_IOC_FSINUMBERS)
+		error = xfs_inumbers(mp, &inlast, &count,
+					bulkreq.ubuffer, xfs_inumbers_fmt);
+	else if (cmd == XFS_IOC_FSBULKSTAT_SINGLE)
+		error = xfs_bulkstat_one(mp, inlast, bulkreq.ubuffer,
+					sizeof(xfs_bstat_t), NULL, &done);
+	else	/* XFS_IOC_FSBULKSTAT */
+		error = xfs_bulkstat(mp, &inlast, &count, xfs_bulkstat_one,
+				     sizeof(xfs_bstat_t), bulkreq.ubuffer,
+				     &done);
+
+	if (error)
+		return error;
+
+	if (bulkreq.ocount != NULL) {
+		if (copy_to_user(bulkreq.lastip, &inlast,
+						sizeof(xfs_ino_t)))
+			return -EFAULT;
+
+		if (copy_to_user(bulkreq.ocount, &count, sizeof(count)))
+			return -EFAULT;
+	}
+
+	return 0;
+}
+
+STATIC int
+xfs_ioc_ag_bulkstat(
+	struct xfs_mount	*mp,
+	void			__user *arg)
+{
+	struct xfs_ag_bulkreq	breq;
+	xfs_agino_t		agino;
+	xfs_agino_t		end_agino = NULLAGINO;
+	int			ra_chunks = XFS_BULKSTAT_RA_CHUNKS;
+	int			count;
+	int			done;
+	int			error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (XFS_FORCED_SHUTDOWN(mp))
+		return -EIO;
+
+	if (copy_from_user(&breq, arg, sizeof(breq)))
+		return -EFAULT;
+
+	if (breq.flags & ~XFS_AG_BULKREQ_DONE)
+		return -EINVAL;
+	if (memchr_inv(breq.reserved, 0, sizeof(breq.reserved)))
+		return -EINVAL;
+	if (breq.agno >= mp->m_sb.sb_agcount)
+		return -EINVAL;
+	if (breq.icount == 0 ||
+	    breq.icount > INT_MAX / sizeof(struct xfs_bstat_v2))
+		return -EINVAL;
+	if (!breq.ubuffer)
+		return -EINVAL;
+
+	/* The cursor must be a valid inode number in the requested AG. */
+	agino = XFS_INO_TO_AGINO(mp, breq.ino);
+	if (breq.ino &&
+	    (XFS_INO_TO_AGNO(mp, breq.ino) != breq.agno ||
+	     breq.ino != XFS_AGINO_TO_INO(mp, breq.agno, agino)))
+		return -EINVAL;
+
+	/* An end past this AG just means the end of the AG. */
+	if (breq.end_ino &&
+	    XFS_INO_TO_AGNO(mp, breq.end_ino) <= breq.agno) {
+		if (XFS_INO_TO_AGNO(mp, breq.end_ino) < breq.agno)
+			return -EINVAL;
+		end_agino = XFS_INO_TO_AGINO(mp, breq.end_ino);
+	}
+
+	if (breq.ra_chunks)
+		ra_chunks = min_t(__u32, breq.ra_chunks,
+				  XFS_BULKSTAT_RA_CHUNKS_MAX);
+
+	count = breq.icount;
+	error = xfs_bulkstat_ag(mp, breq.agno, &agino, end_agino, ra_chunks,
+				xfs_bulkstat_one_v2, sizeof(struct xfs_bstat_v2),
+				u64_to_user_ptr(breq.ubuffer), &count, &done);
+	if (error)
+		return error;
+
+	breq.ino = XFS_AGINO_TO_INO(mp, breq.agno, agino);
+	breq.icount = count;
+	breq.flags = done ? XFS_AG_BULKREQ_DONE : 0;
+	if (copy_to_user(arg, &breq, sizeof(breq)))
+		return -EFAULT;
+	return 0;
+}
+
+STATIC int
+xfs_ioc_readdirstat(
+	struct file		*filp,
+	void			__user *arg)
+{
+	struct inode		*inode = file_inode(filp);
+	struct xfs_inode	*ip = XFS_I(inode);
+	struct xfs_readdirstat_req rreq;
+	loff_t			pos;
+	int			count;
+	int			done;
+	int			error;
+
+	if (!S_ISDIR(inode->i_mode))
+		return -ENOTDIR;
+	if (!(filp->f_mode & FMODE_READ))
+		return -EBADF;
+
+	if (XFS_FORCED_SHUTDOWN(ip->i_mount))
+		return -EIO;
+
+	/* Looking up the entries needs search permission, as for stat. */
+	error = inode_permission(inode, MAY_EXEC);
+	if (error)
+		return error;
+
+	if (copy_from_user(&rreq, arg, sizeof(rreq)))
+		return -EFAULT;
+
+	if (rreq.flags & ~XFS_READDIRSTAT_DONE)
+		return -EINVAL;
+	if (memchr_inv(rreq.reserved, 0, sizeof(rreq.reserved)))
+		return -EINVAL;
+	if (rreq.icount == 0 || !rreq.ubuffer)
+		return -EINVAL;
+	if (rreq.pos > LLONG_MAX)
+		return -EINVAL;
+
+	pos = rreq.pos;
+	count = min_t(__u32, rreq.icount, XFS_READDIRSTAT_MAX);
+	error = xfs_readdirstat(ip, &pos, u64_to_user_ptr(rreq.ubuffer),
+				&count, &done);
+	if (error)
+		return error;
+
+	rreq.pos = pos;
+	rreq.icount = count;
+	rreq.flags = done ? XFS_READDIRSTAT_DONE : 0;
+	if (copy_to_user(arg, &rreq, sizeof(rreq)))
+		return -EFAULT;
+	return 0;
+}
+
+STATIC int
+xfs_ioc_rmtree(
+	struct file		*filp,
+	void			__user *arg)
+{
+	struct inode		*inode = file_inode(filp);
+	struct xfs_rmtree_req	rreq;
+	__u64			removed = 0;
+	int			error;
+
+	if (!S_ISDIR(inode->i_mode))
+		return -ENOTDIR;
+	if (!(filp->f_mode & FMODE_READ))
+		return -EBADF;
+
+	if (XFS_FORCED_SHUTDOWN(XFS_I(inode)->i_mount))
+		return -EIO;
+
+	if (copy_from_user(&rreq, arg, sizeof(rreq)))
+		return -EFAULT;
+
+	if (rreq.flags || rreq.pad)
+		return -EINVAL;
+	if (memchr_inv(rreq.reserved, 0, sizeof(rreq.reserved)))
+		return -EINVAL;
+
+	error = mnt_want_write_file(filp);
+	if (error)
+		return error;
+	error = xfs_rmtree(filp->f_path.dentry, &removed);
+	mnt_drop_write_file(filp);
+
+	rreq.removed = removed;
+	if (copy_to_user(arg, &rreq, sizeof(rreq)))
+		return -EFAULT;
+	return error;
+}
+
+/*
+ * Create one name in a directory locked by the caller.  This is what
+ * open(O_CREAT|O_EXCL) and mkdir do once they have looked up the parent.
+ */
+STATIC int
+xfs_create_batch_one(
+	const struct path	*path,
+	const char		*name,
+	umode_t			mode,
+	xfs_ino_t		*ino)
+{
+	struct inode		*dir = d_inode(path->dentry);
+	struct dentry		*dentry;
+	int			error;
+
+	dentry = lookup_one_len(name, path->dentry, strlen(name));
+	if (IS_ERR(dentry))
+		return PTR_ERR(dentry);
+
+	if (d_really_is_positive(dentry)) {
+		error = -EEXIST;
+	} else if (S_ISDIR(mode)) {
+		error = security_path_mkdir(path, dentry, mode);
+		if (!error)
+			error = vfs_mkdir(dir, dentry, mode);
+	} else {
+		error = security_path_mknod(path, dentry, mode, 0);
+		if (!error)
+			error = vfs_create(dir, dentry, mode, true);
+	}
+	if (!error)
+		*ino = d_inode(dentry)->i_ino;
+	dput(dentry);
+	return error;
+}
+
+/*
+ * Create a batch of names under one hold of the directory lock, skipping the
+ * path walk and file setup of a syscall per file.  Consecutive creates in a
+ * directory allocate inodes from the same chunk near the parent, so a batch
+ * normally ends up in a contiguous run of inodes.
+ */
+STATIC int
+xfs_ioc_create_batch(
+	struct file		*filp,
+	void			__user *arg)
+{
+	struct inode		*dir = file_inode(filp);
+	struct xfs_create_batch_req creq;
+	struct xfs_create_ent	__user *uents;
+	struct xfs_create_ent	*ents;
+	struct xfs_create_ent	*ce;
+	xfs_ino_t		ino;
+	char			*names;
+	char			*name;
+	umode_t			mode;
+	__u32			count;
+	__u32			done;
+	__u32			n;
+	__u32			i;
+	long			len;
+	int			error;
+
+	if (!S_ISDIR(dir->i_mode))
+		return -ENOTDIR;
+
+	if (XFS_FORCED_SHUTDOWN(XFS_I(dir)->i_mount))
+		return -EIO;
+
+	if (copy_from_user(&creq, arg, sizeof(creq)))
+		return -EFAULT;
+
+	if (creq.flags)
+		return -EINVAL;
+	if (memchr_inv(creq.reserved, 0, sizeof(creq.reserved)))
+		return -EINVAL;
+	if (creq.count == 0 || !creq.ubuffer)
+		return -EINVAL;
+
+	uents = u64_to_user_ptr(creq.ubuffer);
+	count = min_t(__u32, creq.count, XFS_CREATE_BATCH_MAX);
+
+	ents = kmem_alloc(XFS_CREATE_BATCH * sizeof(*ents), KM_SLEEP);
+	names = kmem_alloc_large(XFS_CREATE_BATCH * MAXNAMELEN,
+			KM_SLEEP | KM_MAYFAIL);
+	if (!names) {
+		error = -ENOMEM;
+		goto out_free;
+	}
+
+	error = mnt_want_write_file(filp);
+	if (error)
+		goto out_free;
+
+	for (done = 0; done < count; done += n) {
+		if (fatal_signal_pending(current))
+			break;
+
+		n = min_t(__u32, count - done, XFS_CREATE_BATCH);
+		if (copy_from_user(ents, &uents[done], n * sizeof(*ents))) {
+			error = -EFAULT;
+			break;
+		}
+
+		/* Pull in the names before taking the directory lock. */
+		for (i = 0; i < n; i++) {
+			ce = &ents[i];
+			name = names + i * MAXNAMELEN;
+			ce->ce_ino = 0;
+			ce->ce_error = 0;
+			len = strncpy_from_user(name,
+					u64_to_user_ptr(ce->ce_name),
+					MAXNAMELEN);
+			if (len < 0) {
+				error = len;
+				goto out_drop;
+			}
+			if (len == 0)
+				ce->ce_error = ENOENT;
+			else if (len == MAXNAMELEN)
+				ce->ce_error = ENAMETOOLONG;
+			else if ((ce->ce_mode & ~(S_IFMT | S_IALLUGO)) ||
+				 (!S_ISREG(ce->ce_mode) &&
+				  !S_ISDIR(ce->ce_mode)))
+				ce->ce_error = EINVAL;
+		}
+
+		inode_lock_nested(dir, I_MUTEX_PARENT);
+		for (i = 0; i < n; i++) {
+			ce = &ents[i];
+			if (ce->ce_error)
+				continue;
+			if (IS_DEADDIR(dir)) {
+				ce->ce_error = ENOENT;
+				continue;
+			}
+
+			mode = ce->ce_mode;
+			if (!IS_POSIXACL(dir))
+				mode &= ~current_umask();
+			error = xfs_create_batch_one(&filp->f_path,
+					names + i * MAXNAMELEN, mode, &ino);
+			if (error)
+				ce->ce_error = -error;
+			else
+				ce->ce_ino = ino;
+		}
+		inode_unlock(dir);
+		error = 0;
 
-		error = xfs_vn_setattr_size(file_dentry(filp), &iattr);
-		break;
-	default:
-		ASSERT(0);
-		error = -EINVAL;
+		if (copy_to_user(&uents[done], ents, n * sizeof(*ents))) {
+			error = -EFAULT;
+			break;
+		}
+		cond_resched();
 	}
 
+	creq.count = done;
+	if (!error && copy_to_user(arg, &creq, sizeof(creq)))
+		error = -EFAULT;
+out_drop:
+	mnt_drop_write_file(filp);
+out_free:
+	kmem_free(names);
+	kmem_free(ents);
+	return error;
+}
+
+STATIC int
+xfs_ioc_get_changes(
+	struct xfs_mount	*mp,
+	void			__user *arg)
+{
+	struct xfs_changes_req	creq;
+	struct xfs_change	*changes;
+	xfs_lsn_t		lsn;
+	int			error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (!mp->m_changelog)
+		return -EOPNOTSUPP;
+
+	if (copy_from_user(&creq, arg, sizeof(creq)))
+		return -EFAULT;
+
+	if (creq.pad || memchr_inv(creq.reserved, 0, sizeof(creq.reserved)))
+		return -EINVAL;
+	if (creq.count == 0 || !creq.ubuffer)
+		return -EINVAL;
+
+	creq.count = min_t(__u32, creq.count, XFS_CHANGES_MAX);
+	changes = kmem_alloc_large(creq.count * sizeof(*changes),
+			KM_SLEEP | KM_MAYFAIL);
+	if (!changes)
+		return -ENOMEM;
+
+	lsn = creq.lsn;
+	error = xfs_changelog_read(mp, &lsn, &creq.offset, changes,
+			&creq.count, &creq.flags);
 	if (error)
-		goto out_unlock;
+		goto out_free;
+	creq.lsn = lsn;
 
-	error = xfs_update_prealloc_flags(ip, flags);
+	error = -EFAULT;
+	if (copy_to_user(u64_to_user_ptr(creq.ubuffer), changes,
+			creq.count * sizeof(*changes)) ||
+	    copy_to_user(arg, &creq, sizeof(creq)))
+		goto out_free;
+	error = 0;
 
-out_unlock:
-	xfs_iunlock(ip, iolock);
-	mnt_drop_write_file(filp);
+out_free:
+	kmem_free(changes);
 	return error;
 }
 
 STATIC int
-xfs_ioc_bulkstat(
-	xfs_mount_t		*mp,
-	unsigned int		cmd,
+xfs_ioc_get_hot_inodes(
+	struct xfs_mount	*mp,
 	void			__user *arg)
 {
-	xfs_fsop_bulkreq_t	bulkreq;
-	int			count;	/* # of records returned */
-	xfs_ino_t		inlast;	/* last inode number */
-	int			done;
+	struct xfs_hot_inodes_req hreq;
+	struct xfs_inode_heat	*heats;
 	int			error;
 
-	/* done = 1 if there are more stats to get and if bulkstat */
-	/* should be called again (unused here, but used in dmapi) */
-
 	if (!capable(CAP_SYS_ADMIN))
 		return -EPERM;
+	if (!(mp->m_flags & XFS_MOUNT_IOHEAT))
+		return -EOPNOTSUPP;
 
-	if (XFS_FORCED_SHUTDOWN(mp))
-		return -EIO;
-
-	if (copy_from_user(&bulkreq, arg, sizeof(xfs_fsop_bulkreq_t)))
+	if (copy_from_user(&hreq, arg, sizeof(hreq)))
 		return -EFAULT;
 
-	if (copy_from_user(&inlast, bulkreq.lastip, sizeof(__s64)))
+	if (memchr_inv(hreq.reserved, 0, sizeof(hreq.reserved)))
+		return -EINVAL;
+	if (!hreq.flags || (hreq.flags & ~XFS_HOT_FLAGS))
+		return -EINVAL;
+	if (hreq.count == 0 || !hreq.ubuffer)
+		return -EINVAL;
+
+	hreq.count = min_t(__u32, hreq.count, XFS_HOT_INODES_MAX);
+	heats = kmem_alloc_large(hreq.count * sizeof(*heats),
+			KM_SLEEP | KM_MAYFAIL);
+	if (!heats)
+		return -ENOMEM;
+
+	error = xfs_heat_hottest(mp, hreq.flags, heats, &hreq.count);
+	if (error)
+		goto out_free;
+
+	error = -EFAULT;
+	if (copy_to_user(u64_to_user_ptr(hreq.ubuffer), heats,
+			hreq.count * sizeof(*heats)) ||
+	    copy_to_user(arg, &hreq, sizeof(hreq)))
+		goto out_free;
+	error = 0;
+
+out_free:
+	kmem_free(heats);
+	return error;
+}
+
+STATIC int
+xfs_ioc_get_proj_usage(
+	struct xfs_mount	*mp,
+	void			__user *arg)
+{
+	struct xfs_proj_usage_req preq;
+	struct xfs_proj_usage	*pu;
+	xfs_dqid_t		id;
+	unsigned int		count;
+	bool			done;
+	int			error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&preq, arg, sizeof(preq)))
 		return -EFAULT;
 
-	if ((count = bulkreq.icount) <= 0)
+	if (preq.flags || preq.pad ||
+	    memchr_inv(preq.reserved, 0, sizeof(preq.reserved)))
 		return -EINVAL;
-
-	if (bulkreq.ubuffer == NULL)
+	if (preq.count == 0 || !preq.ubuffer)
 		return -EINVAL;
 
-	if (cmd == XFS_IOC_FSINUMBERS)
-		error = xfs_inumbers(mp, &inlast, &count,
-					bulkreq.ubuffer, xfs_inumbers_fmt);
-	else if (cmd == XFS_IOC_FSBULKSTAT_SINGLE)
-		error = xfs_bulkstat_one(mp, inlast, bulkreq.ubuffer,
-					sizeof(xfs_bstat_t), NULL, &done);
-	else	/* XFS_IOC_FSBULKSTAT */
-		error = xfs_bulkstat(mp, &inlast, &count, xfs_bulkstat_one,
-				     sizeof(xfs_bstat_t), bulkreq.ubuffer,
-				     &done);
+	count = min_t(__u32, preq.count, XFS_PROJ_USAGE_MAX);
+	pu = kmem_alloc_large(count * sizeof(*pu), KM_SLEEP | KM_MAYFAIL);
+	if (!pu)
+		return -ENOMEM;
 
+	id = preq.projid;
+	error = xfs_qm_proj_usage(mp, &id, pu, &count, &done);
 	if (error)
-		return error;
-
-	if (bulkreq.ocount != NULL) {
-		if (copy_to_user(bulkreq.lastip, &inlast,
-						sizeof(xfs_ino_t)))
-			return -EFAULT;
+		goto out_free;
 
-		if (copy_to_user(bulkreq.ocount, &count, sizeof(count)))
-			return -EFAULT;
-	}
+	preq.projid = id;
+	preq.count = count;
+	preq.flags = done ? XFS_PROJ_USAGE_DONE : 0;
+	error = -EFAULT;
+	if (copy_to_user(u64_to_user_ptr(preq.ubuffer), pu,
+			count * sizeof(*pu)) ||
+	    copy_to_user(arg, &preq, sizeof(preq)))
+		goto out_free;
+	error = 0;
 
-	return 0;
+out_free:
+	kmem_free(pu);
+	return error;
 }
 
 STATIC int
@@ -1025,7 +1868,8 @@ xfs_ioctl_setattr_xflags(
 	struct xfs_mount	*mp = ip->i_mount;
 
 	/* Can't change realtime flag if any extents are allocated. */
-	if ((ip->i_d.di_nextents || ip->i_delayed_blks) &&
+	if ((ip->i_d.di_nextents || ip->i_delayed_blks ||
+	     xfs_is_inline_data_inode(ip)) &&
 	    XFS_IS_REALTIME_INODE(ip) != (fa->fsx_xflags & FS_XFLAG_REALTIME))
 		return -EINVAL;
 
@@ -1714,6 +2558,117 @@ xfs_ioc_scrub_metadata(
 	return 0;
 }
 
+STATIC int
+xfs_ioc_scrubv_metadata(
+	struct xfs_inode		*ip,
+	void				__user *arg)
+{
+	struct xfs_mount		*mp = ip->i_mount;
+	struct xfs_scrub_vec_head	head;
+	struct xfs_scrub_vec		*vecs;
+	struct xfs_scrub_vec_result	*results;
+	size_t				results_len;
+	int				error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&head, arg, sizeof(head)))
+		return -EFAULT;
+
+	if (head.svh_pad || memchr_inv(head.svh_reserved, 0,
+				       sizeof(head.svh_reserved)))
+		return -EINVAL;
+	if (head.svh_nr == 0 || head.svh_nr > XFS_SCRUB_TYPE_NR)
+		return -EINVAL;
+	if (head.svh_agcount == 0 ||
+	    head.svh_agno >= mp->m_sb.sb_agcount ||
+	    head.svh_agcount > mp->m_sb.sb_agcount - head.svh_agno)
+		return -EINVAL;
+	if (head.svh_rest_us > XFS_SCRUB_VEC_MAX_REST_US)
+		return -EINVAL;
+
+	vecs = memdup_user(u64_to_user_ptr(head.svh_vectors),
+			   head.svh_nr * sizeof(struct xfs_scrub_vec));
+	if (IS_ERR(vecs))
+		return PTR_ERR(vecs);
+
+	results_len = (size_t)head.svh_agcount * head.svh_nr *
+		      sizeof(struct xfs_scrub_vec_result);
+	results = kmem_zalloc_large(results_len, KM_SLEEP);
+	if (!results) {
+		error = -ENOMEM;
+		goto out_vecs;
+	}
+
+	error = xfs_scrub_metadata_vec(ip, &head, vecs, results);
+	if (error)
+		goto out_results;
+
+	if (copy_to_user(u64_to_user_ptr(head.svh_results), results,
+			 results_len))
+		error = -EFAULT;
+out_results:
+	kmem_free(results);
+out_vecs:
+	kfree(vecs);
+	return error;
+}
+
+STATIC int
+xfs_ioc_scrub_inodes(
+	struct xfs_inode		*ip,
+	void				__user *arg)
+{
+	struct xfs_mount		*mp = ip->i_mount;
+	struct xfs_scrub_inodes_head	head;
+	struct xfs_scrub_inode_failure	*failures = NULL;
+	size_t				failures_len;
+	int				error;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&head, arg, sizeof(head)))
+		return -EFAULT;
+
+	if (head.sih_pad || memchr_inv(head.sih_reserved, 0,
+				       sizeof(head.sih_reserved)))
+		return -EINVAL;
+	if (head.sih_agcount == 0 ||
+	    head.sih_agno >= mp->m_sb.sb_agcount ||
+	    head.sih_agcount > mp->m_sb.sb_agcount - head.sih_agno)
+		return -EINVAL;
+	if (head.sih_max_failures > XFS_SCRUB_INODES_MAX_FAILURES)
+		return -EINVAL;
+
+	failures_len = (size_t)head.sih_max_failures *
+		       sizeof(struct xfs_scrub_inode_failure);
+	if (failures_len) {
+		failures = kmem_zalloc_large(failures_len, KM_SLEEP);
+		if (!failures)
+			return -ENOMEM;
+	}
+
+	error = xfs_scrub_inodes(ip, &head, failures);
+	if (error)
+		goto out_failures;
+
+	failures_len = (size_t)min(head.sih_found, head.sih_max_failures) *
+		       sizeof(struct xfs_scrub_inode_failure);
+	if (failures_len &&
+	    copy_to_user(u64_to_user_ptr(head.sih_failures), failures,
+			 failures_len)) {
+		error = -EFAULT;
+		goto out_failures;
+	}
+	if (copy_to_user(arg, &head, sizeof(head)))
+		error = -EFAULT;
+out_failures:
+	kmem_free(failures);
+	return error;
+}
+
 int
 xfs_ioc_swapext(
 	xfs_swapext_t	*sxp)
@@ -1722,6 +2677,10 @@ xfs_ioc_swapext(
 	struct fd	f, tmp;
 	int		error = 0;
 
+	if (sxp->sx_version != XFS_SX_VERSION &&
+	    sxp->sx_version != XFS_SX_VERSION_RTMOVE)
+		return -EINVAL;
+
 	/* Pull information for the target fd */
 	f = fdget((int)sxp->sx_fdtarget);
 	if (!f.file) {
@@ -1794,6 +2753,95 @@ xfs_ioc_swapext(
 	return error;
 }
 
+STATIC int
+xfs_ioc_swaprange(
+	struct file		*filp,
+	struct xfs_swap_range	*sr)
+{
+	struct xfs_inode	*ip1 = XFS_I(file_inode(filp));
+	struct xfs_inode	*ip2;
+	struct fd		f;
+	int			error;
+
+	if (sr->sr_pad[0] || sr->sr_pad[1] || sr->sr_pad[2])
+		return -EINVAL;
+
+	if (!(filp->f_mode & FMODE_WRITE) ||
+	    !(filp->f_mode & FMODE_READ) ||
+	    (filp->f_flags & O_APPEND))
+		return -EBADF;
+
+	f = fdget((int)sr->sr_fd);
+	if (!f.file)
+		return -EBADF;
+
+	if (!(f.file->f_mode & FMODE_WRITE) ||
+	    !(f.file->f_mode & FMODE_READ) ||
+	    (f.file->f_flags & O_APPEND)) {
+		error = -EBADF;
+		goto out_put_file;
+	}
+
+	if (IS_SWAPFILE(file_inode(filp)) ||
+	    IS_SWAPFILE(file_inode(f.file))) {
+		error = -EINVAL;
+		goto out_put_file;
+	}
+
+	/* Make sure the other fd is an XFS file on the same mount. */
+	if (f.file->f_op != &xfs_file_operations ||
+	    f.file->f_path.mnt != filp->f_path.mnt) {
+		error = -EXDEV;
+		goto out_put_file;
+	}
+
+	ip2 = XFS_I(file_inode(f.file));
+	if (ip1 == ip2) {
+		error = -EINVAL;
+		goto out_put_file;
+	}
+
+	if (XFS_FORCED_SHUTDOWN(ip1->i_mount)) {
+		error = -EIO;
+		goto out_put_file;
+	}
+
+	error = xfs_swap_range(ip1, ip2, sr);
+
+ out_put_file:
+	fdput(f);
+	return error;
+}
+
+STATIC int
+xfs_ioc_defrag_range(
+	struct file		*filp,
+	struct xfs_defrag_range	*dr)
+{
+	struct inode		*inode = file_inode(filp);
+	struct xfs_inode	*ip = XFS_I(inode);
+
+	if (dr->dr_pad[0] || dr->dr_pad[1] || dr->dr_pad[2] || dr->dr_pad[3])
+		return -EINVAL;
+
+	if (!(filp->f_mode & FMODE_WRITE) ||
+	    !(filp->f_mode & FMODE_READ) ||
+	    (filp->f_flags & O_APPEND))
+		return -EBADF;
+
+	if (!S_ISREG(inode->i_mode))
+		return -EINVAL;
+	if (IS_SWAPFILE(inode))
+		return -ETXTBSY;
+	if (IS_IMMUTABLE(inode) || IS_APPEND(inode))
+		return -EPERM;
+
+	if (XFS_FORCED_SHUTDOWN(ip->i_mount))
+		return -EIO;
+
+	return xfs_reflink_defrag_range(ip, dr);
+}
+
 static int
 xfs_ioc_get_ag_reserve_blocks(
 	struct xfs_mount		*mp,
@@ -1872,6 +2920,16 @@ xfs_file_ioctl(
 	case XFS_IOC_FSINUMBERS:
 		return xfs_ioc_bulkstat(mp, cmd, arg);
 
+	case XFS_IOC_AG_BULKSTAT:
+		return xfs_ioc_ag_bulkstat(mp, arg);
+
+	case XFS_IOC_READDIRSTAT:
+		return xfs_ioc_readdirstat(filp, arg);
+	case XFS_IOC_RMTREE:
+		return xfs_ioc_rmtree(filp, arg);
+	case XFS_IOC_CREATE_BATCH:
+		return xfs_ioc_create_batch(filp, arg);
+
 	case XFS_IOC_FSGEOMETRY_V1:
 		return xfs_ioc_fsgeometry_v1(mp, arg);
 
@@ -1921,6 +2979,12 @@ xfs_file_ioctl(
 	case XFS_IOC_SCRUB_METADATA:
 		return xfs_ioc_scrub_metadata(ip, arg);
 
+	case XFS_IOC_SCRUBV_METADATA:
+		return xfs_ioc_scrubv_metadata(ip, arg);
+
+	case XFS_IOC_SCRUB_INODES:
+		return xfs_ioc_scrub_inodes(ip, arg);
+
 	case XFS_IOC_FD_TO_HANDLE:
 	case XFS_IOC_PATH_TO_HANDLE:
 	case XFS_IOC_PATH_TO_FSHANDLE: {
@@ -1937,6 +3001,16 @@ xfs_file_ioctl(
 			return -EFAULT;
 		return xfs_open_by_handle(filp, &hreq);
 	}
+	case XFS_IOC_OPEN_BY_HANDLES:
+		return xfs_ioc_open_by_handles(filp, arg);
+	case XFS_IOC_HANDLE_TO_PATH:
+		return xfs_ioc_handle_to_path(filp, arg);
+	case XFS_IOC_GET_CHANGES:
+		return xfs_ioc_get_changes(mp, arg);
+	case XFS_IOC_GET_HOT_INODES:
+		return xfs_ioc_get_hot_inodes(mp, arg);
+	case XFS_IOC_GET_PROJ_USAGE:
+		return xfs_ioc_get_proj_usage(mp, arg);
 	case XFS_IOC_FSSETDM_BY_HANDLE:
 		return xfs_fssetdm_by_handle(filp, arg);
 
@@ -1966,6 +3040,60 @@ xfs_file_ioctl(
 		return error;
 	}
 
+	case XFS_IOC_SWAPRANGE: {
+		struct xfs_swap_range	sr;
+
+		if (copy_from_user(&sr, arg, sizeof(sr)))
+			return -EFAULT;
+		error = mnt_want_write_file(filp);
+		if (error)
+			return error;
+		error = xfs_ioc_swaprange(filp, &sr);
+		mnt_drop_write_file(filp);
+		return error;
+	}
+
+	case XFS_IOC_DEFRAG_RANGE: {
+		struct xfs_defrag_range	dr;
+
+		if (copy_from_user(&dr, arg, sizeof(dr)))
+			return -EFAULT;
+		error = mnt_want_write_file(filp);
+		if (error)
+			return error;
+		error = xfs_ioc_defrag_range(filp, &dr);
+		mnt_drop_write_file(filp);
+		if (error)
+			return error;
+		if (copy_to_user(arg, &dr, sizeof(dr)))
+			return -EFAULT;
+		return 0;
+	}
+
+	case XFS_IOC_COMPACT_AG: {
+		struct xfs_compact_ag	ca;
+
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		if (copy_from_user(&ca, arg, sizeof(ca)))
+			return -EFAULT;
+		if (ca.ca_pad[0] || ca.ca_pad[1] || ca.ca_pad[2] ||
+		    ca.ca_pad[3])
+			return -EINVAL;
+		if (XFS_FORCED_SHUTDOWN(mp))
+			return -EIO;
+		error = mnt_want_write_file(filp);
+		if (error)
+			return error;
+		error = xfs_compact_ag(mp, &ca);
+		mnt_drop_write_file(filp);
+		if (error)
+			return error;
+		if (copy_to_user(arg, &ca, sizeof(ca)))
+			return -EFAULT;
+		return 0;
+	}
+
 	case XFS_IOC_FSCOUNTS: {
 		xfs_fsop_counts_t out;
 
@@ -43,27 +43,37 @@ xfs_readlink_by_handle(
 	struct file		*parfilp,
 	xfs_fsop_handlereq_t	*hreq);
 
-extern int
-xfs_attrmulti_attr_get(
-	struct inode		*inode,
-	unsigned char		*name,
-	unsigned char		__user *ubuf,
-	uint32_t		*len,
-	uint32_t		flags);
+/*
+ * Most handles resolved by one XFS_IOC_OPEN_BY_HANDLES call.
+ */
+#define XFS_HANDLES_MAX		4096
 
-extern int
-xfs_attrmulti_attr_set(
-	struct inode		*inode,
-	unsigned char		*name,
-	const unsigned char	__user *ubuf,
-	uint32_t		len,
-	uint32_t		flags);
+/*
+ * Most projects reported by one XFS_IOC_GET_PROJ_USAGE call.
+ */
+#define XFS_PROJ_USAGE_MAX	1024
 
-extern int
-xfs_attrmulti_attr_remove(
+/*
+ * Most files created by one XFS_IOC_CREATE_BATCH call, and the number of
+ * them created under one hold of the directory lock.
+ */
+#define XFS_CREATE_BATCH_MAX	1024
+#define XFS_CREATE_BATCH	64
+
+/*
+ * Number of attrmulti operations staged in the kernel at a time.
+ */
+#define XFS_ATTRMULTI_BATCH	16
+
+struct xfs_attr_op;
+
+extern void
+xfs_attrmulti_batch(
+	struct file		*parfilp,
 	struct inode		*inode,
-	unsigned char		*name,
-	uint32_t		flags);
+	struct xfs_attr_op	*ops,
+	void			__user **uvalues,
+	int			nops);
 
 extern struct dentry *
 xfs_handle_to_dentry(
@@ -399,9 +399,13 @@ xfs_compat_attrmulti_by_handle(
 	int					error;
 	compat_xfs_attr_multiop_t		*ops;
 	compat_xfs_fsop_attrmulti_handlereq_t	am_hreq;
+	struct xfs_attr_op			*xops = NULL;
+	void					__user **uvalues = NULL;
 	struct dentry				*dentry;
-	unsigned int				i, size;
+	unsigned int				i, j, k, n, size;
 	unsigned char				*attr_name;
+	unsigned char				*name;
+	long					len;
 
 	if (!capable(CAP_SYS_ADMIN))
 		return -EPERM;
@@ -429,54 +433,59 @@ xfs_compat_attrmulti_by_handle(
 	}
 
 	error = -ENOMEM;
-	attr_name = kmalloc(MAXNAMELEN, GFP_KERNEL);
-	if (!attr_name)
-		goto out_kfree_ops;
+	attr_name = kmalloc(XFS_ATTRMULTI_BATCH * MAXNAMELEN, GFP_KERNEL);
+	xops = kmalloc(XFS_ATTRMULTI_BATCH * sizeof(*xops), GFP_KERNEL);
+	uvalues = kmalloc(XFS_ATTRMULTI_BATCH * sizeof(*uvalues), GFP_KERNEL);
+	if (!attr_name || !xops || !uvalues)
+		goto out_kfree_names;
 
 	error = 0;
-	for (i = 0; i < am_hreq.opcount; i++) {
-		ops[i].am_error = strncpy_from_user((char *)attr_name,
-				compat_ptr(ops[i].am_attrname),
-				MAXNAMELEN);
-		if (ops[i].am_error == 0 || ops[i].am_error == MAXNAMELEN)
-			error = -ERANGE;
-		if (ops[i].am_error < 0)
-			break;
-
-		switch (ops[i].am_opcode) {
-		case ATTR_OP_GET:
-			ops[i].am_error = xfs_attrmulti_attr_get(
-					d_inode(dentry), attr_name,
-					compat_ptr(ops[i].am_attrvalue),
-					&ops[i].am_length, ops[i].am_flags);
-			break;
-		case ATTR_OP_SET:
-			ops[i].am_error = mnt_want_write_file(parfilp);
-			if (ops[i].am_error)
-				break;
-			ops[i].am_error = xfs_attrmulti_attr_set(
-					d_inode(dentry), attr_name,
-					compat_ptr(ops[i].am_attrvalue),
-					ops[i].am_length, ops[i].am_flags);
-			mnt_drop_write_file(parfilp);
-			break;
-		case ATTR_OP_REMOVE:
-			ops[i].am_error = mnt_want_write_file(parfilp);
-			if (ops[i].am_error)
+	for (i = 0; i < am_hreq.opcount; i += n) {
+		n = min_t(unsigned int, am_hreq.opcount - i,
+			  XFS_ATTRMULTI_BATCH);
+		for (j = 0; j < n; j++) {
+			name = attr_name + j * MAXNAMELEN;
+			len = strncpy_from_user((char *)name,
+					compat_ptr(ops[i + j].am_attrname),
+					MAXNAMELEN);
+			if (len < 0) {
+				ops[i + j].am_error = len;
 				break;
-			ops[i].am_error = xfs_attrmulti_attr_remove(
-					d_inode(dentry), attr_name,
-					ops[i].am_flags);
-			mnt_drop_write_file(parfilp);
-			break;
-		default:
-			ops[i].am_error = -EINVAL;
+			}
+
+			xops[j].xo_name = name;
+			xops[j].xo_valuelen = ops[i + j].am_length;
+			xops[j].xo_flags = ops[i + j].am_flags;
+			xops[j].xo_opcode = ops[i + j].am_opcode;
+			xops[j].xo_error = 0;
+			uvalues[j] = compat_ptr(ops[i + j].am_attrvalue);
+
+			if (len == 0 || len == MAXNAMELEN) {
+				error = -ERANGE;
+				xops[j].xo_error = -ERANGE;
+			} else if (xops[j].xo_opcode != ATTR_OP_GET &&
+				   xops[j].xo_opcode != ATTR_OP_SET &&
+				   xops[j].xo_opcode != ATTR_OP_REMOVE) {
+				xops[j].xo_error = -EINVAL;
+			}
+		}
+
+		xfs_attrmulti_batch(parfilp, d_inode(dentry), xops, uvalues, j);
+		for (k = 0; k < j; k++) {
+			ops[i + k].am_error = xops[k].xo_error;
+			if (xops[k].xo_opcode == ATTR_OP_GET)
+				ops[i + k].am_length = xops[k].xo_valuelen;
 		}
+		if (j < n)
+			break;
 	}
 
 	if (copy_to_user(compat_ptr(am_hreq.ops), ops, size))
 		error = -EFAULT;
 
+ out_kfree_names:
+	kfree(uvalues);
+	kfree(xops);
 	kfree(attr_name);
  out_kfree_ops:
 	kfree(ops);
@@ -558,6 +567,20 @@ xfs_file_compat_ioctl(
 	case FS_IOC_GETFSMAP:
 	case XFS_IOC_GET_AG_RESBLKS:
 	case XFS_IOC_SCRUB_METADATA:
+	case XFS_IOC_SCRUBV_METADATA:
+	case XFS_IOC_SCRUB_INODES:
+	case XFS_IOC_AG_BULKSTAT:
+	case XFS_IOC_READDIRSTAT:
+	case XFS_IOC_SWAPRANGE:
+	case XFS_IOC_DEFRAG_RANGE:
+	case XFS_IOC_COMPACT_AG:
+	case XFS_IOC_OPEN_BY_HANDLES:
+	case XFS_IOC_HANDLE_TO_PATH:
+	case XFS_IOC_GET_CHANGES:
+	case XFS_IOC_GET_PROJ_USAGE:
+	case XFS_IOC_GET_HOT_INODES:
+	case XFS_IOC_RMTREE:
+	case XFS_IOC_CREATE_BATCH:
 		return xfs_file_ioctl(filp, cmd, p);
 #ifndef BROKEN_X86_ALIGNMENT
 	/* These are handled fine if no alignment issues */
@@ -32,6 +32,8 @@
 #include "xfs_bmap_util.h"
 #include "xfs_error.h"
 #include "xfs_trans.h"
+#include "xfs_inode_item.h"
+#include "xfs_log.h"
 #include "xfs_trans_space.h"
 #include "xfs_iomap.h"
 #include "xfs_trace.h"
@@ -176,6 +178,8 @@ xfs_iomap_write_direct(
 
 	rt = XFS_IS_REALTIME_INODE(ip);
 	extsz = xfs_get_extsz_hint(ip);
+	if (!extsz)
+		extsz = xfs_get_dax_align(ip);
 	lockmode = XFS_ILOCK_SHARED;	/* locked by caller */
 
 	ASSERT(xfs_isilocked(ip, lockmode));
@@ -365,6 +369,50 @@ xfs_quota_calc_throttle(
 	}
 }
 
+/*
+ * Track how fast the file is growing.  Every write that extends the file
+ * records the time, and at most once a second the growth in file size since
+ * the previous sample is folded into a moving average of the append rate.
+ * After a gap of more than a scan interval the old average is discarded.
+ *
+ * Called with the ILOCK held exclusively.
+ */
+STATIC void
+xfs_iomap_append_sample(
+	struct xfs_inode	*ip,
+	loff_t			end)
+{
+	struct xfs_inode_io	*io;
+	xfs_fsize_t		isize = XFS_ISIZE(ip);
+	unsigned long		now = jiffies;
+	unsigned long		elapsed;
+	uint64_t		rate;
+
+	if (end <= isize)
+		return;
+	io = xfs_inode_io_get(ip);
+	WRITE_ONCE(io->iio_append_last, now);
+
+	elapsed = now - io->iio_append_stamp;
+	if (!io->iio_append_stamp || isize < io->iio_append_size ||
+	    elapsed > xfs_eofb_secs * HZ) {
+		io->iio_append_stamp = now;
+		io->iio_append_size = isize;
+		WRITE_ONCE(io->iio_append_rate, 0);
+		return;
+	}
+	if (elapsed < HZ)
+		return;
+
+	rate = div64_u64((uint64_t)(isize - io->iio_append_size) * HZ, elapsed);
+	if (io->iio_append_rate)
+		rate = (io->iio_append_rate * 3ULL + rate) >> 2;
+	io->iio_append_stamp = now;
+	io->iio_append_size = isize;
+	WRITE_ONCE(io->iio_append_rate, max_t(uint64_t, min_t(uint64_t, rate,
+						UINT_MAX), 1));
+}
+
 /*
  * If we are doing a write at the end of the file and there are no allocations
  * past this one, then extend the allocation out to the file system's write
@@ -437,6 +485,18 @@ xfs_iomap_prealloc_size(
 		alloc_blocks = prev.br_blockcount << 1;
 	else
 		alloc_blocks = XFS_B_TO_FSB(mp, offset);
+
+	/*
+	 * If we know how fast the file is being appended to, don't reserve
+	 * more than it will grow into before the background scanner would
+	 * trim the excess.  This stops fast writers from doubling their way
+	 * to huge preallocations that are mostly freed again on close.
+	 */
+	if (ip->i_io && ip->i_io->iio_append_rate)
+		alloc_blocks = min_t(xfs_fsblock_t, alloc_blocks,
+				XFS_B_TO_FSB(mp,
+					(uint64_t)ip->i_io->iio_append_rate *
+					xfs_eofb_secs));
 	if (!alloc_blocks)
 		goto check_writeio;
 	qblocks = alloc_blocks;
@@ -538,7 +598,12 @@ xfs_file_iomap_begin_delay(
 	ASSERT(!XFS_IS_REALTIME_INODE(ip));
 	ASSERT(!xfs_get_extsz_hint(ip));
 
-	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	if (flags & IOMAP_NOWAIT) {
+		if (!xfs_ilock_nowait(ip, XFS_ILOCK_EXCL))
+			return -EAGAIN;
+	} else {
+		xfs_ilock(ip, XFS_ILOCK_EXCL);
+	}
 
 	if (unlikely(XFS_TEST_ERROR(
 	    (XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_EXTENTS &&
@@ -550,8 +615,13 @@ xfs_file_iomap_begin_delay(
 	}
 
 	XFS_STATS_INC(mp, xs_blk_mapw);
+	xfs_iomap_append_sample(ip, offset + count);
 
 	if (!(ifp->if_flags & XFS_IFEXTENTS)) {
+		if (flags & IOMAP_NOWAIT) {
+			error = -EAGAIN;
+			goto out_unlock;
+		}
 		error = xfs_iread_extents(NULL, ip, XFS_DATA_FORK);
 		if (error)
 			goto out_unlock;
@@ -562,6 +632,10 @@ xfs_file_iomap_begin_delay(
 		if (xfs_is_reflink_inode(ip)) {
 			bool		shared;
 
+			if (flags & IOMAP_NOWAIT) {
+				error = -EAGAIN;
+				goto out_unlock;
+			}
 			end_fsb = min(XFS_B_TO_FSB(mp, offset + count),
 					maxbytes_fsb);
 			xfs_trim_extent(&got, offset_fsb, end_fsb - offset_fsb);
@@ -574,6 +648,15 @@ xfs_file_iomap_begin_delay(
 		goto done;
 	}
 
+	/*
+	 * Reserving delalloc blocks can block on quota and free space
+	 * accounting, so nowait writes only proceed over existing extents.
+	 */
+	if (flags & IOMAP_NOWAIT) {
+		error = -EAGAIN;
+		goto out_unlock;
+	}
+
 	error = xfs_qm_dqattach_locked(ip, 0);
 	if (error)
 		goto out_unlock;
@@ -653,6 +736,74 @@ xfs_file_iomap_begin_delay(
 	return error;
 }
 
+/*
+ * Reserve delalloc blocks for a run of pages around a write fault on a hole.
+ * [*start_fsb, *end_fsb) is trimmed to the hole containing @offset_fsb, kept
+ * page aligned so that every block reserved is covered by a page the caller
+ * is going to dirty, and then reserved in one go.  On return it describes
+ * what was reserved, which is empty if @offset_fsb isn't in a hole.
+ */
+int
+xfs_iomap_reserve_fault_run(
+	struct xfs_inode	*ip,
+	xfs_fileoff_t		offset_fsb,
+	xfs_fileoff_t		*start_fsb,
+	xfs_fileoff_t		*end_fsb)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_ifork	*ifp = XFS_IFORK_PTR(ip, XFS_DATA_FORK);
+	xfs_fileoff_t		page_fsb = XFS_B_TO_FSB(mp, PAGE_SIZE);
+	struct xfs_bmbt_irec	got;
+	struct xfs_bmbt_irec	prev;
+	xfs_extnum_t		idx;
+	int			eof;
+	int			error = 0;
+
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	if (XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_EXTENTS &&
+	    XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_BTREE)
+		goto out_none;
+
+	if (!(ifp->if_flags & XFS_IFEXTENTS)) {
+		error = xfs_iread_extents(NULL, ip, XFS_DATA_FORK);
+		if (error)
+			goto out_none;
+	}
+
+	eof = !xfs_iext_lookup_extent(ip, ifp, offset_fsb, &idx, &got);
+	if (!eof) {
+		if (got.br_startoff <= offset_fsb)
+			goto out_none;
+		*end_fsb = min(*end_fsb, round_down(got.br_startoff, page_fsb));
+	}
+	if (xfs_iext_get_extent(ifp, idx - 1, &prev))
+		*start_fsb = max(*start_fsb,
+				 round_up(prev.br_startoff + prev.br_blockcount,
+					  page_fsb));
+	if (*start_fsb >= *end_fsb)
+		goto out_none;
+
+	error = xfs_qm_dqattach_locked(ip, 0);
+	if (error)
+		goto out_none;
+
+	error = xfs_bmapi_reserve_delalloc(ip, XFS_DATA_FORK, *start_fsb,
+			*end_fsb - *start_fsb, 0, &got, &idx, eof);
+	if (error)
+		goto out_none;
+
+	*end_fsb = min(*end_fsb, got.br_startoff + got.br_blockcount);
+	trace_xfs_iomap_alloc(ip, XFS_FSB_TO_B(mp, *start_fsb),
+			XFS_FSB_TO_B(mp, *end_fsb - *start_fsb), 0, &got);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return 0;
+
+out_none:
+	*end_fsb = *start_fsb;
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return error;
+}
+
 /*
  * Pass in a delayed allocate extent, convert it to real extents;
  * return to the caller the extent we create which maps on top of
@@ -662,6 +813,15 @@ xfs_file_iomap_begin_delay(
  *
  * We no longer bother to look at the incoming map - all we have to
  * guarantee is that whatever we allocate fills the required range.
+ *
+ * Note that we don't just allocate the range being written back:
+ * xfs_bmapi_allocate() converts the whole delalloc extent we land in, and
+ * since adjacent delalloc reservations are always merged in the incore extent
+ * list, that is the entire contiguous delalloc run up to MAXEXTLEN.  With no
+ * first block set in the transaction, xfs_bmap_btalloc_nullfb() raises the
+ * minimum length to the longest free extent available, so the allocator is
+ * asked for the combined length in one go rather than taking the nearest
+ * fragment.
  */
 int
 xfs_iomap_write_allocate(
@@ -903,7 +1063,7 @@ xfs_iomap_write_unwritten(
 		i_size = xfs_new_eof(ip, i_size);
 		if (i_size) {
 			ip->i_d.di_size = i_size;
-			xfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+			xfs_trans_log_inode(tp, ip, XFS_ILOG_ISIZE);
 		}
 
 		error = xfs_defer_finish(&tp, &dfops, NULL);
@@ -939,6 +1099,371 @@ xfs_iomap_write_unwritten(
 	return error;
 }
 
+/*
+ * Batched unwritten extent conversion for direct I/O completions.
+ *
+ * A database writing into preallocated space at a high queue depth completes
+ * many direct writes into adjacent unwritten ranges at once, and converting
+ * each of them separately costs a transaction per I/O.  Instead completions
+ * queue their range on a per-inode accumulator and the first one to find no
+ * conversion running becomes the converter: it takes everything queued, sorts
+ * it, merges adjacent and overlapping ranges and converts each merged range
+ * with xfs_iomap_write_unwritten.  Completions that arrive while a conversion
+ * is running wait for the next converter to pick them up, so the I/O still
+ * isn't completed to the caller until its extents have been converted.
+ *
+ * When the previous batch showed that completions are arriving concurrently,
+ * the converter lingers for a short window before taking the queue so that
+ * more ranges can join.  Completions that have to be synced (O_[D]SYNC and
+ * synchronous I/O) never linger.
+ */
+#define XFS_UNWRITTEN_BATCH_WINDOW_US	50
+
+struct xfs_unwritten_batch {
+	spinlock_t		ub_lock;
+	struct list_head	ub_queue;	/* ranges to convert */
+	bool			ub_busy;	/* a converter is running */
+	unsigned int		ub_last;	/* size of the previous batch */
+	wait_queue_head_t	ub_wait;
+};
+
+struct xfs_unwritten_range {
+	struct list_head	ur_list;
+	xfs_off_t		ur_offset;
+	xfs_off_t		ur_count;
+	int			ur_error;
+	bool			ur_done;
+};
+
+void
+xfs_iomap_unwritten_batch_free(
+	struct xfs_inode	*ip)
+{
+	if (!ip->i_io)
+		return;
+	kmem_free(ip->i_io->iio_unwritten_batch);
+	ip->i_io->iio_unwritten_batch = NULL;
+}
+
+static int
+xfs_unwritten_range_compare(
+	void			*priv,
+	struct list_head	*a,
+	struct list_head	*b)
+{
+	struct xfs_unwritten_range *ra;
+	struct xfs_unwritten_range *rb;
+
+	ra = container_of(a, struct xfs_unwritten_range, ur_list);
+	rb = container_of(b, struct xfs_unwritten_range, ur_list);
+	if (ra->ur_offset < rb->ur_offset)
+		return -1;
+	if (ra->ur_offset > rb->ur_offset)
+		return 1;
+	return 0;
+}
+
+/*
+ * Convert a batch of queued ranges, merging adjacent and overlapping ones, and
+ * complete each range with the result of the conversion that covered it.
+ * Returns the number of ranges in the batch.
+ */
+STATIC unsigned int
+xfs_iomap_convert_batch(
+	struct xfs_inode	*ip,
+	struct list_head	*batch)
+{
+	struct xfs_unwritten_range *ur;
+	struct xfs_unwritten_range *first;
+	struct xfs_unwritten_range *n;
+	xfs_off_t		end;
+	unsigned int		nr = 0;
+	int			error;
+
+	list_sort(NULL, batch, xfs_unwritten_range_compare);
+
+	while (!list_empty(batch)) {
+		first = list_first_entry(batch, struct xfs_unwritten_range,
+				ur_list);
+		end = first->ur_offset + first->ur_count;
+		ur = first;
+		list_for_each_entry_continue(ur, batch, ur_list) {
+			if (ur->ur_offset > end)
+				break;
+			end = max(end, ur->ur_offset + ur->ur_count);
+		}
+
+		error = xfs_iomap_write_unwritten(ip, first->ur_offset,
+				end - first->ur_offset);
+
+		/*
+		 * The waiter owns the range and may return as soon as it sees
+		 * ur_done, so don't touch a range after completing it.
+		 */
+		list_for_each_entry_safe(ur, n, batch, ur_list) {
+			if (ur->ur_offset > end)
+				break;
+			list_del(&ur->ur_list);
+			ur->ur_error = error;
+			smp_store_release(&ur->ur_done, true);
+			nr++;
+		}
+	}
+	return nr;
+}
+
+/*
+ * Convert the unwritten extents under a completed direct write, batching the
+ * conversion with any other completions for the same inode.
+ */
+int
+xfs_iomap_write_unwritten_batch(
+	struct xfs_inode	*ip,
+	xfs_off_t		offset,
+	xfs_off_t		count,
+	bool			sync)
+{
+	struct xfs_inode_io	*io = xfs_inode_io_get(ip);
+	struct xfs_unwritten_batch *ub = READ_ONCE(io->iio_unwritten_batch);
+	struct xfs_unwritten_range ur = {
+		.ur_offset	= offset,
+		.ur_count	= count,
+	};
+	LIST_HEAD		(batch);
+	unsigned int		nr;
+	bool			linger;
+
+	if (!ub) {
+		ub = kmem_zalloc(sizeof(*ub), KM_NOFS | KM_MAYFAIL);
+		if (!ub)
+			return xfs_iomap_write_unwritten(ip, offset, count);
+		spin_lock_init(&ub->ub_lock);
+		INIT_LIST_HEAD(&ub->ub_queue);
+		init_waitqueue_head(&ub->ub_wait);
+		if (cmpxchg(&io->iio_unwritten_batch, NULL, ub) != NULL) {
+			kmem_free(ub);
+			ub = READ_ONCE(io->iio_unwritten_batch);
+		}
+	}
+
+	spin_lock(&ub->ub_lock);
+	list_add_tail(&ur.ur_list, &ub->ub_queue);
+	while (ub->ub_busy) {
+		spin_unlock(&ub->ub_lock);
+		wait_event(ub->ub_wait, smp_load_acquire(&ur.ur_done) ||
+					!READ_ONCE(ub->ub_busy));
+		if (smp_load_acquire(&ur.ur_done))
+			return ur.ur_error;
+		spin_lock(&ub->ub_lock);
+	}
+	if (ur.ur_done) {
+		spin_unlock(&ub->ub_lock);
+		return ur.ur_error;
+	}
+	ub->ub_busy = true;
+	linger = !sync && ub->ub_last > 1;
+	spin_unlock(&ub->ub_lock);
+
+	if (linger)
+		usleep_range(XFS_UNWRITTEN_BATCH_WINDOW_US,
+			     2 * XFS_UNWRITTEN_BATCH_WINDOW_US);
+
+	spin_lock(&ub->ub_lock);
+	list_splice_init(&ub->ub_queue, &batch);
+	spin_unlock(&ub->ub_lock);
+
+	nr = xfs_iomap_convert_batch(ip, &batch);
+
+	spin_lock(&ub->ub_lock);
+	ub->ub_last = nr;
+	ub->ub_busy = false;
+	spin_unlock(&ub->ub_lock);
+	wake_up_all(&ub->ub_wait);
+
+	return ur.ur_error;
+}
+
+/*
+ * Block ranges of in-flight direct writes.
+ *
+ * A direct write that isn't aligned to the filesystem block size has the
+ * rest of its first and last block zeroed by the dio code if the block is
+ * newly allocated or unwritten.  Two such writes into the same block, or
+ * one racing with an aligned write to it, would overwrite each other's data
+ * with zeroes, and a write into a block must not map it before an earlier
+ * write's unwritten extent conversion has completed.  The big hammer for
+ * this is to take the iolock exclusively and drain all direct I/O to the
+ * file, which completely serialises small unaligned writers such as a log
+ * writing 512 byte records to a 4k block filesystem.
+ *
+ * Once a file has seen an unaligned direct write, every direct write to it
+ * registers the blocks it touches here from submission until its completion
+ * has finished, and an unaligned write waits only for writes overlapping its
+ * blocks, and an aligned one only for unaligned writes overlapping its
+ * blocks.  The first unaligned write still drains the file under the
+ * exclusive iolock, so that no unregistered write can be in flight, and
+ * then sets up the tracking for the rest of the inode's life in the cache.
+ */
+struct xfs_dio_blocks {
+	wait_queue_head_t	db_wait;	/* lock also protects list */
+	struct list_head	db_ranges;
+};
+
+struct xfs_dio_range {
+	struct list_head	dr_list;
+	xfs_off_t		dr_start;	/* block aligned */
+	xfs_off_t		dr_end;		/* block aligned, exclusive */
+	bool			dr_unaligned;
+	bool			dr_done;
+	atomic_t		dr_ref;		/* submitter and completion */
+};
+
+/*
+ * Start tracking direct writes to the inode.  Must be called with the iolock
+ * held exclusively and all direct I/O drained.
+ */
+void
+xfs_iomap_dio_blocks_init(
+	struct xfs_inode	*ip)
+{
+	struct xfs_inode_io	*io = xfs_inode_io_get(ip);
+	struct xfs_dio_blocks	*db;
+
+	ASSERT(xfs_isilocked(ip, XFS_IOLOCK_EXCL));
+	ASSERT(atomic_read(&VFS_I(ip)->i_dio_count) == 0);
+
+	if (io->iio_dio_blocks)
+		return;
+	db = kmem_alloc(sizeof(*db), KM_NOFS | KM_MAYFAIL);
+	if (!db)
+		return;
+	init_waitqueue_head(&db->db_wait);
+	INIT_LIST_HEAD(&db->db_ranges);
+	WRITE_ONCE(io->iio_dio_blocks, db);
+}
+
+void
+xfs_iomap_dio_blocks_free(
+	struct xfs_inode	*ip)
+{
+	struct xfs_inode_io	*io = ip->i_io;
+
+	if (!io)
+		return;
+	ASSERT(!io->iio_dio_blocks ||
+	       list_empty(&io->iio_dio_blocks->db_ranges));
+	kmem_free(io->iio_dio_blocks);
+	io->iio_dio_blocks = NULL;
+}
+
+static bool
+xfs_dio_range_trylock(
+	struct xfs_dio_blocks	*db,
+	struct xfs_dio_range	*dr)
+{
+	struct xfs_dio_range	*cur;
+
+	spin_lock(&db->db_wait.lock);
+	list_for_each_entry(cur, &db->db_ranges, dr_list) {
+		if (cur->dr_start < dr->dr_end && dr->dr_start < cur->dr_end &&
+		    (cur->dr_unaligned || dr->dr_unaligned)) {
+			spin_unlock(&db->db_wait.lock);
+			return false;
+		}
+	}
+	list_add_tail(&dr->dr_list, &db->db_ranges);
+	spin_unlock(&db->db_wait.lock);
+	return true;
+}
+
+/*
+ * Register a direct write of count bytes at pos, waiting for conflicting
+ * writes to complete first.  Must be called with the iolock held.  Sets *drp
+ * to NULL if the inode doesn't track direct writes.
+ */
+int
+xfs_iomap_dio_range_start(
+	struct xfs_inode	*ip,
+	xfs_off_t		pos,
+	size_t			count,
+	bool			unaligned,
+	bool			nowait,
+	struct xfs_dio_range	**drp)
+{
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
+	struct xfs_dio_blocks	*db;
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_dio_range	*dr;
+
+	ASSERT(xfs_isilocked(ip, XFS_IOLOCK_SHARED | XFS_IOLOCK_EXCL));
+
+	*drp = NULL;
+	db = io ? READ_ONCE(io->iio_dio_blocks) : NULL;
+	if (!db)
+		return 0;
+
+	dr = kmem_alloc(sizeof(*dr), KM_NOFS);
+	dr->dr_start = round_down(pos, mp->m_sb.sb_blocksize);
+	dr->dr_end = round_up(pos + count, mp->m_sb.sb_blocksize);
+	dr->dr_unaligned = unaligned;
+	dr->dr_done = false;
+	atomic_set(&dr->dr_ref, 2);
+
+	if (!xfs_dio_range_trylock(db, dr)) {
+		if (nowait) {
+			kmem_free(dr);
+			return -EAGAIN;
+		}
+		wait_event(db->db_wait, xfs_dio_range_trylock(db, dr));
+	}
+	*drp = dr;
+	return 0;
+}
+
+static void
+xfs_dio_range_put(
+	struct xfs_dio_range	*dr)
+{
+	if (atomic_dec_and_test(&dr->dr_ref))
+		kmem_free(dr);
+}
+
+/*
+ * The write's completion, including any unwritten extent conversion, has
+ * finished: let conflicting writes go ahead.
+ */
+void
+xfs_iomap_dio_range_end(
+	struct xfs_inode	*ip,
+	struct xfs_dio_range	*dr)
+{
+	struct xfs_dio_blocks	*db = ip->i_io->iio_dio_blocks;
+
+	spin_lock(&db->db_wait.lock);
+	ASSERT(!dr->dr_done);
+	list_del(&dr->dr_list);
+	dr->dr_done = true;
+	wake_up_locked(&db->db_wait);
+	spin_unlock(&db->db_wait.lock);
+	xfs_dio_range_put(dr);
+}
+
+/*
+ * Drop the submitter's reference once iomap_dio_rw has returned.  If the I/O
+ * wasn't queued, the completion has either already run in our context or
+ * will never run, in which case we have to end the range ourselves.
+ */
+void
+xfs_iomap_dio_range_finish(
+	struct xfs_inode	*ip,
+	struct xfs_dio_range	*dr,
+	bool			queued)
+{
+	if (!queued && !dr->dr_done)
+		xfs_iomap_dio_range_end(ip, dr);
+	xfs_dio_range_put(dr);
+}
+
 static inline bool imap_needs_alloc(struct inode *inode,
 		struct xfs_bmbt_irec *imap, int nimaps)
 {
@@ -948,6 +1473,45 @@ static inline bool imap_needs_alloc(struct inode *inode,
 		(IS_DAX(inode) && imap->br_state == XFS_EXT_UNWRITTEN);
 }
 
+/*
+ * Synchronous DAX faults.
+ *
+ * Applications on persistent memory want to make stores through a DAX
+ * mapping durable by flushing CPU caches, without calling fsync.  That only
+ * works if the block allocation behind the mapping is already on stable
+ * storage by the time the page becomes writable.  For files marked
+ * synchronous (the sync inode flag, or a sync mount) we therefore force the
+ * log up to the allocation before handing the new mapping back to the DAX
+ * fault code, which is what inserts the writable page table entry.
+ */
+static inline bool
+xfs_iomap_sync_fault(
+	struct inode		*inode,
+	unsigned		flags)
+{
+	return (flags & (IOMAP_WRITE | IOMAP_FAULT)) ==
+			(IOMAP_WRITE | IOMAP_FAULT) &&
+	       IS_DAX(inode) && IS_SYNC(inode);
+}
+
+STATIC int
+xfs_iomap_sync_alloc(
+	struct xfs_inode	*ip)
+{
+	xfs_lsn_t		lsn = 0;
+
+	xfs_ilock(ip, XFS_ILOCK_SHARED);
+	if (xfs_ipincount(ip) &&
+	    (ip->i_itemp->ili_fsync_fields & ~XFS_ILOG_TIMESTAMP))
+		lsn = ip->i_itemp->ili_last_lsn;
+	xfs_iunlock(ip, XFS_ILOCK_SHARED);
+
+	if (!lsn)
+		return 0;
+	trace_xfs_iomap_sync_fault(ip);
+	return _xfs_log_force_lsn(ip->i_mount, lsn, XFS_LOG_SYNC, NULL);
+}
+
 static inline bool need_excl_ilock(struct xfs_inode *ip, unsigned flags)
 {
 	/*
@@ -961,6 +1525,126 @@ static inline bool need_excl_ilock(struct xfs_inode *ip, unsigned flags)
 	return false;
 }
 
+/*
+ * Direct overwrites of written extents don't change the extent map, so we
+ * remember the extent that the last one landed in and let later overwrites
+ * inside it skip the ILOCK and the extent lookup altogether.  The cached
+ * mapping is only trusted while the data fork sequence number is the one it
+ * was sampled under; every change to the extent list bumps it.
+ *
+ * Anything that can remap or free a written extent underneath a direct write
+ * (truncate, hole punching, reflink, extent swapping) takes the IOLOCK
+ * exclusively and waits for direct I/O, which is no different from what
+ * protects the mapping once the slow path has dropped the ILOCK.  Reflinked
+ * inodes never use the cache as their overwrites may need a CoW fork lookup.
+ */
+static inline bool
+xfs_iomap_dio_overwrite(
+	struct xfs_inode	*ip,
+	unsigned		flags)
+{
+	return (flags & (IOMAP_WRITE | IOMAP_DIRECT)) ==
+			(IOMAP_WRITE | IOMAP_DIRECT) &&
+	       !xfs_is_reflink_inode(ip) && !IS_DAX(VFS_I(ip));
+}
+
+STATIC bool
+xfs_iomap_dio_map_lookup(
+	struct xfs_inode	*ip,
+	xfs_fileoff_t		offset_fsb,
+	xfs_fileoff_t		end_fsb,
+	struct xfs_bmbt_irec	*imap)
+{
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
+	unsigned int		seq;
+	unsigned int		fseq;
+
+	if (!io)
+		return false;
+	do {
+		seq = read_seqcount_begin(&io->iio_dio_mapseq);
+		*imap = io->iio_dio_map;
+		fseq = io->iio_dio_map_fseq;
+	} while (read_seqcount_retry(&io->iio_dio_mapseq, seq));
+
+	if (!imap->br_blockcount || fseq != READ_ONCE(ip->i_df.if_seq))
+		return false;
+	if (offset_fsb < imap->br_startoff ||
+	    end_fsb > imap->br_startoff + imap->br_blockcount)
+		return false;
+
+	xfs_trim_extent(imap, offset_fsb, end_fsb - offset_fsb);
+	return true;
+}
+
+/*
+ * Cache the whole written extent containing offset_fsb for later direct
+ * overwrites.  Called with the ILOCK held exclusively.
+ */
+STATIC void
+xfs_iomap_dio_map_cache(
+	struct xfs_inode	*ip,
+	xfs_fileoff_t		offset_fsb)
+{
+	struct xfs_inode_io	*io = xfs_inode_io_get(ip);
+	struct xfs_bmbt_irec	got;
+	xfs_extnum_t		idx;
+
+	ASSERT(xfs_isilocked(ip, XFS_ILOCK_EXCL));
+
+	if (!xfs_iext_lookup_extent(ip, &ip->i_df, offset_fsb, &idx, &got) ||
+	    got.br_startoff > offset_fsb ||
+	    isnullstartblock(got.br_startblock) ||
+	    got.br_state != XFS_EXT_NORM)
+		return;
+
+	write_seqcount_begin(&io->iio_dio_mapseq);
+	io->iio_dio_map = got;
+	io->iio_dio_map_fseq = ip->i_df.if_seq;
+	write_seqcount_end(&io->iio_dio_mapseq);
+}
+
+/*
+ * Is the whole range, rounded out to filesystem blocks, mapped by written
+ * extents?  A direct write into such a range never needs sub-block zeroing,
+ * so unaligned writers to it don't have to be serialised against each other,
+ * and a DAX write into it never allocates.
+ * The caller holds the IOLOCK, which keeps the range from being punched out
+ * or converted back to unwritten underneath it.
+ */
+bool
+xfs_iomap_dio_written(
+	struct xfs_inode	*ip,
+	xfs_off_t		offset,
+	size_t			count)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_bmbt_irec	imap;
+	xfs_fileoff_t		offset_fsb = XFS_B_TO_FSBT(mp, offset);
+	xfs_fileoff_t		end_fsb = XFS_B_TO_FSB(mp, offset + count);
+	unsigned		lockmode;
+	int			nimaps;
+	bool			written = true;
+
+	ASSERT(xfs_isilocked(ip, XFS_IOLOCK_EXCL | XFS_IOLOCK_SHARED));
+
+	lockmode = xfs_ilock_data_map_shared(ip);
+	while (offset_fsb < end_fsb) {
+		nimaps = 1;
+		if (xfs_bmapi_read(ip, offset_fsb, end_fsb - offset_fsb,
+				   &imap, &nimaps, 0) || !nimaps ||
+		    imap.br_startblock == HOLESTARTBLOCK ||
+		    isnullstartblock(imap.br_startblock) ||
+		    imap.br_state != XFS_EXT_NORM) {
+			written = false;
+			break;
+		}
+		offset_fsb = imap.br_startoff + imap.br_blockcount;
+	}
+	xfs_iunlock(ip, lockmode);
+	return written;
+}
+
 static int
 xfs_file_iomap_begin(
 	struct inode		*inode,
@@ -981,6 +1665,28 @@ xfs_file_iomap_begin(
 	if (XFS_FORCED_SHUTDOWN(mp))
 		return -EIO;
 
+	/*
+	 * Anything that dirties page cache or writes directly goes through
+	 * here, so set up the data I/O state for writeback completion and
+	 * the allocation heuristics.
+	 */
+	if (flags & (IOMAP_WRITE | IOMAP_ZERO))
+		xfs_inode_io_get(ip);
+
+	/*
+	 * Inline data can't be mapped, so move it out to a real block before
+	 * anyone writes to the file through the iomap interface.  Readers
+	 * must not allocate blocks, so direct reads are sent back to the page
+	 * cache and anything else is refused.
+	 */
+	if (xfs_is_inline_data_inode(ip)) {
+		if (!(flags & (IOMAP_WRITE | IOMAP_ZERO)))
+			return (flags & IOMAP_DIRECT) ? -ENOTBLK : -EIO;
+		error = xfs_inline_data_to_extents(ip);
+		if (error)
+			return error;
+	}
+
 	if (((flags & (IOMAP_WRITE | IOMAP_DIRECT)) == IOMAP_WRITE) &&
 			!IS_DAX(inode) && !xfs_get_extsz_hint(ip)) {
 		/* Reserve delalloc blocks for regular writeback. */
@@ -988,7 +1694,25 @@ xfs_file_iomap_begin(
 				iomap);
 	}
 
-	if (need_excl_ilock(ip, flags)) {
+	if (xfs_iomap_dio_overwrite(ip, flags) &&
+	    offset + length <= mp->m_super->s_maxbytes &&
+	    xfs_iomap_dio_map_lookup(ip, XFS_B_TO_FSBT(mp, offset),
+			XFS_B_TO_FSB(mp, offset + length), &imap)) {
+		trace_xfs_iomap_found_cached(ip, offset, length, 0, &imap);
+		goto out_map;
+	}
+
+	if (flags & IOMAP_NOWAIT) {
+		/*
+		 * Never sleep on the ILOCK for nowait I/O.  Reading in the
+		 * extent list needs the lock exclusive, but we bail out below
+		 * in that case anyway, so shared is good enough here.
+		 */
+		lockmode = need_excl_ilock(ip, flags) ? XFS_ILOCK_EXCL :
+							XFS_ILOCK_SHARED;
+		if (!xfs_ilock_nowait(ip, lockmode))
+			return -EAGAIN;
+	} else if (need_excl_ilock(ip, flags)) {
 		lockmode = XFS_ILOCK_EXCL;
 		xfs_ilock(ip, XFS_ILOCK_EXCL);
 	} else {
@@ -1000,6 +1724,12 @@ xfs_file_iomap_begin(
 		goto out_unlock;
 	}
 
+	/* Writeback may have moved the data inline since we checked. */
+	if (xfs_is_inline_data_inode(ip)) {
+		error = (flags & IOMAP_DIRECT) ? -ENOTBLK : -EIO;
+		goto out_unlock;
+	}
+
 	ASSERT(offset <= mp->m_super->s_maxbytes);
 	if ((xfs_fsize_t)offset + length > mp->m_super->s_maxbytes)
 		length = mp->m_super->s_maxbytes - offset;
@@ -1076,17 +1806,34 @@ xfs_file_iomap_begin(
 		if (error)
 			return error;
 
+		if (xfs_iomap_sync_fault(inode, flags)) {
+			error = xfs_iomap_sync_alloc(ip);
+			if (error)
+				return error;
+		}
+
 		iomap->flags = IOMAP_F_NEW;
 		trace_xfs_iomap_alloc(ip, offset, length, 0, &imap);
 	} else {
 		ASSERT(nimaps);
 
+		if (xfs_iomap_dio_overwrite(ip, flags))
+			xfs_iomap_dio_map_cache(ip, offset_fsb);
 		xfs_iunlock(ip, lockmode);
 		trace_xfs_iomap_found(ip, offset, length, 0, &imap);
 	}
 
+out_map:
 	xfs_bmbt_to_iomap(ip, iomap, &imap);
 
+	/*
+	 * Tell the direct I/O code if fdatasync would still have to force
+	 * the log for this inode, so that it doesn't rely on FUA alone.
+	 */
+	if ((flags & IOMAP_WRITE) && xfs_ipincount(ip) &&
+	    (ip->i_itemp->ili_fsync_fields & ~XFS_ILOG_TIMESTAMP))
+		iomap->flags |= IOMAP_F_DIRTY;
+
 	/* optionally associate a dax device with the iomap bdev */
 	bdev = iomap->bdev;
 	if (blk_queue_dax(bdev->bd_queue))
@@ -28,6 +28,21 @@ int xfs_iomap_write_direct(struct xfs_inode *, xfs_off_t, size_t,
 int xfs_iomap_write_allocate(struct xfs_inode *, int, xfs_off_t,
 			struct xfs_bmbt_irec *);
 int xfs_iomap_write_unwritten(struct xfs_inode *, xfs_off_t, xfs_off_t);
+int xfs_iomap_write_unwritten_batch(struct xfs_inode *, xfs_off_t, xfs_off_t,
+			bool);
+void xfs_iomap_unwritten_batch_free(struct xfs_inode *);
+int xfs_iomap_reserve_fault_run(struct xfs_inode *, xfs_fileoff_t,
+			xfs_fileoff_t *, xfs_fileoff_t *);
+bool xfs_iomap_dio_written(struct xfs_inode *, xfs_off_t, size_t);
+
+struct xfs_dio_range;
+void xfs_iomap_dio_blocks_init(struct xfs_inode *);
+void xfs_iomap_dio_blocks_free(struct xfs_inode *);
+int xfs_iomap_dio_range_start(struct xfs_inode *, xfs_off_t, size_t, bool,
+			bool, struct xfs_dio_range **);
+void xfs_iomap_dio_range_end(struct xfs_inode *, struct xfs_dio_range *);
+void xfs_iomap_dio_range_finish(struct xfs_inode *, struct xfs_dio_range *,
+			bool);
 
 void xfs_bmbt_to_iomap(struct xfs_inode *, struct iomap *,
 		struct xfs_bmbt_irec *);
@@ -39,6 +39,7 @@
 #include "xfs_trans_space.h"
 #include "xfs_pnfs.h"
 #include "xfs_iomap.h"
+#include "xfs_reflink.h"
 
 #include <linux/capability.h>
 #include <linux/xattr.h>
@@ -455,6 +456,7 @@ xfs_vn_get_link(
 	struct delayed_call	*done)
 {
 	char			*link;
+	const char		*cached;
 	int			error = -ENOMEM;
 
 	if (!dentry)
@@ -468,6 +470,16 @@ xfs_vn_get_link(
 	if (unlikely(error))
 		goto out_kfree;
 
+	/*
+	 * Once the target is cached in i_link the VFS uses it directly and
+	 * we won't be called for this inode again.
+	 */
+	cached = xfs_readlink_cache_set(XFS_I(d_inode(dentry)), link);
+	if (cached) {
+		kfree(link);
+		return cached;
+	}
+
 	set_delayed_call(done, kfree_link, link);
 	return link;
 
@@ -1055,11 +1067,42 @@ xfs_vn_update_time(
 
 	trace_xfs_update_time(ip);
 
+	/*
+	 * With lazytime, pure timestamp updates only dirty the VFS inode and
+	 * skip the transaction (and with it the log reservation) entirely.
+	 * xfs_fs_dirty_inode logs them once writeback, fsync or the final
+	 * iput decide they have to hit the disk.  Changes to i_version must
+	 * still be logged right away.
+	 *
+	 * The VFS only expires dirty timestamps after half a day, which is a
+	 * long time to lose mtime updates for a file that is being rewritten
+	 * in place the whole time.  Once the lazy timestamps are older than
+	 * xfs_lazytime_secs log them here instead, which also clears the
+	 * lazy state again.  inode->dirtied_time_when isn't updated while
+	 * the inode has dirty pages, so keep our own stamp with the data I/O
+	 * state.  Only writes update mtime, so a file that was never written
+	 * has no mtime updates to lose and its atime is left to the VFS.
+	 */
+	if ((inode->i_sb->s_flags & MS_LAZYTIME) && !(flags & S_VERSION)) {
+		struct xfs_inode_io	*io;
+
+		io = (flags & S_MTIME) ? xfs_inode_io_get(ip) :
+					 READ_ONCE(ip->i_io);
+		if (!io)
+			return generic_update_time(inode, now, flags);
+		if (!(inode->i_state & I_DIRTY_TIME))
+			io->iio_lazytime_stamp = jiffies;
+		if (time_before(jiffies, io->iio_lazytime_stamp +
+					 xfs_lazytime_secs * HZ))
+			return generic_update_time(inode, now, flags);
+	}
+
 	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_fsyncts, 0, 0, 0, &tp);
 	if (error)
 		return error;
 
 	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	xfs_iflags_clear(ip, XFS_ILAZYTIME);
 	if (flags & S_CTIME)
 		inode->i_ctime = *now;
 	if (flags & S_MTIME)
@@ -1072,6 +1115,124 @@ xfs_vn_update_time(
 	return xfs_trans_commit(tp);
 }
 
+STATIC int
+xfs_fiemap_fill(
+	struct xfs_inode		*ip,
+	struct fiemap_extent_info	*fieinfo,
+	struct xfs_bmbt_irec		*irec,
+	u32				flags)
+{
+	struct xfs_mount		*mp = ip->i_mount;
+	u64				physical = 0;
+
+	if (isnullstartblock(irec->br_startblock))
+		flags |= FIEMAP_EXTENT_DELALLOC | FIEMAP_EXTENT_UNKNOWN;
+	else
+		physical = BBTOB(xfs_fsb_to_db(ip, irec->br_startblock));
+	if (irec->br_state == XFS_EXT_UNWRITTEN)
+		flags |= FIEMAP_EXTENT_UNWRITTEN;
+
+	return fiemap_fill_next_extent(fieinfo,
+			XFS_FSB_TO_B(mp, irec->br_startoff), physical,
+			XFS_FSB_TO_B(mp, irec->br_blockcount), flags);
+}
+
+/*
+ * Report the data fork mappings by walking the in-core extent list under a
+ * single ILOCK hold rather than calling ->iomap_begin for every extent.  Each
+ * mapping is held back until the next one is found so that the final one in
+ * the range can be flagged FIEMAP_EXTENT_LAST.
+ */
+STATIC int
+xfs_fiemap_data(
+	struct xfs_inode		*ip,
+	struct fiemap_extent_info	*fieinfo,
+	u64				start,
+	u64				length)
+{
+	struct xfs_mount		*mp = ip->i_mount;
+	struct xfs_ifork		*ifp = XFS_IFORK_PTR(ip, XFS_DATA_FORK);
+	struct xfs_bmbt_irec		got, rec, prev;
+	xfs_fileoff_t			offset_fsb = XFS_B_TO_FSBT(mp, start);
+	xfs_fileoff_t			end_fsb = XFS_B_TO_FSB(mp, start + length);
+	xfs_extnum_t			idx;
+	u32				prev_flags = 0;
+	bool				have_prev = false;
+	bool				shared, trimmed;
+	uint				lockmode;
+	int				error;
+
+	error = fiemap_check_flags(fieinfo, FIEMAP_FLAG_SYNC);
+	if (error)
+		return error;
+
+	if (fieinfo->fi_flags & FIEMAP_FLAG_SYNC) {
+		error = filemap_write_and_wait(VFS_I(ip)->i_mapping);
+		if (error)
+			return error;
+	}
+
+	lockmode = xfs_ilock_data_map_shared(ip);
+	if (xfs_is_inline_data_inode(ip)) {
+		if (start < ifp->if_bytes)
+			error = fiemap_fill_next_extent(fieinfo, 0, 0,
+					ifp->if_bytes,
+					FIEMAP_EXTENT_DATA_INLINE |
+					FIEMAP_EXTENT_NOT_ALIGNED |
+					FIEMAP_EXTENT_LAST);
+		goto out_unlock;
+	}
+
+	if (!(ifp->if_flags & XFS_IFEXTENTS)) {
+		error = xfs_iread_extents(NULL, ip, XFS_DATA_FORK);
+		if (error)
+			goto out_unlock;
+	}
+
+	if (!xfs_iext_lookup_extent(ip, ifp, offset_fsb, &idx, &got))
+		goto out_unlock;
+
+	do {
+		if (got.br_startoff >= end_fsb)
+			break;
+		xfs_trim_extent(&got, offset_fsb, end_fsb - offset_fsb);
+
+		/* Split written extents at the boundaries of shared ranges. */
+		while (got.br_blockcount) {
+			rec = got;
+			error = xfs_reflink_trim_around_shared(ip, &rec, &shared,
+					&trimmed);
+			if (error)
+				goto out_unlock;
+
+			if (have_prev) {
+				error = xfs_fiemap_fill(ip, fieinfo, &prev,
+						prev_flags);
+				if (error)
+					goto out_unlock;
+			}
+			prev = rec;
+			prev_flags = shared ? FIEMAP_EXTENT_SHARED : 0;
+			have_prev = true;
+
+			got.br_startoff += rec.br_blockcount;
+			if (!isnullstartblock(got.br_startblock))
+				got.br_startblock += rec.br_blockcount;
+			got.br_blockcount -= rec.br_blockcount;
+		}
+	} while (xfs_iext_get_extent(ifp, ++idx, &got));
+
+	if (have_prev)
+		error = xfs_fiemap_fill(ip, fieinfo, &prev,
+				prev_flags | FIEMAP_EXTENT_LAST);
+out_unlock:
+	xfs_iunlock(ip, lockmode);
+	/* a full extent array isn't an error */
+	if (error == 1)
+		error = 0;
+	return error;
+}
+
 STATIC int
 xfs_vn_fiemap(
 	struct inode		*inode,
@@ -1087,8 +1248,7 @@ xfs_vn_fiemap(
 		error = iomap_fiemap(inode, fieinfo, start, length,
 				&xfs_xattr_iomap_ops);
 	} else {
-		error = iomap_fiemap(inode, fieinfo, start, length,
-				&xfs_iomap_ops);
+		error = xfs_fiemap_data(XFS_I(inode), fieinfo, start, length);
 	}
 	xfs_iunlock(XFS_I(inode), XFS_IOLOCK_SHARED);
 
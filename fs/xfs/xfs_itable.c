@@ -30,6 +30,10 @@
 #include "xfs_error.h"
 #include "xfs_trace.h"
 #include "xfs_icache.h"
+#include "xfs_da_format.h"
+#include "xfs_da_btree.h"
+#include "xfs_dir2.h"
+#include "xfs_dir2_priv.h"
 
 int
 xfs_internal_inum(
@@ -178,6 +182,94 @@ xfs_bulkstat_one(
 				    xfs_bulkstat_one_fmt, ubused, stat);
 }
 
+/*
+ * Return v2 stat information for one inode.  This is a formatter for
+ * xfs_bulkstat_ag() and fills in the fixed-size xfs_bstat_v2 directly from
+ * the inode rather than going through the legacy xfs_bstat structure, which
+ * truncates the link count and has ABI dependent time fields.
+ */
+int
+xfs_bulkstat_one_v2(
+	struct xfs_mount	*mp,		/* mount point for filesystem */
+	xfs_ino_t		ino,		/* inode number to get data for */
+	void __user		*buffer,	/* buffer to place output in */
+	int			ubsize,		/* size of buffer */
+	int			*ubused,	/* bytes used by me */
+	int			*stat)		/* BULKSTAT_RV_... */
+{
+	struct xfs_icdinode	*dic;
+	struct xfs_inode	*ip;
+	struct inode		*inode;
+	struct xfs_bstat_v2	bs;
+	int			error;
+
+	*stat = BULKSTAT_RV_NOTHING;
+
+	if (!buffer || xfs_internal_inum(mp, ino))
+		return -EINVAL;
+	if (ubsize < sizeof(bs))
+		return -ENOMEM;
+
+	error = xfs_iget(mp, NULL, ino,
+			 (XFS_IGET_DONTCACHE | XFS_IGET_UNTRUSTED),
+			 XFS_ILOCK_SHARED, &ip);
+	if (error)
+		return error;
+
+	ASSERT(ip != NULL);
+	ASSERT(ip->i_imap.im_blkno != 0);
+	inode = VFS_I(ip);
+	dic = &ip->i_d;
+
+	memset(&bs, 0, sizeof(bs));
+	bs.bs_ino = ino;
+	bs.bs_size = dic->di_size;
+	bs.bs_atime = inode->i_atime.tv_sec;
+	bs.bs_atime_nsec = inode->i_atime.tv_nsec;
+	bs.bs_mtime = inode->i_mtime.tv_sec;
+	bs.bs_mtime_nsec = inode->i_mtime.tv_nsec;
+	bs.bs_ctime = inode->i_ctime.tv_sec;
+	bs.bs_ctime_nsec = inode->i_ctime.tv_nsec;
+	bs.bs_uid = dic->di_uid;
+	bs.bs_gid = dic->di_gid;
+	bs.bs_projid = xfs_get_projid(ip);
+	bs.bs_nlink = inode->i_nlink;
+	bs.bs_gen = inode->i_generation;
+	bs.bs_mode = inode->i_mode;
+	bs.bs_xflags = xfs_ip2xflags(ip);
+	bs.bs_extsize = dic->di_extsize << mp->m_sb.sb_blocklog;
+	bs.bs_extents = dic->di_nextents;
+	bs.bs_aextents = dic->di_anextents;
+	bs.bs_forkoff = XFS_IFORK_BOFF(ip);
+	if (dic->di_version == 3 && (dic->di_flags2 & XFS_DIFLAG2_COWEXTSIZE))
+		bs.bs_cowextsize = dic->di_cowextsize << mp->m_sb.sb_blocklog;
+
+	switch (dic->di_format) {
+	case XFS_DINODE_FMT_DEV:
+		bs.bs_rdev = ip->i_df.if_u2.if_rdev;
+		bs.bs_blksize = BLKDEV_IOSIZE;
+		break;
+	case XFS_DINODE_FMT_LOCAL:
+	case XFS_DINODE_FMT_UUID:
+		bs.bs_blksize = mp->m_sb.sb_blocksize;
+		break;
+	case XFS_DINODE_FMT_EXTENTS:
+	case XFS_DINODE_FMT_BTREE:
+		bs.bs_blksize = mp->m_sb.sb_blocksize;
+		bs.bs_blocks = dic->di_nblocks + ip->i_delayed_blks;
+		break;
+	}
+	xfs_iunlock(ip, XFS_ILOCK_SHARED);
+	IRELE(ip);
+
+	if (copy_to_user(buffer, &bs, sizeof(bs)))
+		return -EFAULT;
+	if (ubused)
+		*ubused = sizeof(bs);
+	*stat = BULKSTAT_RV_DIDONE;
+	return 0;
+}
+
 /*
  * Loop over all clusters in a chunk for a given incore inode allocation btree
  * record.  Do a readahead if there are any allocated inodes in that cluster.
@@ -189,7 +281,7 @@ xfs_bulkstat_ichunk_ra(
 	struct xfs_inobt_rec_incore	*irec)
 {
 	xfs_agblock_t			agbno;
-	struct blk_plug			plug;
+	struct xfs_buf_ra_batch		rab;
 	int				blks_per_cluster;
 	int				inodes_per_cluster;
 	int				i;	/* inode chunk index */
@@ -198,15 +290,18 @@ xfs_bulkstat_ichunk_ra(
 	blks_per_cluster = xfs_icluster_size_fsb(mp);
 	inodes_per_cluster = blks_per_cluster << mp->m_sb.sb_inopblog;
 
-	blk_start_plug(&plug);
+	/* the clusters of a chunk are contiguous, so read them together */
+	xfs_buf_ra_batch_start(&rab);
 	for (i = 0; i < XFS_INODES_PER_CHUNK;
 	     i += inodes_per_cluster, agbno += blks_per_cluster) {
 		if (xfs_inobt_maskn(i, inodes_per_cluster) & ~irec->ir_free) {
-			xfs_btree_reada_bufs(mp, agno, agbno, blks_per_cluster,
-					     &xfs_inode_buf_ops);
+			xfs_buf_ra_batch_add(&rab, mp->m_ddev_targp,
+					XFS_AGB_TO_DADDR(mp, agno, agbno),
+					XFS_FSB_TO_BB(mp, blks_per_cluster),
+					&xfs_inode_buf_ops);
 		}
 	}
-	blk_finish_plug(&plug);
+	xfs_buf_ra_batch_finish(&rab);
 }
 
 /*
@@ -543,6 +638,441 @@ xfs_bulkstat(
 	return error;
 }
 
+/*
+ * Mark the inodes of a chunk that lie at or beyond end_agino as free so that
+ * a chunk straddling the end of the range is only partially returned.
+ * Returns true if the chunk reaches the end of the range.
+ */
+STATIC bool
+xfs_bulkstat_clamp_ichunk(
+	struct xfs_inobt_rec_incore	*irec,
+	xfs_agino_t			end_agino)
+{
+	int				idx;
+
+	if (end_agino - irec->ir_startino > XFS_INODES_PER_CHUNK)
+		return false;
+
+	idx = end_agino - irec->ir_startino;
+	if (idx < XFS_INODES_PER_CHUNK)
+		irec->ir_free |= xfs_inobt_maskn(idx,
+				XFS_INODES_PER_CHUNK - idx);
+	return true;
+}
+
+/*
+ * Return stat information in bulk for a range of inodes within a single
+ * allocation group.
+ *
+ * Callers walking different AGs do not share any state, so userspace can run
+ * one of these per AG in parallel.  *aginop is the first inode to return (0
+ * means the start of the AG) and is updated to the next inode to look at,
+ * and the walk stops before end_agino.  In addition to the chunks that are
+ * gathered for this call, the next ra_chunks allocated chunks are read ahead
+ * so that the following call does not stall on inode cluster reads.
+ */
+int
+xfs_bulkstat_ag(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
+	xfs_agino_t		*aginop,	/* in: first, out: next inode */
+	xfs_agino_t		end_agino,	/* stop before this inode */
+	int			ra_chunks,	/* chunks to read ahead */
+	bulkstat_one_pf		formatter,
+	size_t			statstruct_size,
+	char __user		*ubuffer,
+	int			*ubcountp,	/* size of buffer/count returned */
+	int			*done)
+{
+	struct xfs_buf		*agbp;
+	struct xfs_btree_cur	*cur;
+	struct xfs_inobt_rec_incore *irbuf;
+	struct xfs_bulkstat_agichunk ac;
+	xfs_agino_t		agino;	/* last inode processed */
+	int			nirbuf;
+	int			ubcount;
+	int			error = 0;
+
+	ASSERT(agno < mp->m_sb.sb_agcount);
+
+	ubcount = *ubcountp;
+	ac.ac_ubuffer = &ubuffer;
+	ac.ac_ubleft = ubcount * statstruct_size;
+	ac.ac_ubelem = 0;
+
+	*ubcountp = 0;
+	*done = 0;
+
+	/*
+	 * Inode number zero can never be in use in any AG, so the internal
+	 * "last processed" cursor of zero doubles as the start of the AG.
+	 */
+	agino = *aginop ? *aginop - 1 : 0;
+	if (*aginop >= end_agino) {
+		*done = 1;
+		return 0;
+	}
+
+	irbuf = kmem_zalloc_large(PAGE_SIZE * 4, KM_SLEEP);
+	if (!irbuf)
+		return -ENOMEM;
+	nirbuf = (PAGE_SIZE * 4) / sizeof(*irbuf);
+
+	for (;;) {
+		struct xfs_inobt_rec_incore	*irbp = irbuf;
+		struct xfs_inobt_rec_incore	*irbufend = irbuf + nirbuf;
+		struct xfs_inobt_rec_incore	r;
+		bool				end_of_range = false;
+		int				icount = 0;
+		int				stat;
+		int				i;
+
+		error = xfs_ialloc_read_agi(mp, NULL, agno, &agbp);
+		if (error)
+			break;
+		cur = xfs_inobt_init_cursor(mp, NULL, agbp, agno,
+					    XFS_BTNUM_INO);
+		if (agino > 0) {
+			error = xfs_bulkstat_grab_ichunk(cur, agino, &icount, &r);
+			if (error)
+				goto del_cursor;
+			if (icount) {
+				if (xfs_bulkstat_clamp_ichunk(&r, end_agino))
+					end_of_range = true;
+				if (r.ir_free != XFS_INOBT_ALL_FREE)
+					*irbp++ = r;
+				if (end_of_range)
+					goto del_cursor;
+			}
+			error = xfs_btree_increment(cur, 0, &stat);
+		} else {
+			error = xfs_inobt_lookup(cur, 0, XFS_LOOKUP_GE, &stat);
+		}
+		if (error || stat == 0) {
+			end_of_range = true;
+			goto del_cursor;
+		}
+
+		while (irbp < irbufend && icount < ubcount) {
+			error = xfs_inobt_get_rec(cur, &r, &stat);
+			if (error || stat == 0 || r.ir_startino >= end_agino) {
+				end_of_range = true;
+				goto del_cursor;
+			}
+
+			if (xfs_bulkstat_clamp_ichunk(&r, end_agino))
+				end_of_range = true;
+
+			if (r.ir_free != XFS_INOBT_ALL_FREE &&
+			    r.ir_freecount < r.ir_count) {
+				xfs_bulkstat_ichunk_ra(mp, agno, &r);
+				*irbp++ = r;
+				icount += r.ir_count - r.ir_freecount;
+			}
+			if (end_of_range)
+				goto del_cursor;
+
+			error = xfs_btree_increment(cur, 0, &stat);
+			if (error || stat == 0) {
+				end_of_range = true;
+				goto del_cursor;
+			}
+			cond_resched();
+		}
+
+		/*
+		 * The batch is full, so keep walking the btree to start reads
+		 * on the chunks the next call will want.  The records are not
+		 * saved; the next pass looks them up again from the cursor.
+		 */
+		for (i = 0; i < ra_chunks; i++) {
+			error = xfs_inobt_get_rec(cur, &r, &stat);
+			if (error || stat == 0 || r.ir_startino >= end_agino)
+				break;
+			if (r.ir_freecount < r.ir_count)
+				xfs_bulkstat_ichunk_ra(mp, agno, &r);
+			error = xfs_btree_increment(cur, 0, &stat);
+			if (error || stat == 0)
+				break;
+		}
+
+		/*
+		 * Drop the btree buffers and the agi buffer as we can't hold
+		 * any of the locks these represent when calling iget.
+		 */
+del_cursor:
+		xfs_btree_del_cursor(cur, error ?
+					  XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+		xfs_buf_relse(agbp);
+		if (error)
+			break;
+
+		irbufend = irbp;
+		for (irbp = irbuf;
+		     irbp < irbufend && ac.ac_ubleft >= statstruct_size;
+		     irbp++) {
+			error = xfs_bulkstat_ag_ichunk(mp, agno, irbp,
+					formatter, statstruct_size, &ac,
+					&agino);
+			if (error)
+				break;
+
+			cond_resched();
+		}
+
+		if (ac.ac_ubleft < statstruct_size || error)
+			break;
+
+		if (end_of_range) {
+			*done = 1;
+			break;
+		}
+	}
+
+	kmem_free(irbuf);
+	*ubcountp = ac.ac_ubelem;
+
+	/* As for xfs_bulkstat(), report what we found before any error. */
+	if (ac.ac_ubelem)
+		error = 0;
+
+	if (agino)
+		*aginop = agino + 1;
+	return error;
+}
+
+/*
+ * Call @fn on every allocated inode in an AG.
+ *
+ * This is for internal walkers that don't need to copy anything out, such as
+ * quotacheck.  Inode chunks are gathered a batch at a time with readahead
+ * issued for all of their clusters, then the AGI is dropped before @fn is
+ * called so that it can iget the inodes.  The walk stops at the first error
+ * returned by @fn.
+ */
+int
+xfs_inode_walk_ag(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
+	xfs_inode_walk_fn	fn,
+	void			*data)
+{
+	struct xfs_buf		*agbp;
+	struct xfs_btree_cur	*cur;
+	struct xfs_inobt_rec_incore *irbuf;
+	xfs_agino_t		next_agino = 0;
+	int			nirbuf;
+	int			error = 0;
+
+	irbuf = kmem_alloc(PAGE_SIZE, KM_SLEEP);
+	nirbuf = PAGE_SIZE / sizeof(*irbuf);
+
+	for (;;) {
+		struct xfs_inobt_rec_incore	*irbp = irbuf;
+		struct xfs_inobt_rec_incore	*irbufend = irbuf + nirbuf;
+		bool				end_of_ag = false;
+		int				stat;
+		int				i;
+
+		error = xfs_ialloc_read_agi(mp, NULL, agno, &agbp);
+		if (error)
+			break;
+		cur = xfs_inobt_init_cursor(mp, NULL, agbp, agno,
+					    XFS_BTNUM_INO);
+		error = xfs_inobt_lookup(cur, next_agino, XFS_LOOKUP_GE, &stat);
+		while (!error && stat && irbp < irbufend) {
+			error = xfs_inobt_get_rec(cur, irbp, &stat);
+			if (error || !stat)
+				break;
+			next_agino = irbp->ir_startino + XFS_INODES_PER_CHUNK;
+			if (irbp->ir_freecount < irbp->ir_count) {
+				xfs_bulkstat_ichunk_ra(mp, agno, irbp);
+				irbp++;
+			}
+			error = xfs_btree_increment(cur, 0, &stat);
+		}
+		if (!stat)
+			end_of_ag = true;
+		xfs_btree_del_cursor(cur, error ?
+					  XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+		xfs_buf_relse(agbp);
+		if (error)
+			break;
+
+		irbufend = irbp;
+		for (irbp = irbuf; irbp < irbufend && !error; irbp++) {
+			for (i = 0; i < XFS_INODES_PER_CHUNK; i++) {
+				if (XFS_INOBT_MASK(i) & irbp->ir_free)
+					continue;
+				error = fn(mp, XFS_AGINO_TO_INO(mp, agno,
+						irbp->ir_startino + i), data);
+				if (error)
+					break;
+			}
+			cond_resched();
+		}
+		if (error || end_of_ag)
+			break;
+	}
+
+	kmem_free(irbuf);
+	return error;
+}
+
+/*
+ * Readdir plus stat.
+ *
+ * A readdir followed by a stat of each name costs a path lookup and an iget
+ * per entry, and the igets land on inode clusters in whatever order the names
+ * are hashed into the directory.  Here we read a batch of entries into the
+ * caller's buffer first, then look the inodes up in inode number order so
+ * that all the inodes of a cluster are read in one go, with readahead issued
+ * for all the clusters up front.
+ */
+struct xfs_readdirstat_ent {
+	xfs_ino_t		ino;
+	unsigned int		idx;	/* slot in the user buffer */
+};
+
+struct xfs_readdirstat_ctx {
+	struct dir_context	ctx;
+	struct xfs_dirent_stat	__user *ubuffer;
+	struct xfs_readdirstat_ent *ents;
+	int			nr;
+	int			max;
+	int			error;
+};
+
+static int
+xfs_readdirstat_fill(
+	struct dir_context	*ctx,
+	const char		*name,
+	int			namelen,
+	loff_t			offset,
+	u64			ino,
+	unsigned int		d_type)
+{
+	struct xfs_readdirstat_ctx *rctx;
+	struct xfs_dirent_stat	__user *uds;
+
+	rctx = container_of(ctx, struct xfs_readdirstat_ctx, ctx);
+	if (rctx->nr == rctx->max)
+		return -ENOSPC;
+
+	uds = &rctx->ubuffer[rctx->nr];
+	if (put_user(ino, &uds->ds_ino) ||
+	    put_user(0, &uds->ds_error) ||
+	    put_user(namelen, &uds->ds_namelen) ||
+	    put_user(d_type, &uds->ds_type) ||
+	    put_user(0, &uds->ds_pad) ||
+	    copy_to_user(uds->ds_name, name, namelen) ||
+	    put_user(0, &uds->ds_name[namelen])) {
+		rctx->error = -EFAULT;
+		return -EFAULT;
+	}
+
+	rctx->ents[rctx->nr].ino = ino;
+	rctx->ents[rctx->nr].idx = rctx->nr;
+	rctx->nr++;
+	return 0;
+}
+
+static int
+xfs_readdirstat_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct xfs_readdirstat_ent *ea = a;
+	const struct xfs_readdirstat_ent *eb = b;
+
+	if (ea->ino < eb->ino)
+		return -1;
+	return ea->ino > eb->ino;
+}
+
+/*
+ * Read up to *count entries of directory dp from the cookie *pos and stat
+ * them.  On return *pos is the cookie of the next entry, *count the number of
+ * entries returned and *done is set if the end of the directory was reached.
+ */
+int
+xfs_readdirstat(
+	struct xfs_inode	*dp,
+	loff_t			*pos,
+	struct xfs_dirent_stat	__user *ubuffer,
+	int			*count,
+	int			*done)
+{
+	struct xfs_mount	*mp = dp->i_mount;
+	struct inode		*inode = VFS_I(dp);
+	struct xfs_readdirstat_ctx rctx = {
+		.ctx.actor	= xfs_readdirstat_fill,
+		.ctx.pos	= *pos,
+		.ubuffer	= ubuffer,
+		.max		= *count,
+	};
+	struct xfs_dirent_stat	__user *uds;
+	xfs_daddr_t		last_blkno = 0;
+	struct xfs_buf_ra_batch	rab;
+	size_t			bufsize;
+	int			stat;
+	int			i;
+	int			error;
+
+	ASSERT(*count > 0 && *count <= XFS_READDIRSTAT_MAX);
+
+	rctx.ents = kmem_alloc_large(*count * sizeof(*rctx.ents),
+			KM_SLEEP | KM_MAYFAIL);
+	if (!rctx.ents)
+		return -ENOMEM;
+
+	bufsize = (size_t)min_t(loff_t, 32768, dp->i_d.di_size);
+	inode_lock_shared(inode);
+	if (IS_DEADDIR(inode))
+		error = -ENOENT;
+	else
+		error = xfs_readdir(NULL, dp, &rctx.ctx, bufsize, NULL);
+	inode_unlock_shared(inode);
+	if (!error)
+		error = rctx.error;
+	if (error)
+		goto out_free;
+
+	*pos = rctx.ctx.pos;
+	*count = rctx.nr;
+	*done = rctx.nr < rctx.max;
+
+	/* Visit the inodes in disk order, one cluster at a time. */
+	sort(rctx.ents, rctx.nr, sizeof(*rctx.ents), xfs_readdirstat_cmp, NULL);
+	xfs_buf_ra_batch_start(&rab);
+	for (i = 0; i < rctx.nr; i++)
+		xfs_dir2_inode_readahead(mp, rctx.ents[i].ino, &last_blkno,
+					 &rab);
+	xfs_buf_ra_batch_finish(&rab);
+
+	for (i = 0; i < rctx.nr; i++) {
+		uds = &ubuffer[rctx.ents[i].idx];
+		error = xfs_bulkstat_one_v2(mp, rctx.ents[i].ino,
+				&uds->ds_bstat, sizeof(uds->ds_bstat), NULL,
+				&stat);
+		if (error == -EFAULT)
+			goto out_free;
+		if (error) {
+			if (clear_user(&uds->ds_bstat, sizeof(uds->ds_bstat)) ||
+			    put_user(-error, &uds->ds_error)) {
+				error = -EFAULT;
+				goto out_free;
+			}
+			error = 0;
+		}
+		cond_resched();
+	}
+
+out_free:
+	kmem_free(rctx.ents);
+	return error;
+}
+
 int
 xfs_inumbers_fmt(
 	void			__user *ubuffer, /* buffer to write to */
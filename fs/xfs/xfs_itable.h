@@ -50,6 +50,41 @@ xfs_bulkstat(
 	char		__user *ubuffer,/* buffer with inode stats */
 	int		*done);		/* 1 if there are more stats to get */
 
+/*
+ * Default and maximum number of inode chunks read ahead by xfs_bulkstat_ag()
+ * beyond the chunks being returned.
+ */
+#define XFS_BULKSTAT_RA_CHUNKS		16
+#define XFS_BULKSTAT_RA_CHUNKS_MAX	1024
+
+/*
+ * Return stat information in bulk for a range of inodes in one AG.
+ */
+int
+xfs_bulkstat_ag(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno,
+	xfs_agino_t		*aginop,
+	xfs_agino_t		end_agino,
+	int			ra_chunks,
+	bulkstat_one_pf		formatter,
+	size_t			statstruct_size,
+	char			__user *ubuffer,
+	int			*count,
+	int			*done);
+
+/* Largest number of entries returned by one xfs_readdirstat() call. */
+#define XFS_READDIRSTAT_MAX		4096
+
+int xfs_readdirstat(struct xfs_inode *dp, loff_t *pos,
+		struct xfs_dirent_stat __user *ubuffer, int *count, int *done);
+
+typedef int (*xfs_inode_walk_fn)(struct xfs_mount *mp, xfs_ino_t ino,
+		void *data);
+
+int xfs_inode_walk_ag(struct xfs_mount *mp, xfs_agnumber_t agno,
+		xfs_inode_walk_fn fn, void *data);
+
 typedef int (*bulkstat_one_fmt_pf)(  /* used size in bytes or negative error */
 	void			__user *ubuffer, /* buffer to write to */
 	int			ubsize,		 /* remaining user buffer sz */
@@ -75,6 +110,15 @@ xfs_bulkstat_one(
 	int			*ubused,
 	int			*stat);
 
+int
+xfs_bulkstat_one_v2(
+	struct xfs_mount	*mp,
+	xfs_ino_t		ino,
+	void			__user *buffer,
+	int			ubsize,
+	int			*ubused,
+	int			*stat);
+
 typedef int (*inumbers_fmt_pf)(
 	void			__user *ubuffer, /* buffer to write to */
 	const xfs_inogrp_t	*buffer,	/* buffer to read from */
@@ -48,6 +48,7 @@ typedef __u32			xfs_nlink_t;
 #include <linux/swap.h>
 #include <linux/errno.h>
 #include <linux/sched/signal.h>
+#include <linux/sched/task_stack.h>
 #include <linux/bitops.h>
 #include <linux/major.h>
 #include <linux/pagemap.h>
@@ -110,6 +111,15 @@ typedef __u32			xfs_nlink_t;
 #define xfs_fstrm_centisecs	xfs_params.fstrm_timer.val
 #define xfs_eofb_secs		xfs_params.eofb_timer.val
 #define xfs_cowb_secs		xfs_params.cowb_timer.val
+#define xfs_trim_mbps		xfs_params.trim_mbps.val
+#define xfs_trim_iops		xfs_params.trim_iops.val
+#define xfs_discard_centisecs	xfs_params.discard_timer.val
+#define xfs_scrub_idle_io	xfs_params.scrub_idle_io.val
+#define xfs_scrub_latency_ms	xfs_params.scrub_lat_ms.val
+#define xfs_scrub_frag_extents	xfs_params.scrub_frag_ext.val
+#define xfs_lazytime_secs	xfs_params.lazytime_age.val
+#define xfs_cil_push_latency_ms	xfs_params.cil_push_lat_ms.val
+#define xfs_statfs_cache_ms	xfs_params.statfs_ms.val
 
 #define current_cpu()		(raw_smp_processor_id())
 #define current_pid()		(current->pid)
@@ -36,6 +36,7 @@
 #include "xfs_sb.h"
 
 kmem_zone_t	*xfs_log_ticket_zone;
+mempool_t	*xfs_log_ticket_pool;
 
 /* Local miscellaneous function prototypes */
 STATIC int
@@ -52,10 +53,6 @@ xlog_alloc_log(
 	xfs_daddr_t		blk_offset,
 	int			num_bblks);
 STATIC int
-xlog_space_left(
-	struct xlog		*log,
-	atomic64_t		*head);
-STATIC int
 xlog_sync(
 	struct xlog		*log,
 	struct xlog_in_core	*iclog);
@@ -190,6 +187,122 @@ xlog_grant_add_space(
 	} while (head_val != old);
 }
 
+/*
+ * Return all cached grant space to the grant heads.  This is called by
+ * anyone who is about to wait for log space so that space parked in the
+ * per-cpu caches can never starve a waiter.  Returns true if any space was
+ * given back, in which case the caller is responsible for waking waiters.
+ */
+STATIC bool
+xlog_grant_cache_drain(
+	struct xlog		*log)
+{
+	int			cpu;
+	int			bytes;
+	bool			drained = false;
+
+	if (!log->l_grant_chunk)
+		return false;
+
+	for_each_possible_cpu(cpu) {
+		bytes = atomic_xchg(per_cpu_ptr(log->l_grant_cache, cpu), 0);
+		if (!bytes)
+			continue;
+		xlog_grant_sub_space(log, &log->l_reserve_head.grant, bytes);
+		xlog_grant_sub_space(log, &log->l_write_head.grant, bytes);
+		drained = true;
+	}
+	return drained;
+}
+
+/*
+ * Sum up the space currently parked in the grant caches.  This walks every
+ * CPU, so only use it on slow paths.
+ */
+STATIC int
+xlog_grant_cache_bytes(
+	struct xlog		*log)
+{
+	int			cpu;
+	int			bytes = 0;
+
+	if (!log->l_grant_chunk)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		bytes += atomic_read(per_cpu_ptr(log->l_grant_cache, cpu));
+	return bytes;
+}
+
+/*
+ * Try to satisfy a reservation from this CPU's grant space cache.  The bytes
+ * taken have already been accounted in both grant heads, so the caller must
+ * not add them again.  Tickets queued for log space have priority over the
+ * caches, so don't use them while anyone is waiting.
+ */
+STATIC bool
+xlog_grant_cache_get(
+	struct xlog		*log,
+	int			need_bytes)
+{
+	atomic_t		*cache;
+	int			old, cur;
+
+	if (need_bytes > log->l_grant_chunk)
+		return false;
+	if (!list_empty_careful(&log->l_reserve_head.waiters) ||
+	    !list_empty_careful(&log->l_write_head.waiters))
+		return false;
+
+	cache = raw_cpu_ptr(log->l_grant_cache);
+	cur = atomic_read(cache);
+	do {
+		if (cur < need_bytes)
+			return false;
+		old = cur;
+		cur = atomic_cmpxchg(cache, old, old - need_bytes);
+	} while (cur != old);
+	return true;
+}
+
+/*
+ * Top up this CPU's grant space cache after a reservation went through the
+ * grant heads.  We leave at least a quarter of the log uncached so that
+ * the caches only ever hold space that nobody else is short of.  If a waiter
+ * showed up while we were refilling, give everything back and wake it.
+ * Nothing gets parked once unmount has started, as the caches would otherwise
+ * hold on to space after the final drain in xfs_log_quiesce().
+ */
+STATIC void
+xlog_grant_cache_refill(
+	struct xlog		*log)
+{
+	int			chunk = log->l_grant_chunk;
+	int			reserve = chunk + (log->l_logsize >> 2);
+
+	if (!chunk || READ_ONCE(log->l_grant_nocache))
+		return;
+	if (atomic_read(raw_cpu_ptr(log->l_grant_cache)) >= chunk)
+		return;
+	if (!list_empty_careful(&log->l_reserve_head.waiters) ||
+	    !list_empty_careful(&log->l_write_head.waiters))
+		return;
+	if (xlog_space_left(log, &log->l_reserve_head.grant) < reserve ||
+	    xlog_space_left(log, &log->l_write_head.grant) < reserve)
+		return;
+
+	xlog_grant_add_space(log, &log->l_reserve_head.grant, chunk);
+	xlog_grant_add_space(log, &log->l_write_head.grant, chunk);
+	atomic_add(chunk, raw_cpu_ptr(log->l_grant_cache));
+	smp_mb__after_atomic();
+
+	if (!list_empty_careful(&log->l_reserve_head.waiters) ||
+	    !list_empty_careful(&log->l_write_head.waiters)) {
+		xlog_grant_cache_drain(log);
+		xfs_log_space_wake(log->l_mp);
+	}
+}
+
 STATIC void
 xlog_grant_head_init(
 	struct xlog_grant_head	*head)
@@ -258,6 +371,8 @@ xlog_grant_head_wait(
 	int			need_bytes) __releases(&head->lock)
 					    __acquires(&head->lock)
 {
+	ktime_t			start = ktime_get();
+
 	list_add_tail(&tic->t_queue, &head->waiters);
 
 	do {
@@ -266,6 +381,18 @@ xlog_grant_head_wait(
 		xlog_grant_push_ail(log, need_bytes);
 
 		__set_current_state(TASK_UNINTERRUPTIBLE);
+
+		/*
+		 * Now that we are on the waiter list nobody refills the grant
+		 * caches any more, but a refill may have raced with us being
+		 * queued.  Pull back what it parked and hand it out in queue
+		 * order, which may well wake us up again straight away.
+		 */
+		if (xlog_grant_cache_drain(log)) {
+			int	free_bytes = xlog_space_left(log, &head->grant);
+
+			xlog_grant_head_wake(log, head, &free_bytes);
+		}
 		spin_unlock(&head->lock);
 
 		XFS_STATS_INC(log->l_mp, xs_sleep_logspace);
@@ -280,6 +407,9 @@ xlog_grant_head_wait(
 	} while (xlog_space_left(log, &head->grant) < need_bytes);
 
 	list_del_init(&tic->t_queue);
+	XFS_STATS_LAT(log->l_mp, XFS_LAT_LOG_RESV, start);
+	XFS_STATS_ADD(log->l_mp, xs_log_space_wait_us,
+		      ktime_us_delta(ktime_get(), start));
 	return 0;
 shutdown:
 	list_del_init(&tic->t_queue);
@@ -323,6 +453,18 @@ xlog_grant_head_check(
 	 */
 	*need_bytes = xlog_ticket_reservation(log, head, tic);
 	free_bytes = xlog_space_left(log, &head->grant);
+
+	/*
+	 * Before we either queue behind other waiters or go to sleep ourselves,
+	 * give back the space parked in the per-cpu grant caches and let the
+	 * tickets already on the queues have first go at it.
+	 */
+	if ((!list_empty_careful(&head->waiters) || free_bytes < *need_bytes) &&
+	    xlog_grant_cache_drain(log)) {
+		xfs_log_space_wake(log->l_mp);
+		free_bytes = xlog_space_left(log, &head->grant);
+	}
+
 	if (!list_empty_careful(&head->waiters)) {
 		spin_lock(&head->lock);
 		if (!xlog_grant_head_wake(log, head, &free_bytes) ||
@@ -462,6 +604,10 @@ xfs_log_reserve(
 
 	trace_xfs_log_reserve(log, tic);
 
+	need_bytes = xlog_ticket_reservation(log, &log->l_reserve_head, tic);
+	if (xlog_grant_cache_get(log, need_bytes))
+		goto out_granted;
+
 	error = xlog_grant_head_check(log, &log->l_reserve_head, tic,
 				      &need_bytes);
 	if (error)
@@ -469,6 +615,8 @@ xfs_log_reserve(
 
 	xlog_grant_add_space(log, &log->l_reserve_head.grant, need_bytes);
 	xlog_grant_add_space(log, &log->l_write_head.grant, need_bytes);
+	xlog_grant_cache_refill(log);
+out_granted:
 	trace_xfs_log_reserve_exit(log, tic);
 	xlog_verify_grant_tail(log);
 	return 0;
@@ -933,6 +1081,7 @@ xfs_log_quiesce(
 	struct xfs_mount	*mp)
 {
 	cancel_delayed_work_sync(&mp->m_log->l_work);
+	xlog_grant_cache_drain(mp->m_log);
 	xfs_log_force(mp, XFS_LOG_SYNC);
 
 	/*
@@ -950,6 +1099,45 @@ xfs_log_quiesce(
 	xfs_log_unmount_write(mp);
 }
 
+/*
+ * Quiesce the log for a fast freeze.
+ *
+ * Everything committed so far is forced into the log, and then metadata
+ * writeback stops with the AIL still dirty, so the freeze only has to wait
+ * for the log rather than for all dirty metadata to be written back in
+ * place.  No unmount record is written, so an image of the frozen device
+ * needs log recovery when it is mounted.  The caller must have logged
+ * anything else it needs in the log before calling this: with the AIL
+ * paused, nothing that needs log space can make progress until
+ * xfs_log_unquiesce_fast() is called, which unmount does for a filesystem
+ * that was never thawed.
+ */
+void
+xfs_log_quiesce_fast(
+	struct xfs_mount	*mp)
+{
+	cancel_delayed_work_sync(&mp->m_log->l_work);
+	xfs_log_force(mp, XFS_LOG_SYNC);
+
+	/*
+	 * Stop pushing the AIL and wait for the writes the last push issued,
+	 * including the uncached superblock buffer, so that nothing is
+	 * written in place while we are frozen.
+	 */
+	xfs_ail_pause(mp->m_ail);
+	xfs_buftarg_wait_io(mp->m_ddev_targp);
+	xfs_buf_lock(mp->m_sb_bp);
+	xfs_buf_unlock(mp->m_sb_bp);
+}
+
+/* Restart the metadata writeback stopped by xfs_log_quiesce_fast(). */
+void
+xfs_log_unquiesce_fast(
+	struct xfs_mount	*mp)
+{
+	xfs_ail_resume(mp->m_ail);
+}
+
 /*
  * Shut down and release the AIL and Log.
  *
@@ -961,6 +1149,7 @@ void
 xfs_log_unmount(
 	struct xfs_mount	*mp)
 {
+	WRITE_ONCE(mp->m_log->l_grant_nocache, true);
 	xfs_log_quiesce(mp);
 
 	xfs_trans_ail_destroy(mp);
@@ -1019,6 +1208,20 @@ xfs_log_space_wake(
 	}
 }
 
+/*
+ * Are there transactions blocked waiting for log space?  If so, pushing the
+ * AIL is on their critical path rather than background work.
+ */
+bool
+xfs_log_space_waiters(
+	struct xfs_mount	*mp)
+{
+	struct xlog		*log = mp->m_log;
+
+	return !list_empty_careful(&log->l_reserve_head.waiters) ||
+	       !list_empty_careful(&log->l_write_head.waiters);
+}
+
 /*
  * Determine if we have a transaction that has gone to disk that needs to be
  * covered. To begin the transition to the idle state firstly the log needs to
@@ -1130,7 +1333,7 @@ xlog_assign_tail_lsn(
  * the tail.  The details of this case are described below, but the end
  * result is that we return the size of the log as the amount of space left.
  */
-STATIC int
+int
 xlog_space_left(
 	struct xlog	*log,
 	atomic64_t	*head)
@@ -1205,6 +1408,8 @@ xlog_iodone(xfs_buf_t *bp)
 		aborted = XFS_LI_ABORTED;
 	} else if (iclog->ic_state & XLOG_STATE_IOERROR) {
 		aborted = XFS_LI_ABORTED;
+	} else if (bp->b_flags & XBF_FLUSH) {
+		xfs_buftarg_flushed(l->l_mp->m_ddev_targp, iclog->ic_flush_seq);
 	}
 
 	/* log I/O is always issued ASYNC */
@@ -1227,6 +1432,12 @@ xlog_iodone(xfs_buf_t *bp)
  *
  * If the filesystem blocksize is too large, we may need to choose a
  * larger size since the directory code currently logs entire blocks.
+ *
+ * Version 2 logs can be asked for up to XLOG_MAX_LARGE_ICLOGS buffers of up to
+ * XLOG_MAX_LARGE_RECORD_BSIZE each for fast log devices. All the iclogs can be
+ * in flight at once and each of them pins down log space until its I/O is
+ * done, so anything beyond the traditional limits is scaled back until the
+ * ring fits into a quarter of the log.
  */
 
 STATIC void
@@ -1234,7 +1445,6 @@ xlog_get_iclog_buffer_size(
 	struct xfs_mount	*mp,
 	struct xlog		*log)
 {
-	int size;
 	int xhdrs;
 
 	if (mp->m_logbufs <= 0)
@@ -1243,43 +1453,51 @@ xlog_get_iclog_buffer_size(
 		log->l_iclog_bufs = mp->m_logbufs;
 
 	/*
-	 * Buffer size passed in from mount system call.
+	 * Buffer size passed in from mount system call, otherwise all
+	 * machines use 32kB buffers by default.
 	 */
-	if (mp->m_logbsize > 0) {
-		size = log->l_iclog_size = mp->m_logbsize;
-		log->l_iclog_size_log = 0;
-		while (size != 1) {
-			log->l_iclog_size_log++;
-			size >>= 1;
-		}
+	if (mp->m_logbsize > 0)
+		log->l_iclog_size = mp->m_logbsize;
+	else
+		log->l_iclog_size = XLOG_BIG_RECORD_BSIZE;
 
-		if (xfs_sb_version_haslogv2(&mp->m_sb)) {
-			/* # headers = size / 32k
-			 * one header holds cycles from 32k of data
-			 */
+	while (log->l_iclog_size > XLOG_MAX_RECORD_BSIZE &&
+	       log->l_iclog_bufs * log->l_iclog_size > log->l_logsize / 4)
+		log->l_iclog_size >>= 1;
+	while (log->l_iclog_bufs > XLOG_MAX_ICLOGS &&
+	       log->l_iclog_bufs * log->l_iclog_size > log->l_logsize / 4)
+		log->l_iclog_bufs--;
 
-			xhdrs = mp->m_logbsize / XLOG_HEADER_CYCLE_SIZE;
-			if (mp->m_logbsize % XLOG_HEADER_CYCLE_SIZE)
-				xhdrs++;
-			log->l_iclog_hsize = xhdrs << BBSHIFT;
-			log->l_iclog_heads = xhdrs;
-		} else {
-			ASSERT(mp->m_logbsize <= XLOG_BIG_RECORD_BSIZE);
-			log->l_iclog_hsize = BBSIZE;
-			log->l_iclog_heads = 1;
-		}
-		goto done;
+	if ((mp->m_logbufs > 0 && mp->m_logbufs != log->l_iclog_bufs) ||
+	    (mp->m_logbsize > 0 && mp->m_logbsize != log->l_iclog_size)) {
+		xfs_warn(mp,
+	"log too small for %d x %dk log buffers, using %d x %dk log buffers",
+			mp->m_logbufs > 0 ? mp->m_logbufs : log->l_iclog_bufs,
+			(mp->m_logbsize > 0 ? mp->m_logbsize :
+					      log->l_iclog_size) >> 10,
+			log->l_iclog_bufs, log->l_iclog_size >> 10);
+		if (mp->m_logbufs > 0)
+			mp->m_logbufs = log->l_iclog_bufs;
+		if (mp->m_logbsize > 0)
+			mp->m_logbsize = log->l_iclog_size;
 	}
+	log->l_iclog_size_log = ilog2(log->l_iclog_size);
 
-	/* All machines use 32kB buffers by default. */
-	log->l_iclog_size = XLOG_BIG_RECORD_BSIZE;
-	log->l_iclog_size_log = XLOG_BIG_RECORD_BSHIFT;
-
-	/* the default log size is 16k or 32k which is one header sector */
-	log->l_iclog_hsize = BBSIZE;
-	log->l_iclog_heads = 1;
+	if (xfs_sb_version_haslogv2(&mp->m_sb)) {
+		/* # headers = size / 32k
+		 * one header holds cycles from 32k of data
+		 */
+		xhdrs = log->l_iclog_size / XLOG_HEADER_CYCLE_SIZE;
+		if (log->l_iclog_size % XLOG_HEADER_CYCLE_SIZE)
+			xhdrs++;
+		log->l_iclog_hsize = xhdrs << BBSHIFT;
+		log->l_iclog_heads = xhdrs;
+	} else {
+		ASSERT(log->l_iclog_size <= XLOG_BIG_RECORD_BSIZE);
+		log->l_iclog_hsize = BBSIZE;
+		log->l_iclog_heads = 1;
+	}
 
-done:
 	/* are we being asked to make the sizes selected above visible? */
 	if (mp->m_logbufs == 0)
 		mp->m_logbufs = log->l_iclog_bufs;
@@ -1333,6 +1551,59 @@ xfs_log_worker(
 	xfs_log_work_queue(mp);
 }
 
+/*
+ * With the pmemlog mount option and an external log on a DAX capable device,
+ * map the whole log so that xlog_sync can copy iclogs into it directly.  If
+ * we can't, say why and carry on writing the log through the block layer.
+ */
+STATIC void
+xlog_dax_init(
+	struct xlog		*log)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	struct block_device	*bdev = log->l_targ->bt_bdev;
+	struct dax_device	*dax_dev;
+	long			nr_pages;
+	pgoff_t			pgoff;
+	void			*kaddr;
+	pfn_t			pfn;
+	int			id;
+
+	if (!(mp->m_flags & XFS_MOUNT_PMEMLOG))
+		return;
+	if (mp->m_logdev_targp == mp->m_ddev_targp) {
+		xfs_warn(mp, "pmemlog requires an external log device.");
+		return;
+	}
+	if (!blk_queue_dax(bdev->bd_queue)) {
+		xfs_warn(mp, "pmemlog: log device does not support DAX.");
+		return;
+	}
+
+	dax_dev = fs_dax_get_by_host(bdev->bd_disk->disk_name);
+	if (!dax_dev)
+		return;
+	if (bdev_dax_pgoff(bdev, log->l_logBBstart, log->l_logsize, &pgoff))
+		goto out_put;
+
+	nr_pages = DIV_ROUND_UP(log->l_logsize, PAGE_SIZE);
+	id = dax_read_lock();
+	nr_pages -= dax_direct_access(dax_dev, pgoff, nr_pages, &kaddr, &pfn);
+	dax_read_unlock(id);
+	if (nr_pages) {
+		xfs_warn(mp, "pmemlog: cannot map the whole log.");
+		goto out_put;
+	}
+
+	log->l_dax_dev = dax_dev;
+	log->l_dax_addr = kaddr;
+	log->l_dax_flush = test_bit(QUEUE_FLAG_WC, &bdev->bd_queue->queue_flags);
+	xfs_info(mp, "Writing the log through DAX.");
+	return;
+out_put:
+	fs_put_dax(dax_dev);
+}
+
 /*
  * This routine initializes some of the log structure for a given mount point.
  * Its primary purpose is to fill in enough, so recovery can occur.  However,
@@ -1378,6 +1649,17 @@ xlog_alloc_log(
 	xlog_grant_head_init(&log->l_reserve_head);
 	xlog_grant_head_init(&log->l_write_head);
 
+	/*
+	 * Don't let the grant caches hold more than an eighth of the log in
+	 * total.  If that leaves too little per CPU to be useful, go without.
+	 */
+	log->l_grant_cache = alloc_percpu(atomic_t);
+	if (!log->l_grant_cache)
+		goto out_free_log;
+	log->l_grant_chunk = log->l_logsize / (8 * num_possible_cpus());
+	if (log->l_grant_chunk < XLOG_GRANT_CACHE_MIN)
+		log->l_grant_chunk = 0;
+
 	error = -EFSCORRUPTED;
 	if (xfs_sb_version_hassector(&mp->m_sb)) {
 	        log2_size = mp->m_sb.sb_logsectlog;
@@ -1432,7 +1714,10 @@ xlog_alloc_log(
 	log->l_xbuf = bp;
 
 	spin_lock_init(&log->l_icloglock);
+	spin_lock_init(&log->l_buf_cancel_lock);
 	init_waitqueue_head(&log->l_flush_wait);
+	spin_lock_init(&log->l_gc_lock);
+	init_waitqueue_head(&log->l_gc_wait);
 
 	iclogp = &log->l_iclog;
 	/*
@@ -1443,6 +1728,12 @@ xlog_alloc_log(
 	 * xlog_in_core_t in xfs_log_priv.h for details.
 	 */
 	ASSERT(log->l_iclog_size >= 4096);
+#ifdef DEBUG
+	log->l_iclog_bak = kmem_zalloc(log->l_iclog_bufs * sizeof(void *),
+				       KM_MAYFAIL);
+	if (!log->l_iclog_bak)
+		goto out_free_iclog;
+#endif
 	for (i=0; i < log->l_iclog_bufs; i++) {
 		*iclogp = kmem_zalloc(sizeof(xlog_in_core_t), KM_MAYFAIL);
 		if (!*iclogp)
@@ -1498,6 +1789,8 @@ xlog_alloc_log(
 	error = xlog_cil_init(log);
 	if (error)
 		goto out_free_iclog;
+
+	xlog_dax_init(log);
 	return log;
 
 out_free_iclog:
@@ -1507,9 +1800,13 @@ xlog_alloc_log(
 			xfs_buf_free(iclog->ic_bp);
 		kmem_free(iclog);
 	}
+#ifdef DEBUG
+	kmem_free(log->l_iclog_bak);
+#endif
 	spinlock_destroy(&log->l_icloglock);
 	xfs_buf_free(log->l_xbuf);
 out_free_log:
+	free_percpu(log->l_grant_cache);
 	kmem_free(log);
 out:
 	return ERR_PTR(error);
@@ -1547,15 +1844,76 @@ xlog_commit_record(
 	return error;
 }
 
+/*
+ * The reservation rate is sampled at most every XLOG_PUSH_SAMPLE_INTERVAL and
+ * the AIL is pushed far enough ahead of the reserve grant head to free the
+ * space that reservations are expected to consume over the next
+ * XLOG_PUSH_AHEAD_MS. That covers the longest xfsaild backoff plus the time it
+ * takes to write back the metadata it pushes.
+ */
+#define XLOG_PUSH_SAMPLE_INTERVAL	(HZ / 10)
+#define XLOG_PUSH_AHEAD_MS		200
+
+/*
+ * Sample the rate at which transaction reservations are consuming log space,
+ * in basic blocks per second, and return an exponentially weighted moving
+ * average of it. The grant head is linearised across log cycles so that
+ * wrapping doesn't confuse the delta. Returning reservations can move the
+ * grant head backwards, which just counts as an idle sample.
+ */
+STATIC int
+xlog_grant_push_rate(
+	struct xlog	*log)
+{
+	unsigned long	stamp = READ_ONCE(log->l_push_stamp);
+	unsigned long	now = jiffies;
+	int64_t		grant;
+	int64_t		delta;
+	int64_t		rate;
+	int		cycle;
+	int		space;
+
+	if (stamp && time_before(now, stamp + XLOG_PUSH_SAMPLE_INTERVAL))
+		return READ_ONCE(log->l_push_rate);
+	if (cmpxchg(&log->l_push_stamp, stamp, now) != stamp)
+		return READ_ONCE(log->l_push_rate);
+
+	xlog_crack_grant_head(&log->l_reserve_head.grant, &cycle, &space);
+	grant = (int64_t)cycle * log->l_logsize + space;
+	delta = grant - log->l_push_grant;
+	log->l_push_grant = grant;
+
+	/* first sample just establishes the baseline */
+	rate = log->l_push_rate;
+	if (!stamp)
+		return rate;
+
+	if (delta > 0)
+		delta = div_u64((uint64_t)BTOBBT(delta) * HZ, now - stamp);
+	else
+		delta = 0;
+	rate = min_t(int64_t, (rate * 3 + delta) >> 2, INT_MAX);
+	WRITE_ONCE(log->l_push_rate, rate);
+	return rate;
+}
+
 /*
  * Push on the buffer cache code if we ever use more than 75% of the on-disk
  * log space.  This code pushes on the lsn which would supposedly free up
- * the 25% which we want to leave free.  We may need to adopt a policy which
- * pushes on an lsn which is further along in the log once we reach the high
- * water mark.  In this manner, we would be creating a low water mark.
+ * the 25% which we want to leave free.
+ *
+ * A fixed 25% low water mark means a fast enough workload consumes the free
+ * space faster than the AIL can free it once the push starts, so writers end
+ * up sleeping on log space in a sawtooth pattern. To avoid that the threshold
+ * is raised to cover the expected consumption over the next
+ * XLOG_PUSH_AHEAD_MS at the current reservation rate, but no further than
+ * half the log so we don't push metadata out needlessly early.
+ *
+ * Return the LSN the AIL has to be pushed to in order to get there, or
+ * NULLCOMMITLSN if there is enough free log space already.
  */
-STATIC void
-xlog_grant_push_ail(
+xfs_lsn_t
+xlog_grant_push_threshold(
 	struct xlog	*log,
 	int		need_bytes)
 {
@@ -1566,6 +1924,7 @@ xlog_grant_push_ail(
 	int		threshold_block;
 	int		threshold_cycle;
 	int		free_threshold;
+	int		ahead;
 
 	ASSERT(BTOBB(need_bytes) < log->l_logBBsize);
 
@@ -1575,13 +1934,29 @@ xlog_grant_push_ail(
 	/*
 	 * Set the threshold for the minimum number of free blocks in the
 	 * log to the maximum of what the caller needs, one quarter of the
-	 * log, and 256 blocks.
+	 * log, 256 blocks and what we expect to be reserved before pushed
+	 * metadata has been written back.
 	 */
+	ahead = div_u64((uint64_t)xlog_grant_push_rate(log) *
+			XLOG_PUSH_AHEAD_MS, MSEC_PER_SEC);
 	free_threshold = BTOBB(need_bytes);
 	free_threshold = MAX(free_threshold, (log->l_logBBsize >> 2));
 	free_threshold = MAX(free_threshold, 256);
+	free_threshold = MAX(free_threshold,
+			     MIN(ahead, log->l_logBBsize >> 1));
+	if (READ_ONCE(log->l_push_threshold) != free_threshold)
+		WRITE_ONCE(log->l_push_threshold, free_threshold);
 	if (free_blocks >= free_threshold)
-		return;
+		return NULLCOMMITLSN;
+
+	/*
+	 * Space parked in the grant caches is still free as far as the tail
+	 * of the log is concerned, so don't start pushing just because of it.
+	 */
+	free_bytes += xlog_grant_cache_bytes(log);
+	free_blocks = BTOBBT(free_bytes);
+	if (free_blocks >= free_threshold)
+		return NULLCOMMITLSN;
 
 	xlog_crack_atomic_lsn(&log->l_tail_lsn, &threshold_cycle,
 						&threshold_block);
@@ -1601,6 +1976,20 @@ xlog_grant_push_ail(
 	if (XFS_LSN_CMP(threshold_lsn, last_sync_lsn) > 0)
 		threshold_lsn = last_sync_lsn;
 
+	return threshold_lsn;
+}
+
+STATIC void
+xlog_grant_push_ail(
+	struct xlog	*log,
+	int		need_bytes)
+{
+	xfs_lsn_t	threshold_lsn;
+
+	threshold_lsn = xlog_grant_push_threshold(log, need_bytes);
+	if (threshold_lsn == NULLCOMMITLSN)
+		return;
+
 	/*
 	 * Get the transaction layer to kick the dirty buffers out to
 	 * disk asynchronously. No point in trying to do this if
@@ -1693,6 +2082,46 @@ xlog_cksum(
 	return xfs_end_cksum(crc);
 }
 
+/*
+ * Copy a log buffer into the DAX mapped log instead of building a bio for it.
+ * memcpy_flushcache leaves nothing of the record in the CPU cache, so once the
+ * stores are fenced the record is as stable as a FUA write would have made
+ * it, unless the device has a volatile write cache of its own that still
+ * needs flushing.  Completion still runs from the log workqueue as it would
+ * after a bio, because the log callbacks can't be run in the context of every
+ * caller of xlog_sync.
+ */
+STATIC void
+xlog_dax_write(
+	struct xlog		*log,
+	struct xfs_buf		*bp)
+{
+	void			*dst;
+	int			error;
+	int			id;
+
+	dst = log->l_dax_addr + BBTOB(XFS_BUF_ADDR(bp) - log->l_logBBstart);
+
+	id = dax_read_lock();
+	if (dax_alive(log->l_dax_dev)) {
+		memcpy_flushcache(dst, bp->b_addr, BBTOB(bp->b_io_length));
+		wmb();
+	} else {
+		xfs_buf_ioerror(bp, -EIO);
+	}
+	dax_read_unlock(id);
+
+	if (!bp->b_error && log->l_dax_flush) {
+		error = blkdev_issue_flush(log->l_targ->bt_bdev, GFP_NOFS,
+				NULL);
+		if (error)
+			xfs_buf_ioerror(bp, error);
+	}
+
+	bp->b_io_cpu = raw_smp_processor_id();
+	xfs_buf_ioend_async(bp);
+}
+
 /*
  * The bdstrat callback function for log bufs. This gives us a central
  * place to trap bufs in case we get hit by a log I/O error and need to
@@ -1727,6 +2156,11 @@ xlog_bdstrat(
 		return 0;
 	}
 
+	if (iclog->ic_log->l_dax_addr) {
+		xlog_dax_write(iclog->ic_log, bp);
+		return 0;
+	}
+
 	xfs_buf_submit(bp);
 	return 0;
 }
@@ -1859,7 +2293,8 @@ xlog_sync(
 	bp->b_io_length = BTOBB(count);
 	bp->b_fspriv = iclog;
 	bp->b_flags &= ~XBF_FLUSH;
-	bp->b_flags |= (XBF_ASYNC | XBF_SYNCIO | XBF_WRITE | XBF_FUA);
+	bp->b_flags |= (XBF_ASYNC | XBF_SYNCIO | XBF_PRIO_IO | XBF_WRITE |
+			XBF_FUA);
 
 	/*
 	 * Flush the data device before flushing the log to make sure all meta
@@ -1867,11 +2302,14 @@ xlog_sync(
 	 * stamping the new log tail LSN into the log buffer.  For an external
 	 * log we need to issue the flush explicitly, and unfortunately
 	 * synchronously here; for an internal log we can simply use the block
-	 * layer state machine for preflushes.
+	 * layer state machine for preflushes.  Either way, if nothing but FUA
+	 * log writes hit the data device since its cache was last flushed,
+	 * there is nothing to flush.
 	 */
 	if (log->l_mp->m_logdev_targp != log->l_mp->m_ddev_targp)
 		xfs_blkdev_issue_flush(log->l_mp->m_ddev_targp);
-	else
+	else if (xfs_buftarg_needs_flush(log->l_mp->m_ddev_targp,
+					 &iclog->ic_flush_seq))
 		bp->b_flags |= XBF_FLUSH;
 
 	ASSERT(XFS_BUF_ADDR(bp) <= log->l_logBBsize-1);
@@ -1898,7 +2336,8 @@ xlog_sync(
 				(char *)&iclog->ic_header + count, split);
 		bp->b_fspriv = iclog;
 		bp->b_flags &= ~XBF_FLUSH;
-		bp->b_flags |= (XBF_ASYNC | XBF_SYNCIO | XBF_WRITE | XBF_FUA);
+		bp->b_flags |= (XBF_ASYNC | XBF_SYNCIO | XBF_PRIO_IO |
+				XBF_WRITE | XBF_FUA);
 
 		ASSERT(XFS_BUF_ADDR(bp) <= log->l_logBBsize-1);
 		ASSERT(XFS_BUF_ADDR(bp) + BTOBB(count) <= log->l_logBBsize);
@@ -1954,8 +2393,13 @@ xlog_dealloc_log(
 		kmem_free(iclog);
 		iclog = next_iclog;
 	}
+#ifdef DEBUG
+	kmem_free(log->l_iclog_bak);
+#endif
 	spinlock_destroy(&log->l_icloglock);
 
+	fs_put_dax(log->l_dax_dev);
+	free_percpu(log->l_grant_cache);
 	log->l_mp->m_log = NULL;
 	kmem_free(log);
 }	/* xlog_dealloc_log */
@@ -2931,6 +3375,7 @@ xlog_state_get_iclog_space(
 	xlog_rec_header_t *head;
 	xlog_in_core_t	  *iclog;
 	int		  error;
+	ktime_t		  wait_start;
 
 restart:
 	spin_lock(&log->l_icloglock);
@@ -2944,7 +3389,11 @@ xlog_state_get_iclog_space(
 		XFS_STATS_INC(log->l_mp, xs_log_noiclogs);
 
 		/* Wait for log writes to have flushed */
+		wait_start = ktime_get();
 		xlog_wait(&log->l_flush_wait, &log->l_icloglock);
+		XFS_STATS_ADD(log->l_mp, xs_log_noiclogs_us,
+			      ktime_us_delta(ktime_get(), wait_start));
+		XFS_STATS_LAT(log->l_mp, XFS_LAT_ICLOG_WAIT, wait_start);
 		goto restart;
 	}
 
@@ -3238,8 +3687,8 @@ xlog_state_switch_iclogs(
  *	   b) when we return from flushing out this iclog, it is still
  *		not in the active nor dirty state.
  */
-int
-_xfs_log_force(
+STATIC int
+__xfs_log_force(
 	struct xfs_mount	*mp,
 	uint			flags,
 	int			*log_flushed)
@@ -3352,6 +3801,24 @@ _xfs_log_force(
 	return 0;
 }
 
+int
+_xfs_log_force(
+	struct xfs_mount	*mp,
+	uint			flags,
+	int			*log_flushed)
+{
+	ktime_t			start;
+	int			error;
+
+	if (!(flags & XFS_LOG_SYNC))
+		return __xfs_log_force(mp, flags, log_flushed);
+
+	start = ktime_get();
+	error = __xfs_log_force(mp, flags, log_flushed);
+	XFS_STATS_LAT(mp, XFS_LAT_LOG_FORCE, start);
+	return error;
+}
+
 /*
  * Wrapper for _xfs_log_force(), to be used when caller doesn't care
  * about errors or whether the log was flushed or not. This is the normal
@@ -3381,8 +3848,8 @@ xfs_log_force(
  * write to disk, that thread will wake up all threads waiting on the
  * sv.
  */
-int
-_xfs_log_force_lsn(
+STATIC int
+__xfs_log_force_lsn(
 	struct xfs_mount	*mp,
 	xfs_lsn_t		lsn,
 	uint			flags,
@@ -3496,6 +3963,78 @@ _xfs_log_force_lsn(
 	return 0;
 }
 
+int
+_xfs_log_force_lsn(
+	struct xfs_mount	*mp,
+	xfs_lsn_t		lsn,
+	uint			flags,
+	int			*log_flushed)
+{
+	ktime_t			start;
+	int			error;
+
+	if (!(flags & XFS_LOG_SYNC))
+		return __xfs_log_force_lsn(mp, lsn, flags, log_flushed);
+
+	start = ktime_get();
+	error = __xfs_log_force_lsn(mp, lsn, flags, log_flushed);
+	XFS_STATS_LAT(mp, XFS_LAT_LOG_FORCE, start);
+	return error;
+}
+
+/*
+ * Start writing out the iclog holding the commit record at @lsn if nobody has
+ * done so yet.  Unlike __xfs_log_force_lsn() this never sleeps, neither for the
+ * previous iclog nor for the I/O to complete.
+ */
+void
+xlog_force_iclog_lsn(
+	struct xlog		*log,
+	xfs_lsn_t		lsn)
+{
+	struct xlog_in_core	*iclog;
+
+	spin_lock(&log->l_icloglock);
+	iclog = log->l_iclog;
+	do {
+		if (be64_to_cpu(iclog->ic_header.h_lsn) != lsn) {
+			iclog = iclog->ic_next;
+			continue;
+		}
+		if (iclog->ic_state != XLOG_STATE_ACTIVE)
+			break;
+		atomic_inc(&iclog->ic_refcnt);
+		xlog_state_switch_iclogs(log, iclog, 0);
+		spin_unlock(&log->l_icloglock);
+		/* an I/O error here aborts the callbacks on the iclog */
+		xlog_state_release_iclog(log, iclog);
+		return;
+	} while (iclog != log->l_iclog);
+	spin_unlock(&log->l_icloglock);
+}
+
+/*
+ * Asynchronously force the log to CIL sequence lsn.
+ *
+ * Instead of sleeping until the checkpoint is on stable storage, @cb is
+ * attached to it and called from log I/O completion once it is, with a
+ * non-zero abort argument if the log was shut down first.  If the sequence is
+ * already stable @cb is called before this returns.  This lets callers like
+ * O_DSYNC AIO keep many log forces in flight from a single thread.
+ */
+void
+xfs_log_force_lsn_async(
+	struct xfs_mount	*mp,
+	xfs_lsn_t		lsn,
+	struct xfs_log_callback	*cb)
+{
+	ASSERT(lsn != 0);
+
+	XFS_STATS_INC(mp, xs_log_force);
+	trace_xfs_log_force(mp, lsn, _RET_IP_);
+	xlog_cil_force_seq_async(mp->m_log, lsn, cb);
+}
+
 /*
  * Wrapper for _xfs_log_force_lsn(), to be used when caller doesn't care
  * about errors or whether the log was flushed or not. This is the normal
@@ -3511,6 +4050,102 @@ xfs_log_force_lsn(
 	_xfs_log_force_lsn(mp, lsn, flags, NULL);
 }
 
+/*
+ * Synchronously force the log to CIL sequence lsn as part of a group.
+ *
+ * Concurrent fsyncs of different inodes each want the log forced to their own
+ * sequence, and forcing them one after another costs a CIL push, an iclog
+ * write and a cache flush per caller.  Instead the first caller becomes the
+ * group leader and everyone arriving while it is busy records its sequence and
+ * sleeps.  The leader forces the log once to the highest sequence requested
+ * and wakes the group; callers whose sequence arrived too late to be covered
+ * elect the next leader among themselves.
+ *
+ * If the last group had more than one member the leader waits for a fraction
+ * of the average log force latency before sampling the target, which gives
+ * more callers a chance to join.  A lone fsync never waits.
+ */
+int
+xfs_log_force_lsn_group(
+	struct xfs_mount	*mp,
+	xfs_lsn_t		lsn,
+	int			*log_flushed)
+{
+	struct xlog		*log = mp->m_log;
+	unsigned long		gen;
+	unsigned int		size;
+	unsigned long		delay = 0;
+	xfs_lsn_t		target;
+	uint64_t		start;
+	int			flushed = 0;
+	int			error;
+
+	ASSERT(lsn != 0);
+
+	spin_lock(&log->l_gc_lock);
+	if (lsn <= log->l_gc_done) {
+		spin_unlock(&log->l_gc_lock);
+		return 0;
+	}
+	log->l_gc_members++;
+	if (lsn > log->l_gc_want)
+		log->l_gc_want = lsn;
+
+	while (log->l_gc_active) {
+		gen = log->l_gc_gen;
+		spin_unlock(&log->l_gc_lock);
+		wait_event(log->l_gc_wait, READ_ONCE(log->l_gc_gen) != gen);
+		spin_lock(&log->l_gc_lock);
+
+		if (lsn <= log->l_gc_target) {
+			error = log->l_gc_error;
+			if (log_flushed)
+				*log_flushed = log->l_gc_flushed;
+			spin_unlock(&log->l_gc_lock);
+			return error;
+		}
+	}
+
+	/* We're the leader now. */
+	log->l_gc_active = true;
+	if (log->l_gc_last_size > 1)
+		delay = min_t(uint64_t, log->l_gc_force_ns >> 12,
+				XLOG_GC_MAX_DELAY_US);
+	spin_unlock(&log->l_gc_lock);
+
+	if (delay)
+		usleep_range(delay, delay + (delay >> 1));
+
+	spin_lock(&log->l_gc_lock);
+	target = log->l_gc_want;
+	size = log->l_gc_members;
+	log->l_gc_members = 0;
+	spin_unlock(&log->l_gc_lock);
+
+	trace_xfs_log_force(mp, target, _RET_IP_);
+	start = ktime_get_ns();
+	error = _xfs_log_force_lsn(mp, target, XFS_LOG_SYNC, &flushed);
+
+	spin_lock(&log->l_gc_lock);
+	if (flushed)
+		log->l_gc_force_ns = (log->l_gc_force_ns * 7 +
+				      (ktime_get_ns() - start)) >> 3;
+	if (!error && target > log->l_gc_done)
+		log->l_gc_done = target;
+	log->l_gc_target = target;
+	log->l_gc_error = error;
+	log->l_gc_flushed = flushed;
+	log->l_gc_last_size = size;
+	log->l_gc_active = false;
+	log->l_gc_gen++;
+	spin_unlock(&log->l_gc_lock);
+	wake_up_all(&log->l_gc_wait);
+
+	if (log_flushed)
+		*log_flushed = flushed;
+	return error;
+}
+
 /*
  * Called when we want to mark the current iclog as being ready to sync to
  * disk.
@@ -3547,7 +4182,7 @@ xfs_log_ticket_put(
 {
 	ASSERT(atomic_read(&ticket->t_ref) > 0);
 	if (atomic_dec_and_test(&ticket->t_ref))
-		kmem_zone_free(xfs_log_ticket_zone, ticket);
+		kmem_pool_free(xfs_log_ticket_pool, ticket);
 }
 
 xlog_ticket_t *
@@ -3671,7 +4306,7 @@ xlog_ticket_alloc(
 	struct xlog_ticket	*tic;
 	int			unit_res;
 
-	tic = kmem_zone_zalloc(xfs_log_ticket_zone, alloc_flags);
+	tic = kmem_pool_zalloc(xfs_log_ticket_pool, sizeof(*tic), alloc_flags);
 	if (!tic)
 		return NULL;
 
@@ -119,6 +119,7 @@ static inline xfs_lsn_t	_lsn_cmp(xfs_lsn_t lsn1, xfs_lsn_t lsn2)
 
 /* Log manager interfaces */
 struct xfs_mount;
+struct xlog;
 struct xlog_in_core;
 struct xlog_ticket;
 struct xfs_log_item;
@@ -141,6 +142,12 @@ int	  _xfs_log_force_lsn(struct xfs_mount *mp,
 void	  xfs_log_force_lsn(struct xfs_mount	*mp,
 			    xfs_lsn_t		lsn,
 			    uint		flags);
+int	  xfs_log_force_lsn_group(struct xfs_mount *mp,
+				  xfs_lsn_t	lsn,
+				  int		*log_flushed);
+void	  xfs_log_force_lsn_async(struct xfs_mount *mp,
+				  xfs_lsn_t	lsn,
+				  struct xfs_log_callback *cb);
 int	  xfs_log_mount(struct xfs_mount	*mp,
 			struct xfs_buftarg	*log_target,
 			xfs_daddr_t		start_block,
@@ -150,6 +157,7 @@ int	xfs_log_mount_cancel(struct xfs_mount *);
 xfs_lsn_t xlog_assign_tail_lsn(struct xfs_mount *mp);
 xfs_lsn_t xlog_assign_tail_lsn_locked(struct xfs_mount *mp);
 void	  xfs_log_space_wake(struct xfs_mount *mp);
+bool	  xfs_log_space_waiters(struct xfs_mount *mp);
 int	  xfs_log_notify(struct xfs_mount	*mp,
 			 struct xlog_in_core	*iclog,
 			 struct xfs_log_callback *callback_entry);
@@ -171,9 +179,12 @@ void	  xfs_log_ticket_put(struct xlog_ticket *ticket);
 void	xfs_log_commit_cil(struct xfs_mount *mp, struct xfs_trans *tp,
 				xfs_lsn_t *commit_lsn, bool regrant);
 bool	xfs_log_item_in_current_chkpt(struct xfs_log_item *lip);
+xfs_lsn_t xlog_grant_push_threshold(struct xlog *log, int need_bytes);
 
 void	xfs_log_work_queue(struct xfs_mount *mp);
 void	xfs_log_quiesce(struct xfs_mount *mp);
+void	xfs_log_quiesce_fast(struct xfs_mount *mp);
+void	xfs_log_unquiesce_fast(struct xfs_mount *mp);
 bool	xfs_log_check_lsn(struct xfs_mount *, xfs_lsn_t);
 
 #endif	/* __XFS_LOG_H__ */
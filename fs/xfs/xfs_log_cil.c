@@ -33,6 +33,7 @@
 #include "xfs_trace.h"
 
 struct workqueue_struct *xfs_discard_wq;
+mempool_t *xfs_cil_ctx_pool;
 
 /*
  * Allocate a new ticket. Failing to get a new ticket makes it really hard to
@@ -193,6 +194,20 @@ xlog_cil_alloc_shadow_bufs(
 		if (!lip->li_lv_shadow ||
 		    buf_size > lip->li_lv_shadow->lv_size) {
 
+			/*
+			 * Items that keep getting relogged, such as directory
+			 * and btree blocks, tend to grow their dirty regions a
+			 * little at a time.  Round the allocation up so that
+			 * we don't reallocate the shadow buffer (and then the
+			 * CIL log vector it gets swapped with) on every step,
+			 * and let large buffers fall back to vmalloc rather
+			 * than needing high order pages.
+			 */
+			if (buf_size < PAGE_SIZE)
+				buf_size = roundup_pow_of_two(buf_size);
+			else
+				buf_size = round_up(buf_size, PAGE_SIZE);
+
 			/*
 			 * We free and allocate here as a realloc would copy
 			 * unecessary data. We don't use kmem_zalloc() for the
@@ -202,7 +217,7 @@ xlog_cil_alloc_shadow_bufs(
 			 */
 			kmem_free(lip->li_lv_shadow);
 
-			lv = kmem_alloc(buf_size, KM_SLEEP|KM_NOFS);
+			lv = kmem_alloc_large(buf_size, KM_SLEEP|KM_NOFS);
 			memset(lv, 0, xlog_cil_iovec_space(niovecs));
 
 			lv->lv_item = lip;
@@ -398,6 +413,11 @@ xlog_cil_insert_format_items(
  * if the change requires additional log metadata. If it does, take that space
  * as well. Remove the amount of space we added to the checkpoint ticket from
  * the current transaction ticket so that the accounting works out correctly.
+ *
+ * All of the CIL state we modify here lives in the per-cpu structure of the
+ * CPU we are running on, so we only need to disable preemption to keep other
+ * committers out. The push gathers it all up into the checkpoint context
+ * under the exclusive context lock, which we hold in shared mode here.
  */
 static void
 xlog_cil_insert_items(
@@ -406,11 +426,13 @@ xlog_cil_insert_items(
 {
 	struct xfs_cil		*cil = log->l_cilp;
 	struct xfs_cil_ctx	*ctx = cil->xc_ctx;
+	struct xlog_cil_pcp	*cilpcp;
 	struct xfs_log_item_desc *lidp;
 	int			len = 0;
 	int			diff_iovecs = 0;
 	int			iclog_space;
 	int			iovhdr_res = 0, split_res = 0, ctx_res = 0;
+	int			order;
 
 	ASSERT(tp);
 
@@ -420,64 +442,67 @@ xlog_cil_insert_items(
 	 */
 	xlog_cil_insert_format_items(log, tp, &len, &diff_iovecs);
 
-	spin_lock(&cil->xc_cil_lock);
-
 	/* account for space used by new iovec headers  */
 	iovhdr_res = diff_iovecs * sizeof(xlog_op_header_t);
 	len += iovhdr_res;
-	ctx->nvecs += diff_iovecs;
-
-	/* attach the transaction to the CIL if it has any busy extents */
-	if (!list_empty(&tp->t_busy))
-		list_splice_init(&tp->t_busy, &ctx->busy_extents);
 
 	/*
-	 * Now transfer enough transaction reservation to the context ticket
-	 * for the checkpoint. The context ticket is special - the unit
-	 * reservation has to grow as well as the current reservation as we
-	 * steal from tickets so we can correctly determine the space used
-	 * during the transaction commit.
+	 * The first commit into a new context steals the unit reservation for
+	 * the checkpoint ticket. Test the bit before doing the atomic op so
+	 * that all the other commits only ever read the cacheline it lives in.
 	 */
-	if (ctx->ticket->t_curr_res == 0) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) &&
+	    test_and_clear_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		ctx_res = ctx->ticket->t_unit_res;
-		ctx->ticket->t_curr_res = ctx_res;
 		tp->t_ticket->t_curr_res -= ctx_res;
 	}
 
-	/* do we need space for more log record headers? */
+	/* one atomic per commit to order the items for the push */
+	order = atomic_inc_return(&ctx->order_id);
+
+	cilpcp = get_cpu_ptr(cil->xc_pcp);
+
+	/* attach the transaction to the CIL if it has any busy extents */
+	if (!list_empty(&tp->t_busy))
+		list_splice_init(&tp->t_busy, &cilpcp->busy_extents);
+
+	/*
+	 * Do we need space for more log record headers? Every CPU rounds up the
+	 * headers for its own share of the checkpoint, so take one up front
+	 * on the first commit on this CPU. That way the sum of the per-cpu
+	 * reservations always covers the headers the whole checkpoint needs.
+	 */
 	iclog_space = log->l_iclog_size - log->l_iclog_hsize;
-	if (len > 0 && (ctx->space_used / iclog_space !=
-				(ctx->space_used + len) / iclog_space)) {
+	if (len > 0 && (!cilpcp->space_used ||
+			cilpcp->space_used / iclog_space !=
+				(cilpcp->space_used + len) / iclog_space)) {
 		split_res = (len + iclog_space - 1) / iclog_space;
 		/* need to take into account split region headers, too */
 		split_res *= log->l_iclog_hsize + sizeof(struct xlog_op_header);
-		ctx->ticket->t_unit_res += split_res;
-		ctx->ticket->t_curr_res += split_res;
 		tp->t_ticket->t_curr_res -= split_res;
 		ASSERT(tp->t_ticket->t_curr_res >= len);
 	}
 	tp->t_ticket->t_curr_res -= len;
-	ctx->space_used += len;
+	cilpcp->space_reserved += ctx_res + split_res;
+	cilpcp->space_used += len;
 
 	/*
-	 * If we've overrun the reservation, dump the tx details before we move
-	 * the log items. Shutdown is imminent...
+	 * Only fold the space used into the context once we have built up a
+	 * batch of it so background pushes can be triggered without every
+	 * commit hitting the same counter.
 	 */
-	if (WARN_ON(tp->t_ticket->t_curr_res < 0)) {
-		xfs_warn(log->l_mp, "Transaction log reservation overrun:");
-		xfs_warn(log->l_mp,
-			 "  log items: %d bytes (iov hdrs: %d bytes)",
-			 len, iovhdr_res);
-		xfs_warn(log->l_mp, "  split region headers: %d bytes",
-			 split_res);
-		xfs_warn(log->l_mp, "  ctx ticket: %d bytes", ctx_res);
-		xlog_print_trans(tp);
+	cilpcp->space_batch += len;
+	if (cilpcp->space_batch >= cil->xc_pcp_batch) {
+		atomic_add(cilpcp->space_batch, &ctx->space_used);
+		cilpcp->space_batch = 0;
+		XFS_STATS_INC(log->l_mp, xs_cil_space_folds);
 	}
 
 	/*
-	 * Now (re-)position everything modified at the tail of the CIL.
-	 * We do this here so we only need to take the CIL lock once during
-	 * the transaction commit.
+	 * Now add everything modified that isn't already in the CIL to the
+	 * list for this CPU. Items relogged in this context stay on whatever
+	 * list they were first added to - we can't touch other CPUs' lists -
+	 * so just record the new commit order and let the push sort them.
 	 */
 	list_for_each_entry(lidp, &tp->t_items, lid_trans) {
 		struct xfs_log_item	*lip = lidp->lid_item;
@@ -486,16 +511,26 @@ xlog_cil_insert_items(
 		if (!(lidp->lid_flags & XFS_LID_DIRTY))
 			continue;
 
-		/*
-		 * Only move the item if it isn't already at the tail. This is
-		 * to prevent a transient list_empty() state when reinserting
-		 * an item that is already the only item in the CIL.
-		 */
-		if (!list_is_last(&lip->li_cil, &cil->xc_cil))
-			list_move_tail(&lip->li_cil, &cil->xc_cil);
+		lip->li_order_id = order;
+		if (list_empty(&lip->li_cil))
+			list_add_tail(&lip->li_cil, &cilpcp->log_items);
 	}
+	put_cpu_ptr(cil->xc_pcp);
 
-	spin_unlock(&cil->xc_cil_lock);
+	/*
+	 * If we've overrun the reservation, dump the tx details. Shutdown is
+	 * imminent...
+	 */
+	if (WARN_ON(tp->t_ticket->t_curr_res < 0)) {
+		xfs_warn(log->l_mp, "Transaction log reservation overrun:");
+		xfs_warn(log->l_mp,
+			 "  log items: %d bytes (iov hdrs: %d bytes)",
+			 len, iovhdr_res);
+		xfs_warn(log->l_mp, "  split region headers: %d bytes",
+			 split_res);
+		xfs_warn(log->l_mp, "  ctx ticket: %d bytes", ctx_res);
+		xlog_print_trans(tp);
+	}
 
 	if (tp->t_ticket->t_curr_res < 0)
 		xfs_force_shutdown(log->l_mp, SHUTDOWN_LOG_IO_ERROR);
@@ -514,80 +549,77 @@ xlog_cil_free_logvec(
 	}
 }
 
-static void
-xlog_discard_endio_work(
-	struct work_struct	*work)
-{
-	struct xfs_cil_ctx	*ctx =
-		container_of(work, struct xfs_cil_ctx, discard_endio_work);
-	struct xfs_mount	*mp = ctx->cil->xc_log->l_mp;
-
-	xfs_extent_busy_clear(mp, &ctx->busy_extents, false);
-	kmem_free(ctx);
-}
-
 /*
- * Queue up the actual completion to a thread to avoid IRQ-safe locking for
- * pagb_lock.  Note that we need a unbounded workqueue, otherwise we might
- * get the execution delayed up to 30 seconds for weird reasons.
+ * Tell the async log forces waiting on a checkpoint that it is stable.
  */
 static void
-xlog_discard_endio(
-	struct bio		*bio)
+xlog_cil_run_force_cbs(
+	struct xfs_log_callback	*cb,
+	int			abort)
 {
-	struct xfs_cil_ctx	*ctx = bio->bi_private;
+	struct xfs_log_callback	*next;
 
-	INIT_WORK(&ctx->discard_endio_work, xlog_discard_endio_work);
-	queue_work(xfs_discard_wq, &ctx->discard_endio_work);
+	for (; cb; cb = next) {
+		next = cb->cb_next;
+		cb->cb_func(cb->cb_arg, abort);
+	}
 }
 
+/*
+ * Mark all items committed and clear busy extents. We free the log vector
+ * chains in a separate pass so that we unpin the log items as quickly as
+ * possible.
+ */
+/*
+ * Resize the background push threshold from how long this checkpoint took to
+ * become stable.
+ *
+ * A checkpoint costs roughly one cache flush plus a time proportional to its
+ * size for formatting and writing it.  The flush cost is taken from the
+ * average synchronous log force latency, and the rest of the time this
+ * checkpoint took, from the push starting to the commit record being stable,
+ * is spread over its size to give a moving average write cost per kilobyte.
+ * The threshold is then what we can push within the target latency, bounded
+ * by the default threshold.  space_used includes the op headers of every
+ * region, so checkpoints with many small items are charged for them.
+ */
 static void
-xlog_discard_busy_extents(
-	struct xfs_mount	*mp,
+xlog_cil_push_space_update(
+	struct xfs_cil		*cil,
 	struct xfs_cil_ctx	*ctx)
 {
-	struct list_head	*list = &ctx->busy_extents;
-	struct xfs_extent_busy	*busyp;
-	struct bio		*bio = NULL;
-	struct blk_plug		plug;
-	int			error = 0;
-
-	ASSERT(mp->m_flags & XFS_MOUNT_DISCARD);
-
-	blk_start_plug(&plug);
-	list_for_each_entry(busyp, list, list) {
-		trace_xfs_discard_extent(mp, busyp->agno, busyp->bno,
-					 busyp->length);
-
-		error = __blkdev_issue_discard(mp->m_ddev_targp->bt_bdev,
-				XFS_AGB_TO_DADDR(mp, busyp->agno, busyp->bno),
-				XFS_FSB_TO_BB(mp, busyp->length),
-				GFP_NOFS, 0, &bio);
-		if (error && error != -EOPNOTSUPP) {
-			xfs_info(mp,
-	 "discard failed for extent [0x%llx,%u], error %d",
-				 (unsigned long long)busyp->bno,
-				 busyp->length,
-				 error);
-			break;
-		}
+	struct xlog		*log = cil->xc_log;
+	uint64_t		target;
+	uint64_t		flush;
+	uint64_t		elapsed;
+	uint64_t		kb;
+	uint64_t		cost;
+	uint64_t		space;
+
+	target = (uint64_t)xfs_cil_push_latency_ms * NSEC_PER_MSEC;
+	if (!target) {
+		WRITE_ONCE(cil->xc_push_space, XLOG_CIL_SPACE_LIMIT(log));
+		return;
 	}
 
-	if (bio) {
-		bio->bi_private = ctx;
-		bio->bi_end_io = xlog_discard_endio;
-		submit_bio(bio);
-	} else {
-		xlog_discard_endio_work(&ctx->discard_endio_work);
-	}
-	blk_finish_plug(&plug);
+	flush = READ_ONCE(log->l_gc_force_ns);
+	elapsed = ktime_get_ns() - ctx->push_ns;
+	elapsed = elapsed > flush ? elapsed - flush : 0;
+	kb = max_t(uint64_t, atomic_read(&ctx->space_used) >> 10, 1);
+	cost = (cil->xc_ckpt_ns_per_kb * 7 + div64_u64(elapsed, kb)) >> 3;
+	cil->xc_ckpt_ns_per_kb = cost;
+
+	if (target <= flush)
+		space = 0;
+	else if (!cost)
+		space = XLOG_CIL_SPACE_LIMIT(log);
+	else
+		space = div64_u64(target - flush, cost) << 10;
+	space = clamp_t(uint64_t, space, XLOG_CIL_MIN_SPACE_LIMIT(log),
+			XLOG_CIL_SPACE_LIMIT(log));
+	WRITE_ONCE(cil->xc_push_space, space);
 }
 
-/*
- * Mark all items committed and clear busy extents. We free the log vector
- * chains in a separate pass so that we unpin the log items as quickly as
- * possible.
- */
 static void
 xlog_cil_committed(
 	void	*args,
@@ -595,6 +627,10 @@ xlog_cil_committed(
 {
 	struct xfs_cil_ctx	*ctx = args;
 	struct xfs_mount	*mp = ctx->cil->xc_log->l_mp;
+	struct xfs_log_callback	*cb;
+
+	if (!abort)
+		xlog_cil_push_space_update(ctx->cil, ctx);
 
 	xfs_trans_committed_bulk(ctx->cil->xc_log->l_ailp, ctx->lv_chain,
 					ctx->start_lsn, abort);
@@ -613,14 +649,219 @@ xlog_cil_committed(
 	if (abort)
 		wake_up_all(&ctx->cil->xc_commit_wait);
 	list_del(&ctx->committing);
+	cb = ctx->force_cbs;
 	spin_unlock(&ctx->cil->xc_push_lock);
 
+	xlog_cil_run_force_cbs(cb, abort);
+
 	xlog_cil_free_logvec(ctx->lv_chain);
 
 	if (!list_empty(&ctx->busy_extents))
-		xlog_discard_busy_extents(mp, ctx);
-	else
-		kmem_free(ctx);
+		xfs_discard_queue_extents(mp, &ctx->busy_extents);
+	kmem_pool_free(xfs_cil_ctx_pool, ctx);
+}
+
+/*
+ * Pull everything the per-cpu structures gathered for the context being pushed
+ * into @ctx and @log_items, and fold the ticket reservation they stole from the
+ * transactions into the checkpoint ticket. The caller must hold the context
+ * lock exclusively so that no commit can be modifying the per-cpu state.
+ */
+static void
+xlog_cil_pcp_aggregate(
+	struct xfs_cil		*cil,
+	struct xfs_cil_ctx	*ctx,
+	struct list_head	*log_items)
+{
+	struct xlog_cil_pcp	*cilpcp;
+	int			space_reserved = 0;
+	int			cpu;
+
+	for_each_possible_cpu(cpu) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+
+		list_splice_init(&cilpcp->log_items, log_items);
+		list_splice_init(&cilpcp->busy_extents, &ctx->busy_extents);
+		atomic_add(cilpcp->space_batch, &ctx->space_used);
+		space_reserved += cilpcp->space_reserved;
+
+		cilpcp->space_used = 0;
+		cilpcp->space_batch = 0;
+		cilpcp->space_reserved = 0;
+	}
+
+	/*
+	 * The checkpoint ticket starts out without any reservation, so all the
+	 * space stolen from the transactions makes up both its unit and current
+	 * reservation.
+	 */
+	ctx->ticket->t_curr_res += space_reserved;
+	ctx->ticket->t_unit_res = ctx->ticket->t_curr_res;
+}
+
+/*
+ * Items are added to the per-cpu lists in the order they are first committed
+ * to the context, not in the order they were last modified. Sort them by the
+ * order of their last commit so that the checkpoint looks like they were moved
+ * to the tail of a single list on every commit.
+ */
+static int
+xlog_cil_order_cmp(
+	void			*priv,
+	struct list_head	*a,
+	struct list_head	*b)
+{
+	struct xfs_log_item	*l1 = container_of(a, struct xfs_log_item,
+						   li_cil);
+	struct xfs_log_item	*l2 = container_of(b, struct xfs_log_item,
+						   li_cil);
+
+	return l1->li_order_id > l2->li_order_id;
+}
+
+/*
+ * Write the log vectors of a checkpoint context into the log and then write
+ * its commit record.
+ *
+ * This runs from a work item of its own for each context once xlog_cil_push()
+ * has written the checkpoint transaction header, so that a new checkpoint can
+ * be switched to and start writing while this one is still being copied into
+ * the iclogs. The commit records still have to be strictly ordered, which is
+ * done through the committing list.
+ */
+#define XLOG_CIL_CKPT_SAMPLE_INTERVAL	HZ
+
+/*
+ * Account a checkpoint whose commit record has been written and keep a
+ * moving average of the checkpoint rate for sysfs. Only the task that wins
+ * the cmpxchg on xc_ckpt_stamp updates the rate.
+ */
+static void
+xlog_cil_ckpt_account(
+	struct xfs_cil		*cil,
+	struct xfs_cil_ctx	*ctx)
+{
+	unsigned long		stamp = READ_ONCE(cil->xc_ckpt_stamp);
+	unsigned long		now = jiffies;
+	int64_t			count;
+	int64_t			delta;
+
+	count = atomic64_inc_return(&cil->xc_ckpt_count);
+	atomic64_add(atomic_read(&ctx->space_used), &cil->xc_ckpt_bytes);
+
+	if (time_before(now, stamp + XLOG_CIL_CKPT_SAMPLE_INTERVAL))
+		return;
+	if (cmpxchg(&cil->xc_ckpt_stamp, stamp, now) != stamp)
+		return;
+
+	delta = div_u64((count - cil->xc_ckpt_last) * HZ, now - stamp);
+	cil->xc_ckpt_last = count;
+	WRITE_ONCE(cil->xc_ckpt_rate,
+		   min_t(int64_t, (cil->xc_ckpt_rate * 3 + delta) >> 2, INT_MAX));
+}
+
+static void
+xlog_cil_write_work(
+	struct work_struct	*work)
+{
+	struct xfs_cil_ctx	*ctx = container_of(work, struct xfs_cil_ctx,
+						    write_work);
+	struct xfs_cil		*cil = ctx->cil;
+	struct xlog		*log = cil->xc_log;
+	struct xlog_ticket	*tic = ctx->ticket;
+	struct xfs_cil_ctx	*prev_ctx;
+	struct xlog_in_core	*commit_iclog;
+	xfs_lsn_t		commit_lsn;
+	xfs_lsn_t		start_lsn;
+	bool			force;
+	int			error;
+
+	/*
+	 * The checkpoint start LSN was recorded when we wrote the transaction
+	 * header, so don't let this write overwrite it. A checkpoint of only
+	 * ordered items has nothing to write.
+	 */
+	if (ctx->nvecs) {
+		error = xlog_write(log, ctx->lv_chain, tic, &start_lsn, NULL, 0);
+		if (error)
+			goto out_abort_free_ticket;
+	}
+
+	/*
+	 * now that we've written the checkpoint into the log, strictly
+	 * order the commit records so replay will get them in the right order.
+	 */
+restart:
+	spin_lock(&cil->xc_push_lock);
+	list_for_each_entry(prev_ctx, &cil->xc_committing, committing) {
+		/*
+		 * Avoid getting stuck in this loop because we were woken by the
+		 * shutdown, but then went back to sleep once already in the
+		 * shutdown state.
+		 */
+		if (XLOG_FORCED_SHUTDOWN(log)) {
+			spin_unlock(&cil->xc_push_lock);
+			goto out_abort_free_ticket;
+		}
+
+		/*
+		 * Higher sequences will wait for this one so skip them.
+		 * Don't wait for our own sequence, either.
+		 */
+		if (prev_ctx->sequence >= ctx->sequence)
+			continue;
+		if (!prev_ctx->commit_lsn) {
+			/*
+			 * It is still being pushed! Wait for the push to
+			 * complete, then start again from the beginning.
+			 */
+			xlog_wait(&cil->xc_commit_wait, &cil->xc_push_lock);
+			goto restart;
+		}
+	}
+	spin_unlock(&cil->xc_push_lock);
+
+	/* xfs_log_done always frees the ticket on error. */
+	commit_lsn = xfs_log_done(log->l_mp, tic, &commit_iclog, false);
+	if (commit_lsn == -1)
+		goto out_abort;
+
+	/* attach all the transactions w/ busy extents to iclog */
+	ctx->log_cb.cb_func = xlog_cil_committed;
+	ctx->log_cb.cb_arg = ctx;
+	error = xfs_log_notify(log->l_mp, commit_iclog, &ctx->log_cb);
+	if (error)
+		goto out_abort;
+
+	/*
+	 * now the checkpoint commit is complete and we've attached the
+	 * callbacks to the iclog we can assign the commit LSN to the context
+	 * and wake up anyone who is waiting for the commit to complete.
+	 */
+	spin_lock(&cil->xc_push_lock);
+	ctx->commit_lsn = commit_lsn;
+	force = ctx->force_cbs != NULL;
+	wake_up_all(&cil->xc_commit_wait);
+	spin_unlock(&cil->xc_push_lock);
+
+	xlog_cil_ckpt_account(cil, ctx);
+
+	/* release the hounds! */
+	if (xfs_log_release_iclog(log->l_mp, commit_iclog))
+		return;
+
+	/*
+	 * An async force was waiting for the commit record, so it has to be
+	 * pushed out now.  ctx may already be freed, so don't touch it.
+	 */
+	if (force)
+		xlog_force_iclog_lsn(log, commit_lsn);
+	return;
+
+out_abort_free_ticket:
+	xfs_log_ticket_put(tic);
+out_abort:
+	xlog_cil_committed(ctx, XFS_LI_ABORTED);
 }
 
 /*
@@ -636,6 +877,12 @@ xlog_cil_committed(
  * forces to run racily and not issue pushes for the same sequence twice. If we
  * get a race between multiple pushes for the same sequence they will block on
  * the first one and then abort, hence avoiding needless pushes.
+ *
+ * Only switching to a new context and writing the checkpoint transaction
+ * header is serialised here. Writing the rest of the checkpoint is handed off
+ * to xlog_cil_write_work() so that several checkpoints can be in flight at
+ * once. Writing the header first ensures that checkpoints start in the log in
+ * sequence order.
  */
 STATIC int
 xlog_cil_push(
@@ -645,20 +892,20 @@ xlog_cil_push(
 	struct xfs_log_vec	*lv;
 	struct xfs_cil_ctx	*ctx;
 	struct xfs_cil_ctx	*new_ctx;
-	struct xlog_in_core	*commit_iclog;
 	struct xlog_ticket	*tic;
 	int			num_iovecs;
 	int			error = 0;
 	struct xfs_trans_header thdr;
 	struct xfs_log_iovec	lhdr;
 	struct xfs_log_vec	lvhdr = { NULL };
-	xfs_lsn_t		commit_lsn;
 	xfs_lsn_t		push_seq;
+	LIST_HEAD		(log_items);
 
 	if (!cil)
 		return 0;
 
-	new_ctx = kmem_zalloc(sizeof(*new_ctx), KM_SLEEP|KM_NOFS);
+	new_ctx = kmem_pool_zalloc(xfs_cil_ctx_pool, sizeof(*new_ctx),
+			KM_SLEEP|KM_NOFS);
 	new_ctx->ticket = xlog_cil_ticket_alloc(log);
 
 	down_write(&cil->xc_ctx_lock);
@@ -673,7 +920,7 @@ xlog_cil_push(
 	 * move on to a new sequence number and so we have to be able to push
 	 * this sequence again later.
 	 */
-	if (list_empty(&cil->xc_cil)) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		cil->xc_push_seq = 0;
 		spin_unlock(&cil->xc_push_lock);
 		goto out_skip;
@@ -712,19 +959,24 @@ xlog_cil_push(
 	 */
 	list_add(&ctx->committing, &cil->xc_committing);
 	spin_unlock(&cil->xc_push_lock);
+	ctx->push_ns = ktime_get_ns();
 
 	/*
 	 * pull all the log vectors off the items in the CIL, and
-	 * remove the items from the CIL. We don't need the CIL lock
-	 * here because it's only needed on the transaction commit
-	 * side which is currently locked out by the flush lock.
+	 * remove the items from the CIL. Transaction commits are
+	 * locked out by the context lock, so we are free to gather
+	 * up the per-cpu state and sort it into commit order.
 	 */
+	XFS_STATS_INC(log->l_mp, xs_cil_pushes);
+	xlog_cil_pcp_aggregate(cil, ctx, &log_items);
+	list_sort(NULL, &log_items, xlog_cil_order_cmp);
+
 	lv = NULL;
 	num_iovecs = 0;
-	while (!list_empty(&cil->xc_cil)) {
+	while (!list_empty(&log_items)) {
 		struct xfs_log_item	*item;
 
-		item = list_first_entry(&cil->xc_cil,
+		item = list_first_entry(&log_items,
 					struct xfs_log_item, li_cil);
 		list_del_init(&item->li_cil);
 		if (!ctx->lv_chain)
@@ -735,6 +987,7 @@ xlog_cil_push(
 		item->li_lv = NULL;
 		num_iovecs += lv->lv_niovecs;
 	}
+	ctx->nvecs = num_iovecs;
 
 	/*
 	 * initialise the new context and attach it to the CIL. Then attach
@@ -746,7 +999,6 @@ xlog_cil_push(
 	INIT_LIST_HEAD(&new_ctx->busy_extents);
 	new_ctx->sequence = ctx->sequence + 1;
 	new_ctx->cil = cil;
-	cil->xc_ctx = new_ctx;
 
 	/*
 	 * The switch is now done, so we can drop the context lock and move out
@@ -774,7 +1026,9 @@ xlog_cil_push(
 	 * deferencing a freed context pointer.
 	 */
 	spin_lock(&cil->xc_push_lock);
+	cil->xc_ctx = new_ctx;
 	cil->xc_current_sequence = new_ctx->sequence;
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
 	spin_unlock(&cil->xc_push_lock);
 	up_write(&cil->xc_ctx_lock);
 
@@ -782,6 +1036,7 @@ xlog_cil_push(
 	 * Build a checkpoint transaction header and write it to the log to
 	 * begin the transaction. We need to account for the space used by the
 	 * transaction header here as it is not accounted for in xlog_write().
+	 * The log vectors are written separately by xlog_cil_write_work().
 	 *
 	 * The LSN we need to pass to the log items on transaction commit is
 	 * the LSN reported by the first log vector write. If we use the commit
@@ -799,80 +1054,23 @@ xlog_cil_push(
 
 	lvhdr.lv_niovecs = 1;
 	lvhdr.lv_iovecp = &lhdr;
-	lvhdr.lv_next = ctx->lv_chain;
 
 	error = xlog_write(log, &lvhdr, tic, &ctx->start_lsn, NULL, 0);
 	if (error)
 		goto out_abort_free_ticket;
 
-	/*
-	 * now that we've written the checkpoint into the log, strictly
-	 * order the commit records so replay will get them in the right order.
-	 */
-restart:
-	spin_lock(&cil->xc_push_lock);
-	list_for_each_entry(new_ctx, &cil->xc_committing, committing) {
-		/*
-		 * Avoid getting stuck in this loop because we were woken by the
-		 * shutdown, but then went back to sleep once already in the
-		 * shutdown state.
-		 */
-		if (XLOG_FORCED_SHUTDOWN(log)) {
-			spin_unlock(&cil->xc_push_lock);
-			goto out_abort_free_ticket;
-		}
-
-		/*
-		 * Higher sequences will wait for this one so skip them.
-		 * Don't wait for our own sequence, either.
-		 */
-		if (new_ctx->sequence >= ctx->sequence)
-			continue;
-		if (!new_ctx->commit_lsn) {
-			/*
-			 * It is still being pushed! Wait for the push to
-			 * complete, then start again from the beginning.
-			 */
-			xlog_wait(&cil->xc_commit_wait, &cil->xc_push_lock);
-			goto restart;
-		}
-	}
-	spin_unlock(&cil->xc_push_lock);
-
-	/* xfs_log_done always frees the ticket on error. */
-	commit_lsn = xfs_log_done(log->l_mp, tic, &commit_iclog, false);
-	if (commit_lsn == -1)
-		goto out_abort;
-
-	/* attach all the transactions w/ busy extents to iclog */
-	ctx->log_cb.cb_func = xlog_cil_committed;
-	ctx->log_cb.cb_arg = ctx;
-	error = xfs_log_notify(log->l_mp, commit_iclog, &ctx->log_cb);
-	if (error)
-		goto out_abort;
-
-	/*
-	 * now the checkpoint commit is complete and we've attached the
-	 * callbacks to the iclog we can assign the commit LSN to the context
-	 * and wake up anyone who is waiting for the commit to complete.
-	 */
-	spin_lock(&cil->xc_push_lock);
-	ctx->commit_lsn = commit_lsn;
-	wake_up_all(&cil->xc_commit_wait);
-	spin_unlock(&cil->xc_push_lock);
-
-	/* release the hounds! */
-	return xfs_log_release_iclog(log->l_mp, commit_iclog);
+	INIT_WORK(&ctx->write_work, xlog_cil_write_work);
+	queue_work(log->l_mp->m_cil_workqueue, &ctx->write_work);
+	return 0;
 
 out_skip:
 	up_write(&cil->xc_ctx_lock);
 	xfs_log_ticket_put(new_ctx->ticket);
-	kmem_free(new_ctx);
+	kmem_pool_free(xfs_cil_ctx_pool, new_ctx);
 	return 0;
 
 out_abort_free_ticket:
 	xfs_log_ticket_put(tic);
-out_abort:
 	xlog_cil_committed(ctx, XFS_LI_ABORTED);
 	return -EIO;
 }
@@ -903,13 +1101,15 @@ xlog_cil_push_background(
 	 * The cil won't be empty because we are called while holding the
 	 * context lock so whatever we added to the CIL will still be there
 	 */
-	ASSERT(!list_empty(&cil->xc_cil));
+	ASSERT(!test_bit(XLOG_CIL_EMPTY, &cil->xc_flags));
 
 	/*
 	 * don't do a background push if we haven't used up all the
-	 * space available yet.
+	 * space available yet. The per-cpu batching means this can trigger
+	 * a little late, which is fine as it is only a soft limit.
 	 */
-	if (cil->xc_ctx->space_used < XLOG_CIL_SPACE_LIMIT(log))
+	if (atomic_read(&cil->xc_ctx->space_used) <
+	    READ_ONCE(cil->xc_push_space))
 		return;
 
 	spin_lock(&cil->xc_push_lock);
@@ -947,7 +1147,8 @@ xlog_cil_push_now(
 	 * there's no work we need to do.
 	 */
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil) || push_seq <= cil->xc_push_seq) {
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags) ||
+	    push_seq <= cil->xc_push_seq) {
 		spin_unlock(&cil->xc_push_lock);
 		return;
 	}
@@ -965,7 +1166,7 @@ xlog_cil_empty(
 	bool		empty = false;
 
 	spin_lock(&cil->xc_push_lock);
-	if (list_empty(&cil->xc_cil))
+	if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
 		empty = true;
 	spin_unlock(&cil->xc_push_lock);
 	return empty;
@@ -1003,7 +1204,11 @@ xfs_log_commit_cil(
 	xlog_cil_alloc_shadow_bufs(log, tp);
 
 	/* lock out background commit */
-	down_read(&cil->xc_ctx_lock);
+	if (!down_read_trylock(&cil->xc_ctx_lock)) {
+		XFS_STATS_INC(mp, xs_cil_ctx_waits);
+		down_read(&cil->xc_ctx_lock);
+	}
+	XFS_STATS_INC(mp, xs_cil_commits);
 
 	xlog_cil_insert_items(log, tp);
 
@@ -1108,7 +1313,7 @@ xlog_cil_force_lsn(
 	 * we would have found the context on the committing list.
 	 */
 	if (sequence == cil->xc_current_sequence &&
-	    !list_empty(&cil->xc_cil)) {
+	    !test_bit(XLOG_CIL_EMPTY, &cil->xc_flags)) {
 		spin_unlock(&cil->xc_push_lock);
 		goto restart;
 	}
@@ -1128,6 +1333,67 @@ xlog_cil_force_lsn(
 	return 0;
 }
 
+/*
+ * Asynchronous version of xlog_cil_force_lsn() plus the iclog force that
+ * follows it.  Rather than sleeping on the push, @cb is attached to the
+ * checkpoint context for @sequence and run from xlog_cil_committed() when the
+ * commit record is on disk.  A push is queued if the sequence is still the
+ * current one, and if its commit record is already in an iclog that iclog is
+ * pushed out.  Otherwise xlog_cil_write_work() does that once it has written
+ * the commit record.
+ *
+ * A sequence that is neither current nor on the committing list has already
+ * completed, and so has nothing to wait for.
+ */
+void
+xlog_cil_force_seq_async(
+	struct xlog		*log,
+	xfs_lsn_t		sequence,
+	struct xfs_log_callback	*cb)
+{
+	struct xfs_cil		*cil = log->l_cilp;
+	struct xfs_cil_ctx	*ctx;
+	xfs_lsn_t		commit_lsn;
+
+	ASSERT(sequence <= cil->xc_current_sequence);
+
+	spin_lock(&cil->xc_push_lock);
+	if (XLOG_FORCED_SHUTDOWN(log)) {
+		spin_unlock(&cil->xc_push_lock);
+		cb->cb_func(cb->cb_arg, XFS_LI_ABORTED);
+		return;
+	}
+
+	if (sequence == cil->xc_current_sequence) {
+		if (test_bit(XLOG_CIL_EMPTY, &cil->xc_flags))
+			goto out_stable;
+		ctx = cil->xc_ctx;
+		goto found;
+	}
+	list_for_each_entry(ctx, &cil->xc_committing, committing) {
+		if (ctx->sequence == sequence)
+			goto found;
+	}
+out_stable:
+	spin_unlock(&cil->xc_push_lock);
+	cb->cb_func(cb->cb_arg, 0);
+	return;
+
+found:
+	cb->cb_next = ctx->force_cbs;
+	ctx->force_cbs = cb;
+	commit_lsn = ctx->commit_lsn;
+	if (sequence == cil->xc_current_sequence &&
+	    sequence > cil->xc_push_seq) {
+		cil->xc_push_seq = sequence;
+		queue_work(log->l_mp->m_cil_workqueue, &cil->xc_push_work);
+	}
+	spin_unlock(&cil->xc_push_lock);
+
+	if (commit_lsn)
+		xlog_force_iclog_lsn(log, commit_lsn);
+}
+
 /*
  * Check if the current log item was first committed in this sequence.
  * We can't rely on just the log item being in the CIL, we have to check
@@ -1167,24 +1433,44 @@ xlog_cil_init(
 {
 	struct xfs_cil	*cil;
 	struct xfs_cil_ctx *ctx;
+	struct xlog_cil_pcp *cilpcp;
+	int		cpu;
 
 	cil = kmem_zalloc(sizeof(*cil), KM_SLEEP|KM_MAYFAIL);
 	if (!cil)
 		return -ENOMEM;
 
-	ctx = kmem_zalloc(sizeof(*ctx), KM_SLEEP|KM_MAYFAIL);
-	if (!ctx) {
-		kmem_free(cil);
-		return -ENOMEM;
+	cil->xc_pcp = alloc_percpu(struct xlog_cil_pcp);
+	if (!cil->xc_pcp)
+		goto out_free_cil;
+
+	ctx = kmem_pool_zalloc(xfs_cil_ctx_pool, sizeof(*ctx),
+			KM_SLEEP|KM_MAYFAIL);
+	if (!ctx)
+		goto out_free_pcp;
+
+	for_each_possible_cpu(cpu) {
+		cilpcp = per_cpu_ptr(cil->xc_pcp, cpu);
+		INIT_LIST_HEAD(&cilpcp->busy_extents);
+		INIT_LIST_HEAD(&cilpcp->log_items);
 	}
 
+	/*
+	 * Fold the per-cpu space counters into the context often enough that
+	 * all CPUs together can't overshoot the background push threshold by
+	 * more than a quarter.
+	 */
+	cil->xc_pcp_batch = max_t(int, XLOG_CIL_SPACE_LIMIT(log) /
+					(4 * num_online_cpus()), 1);
+	set_bit(XLOG_CIL_EMPTY, &cil->xc_flags);
+
 	INIT_WORK(&cil->xc_push_work, xlog_cil_push_work);
-	INIT_LIST_HEAD(&cil->xc_cil);
 	INIT_LIST_HEAD(&cil->xc_committing);
-	spin_lock_init(&cil->xc_cil_lock);
 	spin_lock_init(&cil->xc_push_lock);
 	init_rwsem(&cil->xc_ctx_lock);
 	init_waitqueue_head(&cil->xc_commit_wait);
+	cil->xc_ckpt_stamp = jiffies;
+	cil->xc_push_space = XLOG_CIL_SPACE_LIMIT(log);
 
 	INIT_LIST_HEAD(&ctx->committing);
 	INIT_LIST_HEAD(&ctx->busy_extents);
@@ -1196,6 +1482,12 @@ xlog_cil_init(
 	cil->xc_log = log;
 	log->l_cilp = cil;
 	return 0;
+
+out_free_pcp:
+	free_percpu(cil->xc_pcp);
+out_free_cil:
+	kmem_free(cil);
+	return -ENOMEM;
 }
 
 void
@@ -1203,12 +1495,15 @@ xlog_cil_destroy(
 	struct xlog	*log)
 {
 	if (log->l_cilp->xc_ctx) {
+		xlog_cil_run_force_cbs(log->l_cilp->xc_ctx->force_cbs,
+				XFS_LI_ABORTED);
 		if (log->l_cilp->xc_ctx->ticket)
 			xfs_log_ticket_put(log->l_cilp->xc_ctx->ticket);
-		kmem_free(log->l_cilp->xc_ctx);
+		kmem_pool_free(xfs_cil_ctx_pool, log->l_cilp->xc_ctx);
 	}
 
-	ASSERT(list_empty(&log->l_cilp->xc_cil));
+	ASSERT(test_bit(XLOG_CIL_EMPTY, &log->l_cilp->xc_flags));
+	free_percpu(log->l_cilp->xc_pcp);
 	kmem_free(log->l_cilp);
 }
 
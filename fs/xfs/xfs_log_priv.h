@@ -151,6 +151,9 @@ static inline uint xlog_get_client_id(__be32 i)
 
 #define XLOG_COVER_OPS		5
 
+/* Smallest per-cpu grant cache refill worth having, see xlog_alloc_log */
+#define XLOG_GRANT_CACHE_MIN	(64 * 1024)
+
 /* Ticket reservation region accounting */ 
 #define XLOG_TIC_LEN_MAX	15
 
@@ -223,6 +226,7 @@ typedef struct xlog_in_core {
 	int			ic_size;
 	int			ic_offset;
 	int			ic_bwritecnt;
+	int			ic_flush_seq;	/* ddev write seq at preflush */
 	unsigned short		ic_state;
 	char			*ic_datap;	/* pointer to iclog data */
 
@@ -252,12 +256,31 @@ struct xfs_cil_ctx {
 	xfs_lsn_t		commit_lsn;	/* chkpt commit record lsn */
 	struct xlog_ticket	*ticket;	/* chkpt ticket */
 	int			nvecs;		/* number of regions */
-	int			space_used;	/* aggregate size of regions */
+	atomic_t		space_used;	/* aggregate size of regions */
+	atomic_t		order_id;	/* commit order of items */
 	struct list_head	busy_extents;	/* busy extents in chkpt */
 	struct xfs_log_vec	*lv_chain;	/* logvecs being pushed */
 	struct xfs_log_callback	log_cb;		/* completion callback hook. */
+	struct xfs_log_callback	*force_cbs;	/* async force callbacks */
 	struct list_head	committing;	/* ctx committing list */
-	struct work_struct	discard_endio_work;
+	struct work_struct	write_work;	/* checkpoint write */
+	uint64_t		push_ns;	/* when the push started */
+};
+
+/*
+ * Per-cpu CIL tracking.
+ *
+ * Transaction commits only add to the structure of the CPU they run on, so
+ * they don't have to serialise against each other. The push folds everything
+ * into the checkpoint context that is being pushed while holding the context
+ * lock exclusively.
+ */
+struct xlog_cil_pcp {
+	int			space_used;	/* ctx space used on this cpu */
+	int			space_batch;	/* not yet in ctx->space_used */
+	int			space_reserved;	/* stolen ticket reservation */
+	struct list_head	busy_extents;	/* busy extents */
+	struct list_head	log_items;	/* log items, unordered */
 };
 
 /*
@@ -278,8 +301,9 @@ struct xfs_cil_ctx {
  */
 struct xfs_cil {
 	struct xlog		*xc_log;
-	struct list_head	xc_cil;
-	spinlock_t		xc_cil_lock;
+	struct xlog_cil_pcp __percpu *xc_pcp;
+	unsigned long		xc_flags;
+	int			xc_pcp_batch;	/* space_used fold threshold */
 
 	struct rw_semaphore	xc_ctx_lock ____cacheline_aligned_in_smp;
 	struct xfs_cil_ctx	*xc_ctx;
@@ -290,8 +314,20 @@ struct xfs_cil {
 	wait_queue_head_t	xc_commit_wait;
 	xfs_lsn_t		xc_current_sequence;
 	struct work_struct	xc_push_work;
+
+	/* checkpoint statistics, see xlog_cil_ckpt_account() */
+	atomic64_t		xc_ckpt_count ____cacheline_aligned_in_smp;
+	atomic64_t		xc_ckpt_bytes;
+	unsigned long		xc_ckpt_stamp;	/* jiffies of last sample */
+	int64_t			xc_ckpt_last;	/* count at last sample */
+	int			xc_ckpt_rate;	/* checkpoints/s, averaged */
+	uint64_t		xc_ckpt_ns_per_kb; /* checkpoint write cost */
+	int			xc_push_space;	/* background push threshold */
 } ____cacheline_aligned_in_smp;
 
+/* xc_flags bit values */
+#define	XLOG_CIL_EMPTY		0	/* nothing committed to the ctx yet */
+
 /*
  * The amount of log space we allow the CIL to aggregate is difficult to size.
  * Whatever we choose, we have to make sure we can get a reservation for the
@@ -341,6 +377,19 @@ struct xfs_cil {
  */
 #define XLOG_CIL_SPACE_LIMIT(log)	(log->l_logsize >> 3)
 
+/*
+ * With a target checkpoint latency set, the background push threshold is sized
+ * so that pushing that much should take about the target latency to complete,
+ * but never less than this.
+ */
+#define XLOG_CIL_MIN_SPACE_LIMIT(log)	(XLOG_CIL_SPACE_LIMIT(log) >> 3)
+
+/*
+ * Upper bound on how long a group commit leader waits for other synchronous
+ * log forces to join its group, in microseconds.
+ */
+#define XLOG_GC_MAX_DELAY_US		1000
+
 /*
  * ticket grant locks, queues and accounting have their own cachlines
  * as these are quite hot and can be operated on concurrently.
@@ -365,10 +414,17 @@ struct xlog {
 	struct xfs_buf		*l_xbuf;        /* extra buffer for log
 						 * wrapping */
 	struct xfs_buftarg	*l_targ;        /* buftarg of log */
+	struct dax_device	*l_dax_dev;	/* pmemlog: DAX log device */
+	void			*l_dax_addr;	/* pmemlog: mapped log start */
+	bool			l_dax_flush;	/* pmemlog: device has a
+						 * volatile write cache */
 	struct delayed_work	l_work;		/* background flush work */
 	uint			l_flags;
 	uint			l_quotaoffs_flag; /* XFS_DQ_*, for QUOTAOFFs */
 	struct list_head	*l_buf_cancel_table;
+	unsigned int		l_buf_cancel_bits; /* log2 of table size */
+	spinlock_t		l_buf_cancel_lock; /* pass 2 table updates */
+	struct xlog_recover_replay *l_recover_replay; /* parallel pass 2 */
 	int			l_iclog_hsize;  /* size of iclog header */
 	int			l_iclog_heads;  /* # of iclog header sectors */
 	uint			l_sectBBsize;   /* sector size in BBs (2^n) */
@@ -406,11 +462,52 @@ struct xlog {
 	struct xlog_grant_head	l_reserve_head;
 	struct xlog_grant_head	l_write_head;
 
+	/*
+	 * Per-cpu caches of grant space.  Each cache holds bytes that have
+	 * already been added to both the reserve and write grant heads, so
+	 * small reservations can be satisfied without touching the shared
+	 * grant head cachelines.  Caches are only refilled while nobody is
+	 * waiting for log space, are drained before anyone queues up to wait
+	 * and are never refilled again once unmount has started.
+	 */
+	atomic_t __percpu	*l_grant_cache;
+	int			l_grant_chunk;	/* bytes per refill, 0 = off */
+	bool			l_grant_nocache; /* unmounting, don't refill */
+
+	/*
+	 * Adaptive AIL push control. The rate at which reservations consume
+	 * log space is sampled from the reserve grant head so the AIL can be
+	 * pushed ahead of demand. Only the task that wins the cmpxchg on
+	 * l_push_stamp updates the sample state.
+	 */
+	unsigned long		l_push_stamp ____cacheline_aligned_in_smp;
+						/* jiffies of last sample */
+	int64_t			l_push_grant;	/* grant bytes at last sample */
+	int			l_push_rate;	/* reserve rate, BB/s */
+	int			l_push_threshold; /* free space target, BB */
+
+	/*
+	 * Group commit of synchronous log forces, see
+	 * xfs_log_force_lsn_group().  Protected by l_gc_lock.
+	 */
+	spinlock_t		l_gc_lock ____cacheline_aligned_in_smp;
+	wait_queue_head_t	l_gc_wait;
+	bool			l_gc_active;	/* a group leader is forcing */
+	unsigned long		l_gc_gen;	/* bumped as each group ends */
+	unsigned int		l_gc_members;	/* callers since last sample */
+	unsigned int		l_gc_last_size;	/* members of the last group */
+	xfs_lsn_t		l_gc_want;	/* highest sequence requested */
+	xfs_lsn_t		l_gc_target;	/* sequence of the last group */
+	xfs_lsn_t		l_gc_done;	/* highest sequence forced ok */
+	int			l_gc_error;	/* result of the last group */
+	int			l_gc_flushed;	/* last group wrote iclogs */
+	uint64_t		l_gc_force_ns;	/* average log force latency */
+
 	struct xfs_kobj		l_kobj;
 
 	/* The following field are used for debugging; need to hold icloglock */
 #ifdef DEBUG
-	void			*l_iclog_bak[XLOG_MAX_ICLOGS];
+	void			**l_iclog_bak;
 	/* log record crc error injection factor */
 	uint32_t		l_badcrc_factor;
 #endif
@@ -418,8 +515,10 @@ struct xlog {
 	xfs_lsn_t		l_recovery_lsn;
 };
 
+#define XLOG_BUF_CANCEL_SIZE(log)	(1U << (log)->l_buf_cancel_bits)
 #define XLOG_BUF_CANCEL_BUCKET(log, blkno) \
-	((log)->l_buf_cancel_table + ((uint64_t)blkno % XLOG_BC_TABLE_SIZE))
+	((log)->l_buf_cancel_table + \
+	 hash_64((uint64_t)(blkno), (log)->l_buf_cancel_bits))
 
 #define XLOG_FORCED_SHUTDOWN(log)	((log)->l_flags & XLOG_IO_ERROR)
 
@@ -437,6 +536,8 @@ extern __le32	 xlog_cksum(struct xlog *log, struct xlog_rec_header *rhead,
 			    char *dp, int size);
 
 extern kmem_zone_t *xfs_log_ticket_zone;
+extern mempool_t *xfs_log_ticket_pool;
+extern mempool_t *xfs_cil_ctx_pool;
 struct xlog_ticket *
 xlog_ticket_alloc(
 	struct xlog	*log,
@@ -457,6 +558,7 @@ xlog_write_adv_cnt(void **ptr, int *len, int *off, size_t bytes)
 
 void	xlog_print_tic_res(struct xfs_mount *mp, struct xlog_ticket *ticket);
 void	xlog_print_trans(struct xfs_trans *);
+int	xlog_space_left(struct xlog *log, atomic64_t *head);
 int
 xlog_write(
 	struct xlog		*log,
@@ -543,6 +645,10 @@ xlog_cil_force(struct xlog *log)
 	xlog_cil_force_lsn(log, log->l_cilp->xc_current_sequence);
 }
 
+void	xlog_cil_force_seq_async(struct xlog *log, xfs_lsn_t sequence,
+				 struct xfs_log_callback *cb);
+void	xlog_force_iclog_lsn(struct xlog *log, xfs_lsn_t lsn);
+
 /*
  * Unmount record type is used as a pseudo transaction type for the ticket.
  * It's value must be outside the range of XFS_TRANS_* values.
@@ -47,6 +47,8 @@
 #include "xfs_buf_item.h"
 #include "xfs_refcount_item.h"
 #include "xfs_bmap_item.h"
+#include "xfs_swapext_item.h"
+#include <linux/hash.h>
 
 #define BLK_AVG(blk1, blk2)	((blk1+blk2) >> 1)
 
@@ -80,6 +82,47 @@ struct xfs_buf_cancel {
 	struct list_head	bc_list;
 };
 
+/*
+ * The number and size of the log records that can be in flight at the head of
+ * the log depend on the iclog configuration the log was written with, which
+ * need not be the one we are mounted with.  v2 logs can have been written with
+ * up to XLOG_MAX_LARGE_ICLOGS iclogs of up to XLOG_MAX_LARGE_RECORD_BSIZE, but
+ * anything beyond the traditional limits is scaled back until the ring fits
+ * into a quarter of the log, so size the recovery search windows for the
+ * largest ring the log could have been written with.
+ */
+static inline int
+xlog_max_record_bblks(
+	struct xlog	*log)
+{
+	if (!xfs_sb_version_haslogv2(&log->l_mp->m_sb))
+		return XLOG_REC_SHIFT(log);
+	return max_t(int, XLOG_REC_SHIFT(log),
+		     min_t(int, BTOBB(XLOG_MAX_LARGE_RECORD_BSIZE),
+			   log->l_logBBsize >> 2));
+}
+
+static inline int
+xlog_max_iclogs(
+	struct xlog	*log)
+{
+	if (!xfs_sb_version_haslogv2(&log->l_mp->m_sb))
+		return XLOG_MAX_ICLOGS;
+	return XLOG_MAX_LARGE_ICLOGS;
+}
+
+static inline int
+xlog_max_inflight_bblks(
+	struct xlog	*log)
+{
+	if (!xfs_sb_version_haslogv2(&log->l_mp->m_sb))
+		return XLOG_TOTAL_REC_SHIFT(log);
+	return max_t(int, XLOG_TOTAL_REC_SHIFT(log),
+		     min_t(int, BTOBB(XLOG_MAX_LARGE_ICLOGS *
+				      XLOG_MAX_LARGE_RECORD_BSIZE),
+			   log->l_logBBsize >> 2));
+}
+
 /*
  * Sector aligned buffer routines for buffer create/read/write/access
  */
@@ -251,6 +294,280 @@ xlog_bread_offset(
 	return error2;
 }
 
+/*
+ * Asynchronous log reads.  xlog_bread_submit() starts the read of @nbblks
+ * blocks at @blk_no into @bp and xlog_bread_wait() waits for it, so that a
+ * caller can have several reads in flight at once.  The buffer data is laid
+ * out exactly as xlog_bread_noalign() would leave it.
+ */
+STATIC void
+xlog_bread_iodone(
+	struct xfs_buf		*bp)
+{
+	complete(&bp->b_iowait);
+}
+
+STATIC void
+xlog_bread_submit(
+	struct xlog		*log,
+	xfs_daddr_t		blk_no,
+	int			nbblks,
+	struct xfs_buf		*bp)
+{
+	blk_no = round_down(blk_no, log->l_sectBBsize);
+	nbblks = round_up(nbblks, log->l_sectBBsize);
+
+	ASSERT(nbblks > 0);
+	ASSERT(nbblks <= bp->b_length);
+
+	XFS_BUF_SET_ADDR(bp, log->l_logBBstart + blk_no);
+	bp->b_flags |= XBF_READ | XBF_ASYNC;
+	bp->b_io_length = nbblks;
+	bp->b_error = 0;
+	bp->b_iodone = xlog_bread_iodone;
+	reinit_completion(&bp->b_iowait);
+	xfs_buf_submit(bp);
+}
+
+STATIC int
+xlog_bread_wait(
+	struct xlog		*log,
+	struct xfs_buf		*bp)
+{
+	wait_for_completion(&bp->b_iowait);
+	bp->b_flags &= ~XBF_ASYNC;
+	bp->b_iodone = NULL;
+	if (bp->b_error && !XFS_FORCED_SHUTDOWN(log->l_mp))
+		xfs_buf_ioerror_alert(bp, __func__);
+	return bp->b_error;
+}
+
+/*
+ * Streaming log reads for the recovery passes.
+ *
+ * The recovery passes walk the log from tail to head one record at a time.
+ * Rather than issuing a synchronous read for each record header and body,
+ * read the log in large windows and keep the read of the next window in
+ * flight while the records in the current one are processed, so that device
+ * time and record processing overlap.  Records are copied out of the windows
+ * into the caller's buffers, which lets them straddle window boundaries and
+ * the physical end of the log without any special casing.
+ */
+#define XLOG_RECOVER_WINDOW_BYTES	(2 << 20)
+
+struct xlog_rwin {
+	struct xfs_buf		*rw_bp[2];
+	xfs_daddr_t		rw_start[2];	/* first block, -1 if empty */
+	int			rw_len[2];	/* blocks held */
+	bool			rw_busy[2];	/* read in flight */
+	int			rw_bblks;	/* window size */
+};
+
+STATIC int
+xlog_rwin_wait(
+	struct xlog		*log,
+	struct xlog_rwin	*rw,
+	int			i)
+{
+	int			error;
+
+	if (!rw->rw_busy[i])
+		return 0;
+
+	rw->rw_busy[i] = false;
+	error = xlog_bread_wait(log, rw->rw_bp[i]);
+	if (error)
+		rw->rw_start[i] = -1;
+	return error;
+}
+
+/* Start reading the window at @start, which must be sector aligned. */
+STATIC void
+xlog_rwin_submit(
+	struct xlog		*log,
+	struct xlog_rwin	*rw,
+	int			i,
+	xfs_daddr_t		start)
+{
+	ASSERT(!rw->rw_busy[i]);
+	ASSERT(!(start & ((xfs_daddr_t)log->l_sectBBsize - 1)));
+
+	rw->rw_start[i] = start;
+	rw->rw_len[i] = min_t(xfs_daddr_t, rw->rw_bblks,
+			      log->l_logBBsize - start);
+	rw->rw_busy[i] = true;
+	xlog_bread_submit(log, start, rw->rw_len[i], rw->rw_bp[i]);
+}
+
+/*
+ * Return the window holding @blk_no, reading it if necessary, and make sure
+ * the window after it is being read.
+ */
+STATIC int
+xlog_rwin_get(
+	struct xlog		*log,
+	struct xlog_rwin	*rw,
+	xfs_daddr_t		blk_no,
+	int			*slot)
+{
+	xfs_daddr_t		next;
+	int			i, other;
+	int			error;
+
+	for (i = 0; i < 2; i++) {
+		if (rw->rw_start[i] >= 0 && blk_no >= rw->rw_start[i] &&
+		    blk_no < rw->rw_start[i] + rw->rw_len[i])
+			break;
+	}
+	if (i == 2) {
+		/* Not sequential; throw away what we have and start over. */
+		for (i = 0; i < 2; i++) {
+			xlog_rwin_wait(log, rw, i);
+			rw->rw_start[i] = -1;
+		}
+		i = 0;
+		xlog_rwin_submit(log, rw, i,
+				round_down(blk_no, log->l_sectBBsize));
+	}
+
+	error = xlog_rwin_wait(log, rw, i);
+	if (error)
+		return error;
+
+	next = rw->rw_start[i] + rw->rw_len[i];
+	if (next == log->l_logBBsize)
+		next = 0;
+	other = 1 - i;
+	if (rw->rw_start[other] != next) {
+		xlog_rwin_wait(log, rw, other);
+		xlog_rwin_submit(log, rw, other, next);
+	}
+
+	*slot = i;
+	return 0;
+}
+
+/* Copy @nbblks blocks starting at @blk_no out of the windows into @dest. */
+STATIC int
+xlog_rwin_copy(
+	struct xlog		*log,
+	struct xlog_rwin	*rw,
+	xfs_daddr_t		blk_no,
+	int			nbblks,
+	char			*dest)
+{
+	int			i, len;
+	int			error;
+
+	if (!xlog_buf_bbcount_valid(log, nbblks) ||
+	    blk_no + nbblks > log->l_logBBsize) {
+		xfs_warn(log->l_mp, "Invalid block length (0x%x) for buffer",
+			nbblks);
+		XFS_ERROR_REPORT(__func__, XFS_ERRLEVEL_HIGH, log->l_mp);
+		return -EFSCORRUPTED;
+	}
+
+	while (nbblks > 0) {
+		error = xlog_rwin_get(log, rw, blk_no, &i);
+		if (error)
+			return error;
+		len = min_t(xfs_daddr_t, nbblks,
+			    rw->rw_start[i] + rw->rw_len[i] - blk_no);
+		memcpy(dest, rw->rw_bp[i]->b_addr +
+				BBTOB(blk_no - rw->rw_start[i]), BBTOB(len));
+		dest += BBTOB(len);
+		blk_no += len;
+		nbblks -= len;
+	}
+	return 0;
+}
+
+/* Returns NULL if there's no memory for the windows; reads are then sync. */
+STATIC struct xlog_rwin *
+xlog_rwin_alloc(
+	struct xlog		*log)
+{
+	struct xlog_rwin	*rw;
+	int			bblks;
+	int			i;
+
+	bblks = min_t(int, BTOBB(XLOG_RECOVER_WINDOW_BYTES),
+		      log->l_logBBsize);
+	bblks = round_down(bblks, log->l_sectBBsize);
+
+	rw = kmem_zalloc(sizeof(*rw), KM_SLEEP | KM_MAYFAIL);
+	if (!rw)
+		return NULL;
+	rw->rw_bblks = bblks;
+	for (i = 0; i < 2; i++) {
+		rw->rw_start[i] = -1;
+		rw->rw_bp[i] = xlog_get_bp(log, bblks);
+		if (!rw->rw_bp[i])
+			goto out_free;
+	}
+	return rw;
+
+out_free:
+	while (--i >= 0)
+		xlog_put_bp(rw->rw_bp[i]);
+	kmem_free(rw);
+	return NULL;
+}
+
+STATIC void
+xlog_rwin_free(
+	struct xlog		*log,
+	struct xlog_rwin	*rw)
+{
+	int			i;
+
+	if (!rw)
+		return;
+	for (i = 0; i < 2; i++) {
+		xlog_rwin_wait(log, rw, i);
+		xlog_put_bp(rw->rw_bp[i]);
+	}
+	kmem_free(rw);
+}
+
+/*
+ * Read log blocks for a recovery pass, through the windows if we have them.
+ * Like xlog_bread, *offset points at the data on return.
+ */
+STATIC int
+xlog_recover_bread(
+	struct xlog		*log,
+	struct xlog_rwin	*rw,
+	xfs_daddr_t		blk_no,
+	int			nbblks,
+	struct xfs_buf		*bp,
+	char			**offset)
+{
+	if (!rw)
+		return xlog_bread(log, blk_no, nbblks, bp, offset);
+	if (nbblks > bp->b_length)
+		return -EFSCORRUPTED;
+	*offset = bp->b_addr;
+	return xlog_rwin_copy(log, rw, blk_no, nbblks, bp->b_addr);
+}
+
+/* As xlog_bread_offset, for the part of a record wrapped to the log start. */
+STATIC int
+xlog_recover_bread_offset(
+	struct xlog		*log,
+	struct xlog_rwin	*rw,
+	xfs_daddr_t		blk_no,
+	int			nbblks,
+	struct xfs_buf		*bp,
+	char			*offset)
+{
+	if (!rw)
+		return xlog_bread_offset(log, blk_no, nbblks, bp, offset);
+	if (offset + BBTOB(nbblks) > (char *)bp->b_addr + BBTOB(bp->b_length))
+		return -EFSCORRUPTED;
+	return xlog_rwin_copy(log, rw, blk_no, nbblks, offset);
+}
+
 /*
  * Write out the buffer at the given block for the given number of blocks.
  * The buffer is kept locked across the write and is returned locked.
@@ -397,11 +714,21 @@ xlog_recover_iodone(
 	xfs_buf_ioend(bp);
 }
 
+/*
+ * Number of blocks probed concurrently in each round of the search for the
+ * start of a cycle.  Each round cuts the search range by a factor of
+ * XLOG_FIND_PROBES + 1 for the latency of a single read.
+ */
+#define XLOG_FIND_PROBES	8
+
 /*
  * This routine finds (to an approximation) the first block in the physical
- * log which contains the given cycle.  It uses a binary search algorithm.
- * Note that the algorithm can not be perfect because the disk will not
- * necessarily be perfect.
+ * log which contains the given cycle.  It uses a k-ary search, reading
+ * XLOG_FIND_PROBES evenly spaced blocks of the range at once and narrowing
+ * the range to the gap in front of the first probe with the given cycle.
+ * If we can't get the probe buffers this degrades to a binary search
+ * through @bp.  Note that the algorithm can not be perfect because the disk
+ * will not necessarily be perfect.
  */
 STATIC int
 xlog_find_cycle_start(
@@ -411,31 +738,63 @@ xlog_find_cycle_start(
 	xfs_daddr_t	*last_blk,
 	uint		cycle)
 {
-	char		*offset;
-	xfs_daddr_t	mid_blk;
+	struct xfs_buf	*pbp[XLOG_FIND_PROBES];
+	xfs_daddr_t	pblk[XLOG_FIND_PROBES];
 	xfs_daddr_t	end_blk;
-	uint		mid_cycle;
-	int		error;
+	int		nprobes, n, k;
+	int		error = 0, error2;
+
+	for (nprobes = 0; nprobes < XLOG_FIND_PROBES; nprobes++) {
+		pbp[nprobes] = xlog_get_bp(log, 1);
+		if (!pbp[nprobes])
+			break;
+	}
+	if (nprobes < 2) {
+		if (nprobes)
+			xlog_put_bp(pbp[0]);
+		pbp[0] = bp;
+		nprobes = 1;
+	}
 
 	end_blk = *last_blk;
-	mid_blk = BLK_AVG(first_blk, end_blk);
-	while (mid_blk != first_blk && mid_blk != end_blk) {
-		error = xlog_bread(log, mid_blk, 1, bp, &offset);
+	while (end_blk - first_blk > 1) {
+		n = min_t(xfs_daddr_t, nprobes, end_blk - first_blk - 1);
+		for (k = 0; k < n; k++) {
+			pblk[k] = first_blk +
+				  (end_blk - first_blk) * (k + 1) / (n + 1);
+			xlog_bread_submit(log, pblk[k], 1, pbp[k]);
+		}
+		for (k = 0; k < n; k++) {
+			error2 = xlog_bread_wait(log, pbp[k]);
+			if (error2 && !error)
+				error = error2;
+		}
 		if (error)
-			return error;
-		mid_cycle = xlog_get_cycle(offset);
-		if (mid_cycle == cycle)
-			end_blk = mid_blk;   /* last_half_cycle == mid_cycle */
-		else
-			first_blk = mid_blk; /* first_half_cycle == mid_cycle */
-		mid_blk = BLK_AVG(first_blk, end_blk);
+			goto out;
+
+		/*
+		 * Everything before the first probe stamped with the cycle has
+		 * the first half cycle and everything after it the last half.
+		 */
+		for (k = 0; k < n; k++) {
+			if (xlog_get_cycle(xlog_align(log, pblk[k], 1,
+						      pbp[k])) == cycle)
+				break;
+		}
+		if (k > 0)
+			first_blk = pblk[k - 1];
+		if (k < n)
+			end_blk = pblk[k];
 	}
-	ASSERT((mid_blk == first_blk && mid_blk+1 == end_blk) ||
-	       (mid_blk == end_blk && mid_blk-1 == first_blk));
+	ASSERT(first_blk + 1 == end_blk);
 
 	*last_blk = end_blk;
-
-	return 0;
+out:
+	if (pbp[0] != bp) {
+		for (k = 0; k < nprobes; k++)
+			xlog_put_bp(pbp[k]);
+	}
+	return error;
 }
 
 /*
@@ -445,6 +804,9 @@ xlog_find_cycle_start(
  * block in the range.  The scan needs to occur from front to back
  * and the pointer into the region must be updated since a later
  * routine will need to perform another test.
+ *
+ * If the range doesn't fit in one buffer, the read of the next chunk is
+ * kept in flight while the current one is scanned.
  */
 STATIC int
 xlog_find_verify_cycle(
@@ -457,6 +819,7 @@ xlog_find_verify_cycle(
 	xfs_daddr_t	i, j;
 	uint		cycle;
 	xfs_buf_t	*bp;
+	xfs_buf_t	*nbp = NULL;
 	xfs_daddr_t	bufblks;
 	char		*buf = NULL;
 	int		error = 0;
@@ -476,14 +839,35 @@ xlog_find_verify_cycle(
 			return -ENOMEM;
 	}
 
+	if (bufblks < nbblks)
+		nbp = xlog_get_bp(log, bufblks);
+	if (nbp) {
+		xlog_bread_submit(log, start_blk,
+				  min_t(xfs_daddr_t, bufblks, nbblks), nbp);
+	}
+
 	for (i = start_blk; i < start_blk + nbblks; i += bufblks) {
 		int	bcount;
 
 		bcount = min(bufblks, (start_blk + nbblks - i));
 
-		error = xlog_bread(log, i, bcount, bp, &buf);
-		if (error)
-			goto out;
+		if (nbp) {
+			swap(bp, nbp);
+			error = xlog_bread_wait(log, bp);
+			if (error)
+				goto out;
+			buf = xlog_align(log, i, bcount, bp);
+			if (i + bcount < start_blk + nbblks) {
+				xlog_bread_submit(log, i + bcount,
+					min_t(xfs_daddr_t, bufblks,
+					      start_blk + nbblks - i - bcount),
+					nbp);
+			}
+		} else {
+			error = xlog_bread(log, i, bcount, bp, &buf);
+			if (error)
+				goto out;
+		}
 
 		for (j = 0; j < bcount; j++) {
 			cycle = xlog_get_cycle(buf);
@@ -499,6 +883,12 @@ xlog_find_verify_cycle(
 	*new_blk = -1;
 
 out:
+	if (nbp) {
+		/* don't free a buffer with a read still in flight */
+		if (nbp->b_flags & XBF_ASYNC)
+			xlog_bread_wait(log, nbp);
+		xlog_put_bp(nbp);
+	}
 	xlog_put_bp(bp);
 	return error;
 }
@@ -631,12 +1021,12 @@ xlog_find_head(
 	xfs_daddr_t	*return_head_blk)
 {
 	xfs_buf_t	*bp;
-	char		*offset;
+	xfs_buf_t	*lbp;
 	xfs_daddr_t	new_blk, first_blk, start_blk, last_blk, head_blk;
 	int		num_scan_bblks;
 	uint		first_half_cycle, last_half_cycle;
 	uint		stop_on_cycle;
-	int		error, log_bbnum = log->l_logBBsize;
+	int		error, error2, log_bbnum = log->l_logBBsize;
 
 	/* Is the end of the log device zeroed? */
 	error = xlog_find_zeroed(log, &first_blk);
@@ -663,19 +1053,28 @@ xlog_find_head(
 	bp = xlog_get_bp(log, 1);
 	if (!bp)
 		return -ENOMEM;
-
-	error = xlog_bread(log, 0, 1, bp, &offset);
-	if (error)
+	lbp = xlog_get_bp(log, 1);
+	if (!lbp) {
+		error = -ENOMEM;
 		goto bp_err;
+	}
 
-	first_half_cycle = xlog_get_cycle(offset);
-
+	/* read the first and last blocks of the log at the same time */
 	last_blk = head_blk = log_bbnum - 1;	/* get cycle # of last block */
-	error = xlog_bread(log, last_blk, 1, bp, &offset);
-	if (error)
+	xlog_bread_submit(log, 0, 1, bp);
+	xlog_bread_submit(log, last_blk, 1, lbp);
+	error = xlog_bread_wait(log, bp);
+	error2 = xlog_bread_wait(log, lbp);
+	if (!error)
+		error = error2;
+	if (error) {
+		xlog_put_bp(lbp);
 		goto bp_err;
+	}
 
-	last_half_cycle = xlog_get_cycle(offset);
+	first_half_cycle = xlog_get_cycle(xlog_align(log, 0, 1, bp));
+	last_half_cycle = xlog_get_cycle(xlog_align(log, last_blk, 1, lbp));
+	xlog_put_bp(lbp);
 	ASSERT(last_half_cycle != 0);
 
 	/*
@@ -753,7 +1152,7 @@ xlog_find_head(
 	 * in the in-core log.  The following number can be made tighter if
 	 * we actually look at the block size of the filesystem.
 	 */
-	num_scan_bblks = XLOG_TOTAL_REC_SHIFT(log);
+	num_scan_bblks = xlog_max_inflight_bblks(log);
 	if (head_blk >= num_scan_bblks) {
 		/*
 		 * We are guaranteed that the entire check can be performed
@@ -826,7 +1225,7 @@ xlog_find_head(
 	 * Now we need to make sure head_blk is not pointing to a block in
 	 * the middle of a log record.
 	 */
-	num_scan_bblks = XLOG_REC_SHIFT(log);
+	num_scan_bblks = xlog_max_record_bblks(log);
 	if (head_blk >= num_scan_bblks) {
 		start_blk = head_blk - num_scan_bblks; /* don't read head_blk */
 
@@ -962,7 +1361,8 @@ xlog_rseek_logrec_hdr(
  * the provided number of records or hit the head block. The return value is the
  * number of records encountered or a negative error code. The log block and
  * buffer pointer of the last record seen are returned in rblk and rhead
- * respectively.
+ * respectively.  The blocks are read through @rw if the caller has read
+ * windows rather than one synchronous read per block.
  */
 STATIC int
 xlog_seek_logrec_hdr(
@@ -970,6 +1370,7 @@ xlog_seek_logrec_hdr(
 	xfs_daddr_t		head_blk,
 	xfs_daddr_t		tail_blk,
 	int			count,
+	struct xlog_rwin	*rw,
 	struct xfs_buf		*bp,
 	xfs_daddr_t		*rblk,
 	struct xlog_rec_header	**rhead,
@@ -989,7 +1390,7 @@ xlog_seek_logrec_hdr(
 	 */
 	end_blk = head_blk > tail_blk ? head_blk : log->l_logBBsize - 1;
 	for (i = (int) tail_blk; i <= end_blk; i++) {
-		error = xlog_bread(log, i, 1, bp, &offset);
+		error = xlog_recover_bread(log, rw, i, 1, bp, &offset);
 		if (error)
 			goto out_error;
 
@@ -1007,7 +1408,7 @@ xlog_seek_logrec_hdr(
 	 */
 	if (tail_blk > head_blk && found != count) {
 		for (i = 0; i < (int) head_blk; i++) {
-			error = xlog_bread(log, i, 1, bp, &offset);
+			error = xlog_recover_bread(log, rw, i, 1, bp, &offset);
 			if (error)
 				goto out_error;
 
@@ -1043,6 +1444,7 @@ xlog_verify_tail(
 	xfs_daddr_t		tail_blk)
 {
 	struct xlog_rec_header	*thead;
+	struct xlog_rwin	*rw;
 	struct xfs_buf		*bp;
 	xfs_daddr_t		first_bad;
 	int			count;
@@ -1055,29 +1457,31 @@ xlog_verify_tail(
 		return -ENOMEM;
 
 	/*
-	 * Seek XLOG_MAX_ICLOGS + 1 records past the current tail record to get
+	 * Seek xlog_max_iclogs() + 1 records past the current tail record to get
 	 * a temporary head block that points after the last possible
 	 * concurrently written record of the tail.
 	 */
+	rw = xlog_rwin_alloc(log);
 	count = xlog_seek_logrec_hdr(log, head_blk, tail_blk,
-				     XLOG_MAX_ICLOGS + 1, bp, &tmp_head, &thead,
-				     &wrapped);
+				     xlog_max_iclogs(log) + 1, rw, bp,
+				     &tmp_head, &thead, &wrapped);
+	xlog_rwin_free(log, rw);
 	if (count < 0) {
 		error = count;
 		goto out;
 	}
 
 	/*
-	 * If the call above didn't find XLOG_MAX_ICLOGS + 1 records, we ran
+	 * If the call above didn't find xlog_max_iclogs() + 1 records, we ran
 	 * into the actual log head. tmp_head points to the start of the record
 	 * so update it to the actual head block.
 	 */
-	if (count < XLOG_MAX_ICLOGS + 1)
+	if (count < xlog_max_iclogs(log) + 1)
 		tmp_head = head_blk;
 
 	/*
 	 * We now have a tail and temporary head block that covers at least
-	 * XLOG_MAX_ICLOGS records from the tail. We need to verify that these
+	 * xlog_max_iclogs() records from the tail. We need to verify that these
 	 * records were completely written. Run a CRC verification pass from
 	 * tail to head and return the result.
 	 */
@@ -1096,8 +1500,8 @@ xlog_verify_tail(
  * log in the event of a crash. Our only means to detect this scenario is via
  * CRC verification. While we can't always be certain that CRC verification
  * failure is due to a torn write vs. an unrelated corruption, we do know that
- * only a certain number (XLOG_MAX_ICLOGS) of log records can be written out at
- * one time. Therefore, CRC verify up to XLOG_MAX_ICLOGS records at the head of
+ * only a certain number (xlog_max_iclogs()) of log records can be written out
+ * at one time. Therefore, CRC verify up to that many records at the head of
  * the log and treat failures in this range as torn writes as a matter of
  * policy. In the event of CRC failure, the head is walked back to the last good
  * record in the log and the tail is updated from that record and verified.
@@ -1130,7 +1534,7 @@ xlog_verify_head(
 	if (!tmp_bp)
 		return -ENOMEM;
 	error = xlog_rseek_logrec_hdr(log, *head_blk, *tail_blk,
-				      XLOG_MAX_ICLOGS, tmp_bp, &tmp_rhead_blk,
+				      xlog_max_iclogs(log), tmp_bp, &tmp_rhead_blk,
 				      &tmp_rhead, &tmp_wrapped);
 	xlog_put_bp(tmp_bp);
 	if (error < 0)
@@ -1175,7 +1579,7 @@ xlog_verify_head(
 		 *
 		 * Bail out if the updated head/tail match as this indicates
 		 * possible corruption outside of the acceptable
-		 * (XLOG_MAX_ICLOGS) range. This is a job for xfs_repair...
+		 * (xlog_max_iclogs()) range. This is a job for xfs_repair...
 		 */
 		*head_blk = first_bad;
 		*tail_blk = BLOCK_LSN(be64_to_cpu((*rhead)->h_tail_lsn));
@@ -1548,7 +1952,7 @@ xlog_find_zeroed(
 	 * we scan over the defined maximum blocks.  At this point, the maximum
 	 * is not chosen to mean anything special.   XXXmiken
 	 */
-	num_scan_bblks = XLOG_TOTAL_REC_SHIFT(log);
+	num_scan_bblks = xlog_max_inflight_bblks(log);
 	ASSERT(num_scan_bblks <= INT_MAX);
 
 	if (last_blk < num_scan_bblks)
@@ -1771,7 +2175,7 @@ xlog_clear_stale_blocks(
 		return 0;
 	}
 
-	max_distance = XLOG_TOTAL_REC_SHIFT(log);
+	max_distance = xlog_max_inflight_bblks(log);
 	/*
 	 * Take the smaller of the maximum amount of outstanding I/O
 	 * we could have and the distance to the tail to clear out.
@@ -1930,6 +2334,8 @@ xlog_recover_reorder_trans(
 		case XFS_LI_CUD:
 		case XFS_LI_BUI:
 		case XFS_LI_BUD:
+		case XFS_LI_SXI:
+		case XFS_LI_SXD:
 			trace_xfs_log_recover_item_reorder_tail(log,
 							trans, item, pass);
 			list_move_tail(&item->ri_list, &inode_list);
@@ -2000,6 +2406,7 @@ xlog_recover_buffer_pass1(
 		if (bcp->bc_blkno == buf_f->blf_blkno &&
 		    bcp->bc_len == buf_f->blf_len) {
 			bcp->bc_refcount++;
+			XFS_STATS_INC(log->l_mp, xs_recover_cancel_refs);
 			trace_xfs_log_recover_buf_cancel_ref_inc(log, buf_f);
 			return 0;
 		}
@@ -2011,6 +2418,7 @@ xlog_recover_buffer_pass1(
 	bcp->bc_refcount = 1;
 	list_add_tail(&bcp->bc_list, bucket);
 
+	XFS_STATS_INC(log->l_mp, xs_recover_cancel_adds);
 	trace_xfs_log_recover_buf_cancel_add(log, buf_f);
 	return 0;
 }
@@ -2021,7 +2429,7 @@ xlog_recover_buffer_pass1(
  * buffer structure to the caller.
  */
 STATIC struct xfs_buf_cancel *
-xlog_peek_buffer_cancelled(
+xlog_find_buffer_cancelled(
 	struct xlog		*log,
 	xfs_daddr_t		blkno,
 	uint			len,
@@ -2036,10 +2444,13 @@ xlog_peek_buffer_cancelled(
 		return NULL;
 	}
 
+	XFS_STATS_INC(log->l_mp, xs_recover_cancel_lookups);
 	bucket = XLOG_BUF_CANCEL_BUCKET(log, blkno);
 	list_for_each_entry(bcp, bucket, bc_list) {
-		if (bcp->bc_blkno == blkno && bcp->bc_len == len)
+		if (bcp->bc_blkno == blkno && bcp->bc_len == len) {
+			XFS_STATS_INC(log->l_mp, xs_recover_cancel_hits);
 			return bcp;
+		}
 	}
 
 	/*
@@ -2050,6 +2461,26 @@ xlog_peek_buffer_cancelled(
 	return NULL;
 }
 
+/*
+ * As xlog_find_buffer_cancelled(), but safe against pass 2 replay workers
+ * removing entries from the table at the same time.  Only the result of the
+ * lookup can be used, not the entry itself.
+ */
+STATIC bool
+xlog_peek_buffer_cancelled(
+	struct xlog		*log,
+	xfs_daddr_t		blkno,
+	uint			len,
+	unsigned short		flags)
+{
+	bool			found;
+
+	spin_lock(&log->l_buf_cancel_lock);
+	found = xlog_find_buffer_cancelled(log, blkno, len, flags) != NULL;
+	spin_unlock(&log->l_buf_cancel_lock);
+	return found;
+}
+
 /*
  * If the buffer is being cancelled then return 1 so that it will be cancelled,
  * otherwise return 0.  If the buffer is actually a buffer cancel item
@@ -2069,9 +2500,12 @@ xlog_check_buffer_cancelled(
 {
 	struct xfs_buf_cancel	*bcp;
 
-	bcp = xlog_peek_buffer_cancelled(log, blkno, len, flags);
-	if (!bcp)
+	spin_lock(&log->l_buf_cancel_lock);
+	bcp = xlog_find_buffer_cancelled(log, blkno, len, flags);
+	if (!bcp) {
+		spin_unlock(&log->l_buf_cancel_lock);
 		return 0;
+	}
 
 	/*
 	 * We've go a match, so return 1 so that the recovery of this buffer
@@ -2085,6 +2519,7 @@ xlog_check_buffer_cancelled(
 			kmem_free(bcp);
 		}
 	}
+	spin_unlock(&log->l_buf_cancel_lock);
 	return 1;
 }
 
@@ -2942,6 +3377,44 @@ xfs_recover_inode_owner_change(
 	return error;
 }
 
+/*
+ * Replay a compact inode core.  These are only logged for v3 inodes whose
+ * last full core has already been written back, so the on-disk inode is the
+ * base to apply the logged fields to unless it is already more recent.
+ */
+STATIC int
+xlog_recover_inode_compact(
+	struct xlog			*log,
+	struct xlog_recover_item	*item,
+	struct xfs_inode_log_format	*in_f,
+	struct xfs_dinode		*dip,
+	xfs_lsn_t			current_lsn)
+{
+	struct xfs_log_dinode_small	*lsdip = item->ri_buf[1].i_addr;
+	xfs_lsn_t			lsn;
+
+	if (unlikely(in_f->ilf_size != 2 ||
+		     item->ri_buf[1].i_len != sizeof(*lsdip) ||
+		     lsdip->di_magic != XFS_DINODE_MAGIC ||
+		     dip->di_version < 3)) {
+		xfs_alert(log->l_mp,
+	"%s: Bad compact inode log record, rec ptr 0x%p, ino %Ld",
+			__func__, item, in_f->ilf_ino);
+		XFS_ERROR_REPORT("xlog_recover_inode_pass2(8)",
+				 XFS_ERRLEVEL_LOW, log->l_mp);
+		return -EFSCORRUPTED;
+	}
+
+	lsn = be64_to_cpu(dip->di_lsn);
+	if (lsn && lsn != -1 && XFS_LSN_CMP(lsn, current_lsn) >= 0) {
+		trace_xfs_log_recover_inode_skip(log, in_f);
+		return 0;
+	}
+
+	xfs_log_dinode_small_to_disk(lsdip, dip);
+	return 0;
+}
+
 STATIC int
 xlog_recover_inode_pass2(
 	struct xlog			*log,
@@ -2996,7 +3469,6 @@ xlog_recover_inode_pass2(
 		xfs_buf_ioerror_alert(bp, "xlog_recover_do..(read#2)");
 		goto out_release;
 	}
-	ASSERT(in_f->ilf_fields & XFS_ILOG_CORE);
 	dip = xfs_buf_offset(bp, in_f->ilf_boffset);
 
 	/*
@@ -3012,6 +3484,16 @@ xlog_recover_inode_pass2(
 		error = -EFSCORRUPTED;
 		goto out_release;
 	}
+
+	if (in_f->ilf_fields & XFS_ILOG_CCORE) {
+		error = xlog_recover_inode_compact(log, item, in_f, dip,
+						   current_lsn);
+		if (error)
+			goto out_release;
+		goto out_owner_change;
+	}
+
+	ASSERT(in_f->ilf_fields & XFS_ILOG_CORE);
 	ldip = item->ri_buf[1].i_addr;
 	if (unlikely(ldip->di_magic != XFS_DINODE_MAGIC)) {
 		xfs_alert(mp,
@@ -3069,7 +3551,9 @@ xlog_recover_inode_pass2(
 
 	if (unlikely(S_ISREG(ldip->di_mode))) {
 		if ((ldip->di_format != XFS_DINODE_FMT_EXTENTS) &&
-		    (ldip->di_format != XFS_DINODE_FMT_BTREE)) {
+		    (ldip->di_format != XFS_DINODE_FMT_BTREE) &&
+		    (ldip->di_format != XFS_DINODE_FMT_LOCAL ||
+		     !xfs_sb_version_hasinlinedata(&mp->m_sb))) {
 			XFS_CORRUPTION_ERROR("xlog_recover_inode_pass2(3)",
 					 XFS_ERRLEVEL_LOW, mp, ldip);
 			xfs_alert(mp,
@@ -3793,31 +4277,117 @@ xlog_recover_bud_pass2(
 }
 
 /*
- * This routine is called when an inode create format structure is found in a
- * committed transaction in the log.  It's purpose is to initialise the inodes
- * being allocated on disk. This requires us to get inode cluster buffers that
- * match the range to be initialised, stamped with inode templates and written
- * by delayed write so that subsequent modifications will hit the cached buffer
- * and only need writing out at the end of recovery.
+ * This routine is called to create an in-core extent swap intent
+ * item from the sxi format structure which was logged on disk.
+ * It allocates an in-core sxi, copies the range into it, and adds
+ * the sxi to the AIL with the given LSN.
  */
 STATIC int
-xlog_recover_do_icreate_pass2(
-	struct xlog		*log,
-	struct list_head	*buffer_list,
-	xlog_recover_item_t	*item)
+xlog_recover_sxi_pass2(
+	struct xlog			*log,
+	struct xlog_recover_item	*item,
+	xfs_lsn_t			lsn)
 {
-	struct xfs_mount	*mp = log->l_mp;
-	struct xfs_icreate_log	*icl;
-	xfs_agnumber_t		agno;
-	xfs_agblock_t		agbno;
-	unsigned int		count;
-	unsigned int		isize;
-	xfs_agblock_t		length;
-	int			blks_per_cluster;
-	int			bb_per_cluster;
-	int			cancel_count;
-	int			nbufs;
-	int			i;
+	struct xfs_mount		*mp = log->l_mp;
+	struct xfs_sxi_log_item		*sxip;
+
+	if (item->ri_buf[0].i_len != sizeof(struct xfs_sxi_log_format))
+		return -EFSCORRUPTED;
+	sxip = xfs_sxi_init(mp);
+	memcpy(&sxip->sxi_format, item->ri_buf[0].i_addr,
+			sizeof(struct xfs_sxi_log_format));
+
+	spin_lock(&log->l_ailp->xa_lock);
+	/*
+	 * The SXI has two references. One for the SXD and one for SXI to ensure
+	 * it makes it into the AIL. Insert the SXI into the AIL directly and
+	 * drop the SXI reference. Note that xfs_trans_ail_update() drops the
+	 * AIL lock.
+	 */
+	xfs_trans_ail_update(log->l_ailp, &sxip->sxi_item, lsn);
+	xfs_sxi_release(sxip);
+	return 0;
+}
+
+/*
+ * This routine is called when an SXD format structure is found in a committed
+ * transaction in the log. Its purpose is to cancel the corresponding SXI if it
+ * was still in the log. To do this it searches the AIL for the SXI with an id
+ * equal to that in the SXD format structure. If we find it we drop the SXD
+ * reference, which removes the SXI from the AIL and frees it.
+ */
+STATIC int
+xlog_recover_sxd_pass2(
+	struct xlog			*log,
+	struct xlog_recover_item	*item)
+{
+	struct xfs_sxd_log_format	*sxd_formatp;
+	struct xfs_sxi_log_item		*sxip = NULL;
+	struct xfs_log_item		*lip;
+	uint64_t			sxi_id;
+	struct xfs_ail_cursor		cur;
+	struct xfs_ail			*ailp = log->l_ailp;
+
+	sxd_formatp = item->ri_buf[0].i_addr;
+	if (item->ri_buf[0].i_len != sizeof(struct xfs_sxd_log_format))
+		return -EFSCORRUPTED;
+	sxi_id = sxd_formatp->sxd_sxi_id;
+
+	/*
+	 * Search for the SXI with the id in the SXD format structure in the
+	 * AIL.
+	 */
+	spin_lock(&ailp->xa_lock);
+	lip = xfs_trans_ail_cursor_first(ailp, &cur, 0);
+	while (lip != NULL) {
+		if (lip->li_type == XFS_LI_SXI) {
+			sxip = (struct xfs_sxi_log_item *)lip;
+			if (sxip->sxi_format.sxi_id == sxi_id) {
+				/*
+				 * Drop the SXD reference to the SXI. This
+				 * removes the SXI from the AIL and frees it.
+				 */
+				spin_unlock(&ailp->xa_lock);
+				xfs_sxi_release(sxip);
+				spin_lock(&ailp->xa_lock);
+				break;
+			}
+		}
+		lip = xfs_trans_ail_cursor_next(ailp, &cur);
+	}
+
+	xfs_trans_ail_cursor_done(&cur);
+	spin_unlock(&ailp->xa_lock);
+
+	return 0;
+}
+
+/*
+ * This routine is called when an inode create format structure is found in a
+ * committed transaction in the log.  It's purpose is to initialise the inodes
+ * being allocated on disk. This requires us to get inode cluster buffers that
+ * match the range to be initialised, stamped with inode templates and written
+ * by delayed write so that subsequent modifications will hit the cached buffer
+ * and only need writing out at the end of recovery.
+ */
+STATIC int
+xlog_recover_do_icreate_pass2(
+	struct xlog		*log,
+	struct list_head	*buffer_list,
+	xlog_recover_item_t	*item)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_icreate_log	*icl;
+	xfs_agnumber_t		agno;
+	xfs_agblock_t		agbno;
+	unsigned int		count;
+	unsigned int		isize;
+	xfs_agblock_t		length;
+	int			blks_per_cluster;
+	int			bb_per_cluster;
+	int			cancel_count;
+	int			nbufs;
+	int			i;
 
 	icl = (struct xfs_icreate_log *)item->ri_buf[0].i_addr;
 	if (icl->icl_type != XFS_LI_ICREATE) {
@@ -4023,6 +4593,8 @@ xlog_recover_ra_pass2(
 	case XFS_LI_CUD:
 	case XFS_LI_BUI:
 	case XFS_LI_BUD:
+	case XFS_LI_SXI:
+	case XFS_LI_SXD:
 	default:
 		break;
 	}
@@ -4052,6 +4624,8 @@ xlog_recover_commit_pass1(
 	case XFS_LI_CUD:
 	case XFS_LI_BUI:
 	case XFS_LI_BUD:
+	case XFS_LI_SXI:
+	case XFS_LI_SXD:
 		/* nothing to do in pass 1 */
 		return 0;
 	default:
@@ -4063,40 +4637,39 @@ xlog_recover_commit_pass1(
 }
 
 STATIC int
-xlog_recover_commit_pass2(
+xlog_recover_replay_item(
 	struct xlog			*log,
-	struct xlog_recover		*trans,
 	struct list_head		*buffer_list,
-	struct xlog_recover_item	*item)
+	struct xlog_recover_item	*item,
+	xfs_lsn_t			lsn)
 {
-	trace_xfs_log_recover_item_recover(log, trans, item, XLOG_RECOVER_PASS2);
-
 	switch (ITEM_TYPE(item)) {
 	case XFS_LI_BUF:
-		return xlog_recover_buffer_pass2(log, buffer_list, item,
-						 trans->r_lsn);
+		return xlog_recover_buffer_pass2(log, buffer_list, item, lsn);
 	case XFS_LI_INODE:
-		return xlog_recover_inode_pass2(log, buffer_list, item,
-						 trans->r_lsn);
+		return xlog_recover_inode_pass2(log, buffer_list, item, lsn);
 	case XFS_LI_EFI:
-		return xlog_recover_efi_pass2(log, item, trans->r_lsn);
+		return xlog_recover_efi_pass2(log, item, lsn);
 	case XFS_LI_EFD:
 		return xlog_recover_efd_pass2(log, item);
 	case XFS_LI_RUI:
-		return xlog_recover_rui_pass2(log, item, trans->r_lsn);
+		return xlog_recover_rui_pass2(log, item, lsn);
 	case XFS_LI_RUD:
 		return xlog_recover_rud_pass2(log, item);
 	case XFS_LI_CUI:
-		return xlog_recover_cui_pass2(log, item, trans->r_lsn);
+		return xlog_recover_cui_pass2(log, item, lsn);
 	case XFS_LI_CUD:
 		return xlog_recover_cud_pass2(log, item);
 	case XFS_LI_BUI:
-		return xlog_recover_bui_pass2(log, item, trans->r_lsn);
+		return xlog_recover_bui_pass2(log, item, lsn);
 	case XFS_LI_BUD:
 		return xlog_recover_bud_pass2(log, item);
+	case XFS_LI_SXI:
+		return xlog_recover_sxi_pass2(log, item, lsn);
+	case XFS_LI_SXD:
+		return xlog_recover_sxd_pass2(log, item);
 	case XFS_LI_DQUOT:
-		return xlog_recover_dquot_pass2(log, buffer_list, item,
-						trans->r_lsn);
+		return xlog_recover_dquot_pass2(log, buffer_list, item, lsn);
 	case XFS_LI_ICREATE:
 		return xlog_recover_do_icreate_pass2(log, buffer_list, item);
 	case XFS_LI_QUOTAOFF:
@@ -4110,6 +4683,264 @@ xlog_recover_commit_pass2(
 	}
 }
 
+STATIC int
+xlog_recover_commit_pass2(
+	struct xlog			*log,
+	struct xlog_recover		*trans,
+	struct list_head		*buffer_list,
+	struct xlog_recover_item	*item)
+{
+	trace_xfs_log_recover_item_recover(log, trans, item, XLOG_RECOVER_PASS2);
+
+	return xlog_recover_replay_item(log, buffer_list, item, trans->r_lsn);
+}
+
+/*
+ * Parallel pass 2 replay.
+ *
+ * Buffer, inode, dquot and inode create items only ever touch metadata in the
+ * AG they live in, and every item that touches a given piece of metadata lives
+ * in the same AG.  We can therefore hash the items onto a set of partitions by
+ * AG as the transactions are committed, keeping log order within each
+ * partition, and replay the partitions concurrently.  Everything else (the
+ * intent items) is replayed in line as before; those only insert into or
+ * remove from the AIL and don't depend on the metadata being replayed.
+ *
+ * Readahead for the queued items is issued as they are committed, so by the
+ * time a batch is handed to the workers most of the buffers they need are
+ * already on their way in.  Batches are flushed once enough items have been
+ * queued, and at the end of the pass.
+ */
+#define XLOG_RECOVER_MAX_WORKERS	16
+#define XLOG_RECOVER_REPLAY_BATCH	4096
+
+/*
+ * How many AGs can usefully be worked on at once during recovery.  A return
+ * value of less than two means recovery should stay single threaded.
+ */
+STATIC int
+xlog_recover_nr_workers(
+	struct xfs_mount		*mp)
+{
+	int				nr;
+
+	nr = min_t(int, num_online_cpus(), XLOG_RECOVER_MAX_WORKERS);
+	return min_t(xfs_agnumber_t, nr, mp->m_sb.sb_agcount);
+}
+
+struct xlog_recover_part {
+	struct work_struct	rp_work;
+	struct xlog		*rp_log;
+	struct list_head	rp_items;	/* items to replay, in log order */
+	struct list_head	rp_buffer_list;	/* delwri buffers */
+	int			rp_error;
+};
+
+struct xlog_recover_replay {
+	struct workqueue_struct	*rr_wq;
+	int			rr_queued;	/* items across all partitions */
+	int			rr_nparts;
+	struct xlog_recover_part rr_parts[];
+};
+
+STATIC void
+xlog_recover_free_item(
+	struct xlog_recover_item	*item)
+{
+	int				i;
+
+	list_del(&item->ri_list);
+	for (i = 0; i < item->ri_cnt; i++)
+		kmem_free(item->ri_buf[i].i_addr);
+	kmem_free(item->ri_buf);
+	kmem_free(item);
+}
+
+/*
+ * Work out which AG a pass 2 item modifies, if it is one that can be replayed
+ * independently of the items in other AGs.
+ */
+STATIC bool
+xlog_recover_item_agno(
+	struct xlog			*log,
+	struct xlog_recover_item	*item,
+	xfs_agnumber_t			*agno)
+{
+	struct xfs_mount		*mp = log->l_mp;
+	struct xfs_inode_log_format	ilf_buf;
+	struct xfs_inode_log_format	*ilfp;
+	struct xfs_buf_log_format	*buf_f;
+	struct xfs_dq_logformat		*dq_f;
+	struct xfs_icreate_log		*icl;
+
+	switch (ITEM_TYPE(item)) {
+	case XFS_LI_BUF:
+		buf_f = item->ri_buf[0].i_addr;
+		*agno = xfs_daddr_to_agno(mp, buf_f->blf_blkno);
+		return true;
+	case XFS_LI_INODE:
+		if (item->ri_buf[0].i_len == sizeof(*ilfp)) {
+			ilfp = item->ri_buf[0].i_addr;
+		} else {
+			ilfp = &ilf_buf;
+			memset(ilfp, 0, sizeof(*ilfp));
+			if (xfs_inode_item_format_convert(&item->ri_buf[0],
+							  ilfp))
+				return false;
+		}
+		*agno = xfs_daddr_to_agno(mp, ilfp->ilf_blkno);
+		return true;
+	case XFS_LI_DQUOT:
+		dq_f = item->ri_buf[0].i_addr;
+		*agno = xfs_daddr_to_agno(mp, dq_f->qlf_blkno);
+		return true;
+	case XFS_LI_ICREATE:
+		icl = item->ri_buf[0].i_addr;
+		*agno = be32_to_cpu(icl->icl_ag);
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Move @item from its transaction onto the replay partition for its AG.
+ * Returns false if the item has to be replayed in line.
+ */
+STATIC bool
+xlog_recover_queue_item(
+	struct xlog			*log,
+	struct xlog_recover		*trans,
+	struct xlog_recover_item	*item)
+{
+	struct xlog_recover_replay	*replay = log->l_recover_replay;
+	struct xlog_recover_part	*part;
+	xfs_agnumber_t			agno;
+
+	if (!replay || !xlog_recover_item_agno(log, item, &agno))
+		return false;
+
+	trace_xfs_log_recover_item_recover(log, trans, item, XLOG_RECOVER_PASS2);
+
+	part = &replay->rr_parts[agno % replay->rr_nparts];
+	item->ri_lsn = trans->r_lsn;
+	list_move_tail(&item->ri_list, &part->rp_items);
+	replay->rr_queued++;
+	return true;
+}
+
+STATIC void
+xlog_recover_replay_worker(
+	struct work_struct		*work)
+{
+	struct xlog_recover_part	*part =
+		container_of(work, struct xlog_recover_part, rp_work);
+	struct xlog_recover_item	*item;
+
+	list_for_each_entry(item, &part->rp_items, ri_list) {
+		part->rp_error = xlog_recover_replay_item(part->rp_log,
+				&part->rp_buffer_list, item, item->ri_lsn);
+		if (part->rp_error)
+			break;
+		cond_resched();
+	}
+}
+
+/*
+ * Replay everything queued on the partitions and wait for it to finish.  The
+ * delwri buffers dirtied by the workers are moved to @buffer_list so that they
+ * get written back with everything else at the end of the pass.
+ */
+STATIC int
+xlog_recover_replay_flush(
+	struct xlog			*log,
+	struct list_head		*buffer_list)
+{
+	struct xlog_recover_replay	*replay = log->l_recover_replay;
+	struct xlog_recover_item	*item, *n;
+	int				error = 0;
+	int				i;
+
+	if (!replay || !replay->rr_queued)
+		return 0;
+
+	for (i = 0; i < replay->rr_nparts; i++) {
+		if (!list_empty(&replay->rr_parts[i].rp_items))
+			queue_work(replay->rr_wq, &replay->rr_parts[i].rp_work);
+	}
+	flush_workqueue(replay->rr_wq);
+
+	for (i = 0; i < replay->rr_nparts; i++) {
+		struct xlog_recover_part *part = &replay->rr_parts[i];
+
+		if (!error)
+			error = part->rp_error;
+		part->rp_error = 0;
+		list_splice_tail_init(&part->rp_buffer_list, buffer_list);
+		list_for_each_entry_safe(item, n, &part->rp_items, ri_list)
+			xlog_recover_free_item(item);
+	}
+	replay->rr_queued = 0;
+	return error;
+}
+
+/*
+ * Set up parallel replay for pass 2.  If we can't, or there is no point
+ * because there is only one AG or one CPU, replay stays single threaded.
+ */
+STATIC void
+xlog_recover_replay_init(
+	struct xlog			*log)
+{
+	struct xfs_mount		*mp = log->l_mp;
+	struct xlog_recover_replay	*replay;
+	int				nparts;
+	int				i;
+
+	nparts = xlog_recover_nr_workers(mp);
+	if (nparts < 2)
+		return;
+
+	replay = kmem_zalloc(sizeof(*replay) +
+			     nparts * sizeof(struct xlog_recover_part),
+			     KM_MAYFAIL);
+	if (!replay)
+		return;
+
+	replay->rr_wq = alloc_workqueue("xfs-recover/%s", WQ_UNBOUND, nparts,
+					mp->m_fsname);
+	if (!replay->rr_wq) {
+		kmem_free(replay);
+		return;
+	}
+
+	replay->rr_nparts = nparts;
+	for (i = 0; i < nparts; i++) {
+		struct xlog_recover_part *part = &replay->rr_parts[i];
+
+		INIT_WORK(&part->rp_work, xlog_recover_replay_worker);
+		part->rp_log = log;
+		INIT_LIST_HEAD(&part->rp_items);
+		INIT_LIST_HEAD(&part->rp_buffer_list);
+	}
+	log->l_recover_replay = replay;
+}
+
+STATIC void
+xlog_recover_replay_destroy(
+	struct xlog			*log)
+{
+	struct xlog_recover_replay	*replay = log->l_recover_replay;
+
+	if (!replay)
+		return;
+
+	ASSERT(replay->rr_queued == 0);
+	destroy_workqueue(replay->rr_wq);
+	kmem_free(replay);
+	log->l_recover_replay = NULL;
+}
+
 STATIC int
 xlog_recover_items_pass2(
 	struct xlog                     *log,
@@ -4165,6 +4996,8 @@ xlog_recover_commit_trans(
 			break;
 		case XLOG_RECOVER_PASS2:
 			xlog_recover_ra_pass2(log, item);
+			if (xlog_recover_queue_item(log, trans, item))
+				break;
 			list_move_tail(&item->ri_list, &ra_list);
 			items_queued++;
 			if (items_queued >= XLOG_RECOVER_COMMIT_QUEUE_MAX) {
@@ -4194,6 +5027,10 @@ xlog_recover_commit_trans(
 	if (!list_empty(&done_list))
 		list_splice_init(&done_list, &trans->r_itemq);
 
+	if (!error && log->l_recover_replay &&
+	    log->l_recover_replay->rr_queued >= XLOG_RECOVER_REPLAY_BATCH)
+		error = xlog_recover_replay_flush(log, buffer_list);
+
 	return error;
 }
 
@@ -4352,19 +5189,11 @@ xlog_recover_free_trans(
 	struct xlog_recover	*trans)
 {
 	xlog_recover_item_t	*item, *n;
-	int			i;
 
 	hlist_del_init(&trans->r_list);
 
-	list_for_each_entry_safe(item, n, &trans->r_itemq, ri_list) {
-		/* Free the regions in the item. */
-		list_del(&item->ri_list);
-		for (i = 0; i < item->ri_cnt; i++)
-			kmem_free(item->ri_buf[i].i_addr);
-		/* Free the item itself */
-		kmem_free(item->ri_buf);
-		kmem_free(item);
-	}
+	list_for_each_entry_safe(item, n, &trans->r_itemq, ri_list)
+		xlog_recover_free_item(item);
 	/* Free the transaction recover structure */
 	kmem_free(trans);
 }
@@ -4763,6 +5592,46 @@ xlog_recover_cancel_bui(
 	spin_lock(&ailp->xa_lock);
 }
 
+/* Recover the SXI if necessary. */
+STATIC int
+xlog_recover_process_sxi(
+	struct xfs_mount		*mp,
+	struct xfs_ail			*ailp,
+	struct xfs_log_item		*lip)
+{
+	struct xfs_sxi_log_item		*sxip;
+	int				error;
+
+	/*
+	 * Skip SXIs that we've already processed.
+	 */
+	sxip = container_of(lip, struct xfs_sxi_log_item, sxi_item);
+	if (test_bit(XFS_SXI_RECOVERED, &sxip->sxi_flags))
+		return 0;
+
+	spin_unlock(&ailp->xa_lock);
+	error = xfs_sxi_recover(mp, sxip);
+	spin_lock(&ailp->xa_lock);
+
+	return error;
+}
+
+/* Release the SXI since we're cancelling everything. */
+STATIC void
+xlog_recover_cancel_sxi(
+	struct xfs_mount		*mp,
+	struct xfs_ail			*ailp,
+	struct xfs_log_item		*lip)
+{
+	struct xfs_sxi_log_item		*sxip;
+
+	sxip = container_of(lip, struct xfs_sxi_log_item, sxi_item);
+
+	spin_unlock(&ailp->xa_lock);
+	xfs_sxi_release(sxip);
+	spin_lock(&ailp->xa_lock);
+}
+
 /* Is this log item a deferred action intent? */
 static inline bool xlog_item_is_intent(struct xfs_log_item *lip)
 {
@@ -4771,12 +5640,217 @@ static inline bool xlog_item_is_intent(struct xfs_log_item *lip)
 	case XFS_LI_RUI:
 	case XFS_LI_CUI:
 	case XFS_LI_BUI:
+	case XFS_LI_SXI:
 		return true;
 	default:
 		return false;
 	}
 }
 
+/* Recover a single intent item.  Called with the AIL lock held. */
+STATIC int
+xlog_recover_process_intent(
+	struct xlog		*log,
+	struct xfs_ail		*ailp,
+	struct xfs_log_item	*lip)
+{
+	switch (lip->li_type) {
+	case XFS_LI_EFI:
+		return xlog_recover_process_efi(log->l_mp, ailp, lip);
+	case XFS_LI_RUI:
+		return xlog_recover_process_rui(log->l_mp, ailp, lip);
+	case XFS_LI_CUI:
+		return xlog_recover_process_cui(log->l_mp, ailp, lip);
+	case XFS_LI_BUI:
+		return xlog_recover_process_bui(log->l_mp, ailp, lip);
+	case XFS_LI_SXI:
+		return xlog_recover_process_sxi(log->l_mp, ailp, lip);
+	default:
+		ASSERT(0);
+		return 0;
+	}
+}
+
+/*
+ * Work out which AG an intent mostly operates on.  Extent based intents use
+ * the AG of their first extent, bmap intents the AG of the inode they change.
+ * This is only used to spread the intents over the recovery workers, so it
+ * doesn't matter if the on-disk values are garbage; the recovery functions
+ * validate the intent before doing anything with it.
+ */
+STATIC xfs_agnumber_t
+xlog_recover_intent_agno(
+	struct xfs_mount	*mp,
+	struct xfs_log_item	*lip)
+{
+	struct xfs_efi_log_item	*efip;
+	struct xfs_rui_log_item	*ruip;
+	struct xfs_cui_log_item	*cuip;
+	struct xfs_bui_log_item	*buip;
+
+	switch (lip->li_type) {
+	case XFS_LI_EFI:
+		efip = container_of(lip, struct xfs_efi_log_item, efi_item);
+		return XFS_FSB_TO_AGNO(mp,
+				efip->efi_format.efi_extents[0].ext_start);
+	case XFS_LI_RUI:
+		ruip = container_of(lip, struct xfs_rui_log_item, rui_item);
+		return XFS_FSB_TO_AGNO(mp,
+				ruip->rui_format.rui_extents[0].me_startblock);
+	case XFS_LI_CUI:
+		cuip = container_of(lip, struct xfs_cui_log_item, cui_item);
+		return XFS_FSB_TO_AGNO(mp,
+				cuip->cui_format.cui_extents[0].pe_startblock);
+	case XFS_LI_BUI:
+		buip = container_of(lip, struct xfs_bui_log_item, bui_item);
+		return XFS_INO_TO_AGNO(mp,
+				buip->bui_format.bui_extents[0].me_owner);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Parallel intent recovery.
+ *
+ * Each intent is recovered in its own transaction chain, and the deferred
+ * operations it spawns are finished within that chain, so intents that work on
+ * different AGs don't depend on each other.  We hash the intents onto a set of
+ * workers by AG, keeping AIL (and hence log) order within each worker, so that
+ * intents touching the same AG are still recovered in the order they were
+ * logged.
+ */
+struct xlog_recover_intent {
+	struct list_head	ri_list;
+	struct xfs_log_item	*ri_lip;
+};
+
+struct xlog_recover_intent_part {
+	struct work_struct	ip_work;
+	struct xlog		*ip_log;
+	struct list_head	ip_intents;
+	int			ip_error;
+};
+
+STATIC void
+xlog_recover_intent_worker(
+	struct work_struct	*work)
+{
+	struct xlog_recover_intent_part *part =
+		container_of(work, struct xlog_recover_intent_part, ip_work);
+	struct xfs_ail		*ailp = part->ip_log->l_ailp;
+	struct xlog_recover_intent *rip;
+
+	list_for_each_entry(rip, &part->ip_intents, ri_list) {
+		spin_lock(&ailp->xa_lock);
+		part->ip_error = xlog_recover_process_intent(part->ip_log,
+				ailp, rip->ri_lip);
+		spin_unlock(&ailp->xa_lock);
+		if (part->ip_error)
+			break;
+	}
+}
+
+/*
+ * Collect the intents from the AIL and recover them concurrently.  Returns
+ * -EAGAIN if we couldn't set up the workers and the caller should fall back to
+ * recovering the intents serially.
+ */
+STATIC int
+xlog_recover_process_intents_parallel(
+	struct xlog		*log,
+	int			nparts)
+{
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_ail		*ailp = log->l_ailp;
+	struct xfs_ail_cursor	cur;
+	struct xfs_log_item	*lip;
+	struct workqueue_struct	*wq;
+	struct xlog_recover_intent_part *parts;
+	struct xlog_recover_intent *intents;
+	int			nr = 0;
+	int			i;
+	int			error = 0;
+	bool			swaps = false;
+
+	/*
+	 * Nothing else is running yet, so the set of intents in the AIL can't
+	 * change between counting them and collecting them.
+	 */
+	spin_lock(&ailp->xa_lock);
+	for (lip = xfs_trans_ail_cursor_first(ailp, &cur, 0);
+	     lip && xlog_item_is_intent(lip);
+	     lip = xfs_trans_ail_cursor_next(ailp, &cur)) {
+		if (lip->li_type == XFS_LI_SXI)
+			swaps = true;
+		nr++;
+	}
+	xfs_trans_ail_cursor_done(&cur);
+	spin_unlock(&ailp->xa_lock);
+
+	/*
+	 * An extent swap leaves bmap intents for both of its inodes in the
+	 * log, and the unmap from one inode has to be recovered before the
+	 * map into the other or the rmapbt would see two owners for the same
+	 * blocks.  The inodes needn't be in the same AG, so recover serially.
+	 */
+	if (nr < 2 || swaps)
+		return -EAGAIN;
+
+	intents = kmem_zalloc_large(nr * sizeof(*intents), KM_MAYFAIL);
+	if (!intents)
+		return -EAGAIN;
+	parts = kmem_zalloc(nparts * sizeof(*parts), KM_MAYFAIL);
+	if (!parts)
+		goto out_free_intents;
+	wq = alloc_workqueue("xfs-recover/%s", WQ_UNBOUND, nparts,
+			     mp->m_fsname);
+	if (!wq)
+		goto out_free_parts;
+
+	for (i = 0; i < nparts; i++) {
+		INIT_WORK(&parts[i].ip_work, xlog_recover_intent_worker);
+		parts[i].ip_log = log;
+		INIT_LIST_HEAD(&parts[i].ip_intents);
+	}
+
+	i = 0;
+	spin_lock(&ailp->xa_lock);
+	for (lip = xfs_trans_ail_cursor_first(ailp, &cur, 0);
+	     lip && xlog_item_is_intent(lip) && i < nr;
+	     lip = xfs_trans_ail_cursor_next(ailp, &cur)) {
+		struct xlog_recover_intent_part *part;
+
+		part = &parts[xlog_recover_intent_agno(mp, lip) % nparts];
+		intents[i].ri_lip = lip;
+		list_add_tail(&intents[i].ri_list, &part->ip_intents);
+		i++;
+	}
+	xfs_trans_ail_cursor_done(&cur);
+	spin_unlock(&ailp->xa_lock);
+
+	for (i = 0; i < nparts; i++) {
+		if (!list_empty(&parts[i].ip_intents))
+			queue_work(wq, &parts[i].ip_work);
+	}
+	flush_workqueue(wq);
+	destroy_workqueue(wq);
+
+	for (i = 0; i < nparts; i++) {
+		if (!error)
+			error = parts[i].ip_error;
+	}
+	kmem_free(parts);
+	kmem_free(intents);
+	return error;
+
+out_free_parts:
+	kmem_free(parts);
+out_free_intents:
+	kmem_free(intents);
+	return -EAGAIN;
+}
+
 /*
  * When this is called, all of the log intent items which did not have
  * corresponding log done items should be in the AIL.  What we do now
@@ -4802,6 +5876,15 @@ xlog_recover_process_intents(
 	struct xfs_ail_cursor	cur;
 	struct xfs_ail		*ailp;
 	xfs_lsn_t		last_lsn;
+	int			nparts;
+
+	nparts = xlog_recover_nr_workers(log->l_mp);
+	if (nparts > 1) {
+		error = xlog_recover_process_intents_parallel(log, nparts);
+		if (error != -EAGAIN)
+			return error;
+		error = 0;
+	}
 
 	ailp = log->l_ailp;
 	spin_lock(&ailp->xa_lock);
@@ -4827,20 +5910,7 @@ xlog_recover_process_intents(
 		 */
 		ASSERT(XFS_LSN_CMP(last_lsn, lip->li_lsn) >= 0);
 
-		switch (lip->li_type) {
-		case XFS_LI_EFI:
-			error = xlog_recover_process_efi(log->l_mp, ailp, lip);
-			break;
-		case XFS_LI_RUI:
-			error = xlog_recover_process_rui(log->l_mp, ailp, lip);
-			break;
-		case XFS_LI_CUI:
-			error = xlog_recover_process_cui(log->l_mp, ailp, lip);
-			break;
-		case XFS_LI_BUI:
-			error = xlog_recover_process_bui(log->l_mp, ailp, lip);
-			break;
-		}
+		error = xlog_recover_process_intent(log, ailp, lip);
 		if (error)
 			goto out;
 		lip = xfs_trans_ail_cursor_next(ailp, &cur);
@@ -4893,6 +5963,9 @@ xlog_recover_cancel_intents(
 		case XFS_LI_BUI:
 			xlog_recover_cancel_bui(log->l_mp, ailp, lip);
 			break;
+		case XFS_LI_SXI:
+			xlog_recover_cancel_sxi(log->l_mp, ailp, lip);
+			break;
 		}
 
 		lip = xfs_trans_ail_cursor_next(ailp, &cur);
@@ -5003,6 +6076,109 @@ xlog_recover_process_one_iunlink(
 	return NULLAGINO;
 }
 
+/*
+ * Process the unlinked lists of a single AG.
+ */
+STATIC void
+xlog_recover_process_iunlinks_ag(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno)
+{
+	struct xfs_agi		*agi;
+	struct xfs_buf		*agibp;
+	xfs_agino_t		agino;
+	int			bucket;
+	int			error;
+
+	/*
+	 * Find the agi for this ag.
+	 */
+	error = xfs_read_agi(mp, NULL, agno, &agibp);
+	if (error) {
+		/*
+		 * AGI is b0rked. Don't process it.
+		 *
+		 * We should probably mark the filesystem as corrupt
+		 * after we've recovered all the ag's we can....
+		 */
+		return;
+	}
+	/*
+	 * Unlock the buffer so that it can be acquired in the normal
+	 * course of the transaction to truncate and free each inode.
+	 * Because we are not racing with anyone else here for the AGI
+	 * buffer, we don't even need to hold it locked to read the
+	 * initial unlinked bucket entries out of the buffer. We keep
+	 * buffer reference though, so that it stays pinned in memory
+	 * while we need the buffer.
+	 */
+	agi = XFS_BUF_TO_AGI(agibp);
+	xfs_buf_unlock(agibp);
+
+	for (bucket = 0; bucket < XFS_AGI_UNLINKED_BUCKETS; bucket++) {
+		agino = be32_to_cpu(agi->agi_unlinked[bucket]);
+		while (agino != NULLAGINO) {
+			agino = xlog_recover_process_one_iunlink(mp,
+						agno, agino, bucket);
+			cond_resched();
+		}
+	}
+	xfs_buf_rele(agibp);
+}
+
+/*
+ * Each AG's unlinked lists are only ever modified by transactions on inodes in
+ * that AG, so the AGs can be processed concurrently.  We hand out AGs to a set
+ * of workers so that the inactivation I/O for many AGs is in flight at once.
+ */
+struct xlog_recover_iunlink_work {
+	struct work_struct	iw_work;
+	struct xfs_mount	*iw_mp;
+	xfs_agnumber_t		iw_agno;
+};
+
+STATIC void
+xlog_recover_iunlink_worker(
+	struct work_struct	*work)
+{
+	struct xlog_recover_iunlink_work *iw =
+		container_of(work, struct xlog_recover_iunlink_work, iw_work);
+
+	xlog_recover_process_iunlinks_ag(iw->iw_mp, iw->iw_agno);
+}
+
+STATIC bool
+xlog_recover_process_iunlinks_parallel(
+	struct xfs_mount	*mp,
+	int			nr_workers)
+{
+	struct xlog_recover_iunlink_work *works;
+	struct workqueue_struct	*wq;
+	xfs_agnumber_t		agno;
+
+	works = kmem_zalloc_large(mp->m_sb.sb_agcount * sizeof(*works),
+				  KM_MAYFAIL);
+	if (!works)
+		return false;
+	wq = alloc_workqueue("xfs-iunlink/%s", WQ_UNBOUND, nr_workers,
+			     mp->m_fsname);
+	if (!wq) {
+		kmem_free(works);
+		return false;
+	}
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		INIT_WORK(&works[agno].iw_work, xlog_recover_iunlink_worker);
+		works[agno].iw_mp = mp;
+		works[agno].iw_agno = agno;
+		queue_work(wq, &works[agno].iw_work);
+	}
+	flush_workqueue(wq);
+	destroy_workqueue(wq);
+	kmem_free(works);
+	return true;
+}
+
 /*
  * xlog_iunlink_recover
  *
@@ -5021,11 +6197,7 @@ xlog_recover_process_iunlinks(
 {
 	xfs_mount_t	*mp;
 	xfs_agnumber_t	agno;
-	xfs_agi_t	*agi;
-	xfs_buf_t	*agibp;
-	xfs_agino_t	agino;
-	int		bucket;
-	int		error;
+	int		nr_workers;
 	uint		mp_dmevmask;
 
 	mp = log->l_mp;
@@ -5036,40 +6208,11 @@ xlog_recover_process_iunlinks(
 	mp_dmevmask = mp->m_dmevmask;
 	mp->m_dmevmask = 0;
 
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
-		/*
-		 * Find the agi for this ag.
-		 */
-		error = xfs_read_agi(mp, NULL, agno, &agibp);
-		if (error) {
-			/*
-			 * AGI is b0rked. Don't process it.
-			 *
-			 * We should probably mark the filesystem as corrupt
-			 * after we've recovered all the ag's we can....
-			 */
-			continue;
-		}
-		/*
-		 * Unlock the buffer so that it can be acquired in the normal
-		 * course of the transaction to truncate and free each inode.
-		 * Because we are not racing with anyone else here for the AGI
-		 * buffer, we don't even need to hold it locked to read the
-		 * initial unlinked bucket entries out of the buffer. We keep
-		 * buffer reference though, so that it stays pinned in memory
-		 * while we need the buffer.
-		 */
-		agi = XFS_BUF_TO_AGI(agibp);
-		xfs_buf_unlock(agibp);
-
-		for (bucket = 0; bucket < XFS_AGI_UNLINKED_BUCKETS; bucket++) {
-			agino = be32_to_cpu(agi->agi_unlinked[bucket]);
-			while (agino != NULLAGINO) {
-				agino = xlog_recover_process_one_iunlink(mp,
-							agno, agino, bucket);
-			}
-		}
-		xfs_buf_rele(agibp);
+	nr_workers = xlog_recover_nr_workers(mp);
+	if (nr_workers < 2 ||
+	    !xlog_recover_process_iunlinks_parallel(mp, nr_workers)) {
+		for (agno = 0; agno < mp->m_sb.sb_agcount; agno++)
+			xlog_recover_process_iunlinks_ag(mp, agno);
 	}
 
 	mp->m_dmevmask = mp_dmevmask;
@@ -5222,6 +6365,7 @@ xlog_do_recovery_pass(
 	xfs_daddr_t		rhead_blk;
 	char			*offset;
 	xfs_buf_t		*hbp, *dbp;
+	struct xlog_rwin	*rw;
 	int			error = 0, h_size, h_len;
 	int			error2 = 0;
 	int			bblks, split_bblks;
@@ -5308,6 +6452,8 @@ xlog_do_recovery_pass(
 		return -ENOMEM;
 	}
 
+	rw = xlog_rwin_alloc(log);
+
 	memset(rhash, 0, sizeof(rhash));
 	blk_no = rhead_blk = tail_blk;
 	if (tail_blk > head_blk) {
@@ -5325,8 +6471,8 @@ xlog_do_recovery_pass(
 			wrapped_hblks = 0;
 			if (blk_no + hblks <= log->l_logBBsize) {
 				/* Read header in one read */
-				error = xlog_bread(log, blk_no, hblks, hbp,
-						   &offset);
+				error = xlog_recover_bread(log, rw, blk_no,
+						hblks, hbp, &offset);
 				if (error)
 					goto bread_err2;
 			} else {
@@ -5336,9 +6482,9 @@ xlog_do_recovery_pass(
 					ASSERT(blk_no <= INT_MAX);
 					split_hblks = log->l_logBBsize - (int)blk_no;
 					ASSERT(split_hblks > 0);
-					error = xlog_bread(log, blk_no,
-							   split_hblks, hbp,
-							   &offset);
+					error = xlog_recover_bread(log, rw,
+							blk_no, split_hblks, hbp,
+							&offset);
 					if (error)
 						goto bread_err2;
 				}
@@ -5356,7 +6502,7 @@ xlog_do_recovery_pass(
 				 *   - order is important.
 				 */
 				wrapped_hblks = hblks - split_hblks;
-				error = xlog_bread_offset(log, 0,
+				error = xlog_recover_bread_offset(log, rw, 0,
 						wrapped_hblks, hbp,
 						offset + BBTOB(split_hblks));
 				if (error)
@@ -5369,12 +6515,18 @@ xlog_do_recovery_pass(
 				goto bread_err2;
 
 			bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
+			if (bblks > BTOBB(h_size)) {
+				XFS_ERROR_REPORT(__func__, XFS_ERRLEVEL_LOW,
+						 log->l_mp);
+				error = -EFSCORRUPTED;
+				goto bread_err2;
+			}
 			blk_no += hblks;
 
 			/* Read in data for log record */
 			if (blk_no + bblks <= log->l_logBBsize) {
-				error = xlog_bread(log, blk_no, bblks, dbp,
-						   &offset);
+				error = xlog_recover_bread(log, rw, blk_no,
+						bblks, dbp, &offset);
 				if (error)
 					goto bread_err2;
 			} else {
@@ -5390,8 +6542,8 @@ xlog_do_recovery_pass(
 					split_bblks =
 						log->l_logBBsize - (int)blk_no;
 					ASSERT(split_bblks > 0);
-					error = xlog_bread(log, blk_no,
-							split_bblks, dbp,
+					error = xlog_recover_bread(log, rw,
+							blk_no, split_bblks, dbp,
 							&offset);
 					if (error)
 						goto bread_err2;
@@ -5409,7 +6561,7 @@ xlog_do_recovery_pass(
 				 *   _first_, then the log start (LR header end)
 				 *   - order is important.
 				 */
-				error = xlog_bread_offset(log, 0,
+				error = xlog_recover_bread_offset(log, rw, 0,
 						bblks - split_bblks, dbp,
 						offset + BBTOB(split_bblks));
 				if (error)
@@ -5432,7 +6584,8 @@ xlog_do_recovery_pass(
 
 	/* read first part of physical log */
 	while (blk_no < head_blk) {
-		error = xlog_bread(log, blk_no, hblks, hbp, &offset);
+		error = xlog_recover_bread(log, rw, blk_no, hblks, hbp,
+				&offset);
 		if (error)
 			goto bread_err2;
 
@@ -5443,8 +6596,13 @@ xlog_do_recovery_pass(
 
 		/* blocks in data section */
 		bblks = (int)BTOBB(be32_to_cpu(rhead->h_len));
-		error = xlog_bread(log, blk_no+hblks, bblks, dbp,
-				   &offset);
+		if (bblks > BTOBB(h_size)) {
+			XFS_ERROR_REPORT(__func__, XFS_ERRLEVEL_LOW, log->l_mp);
+			error = -EFSCORRUPTED;
+			goto bread_err2;
+		}
+		error = xlog_recover_bread(log, rw, blk_no + hblks, bblks,
+				dbp, &offset);
 		if (error)
 			goto bread_err2;
 
@@ -5458,14 +6616,22 @@ xlog_do_recovery_pass(
 	}
 
  bread_err2:
+	xlog_rwin_free(log, rw);
 	xlog_put_bp(dbp);
  bread_err1:
 	xlog_put_bp(hbp);
 
 	/*
-	 * Submit buffers that have been added from the last record processed,
+	 * Replay whatever is still queued for the parallel replay workers, then
+	 * submit buffers that have been added from the last record processed,
 	 * regardless of error status.
 	 */
+	if (pass == XLOG_RECOVER_PASS2) {
+		error2 = xlog_recover_replay_flush(log, &buffer_list);
+		if (!error)
+			error = error2;
+		error2 = 0;
+	}
 	if (!list_empty(&buffer_list))
 		error2 = xfs_buf_delwri_submit(&buffer_list);
 
@@ -5507,6 +6673,7 @@ xlog_do_log_recovery(
 	xfs_daddr_t	head_blk,
 	xfs_daddr_t	tail_blk)
 {
+	unsigned int	nbuckets;
 	int		error, i;
 
 	ASSERT(head_blk != tail_blk);
@@ -5514,11 +6681,18 @@ xlog_do_log_recovery(
 	/*
 	 * First do a pass to find all of the cancelled buf log items.
 	 * Store them in the buf_cancel_table for use in the second pass.
+	 *
+	 * The number of cancel records scales with the size of the log, so
+	 * scale the table with it too rather than letting the hash chains
+	 * grow without bound on large logs.
 	 */
-	log->l_buf_cancel_table = kmem_zalloc(XLOG_BC_TABLE_SIZE *
+	nbuckets = clamp_t(unsigned int, log->l_logBBsize / XLOG_BC_BUCKET_BBS,
+			   XLOG_BC_TABLE_SIZE, XLOG_BC_TABLE_MAX);
+	log->l_buf_cancel_bits = ilog2(roundup_pow_of_two(nbuckets));
+	log->l_buf_cancel_table = kmem_zalloc_large(XLOG_BUF_CANCEL_SIZE(log) *
 						 sizeof(struct list_head),
 						 KM_SLEEP);
-	for (i = 0; i < XLOG_BC_TABLE_SIZE; i++)
+	for (i = 0; i < XLOG_BUF_CANCEL_SIZE(log); i++)
 		INIT_LIST_HEAD(&log->l_buf_cancel_table[i]);
 
 	error = xlog_do_recovery_pass(log, head_blk, tail_blk,
@@ -5532,13 +6706,15 @@ xlog_do_log_recovery(
 	 * Then do a second pass to actually recover the items in the log.
 	 * When it is complete free the table of buf cancel items.
 	 */
+	xlog_recover_replay_init(log);
 	error = xlog_do_recovery_pass(log, head_blk, tail_blk,
 				      XLOG_RECOVER_PASS2, NULL);
+	xlog_recover_replay_destroy(log);
 #ifdef DEBUG
 	if (!error) {
 		int	i;
 
-		for (i = 0; i < XLOG_BC_TABLE_SIZE; i++)
+		for (i = 0; i < XLOG_BUF_CANCEL_SIZE(log); i++)
 			ASSERT(list_empty(&log->l_buf_cancel_table[i]));
 	}
 #endif	/* DEBUG */
@@ -46,6 +46,7 @@
 #include "xfs_refcount_btree.h"
 #include "xfs_reflink.h"
 #include "xfs_extent_busy.h"
+#include "xfs_discard.h"
 
 
 static DEFINE_MUTEX(xfs_uuid_table_mutex);
@@ -142,6 +143,7 @@ __xfs_free_perag(
 	struct xfs_perag *pag = container_of(head, struct xfs_perag, rcu_head);
 
 	ASSERT(atomic_read(&pag->pag_ref) == 0);
+	free_percpu(pag->pag_stats);
 	kmem_free(pag);
 }
 
@@ -161,6 +163,8 @@ xfs_free_perag(
 		spin_unlock(&mp->m_perag_lock);
 		ASSERT(pag);
 		ASSERT(atomic_read(&pag->pag_ref) == 0);
+		xfs_perag_sysfs_del(pag);
+		xfs_iunlink_destroy(pag);
 		xfs_buf_hash_destroy(pag);
 		call_rcu(&pag->rcu_head, __xfs_free_perag);
 	}
@@ -184,6 +188,29 @@ xfs_sb_validate_fsb_count(
 	return 0;
 }
 
+/*
+ * Spread the AGs round-robin across the online NUMA nodes. Metadata buffers
+ * for an AG are allocated on its node, so each node's memory and buffer LRU
+ * only caches the metadata of its own subset of the AGs.
+ */
+STATIC int
+xfs_perag_buf_nid(
+	xfs_agnumber_t	agno)
+{
+	int		nid;
+	int		n;
+
+	if (num_online_nodes() <= 1)
+		return NUMA_NO_NODE;
+
+	n = agno % num_online_nodes();
+	for_each_online_node(nid) {
+		if (n-- == 0)
+			return nid;
+	}
+	return NUMA_NO_NODE;
+}
+
 int
 xfs_initialize_perag(
 	xfs_mount_t	*mp,
@@ -194,6 +221,7 @@ xfs_initialize_perag(
 	xfs_agnumber_t	first_initialised = NULLAGNUMBER;
 	xfs_perag_t	*pag;
 	int		error = -ENOMEM;
+	int		i;
 
 	/*
 	 * Walk the current per-ag tree so we don't try to initialise AGs
@@ -212,15 +240,38 @@ xfs_initialize_perag(
 			goto out_unwind_new_pags;
 		pag->pag_agno = index;
 		pag->pag_mount = mp;
-		spin_lock_init(&pag->pag_ici_lock);
+		for (i = 0; i < XFS_ICI_SHARDS; i++) {
+			spin_lock_init(&pag->pag_ici_shards[i].lock);
+			INIT_RADIX_TREE(&pag->pag_ici_shards[i].root,
+					GFP_ATOMIC);
+		}
+		pag->pag_ici_shard_shift = max_t(int, mp->m_sb.sb_agblklog +
+				mp->m_sb.sb_inopblog - ilog2(XFS_ICI_SHARDS), 0);
+		spin_lock_init(&pag->pag_ici_tag_lock);
 		mutex_init(&pag->pag_ici_reclaim_lock);
-		INIT_RADIX_TREE(&pag->pag_ici_root, GFP_ATOMIC);
+		INIT_WORK(&pag->pag_reclaim_work, xfs_reclaim_ag_worker);
 		if (xfs_buf_hash_init(pag))
 			goto out_free_pag;
+		if (xfs_iunlink_init(pag))
+			goto out_hash_destroy;
+		pag->pag_stats = alloc_percpu(struct xfs_ag_stats);
+		if (!pag->pag_stats)
+			goto out_iunlink_destroy;
+		error = xfs_perag_sysfs_init(pag);
+		if (error)
+			goto out_free_stats;
+		error = -ENOMEM;
+		pag->pag_buf_nid = xfs_perag_buf_nid(index);
+		pag->pag_bw_stamp = jiffies;
 		init_waitqueue_head(&pag->pagb_wait);
+		INIT_WORK(&pag->pag_resv_work, xfs_fs_reserve_ag_worker);
+		INIT_WORK(&pag->pag_ialloc_work, xfs_inode_prealloc_worker);
+		spin_lock_init(&pag->pag_inactive_lock);
+		INIT_LIST_HEAD(&pag->pag_inactive_list);
+		INIT_WORK(&pag->pag_inactive_work, xfs_inactive_worker);
 
 		if (radix_tree_preload(GFP_NOFS))
-			goto out_hash_destroy;
+			goto out_sysfs_del;
 
 		spin_lock(&mp->m_perag_lock);
 		if (radix_tree_insert(&mp->m_perag_tree, index, pag)) {
@@ -228,7 +279,7 @@ xfs_initialize_perag(
 			spin_unlock(&mp->m_perag_lock);
 			radix_tree_preload_end();
 			error = -EEXIST;
-			goto out_hash_destroy;
+			goto out_sysfs_del;
 		}
 		spin_unlock(&mp->m_perag_lock);
 		radix_tree_preload_end();
@@ -245,6 +296,12 @@ xfs_initialize_perag(
 	mp->m_ag_prealloc_blocks = xfs_prealloc_blocks(mp);
 	return 0;
 
+out_sysfs_del:
+	xfs_perag_sysfs_del(pag);
+out_free_stats:
+	free_percpu(pag->pag_stats);
+out_iunlink_destroy:
+	xfs_iunlink_destroy(pag);
 out_hash_destroy:
 	xfs_buf_hash_destroy(pag);
 out_free_pag:
@@ -255,6 +312,9 @@ xfs_initialize_perag(
 		pag = radix_tree_delete(&mp->m_perag_tree, index);
 		if (!pag)
 			break;
+		xfs_perag_sysfs_del(pag);
+		free_percpu(pag->pag_stats);
+		xfs_iunlink_destroy(pag);
 		xfs_buf_hash_destroy(pag);
 		kmem_free(pag);
 	}
@@ -715,10 +775,14 @@ xfs_mountfs(
 	if (error)
 		goto out_remove_sysfs;
 
-	error = xfs_error_sysfs_init(mp);
+	error = xfs_ag_sysfs_init(mp);
 	if (error)
 		goto out_del_stats;
 
+	error = xfs_error_sysfs_init(mp);
+	if (error)
+		goto out_remove_ag_sysfs;
+
 	error = xfs_errortag_init(mp);
 	if (error)
 		goto out_remove_error_sysfs;
@@ -1019,6 +1083,8 @@ xfs_mountfs(
 		error = xfs_fs_reserve_ag_blocks(mp);
 		if (error && error != -ENOSPC)
 			goto out_agresv;
+
+		xfs_enable_compact_icore_log(mp);
 	}
 
 	return 0;
@@ -1032,7 +1098,7 @@ xfs_mountfs(
 	xfs_rtunmount_inodes(mp);
  out_rele_rip:
 	IRELE(rip);
-	cancel_delayed_work_sync(&mp->m_reclaim_work);
+	xfs_reclaim_work_cancel(mp);
 	xfs_reclaim_inodes(mp, SYNC_WAIT);
  out_log_dealloc:
 	mp->m_flags |= XFS_MOUNT_UNMOUNTING;
@@ -1051,6 +1117,8 @@ xfs_mountfs(
 	xfs_errortag_del(mp);
  out_remove_error_sysfs:
 	xfs_error_sysfs_del(mp);
+ out_remove_ag_sysfs:
+	xfs_ag_sysfs_del(mp);
  out_del_stats:
 	xfs_sysfs_del(&mp->m_stats.xs_kobj);
  out_remove_sysfs:
@@ -1072,6 +1140,7 @@ xfs_unmountfs(
 
 	cancel_delayed_work_sync(&mp->m_eofblocks_work);
 	cancel_delayed_work_sync(&mp->m_cowblocks_work);
+	xfs_inode_prealloc_cancel(mp);
 
 	xfs_fs_unreserve_ag_blocks(mp);
 	xfs_qm_unmount_quotas(mp);
@@ -1092,8 +1161,9 @@ xfs_unmountfs(
 
 	/*
 	 * Wait for all busy extents to be freed, including completion of
-	 * any discard operation.
+	 * any discard operation.  Queued discards have to be issued first.
 	 */
+	xfs_discard_flush(mp);
 	xfs_extent_busy_wait_all(mp);
 	flush_workqueue(xfs_discard_wq);
 
@@ -1116,7 +1186,7 @@ xfs_unmountfs(
 	 * reclaim just to be sure. We can stop background inode reclaim
 	 * here as well if it is still running.
 	 */
-	cancel_delayed_work_sync(&mp->m_reclaim_work);
+	xfs_reclaim_work_cancel(mp);
 	xfs_reclaim_inodes(mp, SYNC_WAIT);
 
 	xfs_qm_unmount(mp);
@@ -1141,6 +1211,13 @@ xfs_unmountfs(
 		xfs_warn(mp, "Unable to free reserved block pool. "
 				"Freespace may not be correct on next mount.");
 
+	/*
+	 * The AIL is empty, so no log intents that need the log incompat
+	 * features are left; drop them from the superblock we're about to
+	 * write so that older kernels can mount the clean filesystem.
+	 */
+	xfs_clear_incompat_log_features(mp);
+
 	error = xfs_log_sbcount(mp);
 	if (error)
 		xfs_warn(mp, "Unable to update superblock counters. "
@@ -1158,6 +1235,7 @@ xfs_unmountfs(
 
 	xfs_errortag_del(mp);
 	xfs_error_sysfs_del(mp);
+	xfs_ag_sysfs_del(mp);
 	xfs_sysfs_del(&mp->m_stats.xs_kobj);
 	xfs_sysfs_del(&mp->m_kobj);
 }
@@ -1207,6 +1285,116 @@ xfs_log_sbcount(xfs_mount_t *mp)
 	return xfs_sync_sb(mp, true);
 }
 
+/*
+ * Set a log incompat feature in the superblock before logging the first item
+ * that needs it, so that a kernel that doesn't understand the item refuses
+ * to recover a log containing it.  The superblock has to be on disk, not just
+ * in the log, because log recovery checks the features before replaying
+ * anything.  The features are cleared again at unmount once the log is
+ * clean, so this is only paid once per mount.
+ */
+int
+xfs_add_incompat_log_feature(
+	struct xfs_mount	*mp,
+	uint32_t		feature)
+{
+	int			error = 0;
+
+	ASSERT(feature & XFS_SB_FEAT_INCOMPAT_LOG_ALL);
+
+	if (!xfs_sb_version_hascrc(&mp->m_sb))
+		return -EOPNOTSUPP;
+	if (xfs_sb_has_incompat_log_feature(&mp->m_sb, feature))
+		return 0;
+
+	/* Serialise with growfs, the other thing that rewrites the sb. */
+	mutex_lock(&mp->m_growlock);
+	if (xfs_sb_has_incompat_log_feature(&mp->m_sb, feature))
+		goto out_unlock;
+
+	spin_lock(&mp->m_sb_lock);
+	mp->m_sb.sb_features_log_incompat |= feature;
+	spin_unlock(&mp->m_sb_lock);
+
+	error = xfs_sync_sb(mp, true);
+	if (error)
+		goto out_unlock;
+	xfs_ail_push_all_sync(mp->m_ail);
+out_unlock:
+	mutex_unlock(&mp->m_growlock);
+	return error;
+}
+
+/*
+ * Compact inode cores are logged from inside transaction commit, where we
+ * can't stop to write the superblock, so turn the feature on up front for
+ * writeable v5 mounts.  If that fails we just keep logging full cores.
+ */
+void
+xfs_enable_compact_icore_log(
+	struct xfs_mount	*mp)
+{
+	int			error;
+
+	if (!xfs_sb_version_hascrc(&mp->m_sb))
+		return;
+
+	error = xfs_add_incompat_log_feature(mp,
+			XFS_SB_FEAT_INCOMPAT_LOG_ICORE);
+	if (error)
+		xfs_warn(mp,
+	"Unable to enable compact inode logging, error %d.", error);
+}
+
+/*
+ * Queue I/O completion work on the CPU that submitted the I/O, rather than
+ * wherever the interrupt happened to land, so that the buffer, ioend and
+ * inode cachelines the completion touches are still local.  If that CPU is
+ * not allowed for this workqueue, stay on its node if possible.
+ */
+void
+xfs_io_queue_work(
+	struct xfs_mount	*mp,
+	int			which,
+	struct workqueue_struct	*wq,
+	struct work_struct	*work,
+	int			submit_cpu)
+{
+	const struct cpumask	*mask = mp->m_wq_cpus[which];
+	int			cpu = nr_cpu_ids;
+
+	if (submit_cpu >= 0 && submit_cpu < nr_cpu_ids) {
+		if (cpumask_test_cpu(submit_cpu, mask))
+			cpu = submit_cpu;
+		else
+			cpu = cpumask_any_and(mask,
+				cpumask_of_node(cpu_to_node(submit_cpu)));
+	}
+	if (cpu < nr_cpu_ids && !cpu_online(cpu))
+		cpu = nr_cpu_ids;
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_any_and(mask, cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = WORK_CPU_UNBOUND;
+
+	queue_work_on(cpu, wq, work);
+}
+
+/* Clear all the log incompat features; the log must be clean. */
+void
+xfs_clear_incompat_log_features(
+	struct xfs_mount	*mp)
+{
+	if (!xfs_sb_version_hascrc(&mp->m_sb) ||
+	    !xfs_sb_has_incompat_log_feature(&mp->m_sb,
+				XFS_SB_FEAT_INCOMPAT_LOG_ALL))
+		return;
+
+	spin_lock(&mp->m_sb_lock);
+	mp->m_sb.sb_features_log_incompat &= ~XFS_SB_FEAT_INCOMPAT_LOG_ALL;
+	spin_unlock(&mp->m_sb_lock);
+}
+
 /*
  * Deltas for the inode count are +/-64, hence we use a large batch size
  * of 128 so we don't need to take the counter lock on every update.
@@ -1248,6 +1436,191 @@ xfs_mod_ifree(
  * we get near to ENOSPC and we have to be very accurate with our updates.
  */
 #define XFS_FDBLOCKS_BATCH	1024
+
+/*
+ * Even with a large batch, the percpu counter has to be summed exactly once
+ * its value gets within batch * nr_cpus of the limit we compare it against,
+ * which on a big machine is a long way from ENOSPC, and every reservation
+ * then takes the counter's lock.  To keep that off the hot path, each cpu
+ * caches a chunk of free blocks taken out of m_fdblocks in one go and hands
+ * out small reservations from it.  Freed blocks go back to the local cache
+ * until it holds two chunks.
+ *
+ * The caches are only used while the filesystem is well away from ENOSPC.
+ * Once m_fdblocks falls below xfs_fdcache_low() all caches are drained back
+ * into the counter and switched off, so that the exact accounting below
+ * sees every free block; they come back on once there is plenty of free
+ * space again.
+ */
+#define XFS_FDCACHE_CHUNK	1024
+
+static inline int64_t
+xfs_fdcache_low(
+	struct xfs_mount	*mp)
+{
+	return mp->m_alloc_set_aside +
+		4 * (int64_t)num_online_cpus() * XFS_FDCACHE_CHUNK;
+}
+
+/* Take blocks from this cpu's cache. */
+static bool
+xfs_fdcache_take(
+	struct xfs_mount	*mp,
+	int64_t			want)
+{
+	struct xfs_fdcache	*fc;
+	bool			ret = false;
+
+	fc = get_cpu_ptr(mp->m_fdcache);
+	spin_lock(&fc->lock);
+	if (fc->blocks >= want) {
+		fc->blocks -= want;
+		ret = true;
+	}
+	spin_unlock(&fc->lock);
+	put_cpu_ptr(mp->m_fdcache);
+	return ret;
+}
+
+/* Give freed blocks to this cpu's cache if it's on and has room. */
+static bool
+xfs_fdcache_give(
+	struct xfs_mount	*mp,
+	int64_t			delta)
+{
+	struct xfs_fdcache	*fc;
+	bool			ret = false;
+
+	fc = get_cpu_ptr(mp->m_fdcache);
+	spin_lock(&fc->lock);
+	if (mp->m_fdcache_on && fc->blocks + delta <= 2 * XFS_FDCACHE_CHUNK) {
+		fc->blocks += delta;
+		ret = true;
+	}
+	spin_unlock(&fc->lock);
+	put_cpu_ptr(mp->m_fdcache);
+	return ret;
+}
+
+/* Move every cached block back into m_fdblocks.  Caller holds the lock. */
+static void
+__xfs_fdcache_drain(
+	struct xfs_mount	*mp)
+{
+	struct xfs_fdcache	*fc;
+	int			cpu;
+
+	for_each_possible_cpu(cpu) {
+		fc = per_cpu_ptr(mp->m_fdcache, cpu);
+		spin_lock(&fc->lock);
+		percpu_counter_add(&mp->m_fdblocks, fc->blocks);
+		fc->blocks = 0;
+		spin_unlock(&fc->lock);
+	}
+}
+
+/* Switch the caches off and drain them. */
+static void
+xfs_fdcache_drain(
+	struct xfs_mount	*mp)
+{
+	spin_lock(&mp->m_fdcache_lock);
+	if (mp->m_fdcache_on) {
+		mp->m_fdcache_on = false;
+		__xfs_fdcache_drain(mp);
+	}
+	spin_unlock(&mp->m_fdcache_lock);
+}
+
+/*
+ * Refill this cpu's cache with a chunk from m_fdblocks and take want blocks
+ * out of it, unless we're getting close to ENOSPC, in which case switch the
+ * caches off.
+ */
+static bool
+xfs_fdcache_refill(
+	struct xfs_mount	*mp,
+	int64_t			want)
+{
+	struct xfs_fdcache	*fc;
+	int64_t			chunk = XFS_FDCACHE_CHUNK + want;
+	bool			ret = false;
+
+	spin_lock(&mp->m_fdcache_lock);
+	if (!mp->m_fdcache_on)
+		goto out_unlock;
+
+	if (__percpu_counter_compare(&mp->m_fdblocks,
+			xfs_fdcache_low(mp) + chunk, XFS_FDBLOCKS_BATCH) < 0) {
+		mp->m_fdcache_on = false;
+		__xfs_fdcache_drain(mp);
+		goto out_unlock;
+	}
+
+	percpu_counter_add_batch(&mp->m_fdblocks, -chunk, XFS_FDBLOCKS_BATCH);
+	fc = this_cpu_ptr(mp->m_fdcache);
+	spin_lock(&fc->lock);
+	fc->blocks += chunk - want;
+	spin_unlock(&fc->lock);
+	ret = true;
+out_unlock:
+	spin_unlock(&mp->m_fdcache_lock);
+	return ret;
+}
+
+/* Turn the caches back on once we're well clear of ENOSPC again. */
+static void
+xfs_fdcache_maybe_enable(
+	struct xfs_mount	*mp)
+{
+	if (likely(READ_ONCE(mp->m_fdcache_on)) ||
+	    percpu_counter_read(&mp->m_fdblocks) < 2 * xfs_fdcache_low(mp))
+		return;
+
+	spin_lock(&mp->m_fdcache_lock);
+	mp->m_fdcache_on = true;
+	spin_unlock(&mp->m_fdcache_lock);
+}
+
+/*
+ * Exact number of free blocks, including what is sitting in the per-cpu
+ * caches.
+ */
+int64_t
+xfs_fdblocks_sum(
+	struct xfs_mount	*mp)
+{
+	int64_t			sum;
+	int			cpu;
+
+	sum = percpu_counter_sum(&mp->m_fdblocks);
+	for_each_possible_cpu(cpu)
+		sum += READ_ONCE(per_cpu_ptr(mp->m_fdcache, cpu)->blocks);
+	return sum;
+}
+
+/*
+ * Empty the caches without giving the blocks back, for when m_fdblocks is
+ * about to be reset from the superblock.
+ */
+void
+xfs_fdcache_reset(
+	struct xfs_mount	*mp)
+{
+	struct xfs_fdcache	*fc;
+	int			cpu;
+
+	spin_lock(&mp->m_fdcache_lock);
+	for_each_possible_cpu(cpu) {
+		fc = per_cpu_ptr(mp->m_fdcache, cpu);
+		spin_lock(&fc->lock);
+		fc->blocks = 0;
+		spin_unlock(&fc->lock);
+	}
+	mp->m_fdcache_on = true;
+	spin_unlock(&mp->m_fdcache_lock);
+}
+
 int
 xfs_mod_fdblocks(
 	struct xfs_mount	*mp,
@@ -1264,7 +1637,9 @@ xfs_mod_fdblocks(
 		 * first. Most of the time the pool is full.
 		 */
 		if (likely(mp->m_resblks == mp->m_resblks_avail)) {
-			percpu_counter_add(&mp->m_fdblocks, delta);
+			if (delta > XFS_FDCACHE_CHUNK ||
+			    !xfs_fdcache_give(mp, delta))
+				percpu_counter_add(&mp->m_fdblocks, delta);
 			return 0;
 		}
 
@@ -1282,6 +1657,12 @@ xfs_mod_fdblocks(
 		return 0;
 	}
 
+	/* Small reservations come out of the per-cpu caches if we can. */
+	if (-delta <= XFS_FDCACHE_CHUNK && READ_ONCE(mp->m_fdcache_on) &&
+	    (xfs_fdcache_take(mp, -delta) || xfs_fdcache_refill(mp, -delta)))
+		return 0;
+
+retry:
 	/*
 	 * Taking blocks away, need to be more accurate the closer we
 	 * are to zero.
@@ -1300,6 +1681,7 @@ xfs_mod_fdblocks(
 	if (__percpu_counter_compare(&mp->m_fdblocks, mp->m_alloc_set_aside,
 				     XFS_FDBLOCKS_BATCH) >= 0) {
 		/* we had space! */
+		xfs_fdcache_maybe_enable(mp);
 		return 0;
 	}
 
@@ -1309,6 +1691,13 @@ xfs_mod_fdblocks(
 	 */
 	spin_lock(&mp->m_sb_lock);
 	percpu_counter_add(&mp->m_fdblocks, -delta);
+
+	/* Don't fail while free blocks are still sitting in the caches. */
+	if (READ_ONCE(mp->m_fdcache_on)) {
+		spin_unlock(&mp->m_sb_lock);
+		xfs_fdcache_drain(mp);
+		goto retry;
+	}
 	if (!rsvd)
 		goto fdblocks_enospc;
 
@@ -26,6 +26,8 @@ struct xfs_ail;
 struct xfs_quotainfo;
 struct xfs_dir_ops;
 struct xfs_da_geometry;
+struct xfs_rtzones;
+struct xfs_changelog;
 
 /* dynamic preallocation free space thresholds, 5% down to 1% */
 enum {
@@ -69,6 +71,26 @@ struct xfs_error_cfg {
 	long		retry_timeout;	/* in jiffies, -1 = infinite */
 };
 
+/*
+ * Per-cpu cache of free blocks already taken out of m_fdblocks, so that
+ * small reservations don't have to touch the global counter at all.
+ */
+struct xfs_fdcache {
+	spinlock_t		lock;
+	int64_t			blocks;
+};
+
+/*
+ * I/O completion workqueues whose work is steered to the submitting CPU,
+ * restricted to the CPUs set in m_wq_cpus.  See xfs_io_queue_work.
+ */
+enum {
+	XFS_WQ_BUF = 0,		/* xfs-buf: metadata buffer completion */
+	XFS_WQ_CONV,		/* xfs-conv: data ioend completion */
+	XFS_WQ_LOG,		/* xfs-log: iclog completion */
+	XFS_WQ_STEER_MAX,
+};
+
 typedef struct xfs_mount {
 	struct super_block	*m_super;
 	xfs_tid_t		m_tid;		/* next unused tid for fs */
@@ -79,6 +101,9 @@ typedef struct xfs_mount {
 	struct percpu_counter	m_icount;	/* allocated inodes counter */
 	struct percpu_counter	m_ifree;	/* free inodes counter */
 	struct percpu_counter	m_fdblocks;	/* free block counter */
+	struct xfs_fdcache __percpu *m_fdcache;	/* per-cpu free block caches */
+	spinlock_t		m_fdcache_lock;	/* serialises refill/drain */
+	bool			m_fdcache_on;	/* caches may hold blocks */
 
 	struct xfs_buf		*m_sb_bp;	/* buffer for superblock */
 	char			*m_fsname;	/* filesystem name */
@@ -103,6 +128,10 @@ typedef struct xfs_mount {
 	uint			m_rsumsize;	/* size of rt summary, bytes */
 	struct xfs_inode	*m_rbmip;	/* pointer to bitmap inode */
 	struct xfs_inode	*m_rsumip;	/* pointer to summary inode */
+	unsigned long		*m_rsum_index;	/* in-core rt summary index */
+	unsigned int		m_rsum_index_longs; /* longs per index level */
+	struct xfs_rtzones	*m_rtzones;	/* rt device zone table */
+	struct xfs_changelog	*m_changelog;	/* changed inode ring */
 	struct xfs_inode	*m_rootip;	/* pointer to root directory */
 	struct xfs_quotainfo	*m_quotainfo;	/* disk quota information */
 	xfs_buftarg_t		*m_ddev_targp;	/* saves taking the address */
@@ -134,8 +163,12 @@ typedef struct xfs_mount {
 	xfs_extlen_t		m_ag_prealloc_blocks; /* reserved ag blocks */
 	uint			m_alloc_set_aside; /* space we can't use */
 	uint			m_ag_max_usable; /* max space per AG */
+	xfs_extlen_t		m_ag_resv_est_meta; /* est. metadata resv/AG */
+	xfs_extlen_t		m_ag_resv_est_agfl; /* est. AGFL resv/AG */
 	struct radix_tree_root	m_perag_tree;	/* per-ag accounting info */
 	spinlock_t		m_perag_lock;	/* lock for m_perag_tree */
+	atomic_t		m_ici_tagged[RADIX_TREE_MAX_TAGS];
+						/* AGs with each icache tag */
 	struct mutex		m_growlock;	/* growfs mutex */
 	int			m_fixedfsid[2];	/* unchanged for life of FS */
 	uint			m_dmevmask;	/* DMI events for this FS */
@@ -148,6 +181,17 @@ typedef struct xfs_mount {
 	int			m_inoalign_mask;/* mask sb_inoalignmt if used */
 	uint			m_qflags;	/* quota status flags */
 	struct xfs_trans_resv	m_resv;		/* precomputed res values */
+	seqlock_t		m_dresv_lock;	/* m_dresv, m_dresv_levels */
+	struct xfs_trans_resv	m_dresv;	/* res for current depths */
+	struct xfs_resv_levels	m_dresv_levels;	/* depths m_dresv is sized for */
+	xfs_agnumber_t		m_dresv_agcount; /* AGs present at mount */
+	atomic_t		m_dresv_unseen;	/* of those, AGFs not yet read */
+	seqlock_t		m_statfs_lock;	/* cached statfs counters */
+	unsigned long		m_statfs_stamp;	/* jiffies of last refresh */
+	int64_t			m_statfs_fdfast;/* m_fdblocks approx. then */
+	uint64_t		m_statfs_icount;
+	uint64_t		m_statfs_ifree;
+	uint64_t		m_statfs_fdblocks;
 	uint64_t		m_maxicount;	/* maximum inode count */
 	uint64_t		m_resblks;	/* total reserved blocks */
 	uint64_t		m_resblks_avail;/* available reserved blocks */
@@ -163,11 +207,14 @@ typedef struct xfs_mount {
 	atomic_t		m_active_trans;	/* number trans frozen */
 	struct xfs_mru_cache	*m_filestream;  /* per-mount filestream data */
 	struct delayed_work	m_reclaim_work;	/* background inode reclaim */
+	struct list_lru		m_reclaim_lru;	/* reclaimable inodes by memcg */
 	struct delayed_work	m_eofblocks_work; /* background eof blocks
 						     trimming */
 	struct delayed_work	m_cowblocks_work; /* background cow blocks
 						     trimming */
+	struct delayed_work	m_discard_work;	/* online discard batching */
 	bool			m_update_sb;	/* sb needs update in mount */
+	bool			m_fast_frozen;	/* AIL paused by fast freeze */
 	int64_t			m_low_space[XFS_LOWSP_MAX];
 						/* low free space thresholds */
 	struct xfs_kobj		m_kobj;
@@ -175,15 +222,20 @@ typedef struct xfs_mount {
 	struct xfs_kobj		m_error_meta_kobj;
 	struct xfs_error_cfg	m_error_cfg[XFS_ERR_CLASS_MAX][XFS_ERR_ERRNO_MAX];
 	struct xstats		m_stats;	/* per-fs stats */
+	struct xfs_kobj		m_ag_kobj;	/* per-ag sysfs directory */
 
 	struct workqueue_struct *m_buf_workqueue;
-	struct workqueue_struct	*m_data_workqueue;
 	struct workqueue_struct	*m_unwritten_workqueue;
 	struct workqueue_struct	*m_cil_workqueue;
 	struct workqueue_struct	*m_reclaim_workqueue;
 	struct workqueue_struct	*m_log_workqueue;
 	struct workqueue_struct *m_eofblocks_workqueue;
+	struct workqueue_struct	*m_blockgc_workqueue;
 	struct workqueue_struct	*m_sync_workqueue;
+	struct workqueue_struct	*m_agresv_workqueue;
+	struct workqueue_struct	*m_ialloc_workqueue;
+	struct workqueue_struct	*m_inactive_workqueue;
+	cpumask_var_t		m_wq_cpus[XFS_WQ_STEER_MAX];
 
 	/*
 	 * Generation of the filesysyem layout.  This is incremented by each
@@ -241,6 +293,23 @@ typedef struct xfs_mount {
 #define XFS_MOUNT_FILESTREAMS	(1ULL << 24)	/* enable the filestreams
 						   allocator */
 #define XFS_MOUNT_NOATTR2	(1ULL << 25)	/* disable use of attr2 format */
+#define XFS_MOUNT_HIPRI		(1ULL << 26)	/* poll for synchronous direct
+						 * and metadata I/O completion */
+#define XFS_MOUNT_SHAREDWRITE	(1ULL << 27)	/* buffered overwrites inside
+						 * EOF share the iolock */
+#define XFS_MOUNT_DIRINDEX	(1ULL << 28)	/* in-memory hash index for
+						 * large directories */
+#define XFS_MOUNT_CHANGELOG	(1ULL << 29)	/* record changed inodes for
+						 * XFS_IOC_GET_CHANGES */
+#define XFS_MOUNT_FASTFREEZE	(1ULL << 30)	/* freeze only makes the log
+						 * stable */
+#define XFS_MOUNT_IOHEAT	(1ULL << 31)	/* track per-inode I/O heat */
+#define XFS_MOUNT_PMEMLOG	(1ULL << 32)	/* write the log with CPU
+						 * stores through DAX */
+#define XFS_MOUNT_IPREFETCH	(1ULL << 33)	/* cache the rest of an inode
+						 * cluster on a cache miss */
+#define XFS_MOUNT_AUTO_LOGBSIZE	(1ULL << 34)	/* logbsize chosen from
+						 * log device geometry */
 
 #define XFS_MOUNT_DAX		(1ULL << 62)	/* TEST ONLY! */
 
@@ -340,10 +409,43 @@ struct xfs_ag_resv {
 	xfs_extlen_t			ar_asked;
 };
 
+/* Number of power-of-two buckets in the per-ag free space histogram. */
+#define XFS_FREESP_HIST_BUCKETS	32
+
 /*
  * Per-ag incore structure, copies of information in agf and agi, to improve the
  * performance of allocation group selection.
  */
+/*
+ * Per-AG activity counters, exported through /sys/fs/xfs/<dev>/ag/<agno>/stats
+ * so that hot or imbalanced AGs can be spotted.
+ */
+struct xfs_ag_stats {
+	uint64_t	as_allocs;		/* extents allocated */
+	uint64_t	as_alloc_blocks;	/* blocks allocated */
+	uint64_t	as_frees;		/* extents freed */
+	uint64_t	as_free_blocks;		/* blocks freed */
+	uint64_t	as_busy_stalls;		/* waits for busy extents */
+	uint64_t	as_agf_trylock_fails;	/* AGF skipped by trylock */
+	uint64_t	as_buf_lock_waits;	/* metadata buffer lock waits */
+	uint64_t	as_buf_trylock_fails;	/* metadata buffer trylock fails */
+};
+
+#define XFS_AG_STATS_INC(pag, v)	this_cpu_inc((pag)->pag_stats->v)
+#define XFS_AG_STATS_ADD(pag, v, inc)	this_cpu_add((pag)->pag_stats->v, (inc))
+
+/*
+ * The incore inode cache of each AG is split by AG inode number range into
+ * XFS_ICI_SHARDS radix trees, each with its own lock, so that inserts,
+ * deletes and tag updates in different parts of the AG don't contend.
+ */
+#define XFS_ICI_SHARDS		16
+
+struct xfs_ici_shard {
+	spinlock_t		lock;	/* protects root */
+	struct radix_tree_root	root;	/* incore inodes in this range */
+} ____cacheline_aligned_in_smp;
+
 typedef struct xfs_perag {
 	struct xfs_mount *pag_mount;	/* owner filesystem */
 	xfs_agnumber_t	pag_agno;	/* AG this structure belongs to */
@@ -358,6 +460,10 @@ typedef struct xfs_perag {
 	xfs_extlen_t	pagf_freeblks;	/* total free blocks */
 	xfs_extlen_t	pagf_longest;	/* longest free space */
 	uint32_t	pagf_btreeblks;	/* # of blocks held in AGF btrees */
+	bool		pagf_hist_init;	/* pagf_hist has been built */
+	bool		pagf_hist_bad;	/* building pagf_hist failed */
+	uint32_t	pagf_hist[XFS_FREESP_HIST_BUCKETS];
+					/* free extents by log2 of length */
 	xfs_agino_t	pagi_freecount;	/* number of free inodes */
 	xfs_agino_t	pagi_count;	/* number of allocated inodes */
 
@@ -369,22 +475,55 @@ typedef struct xfs_perag {
 	xfs_agino_t	pagl_pagino;
 	xfs_agino_t	pagl_leftrec;
 	xfs_agino_t	pagl_rightrec;
+
+	/*
+	 * Free inode btree record the last allocation for pagfi_pagino came
+	 * from.  Records are only added to the finobt when inodes are freed
+	 * or chunks allocated, which clears the hint, so until then this is
+	 * still the closest record to the parent.
+	 */
+	xfs_agino_t	pagfi_pagino;
+	xfs_agino_t	pagfi_startino;
+
+	/* AGI unlinked list back pointers, protected by the AGI buffer lock */
+	struct rhashtable pagi_unlinked_hash;
+
 	spinlock_t	pagb_lock;	/* lock for pagb_tree */
+	seqcount_t	pagb_seq;	/* lockless pagb_tree lookups */
 	struct rb_root	pagb_tree;	/* ordered tree of busy extents */
 	unsigned int	pagb_gen;	/* generation count for pagb_tree */
 	wait_queue_head_t pagb_wait;	/* woken when pagb_gen changes */
+	struct list_head pagb_discard;	/* busy extents queued for discard */
+	xfs_extlen_t	pagb_discard_blocks; /* blocks in pagb_discard */
 
 	atomic_t        pagf_fstrms;    /* # of filestreams active in this AG */
 
-	spinlock_t	pag_ici_lock;	/* incore inode cache lock */
-	struct radix_tree_root pag_ici_root;	/* incore inode cache root */
-	int		pag_ici_reclaimable;	/* reclaimable inodes */
+	/*
+	 * Recent user data allocation rate, sampled lazily by the filestream
+	 * allocator to spread new streams over idle AGs.
+	 */
+	atomic64_t	pag_data_blocks;/* user data blocks allocated */
+	unsigned long	pag_bw_stamp;	/* jiffies of last rate sample */
+	int64_t		pag_bw_blocks;	/* pag_data_blocks at last sample */
+	unsigned int	pag_bw_rate;	/* blocks/s, averaged */
+
+	unsigned long	pag_contended;	/* jiffies of last AGI/AGF lock wait */
+
+	struct xfs_ici_shard pag_ici_shards[XFS_ICI_SHARDS];
+	unsigned int	pag_ici_shard_shift;	/* agino to shard index */
+	/* icache tags set in any shard, and the number of shards with each */
+	unsigned long	pag_ici_tags;
+	atomic_t	pag_ici_tagged[RADIX_TREE_MAX_TAGS];
+	spinlock_t	pag_ici_tag_lock;	/* serialises pag_ici_tags */
+	atomic_t	pag_ici_reclaimable;	/* reclaimable inodes */
 	struct mutex	pag_ici_reclaim_lock;	/* serialisation point */
 	unsigned long	pag_ici_reclaim_cursor;	/* reclaim restart point */
+	struct work_struct pag_reclaim_work;	/* background reclaim */
 
 	/* buffer cache index */
 	spinlock_t	pag_buf_lock;	/* lock for pag_buf_hash */
 	struct rhashtable pag_buf_hash;
+	int		pag_buf_nid;	/* NUMA node for buffer memory */
 
 	/* for rcu-safe freeing */
 	struct rcu_head	rcu_head;
@@ -394,9 +533,26 @@ typedef struct xfs_perag {
 	struct xfs_ag_resv	pag_meta_resv;
 	/* Blocks reserved for just AGFL-based metadata. */
 	struct xfs_ag_resv	pag_agfl_resv;
+	/* Reservations not set up yet, estimate held at the mount level. */
+	bool			pag_resv_pending;
+	struct work_struct	pag_resv_work;
+
+	/* Background inode chunk allocation. */
+	struct work_struct	pag_ialloc_work;
+
+	/* Unlinked inodes waiting for background inactivation. */
+	spinlock_t		pag_inactive_lock;
+	struct list_head	pag_inactive_list;
+	unsigned int		pag_inactive_count;
+	struct work_struct	pag_inactive_work;
 
 	/* reference count */
 	uint8_t			pagf_refcount_level;
+	atomic_t		pagf_refcount_gen;	/* bumped on changes */
+
+	/* activity counters and their sysfs directory */
+	struct xfs_ag_stats __percpu *pag_stats;
+	struct xfs_kobj		pag_kobj;
 } xfs_perag_t;
 
 static inline struct xfs_ag_resv *
@@ -414,6 +570,32 @@ xfs_perag_resv(
 	}
 }
 
+/*
+ * Allocators that have to wait for an AG header lock, or give up on it, mark
+ * the AG as contended.  For a short while afterwards AG selection prefers
+ * other AGs for new allocations.
+ */
+#define XFS_PERAG_CONTENDED_TIME	(HZ / 10)
+
+static inline void
+xfs_perag_set_contended(
+	struct xfs_perag	*pag)
+{
+	unsigned long		stamp = jiffies | 1;
+
+	if (READ_ONCE(pag->pag_contended) != stamp)
+		WRITE_ONCE(pag->pag_contended, stamp);
+}
+
+static inline bool
+xfs_perag_contended(
+	struct xfs_perag	*pag)
+{
+	unsigned long		stamp = READ_ONCE(pag->pag_contended);
+
+	return stamp && time_before(jiffies, stamp + XFS_PERAG_CONTENDED_TIME);
+}
+
 int xfs_buf_hash_init(xfs_perag_t *pag);
 void xfs_buf_hash_destroy(xfs_perag_t *pag);
 
@@ -424,11 +606,20 @@ extern int	xfs_mountfs(xfs_mount_t *mp);
 extern int	xfs_initialize_perag(xfs_mount_t *mp, xfs_agnumber_t agcount,
 				     xfs_agnumber_t *maxagi);
 extern void	xfs_unmountfs(xfs_mount_t *);
+extern int	xfs_add_incompat_log_feature(struct xfs_mount *mp,
+				uint32_t feature);
+extern void	xfs_clear_incompat_log_features(struct xfs_mount *mp);
+extern void	xfs_enable_compact_icore_log(struct xfs_mount *mp);
+extern void	xfs_io_queue_work(struct xfs_mount *mp, int which,
+				  struct workqueue_struct *wq,
+				  struct work_struct *work, int submit_cpu);
 
 extern int	xfs_mod_icount(struct xfs_mount *mp, int64_t delta);
 extern int	xfs_mod_ifree(struct xfs_mount *mp, int64_t delta);
 extern int	xfs_mod_fdblocks(struct xfs_mount *mp, int64_t delta,
 				 bool reserved);
+extern int64_t	xfs_fdblocks_sum(struct xfs_mount *mp);
+extern void	xfs_fdcache_reset(struct xfs_mount *mp);
 extern int	xfs_mod_frextents(struct xfs_mount *mp, int64_t delta);
 
 extern struct xfs_buf *xfs_getsb(xfs_mount_t *, int);
@@ -18,6 +18,8 @@
 #include "xfs.h"
 #include "xfs_mru_cache.h"
 
+#include <linux/hash.h>
+
 /*
  * The MRU Cache data structure consists of a data store, an array of lists and
  * a lock to protect its internal state.  At initialisation time, the client
@@ -78,6 +80,17 @@
  * of the reap list.  To keep the list maintenance portion of these operations
  * O(1) also, list tails need to be accessible without walking the entire list.
  * This is the reason why doubly linked list heads are used.
+ *
+ * To let many streams use the cache concurrently, the keys are hashed over a
+ * number of shards, each with its own lock, data store and set of lists.  Each
+ * shard keeps its own time zero.  A single reaper walks all the shards.
+ *
+ * Lookups don't take the shard lock.  They find the element in the data store
+ * under RCU and only take the lock to move the element to the MRU list if it
+ * was last moved more than one group time ago.  That costs the element at most
+ * one more group time of lifetime, which is within the granularity the lists
+ * give us anyway.  Because lookups can still be looking at an element after it
+ * has been removed, clients must free their elements with an RCU grace period.
  */
 
 /*
@@ -100,22 +113,39 @@
  * likely result in a loop in one of the lists.  That's a sure-fire recipe for
  * an infinite loop in the code.
  */
-struct xfs_mru_cache {
+struct xfs_mru_shard {
+	spinlock_t		lock;      /* Lock to protect this shard.   */
 	struct radix_tree_root	store;     /* Core storage data structure.  */
 	struct list_head	*lists;    /* Array of lists, one per grp.  */
 	struct list_head	reap_list; /* Elements overdue for reaping. */
-	spinlock_t		lock;      /* Lock to protect this struct.  */
-	unsigned int		grp_count; /* Number of discrete groups.    */
-	unsigned int		grp_time;  /* Time period spanned by grps.  */
 	unsigned int		lru_grp;   /* Group containing time zero.   */
 	unsigned long		time_zero; /* Time first element was added. */
+} ____cacheline_aligned_in_smp;
+
+struct xfs_mru_cache {
+	struct xfs_mru_shard	*shards;   /* Array of shards.              */
+	unsigned int		shard_shift; /* log2 of the number of shards. */
+	unsigned int		grp_count; /* Number of discrete groups.    */
+	unsigned int		grp_time;  /* Time period spanned by grps.  */
 	xfs_mru_cache_free_func_t free_func; /* Function pointer for freeing. */
 	struct delayed_work	work;      /* Workqueue data for reaping.   */
-	unsigned int		queued;	   /* work has been queued */
+	unsigned long		queued;	   /* work has been queued */
 };
 
+#define XFS_MRU_MAX_SHARD_SHIFT	6
+
 static struct workqueue_struct	*xfs_mru_reap_wq;
 
+static inline struct xfs_mru_shard *
+xfs_mru_shard(
+	struct xfs_mru_cache	*mru,
+	unsigned long		key)
+{
+	if (!mru->shard_shift)
+		return mru->shards;
+	return &mru->shards[hash_long(key, mru->shard_shift)];
+}
+
 /*
  * When inserting, destroying or reaping, it's first necessary to update the
  * lists relative to a particular time.  In the case of destroying, that time
@@ -136,6 +166,7 @@ static struct workqueue_struct	*xfs_mru_reap_wq;
 STATIC unsigned long
 _xfs_mru_cache_migrate(
 	struct xfs_mru_cache	*mru,
+	struct xfs_mru_shard	*shard,
 	unsigned long		now)
 {
 	unsigned int		grp;
@@ -143,34 +174,34 @@ _xfs_mru_cache_migrate(
 	struct list_head	*lru_list;
 
 	/* Nothing to do if the data store is empty. */
-	if (!mru->time_zero)
+	if (!shard->time_zero)
 		return 0;
 
 	/* While time zero is older than the time spanned by all the lists. */
-	while (mru->time_zero <= now - mru->grp_count * mru->grp_time) {
+	while (shard->time_zero <= now - mru->grp_count * mru->grp_time) {
 
 		/*
 		 * If the LRU list isn't empty, migrate its elements to the tail
 		 * of the reap list.
 		 */
-		lru_list = mru->lists + mru->lru_grp;
+		lru_list = shard->lists + shard->lru_grp;
 		if (!list_empty(lru_list))
-			list_splice_init(lru_list, mru->reap_list.prev);
+			list_splice_init(lru_list, shard->reap_list.prev);
 
 		/*
 		 * Advance the LRU group number, freeing the old LRU list to
 		 * become the new MRU list; advance time zero accordingly.
 		 */
-		mru->lru_grp = (mru->lru_grp + 1) % mru->grp_count;
-		mru->time_zero += mru->grp_time;
+		shard->lru_grp = (shard->lru_grp + 1) % mru->grp_count;
+		shard->time_zero += mru->grp_time;
 
 		/*
 		 * If reaping is so far behind that all the elements on all the
 		 * lists have been migrated to the reap list, it's now empty.
 		 */
 		if (++migrated == mru->grp_count) {
-			mru->lru_grp = 0;
-			mru->time_zero = 0;
+			shard->lru_grp = 0;
+			shard->time_zero = 0;
 			return 0;
 		}
 	}
@@ -179,15 +210,16 @@ _xfs_mru_cache_migrate(
 	for (grp = 0; grp < mru->grp_count; grp++) {
 
 		/* Check the grp'th list from the LRU end. */
-		lru_list = mru->lists + ((mru->lru_grp + grp) % mru->grp_count);
+		lru_list = shard->lists +
+			   ((shard->lru_grp + grp) % mru->grp_count);
 		if (!list_empty(lru_list))
-			return mru->time_zero +
+			return shard->time_zero +
 			       (mru->grp_count + grp) * mru->grp_time;
 	}
 
 	/* All the lists must be empty. */
-	mru->lru_grp = 0;
-	mru->time_zero = 0;
+	shard->lru_grp = 0;
+	shard->time_zero = 0;
 	return 0;
 }
 
@@ -200,6 +232,7 @@ _xfs_mru_cache_migrate(
 STATIC void
 _xfs_mru_cache_list_insert(
 	struct xfs_mru_cache	*mru,
+	struct xfs_mru_shard	*shard,
 	struct xfs_mru_cache_elem *elem)
 {
 	unsigned int		grp = 0;
@@ -210,20 +243,19 @@ _xfs_mru_cache_list_insert(
 	 * zero and start the work queue timer if necessary.  Otherwise, set grp
 	 * to the number of group times that have elapsed since time zero.
 	 */
-	if (!_xfs_mru_cache_migrate(mru, now)) {
-		mru->time_zero = now;
-		if (!mru->queued) {
-			mru->queued = 1;
+	if (!_xfs_mru_cache_migrate(mru, shard, now)) {
+		shard->time_zero = now;
+		if (!test_and_set_bit(0, &mru->queued))
 			queue_delayed_work(xfs_mru_reap_wq, &mru->work,
 			                   mru->grp_count * mru->grp_time);
-		}
 	} else {
-		grp = (now - mru->time_zero) / mru->grp_time;
-		grp = (mru->lru_grp + grp) % mru->grp_count;
+		grp = (now - shard->time_zero) / mru->grp_time;
+		grp = (shard->lru_grp + grp) % mru->grp_count;
 	}
 
 	/* Insert the element at the tail of the corresponding list. */
-	list_add_tail(&elem->list_node, mru->lists + grp);
+	list_add_tail(&elem->list_node, shard->lists + grp);
+	WRITE_ONCE(elem->touched, now);
 }
 
 /*
@@ -232,22 +264,23 @@ _xfs_mru_cache_list_insert(
  * data store, removing it from the reap list, calling the client's free
  * function and deleting the element from the element zone.
  *
- * We get called holding the mru->lock, which we drop and then reacquire.
+ * We get called holding the shard lock, which we drop and then reacquire.
  * Sparse need special help with this to tell it we know what we are doing.
  */
 STATIC void
 _xfs_mru_cache_clear_reap_list(
-	struct xfs_mru_cache	*mru)
-		__releases(mru->lock) __acquires(mru->lock)
+	struct xfs_mru_cache	*mru,
+	struct xfs_mru_shard	*shard)
+		__releases(shard->lock) __acquires(shard->lock)
 {
 	struct xfs_mru_cache_elem *elem, *next;
 	struct list_head	tmp;
 
 	INIT_LIST_HEAD(&tmp);
-	list_for_each_entry_safe(elem, next, &mru->reap_list, list_node) {
+	list_for_each_entry_safe(elem, next, &shard->reap_list, list_node) {
 
 		/* Remove the element from the data store. */
-		radix_tree_delete(&mru->store, elem->key);
+		radix_tree_delete(&shard->store, elem->key);
 
 		/*
 		 * remove to temp list so it can be freed without
@@ -255,14 +288,14 @@ _xfs_mru_cache_clear_reap_list(
 		 */
 		list_move(&elem->list_node, &tmp);
 	}
-	spin_unlock(&mru->lock);
+	spin_unlock(&shard->lock);
 
 	list_for_each_entry_safe(elem, next, &tmp, list_node) {
 		list_del_init(&elem->list_node);
 		mru->free_func(elem);
 	}
 
-	spin_lock(&mru->lock);
+	spin_lock(&shard->lock);
 }
 
 /*
@@ -271,6 +304,9 @@ _xfs_mru_cache_clear_reap_list(
  * and flushing of the reaper easy to do. Hence we need to
  * keep when the next reap must occur so we can determine
  * at each interval whether there is anything we need to do.
+ *
+ * The queued bit is cleared before the shards are scanned so that an insert
+ * into a shard we have already scanned queues the work again itself.
  */
 STATIC void
 _xfs_mru_cache_reap(
@@ -278,27 +314,37 @@ _xfs_mru_cache_reap(
 {
 	struct xfs_mru_cache	*mru =
 		container_of(work, struct xfs_mru_cache, work.work);
-	unsigned long		now, next;
+	struct xfs_mru_shard	*shard;
+	unsigned long		now, next, first = 0;
+	int			i;
 
-	ASSERT(mru && mru->lists);
-	if (!mru || !mru->lists)
+	ASSERT(mru && mru->shards);
+	if (!mru || !mru->shards)
 		return;
 
-	spin_lock(&mru->lock);
-	next = _xfs_mru_cache_migrate(mru, jiffies);
-	_xfs_mru_cache_clear_reap_list(mru);
+	clear_bit(0, &mru->queued);
+	smp_mb__after_atomic();
+
+	for (i = 0; i < (1 << mru->shard_shift); i++) {
+		shard = &mru->shards[i];
+		spin_lock(&shard->lock);
+		next = _xfs_mru_cache_migrate(mru, shard, jiffies);
+		_xfs_mru_cache_clear_reap_list(mru, shard);
+		spin_unlock(&shard->lock);
 
-	mru->queued = next;
-	if ((mru->queued > 0)) {
+		if (next && (!first || time_before(next, first)))
+			first = next;
+	}
+
+	if (first) {
 		now = jiffies;
-		if (next <= now)
+		if (time_before_eq(first, now))
 			next = 0;
 		else
-			next -= now;
-		queue_delayed_work(xfs_mru_reap_wq, &mru->work, next);
+			next = first - now;
+		set_bit(0, &mru->queued);
+		mod_delayed_work(xfs_mru_reap_wq, &mru->work, next);
 	}
-
-	spin_unlock(&mru->lock);
 }
 
 int
@@ -317,6 +363,17 @@ xfs_mru_cache_uninit(void)
 	destroy_workqueue(xfs_mru_reap_wq);
 }
 
+STATIC void
+xfs_mru_cache_free_shards(
+	struct xfs_mru_cache	*mru)
+{
+	int			i;
+
+	for (i = 0; i < (1 << mru->shard_shift); i++)
+		kmem_free(mru->shards[i].lists);
+	kmem_free(mru->shards);
+}
+
 /*
  * To initialise a struct xfs_mru_cache pointer, call xfs_mru_cache_create()
  * with the address of the pointer, a lifetime value in milliseconds, a group
@@ -331,7 +388,8 @@ xfs_mru_cache_create(
 	xfs_mru_cache_free_func_t free_func)
 {
 	struct xfs_mru_cache	*mru = NULL;
-	int			err = 0, grp;
+	struct xfs_mru_shard	*shard;
+	int			grp, i;
 	unsigned int		grp_time;
 
 	if (mrup)
@@ -348,37 +406,43 @@ xfs_mru_cache_create(
 
 	/* An extra list is needed to avoid reaping up to a grp_time early. */
 	mru->grp_count = grp_count + 1;
-	mru->lists = kmem_zalloc(mru->grp_count * sizeof(*mru->lists), KM_SLEEP);
-
-	if (!mru->lists) {
-		err = -ENOMEM;
-		goto exit;
+	mru->shard_shift = min_t(unsigned int, XFS_MRU_MAX_SHARD_SHIFT,
+				 order_base_2(num_possible_cpus()));
+	mru->shards = kmem_zalloc(sizeof(*mru->shards) << mru->shard_shift,
+				  KM_SLEEP);
+	if (!mru->shards) {
+		kmem_free(mru);
+		return -ENOMEM;
 	}
 
-	for (grp = 0; grp < mru->grp_count; grp++)
-		INIT_LIST_HEAD(mru->lists + grp);
+	for (i = 0; i < (1 << mru->shard_shift); i++) {
+		shard = &mru->shards[i];
+		shard->lists = kmem_zalloc(mru->grp_count *
+					   sizeof(*shard->lists), KM_SLEEP);
+		if (!shard->lists) {
+			xfs_mru_cache_free_shards(mru);
+			kmem_free(mru);
+			return -ENOMEM;
+		}
+		for (grp = 0; grp < mru->grp_count; grp++)
+			INIT_LIST_HEAD(shard->lists + grp);
 
-	/*
-	 * We use GFP_KERNEL radix tree preload and do inserts under a
-	 * spinlock so GFP_ATOMIC is appropriate for the radix tree itself.
-	 */
-	INIT_RADIX_TREE(&mru->store, GFP_ATOMIC);
-	INIT_LIST_HEAD(&mru->reap_list);
-	spin_lock_init(&mru->lock);
+		/*
+		 * We use GFP_KERNEL radix tree preload and do inserts under a
+		 * spinlock so GFP_ATOMIC is appropriate for the radix tree
+		 * itself.
+		 */
+		INIT_RADIX_TREE(&shard->store, GFP_ATOMIC);
+		INIT_LIST_HEAD(&shard->reap_list);
+		spin_lock_init(&shard->lock);
+	}
 	INIT_DELAYED_WORK(&mru->work, _xfs_mru_cache_reap);
 
 	mru->grp_time  = grp_time;
 	mru->free_func = free_func;
 
 	*mrup = mru;
-
-exit:
-	if (err && mru && mru->lists)
-		kmem_free(mru->lists);
-	if (err && mru)
-		kmem_free(mru);
-
-	return err;
+	return 0;
 }
 
 /*
@@ -391,32 +455,35 @@ static void
 xfs_mru_cache_flush(
 	struct xfs_mru_cache	*mru)
 {
-	if (!mru || !mru->lists)
-		return;
+	struct xfs_mru_shard	*shard;
+	int			i;
 
-	spin_lock(&mru->lock);
-	if (mru->queued) {
-		spin_unlock(&mru->lock);
-		cancel_delayed_work_sync(&mru->work);
-		spin_lock(&mru->lock);
-	}
+	if (!mru || !mru->shards)
+		return;
 
-	_xfs_mru_cache_migrate(mru, jiffies + mru->grp_count * mru->grp_time);
-	_xfs_mru_cache_clear_reap_list(mru);
+	cancel_delayed_work_sync(&mru->work);
 
-	spin_unlock(&mru->lock);
+	for (i = 0; i < (1 << mru->shard_shift); i++) {
+		shard = &mru->shards[i];
+		spin_lock(&shard->lock);
+		_xfs_mru_cache_migrate(mru, shard,
+				jiffies + mru->grp_count * mru->grp_time);
+		_xfs_mru_cache_clear_reap_list(mru, shard);
+		spin_unlock(&shard->lock);
+	}
+	clear_bit(0, &mru->queued);
 }
 
 void
 xfs_mru_cache_destroy(
 	struct xfs_mru_cache	*mru)
 {
-	if (!mru || !mru->lists)
+	if (!mru || !mru->shards)
 		return;
 
 	xfs_mru_cache_flush(mru);
 
-	kmem_free(mru->lists);
+	xfs_mru_cache_free_shards(mru);
 	kmem_free(mru);
 }
 
@@ -431,10 +498,11 @@ xfs_mru_cache_insert(
 	unsigned long		key,
 	struct xfs_mru_cache_elem *elem)
 {
+	struct xfs_mru_shard	*shard;
 	int			error;
 
-	ASSERT(mru && mru->lists);
-	if (!mru || !mru->lists)
+	ASSERT(mru && mru->shards);
+	if (!mru || !mru->shards)
 		return -EINVAL;
 
 	if (radix_tree_preload(GFP_NOFS))
@@ -443,12 +511,13 @@ xfs_mru_cache_insert(
 	INIT_LIST_HEAD(&elem->list_node);
 	elem->key = key;
 
-	spin_lock(&mru->lock);
-	error = radix_tree_insert(&mru->store, key, elem);
+	shard = xfs_mru_shard(mru, key);
+	spin_lock(&shard->lock);
+	error = radix_tree_insert(&shard->store, key, elem);
 	radix_tree_preload_end();
 	if (!error)
-		_xfs_mru_cache_list_insert(mru, elem);
-	spin_unlock(&mru->lock);
+		_xfs_mru_cache_list_insert(mru, shard, elem);
+	spin_unlock(&shard->lock);
 
 	return error;
 }
@@ -464,17 +533,19 @@ xfs_mru_cache_remove(
 	struct xfs_mru_cache	*mru,
 	unsigned long		key)
 {
+	struct xfs_mru_shard	*shard;
 	struct xfs_mru_cache_elem *elem;
 
-	ASSERT(mru && mru->lists);
-	if (!mru || !mru->lists)
+	ASSERT(mru && mru->shards);
+	if (!mru || !mru->shards)
 		return NULL;
 
-	spin_lock(&mru->lock);
-	elem = radix_tree_delete(&mru->store, key);
+	shard = xfs_mru_shard(mru, key);
+	spin_lock(&shard->lock);
+	elem = radix_tree_delete(&shard->store, key);
 	if (elem)
 		list_del(&elem->list_node);
-	spin_unlock(&mru->lock);
+	spin_unlock(&shard->lock);
 
 	return elem;
 }
@@ -500,53 +571,57 @@ xfs_mru_cache_delete(
  * data store and the element's key.  If found, the element will be moved to the
  * head of the MRU list to indicate that it's been touched.
  *
- * The internal data structures are protected by a spinlock that is STILL HELD
- * when this function returns.  Call xfs_mru_cache_done() to release it.  Note
- * that it is not safe to call any function that might sleep in the interim.
- *
- * The implementation could have used reference counting to avoid this
- * restriction, but since most clients simply want to get, set or test a member
- * of the returned data structure, the extra per-element memory isn't warranted.
- *
- * If the element isn't found, this function returns NULL and the spinlock is
- * released.  xfs_mru_cache_done() should NOT be called when this occurs.
+ * The lookup is done under RCU and the RCU read lock is STILL HELD when this
+ * function returns.  Call xfs_mru_cache_done() to release it.  Note that it is
+ * not safe to call any function that might sleep in the interim.  The element
+ * may be removed from the cache concurrently, but won't be freed until
+ * xfs_mru_cache_done() has been called.
  *
- * Because sparse isn't smart enough to know about conditional lock return
- * status, we need to help it get it right by annotating the path that does
- * not release the lock.
+ * If the element isn't found, this function returns NULL and the RCU read
+ * lock is released.  xfs_mru_cache_done() should NOT be called when this
+ * occurs.
  */
 struct xfs_mru_cache_elem *
 xfs_mru_cache_lookup(
 	struct xfs_mru_cache	*mru,
 	unsigned long		key)
 {
+	struct xfs_mru_shard	*shard;
 	struct xfs_mru_cache_elem *elem;
 
-	ASSERT(mru && mru->lists);
-	if (!mru || !mru->lists)
+	ASSERT(mru && mru->shards);
+	if (!mru || !mru->shards)
 		return NULL;
 
-	spin_lock(&mru->lock);
-	elem = radix_tree_lookup(&mru->store, key);
-	if (elem) {
-		list_del(&elem->list_node);
-		_xfs_mru_cache_list_insert(mru, elem);
-		__release(mru_lock); /* help sparse not be stupid */
-	} else
-		spin_unlock(&mru->lock);
+	shard = xfs_mru_shard(mru, key);
+	rcu_read_lock();
+	elem = radix_tree_lookup(&shard->store, key);
+	if (!elem) {
+		rcu_read_unlock();
+		return NULL;
+	}
 
+	/* Only move it if it hasn't been touched for a group time. */
+	if (time_before(jiffies, READ_ONCE(elem->touched) + mru->grp_time))
+		return elem;
+
+	spin_lock(&shard->lock);
+	if (radix_tree_lookup(&shard->store, key) == elem) {
+		list_del(&elem->list_node);
+		_xfs_mru_cache_list_insert(mru, shard, elem);
+	}
+	spin_unlock(&shard->lock);
 	return elem;
 }
 
 /*
- * To release the internal data structure spinlock after having performed an
- * xfs_mru_cache_lookup() or an xfs_mru_cache_peek(), call xfs_mru_cache_done()
- * with the data store pointer.
+ * To release the RCU read lock after having performed an
+ * xfs_mru_cache_lookup(), call xfs_mru_cache_done() with the data store
+ * pointer.
  */
 void
 xfs_mru_cache_done(
 	struct xfs_mru_cache	*mru)
-		__releases(mru->lock)
 {
-	spin_unlock(&mru->lock);
+	rcu_read_unlock();
 }
@@ -20,9 +20,14 @@
 
 struct xfs_mru_cache;
 
+/*
+ * Lookups can still see an element after it has been removed from the cache,
+ * so elements must be freed after an RCU grace period.
+ */
 struct xfs_mru_cache_elem {
 	struct list_head list_node;
 	unsigned long	key;
+	unsigned long	touched;	/* jiffies when last moved to MRU */
 };
 
 /* Function pointer type for callback to free a client's data pointer. */
@@ -2,6 +2,7 @@
  * Copyright (c) 2014 Christoph Hellwig.
  */
 #include <linux/iomap.h>
+#include <linux/sort.h>
 #include "xfs.h"
 #include "xfs_format.h"
 #include "xfs_log_format.h"
@@ -9,7 +10,9 @@
 #include "xfs_sb.h"
 #include "xfs_mount.h"
 #include "xfs_inode.h"
+#include "xfs_defer.h"
 #include "xfs_trans.h"
+#include "xfs_trans_space.h"
 #include "xfs_log.h"
 #include "xfs_bmap.h"
 #include "xfs_bmap_util.h"
@@ -18,6 +21,7 @@
 #include "xfs_shared.h"
 #include "xfs_bit.h"
 #include "xfs_pnfs.h"
+#include "xfs_trace.h"
 
 /*
  * Ensure that we do not have any outstanding pNFS layouts that can be used by
@@ -49,6 +53,19 @@ xfs_break_layouts(
 	return error;
 }
 
+/*
+ * Start recalling any layouts on the inode without waiting for them to come
+ * back.  Callers that are about to break layouts do this before they take
+ * their locks, so that the clients are already returning the layouts by the
+ * time xfs_break_layouts has to wait for them.
+ */
+void
+xfs_recall_layouts(
+	struct inode		*inode)
+{
+	break_layout(inode, false);
+}
+
 /*
  * Get a unique ID including its location so that the client can identify
  * the exported device.
@@ -141,6 +158,11 @@ xfs_fs_map_blocks(
 	if (WARN_ON_ONCE(error))
 		return error;
 
+	/* Clients can only do I/O to blocks. */
+	error = xfs_inline_data_to_extents(ip);
+	if (error)
+		goto out_unlock;
+
 	end_fsb = XFS_B_TO_FSB(mp, (xfs_ufsize_t)offset + length);
 	offset_fsb = XFS_B_TO_FSBT(mp, offset);
 
@@ -191,6 +213,72 @@ xfs_fs_map_blocks(
 	return error;
 }
 
+/*
+ * Number of extent conversions a LAYOUTCOMMIT transaction reserves blocks for
+ * before we commit it and start a new one.
+ */
+#define XFS_PNFS_COMMIT_BATCH	16
+
+struct xfs_pnfs_range {
+	xfs_off_t		start;
+	xfs_off_t		end;
+};
+
+static int
+xfs_pnfs_range_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct xfs_pnfs_range *ra = a;
+	const struct xfs_pnfs_range *rb = b;
+
+	if (ra->start < rb->start)
+		return -1;
+	return ra->start > rb->start;
+}
+
+/*
+ * Clamp the client's extents to the new file size, sort them and merge the
+ * ones that overlap or touch.  Returns the number of ranges left.
+ */
+static int
+xfs_pnfs_merge_ranges(
+	struct iomap		*maps,
+	int			nr_maps,
+	xfs_off_t		size,
+	struct xfs_pnfs_range	*ranges)
+{
+	int			nr = 0;
+	int			i;
+
+	for (i = 0; i < nr_maps; i++) {
+		xfs_off_t	start = maps[i].offset;
+		xfs_off_t	end = start + maps[i].length;
+
+		if (start > size)
+			continue;
+		if (end > size)
+			end = size;
+		if (end <= start)
+			continue;
+		ranges[nr].start = start;
+		ranges[nr].end = end;
+		nr++;
+	}
+	if (nr < 2)
+		return nr;
+
+	sort(ranges, nr, sizeof(*ranges), xfs_pnfs_range_cmp, NULL);
+	for (i = 1, nr_maps = nr, nr = 0; i < nr_maps; i++) {
+		if (ranges[i].start <= ranges[nr].end) {
+			ranges[nr].end = max(ranges[nr].end, ranges[i].end);
+			continue;
+		}
+		ranges[++nr] = ranges[i];
+	}
+	return nr + 1;
+}
+
 /*
  * Ensure the size update falls into a valid allocated block.
  */
@@ -203,10 +291,10 @@ xfs_pnfs_validate_isize(
 	int			nimaps = 1;
 	int			error = 0;
 
-	xfs_ilock(ip, XFS_ILOCK_SHARED);
+	ASSERT(xfs_isilocked(ip, XFS_ILOCK_EXCL));
+
 	error = xfs_bmapi_read(ip, XFS_B_TO_FSBT(ip->i_mount, isize - 1), 1,
 				&imap, &nimaps, 0);
-	xfs_iunlock(ip, XFS_ILOCK_SHARED);
 	if (error)
 		return error;
 
@@ -217,11 +305,97 @@ xfs_pnfs_validate_isize(
 	return 0;
 }
 
+/*
+ * Convert the unwritten extents in the range to written in the caller's
+ * transaction, which holds the inode's ILOCK, rolling it between extents so
+ * that the whole LAYOUTCOMMIT goes through a single chain of transactions.
+ * We only start a new transaction when the block reservation for the btree
+ * updates runs low, dropping the ILOCK around the reservation as usual.
+ */
+static int
+xfs_pnfs_convert_range(
+	struct xfs_inode	*ip,
+	struct xfs_trans	**tpp,
+	xfs_off_t		offset,
+	xfs_off_t		count)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_bmbt_irec	imap;
+	struct xfs_defer_ops	dfops;
+	xfs_fsblock_t		firstfsb;
+	xfs_fileoff_t		offset_fsb;
+	xfs_filblks_t		count_fsb;
+	uint			resblks;
+	int			nimaps;
+	int			error;
+
+	trace_xfs_unwritten_convert(ip, offset, count);
+
+	offset_fsb = XFS_B_TO_FSBT(mp, offset);
+	count_fsb = XFS_B_TO_FSB(mp, (xfs_ufsize_t)offset + count);
+	count_fsb = (xfs_filblks_t)(count_fsb - offset_fsb);
+
+	/* Two full bmbt splits per conversion, see xfs_iomap_write_unwritten. */
+	resblks = XFS_DIOSTRAT_SPACE_RES(mp, 0) << 1;
+
+	while (count_fsb > 0) {
+		struct xfs_trans	*tp = *tpp;
+
+		if (tp->t_blk_res - tp->t_blk_res_used < resblks) {
+			error = xfs_trans_commit(tp);
+			xfs_iunlock(ip, XFS_ILOCK_EXCL);
+			*tpp = NULL;
+			if (error)
+				return error;
+			error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write,
+					resblks * XFS_PNFS_COMMIT_BATCH, 0,
+					XFS_TRANS_RESERVE, tpp);
+			if (error)
+				return error;
+			xfs_ilock(ip, XFS_ILOCK_EXCL);
+			xfs_trans_ijoin(*tpp, ip, 0);
+		} else if (tp->t_flags & XFS_TRANS_DIRTY) {
+			error = xfs_trans_roll(tpp, ip);
+			if (error)
+				return error;
+		}
+
+		xfs_defer_init(&dfops, &firstfsb);
+		nimaps = 1;
+		error = xfs_bmapi_write(*tpp, ip, offset_fsb, count_fsb,
+					XFS_BMAPI_CONVERT, &firstfsb, resblks,
+					&imap, &nimaps, &dfops);
+		if (error)
+			goto out_cancel;
+		error = xfs_defer_finish(tpp, &dfops, ip);
+		if (error)
+			goto out_cancel;
+
+		if (!(imap.br_startblock || XFS_IS_REALTIME_INODE(ip)))
+			return xfs_alert_fsblock_zero(ip, &imap);
+		if (!imap.br_blockcount) {
+			ASSERT(imap.br_blockcount);
+			break;
+		}
+		offset_fsb += imap.br_blockcount;
+		count_fsb -= imap.br_blockcount;
+	}
+	return 0;
+
+out_cancel:
+	xfs_defer_cancel(&dfops);
+	return error;
+}
+
 /*
  * Make sure the blocks described by maps are stable on disk.  This includes
  * converting any unwritten extents, flushing the disk cache and updating the
  * time stamps.
  *
+ * Clients tend to send many small, adjacent extents, so we merge them first
+ * and then do all the conversions and the final inode update in one chain of
+ * rolling transactions, with a single synchronous commit at the end.
+ *
  * Note that we rely on the caller to always send us a timestamp update so that
  * we always commit a transaction here.  If that stops being true we will have
  * to manually flush the cache here similar to what the fsync code path does
@@ -236,13 +410,21 @@ xfs_fs_commit_blocks(
 {
 	struct xfs_inode	*ip = XFS_I(inode);
 	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_pnfs_range	*ranges = NULL;
 	struct xfs_trans	*tp;
 	bool			update_isize = false;
+	int			nr = 0;
 	int			error, i;
 	loff_t			size;
 
 	ASSERT(iattr->ia_valid & (ATTR_ATIME|ATTR_CTIME|ATTR_MTIME));
 
+	if (nr_maps) {
+		ranges = kmem_alloc(nr_maps * sizeof(*ranges), KM_MAYFAIL);
+		if (!ranges)
+			return -ENOMEM;
+	}
+
 	xfs_ilock(ip, XFS_IOLOCK_EXCL);
 
 	size = i_size_read(inode);
@@ -251,48 +433,41 @@ xfs_fs_commit_blocks(
 		size = iattr->ia_size;
 	}
 
-	for (i = 0; i < nr_maps; i++) {
-		u64 start, length, end;
-
-		start = maps[i].offset;
-		if (start > size)
-			continue;
-
-		end = start + maps[i].length;
-		if (end > size)
-			end = size;
-
-		length = end - start;
-		if (!length)
-			continue;
-	
+	nr = xfs_pnfs_merge_ranges(maps, nr_maps, size, ranges);
+	for (i = 0; i < nr; i++) {
 		/*
 		 * Make sure reads through the pagecache see the new data.
 		 */
 		error = invalidate_inode_pages2_range(inode->i_mapping,
-					start >> PAGE_SHIFT,
-					(end - 1) >> PAGE_SHIFT);
+					ranges[i].start >> PAGE_SHIFT,
+					(ranges[i].end - 1) >> PAGE_SHIFT);
 		WARN_ON_ONCE(error);
+	}
 
-		error = xfs_iomap_write_unwritten(ip, start, length);
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write,
+			(XFS_DIOSTRAT_SPACE_RES(mp, 0) << 1) *
+				min(nr, XFS_PNFS_COMMIT_BATCH),
+			0, XFS_TRANS_RESERVE, &tp);
+	if (error)
+		goto out_drop_iolock;
+
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	xfs_trans_ijoin(tp, ip, 0);
+
+	for (i = 0; i < nr; i++) {
+		error = xfs_pnfs_convert_range(ip, &tp, ranges[i].start,
+				ranges[i].end - ranges[i].start);
 		if (error)
-			goto out_drop_iolock;
+			goto out_cancel;
 	}
 
 	if (update_isize) {
 		error = xfs_pnfs_validate_isize(ip, size);
 		if (error)
-			goto out_drop_iolock;
+			goto out_cancel;
 	}
 
-	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_ichange, 0, 0, 0, &tp);
-	if (error)
-		goto out_drop_iolock;
-
-	xfs_ilock(ip, XFS_ILOCK_EXCL);
-	xfs_trans_ijoin(tp, ip, XFS_ILOCK_EXCL);
 	xfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
-
 	xfs_setattr_time(ip, iattr);
 	if (update_isize) {
 		i_size_write(inode, iattr->ia_size);
@@ -301,8 +476,17 @@ xfs_fs_commit_blocks(
 
 	xfs_trans_set_sync(tp);
 	error = xfs_trans_commit(tp);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
 
 out_drop_iolock:
 	xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+	kmem_free(ranges);
 	return error;
+
+out_cancel:
+	if (tp) {
+		xfs_trans_cancel(tp);
+		xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	}
+	goto out_drop_iolock;
 }
@@ -9,11 +9,17 @@ int xfs_fs_commit_blocks(struct inode *inode, struct iomap *maps, int nr_maps,
 		struct iattr *iattr);
 
 int xfs_break_layouts(struct inode *inode, uint *iolock);
+void xfs_recall_layouts(struct inode *inode);
 #else
 static inline int
 xfs_break_layouts(struct inode *inode, uint *iolock)
 {
 	return 0;
 }
+
+static inline void
+xfs_recall_layouts(struct inode *inode)
+{
+}
 #endif /* CONFIG_EXPORTFS_BLOCK_OPS */
 #endif /* _XFS_PNFS_H */
@@ -624,6 +624,7 @@ xfs_qm_init_quotainfo(
 	INIT_RADIX_TREE(&qinf->qi_uquota_tree, GFP_NOFS);
 	INIT_RADIX_TREE(&qinf->qi_gquota_tree, GFP_NOFS);
 	INIT_RADIX_TREE(&qinf->qi_pquota_tree, GFP_NOFS);
+	INIT_RADIX_TREE(&qinf->qi_psnap_tree, GFP_NOFS);
 	mutex_init(&qinf->qi_tree_lock);
 
 	/* mutex used to serialize quotaoffs */
@@ -705,6 +706,26 @@ xfs_qm_init_quotainfo(
 }
 
 
+/* Free the project usage snapshots; no dquots may point at them now. */
+STATIC void
+xfs_qm_destroy_dqsnaps(
+	struct xfs_quotainfo	*qi)
+{
+	struct xfs_dqsnap	*batch[XFS_DQ_LOOKUP_BATCH];
+	unsigned long		index = 0;
+	int			nr_found;
+	int			i;
+
+	while ((nr_found = radix_tree_gang_lookup(&qi->qi_psnap_tree,
+			(void **)batch, index, XFS_DQ_LOOKUP_BATCH)) > 0) {
+		for (i = 0; i < nr_found; i++) {
+			index = (unsigned long)batch[i]->ds_id + 1;
+			radix_tree_delete(&qi->qi_psnap_tree, batch[i]->ds_id);
+			kfree_rcu(batch[i], ds_rcu);
+		}
+	}
+}
+
 /*
  * Gets called when unmounting a filesystem or when all quotas get
  * turned off.
@@ -734,6 +755,7 @@ xfs_qm_destroy_quotainfo(
 		IRELE(qi->qi_pquotaip);
 		qi->qi_pquotaip = NULL;
 	}
+	xfs_qm_destroy_dqsnaps(qi);
 	mutex_destroy(&qi->qi_quotaofflock);
 	kmem_free(qi);
 	mp->m_quotainfo = NULL;
@@ -1063,16 +1085,21 @@ xfs_qm_dqiterate(
  * as the buffer copy. This is so that once the quotacheck is done, we can
  * just log all the buffers, as opposed to logging numerous updates to
  * individual dquots.
+ *
+ * @ip is the inode being accounted, if there is one.  The parallel quotacheck
+ * merges usage that has already been summed up over many inodes and passes a
+ * NULL inode with the totals.
  */
 STATIC int
 xfs_qm_quotacheck_dqadjust(
+	struct xfs_mount	*mp,
 	struct xfs_inode	*ip,
 	xfs_dqid_t		id,
 	uint			type,
+	xfs_qcnt_t		icount,
 	xfs_qcnt_t		nblks,
 	xfs_qcnt_t		rtblks)
 {
-	struct xfs_mount	*mp = ip->i_mount;
 	struct xfs_dquot	*dqp;
 	int			error;
 
@@ -1093,8 +1120,8 @@ xfs_qm_quotacheck_dqadjust(
 	 * Adjust the inode count and the block count to reflect this inode's
 	 * resource usage.
 	 */
-	be64_add_cpu(&dqp->q_core.d_icount, 1);
-	dqp->q_res_icount++;
+	be64_add_cpu(&dqp->q_core.d_icount, icount);
+	dqp->q_res_icount += icount;
 	if (nblks) {
 		be64_add_cpu(&dqp->q_core.d_bcount, nblks);
 		dqp->q_res_bcount += nblks;
@@ -1144,6 +1171,33 @@ xfs_qm_get_rtblks(
 	return 0;
 }
 
+/*
+ * Work out how many data and realtime blocks an inode uses.
+ */
+STATIC int
+xfs_qm_dqusage_blocks(
+	struct xfs_inode	*ip,
+	xfs_qcnt_t		*nblks,
+	xfs_qcnt_t		*rtblks)
+{
+	int			error;
+
+	ASSERT(ip->i_delayed_blks == 0);
+
+	*rtblks = 0;
+	if (XFS_IS_REALTIME_INODE(ip)) {
+		/*
+		 * Walk thru the extent list and count the realtime blocks.
+		 */
+		error = xfs_qm_get_rtblks(ip, rtblks);
+		if (error)
+			return error;
+	}
+
+	*nblks = (xfs_qcnt_t)ip->i_d.di_nblocks - *rtblks;
+	return 0;
+}
+
 /*
  * callback routine supplied to bulkstat(). Given an inumber, find its
  * dquots and update them to account for resources taken by that inode.
@@ -1159,7 +1213,7 @@ xfs_qm_dqusage_adjust(
 	int		*res)		/* result code value */
 {
 	xfs_inode_t	*ip;
-	xfs_qcnt_t	nblks, rtblks = 0;
+	xfs_qcnt_t	nblks, rtblks;
 	int		error;
 
 	ASSERT(XFS_IS_QUOTA_RUNNING(mp));
@@ -1186,18 +1240,9 @@ xfs_qm_dqusage_adjust(
 		return error;
 	}
 
-	ASSERT(ip->i_delayed_blks == 0);
-
-	if (XFS_IS_REALTIME_INODE(ip)) {
-		/*
-		 * Walk thru the extent list and count the realtime blocks.
-		 */
-		error = xfs_qm_get_rtblks(ip, &rtblks);
-		if (error)
-			goto error0;
-	}
-
-	nblks = (xfs_qcnt_t)ip->i_d.di_nblocks - rtblks;
+	error = xfs_qm_dqusage_blocks(ip, &nblks, &rtblks);
+	if (error)
+		goto error0;
 
 	/*
 	 * Add the (disk blocks and inode) resources occupied by this
@@ -1212,22 +1257,22 @@ xfs_qm_dqusage_adjust(
 	 * and quotaoffs don't race. (Quotachecks happen at mount time only).
 	 */
 	if (XFS_IS_UQUOTA_ON(mp)) {
-		error = xfs_qm_quotacheck_dqadjust(ip, ip->i_d.di_uid,
-						   XFS_DQ_USER, nblks, rtblks);
+		error = xfs_qm_quotacheck_dqadjust(mp, ip, ip->i_d.di_uid,
+						   XFS_DQ_USER, 1, nblks, rtblks);
 		if (error)
 			goto error0;
 	}
 
 	if (XFS_IS_GQUOTA_ON(mp)) {
-		error = xfs_qm_quotacheck_dqadjust(ip, ip->i_d.di_gid,
-						   XFS_DQ_GROUP, nblks, rtblks);
+		error = xfs_qm_quotacheck_dqadjust(mp, ip, ip->i_d.di_gid,
+						   XFS_DQ_GROUP, 1, nblks, rtblks);
 		if (error)
 			goto error0;
 	}
 
 	if (XFS_IS_PQUOTA_ON(mp)) {
-		error = xfs_qm_quotacheck_dqadjust(ip, xfs_get_projid(ip),
-						   XFS_DQ_PROJ, nblks, rtblks);
+		error = xfs_qm_quotacheck_dqadjust(mp, ip, xfs_get_projid(ip),
+						   XFS_DQ_PROJ, 1, nblks, rtblks);
 		if (error)
 			goto error0;
 	}
@@ -1244,6 +1289,264 @@ xfs_qm_dqusage_adjust(
 	return error;
 }
 
+/*
+ * Parallel quotacheck.
+ *
+ * Walking every inode in the filesystem one at a time is far too slow on
+ * large filesystems, so we run a set of workers that each take AGs off a
+ * shared counter and walk them with xfs_inode_walk_ag().  Rather than having
+ * all the workers fight over the dquot locks for every inode, each worker
+ * sums up the usage it finds per dquot id in its own radix trees.  Once all
+ * the workers are done the totals are added to the real dquots, which are
+ * then flushed as usual.
+ */
+#define XFS_QM_QC_MAX_WORKERS	16
+
+struct xfs_qm_qc_delta {
+	struct list_head	qd_list;
+	xfs_dqid_t		qd_id;
+	xfs_qcnt_t		qd_icount;
+	xfs_qcnt_t		qd_bcount;
+	xfs_qcnt_t		qd_rtbcount;
+};
+
+/* usage deltas for one quota type */
+struct xfs_qm_qc_deltas {
+	struct radix_tree_root	qs_tree;	/* deltas indexed by id */
+	struct list_head	qs_list;	/* all the deltas in the tree */
+};
+
+struct xfs_qm_qc {
+	struct xfs_mount	*qc_mp;
+	atomic_t		qc_next_agno;
+	int			qc_error;	/* stop all the workers */
+};
+
+struct xfs_qm_qc_worker {
+	struct work_struct	qw_work;
+	struct xfs_qm_qc	*qw_qc;
+	struct xfs_qm_qc_deltas	qw_user;
+	struct xfs_qm_qc_deltas	qw_group;
+	struct xfs_qm_qc_deltas	qw_proj;
+	int			qw_error;
+};
+
+STATIC int
+xfs_qm_qc_add(
+	struct xfs_qm_qc_deltas	*qs,
+	xfs_dqid_t		id,
+	xfs_qcnt_t		nblks,
+	xfs_qcnt_t		rtblks)
+{
+	struct xfs_qm_qc_delta	*qd;
+	int			error;
+
+	qd = radix_tree_lookup(&qs->qs_tree, id);
+	if (!qd) {
+		qd = kmem_zalloc(sizeof(*qd), KM_MAYFAIL | KM_NOFS);
+		if (!qd)
+			return -ENOMEM;
+		qd->qd_id = id;
+		error = radix_tree_insert(&qs->qs_tree, id, qd);
+		if (error) {
+			kmem_free(qd);
+			return error;
+		}
+		list_add_tail(&qd->qd_list, &qs->qs_list);
+	}
+
+	qd->qd_icount++;
+	qd->qd_bcount += nblks;
+	qd->qd_rtbcount += rtblks;
+	return 0;
+}
+
+/* Add the usage of one inode to the worker's deltas. */
+STATIC int
+xfs_qm_qc_walk_one(
+	struct xfs_mount	*mp,
+	xfs_ino_t		ino,
+	void			*data)
+{
+	struct xfs_qm_qc_worker	*qw = data;
+	struct xfs_inode	*ip;
+	xfs_qcnt_t		nblks, rtblks;
+	int			error;
+
+	if (READ_ONCE(qw->qw_qc->qc_error))
+		return -ECANCELED;
+
+	/*
+	 * rootino must have its resources accounted for, not so with the quota
+	 * inodes.
+	 */
+	if (xfs_is_quota_inode(&mp->m_sb, ino))
+		return 0;
+
+	/* The ILOCK is needed to read in the extent list of rt inodes. */
+	error = xfs_iget(mp, NULL, ino, XFS_IGET_DONTCACHE, XFS_ILOCK_EXCL,
+			 &ip);
+	if (error == -ENOENT || error == -EINVAL)
+		return 0;
+	if (error)
+		return error;
+
+	error = xfs_qm_dqusage_blocks(ip, &nblks, &rtblks);
+	if (error)
+		goto out_rele;
+
+	if (XFS_IS_UQUOTA_ON(mp)) {
+		error = xfs_qm_qc_add(&qw->qw_user, ip->i_d.di_uid,
+				      nblks, rtblks);
+		if (error)
+			goto out_rele;
+	}
+	if (XFS_IS_GQUOTA_ON(mp)) {
+		error = xfs_qm_qc_add(&qw->qw_group, ip->i_d.di_gid,
+				      nblks, rtblks);
+		if (error)
+			goto out_rele;
+	}
+	if (XFS_IS_PQUOTA_ON(mp))
+		error = xfs_qm_qc_add(&qw->qw_proj, xfs_get_projid(ip),
+				      nblks, rtblks);
+
+out_rele:
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	IRELE(ip);
+	return error;
+}
+
+STATIC void
+xfs_qm_qc_worker(
+	struct work_struct	*work)
+{
+	struct xfs_qm_qc_worker	*qw = container_of(work,
+					struct xfs_qm_qc_worker, qw_work);
+	struct xfs_qm_qc	*qc = qw->qw_qc;
+	struct xfs_mount	*mp = qc->qc_mp;
+	xfs_agnumber_t		agno;
+
+	while ((agno = atomic_inc_return(&qc->qc_next_agno) - 1) <
+			mp->m_sb.sb_agcount) {
+		qw->qw_error = xfs_inode_walk_ag(mp, agno, xfs_qm_qc_walk_one,
+						 qw);
+		if (qw->qw_error) {
+			WRITE_ONCE(qc->qc_error, 1);
+			break;
+		}
+	}
+}
+
+STATIC void
+xfs_qm_qc_deltas_init(
+	struct xfs_qm_qc_deltas	*qs)
+{
+	INIT_RADIX_TREE(&qs->qs_tree, GFP_NOFS);
+	INIT_LIST_HEAD(&qs->qs_list);
+}
+
+/*
+ * Add the deltas of one quota type to the real dquots, or just throw them
+ * away if @merge is false.
+ */
+STATIC int
+xfs_qm_qc_deltas_merge(
+	struct xfs_mount	*mp,
+	struct xfs_qm_qc_deltas	*qs,
+	uint			type,
+	bool			merge)
+{
+	struct xfs_qm_qc_delta	*qd, *n;
+	int			error = 0;
+
+	list_for_each_entry_safe(qd, n, &qs->qs_list, qd_list) {
+		if (merge && !error)
+			error = xfs_qm_quotacheck_dqadjust(mp, NULL, qd->qd_id,
+					type, qd->qd_icount, qd->qd_bcount,
+					qd->qd_rtbcount);
+		radix_tree_delete(&qs->qs_tree, qd->qd_id);
+		list_del(&qd->qd_list);
+		kmem_free(qd);
+		cond_resched();
+	}
+	return error;
+}
+
+/*
+ * Walk all the inodes in the filesystem with a worker per CPU and add up
+ * the usage.  Returns -EAGAIN if there aren't enough AGs or CPUs to bother,
+ * or we couldn't set up the workers, in which case the caller falls back to
+ * the single threaded walk.
+ */
+STATIC int
+xfs_qm_quotacheck_parallel(
+	struct xfs_mount	*mp)
+{
+	struct xfs_qm_qc	qc = { .qc_mp = mp };
+	struct xfs_qm_qc_worker	*workers;
+	struct workqueue_struct	*wq;
+	int			nworkers;
+	int			error = 0;
+	int			error2;
+	int			i;
+
+	nworkers = min_t(int, num_online_cpus(), XFS_QM_QC_MAX_WORKERS);
+	nworkers = min_t(xfs_agnumber_t, nworkers, mp->m_sb.sb_agcount);
+	if (nworkers < 2)
+		return -EAGAIN;
+
+	workers = kmem_zalloc(nworkers * sizeof(*workers), KM_MAYFAIL);
+	if (!workers)
+		return -EAGAIN;
+	wq = alloc_workqueue("xfs-quotacheck/%s", WQ_UNBOUND, nworkers,
+			     mp->m_fsname);
+	if (!wq) {
+		kmem_free(workers);
+		return -EAGAIN;
+	}
+
+	atomic_set(&qc.qc_next_agno, 0);
+	for (i = 0; i < nworkers; i++) {
+		struct xfs_qm_qc_worker	*qw = &workers[i];
+
+		INIT_WORK(&qw->qw_work, xfs_qm_qc_worker);
+		qw->qw_qc = &qc;
+		xfs_qm_qc_deltas_init(&qw->qw_user);
+		xfs_qm_qc_deltas_init(&qw->qw_group);
+		xfs_qm_qc_deltas_init(&qw->qw_proj);
+		queue_work(wq, &qw->qw_work);
+	}
+	flush_workqueue(wq);
+	destroy_workqueue(wq);
+
+	/* ECANCELED just means another worker failed first. */
+	for (i = 0; i < nworkers; i++) {
+		if (!error && workers[i].qw_error != -ECANCELED)
+			error = workers[i].qw_error;
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		struct xfs_qm_qc_worker	*qw = &workers[i];
+
+		error2 = xfs_qm_qc_deltas_merge(mp, &qw->qw_user,
+				XFS_DQ_USER, !error);
+		if (!error)
+			error = error2;
+		error2 = xfs_qm_qc_deltas_merge(mp, &qw->qw_group,
+				XFS_DQ_GROUP, !error);
+		if (!error)
+			error = error2;
+		error2 = xfs_qm_qc_deltas_merge(mp, &qw->qw_proj,
+				XFS_DQ_PROJ, !error);
+		if (!error)
+			error = error2;
+	}
+
+	kmem_free(workers);
+	return error;
+}
+
 STATIC int
 xfs_qm_flush_one(
 	struct xfs_dquot	*dqp,
@@ -1353,18 +1656,20 @@ xfs_qm_quotacheck(
 		flags |= XFS_PQUOTA_CHKD;
 	}
 
-	do {
-		/*
-		 * Iterate thru all the inodes in the file system,
-		 * adjusting the corresponding dquot counters in core.
-		 */
-		error = xfs_bulkstat(mp, &lastino, &count,
-				     xfs_qm_dqusage_adjust,
-				     structsz, NULL, &done);
-		if (error)
-			break;
-
-	} while (!done);
+	/*
+	 * Iterate thru all the inodes in the file system, adjusting the
+	 * corresponding dquot counters in core.
+	 */
+	error = xfs_qm_quotacheck_parallel(mp);
+	if (error == -EAGAIN) {
+		do {
+			error = xfs_bulkstat(mp, &lastino, &count,
+					     xfs_qm_dqusage_adjust,
+					     structsz, NULL, &done);
+			if (error)
+				break;
+		} while (!done);
+	}
 
 	/*
 	 * We've made all the changes that we need to make incore.  Flush them
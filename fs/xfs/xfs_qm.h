@@ -66,10 +66,14 @@ struct xfs_def_quota {
  * Various quota information for individual filesystems.
  * The mount structure keeps a pointer to this.
  */
+/* Project usage snapshots copied out per RCU read section */
+#define XFS_PROJ_USAGE_BATCH	32
+
 typedef struct xfs_quotainfo {
 	struct radix_tree_root qi_uquota_tree;
 	struct radix_tree_root qi_gquota_tree;
 	struct radix_tree_root qi_pquota_tree;
+	struct radix_tree_root qi_psnap_tree;	/* project usage snapshots */
 	struct mutex qi_tree_lock;
 	struct xfs_inode	*qi_uquotaip;	/* user quota inode */
 	struct xfs_inode	*qi_gquotaip;	/* group quota inode */
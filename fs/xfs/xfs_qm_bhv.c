@@ -29,30 +29,28 @@
 
 
 STATIC void
-xfs_fill_statvfs_from_dquot(
+xfs_fill_statvfs_from_dqsnap(
 	struct kstatfs		*statp,
-	struct xfs_dquot	*dqp)
+	struct xfs_dqsnap	*snap)
 {
 	uint64_t		limit;
 
-	limit = dqp->q_core.d_blk_softlimit ?
-		be64_to_cpu(dqp->q_core.d_blk_softlimit) :
-		be64_to_cpu(dqp->q_core.d_blk_hardlimit);
+	limit = snap->ds_blk_softlimit ?
+		snap->ds_blk_softlimit : snap->ds_blk_hardlimit;
 	if (limit && statp->f_blocks > limit) {
 		statp->f_blocks = limit;
 		statp->f_bfree = statp->f_bavail =
-			(statp->f_blocks > dqp->q_res_bcount) ?
-			 (statp->f_blocks - dqp->q_res_bcount) : 0;
+			(statp->f_blocks > snap->ds_bcount) ?
+			 (statp->f_blocks - snap->ds_bcount) : 0;
 	}
 
-	limit = dqp->q_core.d_ino_softlimit ?
-		be64_to_cpu(dqp->q_core.d_ino_softlimit) :
-		be64_to_cpu(dqp->q_core.d_ino_hardlimit);
+	limit = snap->ds_ino_softlimit ?
+		snap->ds_ino_softlimit : snap->ds_ino_hardlimit;
 	if (limit && statp->f_files > limit) {
 		statp->f_files = limit;
 		statp->f_ffree =
-			(statp->f_files > dqp->q_res_icount) ?
-			 (statp->f_ffree - dqp->q_res_icount) : 0;
+			(statp->f_files > snap->ds_icount) ?
+			 (statp->f_ffree - snap->ds_icount) : 0;
 	}
 }
 
@@ -63,6 +61,9 @@ xfs_fill_statvfs_from_dquot(
  * A statvfs (df, etc.) of a directory that is using project quota should
  * return a statvfs of the project, not the entire filesystem.
  * This makes such trees appear as if they are filesystems in themselves.
+ *
+ * Once the project's dquot has been read in, its usage snapshot answers
+ * without any dquot lookup or locking.
  */
 void
 xfs_qm_statvfs(
@@ -71,11 +72,78 @@ xfs_qm_statvfs(
 {
 	xfs_mount_t		*mp = ip->i_mount;
 	xfs_dquot_t		*dqp;
+	struct xfs_dqsnap	snap;
 
-	if (!xfs_qm_dqget(mp, NULL, xfs_get_projid(ip), XFS_DQ_PROJ, 0, &dqp)) {
-		xfs_fill_statvfs_from_dquot(statp, dqp);
+	if (!xfs_dqsnap_read(mp, xfs_get_projid(ip), &snap)) {
+		if (xfs_qm_dqget(mp, NULL, xfs_get_projid(ip), XFS_DQ_PROJ, 0,
+				 &dqp))
+			return;
+		xfs_dqslack_drain(dqp);
+		xfs_dqsnap_fill(dqp, &snap);
 		xfs_qm_dqput(dqp);
 	}
+	xfs_fill_statvfs_from_dqsnap(statp, &snap);
+}
+
+/*
+ * Report usage for up to *count projects with ids from *id upwards from their
+ * usage snapshots.  Only projects whose dquots have been read in since quotas
+ * were turned on have a snapshot.  On return *count is the number of projects
+ * reported, *id the project id to resume from and *done is set if there are
+ * no more projects to report.
+ */
+int
+xfs_qm_proj_usage(
+	struct xfs_mount	*mp,
+	xfs_dqid_t		*id,
+	struct xfs_proj_usage	*pu,
+	unsigned int		*count,
+	bool			*done)
+{
+	struct xfs_quotainfo	*qi = mp->m_quotainfo;
+	struct xfs_dqsnap	*batch[XFS_PROJ_USAGE_BATCH];
+	struct xfs_dqsnap	snap;
+	unsigned long		index = *id;
+	xfs_dqid_t		last = 0;
+	unsigned int		nr = 0;
+	int			nr_found;
+	int			i;
+
+	if (!qi || !XFS_IS_PQUOTA_ON(mp))
+		return -ESRCH;
+
+	*done = false;
+	while (nr < *count && !*done) {
+		rcu_read_lock();
+		nr_found = radix_tree_gang_lookup(&qi->qi_psnap_tree,
+				(void **)batch, index,
+				min_t(unsigned int, *count - nr,
+				      XFS_PROJ_USAGE_BATCH));
+		for (i = 0; i < nr_found; i++, nr++) {
+			xfs_dqsnap_copy(batch[i], &snap);
+			pu[nr].pu_projid = snap.ds_id;
+			pu[nr].pu_pad = 0;
+			pu[nr].pu_bytes = XFS_FSB_TO_B(mp, snap.ds_bcount);
+			pu[nr].pu_inodes = snap.ds_icount;
+			pu[nr].pu_blk_softlimit =
+				XFS_FSB_TO_B(mp, snap.ds_blk_softlimit);
+			pu[nr].pu_blk_hardlimit =
+				XFS_FSB_TO_B(mp, snap.ds_blk_hardlimit);
+			pu[nr].pu_ino_softlimit = snap.ds_ino_softlimit;
+			pu[nr].pu_ino_hardlimit = snap.ds_ino_hardlimit;
+			last = snap.ds_id;
+		}
+		rcu_read_unlock();
+
+		if (!nr_found || last == (xfs_dqid_t)-1)
+			*done = true;
+		else
+			index = (unsigned long)last + 1;
+	}
+
+	*id = index;
+	*count = nr;
+	return 0;
 }
 
 int
@@ -442,6 +442,9 @@ xfs_qm_scall_setqlim(
 	xfs_trans_dqjoin(tp, dqp);
 	ddq = &dqp->q_core;
 
+	/* the new limits may not leave room for any slack */
+	xfs_dqslack_drain(dqp);
+
 	/*
 	 * Make sure that hardlimits are >= soft limits before changing.
 	 */
@@ -656,6 +659,7 @@ xfs_qm_scall_getquota(
 	*id = be32_to_cpu(dqp->q_core.d_id);
 
 	memset(dst, 0, sizeof(*dst));
+	xfs_dqslack_drain(dqp);
 	dst->d_spc_hardlimit =
 		XFS_FSB_TO_B(mp, be64_to_cpu(dqp->q_core.d_blk_hardlimit));
 	dst->d_spc_softlimit =
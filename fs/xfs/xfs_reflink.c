@@ -184,6 +184,181 @@ xfs_reflink_find_shared(
 	return error;
 }
 
+/*
+ * Adapt the automatic CoW extent size hint to the way the file is being
+ * written, much as xfs_iomap_prealloc_size does for EOF preallocation.
+ * A write that starts where the last CoW reservation ended looks like a
+ * sequential rewrite, so double the hint to cut down on the number of
+ * reservations and the fragmentation of the new extents.  A write
+ * anywhere else looks random, so halve the hint to stop us reserving
+ * (and later copying) blocks around each small write that nobody asked
+ * for.  Back off as the filesystem fills up, the same way that EOF
+ * preallocation does.  Anything we overreserve is trimmed by the
+ * cowblocks worker.  Explicit hints are left alone.
+ */
+STATIC void
+xfs_reflink_tune_cowextsz(
+	struct xfs_inode	*ip,
+	xfs_fileoff_t		offset_fsb)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_inode_io	*io = xfs_inode_io_get(ip);
+	xfs_extlen_t		hint = io->iio_cowextsz_auto;
+	xfs_extlen_t		maxhint = XFS_MAX_AUTO_COWEXTSZ;
+	int64_t			freesp;
+	int			i;
+
+	ASSERT(xfs_isilocked(ip, XFS_ILOCK_EXCL));
+
+	if ((ip->i_d.di_flags2 & XFS_DIFLAG2_COWEXTSIZE) ||
+	    xfs_get_extsz_hint(ip))
+		return;
+
+	freesp = percpu_counter_read_positive(&mp->m_fdblocks);
+	for (i = 0; i < XFS_LOWSP_MAX; i++)
+		if (freesp < mp->m_low_space[i])
+			maxhint >>= 1;
+
+	/* Leave the first reservation at the default size. */
+	if (offset_fsb == io->iio_cow_next)
+		hint <<= 1;
+	else if (io->iio_cow_next != NULLFILEOFF)
+		hint >>= 1;
+	hint = clamp_t(xfs_extlen_t, hint, XFS_MIN_AUTO_COWEXTSZ,
+			max_t(xfs_extlen_t, maxhint, XFS_MIN_AUTO_COWEXTSZ));
+
+	if (hint != io->iio_cowextsz_auto)
+		trace_xfs_reflink_tune_cowextsz(ip, offset_fsb, hint,
+				io->iio_cowextsz_auto);
+	io->iio_cowextsz_auto = hint;
+}
+
+/* Sample an AG's refcount btree generation. */
+STATIC unsigned int
+xfs_reflink_refcount_gen(
+	struct xfs_mount	*mp,
+	xfs_agnumber_t		agno)
+{
+	struct xfs_perag	*pag;
+	unsigned int		gen;
+
+	pag = xfs_perag_get(mp, agno);
+	gen = atomic_read(&pag->pagf_refcount_gen);
+	xfs_perag_put(pag);
+	return gen;
+}
+
+/*
+ * Overwrites of a reflinked file look up the same blocks in the refcount
+ * btree over and over, even though most of them stopped being shared when
+ * they were first CoWed.  Remember the last few ranges that we found to be
+ * all shared or all unshared, each with its AG's refcount btree generation
+ * sampled before the lookup.  Every refcount btree update bumps the
+ * generation, so a range is only trusted while its AG's refcount btree is
+ * unchanged.
+ *
+ * Only reflinked files ever use the cache, so it hangs off the data I/O state
+ * and is allocated the first time something is put into it.  Files that have
+ * not been written yet don't cache anything.
+ */
+#define XFS_SHARED_RANGES	4
+
+/*
+ * A range of data device blocks that were all shared or all unshared when
+ * the refcount btree of their AG was at generation @sr_gen.
+ */
+struct xfs_shared_range {
+	xfs_fsblock_t		sr_bno;		/* start of range */
+	xfs_extlen_t		sr_len;		/* length, zero if unused */
+	bool			sr_shared;	/* range is shared */
+	unsigned int		sr_gen;		/* pagf_refcount_gen sampled */
+};
+
+struct xfs_shared_cache {
+	struct xfs_shared_range	sc_ranges[XFS_SHARED_RANGES];
+	unsigned int		sc_next;	/* next slot to replace */
+};
+
+void
+xfs_reflink_shared_cache_free(
+	struct xfs_inode	*ip)
+{
+	if (!ip->i_io)
+		return;
+	kmem_free(ip->i_io->iio_shared);
+	ip->i_io->iio_shared = NULL;
+}
+
+STATIC bool
+xfs_reflink_shared_cache_lookup(
+	struct xfs_inode	*ip,
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len,
+	bool			*shared)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
+	struct xfs_shared_range	*sr;
+	unsigned int		gen;
+	bool			hit = false;
+	int			i;
+
+	if (!io || !READ_ONCE(io->iio_shared))
+		return false;
+
+	spin_lock(&ip->i_flags_lock);
+	for (i = 0, sr = io->iio_shared->sc_ranges; i < XFS_SHARED_RANGES;
+	     i++, sr++) {
+		if (sr->sr_len && fsbno >= sr->sr_bno &&
+		    fsbno + len <= sr->sr_bno + sr->sr_len) {
+			*shared = sr->sr_shared;
+			gen = sr->sr_gen;
+			hit = true;
+			break;
+		}
+	}
+	spin_unlock(&ip->i_flags_lock);
+
+	return hit && gen == xfs_reflink_refcount_gen(mp,
+					XFS_FSB_TO_AGNO(mp, fsbno));
+}
+
+STATIC void
+xfs_reflink_shared_cache_set(
+	struct xfs_inode	*ip,
+	xfs_fsblock_t		fsbno,
+	xfs_extlen_t		len,
+	bool			shared,
+	unsigned int		gen)
+{
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
+	struct xfs_shared_cache	*sc;
+	struct xfs_shared_range	*sr;
+
+	/* Only cache ranges for files that are being written. */
+	if (!io)
+		return;
+	sc = READ_ONCE(io->iio_shared);
+	if (!sc) {
+		sc = kmem_zalloc(sizeof(*sc), KM_NOFS | KM_MAYFAIL);
+		if (!sc)
+			return;
+		if (cmpxchg(&io->iio_shared, NULL, sc) != NULL) {
+			kmem_free(sc);
+			sc = READ_ONCE(io->iio_shared);
+		}
+	}
+
+	spin_lock(&ip->i_flags_lock);
+	sr = &sc->sc_ranges[sc->sc_next];
+	sc->sc_next = (sc->sc_next + 1) % XFS_SHARED_RANGES;
+	sr->sr_bno = fsbno;
+	sr->sr_len = len;
+	sr->sr_shared = shared;
+	sr->sr_gen = gen;
+	spin_unlock(&ip->i_flags_lock);
+}
+
 /*
  * Trim the mapping to the next block where there's a change in the
  * shared/unshared status.  More specifically, this means that we
@@ -206,6 +381,7 @@ xfs_reflink_trim_around_shared(
 	xfs_extlen_t		aglen;
 	xfs_agblock_t		fbno;
 	xfs_extlen_t		flen;
+	unsigned int		gen;
 	int			error = 0;
 
 	/* Holes, unwritten, and delalloc extents cannot be shared */
@@ -216,10 +392,17 @@ xfs_reflink_trim_around_shared(
 
 	trace_xfs_reflink_trim_around_shared(ip, irec);
 
+	if (xfs_reflink_shared_cache_lookup(ip, irec->br_startblock,
+			irec->br_blockcount, shared)) {
+		*trimmed = false;
+		return 0;
+	}
+
 	agno = XFS_FSB_TO_AGNO(ip->i_mount, irec->br_startblock);
 	agbno = XFS_FSB_TO_AGBNO(ip->i_mount, irec->br_startblock);
 	aglen = irec->br_blockcount;
 
+	gen = xfs_reflink_refcount_gen(ip->i_mount, agno);
 	error = xfs_reflink_find_shared(ip->i_mount, NULL, agno, agbno,
 			aglen, &fbno, &flen, true);
 	if (error)
@@ -228,6 +411,8 @@ xfs_reflink_trim_around_shared(
 	*shared = *trimmed = false;
 	if (fbno == NULLAGBLOCK) {
 		/* No shared blocks at all. */
+		xfs_reflink_shared_cache_set(ip, irec->br_startblock, aglen,
+				false, gen);
 		return 0;
 	} else if (fbno == agbno) {
 		/*
@@ -240,6 +425,8 @@ xfs_reflink_trim_around_shared(
 		*shared = true;
 		if (flen != aglen)
 			*trimmed = true;
+		xfs_reflink_shared_cache_set(ip, irec->br_startblock, flen,
+				true, gen);
 		return 0;
 	} else {
 		/*
@@ -250,6 +437,8 @@ xfs_reflink_trim_around_shared(
 		 */
 		irec->br_blockcount = fbno - agbno;
 		*trimmed = true;
+		xfs_reflink_shared_cache_set(ip, irec->br_startblock,
+				fbno - agbno, false, gen);
 		return 0;
 	}
 }
@@ -311,12 +500,14 @@ xfs_reflink_reserve_cow(
 	if (error)
 		return error;
 
+	xfs_reflink_tune_cowextsz(ip, imap->br_startoff);
 	error = xfs_bmapi_reserve_delalloc(ip, XFS_COW_FORK, imap->br_startoff,
 			imap->br_blockcount, 0, &got, &idx, eof);
 	if (error == -ENOSPC || error == -EDQUOT)
 		trace_xfs_reflink_cow_enospc(ip, imap);
 	if (error)
 		return error;
+	ip->i_io->iio_cow_next = got.br_startoff + got.br_blockcount;
 
 	trace_xfs_reflink_cow_alloc(ip, &got);
 	return 0;
@@ -485,7 +676,8 @@ xfs_reflink_allocate_cow(
 }
 
 /*
- * Find the CoW reservation for a given byte offset of a file.
+ * Find the CoW reservation for a given byte offset of a file.  If there is
+ * none, @imap is set to a hole covering the range up to the next reservation.
  */
 bool
 xfs_reflink_find_cow_mapping(
@@ -503,9 +695,14 @@ xfs_reflink_find_cow_mapping(
 
 	offset_fsb = XFS_B_TO_FSBT(ip->i_mount, offset);
 	if (!xfs_iext_lookup_extent(ip, ifp, offset_fsb, &idx, &got))
+		got.br_startoff = NULLFILEOFF;
+	if (got.br_startoff > offset_fsb) {
+		imap->br_startoff = offset_fsb;
+		imap->br_startblock = HOLESTARTBLOCK;
+		imap->br_blockcount = got.br_startoff - offset_fsb;
+		imap->br_state = XFS_EXT_NORM;
 		return false;
-	if (got.br_startoff > offset_fsb)
-		return false;
+	}
 
 	trace_xfs_reflink_find_cow_mapping(ip, offset, 1, XFS_IO_OVERWRITE,
 			&got);
@@ -814,26 +1011,96 @@ xfs_reflink_end_cow(
 	return error;
 }
 
+/* Most AGs whose CoW leftovers are recovered in parallel at mount. */
+#define XFS_REFLINK_RECOVER_MAX_WORKERS	16
+
+struct xfs_reflink_recover {
+	struct xfs_mount	*rc_mp;
+	atomic_t		rc_next_agno;
+	int			rc_error;	/* first error; stop everyone */
+};
+
+struct xfs_reflink_recover_worker {
+	struct work_struct	rw_work;
+	struct xfs_reflink_recover *rw_rc;
+};
+
+/* Keep recovering AGs until they're all done or someone fails. */
+STATIC void
+xfs_reflink_recover_cow_ags(
+	struct xfs_reflink_recover *rc)
+{
+	struct xfs_mount	*mp = rc->rc_mp;
+	xfs_agnumber_t		agno;
+	int			error;
+
+	while (!READ_ONCE(rc->rc_error) &&
+	       (agno = atomic_inc_return(&rc->rc_next_agno) - 1) <
+			mp->m_sb.sb_agcount) {
+		error = xfs_refcount_recover_cow_leftovers(mp, agno);
+		if (error)
+			cmpxchg(&rc->rc_error, 0, error);
+	}
+}
+
+STATIC void
+xfs_reflink_recover_cow_worker(
+	struct work_struct	*work)
+{
+	struct xfs_reflink_recover_worker *rw = container_of(work,
+				struct xfs_reflink_recover_worker, rw_work);
+
+	xfs_reflink_recover_cow_ags(rw->rw_rc);
+}
+
 /*
  * Free leftover CoW reservations that didn't get cleaned out.
+ *
+ * Each AG's leftovers live only in that AG's refcount btree and free space,
+ * so the AGs are independent of each other.  Share them out among the
+ * mounting thread and a pool of workers; if we can't get any help, the
+ * mounting thread does them all.
  */
 int
 xfs_reflink_recover_cow(
 	struct xfs_mount	*mp)
 {
-	xfs_agnumber_t		agno;
-	int			error = 0;
+	struct xfs_reflink_recover rc = { .rc_mp = mp };
+	struct xfs_reflink_recover_worker *workers = NULL;
+	struct workqueue_struct	*wq = NULL;
+	int			nworkers;
+	int			i;
 
 	if (!xfs_sb_version_hasreflink(&mp->m_sb))
 		return 0;
 
-	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
-		error = xfs_refcount_recover_cow_leftovers(mp, agno);
-		if (error)
-			break;
+	atomic_set(&rc.rc_next_agno, 0);
+
+	/* The mounting thread does its share, so we need one helper fewer. */
+	nworkers = min_t(int, num_online_cpus(),
+			XFS_REFLINK_RECOVER_MAX_WORKERS);
+	nworkers = min_t(xfs_agnumber_t, nworkers, mp->m_sb.sb_agcount) - 1;
+	if (nworkers > 0) {
+		workers = kmem_zalloc(nworkers * sizeof(*workers), KM_MAYFAIL);
+		if (workers)
+			wq = alloc_workqueue("xfs-cowrecover/%s", WQ_UNBOUND,
+					nworkers, mp->m_fsname);
 	}
 
-	return error;
+	if (wq) {
+		for (i = 0; i < nworkers; i++) {
+			INIT_WORK(&workers[i].rw_work,
+					xfs_reflink_recover_cow_worker);
+			workers[i].rw_rc = &rc;
+			queue_work(wq, &workers[i].rw_work);
+		}
+	}
+	xfs_reflink_recover_cow_ags(&rc);
+	if (wq)
+		destroy_workqueue(wq);
+	kmem_free(workers);
+
+	return rc.rc_error;
 }
 
 /*
@@ -1048,10 +1315,12 @@ xfs_reflink_ag_has_free_space(
 /*
  * Unmap a range of blocks from a file, then map other blocks into the hole.
  * The range to unmap is (destoff : destoff + srcioff + irec->br_blockcount).
- * The extent irec is mapped into dest at irec->br_startoff.
+ * The extent irec is mapped into dest at irec->br_startoff.  The caller
+ * must hold the ILOCK and have joined the inode to the transaction.
  */
 STATIC int
 xfs_reflink_remap_extent(
+	struct xfs_trans	**tpp,
 	struct xfs_inode	*ip,
 	struct xfs_bmbt_irec	*irec,
 	xfs_fileoff_t		destoff,
@@ -1059,9 +1328,7 @@ xfs_reflink_remap_extent(
 {
 	struct xfs_mount	*mp = ip->i_mount;
 	bool			real_extent = xfs_bmap_is_real_extent(irec);
-	struct xfs_trans	*tp;
 	xfs_fsblock_t		firstfsb;
-	unsigned int		resblks;
 	struct xfs_defer_ops	dfops;
 	struct xfs_bmbt_irec	uirec;
 	xfs_filblks_t		rlen;
@@ -1072,31 +1339,6 @@ xfs_reflink_remap_extent(
 	unmap_len = irec->br_startoff + irec->br_blockcount - destoff;
 	trace_xfs_reflink_punch_range(ip, destoff, unmap_len);
 
-	/* No reflinking if we're low on space */
-	if (real_extent) {
-		error = xfs_reflink_ag_has_free_space(mp,
-				XFS_FSB_TO_AGNO(mp, irec->br_startblock));
-		if (error)
-			goto out;
-	}
-
-	/* Start a rolling transaction to switch the mappings */
-	resblks = XFS_EXTENTADD_SPACE_RES(ip->i_mount, XFS_DATA_FORK);
-	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write, resblks, 0, 0, &tp);
-	if (error)
-		goto out;
-
-	xfs_ilock(ip, XFS_ILOCK_EXCL);
-	xfs_trans_ijoin(tp, ip, 0);
-
-	/* If we're not just clearing space, then do we have enough quota? */
-	if (real_extent) {
-		error = xfs_trans_reserve_quota_nblks(tp, ip,
-				irec->br_blockcount, 0, XFS_QMOPT_RES_REGBLKS);
-		if (error)
-			goto out_cancel;
-	}
-
 	trace_xfs_reflink_remap(ip, irec->br_startoff,
 				irec->br_blockcount, irec->br_startblock);
 
@@ -1104,7 +1346,7 @@ xfs_reflink_remap_extent(
 	rlen = unmap_len;
 	while (rlen) {
 		xfs_defer_init(&dfops, &firstfsb);
-		error = __xfs_bunmapi(tp, ip, destoff, &rlen, 0, 1,
+		error = __xfs_bunmapi(*tpp, ip, destoff, &rlen, 0, 1,
 				&firstfsb, &dfops);
 		if (error)
 			goto out_defer;
@@ -1136,7 +1378,7 @@ xfs_reflink_remap_extent(
 			goto out_defer;
 
 		/* Update quota accounting. */
-		xfs_trans_mod_dquot_byino(tp, ip, XFS_TRANS_DQ_BCOUNT,
+		xfs_trans_mod_dquot_byino(*tpp, ip, XFS_TRANS_DQ_BCOUNT,
 				uirec.br_blockcount);
 
 		/* Update dest isize if needed. */
@@ -1147,24 +1389,88 @@ xfs_reflink_remap_extent(
 			trace_xfs_reflink_update_inode_size(ip, newlen);
 			i_size_write(VFS_I(ip), newlen);
 			ip->i_d.di_size = newlen;
-			xfs_trans_log_inode(tp, ip, XFS_ILOG_CORE);
+			xfs_trans_log_inode(*tpp, ip, XFS_ILOG_CORE);
 		}
 
 next_extent:
 		/* Process all the deferred stuff. */
-		error = xfs_defer_finish(&tp, &dfops, ip);
+		error = xfs_defer_finish(tpp, &dfops, ip);
 		if (error)
 			goto out_defer;
 	}
 
+	return 0;
+
+out_defer:
+	xfs_defer_cancel(&dfops);
+	return error;
+}
+
+/*
+ * Remap a batch of source mappings into the destination file in a single
+ * rolling transaction.  The source mappings have already been translated
+ * to destination file offsets and are contiguous, starting at destoff.
+ * We reserve enough blocks and quota for the whole batch up front so that
+ * we only pay the cost of setting up a transaction once per batch; the
+ * log space is regranted every time the deferred ops roll the transaction.
+ */
+STATIC int
+xfs_reflink_remap_batch(
+	struct xfs_inode	*ip,
+	struct xfs_bmbt_irec	*imaps,
+	int			nimaps,
+	xfs_fileoff_t		destoff,
+	xfs_off_t		new_isize)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_trans	*tp;
+	xfs_filblks_t		qblocks = 0;
+	unsigned int		resblks;
+	int			i;
+	int			error;
+
+	/* No reflinking if we're low on space */
+	for (i = 0; i < nimaps; i++) {
+		if (!xfs_bmap_is_real_extent(&imaps[i]))
+			continue;
+		error = xfs_reflink_ag_has_free_space(mp,
+				XFS_FSB_TO_AGNO(mp, imaps[i].br_startblock));
+		if (error)
+			goto out;
+		qblocks += imaps[i].br_blockcount;
+	}
+
+	/* Start a rolling transaction to switch the mappings */
+	resblks = nimaps * XFS_EXTENTADD_SPACE_RES(mp, XFS_DATA_FORK);
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write, resblks, 0, 0, &tp);
+	if (error)
+		goto out;
+
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	xfs_trans_ijoin(tp, ip, 0);
+
+	/* If we're not just clearing space, then do we have enough quota? */
+	if (qblocks) {
+		error = xfs_trans_reserve_quota_nblks(tp, ip, qblocks, 0,
+				XFS_QMOPT_RES_REGBLKS);
+		if (error)
+			goto out_cancel;
+	}
+
+	for (i = 0; i < nimaps; i++) {
+		error = xfs_reflink_remap_extent(&tp, ip, &imaps[i], destoff,
+				new_isize);
+		if (error)
+			goto out_cancel;
+		destoff = imaps[i].br_startoff + imaps[i].br_blockcount;
+	}
+
 	error = xfs_trans_commit(tp);
 	xfs_iunlock(ip, XFS_ILOCK_EXCL);
 	if (error)
 		goto out;
 	return 0;
 
-out_defer:
-	xfs_defer_cancel(&dfops);
 out_cancel:
 	xfs_trans_cancel(tp);
 	xfs_iunlock(ip, XFS_ILOCK_EXCL);
@@ -1173,6 +1479,9 @@ xfs_reflink_remap_extent(
 	return error;
 }
 
+/* Number of source mappings we read ahead and remap per transaction. */
+#define XFS_REFLINK_REMAP_BATCH	16
+
 /*
  * Iteratively remap one file's extents (and holes) to another's.
  */
@@ -1185,8 +1494,9 @@ xfs_reflink_remap_blocks(
 	xfs_filblks_t		len,
 	xfs_off_t		new_isize)
 {
-	struct xfs_bmbt_irec	imap;
+	struct xfs_bmbt_irec	imaps[XFS_REFLINK_REMAP_BATCH];
 	int			nimaps;
+	int			i;
 	int			error = 0;
 	xfs_filblks_t		range_len;
 
@@ -1194,24 +1504,28 @@ xfs_reflink_remap_blocks(
 	while (len) {
 		trace_xfs_reflink_remap_blocks_loop(src, srcoff, len,
 				dest, destoff);
-		/* Read extent from the source file */
-		nimaps = 1;
+		/* Read the next few extents from the source file */
+		nimaps = XFS_REFLINK_REMAP_BATCH;
 		xfs_ilock(src, XFS_ILOCK_EXCL);
-		error = xfs_bmapi_read(src, srcoff, len, &imap, &nimaps, 0);
+		error = xfs_bmapi_read(src, srcoff, len, imaps, &nimaps, 0);
 		xfs_iunlock(src, XFS_ILOCK_EXCL);
 		if (error)
 			goto err;
-		ASSERT(nimaps == 1);
-
-		trace_xfs_reflink_remap_imap(src, srcoff, len, XFS_IO_OVERWRITE,
-				&imap);
-
-		/* Translate imap into the destination file. */
-		range_len = imap.br_startoff + imap.br_blockcount - srcoff;
-		imap.br_startoff += destoff - srcoff;
+		ASSERT(nimaps >= 1);
+
+		/* Translate the imaps into the destination file. */
+		range_len = 0;
+		for (i = 0; i < nimaps; i++) {
+			trace_xfs_reflink_remap_imap(src, srcoff + range_len,
+					len - range_len, XFS_IO_OVERWRITE,
+					&imaps[i]);
+			range_len = imaps[i].br_startoff +
+				    imaps[i].br_blockcount - srcoff;
+			imaps[i].br_startoff += destoff - srcoff;
+		}
 
-		/* Clear dest from destoff to the end of imap and map it in. */
-		error = xfs_reflink_remap_extent(dest, &imap, destoff,
+		/* Clear dest from destoff to the end of imaps and map them. */
+		error = xfs_reflink_remap_batch(dest, imaps, nimaps, destoff,
 				new_isize);
 		if (error)
 			goto err;
@@ -1234,6 +1548,124 @@ xfs_reflink_remap_blocks(
 	return error;
 }
 
+/*
+ * Do two ranges already map the same physical blocks?  This is a common
+ * outcome of running a dedupe program repeatedly over the same files, and
+ * if it's true there's no point in reading and comparing the contents.
+ * Both files must have been flushed, and the caller must hold the IOLOCK
+ * and MMAPLOCK of both so that nobody can change them under us.  Matching
+ * holes count as the same, since they read back as zeroes either way.
+ */
+STATIC int
+xfs_reflink_ranges_shared(
+	struct xfs_inode	*src,
+	xfs_fileoff_t		srcoff,
+	struct xfs_inode	*dest,
+	xfs_fileoff_t		destoff,
+	xfs_filblks_t		len,
+	bool			*shared)
+{
+	struct xfs_bmbt_irec	smap;
+	struct xfs_bmbt_irec	dmap;
+	xfs_filblks_t		adv;
+	int			nimaps;
+	int			error = 0;
+
+	*shared = false;
+	if (src == dest)
+		xfs_ilock(src, XFS_ILOCK_EXCL);
+	else
+		xfs_lock_two_inodes(src, dest, XFS_ILOCK_EXCL);
+
+	while (len) {
+		nimaps = 1;
+		error = xfs_bmapi_read(src, srcoff, len, &smap, &nimaps, 0);
+		if (error)
+			goto out_unlock;
+		nimaps = 1;
+		error = xfs_bmapi_read(dest, destoff, len, &dmap, &nimaps, 0);
+		if (error)
+			goto out_unlock;
+
+		adv = min(smap.br_blockcount, dmap.br_blockcount);
+		if (smap.br_startblock == HOLESTARTBLOCK &&
+		    dmap.br_startblock == HOLESTARTBLOCK)
+			goto next;
+		if (!xfs_bmap_is_real_extent(&smap) ||
+		    !xfs_bmap_is_real_extent(&dmap) ||
+		    smap.br_startblock != dmap.br_startblock ||
+		    smap.br_state != dmap.br_state)
+			goto out_unlock;
+next:
+		srcoff += adv;
+		destoff += adv;
+		len -= adv;
+	}
+	*shared = true;
+
+out_unlock:
+	xfs_iunlock(src, XFS_ILOCK_EXCL);
+	if (src != dest)
+		xfs_iunlock(dest, XFS_ILOCK_EXCL);
+	return error;
+}
+
+/*
+ * Get ready to dedupe a range.  This does the same checks and flushing as
+ * vfs_clone_file_prep_inodes, but looks for blocks that are already shared
+ * before falling back to comparing the file contents.  Returns 1 if the
+ * caller should remap the range, 0 if there's nothing to do, or a
+ * negative errno.
+ */
+STATIC int
+xfs_reflink_dedupe_prep(
+	struct inode		*inode_in,
+	loff_t			pos_in,
+	struct inode		*inode_out,
+	loff_t			pos_out,
+	u64			*len)
+{
+	struct xfs_mount	*mp = XFS_I(inode_in)->i_mount;
+	loff_t			disize;
+	bool			is_same = false;
+	int			ret;
+
+	/* Zero length dedupe exits immediately; let the VFS check that. */
+	if (*len == 0)
+		return vfs_clone_file_prep_inodes(inode_in, pos_in, inode_out,
+				pos_out, len, true);
+
+	ret = vfs_clone_file_prep_inodes(inode_in, pos_in, inode_out, pos_out,
+			len, false);
+	if (ret <= 0)
+		return ret;
+
+	/* Don't allow dedupe past EOF in the dest file */
+	disize = i_size_read(inode_out);
+	if (pos_out >= disize || pos_out + *len > disize)
+		return -EINVAL;
+
+	ret = xfs_reflink_ranges_shared(XFS_I(inode_in),
+			XFS_B_TO_FSBT(mp, pos_in), XFS_I(inode_out),
+			XFS_B_TO_FSBT(mp, pos_out), XFS_B_TO_FSB(mp, *len),
+			&is_same);
+	if (ret)
+		return ret;
+	if (is_same) {
+		trace_xfs_reflink_dedupe_shared(XFS_I(inode_in), pos_in, *len,
+				XFS_I(inode_out), pos_out);
+		return 0;
+	}
+
+	ret = vfs_dedupe_file_range_compare(inode_in, pos_in, inode_out,
+			pos_out, *len, &is_same);
+	if (ret)
+		return ret;
+	if (!is_same)
+		return -EBADE;
+	return 1;
+}
+
 /*
  * Link a range of blocks from one file to another.
  */
@@ -1280,13 +1712,30 @@ xfs_reflink_remap_range(
 	if (IS_DAX(inode_in) || IS_DAX(inode_out))
 		goto out_unlock;
 
-	ret = vfs_clone_file_prep_inodes(inode_in, pos_in, inode_out, pos_out,
-			&len, is_dedupe);
+	if (is_dedupe)
+		ret = xfs_reflink_dedupe_prep(inode_in, pos_in, inode_out,
+				pos_out, &len);
+	else
+		ret = vfs_clone_file_prep_inodes(inode_in, pos_in, inode_out,
+				pos_out, &len, false);
 	if (ret <= 0)
 		goto out_unlock;
 
 	trace_xfs_reflink_remap_range(src, pos_in, len, dest, pos_out);
 
+	/*
+	 * Only blocks can be shared.  Writeback in the prep above may have
+	 * just moved small files into their inodes, so check after it.
+	 */
+	ret = xfs_inline_data_to_extents(src);
+	if (ret)
+		goto out_unlock;
+	if (!same_inode) {
+		ret = xfs_inline_data_to_extents(dest);
+		if (ret)
+			goto out_unlock;
+	}
+
 	/* Set flags and remap blocks. */
 	ret = xfs_reflink_set_inode_flag(src, dest);
 	if (ret)
@@ -1408,7 +1857,48 @@ xfs_reflink_dirty_extents(
 	return error;
 }
 
-/* Does this inode need the reflink flag? */
+/*
+ * Have we recently seen a range of this file's blocks that is still shared?
+ * A cached shared range stays valid until its AG's refcount btree changes,
+ * and anything that unmaps a shared block from the file changes the
+ * refcount btree, so this can only be wrong by keeping the flag a little
+ * longer than needed.
+ */
+STATIC bool
+xfs_reflink_shared_cache_any(
+	struct xfs_inode	*ip)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_inode_io	*io = READ_ONCE(ip->i_io);
+	struct xfs_shared_range	sr[XFS_SHARED_RANGES];
+	int			i;
+
+	if (!io || !READ_ONCE(io->iio_shared))
+		return false;
+
+	spin_lock(&ip->i_flags_lock);
+	memcpy(sr, io->iio_shared->sc_ranges, sizeof(sr));
+	spin_unlock(&ip->i_flags_lock);
+
+	for (i = 0; i < XFS_SHARED_RANGES; i++) {
+		if (sr[i].sr_len && sr[i].sr_shared &&
+		    sr[i].sr_gen == xfs_reflink_refcount_gen(mp,
+					XFS_FSB_TO_AGNO(mp, sr[i].sr_bno)))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Does this inode need the reflink flag?
+ *
+ * If we already know of a shared range the answer is immediate.
+ * Otherwise we look at every written extent, skipping the ones that the
+ * shared range cache says are unshared and keeping the AGF and refcount
+ * btree cursor around while consecutive extents stay in the same AG.  A
+ * shared extent that we find is remembered so that the next caller can
+ * stop right away.
+ */
 int
 xfs_reflink_inode_has_shared_extents(
 	struct xfs_trans		*tp,
@@ -1418,14 +1908,19 @@ xfs_reflink_inode_has_shared_extents(
 	struct xfs_bmbt_irec		got;
 	struct xfs_mount		*mp = ip->i_mount;
 	struct xfs_ifork		*ifp;
+	struct xfs_buf			*agbp = NULL;
+	struct xfs_btree_cur		*cur = NULL;
 	xfs_agnumber_t			agno;
+	xfs_agnumber_t			cur_agno = NULLAGNUMBER;
 	xfs_agblock_t			agbno;
 	xfs_extlen_t			aglen;
 	xfs_agblock_t			rbno;
 	xfs_extlen_t			rlen;
 	xfs_extnum_t			idx;
+	unsigned int			gen = 0;
+	bool				shared;
 	bool				found;
-	int				error;
+	int				error = 0;
 
 	ifp = XFS_IFORK_PTR(ip, XFS_DATA_FORK);
 	if (!(ifp->if_flags & XFS_IFEXTENTS)) {
@@ -1434,30 +1929,62 @@ xfs_reflink_inode_has_shared_extents(
 			return error;
 	}
 
-	*has_shared = false;
+	*has_shared = xfs_reflink_shared_cache_any(ip);
+	if (*has_shared)
+		return 0;
+
 	found = xfs_iext_lookup_extent(ip, ifp, 0, &idx, &got);
 	while (found) {
 		if (isnullstartblock(got.br_startblock) ||
 		    got.br_state != XFS_EXT_NORM)
 			goto next;
+		if (xfs_reflink_shared_cache_lookup(ip, got.br_startblock,
+				got.br_blockcount, &shared) && !shared)
+			goto next;
 		agno = XFS_FSB_TO_AGNO(mp, got.br_startblock);
 		agbno = XFS_FSB_TO_AGBNO(mp, got.br_startblock);
 		aglen = got.br_blockcount;
 
-		error = xfs_reflink_find_shared(mp, tp, agno, agbno, aglen,
-				&rbno, &rlen, false);
+		if (agno != cur_agno) {
+			if (cur) {
+				xfs_btree_del_cursor(cur, XFS_BTREE_NOERROR);
+				xfs_trans_brelse(tp, agbp);
+				cur = NULL;
+			}
+			cur_agno = NULLAGNUMBER;
+			gen = xfs_reflink_refcount_gen(mp, agno);
+			error = xfs_alloc_read_agf(mp, tp, agno, 0, &agbp);
+			if (error)
+				return error;
+			if (!agbp)
+				return -ENOMEM;
+			cur = xfs_refcountbt_init_cursor(mp, tp, agbp, agno,
+					NULL);
+			cur_agno = agno;
+		}
+
+		error = xfs_refcount_find_shared(cur, agbno, aglen, &rbno,
+				&rlen, false);
 		if (error)
-			return error;
+			break;
 		/* Is there still a shared block here? */
 		if (rbno != NULLAGBLOCK) {
+			xfs_reflink_shared_cache_set(ip,
+					XFS_AGB_TO_FSB(mp, agno, rbno), rlen,
+					true, gen);
 			*has_shared = true;
-			return 0;
+			break;
 		}
 next:
 		found = xfs_iext_get_extent(ifp, ++idx, &got);
 	}
 
-	return 0;
+	if (cur) {
+		xfs_btree_del_cursor(cur, error ? XFS_BTREE_ERROR :
+						  XFS_BTREE_NOERROR);
+		xfs_trans_brelse(tp, agbp);
+	}
+	return error;
 }
 
 /* Clear the inode reflink flag if there are no shared extents. */
@@ -1581,3 +2108,470 @@ xfs_reflink_unshare(
 	trace_xfs_reflink_unshare_error(ip, error, _RET_IP_);
 	return error;
 }
+
+/*
+ * Online defragmentation.
+ *
+ * Fragmented ranges of a file are rewritten through the CoW fork: we
+ * allocate one contiguous extent in the CoW fork covering a run of small
+ * data fork extents, dirty the page cache over the run and let writeback
+ * move the data.  I/O completion remaps the new blocks into the data fork
+ * and frees the old ones exactly as it does for any other CoW write, so
+ * readers and writers can keep using the file while this goes on.  Writes
+ * that land in the range while it is being moved go straight to the new
+ * blocks.
+ *
+ * The IOLOCK is held only while we set up each chunk, and we sleep for as
+ * long as each chunk took to move unless asked not to, which keeps the
+ * defragmenter from hogging the disk.
+ */
+#define XFS_DEFRAG_CHUNK_BYTES	(16 << 20)
+
+/*
+ * Find the next run of at least two discontiguous written extents between
+ * fbno and end.  Extents that are at least maxlen long are left alone, and
+ * a run is never longer than maxlen.  Sets *lenp to zero if there's
+ * nothing to do.
+ */
+STATIC int
+xfs_reflink_defrag_find_run(
+	struct xfs_inode	*ip,
+	xfs_fileoff_t		fbno,
+	xfs_fileoff_t		end,
+	xfs_filblks_t		maxlen,
+	xfs_fileoff_t		*startp,
+	xfs_filblks_t		*lenp)
+{
+	struct xfs_bmbt_irec	map;
+	xfs_fsblock_t		next_block = NULLFSBLOCK;
+	xfs_fileoff_t		start = NULLFILEOFF;
+	xfs_filblks_t		len = 0;
+	int			nr = 0;
+	int			nmaps;
+	int			error;
+
+	while (fbno < end) {
+		nmaps = 1;
+		error = xfs_bmapi_read(ip, fbno, end - fbno, &map, &nmaps, 0);
+		if (error)
+			return error;
+		if (nmaps == 0)
+			break;
+		fbno = map.br_startoff + map.br_blockcount;
+
+		/* Holes, delalloc, unwritten and big extents end a run. */
+		if (!xfs_bmap_is_real_extent(&map) ||
+		    map.br_blockcount >= maxlen) {
+			if (nr > 1)
+				break;
+			nr = 0;
+			len = 0;
+			continue;
+		}
+
+		if (len == 0)
+			start = map.br_startoff;
+		if (map.br_startblock != next_block)
+			nr++;
+		next_block = map.br_startblock + map.br_blockcount;
+		len += map.br_blockcount;
+		if (len >= maxlen) {
+			len = maxlen;
+			break;
+		}
+	}
+
+	*startp = start;
+	*lenp = nr > 1 ? len : 0;
+	return 0;
+}
+
+/*
+ * Allocate unwritten blocks in the CoW fork for [start, start + len) near
+ * target, or wherever the allocator likes if target is NULLFSBLOCK, and
+ * return the new mapping in imap.  imap->br_blockcount is zero if we
+ * couldn't allocate anything or part of the range is already staged in the
+ * CoW fork, which means somebody else is writing there.
+ */
+STATIC int
+xfs_reflink_stage_cow(
+	struct xfs_inode	*ip,
+	xfs_fileoff_t		start,
+	xfs_filblks_t		len,
+	xfs_fsblock_t		target,
+	struct xfs_bmbt_irec	*imap)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_bmbt_irec	got;
+	struct xfs_defer_ops	dfops;
+	struct xfs_trans	*tp;
+	xfs_fsblock_t		first_block;
+	xfs_extlen_t		resblks;
+	xfs_extnum_t		idx;
+	int			nimaps;
+	int			error;
+
+	imap->br_blockcount = 0;
+
+	resblks = XFS_DIOSTRAT_SPACE_RES(mp, len);
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write, resblks, 0, 0, &tp);
+	if (error)
+		return error;
+
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	error = xfs_qm_dqattach_locked(ip, 0);
+	if (error)
+		goto out_cancel;
+
+	if (xfs_iext_lookup_extent(ip, ip->i_cowfp, start, &idx, &got) &&
+	    got.br_startoff < start + len)
+		goto out_cancel;
+
+	error = xfs_trans_reserve_quota_nblks(tp, ip, resblks, 0,
+			XFS_QMOPT_RES_REGBLKS);
+	if (error)
+		goto out_cancel;
+
+	xfs_trans_ijoin(tp, ip, 0);
+
+	/*
+	 * A non-null firstblock restricts the allocation to that AG and
+	 * makes the allocator start looking at that block.
+	 */
+	xfs_defer_init(&dfops, &first_block);
+	first_block = target;
+	nimaps = 1;
+
+	/* Allocate the whole range as unwritten blocks. */
+	error = xfs_bmapi_write(tp, ip, start, len,
+			XFS_BMAPI_COWFORK | XFS_BMAPI_PREALLOC, &first_block,
+			resblks, imap, &nimaps, &dfops);
+	if (error)
+		goto out_bmap_cancel;
+
+	error = xfs_defer_finish(&tp, &dfops, NULL);
+	if (error)
+		goto out_bmap_cancel;
+
+	error = xfs_trans_commit(tp);
+	if (nimaps == 0)
+		imap->br_blockcount = 0;
+	ASSERT(imap->br_blockcount == 0 || imap->br_startoff == start);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return error;
+
+out_bmap_cancel:
+	xfs_defer_cancel(&dfops);
+	xfs_trans_unreserve_quota_nblks(tp, ip, (long)resblks, 0,
+			XFS_QMOPT_RES_REGBLKS);
+out_cancel:
+	xfs_trans_cancel(tp);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	imap->br_blockcount = 0;
+	return error;
+}
+
+/*
+ * Allocate a CoW fork extent to move the run at start to.  If we can't get
+ * a single extent for the whole run, shorten the run to what we did get;
+ * if that wouldn't reduce the number of extents, give the blocks back and
+ * set *lenp to zero.  Caller holds the IOLOCK.
+ */
+STATIC int
+xfs_reflink_defrag_alloc(
+	struct xfs_inode	*ip,
+	xfs_fileoff_t		start,
+	xfs_filblks_t		*lenp)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_bmbt_irec	imap;
+	xfs_fileoff_t		rstart;
+	xfs_filblks_t		rlen;
+	uint			lockmode;
+	int			error;
+
+	error = xfs_reflink_stage_cow(ip, start, *lenp, NULLFSBLOCK, &imap);
+	if (error)
+		return error;
+	if (imap.br_blockcount == 0) {
+		*lenp = 0;
+		return 0;
+	}
+	if (imap.br_blockcount >= *lenp)
+		return 0;
+
+	/* Short allocation; is it still worth moving the shorter run? */
+	lockmode = xfs_ilock_data_map_shared(ip);
+	error = xfs_reflink_defrag_find_run(ip, start,
+			start + imap.br_blockcount, imap.br_blockcount,
+			&rstart, &rlen);
+	xfs_iunlock(ip, lockmode);
+	if (error)
+		return error;
+	if (rstart == start && rlen == imap.br_blockcount) {
+		*lenp = rlen;
+		return 0;
+	}
+
+	*lenp = 0;
+	return xfs_reflink_cancel_cow_range(ip, XFS_FSB_TO_B(mp, start),
+			XFS_FSB_TO_B(mp, imap.br_blockcount), true);
+}
+
+/*
+ * Clear the reflink flag that we set so that writeback would look at the
+ * CoW fork, unless the file picked up shared extents in the meantime.
+ */
+STATIC int
+xfs_reflink_drop_temp_flag(
+	struct xfs_inode	*ip)
+{
+	int			error = 0;
+
+	xfs_ilock(ip, XFS_IOLOCK_EXCL);
+	inode_dio_wait(VFS_I(ip));
+	if (xfs_is_reflink_inode(ip))
+		error = xfs_reflink_try_clear_inode_flag(ip);
+	xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+	return error;
+}
+
+/*
+ * Defragment the byte range described by dr.  On return dr_offset and
+ * dr_length describe the part of the range we didn't get to, and dr_moved
+ * is the number of bytes we rewrote.
+ */
+int
+xfs_reflink_defrag_range(
+	struct xfs_inode	*ip,
+	struct xfs_defrag_range	*dr)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct inode		*inode = VFS_I(ip);
+	xfs_fileoff_t		fbno;
+	xfs_fileoff_t		end;
+	xfs_fileoff_t		start;
+	xfs_filblks_t		maxlen;
+	xfs_filblks_t		runlen;
+	xfs_filblks_t		len;
+	xfs_off_t		isize;
+	xfs_off_t		pos = 0;
+	xfs_off_t		count = 0;
+	unsigned long		stamp;
+	uint			lockmode;
+	bool			set_flag = false;
+	int			error = 0;
+
+	if (!xfs_sb_version_hasreflink(&mp->m_sb))
+		return -EOPNOTSUPP;
+	if (dr->dr_flags & ~XFS_DEFRAG_FLAGS)
+		return -EINVAL;
+	if (XFS_IS_REALTIME_INODE(ip) || IS_DAX(inode))
+		return -EINVAL;
+	if (dr->dr_offset >= mp->m_super->s_maxbytes)
+		return -EINVAL;
+	if (dr->dr_length > mp->m_super->s_maxbytes - dr->dr_offset)
+		dr->dr_length = mp->m_super->s_maxbytes - dr->dr_offset;
+
+	trace_xfs_reflink_defrag_range(ip, dr->dr_offset, dr->dr_length);
+
+	/* Writeback only looks at the CoW fork of reflink inodes. */
+	if (!xfs_is_reflink_inode(ip)) {
+		xfs_ilock(ip, XFS_IOLOCK_EXCL);
+		inode_dio_wait(inode);
+		if (!xfs_is_reflink_inode(ip)) {
+			error = xfs_reflink_set_inode_flag(ip, ip);
+			set_flag = true;
+		}
+		xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+		if (error)
+			goto out;
+	}
+
+	maxlen = XFS_B_TO_FSB(mp, XFS_DEFRAG_CHUNK_BYTES);
+	fbno = XFS_B_TO_FSBT(mp, dr->dr_offset);
+	end = XFS_B_TO_FSB(mp, dr->dr_offset + dr->dr_length);
+	dr->dr_moved = 0;
+
+	while (fbno < end) {
+		if (fatal_signal_pending(current))
+			break;
+
+		stamp = jiffies;
+		xfs_ilock(ip, XFS_IOLOCK_EXCL);
+		isize = i_size_read(inode);
+		lockmode = xfs_ilock_data_map_shared(ip);
+		error = xfs_reflink_defrag_find_run(ip, fbno,
+				min_t(xfs_fileoff_t, end,
+				      XFS_B_TO_FSB(mp, isize)),
+				maxlen, &start, &runlen);
+		xfs_iunlock(ip, lockmode);
+		if (error || runlen == 0) {
+			xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+			if (!error)
+				fbno = end;
+			break;
+		}
+
+		/* Stage the new extent and dirty the pages over it. */
+		inode_dio_wait(inode);
+		len = runlen;
+		error = xfs_reflink_defrag_alloc(ip, start, &len);
+		if (!error && len) {
+			pos = XFS_FSB_TO_B(mp, start);
+			count = min_t(xfs_off_t, XFS_FSB_TO_B(mp, len),
+					isize - pos);
+			error = iomap_file_dirty(inode, pos, count,
+					&xfs_iomap_ops);
+		}
+		xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+		if (error)
+			break;
+
+		/* Writeback completion moves the new blocks into place. */
+		if (len) {
+			error = filemap_write_and_wait_range(inode->i_mapping,
+					pos, pos + count - 1);
+			if (error)
+				break;
+			dr->dr_moved += count;
+		}
+		fbno = start + (len ? len : runlen);
+
+		if (!(dr->dr_flags & XFS_DEFRAG_NOTHROTTLE))
+			schedule_timeout_killable(jiffies - stamp);
+		cond_resched();
+	}
+
+	/* Report what's left so that userspace can pick up from there. */
+	if (!error) {
+		pos = min_t(xfs_off_t, XFS_FSB_TO_B(mp, fbno),
+				dr->dr_offset + dr->dr_length);
+		pos = max_t(xfs_off_t, pos, dr->dr_offset);
+		dr->dr_length -= pos - dr->dr_offset;
+		dr->dr_offset = pos;
+	}
+
+	/* Turn the reflink flag back off if we were the ones to set it. */
+	if (set_flag) {
+		int		error2;
+
+		error2 = xfs_reflink_drop_temp_flag(ip);
+		if (!error)
+			error = error2;
+	}
+	if (!error)
+		return 0;
+out:
+	trace_xfs_reflink_defrag_range_error(ip, error, _RET_IP_);
+	return error;
+}
+
+/*
+ * Move the written data fork extent irec of ip to new blocks allocated near
+ * target, which must be in a different AG.  Shared extents are left alone
+ * because moving them wouldn't free anything, and so is the extent if the
+ * file no longer maps it where the caller saw it.  *moved is set to the
+ * number of blocks moved.
+ */
+int
+xfs_reflink_relocate_extent(
+	struct xfs_inode	*ip,
+	struct xfs_bmbt_irec	*irec,
+	xfs_fsblock_t		target,
+	xfs_filblks_t		*moved)
+{
+	struct xfs_mount	*mp = ip->i_mount;
+	struct inode		*inode = VFS_I(ip);
+	struct xfs_bmbt_irec	map;
+	struct xfs_bmbt_irec	imap;
+	xfs_agnumber_t		agno;
+	xfs_agblock_t		rbno;
+	xfs_extlen_t		rlen;
+	xfs_off_t		isize;
+	xfs_off_t		pos;
+	xfs_off_t		count;
+	uint			lockmode;
+	bool			set_flag = false;
+	int			nmaps;
+	int			error = 0;
+
+	*moved = 0;
+	if (!xfs_sb_version_hasreflink(&mp->m_sb))
+		return -EOPNOTSUPP;
+	if (!S_ISREG(inode->i_mode) || XFS_IS_REALTIME_INODE(ip) ||
+	    IS_DAX(inode))
+		return 0;
+
+	agno = XFS_FSB_TO_AGNO(mp, irec->br_startblock);
+	ASSERT(XFS_FSB_TO_AGNO(mp, target) != agno);
+
+	xfs_ilock(ip, XFS_IOLOCK_EXCL);
+	inode_dio_wait(inode);
+	if (!xfs_is_reflink_inode(ip)) {
+		error = xfs_reflink_set_inode_flag(ip, ip);
+		if (error)
+			goto out_unlock;
+		set_flag = true;
+	}
+
+	/* Is the extent still there, and is it ours alone? */
+	isize = i_size_read(inode);
+	lockmode = xfs_ilock_data_map_shared(ip);
+	nmaps = 1;
+	error = xfs_bmapi_read(ip, irec->br_startoff, irec->br_blockcount,
+			&map, &nmaps, 0);
+	if (error)
+		goto out_ilock;
+	if (nmaps != 1 || !xfs_bmap_is_real_extent(&map) ||
+	    map.br_startblock != irec->br_startblock ||
+	    XFS_FSB_TO_B(mp, map.br_startoff) >= isize)
+		goto out_ilock;
+	error = xfs_reflink_find_shared(mp, NULL, agno,
+			XFS_FSB_TO_AGBNO(mp, map.br_startblock),
+			map.br_blockcount, &rbno, &rlen, false);
+	if (error || rbno != NULLAGBLOCK)
+		goto out_ilock;
+	xfs_iunlock(ip, lockmode);
+
+	/* Writeback won't touch blocks past EOF, so don't stage them. */
+	map.br_blockcount = min_t(xfs_filblks_t, map.br_blockcount,
+			XFS_B_TO_FSB(mp, isize) - map.br_startoff);
+
+	error = xfs_reflink_stage_cow(ip, map.br_startoff, map.br_blockcount,
+			target, &imap);
+	if (error || imap.br_blockcount == 0)
+		goto out_unlock;
+
+	pos = XFS_FSB_TO_B(mp, imap.br_startoff);
+	if (XFS_FSB_TO_AGNO(mp, imap.br_startblock) == agno) {
+		error = xfs_reflink_cancel_cow_range(ip, pos,
+				XFS_FSB_TO_B(mp, imap.br_blockcount), true);
+		goto out_unlock;
+	}
+
+	count = min_t(xfs_off_t, XFS_FSB_TO_B(mp, imap.br_blockcount),
+			isize - pos);
+	error = iomap_file_dirty(inode, pos, count, &xfs_iomap_ops);
+	xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+	if (!error)
+		error = filemap_write_and_wait_range(inode->i_mapping, pos,
+				pos + count - 1);
+	if (!error)
+		*moved = imap.br_blockcount;
+	goto out_flag;
+
+out_ilock:
+	xfs_iunlock(ip, lockmode);
+out_unlock:
+	xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+out_flag:
+	if (set_flag) {
+		int		error2;
+
+		error2 = xfs_reflink_drop_temp_flag(ip);
+		if (!error)
+			error = error2;
+	}
+	return error;
+}
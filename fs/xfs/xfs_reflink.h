@@ -25,6 +25,7 @@ extern int xfs_reflink_find_shared(struct xfs_mount *mp, struct xfs_trans *tp,
 		xfs_agblock_t *fbno, xfs_extlen_t *flen, bool find_maximal);
 extern int xfs_reflink_trim_around_shared(struct xfs_inode *ip,
 		struct xfs_bmbt_irec *irec, bool *shared, bool *trimmed);
+extern void xfs_reflink_shared_cache_free(struct xfs_inode *ip);
 
 extern int xfs_reflink_reserve_cow(struct xfs_inode *ip,
 		struct xfs_bmbt_irec *imap, bool *shared);
@@ -53,5 +54,10 @@ extern int xfs_reflink_clear_inode_flag(struct xfs_inode *ip,
 		struct xfs_trans **tpp);
 extern int xfs_reflink_unshare(struct xfs_inode *ip, xfs_off_t offset,
 		xfs_off_t len);
+extern int xfs_reflink_defrag_range(struct xfs_inode *ip,
+		struct xfs_defrag_range *dr);
+extern int xfs_reflink_relocate_extent(struct xfs_inode *ip,
+		struct xfs_bmbt_irec *irec, xfs_fsblock_t target,
+		xfs_filblks_t *moved);
 
 #endif /* __XFS_REFLINK_H */
@@ -0,0 +1,358 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_inode.h"
+#include "xfs_da_format.h"
+#include "xfs_da_btree.h"
+#include "xfs_dir2.h"
+#include "xfs_dir2_priv.h"
+#include "xfs_rmtree.h"
+#include <linux/namei.h>
+
+/*
+ * Recursive removal of a directory tree.
+ *
+ * Removing a large tree from userspace costs a getdents, a path lookup and
+ * an unlink or rmdir syscall per name, and the unlinks are issued in
+ * directory hash order, so the inodes being freed are read in random order.
+ * Here the tree is walked depth first in the kernel.  For each directory a
+ * batch of names is read, sorted into inode number order and readahead is
+ * issued for their inode clusters, then all of the batch is removed under a
+ * single hold of the directory lock.  Subdirectories found in a batch are
+ * pushed onto an explicit stack, so arbitrarily deep trees don't use up the
+ * kernel stack, and are removed once they have been emptied.
+ *
+ * Names are removed through the VFS so that the dcache, permission checks,
+ * security hooks and fsnotify all see ordinary unlinks.  The final iput of
+ * each inode is deferred until the directory lock has been dropped, and
+ * unlinked inodes are inactivated by the background inactivation workers,
+ * so the walk itself never waits for the space to be freed.
+ */
+
+struct xfs_rmtree_ent {
+	xfs_ino_t		ino;
+	struct inode		*inode;		/* iput after unlocking */
+	unsigned int		nameoff;
+	unsigned int		namelen;
+};
+
+struct xfs_rmtree_batch {
+	struct dir_context	ctx;
+	struct xfs_rmtree_ent	*ents;
+	char			*names;
+	unsigned int		nameused;
+	int			nr;
+};
+
+/*
+ * A directory on the walk stack, with the cookie to read it from.  The parent
+ * stays on the stack below us until we are gone, so its reference pins the
+ * parent dentry for us.
+ */
+struct xfs_rmtree_dir {
+	struct list_head	list;
+	struct dentry		*dentry;
+	struct dentry		*parent;
+	loff_t			pos;
+};
+
+static int
+xfs_rmtree_fill(
+	struct dir_context	*ctx,
+	const char		*name,
+	int			namelen,
+	loff_t			offset,
+	u64			ino,
+	unsigned int		d_type)
+{
+	struct xfs_rmtree_batch	*batch;
+	struct xfs_rmtree_ent	*ent;
+
+	batch = container_of(ctx, struct xfs_rmtree_batch, ctx);
+	if (name[0] == '.' &&
+	    (namelen == 1 || (namelen == 2 && name[1] == '.')))
+		return 0;
+	if (batch->nr == XFS_RMTREE_BATCH)
+		return -ENOSPC;
+
+	ent = &batch->ents[batch->nr++];
+	ent->ino = ino;
+	ent->inode = NULL;
+	ent->nameoff = batch->nameused;
+	ent->namelen = namelen;
+	memcpy(batch->names + batch->nameused, name, namelen);
+	batch->nameused += namelen;
+	return 0;
+}
+
+static int
+xfs_rmtree_cmp(
+	const void		*a,
+	const void		*b)
+{
+	const struct xfs_rmtree_ent *ea = a;
+	const struct xfs_rmtree_ent *eb = b;
+
+	if (ea->ino < eb->ino)
+		return -1;
+	return ea->ino > eb->ino;
+}
+
+/*
+ * Read the next batch of names from a directory, sort them into inode order
+ * and start reading their inode clusters.
+ */
+STATIC int
+xfs_rmtree_read(
+	struct xfs_rmtree_dir	*rd,
+	struct xfs_rmtree_batch	*batch)
+{
+	struct inode		*dir = d_inode(rd->dentry);
+	struct xfs_inode	*dp = XFS_I(dir);
+	struct xfs_buf_ra_batch	rab;
+	xfs_daddr_t		last_blkno = 0;
+	size_t			bufsize;
+	int			i;
+	int			error;
+
+	error = inode_permission(dir, MAY_READ);
+	if (error)
+		return error;
+
+	batch->ctx.pos = rd->pos;
+	batch->nameused = 0;
+	batch->nr = 0;
+
+	inode_lock_shared(dir);
+	if (IS_DEADDIR(dir)) {
+		error = -ENOENT;
+	} else {
+		bufsize = (size_t)min_t(loff_t, 32768, dp->i_d.di_size);
+		error = xfs_readdir(NULL, dp, &batch->ctx, bufsize, NULL);
+	}
+	inode_unlock_shared(dir);
+	if (error)
+		return error;
+	rd->pos = batch->ctx.pos;
+
+	sort(batch->ents, batch->nr, sizeof(*batch->ents), xfs_rmtree_cmp,
+	     NULL);
+	xfs_buf_ra_batch_start(&rab);
+	for (i = 0; i < batch->nr; i++)
+		xfs_dir2_inode_readahead(dp->i_mount, batch->ents[i].ino,
+					 &last_blkno, &rab);
+	xfs_buf_ra_batch_finish(&rab);
+	return 0;
+}
+
+STATIC int
+xfs_rmtree_push(
+	struct list_head	*stack,
+	struct dentry		*dentry,
+	struct dentry		*parent)
+{
+	struct xfs_rmtree_dir	*rd;
+
+	rd = kmem_alloc(sizeof(*rd), KM_SLEEP | KM_MAYFAIL);
+	if (!rd)
+		return -ENOMEM;
+	rd->dentry = dentry;
+	rd->parent = parent;
+	rd->pos = 0;
+	list_add(&rd->list, stack);
+	return 0;
+}
+
+STATIC void
+xfs_rmtree_pop(
+	struct xfs_rmtree_dir	*rd)
+{
+	list_del(&rd->list);
+	dput(rd->dentry);
+	kmem_free(rd);
+}
+
+/*
+ * Remove a batch of names from a directory.  Directories are not removed
+ * but pushed onto the stack to be emptied first.
+ */
+STATIC int
+xfs_rmtree_remove_batch(
+	struct list_head	*stack,
+	struct xfs_rmtree_dir	*rd,
+	struct xfs_rmtree_batch	*batch,
+	__u64			*removed)
+{
+	struct inode		*dir = d_inode(rd->dentry);
+	struct xfs_rmtree_ent	*ent;
+	struct dentry		*dentry;
+	int			i;
+	int			error = 0;
+
+	inode_lock_nested(dir, I_MUTEX_PARENT);
+	for (i = 0; i < batch->nr; i++) {
+		ent = &batch->ents[i];
+		dentry = lookup_one_len(batch->names + ent->nameoff,
+				rd->dentry, ent->namelen);
+		if (IS_ERR(dentry)) {
+			error = PTR_ERR(dentry);
+			break;
+		}
+		if (d_is_negative(dentry)) {
+			/* Raced with someone else removing it. */
+			dput(dentry);
+			continue;
+		}
+		if (d_is_dir(dentry)) {
+			if (d_mountpoint(dentry)) {
+				dput(dentry);
+				error = -EBUSY;
+				break;
+			}
+			error = xfs_rmtree_push(stack, dentry, rd->dentry);
+			if (error) {
+				dput(dentry);
+				break;
+			}
+			continue;
+		}
+
+		ent->inode = d_inode(dentry);
+		ihold(ent->inode);
+		error = vfs_unlink(dir, dentry, NULL);
+		dput(dentry);
+		if (error)
+			break;
+		(*removed)++;
+	}
+	inode_unlock(dir);
+
+	for (i = 0; i < batch->nr; i++) {
+		if (batch->ents[i].inode)
+			iput(batch->ents[i].inode);
+	}
+	return error;
+}
+
+/* Remove an emptied directory from its parent. */
+STATIC int
+xfs_rmtree_rmdir(
+	struct xfs_rmtree_dir	*rd,
+	__u64			*removed)
+{
+	struct dentry		*parent = rd->parent;
+	struct inode		*dir = d_inode(parent);
+	struct dentry		*dentry = rd->dentry;
+	struct inode		*inode = d_inode(dentry);
+	int			error = 0;
+
+	ihold(inode);
+	inode_lock_nested(dir, I_MUTEX_PARENT);
+	/* Leave it alone if it was renamed out of the tree meanwhile. */
+	if (dentry->d_parent == parent && !d_unhashed(dentry)) {
+		error = vfs_rmdir(dir, dentry);
+		if (!error)
+			(*removed)++;
+	}
+	inode_unlock(dir);
+	iput(inode);
+	return error;
+}
+
+/*
+ * Remove everything below the directory root, leaving root itself empty.
+ * The number of names removed is added to *removed even on failure.
+ */
+int
+xfs_rmtree(
+	struct dentry		*root,
+	__u64			*removed)
+{
+	struct xfs_rmtree_batch	batch = {
+		.ctx.actor	= xfs_rmtree_fill,
+	};
+	struct xfs_rmtree_dir	*rd;
+	loff_t			start;
+	int			error;
+	LIST_HEAD(stack);
+
+	batch.ents = kmem_alloc_large(XFS_RMTREE_BATCH * sizeof(*batch.ents),
+			KM_SLEEP | KM_MAYFAIL);
+	batch.names = kmem_alloc_large(XFS_RMTREE_BATCH * MAXNAMELEN,
+			KM_SLEEP | KM_MAYFAIL);
+	if (!batch.ents || !batch.names) {
+		error = -ENOMEM;
+		goto out_free;
+	}
+
+	error = xfs_rmtree_push(&stack, dget(root), NULL);
+	if (error) {
+		dput(root);
+		goto out_free;
+	}
+
+	while (!list_empty(&stack)) {
+		if (fatal_signal_pending(current)) {
+			error = -EINTR;
+			break;
+		}
+
+		rd = list_first_entry(&stack, struct xfs_rmtree_dir, list);
+		start = rd->pos;
+		error = xfs_rmtree_read(rd, &batch);
+		if (error)
+			break;
+
+		if (batch.nr > 0) {
+			error = xfs_rmtree_remove_batch(&stack, rd, &batch,
+					removed);
+			if (error)
+				break;
+			cond_resched();
+			continue;
+		}
+
+		/*
+		 * Names may have been added behind the cookie while we were
+		 * working, so the directory is only empty once a pass from
+		 * the start finds nothing.
+		 */
+		if (start != 0) {
+			rd->pos = 0;
+			continue;
+		}
+
+		if (rd->parent) {
+			error = xfs_rmtree_rmdir(rd, removed);
+			if (error)
+				break;
+		}
+		xfs_rmtree_pop(rd);
+	}
+
+	while (!list_empty(&stack))
+		xfs_rmtree_pop(list_first_entry(&stack, struct xfs_rmtree_dir,
+				list));
+out_free:
+	kmem_free(batch.names);
+	kmem_free(batch.ents);
+	return error;
+}
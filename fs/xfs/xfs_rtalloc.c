@@ -36,6 +36,7 @@
 #include "xfs_buf.h"
 #include "xfs_icache.h"
 #include "xfs_rtalloc.h"
+#include "xfs_rtzone.h"
 
 
 /*
@@ -76,6 +77,20 @@ xfs_rtany_summary(
 	int		log;		/* loop counter, log2 of ext. size */
 	xfs_suminfo_t	sum;		/* summary data */
 
+	/*
+	 * Answer from the in-core index if we have one.
+	 */
+	if (mp->m_rsum_index) {
+		for (log = low; log <= high; log++) {
+			if (test_bit(bbno, xfs_rtsum_index_level(mp, log))) {
+				*stat = 1;
+				return 0;
+			}
+		}
+		*stat = 0;
+		return 0;
+	}
+
 	/*
 	 * Loop over logs of extent sizes.  Order is irrelevant.
 	 */
@@ -102,6 +117,40 @@ xfs_rtany_summary(
 	return 0;
 }
 
+/*
+ * Find the first bitmap block at or after bbno that has free extents of
+ * size class log starting in it.  Returns sb_rbmblocks in *next if there
+ * are none.
+ */
+STATIC int				/* error */
+xfs_rtfind_summary(
+	xfs_mount_t	*mp,		/* file system mount structure */
+	xfs_trans_t	*tp,		/* transaction pointer */
+	int		log,		/* log2 of extent size */
+	xfs_rtblock_t	bbno,		/* first bitmap block to look at */
+	xfs_buf_t	**rbpp,		/* in/out: summary block buffer */
+	xfs_fsblock_t	*rsb,		/* in/out: summary block number */
+	xfs_rtblock_t	*next)		/* out: bitmap block found */
+{
+	int		error;		/* error value */
+	xfs_suminfo_t	sum;		/* summary data */
+
+	if (mp->m_rsum_index) {
+		*next = find_next_bit(xfs_rtsum_index_level(mp, log),
+				mp->m_sb.sb_rbmblocks, bbno);
+		return 0;
+	}
+
+	for (; bbno < mp->m_sb.sb_rbmblocks; bbno++) {
+		error = xfs_rtget_summary(mp, tp, log, bbno, rbpp, rsb, &sum);
+		if (error)
+			return error;
+		if (sum)
+			break;
+	}
+	*next = bbno;
+	return 0;
+}
 
 /*
  * Copy and transform the summary file, given the old and new
@@ -148,7 +197,7 @@ xfs_rtcopy_summary(
  * Mark an extent specified by start and len allocated.
  * Updates all the summary information as well as the bitmap.
  */
-STATIC int				/* error */
+int					/* error */
 xfs_rtallocate_range(
 	xfs_mount_t	*mp,		/* file system mount point */
 	xfs_trans_t	*tp,		/* transaction pointer */
@@ -162,6 +211,13 @@ xfs_rtallocate_range(
 	xfs_rtblock_t	postblock = 0;	/* first block allocated > end */
 	xfs_rtblock_t	preblock = 0;	/* first block allocated < start */
 
+	/*
+	 * Without a transaction the caller only wants to find an extent,
+	 * see xfs_rtfind_extent.
+	 */
+	if (!tp)
+		return 0;
+
 	end = start + len - 1;
 	/*
 	 * Assume we're allocating out of the middle of a free extent.
@@ -626,12 +682,12 @@ xfs_rtallocate_extent_size(
 	xfs_extlen_t	prod,		/* extent product factor */
 	xfs_rtblock_t	*rtblock)	/* out: start block allocated */
 {
+	xfs_rtblock_t	bbno;		/* bitmap block with extents */
 	int		error;		/* error value */
 	int		i;		/* bitmap block number */
 	int		l;		/* level number (loop control) */
 	xfs_rtblock_t	n;		/* next block to be tried */
 	xfs_rtblock_t	r;		/* result block number */
-	xfs_suminfo_t	sum;		/* summary information for extents */
 
 	ASSERT(minlen % prod == 0 && maxlen % prod == 0);
 	ASSERT(maxlen != 0);
@@ -645,22 +701,17 @@ xfs_rtallocate_extent_size(
 	 */
 	for (l = xfs_highbit32(maxlen); l < mp->m_rsumlevels; l++) {
 		/*
-		 * Loop over all the bitmap blocks.
+		 * Loop over the bitmap blocks that have extents at this level.
 		 */
 		for (i = 0; i < mp->m_sb.sb_rbmblocks; i++) {
-			/*
-			 * Get the summary for this level/block.
-			 */
-			error = xfs_rtget_summary(mp, tp, l, i, rbpp, rsb,
-				&sum);
+			error = xfs_rtfind_summary(mp, tp, l, i, rbpp, rsb,
+				&bbno);
 			if (error) {
 				return error;
 			}
-			/*
-			 * Nothing there, on to the next block.
-			 */
-			if (!sum)
-				continue;
+			if (bbno >= mp->m_sb.sb_rbmblocks)
+				break;
+			i = bbno;
 			/*
 			 * Try allocating the extent.
 			 */
@@ -703,23 +754,18 @@ xfs_rtallocate_extent_size(
 	 */
 	for (l = xfs_highbit32(maxlen); l >= xfs_highbit32(minlen); l--) {
 		/*
-		 * Loop over all the bitmap blocks, try an allocation
-		 * starting in that block.
+		 * Loop over the bitmap blocks that have extents at this
+		 * level, try an allocation starting in each of them.
 		 */
 		for (i = 0; i < mp->m_sb.sb_rbmblocks; i++) {
-			/*
-			 * Get the summary information for this level/block.
-			 */
-			error =	xfs_rtget_summary(mp, tp, l, i, rbpp, rsb,
-						  &sum);
+			error = xfs_rtfind_summary(mp, tp, l, i, rbpp, rsb,
+				&bbno);
 			if (error) {
 				return error;
 			}
-			/*
-			 * If nothing there, go on to next.
-			 */
-			if (!sum)
-				continue;
+			if (bbno >= mp->m_sb.sb_rbmblocks)
+				break;
+			i = bbno;
 			/*
 			 * Try the allocation.  Make sure the specified
 			 * minlen/maxlen are in the possible range for
@@ -755,6 +801,70 @@ xfs_rtallocate_extent_size(
 	return 0;
 }
 
+/*
+ * Build the in-core summary index from the summary file.  The caller must
+ * hold the bitmap inode's ILOCK exclusively.  The index only speeds up
+ * allocation, so if we can't get the memory for it we go without.
+ */
+STATIC int
+xfs_rtsum_index_init(
+	struct xfs_mount	*mp)
+{
+	unsigned long		*index;
+	unsigned int		longs;
+	struct xfs_buf		*bp = NULL;
+	xfs_fsblock_t		sumbno;
+	xfs_rtblock_t		bbno;
+	xfs_suminfo_t		sum;
+	int			log;
+	int			error = 0;
+
+	ASSERT(xfs_isilocked(mp->m_rbmip, XFS_ILOCK_EXCL));
+	ASSERT(mp->m_rsum_index == NULL);
+
+	if (mp->m_sb.sb_rblocks == 0)
+		return 0;
+
+	longs = BITS_TO_LONGS(mp->m_sb.sb_rbmblocks);
+	index = kmem_zalloc_large((size_t)mp->m_rsumlevels * longs *
+			sizeof(unsigned long), KM_MAYFAIL);
+	if (!index)
+		return 0;
+
+	/* Walk the summary file in on-disk order, level by level. */
+	xfs_ilock(mp->m_rsumip, XFS_ILOCK_SHARED | XFS_ILOCK_RTSUM);
+	for (log = 0; log < mp->m_rsumlevels; log++) {
+		for (bbno = 0; bbno < mp->m_sb.sb_rbmblocks; bbno++) {
+			error = xfs_rtget_summary(mp, NULL, log, bbno, &bp,
+					&sumbno, &sum);
+			if (error)
+				goto out_unlock;
+			if (sum)
+				__set_bit(bbno, index + (size_t)log * longs);
+		}
+	}
+out_unlock:
+	if (bp)
+		xfs_trans_brelse(NULL, bp);
+	xfs_iunlock(mp->m_rsumip, XFS_ILOCK_SHARED);
+	if (error) {
+		kmem_free(index);
+		return error;
+	}
+
+	mp->m_rsum_index_longs = longs;
+	mp->m_rsum_index = index;
+	return 0;
+}
+
+STATIC void
+xfs_rtsum_index_free(
+	struct xfs_mount	*mp)
+{
+	kmem_free(mp->m_rsum_index);
+	mp->m_rsum_index = NULL;
+}
+
 /*
  * Allocate space to the bitmap or summary file, and zero it, for growfs.
  */
@@ -953,6 +1063,15 @@ xfs_growfs_rt(
 	error = xfs_growfs_rt_alloc(mp, rsumblocks, nrsumblocks, mp->m_rsumip);
 	if (error)
 		return error;
+	/*
+	 * The summary index is laid out for the current geometry, so drop
+	 * it while we grow and rebuild it afterwards.  This also keeps the
+	 * fake mount below from updating it.
+	 */
+	xfs_ilock(mp->m_rbmip, XFS_ILOCK_EXCL | XFS_ILOCK_RTBITMAP);
+	xfs_rtsum_index_free(mp);
+	xfs_iunlock(mp->m_rbmip, XFS_ILOCK_EXCL);
+
 	/*
 	 * Allocate a new (fake) mount/sb.
 	 */
@@ -1078,17 +1197,29 @@ xfs_growfs_rt(
 	 */
 	kmem_free(nmp);
 
+	/*
+	 * Rebuild the summary index for the new geometry.  Allocation works
+	 * without it, so a failure here doesn't fail the grow.
+	 */
+	xfs_ilock(mp->m_rbmip, XFS_ILOCK_EXCL | XFS_ILOCK_RTBITMAP);
+	xfs_rtsum_index_init(mp);
+	if (mp->m_rtzones && xfs_rtzone_init(mp))
+		xfs_warn(mp,
+	"failed to rebuild the rt zone table, not using zoned allocation.");
+	xfs_iunlock(mp->m_rbmip, XFS_ILOCK_EXCL);
+
 	return error;
 }
 
 /*
- * Allocate an extent in the realtime subvolume, with the usual allocation
- * parameters.  The length units are all in realtime extents, as is the
- * result block number.
+ * Find an extent in the realtime subvolume with the usual allocation
+ * parameters, and allocate it if we have a transaction.  The length units are
+ * all in realtime extents, as is the result block number.
  */
-int					/* error */
-xfs_rtallocate_extent(
-	xfs_trans_t	*tp,		/* transaction pointer */
+STATIC int				/* error */
+xfs_rtallocate_extent_int(
+	xfs_mount_t	*mp,		/* file system mount point */
+	xfs_trans_t	*tp,		/* transaction pointer, or NULL */
 	xfs_rtblock_t	bno,		/* starting block number to allocate */
 	xfs_extlen_t	minlen,		/* minimum length to allocate */
 	xfs_extlen_t	maxlen,		/* maximum length to allocate */
@@ -1097,13 +1228,11 @@ xfs_rtallocate_extent(
 	xfs_extlen_t	prod,		/* extent product factor */
 	xfs_rtblock_t	*rtblock)	/* out: start block allocated */
 {
-	xfs_mount_t	*mp = tp->t_mountp;
 	int		error;		/* error value */
 	xfs_rtblock_t	r;		/* result allocated block */
 	xfs_fsblock_t	sb;		/* summary file block number */
 	xfs_buf_t	*sumbp;		/* summary file block buffer */
 
-	ASSERT(xfs_isilocked(mp->m_rbmip, XFS_ILOCK_EXCL));
 	ASSERT(minlen > 0 && minlen <= maxlen);
 
 	/*
@@ -1124,7 +1253,11 @@ xfs_rtallocate_extent(
 
 retry:
 	sumbp = NULL;
-	if (bno == 0) {
+	if (mp->m_rtzones) {
+		ASSERT(tp != NULL);
+		error = xfs_rtzone_alloc(mp, tp, minlen, maxlen, len, &sumbp,
+				&sb, prod, &r);
+	} else if (bno == 0) {
 		error = xfs_rtallocate_extent_size(mp, tp, minlen, maxlen, len,
 				&sumbp,	&sb, prod, &r);
 	} else {
@@ -1132,6 +1265,11 @@ xfs_rtallocate_extent(
 				len, &sumbp, &sb, prod, &r);
 	}
 
+	/*
+	 * Outside a transaction nobody else will release the summary buffer.
+	 */
+	if (!tp && sumbp)
+		xfs_trans_brelse(NULL, sumbp);
 	if (error)
 		return error;
 
@@ -1142,9 +1280,9 @@ xfs_rtallocate_extent(
 		long	slen = (long)*len;
 
 		ASSERT(*len >= minlen && *len <= maxlen);
-		if (wasdel)
+		if (tp && wasdel)
 			xfs_trans_mod_sb(tp, XFS_TRANS_SB_RES_FREXTENTS, -slen);
-		else
+		else if (tp)
 			xfs_trans_mod_sb(tp, XFS_TRANS_SB_FREXTENTS, -slen);
 	} else if (prod > 1) {
 		prod = 1;
@@ -1155,6 +1293,51 @@ xfs_rtallocate_extent(
 	return 0;
 }
 
+/*
+ * Allocate an extent in the realtime subvolume, with the usual allocation
+ * parameters.  The length units are all in realtime extents, as is the
+ * result block number.
+ */
+int					/* error */
+xfs_rtallocate_extent(
+	xfs_trans_t	*tp,		/* transaction pointer */
+	xfs_rtblock_t	bno,		/* starting block number to allocate */
+	xfs_extlen_t	minlen,		/* minimum length to allocate */
+	xfs_extlen_t	maxlen,		/* maximum length to allocate */
+	xfs_extlen_t	*len,		/* out: actual length allocated */
+	int		wasdel,		/* was a delayed allocation extent */
+	xfs_extlen_t	prod,		/* extent product factor */
+	xfs_rtblock_t	*rtblock)	/* out: start block allocated */
+{
+	xfs_mount_t	*mp = tp->t_mountp;
+
+	ASSERT(xfs_isilocked(mp->m_rbmip, XFS_ILOCK_EXCL));
+	return xfs_rtallocate_extent_int(mp, tp, bno, minlen, maxlen, len,
+			wasdel, prod, rtblock);
+}
+
+/*
+ * Find, but don't allocate, the extent xfs_rtallocate_extent would pick.
+ * This only needs the bitmap and summary inodes locked shared, so that
+ * concurrent allocators can search the realtime bitmap in parallel.  The
+ * extent may be gone by the time the caller locks the inodes exclusively to
+ * allocate it, so it is only a hint.
+ */
+int					/* error */
+xfs_rtfind_extent(
+	xfs_mount_t	*mp,		/* file system mount point */
+	xfs_rtblock_t	bno,		/* starting block number to allocate */
+	xfs_extlen_t	minlen,		/* minimum length to allocate */
+	xfs_extlen_t	maxlen,		/* maximum length to allocate */
+	xfs_extlen_t	*len,		/* out: length found */
+	xfs_extlen_t	prod,		/* extent product factor */
+	xfs_rtblock_t	*rtblock)	/* out: start block found */
+{
+	ASSERT(xfs_isilocked(mp->m_rbmip, XFS_ILOCK_SHARED));
+	return xfs_rtallocate_extent_int(mp, NULL, bno, minlen, maxlen, len,
+			0, prod, rtblock);
+}
+
 /*
  * Initialize realtime fields in the mount structure.
  */
@@ -1181,6 +1364,16 @@ xfs_rtmount_init(
 		sbp->sb_rbmblocks;
 	mp->m_rsumsize = roundup(mp->m_rsumsize, sbp->sb_blocksize);
 	mp->m_rbmip = mp->m_rsumip = NULL;
+	/*
+	 * We always append at a zone's write pointer, but writeback doesn't
+	 * issue the writes in allocation order, so we can't use devices that
+	 * reject writes anywhere else.
+	 */
+	if (bdev_zoned_model(mp->m_rtdev_targp->bt_bdev) == BLK_ZONED_HM) {
+		xfs_warn(mp,
+	"host-managed zoned realtime devices are not supported.");
+		return -EOPNOTSUPP;
+	}
 	/*
 	 * Check that the realtime section is an ok size.
 	 */
@@ -1227,6 +1420,18 @@ xfs_rtmount_inodes(
 		return error;
 	}
 	ASSERT(mp->m_rsumip != NULL);
+
+	xfs_ilock(mp->m_rbmip, XFS_ILOCK_EXCL | XFS_ILOCK_RTBITMAP);
+	error = xfs_rtsum_index_init(mp);
+	if (!error)
+		error = xfs_rtzone_init(mp);
+	xfs_iunlock(mp->m_rbmip, XFS_ILOCK_EXCL);
+	if (error) {
+		xfs_rtsum_index_free(mp);
+		IRELE(mp->m_rsumip);
+		IRELE(mp->m_rbmip);
+		return error;
+	}
 	return 0;
 }
 
@@ -1234,6 +1439,8 @@ void
 xfs_rtunmount_inodes(
 	struct xfs_mount	*mp)
 {
+	xfs_rtzone_free(mp);
+	xfs_rtsum_index_free(mp);
 	if (mp->m_rbmip)
 		IRELE(mp->m_rbmip);
 	if (mp->m_rsumip)
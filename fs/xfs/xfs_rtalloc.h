@@ -34,6 +34,22 @@ typedef int (*xfs_rtalloc_query_range_fn)(
 	void			*priv);
 
 #ifdef CONFIG_XFS_RT
+/*
+ * The in-core summary index holds one bitmap per summary level, with a bit
+ * per rt bitmap block that is set when the summary says there are free
+ * extents of that size class starting in that bitmap block.  It lets the
+ * allocator find candidate bitmap blocks without walking the summary file.
+ * It is maintained under the bitmap inode's ILOCK, and m_rsum_index is NULL
+ * when it isn't available.
+ */
+static inline unsigned long *
+xfs_rtsum_index_level(
+	struct xfs_mount	*mp,
+	int			log)
+{
+	return mp->m_rsum_index + (size_t)log * mp->m_rsum_index_longs;
+}
+
 /*
  * Function prototypes for exported functions.
  */
@@ -54,6 +70,20 @@ xfs_rtallocate_extent(
 	xfs_extlen_t		prod,	/* extent product factor */
 	xfs_rtblock_t		*rtblock); /* out: start block allocated */
 
+/*
+ * Find the extent xfs_rtallocate_extent would allocate, without allocating
+ * it, with the bitmap and summary inodes only locked shared.
+ */
+int					/* error */
+xfs_rtfind_extent(
+	struct xfs_mount	*mp,	/* file system mount structure */
+	xfs_rtblock_t		bno,	/* starting block number to allocate */
+	xfs_extlen_t		minlen,	/* minimum length to allocate */
+	xfs_extlen_t		maxlen,	/* maximum length to allocate */
+	xfs_extlen_t		*len,	/* out: length found */
+	xfs_extlen_t		prod,	/* extent product factor */
+	xfs_rtblock_t		*rtblock); /* out: start block found */
+
 /*
  * Free an extent in the realtime subvolume.  Length is expressed in
  * realtime extents, as is the block number.
@@ -104,6 +134,13 @@ xfs_growfs_rt(
 	struct xfs_mount	*mp,	/* file system mount structure */
 	xfs_growfs_rt_t		*in);	/* user supplied growfs struct */
 
+/*
+ * Mark an extent specified by start and len allocated.
+ */
+int xfs_rtallocate_range(struct xfs_mount *mp, struct xfs_trans *tp,
+			 xfs_rtblock_t start, xfs_extlen_t len,
+			 struct xfs_buf **rbpp, xfs_fsblock_t *rsb);
+
 /*
  * From xfs_rtbitmap.c
  */
@@ -143,6 +180,7 @@ int xfs_rtalloc_extent_is_free(struct xfs_mount *mp, struct xfs_trans *tp,
 			       bool *is_free);
 #else
 # define xfs_rtallocate_extent(t,b,min,max,l,f,p,rb)    (ENOSYS)
+# define xfs_rtfind_extent(m,b,min,max,l,p,rb)          (ENOSYS)
 # define xfs_rtfree_extent(t,b,l)                       (ENOSYS)
 # define xfs_rtpick_extent(m,t,l,rb)                    (ENOSYS)
 # define xfs_growfs_rt(mp,in)                           (ENOSYS)
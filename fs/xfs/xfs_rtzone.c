@@ -0,0 +1,382 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_bit.h"
+#include "xfs_mount.h"
+#include "xfs_inode.h"
+#include "xfs_trans.h"
+#include "xfs_log.h"
+#include "xfs_error.h"
+#include "xfs_buf.h"
+#include "xfs_rtalloc.h"
+#include "xfs_rtzone.h"
+
+/*
+ * Zoned realtime devices
+ *
+ * On a zoned rt device each device zone covers a fixed range of rt extents,
+ * and we allocate from a zone strictly in ascending order at an in-core
+ * write pointer, so file data is laid down sequentially.  Space freed
+ * behind the write pointer stays free in the bitmap but isn't handed out
+ * again until everything allocated from the zone has been freed, at which
+ * point the zone's device write pointer is reset and it is reused from the
+ * start.  Everything here runs under the rt bitmap inode's ILOCK.
+ */
+
+#define XFS_RTZONE_SEQ		(1U << 0)	/* needs a reset to rewrite */
+#define XFS_RTZONE_DEAD		(1U << 1)	/* unusable */
+
+struct xfs_rtzone {
+	xfs_rtblock_t		rz_start;	/* first rt extent */
+	xfs_extlen_t		rz_len;		/* rt extents in zone */
+	xfs_extlen_t		rz_wp;		/* rt extents allocated */
+	unsigned int		rz_flags;
+};
+
+struct xfs_rtzones {
+	struct xfs_rtzone	*rzs_zones;
+	unsigned int		rzs_nr;
+	unsigned int		rzs_cur;	/* zone being appended to */
+};
+
+/* Number of zones to ask the device about at a time. */
+#define XFS_RTZONE_REPORT_NR	128
+
+static inline struct block_device *
+xfs_rtzone_bdev(
+	struct xfs_mount	*mp)
+{
+	return mp->m_rtdev_targp->bt_bdev;
+}
+
+/*
+ * Work out how far into the zone we have allocated.  That is the end of the
+ * last allocated extent in the bitmap, or the device write pointer if data
+ * was written further than that, e.g. by a file that has since been removed.
+ */
+STATIC int
+xfs_rtzone_init_wp(
+	struct xfs_mount	*mp,
+	struct xfs_rtzone	*rz,
+	struct blk_zone		*zone)
+{
+	xfs_rtblock_t		last = rz->rz_start + rz->rz_len - 1;
+	xfs_rtblock_t		next;
+	xfs_rtblock_t		b;
+	unsigned int		rtx_sectors;
+	xfs_extlen_t		dwp = 0;
+	int			stat;
+	int			error;
+
+	rtx_sectors = XFS_FSB_TO_BB(mp, mp->m_sb.sb_rextsize);
+	switch (zone->cond) {
+	case BLK_ZONE_COND_READONLY:
+	case BLK_ZONE_COND_OFFLINE:
+		rz->rz_flags |= XFS_RTZONE_DEAD;
+		rz->rz_wp = rz->rz_len;
+		return 0;
+	case BLK_ZONE_COND_NOT_WP:
+	case BLK_ZONE_COND_EMPTY:
+		break;
+	case BLK_ZONE_COND_FULL:
+		dwp = rz->rz_len;
+		break;
+	default:
+		dwp = div_u64(zone->wp - zone->start + rtx_sectors - 1,
+				rtx_sectors);
+		break;
+	}
+
+	error = xfs_rtcheck_range(mp, NULL, last, 1, 1, &next, &stat);
+	if (error)
+		return error;
+	if (!stat) {
+		rz->rz_wp = rz->rz_len;
+		return 0;
+	}
+	error = xfs_rtfind_back(mp, NULL, last, rz->rz_start, &b);
+	if (error)
+		return error;
+	rz->rz_wp = min_t(xfs_extlen_t, max_t(xfs_extlen_t, b - rz->rz_start,
+			dwp), rz->rz_len);
+	return 0;
+}
+
+/*
+ * Build the in-core zone table for a zoned rt device.  Devices that aren't
+ * zoned, or whose zones don't line up with rt extents, keep using the
+ * regular rt allocator.
+ */
+int
+xfs_rtzone_init(
+	struct xfs_mount	*mp)
+{
+	struct block_device	*bdev = xfs_rtzone_bdev(mp);
+	struct xfs_rtzones	*rzs;
+	struct blk_zone		*zones;
+	unsigned int		zone_sectors;
+	unsigned int		rtx_sectors;
+	sector_t		sector = 0;
+	xfs_extlen_t		zone_rtx;
+	unsigned int		idx = 0;
+	unsigned int		nr;
+	unsigned int		i;
+	int			error;
+
+	ASSERT(xfs_isilocked(mp->m_rbmip, XFS_ILOCK_EXCL));
+
+	xfs_rtzone_free(mp);
+	if (bdev_zoned_model(bdev) == BLK_ZONED_NONE)
+		return 0;
+
+	zone_sectors = bdev_zone_sectors(bdev);
+	rtx_sectors = XFS_FSB_TO_BB(mp, mp->m_sb.sb_rextsize);
+	if (!zone_sectors || zone_sectors % rtx_sectors) {
+		xfs_warn(mp,
+	"rt device zones are not a multiple of the rt extent size, not using zoned allocation.");
+		return 0;
+	}
+	zone_rtx = zone_sectors / rtx_sectors;
+
+	rzs = kmem_zalloc(sizeof(*rzs), KM_SLEEP);
+	rzs->rzs_nr = DIV_ROUND_UP_ULL(mp->m_sb.sb_rextents, zone_rtx);
+	rzs->rzs_zones = kmem_zalloc_large(rzs->rzs_nr *
+			sizeof(struct xfs_rtzone), KM_MAYFAIL);
+	zones = kmem_alloc(XFS_RTZONE_REPORT_NR * sizeof(struct blk_zone),
+			KM_MAYFAIL);
+	if (!rzs->rzs_zones || !zones) {
+		error = -ENOMEM;
+		goto out_free;
+	}
+
+	while (idx < rzs->rzs_nr) {
+		nr = XFS_RTZONE_REPORT_NR;
+		error = blkdev_report_zones(bdev, sector, zones, &nr,
+				GFP_KERNEL);
+		if (error)
+			goto out_free;
+		if (!nr)
+			break;
+
+		for (i = 0; i < nr && idx < rzs->rzs_nr; i++, idx++) {
+			struct xfs_rtzone	*rz = &rzs->rzs_zones[idx];
+
+			rz->rz_start = (xfs_rtblock_t)idx * zone_rtx;
+			rz->rz_len = min_t(xfs_rtblock_t, zone_rtx,
+					mp->m_sb.sb_rextents - rz->rz_start);
+			if (zones[i].type != BLK_ZONE_TYPE_CONVENTIONAL)
+				rz->rz_flags |= XFS_RTZONE_SEQ;
+			error = xfs_rtzone_init_wp(mp, rz, &zones[i]);
+			if (error)
+				goto out_free;
+		}
+		sector = zones[nr - 1].start + zones[nr - 1].len;
+	}
+	if (idx < rzs->rzs_nr) {
+		error = -EIO;
+		goto out_free;
+	}
+
+	kmem_free(zones);
+	mp->m_rtzones = rzs;
+	xfs_info(mp, "using zoned allocation on %u rt device zones.",
+			rzs->rzs_nr);
+	return 0;
+
+out_free:
+	kmem_free(zones);
+	kmem_free(rzs->rzs_zones);
+	kmem_free(rzs);
+	return error;
+}
+
+void
+xfs_rtzone_free(
+	struct xfs_mount	*mp)
+{
+	struct xfs_rtzones	*rzs = mp->m_rtzones;
+
+	if (!rzs)
+		return;
+	mp->m_rtzones = NULL;
+	kmem_free(rzs->rzs_zones);
+	kmem_free(rzs);
+}
+
+/*
+ * Everything ever allocated from this zone has been freed, so rewind it.
+ * The frees must be stable before the old contents are thrown away, or a
+ * crash could leave files pointing at the reset zone.
+ */
+STATIC int
+xfs_rtzone_reset(
+	struct xfs_mount	*mp,
+	struct xfs_rtzone	*rz,
+	bool			*forced)
+{
+	int			error;
+
+	if (rz->rz_flags & XFS_RTZONE_SEQ) {
+		if (!*forced) {
+			error = xfs_log_force(mp, XFS_LOG_SYNC);
+			if (error)
+				return error;
+			*forced = true;
+		}
+		error = blkdev_reset_zones(xfs_rtzone_bdev(mp),
+				XFS_FSB_TO_BB(mp, rz->rz_start *
+						  mp->m_sb.sb_rextsize),
+				XFS_FSB_TO_BB(mp, (xfs_rfsblock_t)rz->rz_len *
+						  mp->m_sb.sb_rextsize),
+				GFP_NOFS);
+		if (error)
+			return error;
+	}
+	rz->rz_wp = 0;
+	return 0;
+}
+
+/*
+ * Move on to the next zone with at least @minlen rt extents left at its
+ * write pointer, going round the device in order.  If there is none, reset
+ * a zone that has had all its space freed.
+ */
+STATIC int
+xfs_rtzone_open(
+	struct xfs_mount	*mp,
+	struct xfs_trans	*tp,
+	xfs_extlen_t		minlen)
+{
+	struct xfs_rtzones	*rzs = mp->m_rtzones;
+	struct xfs_rtzone	*rz;
+	xfs_rtblock_t		next;
+	unsigned int		idx;
+	unsigned int		i;
+	bool			forced = false;
+	int			stat;
+	int			error;
+
+	for (i = 1; i <= rzs->rzs_nr; i++) {
+		idx = (rzs->rzs_cur + i) % rzs->rzs_nr;
+		rz = &rzs->rzs_zones[idx];
+		if (!(rz->rz_flags & XFS_RTZONE_DEAD) &&
+		    rz->rz_len - rz->rz_wp >= minlen) {
+			rzs->rzs_cur = idx;
+			return 0;
+		}
+	}
+
+	for (i = 1; i <= rzs->rzs_nr; i++) {
+		idx = (rzs->rzs_cur + i) % rzs->rzs_nr;
+		rz = &rzs->rzs_zones[idx];
+		if ((rz->rz_flags & XFS_RTZONE_DEAD) || rz->rz_len < minlen)
+			continue;
+
+		error = xfs_rtcheck_range(mp, tp, rz->rz_start, rz->rz_wp, 1,
+				&next, &stat);
+		if (error)
+			return error;
+		if (!stat)
+			continue;
+
+		error = xfs_rtzone_reset(mp, rz, &forced);
+		if (error)
+			return error;
+		rzs->rzs_cur = idx;
+		return 0;
+	}
+	return -ENOSPC;
+}
+
+/*
+ * Allocate between @minlen and @maxlen rt extents at the write pointer of
+ * the current zone, moving on to another zone if it doesn't have room.
+ * Returns NULLRTBLOCK in @rtblock if no zone can satisfy the request.
+ */
+int
+xfs_rtzone_alloc(
+	struct xfs_mount	*mp,
+	struct xfs_trans	*tp,
+	xfs_extlen_t		minlen,
+	xfs_extlen_t		maxlen,
+	xfs_extlen_t		*len,
+	struct xfs_buf		**rbpp,
+	xfs_fsblock_t		*rsb,
+	xfs_extlen_t		prod,
+	xfs_rtblock_t		*rtblock)
+{
+	struct xfs_rtzones	*rzs = mp->m_rtzones;
+	struct xfs_rtzone	*rz;
+	xfs_rtblock_t		bno;
+	xfs_rtblock_t		next;
+	xfs_rtblock_t		end;
+	xfs_extlen_t		avail;
+	int			stat;
+	int			error;
+
+	ASSERT(xfs_isilocked(mp->m_rbmip, XFS_ILOCK_EXCL));
+
+	*rtblock = NULLRTBLOCK;
+	for (;;) {
+		rz = &rzs->rzs_zones[rzs->rzs_cur];
+		if ((rz->rz_flags & XFS_RTZONE_DEAD) ||
+		    rz->rz_len - rz->rz_wp < minlen) {
+			error = xfs_rtzone_open(mp, tp, minlen);
+			if (error == -ENOSPC)
+				return 0;
+			if (error)
+				return error;
+			continue;
+		}
+
+		bno = rz->rz_start + rz->rz_wp;
+		avail = min(rz->rz_len - rz->rz_wp, maxlen);
+		error = xfs_rtcheck_range(mp, tp, bno, avail, 1, &next, &stat);
+		if (error)
+			return error;
+		if (!stat)
+			avail = next - bno;
+		if (prod > 1)
+			avail = rounddown(avail, prod);
+		if (avail >= minlen)
+			break;
+
+		/*
+		 * Something is already allocated at the write pointer, which
+		 * happens in conventional zones that were in use before we
+		 * started appending to them.  Skip past it.
+		 */
+		ASSERT(!stat);
+		error = xfs_rtfind_forw(mp, tp, next,
+				rz->rz_start + rz->rz_len - 1, &end);
+		if (error)
+			return error;
+		rz->rz_wp = end + 1 - rz->rz_start;
+	}
+
+	error = xfs_rtallocate_range(mp, tp, bno, avail, rbpp, rsb);
+	if (error)
+		return error;
+	rz->rz_wp += avail;
+	*len = avail;
+	*rtblock = bno;
+	return 0;
+}
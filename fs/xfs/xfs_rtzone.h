@@ -0,0 +1,35 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef __XFS_RTZONE_H__
+#define __XFS_RTZONE_H__
+
+struct xfs_mount;
+struct xfs_trans;
+
+#if defined(CONFIG_XFS_RT) && defined(CONFIG_BLK_DEV_ZONED)
+int xfs_rtzone_init(struct xfs_mount *mp);
+void xfs_rtzone_free(struct xfs_mount *mp);
+int xfs_rtzone_alloc(struct xfs_mount *mp, struct xfs_trans *tp,
+		xfs_extlen_t minlen, xfs_extlen_t maxlen, xfs_extlen_t *len,
+		struct xfs_buf **rbpp, xfs_fsblock_t *rsb, xfs_extlen_t prod,
+		xfs_rtblock_t *rtblock);
+#else
+# define xfs_rtzone_init(mp)				(0)
+# define xfs_rtzone_free(mp)				((void)0)
+# define xfs_rtzone_alloc(m,t,min,max,l,rb,rs,p,b)	(-ENOSYS)
+#endif
+
+#endif	/* __XFS_RTZONE_H__ */
@@ -36,6 +36,8 @@ int xfs_stats_format(struct xfsstats __percpu *stats, char *buf)
 	uint64_t	xs_xstrat_bytes = 0;
 	uint64_t	xs_write_bytes = 0;
 	uint64_t	xs_read_bytes = 0;
+	uint64_t	xs_log_noiclogs_us = 0;
+	uint64_t	xs_log_space_wait_us = 0;
 
 	static const struct xstats_entry {
 		char	*desc;
@@ -65,6 +67,8 @@ int xfs_stats_format(struct xfsstats __percpu *stats, char *buf)
 		{ "refcntbt",		XFSSTAT_END_REFCOUNT		},
 		/* we print both series of quota information together */
 		{ "qm",			XFSSTAT_END_QM			},
+		{ "cil",		XFSSTAT_END_CIL			},
+		{ "recover",		XFSSTAT_END_RECOVER		},
 	};
 
 	/* Loop over all stats groups */
@@ -83,10 +87,16 @@ int xfs_stats_format(struct xfsstats __percpu *stats, char *buf)
 		xs_xstrat_bytes += per_cpu_ptr(stats, i)->s.xs_xstrat_bytes;
 		xs_write_bytes += per_cpu_ptr(stats, i)->s.xs_write_bytes;
 		xs_read_bytes += per_cpu_ptr(stats, i)->s.xs_read_bytes;
+		xs_log_noiclogs_us +=
+			per_cpu_ptr(stats, i)->s.xs_log_noiclogs_us;
+		xs_log_space_wait_us +=
+			per_cpu_ptr(stats, i)->s.xs_log_space_wait_us;
 	}
 
 	len += snprintf(buf + len, PATH_MAX-len, "xpc %Lu %Lu %Lu\n",
 			xs_xstrat_bytes, xs_write_bytes, xs_read_bytes);
+	len += snprintf(buf + len, PATH_MAX-len, "log_wait %Lu %Lu\n",
+			xs_log_noiclogs_us, xs_log_space_wait_us);
 	len += snprintf(buf + len, PATH_MAX-len, "debug %u\n",
 #if defined(DEBUG)
 		1);
@@ -97,6 +107,59 @@ int xfs_stats_format(struct xfsstats __percpu *stats, char *buf)
 	return len;
 }
 
+int xfs_stats_format_latency(struct xfsstats __percpu *stats, char *buf)
+{
+	static const char * const names[XFS_LAT_MAX] = {
+		[XFS_LAT_LOG_FORCE]	= "log_force",
+		[XFS_LAT_AIL_PUSH]	= "ail_push",
+		[XFS_LAT_LOG_RESV]	= "log_resv",
+		[XFS_LAT_BUF_READ]	= "buf_read",
+		[XFS_LAT_IGET_MISS]	= "iget_miss",
+		[XFS_LAT_ICLOG_WAIT]	= "iclog_wait",
+	};
+	int		i, j, cpu;
+	int		len = 0;
+	uint32_t	val;
+
+	for (i = 0; i < XFS_LAT_MAX; i++) {
+		len += snprintf(buf + len, PAGE_SIZE - len, "%s", names[i]);
+		for (j = 0; j < XFS_LAT_BUCKETS; j++) {
+			val = 0;
+			for_each_possible_cpu(cpu)
+				val += per_cpu_ptr(stats, cpu)->s.xs_lat[i][j];
+			len += snprintf(buf + len, PAGE_SIZE - len, " %u", val);
+		}
+		len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+
+	return len;
+}
+
+int xfs_stats_format_bufio(struct xfsstats __percpu *stats, char *buf)
+{
+	const char	*name;
+	int		i, j, cpu;
+	int		len = 0;
+	uint64_t	val;
+
+	for (i = 0; i < XFS_BUFIO_TYPES; i++) {
+		name = xfs_buf_io_type_name(i);
+		if (!name)
+			continue;
+		len += snprintf(buf + len, PAGE_SIZE - len, "%s", name);
+		for (j = 0; j < XFS_BUFIO_MAX; j++) {
+			val = 0;
+			for_each_possible_cpu(cpu)
+				val += per_cpu_ptr(stats, cpu)->s.xs_bufio[i][j];
+			len += snprintf(buf + len, PAGE_SIZE - len, " %llu",
+					val);
+		}
+		len += snprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+
+	return len;
+}
+
 void xfs_stats_clearall(struct xfsstats __percpu *stats)
 {
 	int		c;
@@ -49,6 +49,41 @@ enum {
 	__XBTS_MAX = 15,
 };
 
+/*
+ * Latency histograms for a few hot paths.  Each histogram has log2 buckets
+ * in microseconds: bucket 0 counts operations that took less than 1us,
+ * bucket n those that took [2^(n-1), 2^n) us, and the last bucket catches
+ * everything slower.
+ */
+enum {
+	XFS_LAT_LOG_FORCE = 0,		/* synchronous log forces */
+	XFS_LAT_AIL_PUSH,		/* one xfsaild push pass */
+	XFS_LAT_LOG_RESV,		/* sleeping for log space */
+	XFS_LAT_BUF_READ,		/* synchronous metadata buffer reads */
+	XFS_LAT_IGET_MISS,		/* inode cache misses */
+	XFS_LAT_ICLOG_WAIT,		/* waiting for a free iclog */
+	XFS_LAT_MAX,
+};
+
+#define XFS_LAT_BUCKETS		24
+
+/*
+ * Metadata buffer I/O attributed to the verifier (b_ops) of the buffer.
+ * Row 0 counts buffers without verifiers, the last row any verifier that
+ * isn't in the table in xfs_buf.c.
+ */
+enum {
+	XFS_BUFIO_READS = 0,
+	XFS_BUFIO_READ_BYTES,
+	XFS_BUFIO_READ_US,
+	XFS_BUFIO_WRITES,
+	XFS_BUFIO_WRITE_BYTES,
+	XFS_BUFIO_WRITE_US,
+	XFS_BUFIO_MAX,
+};
+
+#define XFS_BUFIO_TYPES		32
+
 /*
  * XFS global statistics
  */
@@ -169,10 +204,26 @@ struct __xfsstats {
 #define XFSSTAT_END_QM			(XFSSTAT_END_XQMSTAT+2)
 	uint32_t		xs_qm_dquot;
 	uint32_t		xs_qm_dquot_unused;
+#define XFSSTAT_END_CIL			(XFSSTAT_END_QM+4)
+	uint32_t		xs_cil_commits;
+	uint32_t		xs_cil_ctx_waits;
+	uint32_t		xs_cil_pushes;
+	uint32_t		xs_cil_space_folds;
+#define XFSSTAT_END_RECOVER		(XFSSTAT_END_CIL+4)
+	uint32_t		xs_recover_cancel_adds;
+	uint32_t		xs_recover_cancel_refs;
+	uint32_t		xs_recover_cancel_lookups;
+	uint32_t		xs_recover_cancel_hits;
 /* Extra precision counters */
 	uint64_t		xs_xstrat_bytes;
 	uint64_t		xs_write_bytes;
 	uint64_t		xs_read_bytes;
+	uint64_t		xs_log_noiclogs_us;
+	uint64_t		xs_log_space_wait_us;
+/* Latency histograms */
+	uint32_t		xs_lat[XFS_LAT_MAX][XFS_LAT_BUCKETS];
+/* Buffer I/O by verifier type */
+	uint64_t		xs_bufio[XFS_BUFIO_TYPES][XFS_BUFIO_MAX];
 };
 
 struct xfsstats {
@@ -190,6 +241,8 @@ struct xfsstats {
 
 
 int xfs_stats_format(struct xfsstats __percpu *stats, char *buf);
+int xfs_stats_format_latency(struct xfsstats __percpu *stats, char *buf);
+int xfs_stats_format_bufio(struct xfsstats __percpu *stats, char *buf);
 void xfs_stats_clearall(struct xfsstats __percpu *stats);
 extern struct xstats xfsstats;
 
@@ -229,6 +282,31 @@ do {									\
 	per_cpu_ptr(mp->m_stats.xs_stats, current_cpu())->a[off] += (inc);	\
 } while (0)
 
+static inline int
+xfs_stats_lat_bucket(
+	ktime_t		start)
+{
+	int64_t		us = ktime_us_delta(ktime_get(), start);
+
+	if (us <= 0)
+		return 0;
+	return min_t(int, ilog2(us) + 1, XFS_LAT_BUCKETS - 1);
+}
+
+#define XFS_STATS_LAT(mp, op, start)					\
+do {									\
+	int	__b = xfs_stats_lat_bucket(start);			\
+									\
+	per_cpu_ptr(xfsstats.xs_stats, current_cpu())->s.xs_lat[op][__b]++; \
+	per_cpu_ptr(mp->m_stats.xs_stats, current_cpu())->s.xs_lat[op][__b]++; \
+} while (0)
+
+#define XFS_STATS_BUFIO(mp, type, op, inc)				\
+do {									\
+	per_cpu_ptr(xfsstats.xs_stats, current_cpu())->s.xs_bufio[type][op] += (inc); \
+	per_cpu_ptr(mp->m_stats.xs_stats, current_cpu())->s.xs_bufio[type][op] += (inc); \
+} while (0)
+
 #if defined(CONFIG_PROC_FS)
 
 extern int xfs_init_procfs(void);
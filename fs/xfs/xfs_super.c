@@ -36,10 +36,13 @@
 #include "xfs_log_priv.h"
 #include "xfs_da_btree.h"
 #include "xfs_dir2.h"
+#include "xfs_dir2_index.h"
+#include "xfs_attr.h"
 #include "xfs_extfree_item.h"
 #include "xfs_mru_cache.h"
 #include "xfs_inode_item.h"
 #include "xfs_icache.h"
+#include "xfs_discard.h"
 #include "xfs_trace.h"
 #include "xfs_icreate_item.h"
 #include "xfs_filestream.h"
@@ -49,7 +52,11 @@
 #include "xfs_rmap_item.h"
 #include "xfs_refcount_item.h"
 #include "xfs_bmap_item.h"
+#include "xfs_swapext_item.h"
 #include "xfs_reflink.h"
+#include "xfs_iomap.h"
+#include "xfs_symlink.h"
+#include "xfs_changelog.h"
 
 #include <linux/namei.h>
 #include <linux/dax.h>
@@ -68,6 +75,9 @@ struct bio_set *xfs_ioend_bioset;
 static struct kset *xfs_kset;		/* top-level xfs sysfs dir */
 #ifdef DEBUG
 static struct xfs_kobj xfs_dbg_kobj;	/* global debug sysfs attrs */
+#ifdef CONFIG_XFS_BENCH
+static struct xfs_kobj xfs_bench_kobj;	/* microbenchmark trigger */
+#endif
 #endif
 
 /*
@@ -83,7 +93,11 @@ enum {
 	Opt_quota, Opt_noquota, Opt_usrquota, Opt_grpquota, Opt_prjquota,
 	Opt_uquota, Opt_gquota, Opt_pquota,
 	Opt_uqnoenforce, Opt_gqnoenforce, Opt_pqnoenforce, Opt_qnoenforce,
-	Opt_discard, Opt_nodiscard, Opt_dax, Opt_err,
+	Opt_discard, Opt_nodiscard, Opt_hipri, Opt_nohipri,
+	Opt_sharedwrite, Opt_nosharedwrite, Opt_dirindex, Opt_nodirindex,
+	Opt_changelog, Opt_fastfreeze, Opt_nofastfreeze,
+	Opt_ioheat, Opt_noioheat, Opt_pmemlog, Opt_iprefetch, Opt_noiprefetch,
+	Opt_dax, Opt_err,
 };
 
 static const match_table_t tokens = {
@@ -130,6 +144,20 @@ static const match_table_t tokens = {
 	{Opt_qnoenforce, "qnoenforce"},	/* same as uqnoenforce */
 	{Opt_discard,	"discard"},	/* Discard unused blocks */
 	{Opt_nodiscard,	"nodiscard"},	/* Do not discard unused blocks */
+	{Opt_hipri,	"hipri"},	/* Poll for sync I/O completion */
+	{Opt_nohipri,	"nohipri"},	/* Wait for sync I/O interrupts */
+	{Opt_sharedwrite, "sharedwrite"}, /* Parallel buffered overwrites */
+	{Opt_nosharedwrite, "nosharedwrite"}, /* Serialise buffered writes */
+	{Opt_dirindex,	"dirindex"},	/* Index large directories in memory */
+	{Opt_nodirindex, "nodirindex"},	/* Look names up on disk */
+	{Opt_changelog,	"changelog"},	/* Track changed inodes in memory */
+	{Opt_fastfreeze, "fastfreeze"},	/* Freeze leaves metadata in the log */
+	{Opt_nofastfreeze, "nofastfreeze"}, /* Freeze writes back metadata */
+	{Opt_ioheat,	"ioheat"},	/* Track per-inode I/O heat */
+	{Opt_noioheat,	"noioheat"},	/* Don't track I/O heat */
+	{Opt_pmemlog,	"pmemlog"},	/* Write the log through DAX */
+	{Opt_iprefetch,	"iprefetch"},	/* Cache whole inode clusters */
+	{Opt_noiprefetch, "noiprefetch"}, /* Cache only inodes looked up */
 
 	{Opt_dax,	"dax"},		/* Enable direct access to bdev pages */
 
@@ -367,6 +395,48 @@ xfs_parseargs(
 		case Opt_nodiscard:
 			mp->m_flags &= ~XFS_MOUNT_DISCARD;
 			break;
+		case Opt_hipri:
+			mp->m_flags |= XFS_MOUNT_HIPRI;
+			break;
+		case Opt_nohipri:
+			mp->m_flags &= ~XFS_MOUNT_HIPRI;
+			break;
+		case Opt_sharedwrite:
+			mp->m_flags |= XFS_MOUNT_SHAREDWRITE;
+			break;
+		case Opt_nosharedwrite:
+			mp->m_flags &= ~XFS_MOUNT_SHAREDWRITE;
+			break;
+		case Opt_dirindex:
+			mp->m_flags |= XFS_MOUNT_DIRINDEX;
+			break;
+		case Opt_nodirindex:
+			mp->m_flags &= ~XFS_MOUNT_DIRINDEX;
+			break;
+		case Opt_changelog:
+			mp->m_flags |= XFS_MOUNT_CHANGELOG;
+			break;
+		case Opt_pmemlog:
+			mp->m_flags |= XFS_MOUNT_PMEMLOG;
+			break;
+		case Opt_fastfreeze:
+			mp->m_flags |= XFS_MOUNT_FASTFREEZE;
+			break;
+		case Opt_nofastfreeze:
+			mp->m_flags &= ~XFS_MOUNT_FASTFREEZE;
+			break;
+		case Opt_ioheat:
+			mp->m_flags |= XFS_MOUNT_IOHEAT;
+			break;
+		case Opt_noioheat:
+			mp->m_flags &= ~XFS_MOUNT_IOHEAT;
+			break;
+		case Opt_iprefetch:
+			mp->m_flags |= XFS_MOUNT_IPREFETCH;
+			break;
+		case Opt_noiprefetch:
+			mp->m_flags &= ~XFS_MOUNT_IPREFETCH;
+			break;
 #ifdef CONFIG_FS_DAX
 		case Opt_dax:
 			mp->m_flags |= XFS_MOUNT_DAX;
@@ -435,18 +505,18 @@ xfs_parseargs(
 	if (mp->m_logbufs != -1 &&
 	    mp->m_logbufs != 0 &&
 	    (mp->m_logbufs < XLOG_MIN_ICLOGS ||
-	     mp->m_logbufs > XLOG_MAX_ICLOGS)) {
+	     mp->m_logbufs > XLOG_MAX_LARGE_ICLOGS)) {
 		xfs_warn(mp, "invalid logbufs value: %d [not %d-%d]",
-			mp->m_logbufs, XLOG_MIN_ICLOGS, XLOG_MAX_ICLOGS);
+			mp->m_logbufs, XLOG_MIN_ICLOGS, XLOG_MAX_LARGE_ICLOGS);
 		return -EINVAL;
 	}
 	if (mp->m_logbsize != -1 &&
 	    mp->m_logbsize !=  0 &&
 	    (mp->m_logbsize < XLOG_MIN_RECORD_BSIZE ||
-	     mp->m_logbsize > XLOG_MAX_RECORD_BSIZE ||
+	     mp->m_logbsize > XLOG_MAX_LARGE_RECORD_BSIZE ||
 	     !is_power_of_2(mp->m_logbsize))) {
 		xfs_warn(mp,
-			"invalid logbufsize: %d [not 16k,32k,64k,128k or 256k]",
+			"invalid logbufsize: %d [not a power of 2 from 16k to 4096k]",
 			mp->m_logbsize);
 		return -EINVAL;
 	}
@@ -490,6 +560,14 @@ xfs_showargs(
 		{ XFS_MOUNT_FILESTREAMS,	",filestreams" },
 		{ XFS_MOUNT_GRPID,		",grpid" },
 		{ XFS_MOUNT_DISCARD,		",discard" },
+		{ XFS_MOUNT_HIPRI,		",hipri" },
+		{ XFS_MOUNT_SHAREDWRITE,	",sharedwrite" },
+		{ XFS_MOUNT_DIRINDEX,		",dirindex" },
+		{ XFS_MOUNT_CHANGELOG,		",changelog" },
+		{ XFS_MOUNT_FASTFREEZE,		",fastfreeze" },
+		{ XFS_MOUNT_IOHEAT,		",ioheat" },
+		{ XFS_MOUNT_IPREFETCH,		",iprefetch" },
+		{ XFS_MOUNT_PMEMLOG,		",pmemlog" },
 		{ XFS_MOUNT_SMALL_INUMS,	",inode32" },
 		{ XFS_MOUNT_DAX,		",dax" },
 		{ 0, NULL }
@@ -518,7 +596,7 @@ xfs_showargs(
 
 	if (mp->m_logbufs > 0)
 		seq_printf(m, ",logbufs=%d", mp->m_logbufs);
-	if (mp->m_logbsize > 0)
+	if (mp->m_logbsize > 0 && !(mp->m_flags & XFS_MOUNT_AUTO_LOGBSIZE))
 		seq_printf(m, ",logbsize=%dk", mp->m_logbsize >> 10);
 
 	if (mp->m_logname)
@@ -703,11 +781,20 @@ xfs_blkdev_put(
 		blkdev_put(bdev, FMODE_READ|FMODE_WRITE|FMODE_EXCL);
 }
 
+/*
+ * Flush the device's volatile write cache, unless nothing has been written to
+ * it since the last flush.
+ */
 void
 xfs_blkdev_issue_flush(
 	xfs_buftarg_t		*buftarg)
 {
-	blkdev_issue_flush(buftarg->bt_bdev, GFP_NOFS, NULL);
+	int			seq;
+
+	if (!xfs_buftarg_needs_flush(buftarg, &seq))
+		return;
+	if (!blkdev_issue_flush(buftarg->bt_bdev, GFP_NOFS, NULL))
+		xfs_buftarg_flushed(buftarg, seq);
 }
 
 STATIC void
@@ -842,20 +929,17 @@ STATIC int
 xfs_init_mount_workqueues(
 	struct xfs_mount	*mp)
 {
+	int			i;
+
 	mp->m_buf_workqueue = alloc_workqueue("xfs-buf/%s",
 			WQ_MEM_RECLAIM|WQ_FREEZABLE, 1, mp->m_fsname);
 	if (!mp->m_buf_workqueue)
 		goto out;
 
-	mp->m_data_workqueue = alloc_workqueue("xfs-data/%s",
-			WQ_MEM_RECLAIM|WQ_FREEZABLE, 0, mp->m_fsname);
-	if (!mp->m_data_workqueue)
-		goto out_destroy_buf;
-
 	mp->m_unwritten_workqueue = alloc_workqueue("xfs-conv/%s",
 			WQ_MEM_RECLAIM|WQ_FREEZABLE, 0, mp->m_fsname);
 	if (!mp->m_unwritten_workqueue)
-		goto out_destroy_data_iodone_queue;
+		goto out_destroy_buf;
 
 	mp->m_cil_workqueue = alloc_workqueue("xfs-cil/%s",
 			WQ_MEM_RECLAIM|WQ_FREEZABLE, 0, mp->m_fsname);
@@ -878,13 +962,52 @@ xfs_init_mount_workqueues(
 	if (!mp->m_eofblocks_workqueue)
 		goto out_destroy_log;
 
+	mp->m_blockgc_workqueue = alloc_workqueue("xfs-blockgc/%s",
+			WQ_UNBOUND|WQ_MEM_RECLAIM|WQ_FREEZABLE, 0, mp->m_fsname);
+	if (!mp->m_blockgc_workqueue)
+		goto out_destroy_eofb;
+
 	mp->m_sync_workqueue = alloc_workqueue("xfs-sync/%s", WQ_FREEZABLE, 0,
 					       mp->m_fsname);
 	if (!mp->m_sync_workqueue)
-		goto out_destroy_eofb;
+		goto out_destroy_blockgc;
+
+	mp->m_agresv_workqueue = alloc_workqueue("xfs-agresv/%s",
+			WQ_UNBOUND|WQ_FREEZABLE, 0, mp->m_fsname);
+	if (!mp->m_agresv_workqueue)
+		goto out_destroy_sync;
+
+	mp->m_ialloc_workqueue = alloc_workqueue("xfs-ialloc/%s",
+			WQ_UNBOUND|WQ_FREEZABLE, 0, mp->m_fsname);
+	if (!mp->m_ialloc_workqueue)
+		goto out_destroy_agresv;
+
+	mp->m_inactive_workqueue = alloc_workqueue("xfs-inactive/%s",
+			WQ_MEM_RECLAIM|WQ_FREEZABLE, 0, mp->m_fsname);
+	if (!mp->m_inactive_workqueue)
+		goto out_destroy_ialloc;
+
+	/* completions may run on any CPU until told otherwise via sysfs */
+	for (i = 0; i < XFS_WQ_STEER_MAX; i++) {
+		if (!zalloc_cpumask_var(&mp->m_wq_cpus[i], GFP_KERNEL))
+			goto out_free_cpus;
+		cpumask_copy(mp->m_wq_cpus[i], cpu_possible_mask);
+	}
 
 	return 0;
 
+out_free_cpus:
+	while (--i >= 0)
+		free_cpumask_var(mp->m_wq_cpus[i]);
+	destroy_workqueue(mp->m_inactive_workqueue);
+out_destroy_ialloc:
+	destroy_workqueue(mp->m_ialloc_workqueue);
+out_destroy_agresv:
+	destroy_workqueue(mp->m_agresv_workqueue);
+out_destroy_sync:
+	destroy_workqueue(mp->m_sync_workqueue);
+out_destroy_blockgc:
+	destroy_workqueue(mp->m_blockgc_workqueue);
 out_destroy_eofb:
 	destroy_workqueue(mp->m_eofblocks_workqueue);
 out_destroy_log:
@@ -895,8 +1018,6 @@ xfs_init_mount_workqueues(
 	destroy_workqueue(mp->m_cil_workqueue);
 out_destroy_unwritten:
 	destroy_workqueue(mp->m_unwritten_workqueue);
-out_destroy_data_iodone_queue:
-	destroy_workqueue(mp->m_data_workqueue);
 out_destroy_buf:
 	destroy_workqueue(mp->m_buf_workqueue);
 out:
@@ -907,12 +1028,19 @@ STATIC void
 xfs_destroy_mount_workqueues(
 	struct xfs_mount	*mp)
 {
+	int			i;
+
+	for (i = 0; i < XFS_WQ_STEER_MAX; i++)
+		free_cpumask_var(mp->m_wq_cpus[i]);
+	destroy_workqueue(mp->m_inactive_workqueue);
+	destroy_workqueue(mp->m_ialloc_workqueue);
+	destroy_workqueue(mp->m_agresv_workqueue);
 	destroy_workqueue(mp->m_sync_workqueue);
+	destroy_workqueue(mp->m_blockgc_workqueue);
 	destroy_workqueue(mp->m_eofblocks_workqueue);
 	destroy_workqueue(mp->m_log_workqueue);
 	destroy_workqueue(mp->m_reclaim_workqueue);
 	destroy_workqueue(mp->m_cil_workqueue);
-	destroy_workqueue(mp->m_data_workqueue);
 	destroy_workqueue(mp->m_unwritten_workqueue);
 	destroy_workqueue(mp->m_buf_workqueue);
 }
@@ -933,6 +1061,9 @@ xfs_flush_inodes(
 		sync_inodes_sb(sb);
 		up_read(&sb->s_umount);
 	}
+
+	/* Give back the space held by unlinked inodes still queued. */
+	xfs_inactive_flush(mp);
 }
 
 /* Catch misguided souls that try to use this interface on XFS */
@@ -969,6 +1100,17 @@ xfs_fs_destroy_inode(
 					error, ip->i_ino);
 	}
 
+	xfs_dir2_index_free(ip);
+	xfs_dir2_freemap_free(ip);
+	xfs_attr_cache_free(ip);
+	xfs_reflink_shared_cache_free(ip);
+	xfs_iomap_unwritten_batch_free(ip);
+	xfs_iomap_dio_blocks_free(ip);
+	xfs_readlink_cache_free(ip);
+
+	if (xfs_inactive_queue(ip))
+		return;
+
 	xfs_inactive(ip);
 
 	ASSERT(XFS_FORCED_SHUTDOWN(ip->i_mount) || ip->i_delayed_blks == 0);
@@ -1045,6 +1187,47 @@ xfs_fs_drop_inode(
 	return generic_drop_inode(inode) || (ip->i_flags & XFS_IDONTCACHE);
 }
 
+/*
+ * Log timestamp updates that xfs_vn_update_time deferred on a lazytime
+ * mount.  The VFS turns the lazy I_DIRTY_TIME state into I_DIRTY_SYNC when
+ * the timestamps have to be persisted, which lands us here.
+ */
+STATIC void
+xfs_fs_dirty_inode(
+	struct inode		*inode,
+	int			flag)
+{
+	struct xfs_inode	*ip = XFS_I(inode);
+	struct xfs_mount	*mp = ip->i_mount;
+	struct xfs_trans	*tp;
+
+	if (!(inode->i_sb->s_flags & MS_LAZYTIME))
+		return;
+
+	/*
+	 * Only log the timestamps if they were dirtied lazily and haven't
+	 * been logged since.  The VFS clears I_DIRTY_TIME before it calls
+	 * mark_inode_dirty_sync() to persist them, so we can't tell that
+	 * apart from any other I_DIRTY_SYNC mark by the flags alone and
+	 * have to remember the lazy update ourselves.
+	 */
+	if (flag & I_DIRTY_TIME) {
+		xfs_iflags_set(ip, XFS_ILAZYTIME);
+		return;
+	}
+	if (flag != I_DIRTY_SYNC)
+		return;
+	if (!xfs_iflags_test_and_clear(ip, XFS_ILAZYTIME))
+		return;
+
+	if (xfs_trans_alloc(mp, &M_RES(mp)->tr_fsyncts, 0, 0, 0, &tp))
+		return;
+	xfs_ilock(ip, XFS_ILOCK_EXCL);
+	xfs_trans_ijoin(tp, ip, XFS_ILOCK_EXCL);
+	xfs_trans_log_inode(tp, ip, XFS_ILOG_TIMESTAMP);
+	xfs_trans_commit(tp);
+}
+
 STATIC void
 xfs_free_fsname(
 	struct xfs_mount	*mp)
@@ -1080,6 +1263,63 @@ xfs_fs_sync_fs(
 	return 0;
 }
 
+/*
+ * Summing the per-cpu inode and free block counters walks every CPU, which
+ * gets expensive on big machines that are polled by monitoring agents many
+ * times a second.  If the statfs_cache_ms sysctl is set, statfs is served from
+ * a snapshot of the sums instead.  The snapshot is refreshed once it is older
+ * than the sysctl says, or earlier if the cheap approximate free block count
+ * shows that more than 1/1024th of the data device was allocated or freed
+ * since.  Only the caller that claims the refresh pays for the sums, everyone
+ * else keeps using the snapshot meanwhile.
+ */
+STATIC void
+xfs_statfs_counters(
+	struct xfs_mount	*mp,
+	uint64_t		*icount,
+	uint64_t		*ifree,
+	uint64_t		*fdblocks)
+{
+	unsigned long		interval = msecs_to_jiffies(xfs_statfs_cache_ms);
+	unsigned long		stamp = 0;
+	int64_t			fdfast = 0;
+	int64_t			drift;
+	unsigned int		seq;
+
+	if (interval) {
+		do {
+			seq = read_seqbegin(&mp->m_statfs_lock);
+			stamp = mp->m_statfs_stamp;
+			fdfast = mp->m_statfs_fdfast;
+			*icount = mp->m_statfs_icount;
+			*ifree = mp->m_statfs_ifree;
+			*fdblocks = mp->m_statfs_fdblocks;
+		} while (read_seqretry(&mp->m_statfs_lock, seq));
+
+		drift = percpu_counter_read(&mp->m_fdblocks) - fdfast;
+		if (stamp &&
+		    ((time_before(jiffies, stamp + interval) &&
+		      abs(drift) <= (mp->m_sb.sb_dblocks >> 10)) ||
+		     cmpxchg(&mp->m_statfs_stamp, stamp, jiffies ?: 1) != stamp))
+			return;
+	}
+
+	fdfast = percpu_counter_read(&mp->m_fdblocks);
+	*icount = percpu_counter_sum(&mp->m_icount);
+	*ifree = percpu_counter_sum(&mp->m_ifree);
+	*fdblocks = xfs_fdblocks_sum(mp);
+	if (!interval)
+		return;
+
+	write_seqlock(&mp->m_statfs_lock);
+	mp->m_statfs_stamp = jiffies ?: 1;
+	mp->m_statfs_fdfast = fdfast;
+	mp->m_statfs_icount = *icount;
+	mp->m_statfs_ifree = *ifree;
+	mp->m_statfs_fdblocks = *fdblocks;
+	write_sequnlock(&mp->m_statfs_lock);
+}
+
 STATIC int
 xfs_fs_statfs(
 	struct dentry		*dentry,
@@ -1102,9 +1342,7 @@ xfs_fs_statfs(
 	statp->f_fsid.val[0] = (u32)id;
 	statp->f_fsid.val[1] = (u32)(id >> 32);
 
-	icount = percpu_counter_sum(&mp->m_icount);
-	ifree = percpu_counter_sum(&mp->m_ifree);
-	fdblocks = percpu_counter_sum(&mp->m_fdblocks);
+	xfs_statfs_counters(mp, &icount, &ifree, &fdblocks);
 
 	spin_lock(&mp->m_sb_lock);
 	statp->f_bsize = sbp->sb_blocksize;
@@ -1267,6 +1505,42 @@ xfs_fs_remount(
 			mp->m_flags |= XFS_MOUNT_SMALL_INUMS;
 			mp->m_maxagi = xfs_set_inode_alloc(mp, sbp->sb_agcount);
 			break;
+		case Opt_hipri:
+			mp->m_flags |= XFS_MOUNT_HIPRI;
+			break;
+		case Opt_nohipri:
+			mp->m_flags &= ~XFS_MOUNT_HIPRI;
+			break;
+		case Opt_sharedwrite:
+			mp->m_flags |= XFS_MOUNT_SHAREDWRITE;
+			break;
+		case Opt_nosharedwrite:
+			mp->m_flags &= ~XFS_MOUNT_SHAREDWRITE;
+			break;
+		case Opt_dirindex:
+			mp->m_flags |= XFS_MOUNT_DIRINDEX;
+			break;
+		case Opt_nodirindex:
+			mp->m_flags &= ~XFS_MOUNT_DIRINDEX;
+			break;
+		case Opt_fastfreeze:
+			mp->m_flags |= XFS_MOUNT_FASTFREEZE;
+			break;
+		case Opt_nofastfreeze:
+			mp->m_flags &= ~XFS_MOUNT_FASTFREEZE;
+			break;
+		case Opt_ioheat:
+			mp->m_flags |= XFS_MOUNT_IOHEAT;
+			break;
+		case Opt_noioheat:
+			mp->m_flags &= ~XFS_MOUNT_IOHEAT;
+			break;
+		case Opt_iprefetch:
+			mp->m_flags |= XFS_MOUNT_IPREFETCH;
+			break;
+		case Opt_noiprefetch:
+			mp->m_flags &= ~XFS_MOUNT_IPREFETCH;
+			break;
 		default:
 			/*
 			 * Logically we would return an error here to prevent
@@ -1334,6 +1608,7 @@ xfs_fs_remount(
 		xfs_restore_resvblks(mp);
 		xfs_log_work_queue(mp);
 		xfs_queue_eofblocks(mp);
+		xfs_enable_compact_icore_log(mp);
 
 		/* Recover any CoW blocks that never got remapped. */
 		error = xfs_reflink_recover_cow(mp);
@@ -1373,6 +1648,8 @@ xfs_fs_remount(
 		 * final log force+buftarg wait and deadlock the remount.
 		 */
 		cancel_delayed_work_sync(&mp->m_eofblocks_work);
+		xfs_inode_prealloc_cancel(mp);
+		xfs_inactive_flush(mp);
 
 		xfs_quiesce_attr(mp);
 		mp->m_flags |= XFS_MOUNT_RDONLY;
@@ -1392,10 +1669,27 @@ xfs_fs_freeze(
 	struct super_block	*sb)
 {
 	struct xfs_mount	*mp = XFS_M(sb);
+	int			error;
 
 	xfs_save_resvblks(mp);
-	xfs_quiesce_attr(mp);
-	return xfs_sync_sb(mp, true);
+	if (!(mp->m_flags & XFS_MOUNT_FASTFREEZE)) {
+		xfs_quiesce_attr(mp);
+		return xfs_sync_sb(mp, true);
+	}
+
+	/*
+	 * Fast freeze: make the log stable and leave the dirty metadata in
+	 * the AIL for writeback after the thaw.  The superblock has to be
+	 * logged before the AIL is stopped because it may need log space.
+	 */
+	while (atomic_read(&mp->m_active_trans) > 0)
+		delay(100);
+	error = xfs_sync_sb(mp, true);
+	if (error)
+		return error;
+	xfs_log_quiesce_fast(mp);
+	mp->m_fast_frozen = true;
+	return 0;
 }
 
 STATIC int
@@ -1405,6 +1699,10 @@ xfs_fs_unfreeze(
 	struct xfs_mount	*mp = XFS_M(sb);
 
 	xfs_restore_resvblks(mp);
+	if (mp->m_fast_frozen) {
+		mp->m_fast_frozen = false;
+		xfs_log_unquiesce_fast(mp);
+	}
 	xfs_log_work_queue(mp);
 	return 0;
 }
@@ -1417,6 +1715,39 @@ xfs_fs_show_options(
 	return xfs_showargs(XFS_M(root->d_sb), m);
 }
 
+/*
+ * If the external log device is striped (its optimal I/O size spans several
+ * chunks) pick a default log buffer size of one chunk.  With the small 32k
+ * default, consecutive iclogs all land in the same chunk and therefore on the
+ * same member device; with chunk sized iclogs successive log writes rotate
+ * round-robin across the stripe members and the in-flight iclogs are spread
+ * over all of them.  Returns 0 if the device geometry doesn't suggest a
+ * better size.
+ */
+STATIC int
+xfs_log_stripe_bsize(
+	struct xfs_mount	*mp)
+{
+	struct block_device	*bdev;
+	unsigned int		io_min;
+	unsigned int		io_opt;
+
+	if (!mp->m_logdev_targp || mp->m_logdev_targp == mp->m_ddev_targp)
+		return 0;
+
+	bdev = mp->m_logdev_targp->bt_bdev;
+	io_min = bdev_io_min(bdev);
+	io_opt = bdev_io_opt(bdev);
+	if (!io_opt || io_opt <= io_min || io_opt % io_min)
+		return 0;
+	if (!is_power_of_2(io_min) ||
+	    io_min <= XLOG_BIG_RECORD_BSIZE ||
+	    io_min > XLOG_MAX_RECORD_BSIZE ||
+	    io_min < mp->m_sb.sb_logsunit)
+		return 0;
+	return io_min;
+}
+
 /*
  * This function fills in xfs_mount_t fields based on mount args.
  * Note: the superblock _has_ now been read in.
@@ -1438,6 +1769,17 @@ xfs_finish_flags(
 		"logbuf size must be greater than or equal to log stripe size");
 			return -EINVAL;
 		}
+
+		/* Size default log buffers to a striped external log */
+		if (mp->m_logbsize <= 0) {
+			int	bsize = xfs_log_stripe_bsize(mp);
+
+			if (bsize > 0) {
+				if (mp->m_logbsize < 0)
+					mp->m_flags |= XFS_MOUNT_AUTO_LOGBSIZE;
+				mp->m_logbsize = bsize;
+			}
+		}
 	} else {
 		/* Fail a mount if the logbuf is larger than 32K */
 		if (mp->m_logbsize > XLOG_BIG_RECORD_BSIZE) {
@@ -1445,6 +1787,12 @@ xfs_finish_flags(
 		"logbuf size for version 1 logs must be 16K or 32K");
 			return -EINVAL;
 		}
+		if (mp->m_logbufs > XLOG_MAX_ICLOGS) {
+			xfs_warn(mp,
+		"logbufs for version 1 logs must be %d-%d",
+				XLOG_MIN_ICLOGS, XLOG_MAX_ICLOGS);
+			return -EINVAL;
+		}
 	}
 
 	/*
@@ -1490,6 +1838,7 @@ xfs_init_percpu_counters(
 	struct xfs_mount	*mp)
 {
 	int		error;
+	int		cpu;
 
 	error = percpu_counter_init(&mp->m_icount, 0, GFP_KERNEL);
 	if (error)
@@ -1503,8 +1852,18 @@ xfs_init_percpu_counters(
 	if (error)
 		goto free_ifree;
 
+	mp->m_fdcache = alloc_percpu(struct xfs_fdcache);
+	if (!mp->m_fdcache)
+		goto free_fdblocks;
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(mp->m_fdcache, cpu)->lock);
+	spin_lock_init(&mp->m_fdcache_lock);
+	mp->m_fdcache_on = true;
+
 	return 0;
 
+free_fdblocks:
+	percpu_counter_destroy(&mp->m_fdblocks);
 free_ifree:
 	percpu_counter_destroy(&mp->m_ifree);
 free_icount:
@@ -1518,6 +1877,7 @@ xfs_reinit_percpu_counters(
 {
 	percpu_counter_set(&mp->m_icount, mp->m_sb.sb_icount);
 	percpu_counter_set(&mp->m_ifree, mp->m_sb.sb_ifree);
+	xfs_fdcache_reset(mp);
 	percpu_counter_set(&mp->m_fdblocks, mp->m_sb.sb_fdblocks);
 }
 
@@ -1528,6 +1888,7 @@ xfs_destroy_percpu_counters(
 	percpu_counter_destroy(&mp->m_icount);
 	percpu_counter_destroy(&mp->m_ifree);
 	percpu_counter_destroy(&mp->m_fdblocks);
+	free_percpu(mp->m_fdcache);
 }
 
 STATIC int
@@ -1545,12 +1906,14 @@ xfs_fs_fill_super(
 		goto out;
 
 	spin_lock_init(&mp->m_sb_lock);
+	seqlock_init(&mp->m_statfs_lock);
 	mutex_init(&mp->m_growlock);
 	atomic_set(&mp->m_active_trans, 0);
 	atomic_set(&mp->m_scrubbers, 0);
 	INIT_DELAYED_WORK(&mp->m_reclaim_work, xfs_reclaim_worker);
 	INIT_DELAYED_WORK(&mp->m_eofblocks_work, xfs_eofblocks_worker);
 	INIT_DELAYED_WORK(&mp->m_cowblocks_work, xfs_cowblocks_worker);
+	INIT_DELAYED_WORK(&mp->m_discard_work, xfs_discard_worker);
 	mp->m_kobj.kobject.kset = xfs_kset;
 
 	mp->m_super = sb;
@@ -1584,11 +1947,15 @@ xfs_fs_fill_super(
 	if (error)
 		goto out_destroy_workqueues;
 
+	error = list_lru_init_memcg(&mp->m_reclaim_lru);
+	if (error)
+		goto out_destroy_counters;
+
 	/* Allocate stats memory before we do operations that might use it */
 	mp->m_stats.xs_stats = alloc_percpu(struct xfsstats);
 	if (!mp->m_stats.xs_stats) {
 		error = -ENOMEM;
-		goto out_destroy_counters;
+		goto out_destroy_reclaim_lru;
 	}
 
 	error = xfs_readsb(mp, flags);
@@ -1657,6 +2024,10 @@ xfs_fs_fill_super(
 	if (error)
 		goto out_filestream_unmount;
 
+	error = xfs_changelog_init(mp);
+	if (error)
+		goto out_unmount;
+
 	root = igrab(VFS_I(mp->m_rootip));
 	if (!root) {
 		error = -ENOENT;
@@ -1676,6 +2047,8 @@ xfs_fs_fill_super(
 	xfs_freesb(mp);
  out_free_stats:
 	free_percpu(mp->m_stats.xs_stats);
+ out_destroy_reclaim_lru:
+	list_lru_destroy(&mp->m_reclaim_lru);
  out_destroy_counters:
 	xfs_destroy_percpu_counters(mp);
  out_destroy_workqueues:
@@ -1691,6 +2064,7 @@ xfs_fs_fill_super(
  out_unmount:
 	xfs_filestream_unmount(mp);
 	xfs_unmountfs(mp);
+	xfs_changelog_free(mp);
 	goto out_free_sb;
 }
 
@@ -1701,11 +2075,24 @@ xfs_fs_put_super(
 	struct xfs_mount	*mp = XFS_M(sb);
 
 	xfs_notice(mp, "Unmounting Filesystem");
+
+	/*
+	 * A fast frozen filesystem can be unmounted without being thawed, or
+	 * shut down while frozen.  Either way everything from here on waits
+	 * for the AIL to empty, so it has to be running again.
+	 */
+	if (mp->m_fast_frozen) {
+		mp->m_fast_frozen = false;
+		xfs_log_unquiesce_fast(mp);
+	}
+	xfs_inactive_flush(mp);
 	xfs_filestream_unmount(mp);
 	xfs_unmountfs(mp);
+	xfs_changelog_free(mp);
 
 	xfs_freesb(mp);
 	free_percpu(mp->m_stats.xs_stats);
+	list_lru_destroy(&mp->m_reclaim_lru);
 	xfs_destroy_percpu_counters(mp);
 	xfs_destroy_mount_workqueues(mp);
 	xfs_close_devices(mp);
@@ -1728,6 +2115,8 @@ xfs_fs_nr_cached_objects(
 	struct super_block	*sb,
 	struct shrink_control	*sc)
 {
+	if (sc->memcg)
+		return list_lru_shrink_count(&XFS_M(sb)->m_reclaim_lru, sc);
 	return xfs_reclaim_inodes_count(XFS_M(sb));
 }
 
@@ -1736,6 +2125,8 @@ xfs_fs_free_cached_objects(
 	struct super_block	*sb,
 	struct shrink_control	*sc)
 {
+	if (sc->memcg)
+		return xfs_reclaim_inodes_memcg(XFS_M(sb), sc);
 	return xfs_reclaim_inodes_nr(XFS_M(sb), sc->nr_to_scan);
 }
 
@@ -1743,6 +2134,7 @@ static const struct super_operations xfs_super_operations = {
 	.alloc_inode		= xfs_fs_alloc_inode,
 	.destroy_inode		= xfs_fs_destroy_inode,
 	.drop_inode		= xfs_fs_drop_inode,
+	.dirty_inode		= xfs_fs_dirty_inode,
 	.put_super		= xfs_fs_put_super,
 	.sync_fs		= xfs_fs_sync_fs,
 	.freeze_fs		= xfs_fs_freeze,
@@ -1879,8 +2271,56 @@ xfs_init_zones(void)
 	if (!xfs_bui_zone)
 		goto out_destroy_bud_zone;
 
+	xfs_sxd_zone = kmem_zone_init(sizeof(struct xfs_sxd_log_item),
+			"xfs_sxd_item");
+	if (!xfs_sxd_zone)
+		goto out_destroy_bui_zone;
+
+	xfs_sxi_zone = kmem_zone_init(sizeof(struct xfs_sxi_log_item),
+			"xfs_sxi_item");
+	if (!xfs_sxi_zone)
+		goto out_destroy_sxd_zone;
+
+	/*
+	 * Reserve objects for the transaction commit and log write paths so
+	 * that committing metadata under memory pressure waits on log I/O
+	 * completion to return an element rather than looping in the page
+	 * allocator.  A handful of tickets and contexts covers the CIL and
+	 * the transactions it has in flight; buf log items get a deeper
+	 * reserve as a single commit can dirty many buffers.
+	 */
+	xfs_log_ticket_pool = mempool_create_slab_pool(16, xfs_log_ticket_zone);
+	if (!xfs_log_ticket_pool)
+		goto out_destroy_sxi_zone;
+
+	xfs_log_item_desc_pool = mempool_create_slab_pool(16,
+			xfs_log_item_desc_zone);
+	if (!xfs_log_item_desc_pool)
+		goto out_destroy_log_ticket_pool;
+
+	xfs_buf_item_pool = mempool_create_slab_pool(64, xfs_buf_item_zone);
+	if (!xfs_buf_item_pool)
+		goto out_destroy_log_item_desc_pool;
+
+	xfs_cil_ctx_pool = mempool_create_kmalloc_pool(4,
+			sizeof(struct xfs_cil_ctx));
+	if (!xfs_cil_ctx_pool)
+		goto out_destroy_buf_item_pool;
+
 	return 0;
 
+ out_destroy_buf_item_pool:
+	mempool_destroy(xfs_buf_item_pool);
+ out_destroy_log_item_desc_pool:
+	mempool_destroy(xfs_log_item_desc_pool);
+ out_destroy_log_ticket_pool:
+	mempool_destroy(xfs_log_ticket_pool);
+ out_destroy_sxi_zone:
+	kmem_zone_destroy(xfs_sxi_zone);
+ out_destroy_sxd_zone:
+	kmem_zone_destroy(xfs_sxd_zone);
+ out_destroy_bui_zone:
+	kmem_zone_destroy(xfs_bui_zone);
  out_destroy_bud_zone:
 	kmem_zone_destroy(xfs_bud_zone);
  out_destroy_cui_zone:
@@ -1931,6 +2371,12 @@ xfs_destroy_zones(void)
 	 * destroy caches.
 	 */
 	rcu_barrier();
+	mempool_destroy(xfs_cil_ctx_pool);
+	mempool_destroy(xfs_buf_item_pool);
+	mempool_destroy(xfs_log_item_desc_pool);
+	mempool_destroy(xfs_log_ticket_pool);
+	kmem_zone_destroy(xfs_sxi_zone);
+	kmem_zone_destroy(xfs_sxd_zone);
 	kmem_zone_destroy(xfs_bui_zone);
 	kmem_zone_destroy(xfs_bud_zone);
 	kmem_zone_destroy(xfs_cui_zone);
@@ -1998,6 +2444,7 @@ init_xfs_fs(void)
 	xfs_rmap_update_init_defer_op();
 	xfs_refcount_update_init_defer_op();
 	xfs_bmap_update_init_defer_op();
+	xfs_swapext_init_defer_op();
 
 	xfs_dir_startup();
 
@@ -2051,9 +2498,17 @@ init_xfs_fs(void)
 		goto out_remove_stats_kobj;
 #endif
 
-	error = xfs_qm_init();
+#ifdef CONFIG_XFS_BENCH
+	xfs_bench_kobj.kobject.kset = xfs_kset;
+	error = xfs_sysfs_init(&xfs_bench_kobj, &xfs_bench_ktype, NULL,
+			       "bench");
 	if (error)
 		goto out_remove_dbg_kobj;
+#endif
+
+	error = xfs_qm_init();
+	if (error)
+		goto out_remove_bench_kobj;
 
 	error = register_filesystem(&xfs_fs_type);
 	if (error)
@@ -2062,6 +2517,10 @@ init_xfs_fs(void)
 
  out_qm_exit:
 	xfs_qm_exit();
+ out_remove_bench_kobj:
+#ifdef CONFIG_XFS_BENCH
+	xfs_sysfs_del(&xfs_bench_kobj);
+#endif
  out_remove_dbg_kobj:
 #ifdef DEBUG
 	xfs_sysfs_del(&xfs_dbg_kobj);
@@ -2093,6 +2552,9 @@ exit_xfs_fs(void)
 {
 	xfs_qm_exit();
 	unregister_filesystem(&xfs_fs_type);
+#ifdef CONFIG_XFS_BENCH
+	xfs_sysfs_del(&xfs_bench_kobj);
+#endif
 #ifdef DEBUG
 	xfs_sysfs_del(&xfs_dbg_kobj);
 #endif
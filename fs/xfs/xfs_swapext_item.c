@@ -0,0 +1,484 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_bit.h"
+#include "xfs_mount.h"
+#include "xfs_defer.h"
+#include "xfs_inode.h"
+#include "xfs_trans.h"
+#include "xfs_trans_priv.h"
+#include "xfs_buf_item.h"
+#include "xfs_swapext_item.h"
+#include "xfs_swapext.h"
+#include "xfs_log.h"
+#include "xfs_bmap.h"
+#include "xfs_icache.h"
+#include "xfs_trace.h"
+#include "xfs_bmap_btree.h"
+#include "xfs_trans_space.h"
+
+
+kmem_zone_t	*xfs_sxi_zone;
+kmem_zone_t	*xfs_sxd_zone;
+
+static inline struct xfs_sxi_log_item *SXI_ITEM(struct xfs_log_item *lip)
+{
+	return container_of(lip, struct xfs_sxi_log_item, sxi_item);
+}
+
+void
+xfs_sxi_item_free(
+	struct xfs_sxi_log_item	*sxip)
+{
+	kmem_zone_free(xfs_sxi_zone, sxip);
+}
+
+STATIC void
+xfs_sxi_item_size(
+	struct xfs_log_item	*lip,
+	int			*nvecs,
+	int			*nbytes)
+{
+	*nvecs += 1;
+	*nbytes += sizeof(struct xfs_sxi_log_format);
+}
+
+/*
+ * This is called to fill in the vector of log iovecs for the
+ * given sxi log item. We use only 1 iovec, and we point that
+ * at the sxi_log_format structure embedded in the sxi item.
+ */
+STATIC void
+xfs_sxi_item_format(
+	struct xfs_log_item	*lip,
+	struct xfs_log_vec	*lv)
+{
+	struct xfs_sxi_log_item	*sxip = SXI_ITEM(lip);
+	struct xfs_log_iovec	*vecp = NULL;
+
+	sxip->sxi_format.sxi_type = XFS_LI_SXI;
+	sxip->sxi_format.sxi_size = 1;
+
+	xlog_copy_iovec(lv, &vecp, XLOG_REG_TYPE_SXI_FORMAT, &sxip->sxi_format,
+			sizeof(struct xfs_sxi_log_format));
+}
+
+/*
+ * Pinning has no meaning for an sxi item, so just return.
+ */
+STATIC void
+xfs_sxi_item_pin(
+	struct xfs_log_item	*lip)
+{
+}
+
+/*
+ * The unpin operation is the last place an SXI is manipulated in the log. It is
+ * either inserted in the AIL or aborted in the event of a log I/O error. In
+ * either case, the SXI transaction has been successfully committed to make it
+ * this far. Therefore, we expect whoever committed the SXI to either construct
+ * and commit the SXD or drop the SXD's reference in the event of error. Simply
+ * drop the log's SXI reference now that the log is done with it.
+ */
+STATIC void
+xfs_sxi_item_unpin(
+	struct xfs_log_item	*lip,
+	int			remove)
+{
+	struct xfs_sxi_log_item	*sxip = SXI_ITEM(lip);
+
+	xfs_sxi_release(sxip);
+}
+
+/*
+ * SXI items have no locking or pushing.  However, since SXIs are pulled from
+ * the AIL when their corresponding SXDs are committed to disk, their situation
+ * is very similar to being pinned.  Return XFS_ITEM_PINNED so that the caller
+ * will eventually flush the log.  This should help in getting the SXI out of
+ * the AIL.
+ */
+STATIC uint
+xfs_sxi_item_push(
+	struct xfs_log_item	*lip,
+	struct list_head	*buffer_list)
+{
+	return XFS_ITEM_PINNED;
+}
+
+/*
+ * The SXI has been either committed or aborted if the transaction has been
+ * cancelled. If the transaction was cancelled, an SXD isn't going to be
+ * constructed and thus we free the SXI here directly.
+ */
+STATIC void
+xfs_sxi_item_unlock(
+	struct xfs_log_item	*lip)
+{
+	if (lip->li_flags & XFS_LI_ABORTED)
+		xfs_sxi_item_free(SXI_ITEM(lip));
+}
+
+/*
+ * The SXI is logged only once and cannot be moved in the log, so simply return
+ * the lsn at which it's been logged.
+ */
+STATIC xfs_lsn_t
+xfs_sxi_item_committed(
+	struct xfs_log_item	*lip,
+	xfs_lsn_t		lsn)
+{
+	return lsn;
+}
+
+/*
+ * The SXI dependency tracking op doesn't do squat.  The dependency tracking
+ * has to be handled by the inodes, which are locked throughout the exchange.
+ */
+STATIC void
+xfs_sxi_item_committing(
+	struct xfs_log_item	*lip,
+	xfs_lsn_t		lsn)
+{
+}
+
+/*
+ * This is the ops vector shared by all sxi log items.
+ */
+static const struct xfs_item_ops xfs_sxi_item_ops = {
+	.iop_size	= xfs_sxi_item_size,
+	.iop_format	= xfs_sxi_item_format,
+	.iop_pin	= xfs_sxi_item_pin,
+	.iop_unpin	= xfs_sxi_item_unpin,
+	.iop_unlock	= xfs_sxi_item_unlock,
+	.iop_committed	= xfs_sxi_item_committed,
+	.iop_push	= xfs_sxi_item_push,
+	.iop_committing = xfs_sxi_item_committing,
+};
+
+/*
+ * Allocate and initialize an sxi item.
+ */
+struct xfs_sxi_log_item *
+xfs_sxi_init(
+	struct xfs_mount		*mp)
+
+{
+	struct xfs_sxi_log_item		*sxip;
+
+	sxip = kmem_zone_zalloc(xfs_sxi_zone, KM_SLEEP);
+
+	xfs_log_item_init(mp, &sxip->sxi_item, XFS_LI_SXI, &xfs_sxi_item_ops);
+	sxip->sxi_format.sxi_id = (uintptr_t)(void *)sxip;
+	atomic_set(&sxip->sxi_refcount, 2);
+
+	return sxip;
+}
+
+/*
+ * Freeing the SXI requires that we remove it from the AIL if it has already
+ * been placed there. However, the SXI may not yet have been placed in the AIL
+ * when called by xfs_sxi_release() from SXD processing due to the ordering of
+ * committed vs unpin operations in bulk insert operations. Hence the reference
+ * count to ensure only the last caller frees the SXI.
+ */
+void
+xfs_sxi_release(
+	struct xfs_sxi_log_item	*sxip)
+{
+	ASSERT(atomic_read(&sxip->sxi_refcount) > 0);
+	if (atomic_dec_and_test(&sxip->sxi_refcount)) {
+		xfs_trans_ail_remove(&sxip->sxi_item, SHUTDOWN_LOG_IO_ERROR);
+		xfs_sxi_item_free(sxip);
+	}
+}
+
+static inline struct xfs_sxd_log_item *SXD_ITEM(struct xfs_log_item *lip)
+{
+	return container_of(lip, struct xfs_sxd_log_item, sxd_item);
+}
+
+STATIC void
+xfs_sxd_item_size(
+	struct xfs_log_item	*lip,
+	int			*nvecs,
+	int			*nbytes)
+{
+	*nvecs += 1;
+	*nbytes += sizeof(struct xfs_sxd_log_format);
+}
+
+/*
+ * This is called to fill in the vector of log iovecs for the
+ * given sxd log item. We use only 1 iovec, and we point that
+ * at the sxd_log_format structure embedded in the sxd item.
+ */
+STATIC void
+xfs_sxd_item_format(
+	struct xfs_log_item	*lip,
+	struct xfs_log_vec	*lv)
+{
+	struct xfs_sxd_log_item	*sxdp = SXD_ITEM(lip);
+	struct xfs_log_iovec	*vecp = NULL;
+
+	sxdp->sxd_format.sxd_type = XFS_LI_SXD;
+	sxdp->sxd_format.sxd_size = 1;
+
+	xlog_copy_iovec(lv, &vecp, XLOG_REG_TYPE_SXD_FORMAT, &sxdp->sxd_format,
+			sizeof(struct xfs_sxd_log_format));
+}
+
+/*
+ * Pinning has no meaning for an sxd item, so just return.
+ */
+STATIC void
+xfs_sxd_item_pin(
+	struct xfs_log_item	*lip)
+{
+}
+
+/*
+ * Since pinning has no meaning for an sxd item, unpinning does
+ * not either.
+ */
+STATIC void
+xfs_sxd_item_unpin(
+	struct xfs_log_item	*lip,
+	int			remove)
+{
+}
+
+/*
+ * There isn't much you can do to push on an sxd item.  It is simply stuck
+ * waiting for the log to be flushed to disk.
+ */
+STATIC uint
+xfs_sxd_item_push(
+	struct xfs_log_item	*lip,
+	struct list_head	*buffer_list)
+{
+	return XFS_ITEM_PINNED;
+}
+
+/*
+ * The SXD is either committed or aborted if the transaction is cancelled. If
+ * the transaction is cancelled, drop our reference to the SXI and free the
+ * SXD.
+ */
+STATIC void
+xfs_sxd_item_unlock(
+	struct xfs_log_item	*lip)
+{
+	struct xfs_sxd_log_item	*sxdp = SXD_ITEM(lip);
+
+	if (lip->li_flags & XFS_LI_ABORTED) {
+		xfs_sxi_release(sxdp->sxd_sxip);
+		kmem_zone_free(xfs_sxd_zone, sxdp);
+	}
+}
+
+/*
+ * When the sxd item is committed to disk, all we need to do is delete our
+ * reference to our partner sxi item and then free ourselves. Since we're
+ * freeing ourselves we must return -1 to keep the transaction code from
+ * further referencing this item.
+ */
+STATIC xfs_lsn_t
+xfs_sxd_item_committed(
+	struct xfs_log_item	*lip,
+	xfs_lsn_t		lsn)
+{
+	struct xfs_sxd_log_item	*sxdp = SXD_ITEM(lip);
+
+	/*
+	 * Drop the SXI reference regardless of whether the SXD has been
+	 * aborted. Once the SXD transaction is constructed, it is the sole
+	 * responsibility of the SXD to release the SXI (even if the SXI is
+	 * aborted due to log I/O error).
+	 */
+	xfs_sxi_release(sxdp->sxd_sxip);
+	kmem_zone_free(xfs_sxd_zone, sxdp);
+
+	return (xfs_lsn_t)-1;
+}
+
+/*
+ * The SXD dependency tracking op doesn't do squat.  The dependency tracking
+ * has to be handled by the inodes, which are locked throughout the exchange.
+ */
+STATIC void
+xfs_sxd_item_committing(
+	struct xfs_log_item	*lip,
+	xfs_lsn_t		lsn)
+{
+}
+
+/*
+ * This is the ops vector shared by all sxd log items.
+ */
+static const struct xfs_item_ops xfs_sxd_item_ops = {
+	.iop_size	= xfs_sxd_item_size,
+	.iop_format	= xfs_sxd_item_format,
+	.iop_pin	= xfs_sxd_item_pin,
+	.iop_unpin	= xfs_sxd_item_unpin,
+	.iop_unlock	= xfs_sxd_item_unlock,
+	.iop_committed	= xfs_sxd_item_committed,
+	.iop_push	= xfs_sxd_item_push,
+	.iop_committing = xfs_sxd_item_committing,
+};
+
+/*
+ * Allocate and initialize an sxd item.
+ */
+struct xfs_sxd_log_item *
+xfs_sxd_init(
+	struct xfs_mount		*mp,
+	struct xfs_sxi_log_item		*sxip)
+
+{
+	struct xfs_sxd_log_item	*sxdp;
+
+	sxdp = kmem_zone_zalloc(xfs_sxd_zone, KM_SLEEP);
+	xfs_log_item_init(mp, &sxdp->sxd_item, XFS_LI_SXD, &xfs_sxd_item_ops);
+	sxdp->sxd_sxip = sxip;
+	sxdp->sxd_format.sxd_sxi_id = sxip->sxi_format.sxi_id;
+
+	return sxdp;
+}
+
+/*
+ * Process an extent swap intent item that was recovered from the log.
+ * We need to finish exchanging the rest of the range.
+ */
+int
+xfs_sxi_recover(
+	struct xfs_mount		*mp,
+	struct xfs_sxi_log_item		*sxip)
+{
+	struct xfs_swap_extent		*sx;
+	struct xfs_swapext_intent	sxi;
+	struct xfs_sxd_log_item		*sxdp;
+	struct xfs_trans		*tp;
+	struct xfs_inode		*ip1 = NULL;
+	struct xfs_inode		*ip2 = NULL;
+	struct xfs_defer_ops		dfops;
+	xfs_fsblock_t			firstfsb;
+	xfs_fsblock_t			inode_fsb1;
+	xfs_fsblock_t			inode_fsb2;
+	int				resblks;
+	int				error = 0;
+
+	ASSERT(!test_bit(XFS_SXI_RECOVERED, &sxip->sxi_flags));
+
+	/*
+	 * First check the validity of the range described by the
+	 * SXI.  If anything is bad, then toss the SXI.
+	 */
+	sx = &sxip->sxi_format.sxi_extent;
+	inode_fsb1 = XFS_BB_TO_FSB(mp, XFS_FSB_TO_DADDR(mp,
+			XFS_INO_TO_FSB(mp, sx->se_inode1)));
+	inode_fsb2 = XFS_BB_TO_FSB(mp, XFS_FSB_TO_DADDR(mp,
+			XFS_INO_TO_FSB(mp, sx->se_inode2)));
+	if (inode_fsb1 == 0 || inode_fsb2 == 0 ||
+	    inode_fsb1 >= mp->m_sb.sb_dblocks ||
+	    inode_fsb2 >= mp->m_sb.sb_dblocks ||
+	    sx->se_inode1 == sx->se_inode2 ||
+	    sx->se_startoff1 + sx->se_blockcount < sx->se_startoff1 ||
+	    sx->se_startoff2 + sx->se_blockcount < sx->se_startoff2 ||
+	    (sx->se_flags & ~XFS_SWAP_EXTENT_FLAGS)) {
+		/*
+		 * This will pull the SXI from the AIL and
+		 * free the memory associated with it.
+		 */
+		set_bit(XFS_SXI_RECOVERED, &sxip->sxi_flags);
+		xfs_sxi_release(sxip);
+		return -EIO;
+	}
+
+	/* Grab the inodes. */
+	error = xfs_iget(mp, NULL, sx->se_inode1, 0, 0, &ip1);
+	if (error)
+		return error;
+	error = xfs_iget(mp, NULL, sx->se_inode2, 0, 0, &ip2);
+	if (error)
+		goto out_rele;
+	if (VFS_I(ip1)->i_nlink == 0)
+		xfs_iflags_set(ip1, XFS_IRECOVERY);
+	if (VFS_I(ip2)->i_nlink == 0)
+		xfs_iflags_set(ip2, XFS_IRECOVERY);
+
+	resblks = XFS_SWAP_RMAP_SPACE_RES(mp,
+			XFS_IFORK_NEXTENTS(ip1, XFS_DATA_FORK), XFS_DATA_FORK) +
+		  XFS_SWAP_RMAP_SPACE_RES(mp,
+			XFS_IFORK_NEXTENTS(ip2, XFS_DATA_FORK), XFS_DATA_FORK);
+	error = xfs_trans_alloc(mp, &M_RES(mp)->tr_write, resblks, 0, 0, &tp);
+	if (error)
+		goto out_rele;
+	sxdp = xfs_trans_get_sxd(tp, sxip);
+
+	xfs_lock_two_inodes(ip1, ip2, XFS_ILOCK_EXCL);
+	xfs_trans_ijoin(tp, ip1, 0);
+	xfs_trans_ijoin(tp, ip2, 0);
+	xfs_defer_init(&dfops, &firstfsb);
+
+	/*
+	 * Exchange the next mapping pair and requeue the rest.  We recover
+	 * intents one at a time, so there's no need for the empty intent that
+	 * marks the end of the swap at runtime.
+	 */
+	sxi.sxi_ip1 = ip1;
+	sxi.sxi_ip2 = ip2;
+	sxi.sxi_startoff1 = sx->se_startoff1;
+	sxi.sxi_startoff2 = sx->se_startoff2;
+	sxi.sxi_blockcount = sx->se_blockcount;
+	sxi.sxi_flags = sx->se_flags;
+	error = xfs_trans_log_finish_swapext(tp, sxdp, &dfops, &sxi);
+	if (error)
+		goto err_dfops;
+
+	if (sxi.sxi_blockcount > 0) {
+		error = xfs_swapext_schedule(mp, &dfops, ip1, ip2,
+				sxi.sxi_startoff1, sxi.sxi_startoff2,
+				sxi.sxi_blockcount);
+		if (error)
+			goto err_dfops;
+	}
+
+	/* Finish transaction, free inodes. */
+	error = xfs_defer_finish(&tp, &dfops, NULL);
+	if (error)
+		goto err_dfops;
+
+	set_bit(XFS_SXI_RECOVERED, &sxip->sxi_flags);
+	error = xfs_trans_commit(tp);
+	xfs_iunlock(ip1, XFS_ILOCK_EXCL);
+	xfs_iunlock(ip2, XFS_ILOCK_EXCL);
+	goto out_rele;
+
+err_dfops:
+	xfs_defer_cancel(&dfops);
+	xfs_trans_cancel(tp);
+	xfs_iunlock(ip1, XFS_ILOCK_EXCL);
+	xfs_iunlock(ip2, XFS_ILOCK_EXCL);
+out_rele:
+	if (ip2)
+		IRELE(ip2);
+	IRELE(ip1);
+	return error;
+}
@@ -0,0 +1,71 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef	__XFS_SWAPEXT_ITEM_H__
+#define	__XFS_SWAPEXT_ITEM_H__
+
+/*
+ * The extent swap intent (SXI) records a range of mappings that are being
+ * exchanged between two files, and the extent swap done (SXD) item cancels
+ * it.  Each step of the exchange logs the done item for the current intent
+ * together with the bmap intents for the mapping pair being exchanged and a
+ * new intent for the rest of the range, so log recovery can always restart
+ * the exchange from where it stopped.
+ */
+
+/* kernel only SXI/SXD definitions */
+
+struct xfs_mount;
+struct kmem_zone;
+
+/*
+ * Define SXI flag bits. Manipulated by set/clear/test_bit operators.
+ */
+#define	XFS_SXI_RECOVERED		1
+
+/*
+ * This is the "extent swap intent" log item.  It follows the same rules as
+ * struct xfs_efi_log_item; see the comments about that structure (in
+ * xfs_extfree_item.h) for more details.
+ */
+struct xfs_sxi_log_item {
+	struct xfs_log_item		sxi_item;
+	atomic_t			sxi_refcount;
+	unsigned long			sxi_flags;	/* misc flags */
+	struct xfs_sxi_log_format	sxi_format;
+};
+
+/*
+ * This is the "extent swap done" log item.  It is used to log the fact that
+ * the work described by an earlier sxi item has been performed or handed on
+ * to a new sxi item.
+ */
+struct xfs_sxd_log_item {
+	struct xfs_log_item		sxd_item;
+	struct xfs_sxi_log_item		*sxd_sxip;
+	struct xfs_sxd_log_format	sxd_format;
+};
+
+extern struct kmem_zone	*xfs_sxi_zone;
+extern struct kmem_zone	*xfs_sxd_zone;
+
+struct xfs_sxi_log_item *xfs_sxi_init(struct xfs_mount *);
+struct xfs_sxd_log_item *xfs_sxd_init(struct xfs_mount *,
+		struct xfs_sxi_log_item *);
+void xfs_sxi_item_free(struct xfs_sxi_log_item *);
+void xfs_sxi_release(struct xfs_sxi_log_item *);
+int xfs_sxi_recover(struct xfs_mount *mp, struct xfs_sxi_log_item *sxip);
+
+#endif	/* __XFS_SWAPEXT_ITEM_H__ */
@@ -162,6 +162,68 @@ xfs_readlink(
 	return error;
 }
 
+/*
+ * Remote symlink targets are cached in i_link once read so that path walks,
+ * including RCU walks, never need the ILOCK or the symlink buffers again.
+ * Walkers may still be looking at the string after the VFS inode has been
+ * destroyed, so it is freed only after an RCU grace period.
+ */
+struct xfs_link_cache {
+	struct rcu_head		lc_rcu;
+	char			lc_target[];
+};
+
+/*
+ * Install a copy of @link as the cached target of @ip and return the cached
+ * string, or NULL if we couldn't allocate the cache.  If somebody else got
+ * there first their copy is returned and ours is dropped.
+ */
+const char *
+xfs_readlink_cache_set(
+	struct xfs_inode	*ip,
+	const char		*link)
+{
+	struct inode		*inode = VFS_I(ip);
+	struct xfs_link_cache	*lc;
+	size_t			len;
+	char			*old;
+
+	if (!ip->i_d.di_size)
+		return NULL;
+
+	len = strlen(link);
+	lc = kmalloc(sizeof(*lc) + len + 1, GFP_KERNEL | __GFP_NOWARN);
+	if (!lc)
+		return NULL;
+	memcpy(lc->lc_target, link, len + 1);
+
+	old = cmpxchg(&inode->i_link, NULL, lc->lc_target);
+	if (old) {
+		kfree(lc);
+		return old;
+	}
+	return lc->lc_target;
+}
+
+/*
+ * Drop the cached target when the VFS inode goes away, before the XFS inode
+ * can be recycled for a new VFS inode.
+ */
+void
+xfs_readlink_cache_free(
+	struct xfs_inode	*ip)
+{
+	struct inode		*inode = VFS_I(ip);
+	struct xfs_link_cache	*lc;
+
+	if (!S_ISLNK(inode->i_mode) || !inode->i_link)
+		return;
+
+	lc = container_of(inode->i_link, struct xfs_link_cache, lc_target[0]);
+	inode->i_link = NULL;
+	kfree_rcu(lc, lc_rcu);
+}
+
 int
 xfs_symlink(
 	struct xfs_inode	*dp,
@@ -240,6 +302,15 @@ xfs_symlink(
 	if (error)
 		goto out_release_inode;
 
+	/*
+	 * Reserve disk quota : blocks and inode.  As in xfs_create, do this
+	 * before taking the directory lock.
+	 */
+	error = xfs_trans_reserve_quota(tp, mp, udqp, gdqp,
+						pdqp, resblks, 1, 0);
+	if (error)
+		goto out_trans_cancel;
+
 	xfs_ilock(dp, XFS_ILOCK_EXCL | XFS_ILOCK_PARENT);
 	unlock_dp_on_error = true;
 
@@ -251,14 +322,6 @@ xfs_symlink(
 		goto out_trans_cancel;
 	}
 
-	/*
-	 * Reserve disk quota : blocks and inode.
-	 */
-	error = xfs_trans_reserve_quota(tp, mp, udqp, gdqp,
-						pdqp, resblks, 1, 0);
-	if (error)
-		goto out_trans_cancel;
-
 	/*
 	 * Check for ability to enter directory entry, if no space reserved.
 	 */
@@ -193,6 +193,87 @@ static struct ctl_table xfs_table[] = {
 		.extra1		= &xfs_params.cowb_timer.min,
 		.extra2		= &xfs_params.cowb_timer.max,
 	},
+	{
+		.procname	= "fstrim_max_mbps",
+		.data		= &xfs_params.trim_mbps.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.trim_mbps.min,
+		.extra2		= &xfs_params.trim_mbps.max,
+	},
+	{
+		.procname	= "fstrim_max_iops",
+		.data		= &xfs_params.trim_iops.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.trim_iops.min,
+		.extra2		= &xfs_params.trim_iops.max,
+	},
+	{
+		.procname	= "discard_centisecs",
+		.data		= &xfs_params.discard_timer.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.discard_timer.min,
+		.extra2		= &xfs_params.discard_timer.max,
+	},
+	{
+		.procname	= "scrub_idle_io",
+		.data		= &xfs_params.scrub_idle_io.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.scrub_idle_io.min,
+		.extra2		= &xfs_params.scrub_idle_io.max,
+	},
+	{
+		.procname	= "scrub_read_latency_ms",
+		.data		= &xfs_params.scrub_lat_ms.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.scrub_lat_ms.min,
+		.extra2		= &xfs_params.scrub_lat_ms.max,
+	},
+	{
+		.procname	= "scrub_frag_extents",
+		.data		= &xfs_params.scrub_frag_ext.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.scrub_frag_ext.min,
+		.extra2		= &xfs_params.scrub_frag_ext.max,
+	},
+	{
+		.procname	= "lazytime_max_age",
+		.data		= &xfs_params.lazytime_age.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.lazytime_age.min,
+		.extra2		= &xfs_params.lazytime_age.max,
+	},
+	{
+		.procname	= "cil_push_latency_ms",
+		.data		= &xfs_params.cil_push_lat_ms.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.cil_push_lat_ms.min,
+		.extra2		= &xfs_params.cil_push_lat_ms.max,
+	},
+	{
+		.procname	= "statfs_cache_ms",
+		.data		= &xfs_params.statfs_ms.val,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= proc_dointvec_minmax,
+		.extra1		= &xfs_params.statfs_ms.min,
+		.extra2		= &xfs_params.statfs_ms.max,
+	},
 	/* please keep this the last entry */
 #ifdef CONFIG_PROC_FS
 	{
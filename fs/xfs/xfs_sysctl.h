@@ -49,6 +49,15 @@ typedef struct xfs_param {
 	xfs_sysctl_val_t fstrm_timer;	/* Filestream dir-AG assoc'n timeout. */
 	xfs_sysctl_val_t eofb_timer;	/* Interval between eofb scan wakeups */
 	xfs_sysctl_val_t cowb_timer;	/* Interval between cowb scan wakeups */
+	xfs_sysctl_val_t trim_mbps;	/* FITRIM bandwidth cap, 0 = none */
+	xfs_sysctl_val_t trim_iops;	/* FITRIM discard IOPS cap, 0 = none */
+	xfs_sysctl_val_t discard_timer;	/* Online discard batching interval */
+	xfs_sysctl_val_t scrub_idle_io;	/* Scrub reads ahead at idle priority */
+	xfs_sysctl_val_t scrub_lat_ms;	/* Pause scrub over this read latency */
+	xfs_sysctl_val_t scrub_frag_ext;/* Report forks with this many extents */
+	xfs_sysctl_val_t lazytime_age;	/* Max age of lazy timestamp updates */
+	xfs_sysctl_val_t cil_push_lat_ms;/* Target checkpoint latency, 0 = off */
+	xfs_sysctl_val_t statfs_ms;	/* Max age of cached statfs, 0 = off */
 } xfs_param_t;
 
 /*
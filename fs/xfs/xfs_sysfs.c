@@ -26,6 +26,7 @@
 #include "xfs_log_priv.h"
 #include "xfs_stats.h"
 #include "xfs_mount.h"
+#include "xfs_bench.h"
 
 struct xfs_sysfs_attr {
 	struct attribute attr;
@@ -90,7 +91,113 @@ to_mp(struct kobject *kobject)
 	return container_of(kobj, struct xfs_mount, m_kobj);
 }
 
+/*
+ * Free space histogram, summed over all AGs whose histogram has been built.
+ * Each line gives a range of extent lengths in filesystem blocks and the
+ * number of free extents in that range.
+ */
+STATIC ssize_t
+freesp_histogram_show(
+	struct kobject		*kobject,
+	char			*buf)
+{
+	struct xfs_mount	*mp = to_mp(kobject);
+	struct xfs_perag	*pag;
+	uint64_t		hist[XFS_FREESP_HIST_BUCKETS] = { 0 };
+	xfs_agnumber_t		agno;
+	ssize_t			len = 0;
+	int			b;
+
+	for (agno = 0; agno < mp->m_sb.sb_agcount; agno++) {
+		pag = xfs_perag_get(mp, agno);
+		if (!pag)
+			continue;
+		if (pag->pagf_hist_init) {
+			for (b = 0; b < XFS_FREESP_HIST_BUCKETS; b++)
+				hist[b] += READ_ONCE(pag->pagf_hist[b]);
+		}
+		xfs_perag_put(pag);
+	}
+
+	for (b = 0; b < XFS_FREESP_HIST_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		len += snprintf(buf + len, PAGE_SIZE - len, "%u %u %llu\n",
+				1U << b, (2U << b) - 1,
+				(unsigned long long)hist[b]);
+	}
+	return len;
+}
+XFS_SYSFS_ATTR_RO(freesp_histogram);
+
+/*
+ * CPUs that buffer, data ioend and log I/O completions may be steered to.
+ * Completions run on the submitting CPU if it is in the mask, else on a CPU
+ * from the mask on the submitter's node.
+ */
+STATIC ssize_t
+xfs_wq_cpus_show(
+	struct kobject		*kobject,
+	char			*buf,
+	int			which)
+{
+	struct xfs_mount	*mp = to_mp(kobject);
+
+	return scnprintf(buf, PAGE_SIZE, "%*pb\n",
+			 cpumask_pr_args(mp->m_wq_cpus[which]));
+}
+
+STATIC ssize_t
+xfs_wq_cpus_store(
+	struct kobject		*kobject,
+	const char		*buf,
+	size_t			count,
+	int			which)
+{
+	struct xfs_mount	*mp = to_mp(kobject);
+	cpumask_var_t		new;
+	int			ret;
+
+	if (!alloc_cpumask_var(&new, GFP_KERNEL))
+		return -ENOMEM;
+
+	ret = cpumask_parse(buf, new);
+	if (!ret && !cpumask_intersects(new, cpu_possible_mask))
+		ret = -EINVAL;
+	if (!ret)
+		cpumask_copy(mp->m_wq_cpus[which], new);
+
+	free_cpumask_var(new);
+	return ret ? ret : count;
+}
+
+#define XFS_WQ_CPUS_ATTR(name, which) \
+STATIC ssize_t \
+name##_show( \
+	struct kobject		*kobject, \
+	char			*buf) \
+{ \
+	return xfs_wq_cpus_show(kobject, buf, which); \
+} \
+STATIC ssize_t \
+name##_store( \
+	struct kobject		*kobject, \
+	const char		*buf, \
+	size_t			count) \
+{ \
+	return xfs_wq_cpus_store(kobject, buf, count, which); \
+} \
+XFS_SYSFS_ATTR_RW(name)
+
+XFS_WQ_CPUS_ATTR(buf_completion_cpus, XFS_WQ_BUF);
+XFS_WQ_CPUS_ATTR(conv_completion_cpus, XFS_WQ_CONV);
+XFS_WQ_CPUS_ATTR(log_completion_cpus, XFS_WQ_LOG);
+
 static struct attribute *xfs_mp_attrs[] = {
+	ATTR_LIST(freesp_histogram),
+	ATTR_LIST(buf_completion_cpus),
+	ATTR_LIST(conv_completion_cpus),
+	ATTR_LIST(log_completion_cpus),
 	NULL,
 };
 
@@ -179,6 +286,51 @@ struct kobj_type xfs_dbg_ktype = {
 
 #endif /* DEBUG */
 
+#ifdef CONFIG_XFS_BENCH
+/* bench */
+
+STATIC ssize_t
+run_store(
+	struct kobject	*kobject,
+	const char	*buf,
+	size_t		count)
+{
+	unsigned int	val;
+	int		ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	ret = xfs_bench_run(val);
+	if (ret)
+		return ret;
+
+	return count;
+}
+
+STATIC ssize_t
+run_show(
+	struct kobject	*kobject,
+	char		*buf)
+{
+	return xfs_bench_format(buf, PAGE_SIZE);
+}
+XFS_SYSFS_ATTR_RW(run);
+
+static struct attribute *xfs_bench_attrs[] = {
+	ATTR_LIST(run),
+	NULL,
+};
+
+struct kobj_type xfs_bench_ktype = {
+	.release = xfs_sysfs_release,
+	.sysfs_ops = &xfs_sysfs_ops,
+	.default_attrs = xfs_bench_attrs,
+};
+
+#endif /* CONFIG_XFS_BENCH */
+
 /* stats */
 
 static inline struct xstats *
@@ -200,6 +352,32 @@ stats_show(
 }
 XFS_SYSFS_ATTR_RO(stats);
 
+STATIC ssize_t
+latency_show(
+	struct kobject	*kobject,
+	char		*buf)
+{
+	struct xstats	*stats = to_xstats(kobject);
+
+	return xfs_stats_format_latency(stats->xs_stats, buf);
+}
+XFS_SYSFS_ATTR_RO(latency);
+
+/*
+ * Metadata buffer I/O per verifier type: reads, bytes read, microseconds
+ * reading, then the same three for writes.
+ */
+STATIC ssize_t
+buf_io_show(
+	struct kobject	*kobject,
+	char		*buf)
+{
+	struct xstats	*stats = to_xstats(kobject);
+
+	return xfs_stats_format_bufio(stats->xs_stats, buf);
+}
+XFS_SYSFS_ATTR_RO(buf_io);
+
 STATIC ssize_t
 stats_clear_store(
 	struct kobject	*kobject,
@@ -224,6 +402,8 @@ XFS_SYSFS_ATTR_WO(stats_clear);
 
 static struct attribute *xfs_stats_attrs[] = {
 	ATTR_LIST(stats),
+	ATTR_LIST(latency),
+	ATTR_LIST(buf_io),
 	ATTR_LIST(stats_clear),
 	NULL,
 };
@@ -305,11 +485,153 @@ write_grant_head_show(
 }
 XFS_SYSFS_ATTR_RO(write_grant_head);
 
+/* rate at which reservations are consuming log space, in basic blocks/s */
+STATIC ssize_t
+reserve_grant_rate_show(
+	struct kobject	*kobject,
+	char		*buf)
+{
+	struct xlog *log = to_xlog(kobject);
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", READ_ONCE(log->l_push_rate));
+}
+XFS_SYSFS_ATTR_RO(reserve_grant_rate);
+
+/* free log space the AIL is pushed to maintain, in basic blocks */
+STATIC ssize_t
+ail_push_threshold_show(
+	struct kobject	*kobject,
+	char		*buf)
+{
+	struct xlog *log = to_xlog(kobject);
+
+	return snprintf(buf, PAGE_SIZE, "%d\n",
+			READ_ONCE(log->l_push_threshold));
+}
+XFS_SYSFS_ATTR_RO(ail_push_threshold);
+
+/* bytes held by the reserve and write grant heads, and the log size */
+STATIC ssize_t
+grant_space_used_show(
+	struct kobject	*kobject,
+	char		*buf)
+{
+	struct xlog	*log = to_xlog(kobject);
+
+	return snprintf(buf, PAGE_SIZE, "%d %d %d\n",
+		log->l_logsize -
+			xlog_space_left(log, &log->l_reserve_head.grant),
+		log->l_logsize -
+			xlog_space_left(log, &log->l_write_head.grant),
+		log->l_logsize);
+}
+XFS_SYSFS_ATTR_RO(grant_space_used);
+
+/*
+ * Bytes in the current CIL context and the background push limit. Per-cpu
+ * space that hasn't been folded into the context yet isn't included.
+ */
+STATIC ssize_t
+cil_space_used_show(
+	struct kobject	*kobject,
+	char		*buf)
+{
+	struct xlog	*log = to_xlog(kobject);
+	struct xfs_cil	*cil = log->l_cilp;
+	int		used;
+
+	down_read(&cil->xc_ctx_lock);
+	used = atomic_read(&cil->xc_ctx->space_used);
+	up_read(&cil->xc_ctx_lock);
+
+	return snprintf(buf, PAGE_SIZE, "%d %d\n", used,
+			READ_ONCE(cil->xc_push_space));
+}
+XFS_SYSFS_ATTR_RO(cil_space_used);
+
+/* number of iclogs in each state */
+STATIC ssize_t
+iclog_states_show(
+	struct kobject		*kobject,
+	char			*buf)
+{
+	struct xlog		*log = to_xlog(kobject);
+	struct xlog_in_core	*iclog;
+	int			active = 0;
+	int			want_sync = 0;
+	int			syncing = 0;
+	int			callback = 0;
+	int			dirty = 0;
+	int			other = 0;
+
+	spin_lock(&log->l_icloglock);
+	iclog = log->l_iclog;
+	do {
+		switch (iclog->ic_state) {
+		case XLOG_STATE_ACTIVE:
+			active++;
+			break;
+		case XLOG_STATE_WANT_SYNC:
+			want_sync++;
+			break;
+		case XLOG_STATE_SYNCING:
+			syncing++;
+			break;
+		case XLOG_STATE_DONE_SYNC:
+		case XLOG_STATE_DO_CALLBACK:
+		case XLOG_STATE_CALLBACK:
+			callback++;
+			break;
+		case XLOG_STATE_DIRTY:
+			dirty++;
+			break;
+		default:
+			other++;
+			break;
+		}
+		iclog = iclog->ic_next;
+	} while (iclog != log->l_iclog);
+	spin_unlock(&log->l_icloglock);
+
+	return snprintf(buf, PAGE_SIZE,
+			"active %d\n"
+			"want_sync %d\n"
+			"syncing %d\n"
+			"callback %d\n"
+			"dirty %d\n"
+			"other %d\n",
+			active, want_sync, syncing, callback, dirty, other);
+}
+XFS_SYSFS_ATTR_RO(iclog_states);
+
+/* checkpoints committed, their bytes, average size and rate per second */
+STATIC ssize_t
+checkpoints_show(
+	struct kobject	*kobject,
+	char		*buf)
+{
+	struct xlog	*log = to_xlog(kobject);
+	struct xfs_cil	*cil = log->l_cilp;
+	uint64_t	count = atomic64_read(&cil->xc_ckpt_count);
+	uint64_t	bytes = atomic64_read(&cil->xc_ckpt_bytes);
+
+	return snprintf(buf, PAGE_SIZE, "%llu %llu %llu %d\n",
+			count, bytes, count ? div64_u64(bytes, count) : 0,
+			READ_ONCE(cil->xc_ckpt_rate));
+}
+XFS_SYSFS_ATTR_RO(checkpoints);
+
 static struct attribute *xfs_log_attrs[] = {
 	ATTR_LIST(log_head_lsn),
 	ATTR_LIST(log_tail_lsn),
 	ATTR_LIST(reserve_grant_head),
 	ATTR_LIST(write_grant_head),
+	ATTR_LIST(reserve_grant_rate),
+	ATTR_LIST(ail_push_threshold),
+	ATTR_LIST(grant_space_used),
+	ATTR_LIST(cil_space_used),
+	ATTR_LIST(iclog_states),
+	ATTR_LIST(checkpoints),
 	NULL,
 };
 
@@ -632,3 +954,106 @@ xfs_error_get_cfg(
 
 	return cfg;
 }
+
+/* per-ag stats */
+
+static inline struct xfs_perag *
+to_perag(struct kobject *kobject)
+{
+	struct xfs_kobj *kobj = to_kobj(kobject);
+
+	return container_of(kobj, struct xfs_perag, pag_kobj);
+}
+
+STATIC ssize_t
+ag_stats_show(
+	struct kobject		*kobject,
+	char			*buf)
+{
+	struct xfs_perag	*pag = to_perag(kobject);
+	struct xfs_ag_stats	sum = { 0 };
+	struct xfs_ag_stats	*as;
+	int			cpu;
+
+	for_each_possible_cpu(cpu) {
+		as = per_cpu_ptr(pag->pag_stats, cpu);
+		sum.as_allocs += as->as_allocs;
+		sum.as_alloc_blocks += as->as_alloc_blocks;
+		sum.as_frees += as->as_frees;
+		sum.as_free_blocks += as->as_free_blocks;
+		sum.as_busy_stalls += as->as_busy_stalls;
+		sum.as_agf_trylock_fails += as->as_agf_trylock_fails;
+		sum.as_buf_lock_waits += as->as_buf_lock_waits;
+		sum.as_buf_trylock_fails += as->as_buf_trylock_fails;
+	}
+
+	return snprintf(buf, PAGE_SIZE,
+			"allocs %llu\n"
+			"alloc_blocks %llu\n"
+			"frees %llu\n"
+			"free_blocks %llu\n"
+			"busy_stalls %llu\n"
+			"agf_trylock_fails %llu\n"
+			"buf_lock_waits %llu\n"
+			"buf_trylock_fails %llu\n",
+			sum.as_allocs, sum.as_alloc_blocks,
+			sum.as_frees, sum.as_free_blocks,
+			sum.as_busy_stalls, sum.as_agf_trylock_fails,
+			sum.as_buf_lock_waits, sum.as_buf_trylock_fails);
+}
+
+static struct xfs_sysfs_attr xfs_sysfs_attr_ag_stats = {
+	.attr = { .name = "stats", .mode = 0444 },
+	.show = ag_stats_show,
+};
+
+static struct attribute *xfs_ag_attrs[] = {
+	ATTR_LIST(ag_stats),
+	NULL,
+};
+
+static struct kobj_type xfs_ag_ktype = {
+	.release = xfs_sysfs_release,
+	.sysfs_ops = &xfs_sysfs_ops,
+	.default_attrs = xfs_ag_attrs,
+};
+
+static struct kobj_type xfs_ag_dir_ktype = {
+	.release = xfs_sysfs_release,
+	.sysfs_ops = &xfs_sysfs_ops,
+};
+
+/* .../xfs/<dev>/ag/ */
+int
+xfs_ag_sysfs_init(
+	struct xfs_mount	*mp)
+{
+	return xfs_sysfs_init(&mp->m_ag_kobj, &xfs_ag_dir_ktype,
+				&mp->m_kobj, "ag");
+}
+
+void
+xfs_ag_sysfs_del(
+	struct xfs_mount	*mp)
+{
+	xfs_sysfs_del(&mp->m_ag_kobj);
+}
+
+/* .../xfs/<dev>/ag/<agno>/ */
+int
+xfs_perag_sysfs_init(
+	struct xfs_perag	*pag)
+{
+	char			name[16];
+
+	snprintf(name, sizeof(name), "%u", pag->pag_agno);
+	return xfs_sysfs_init(&pag->pag_kobj, &xfs_ag_ktype,
+				&pag->pag_mount->m_ag_kobj, name);
+}
+
+void
+xfs_perag_sysfs_del(
+	struct xfs_perag	*pag)
+{
+	xfs_sysfs_del(&pag->pag_kobj);
+}
@@ -23,6 +23,7 @@ extern struct kobj_type xfs_mp_ktype;	/* xfs_mount */
 extern struct kobj_type xfs_dbg_ktype;	/* debug */
 extern struct kobj_type xfs_log_ktype;	/* xlog */
 extern struct kobj_type xfs_stats_ktype;	/* stats */
+extern struct kobj_type xfs_bench_ktype;	/* bench */
 
 static inline struct xfs_kobj *
 to_kobj(struct kobject *kobject)
@@ -61,4 +62,9 @@ xfs_sysfs_del(
 int	xfs_error_sysfs_init(struct xfs_mount *mp);
 void	xfs_error_sysfs_del(struct xfs_mount *mp);
 
+int	xfs_ag_sysfs_init(struct xfs_mount *mp);
+void	xfs_ag_sysfs_del(struct xfs_mount *mp);
+int	xfs_perag_sysfs_init(struct xfs_perag *pag);
+void	xfs_perag_sysfs_del(struct xfs_perag *pag);
+
 #endif	/* __XFS_SYSFS_H__ */
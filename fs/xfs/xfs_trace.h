@@ -693,6 +693,7 @@ DEFINE_INODE_EVENT(xfs_filemap_fault);
 DEFINE_INODE_EVENT(xfs_filemap_huge_fault);
 DEFINE_INODE_EVENT(xfs_filemap_page_mkwrite);
 DEFINE_INODE_EVENT(xfs_filemap_pfn_mkwrite);
+DEFINE_INODE_EVENT(xfs_iomap_sync_fault);
 
 DECLARE_EVENT_CLASS(xfs_iref_class,
 	TP_PROTO(struct xfs_inode *ip, unsigned long caller_ip),
@@ -743,6 +744,29 @@ TRACE_EVENT(xfs_iomap_prealloc_size,
 		  __entry->blocks, __entry->shift, __entry->writeio_blocks)
 )
 
+TRACE_EVENT(xfs_reflink_tune_cowextsz,
+	TP_PROTO(struct xfs_inode *ip, xfs_fileoff_t offset, xfs_extlen_t hint,
+		 xfs_extlen_t old_hint),
+	TP_ARGS(ip, offset, hint, old_hint),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(xfs_ino_t, ino)
+		__field(xfs_fileoff_t, offset)
+		__field(xfs_extlen_t, hint)
+		__field(xfs_extlen_t, old_hint)
+	),
+	TP_fast_assign(
+		__entry->dev = VFS_I(ip)->i_sb->s_dev;
+		__entry->ino = ip->i_ino;
+		__entry->offset = offset;
+		__entry->hint = hint;
+		__entry->old_hint = old_hint;
+	),
+	TP_printk("dev %d:%d ino 0x%llx offset 0x%llx cowextsz %u -> %u",
+		  MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		  __entry->offset, __entry->old_hint, __entry->hint)
+)
+
 TRACE_EVENT(xfs_irec_merge_pre,
 	TP_PROTO(struct xfs_mount *mp, xfs_agnumber_t agno, xfs_agino_t agino,
 		 uint16_t holemask, xfs_agino_t nagino, uint16_t nholemask),
@@ -1297,6 +1321,7 @@ DEFINE_IOMAP_EVENT(xfs_get_blocks_alloc);
 DEFINE_IOMAP_EVENT(xfs_get_blocks_map_direct);
 DEFINE_IOMAP_EVENT(xfs_iomap_alloc);
 DEFINE_IOMAP_EVENT(xfs_iomap_found);
+DEFINE_IOMAP_EVENT(xfs_iomap_found_cached);
 
 DECLARE_EVENT_CLASS(xfs_simple_io_class,
 	TP_PROTO(struct xfs_inode *ip, xfs_off_t offset, ssize_t count),
@@ -2190,6 +2215,7 @@ DEFINE_DISCARD_EVENT(xfs_discard_extent);
 DEFINE_DISCARD_EVENT(xfs_discard_toosmall);
 DEFINE_DISCARD_EVENT(xfs_discard_exclude);
 DEFINE_DISCARD_EVENT(xfs_discard_busy);
+DEFINE_DISCARD_EVENT(xfs_compact_gap);
 
 /* btree cursor events */
 DECLARE_EVENT_CLASS(xfs_btree_cur_class,
@@ -2418,6 +2444,7 @@ DEFINE_DEFER_PENDING_EVENT(xfs_defer_intake_cancel);
 DEFINE_DEFER_PENDING_EVENT(xfs_defer_pending_cancel);
 DEFINE_DEFER_PENDING_EVENT(xfs_defer_pending_finish);
 DEFINE_DEFER_PENDING_EVENT(xfs_defer_pending_abort);
+DEFINE_DEFER_PENDING_EVENT(xfs_defer_relog_intent);
 
 #define DEFINE_BMAP_FREE_DEFERRED_EVENT DEFINE_PHYS_EXTENT_DEFERRED_EVENT
 DEFINE_BMAP_FREE_DEFERRED_EVENT(xfs_bmap_free_defer);
@@ -3165,6 +3192,7 @@ DEFINE_INODE_ERROR_EVENT(xfs_reflink_remap_extent_error);
 
 /* dedupe tracepoints */
 DEFINE_DOUBLE_IO_EVENT(xfs_reflink_compare_extents);
+DEFINE_DOUBLE_IO_EVENT(xfs_reflink_dedupe_shared);
 DEFINE_INODE_ERROR_EVENT(xfs_reflink_compare_extents_error);
 
 /* ioctl tracepoints */
@@ -3199,6 +3227,10 @@ TRACE_EVENT(xfs_ioctl_clone,
 DEFINE_SIMPLE_IO_EVENT(xfs_reflink_unshare);
 DEFINE_INODE_ERROR_EVENT(xfs_reflink_unshare_error);
 
+/* defrag tracepoints */
+DEFINE_SIMPLE_IO_EVENT(xfs_reflink_defrag_range);
+DEFINE_INODE_ERROR_EVENT(xfs_reflink_defrag_range_error);
+
 /* copy on write */
 DEFINE_INODE_IREC_EVENT(xfs_reflink_trim_around_shared);
 DEFINE_INODE_IREC_EVENT(xfs_reflink_cow_alloc);
@@ -3223,10 +3255,48 @@ DEFINE_INODE_ERROR_EVENT(xfs_reflink_end_cow_error);
 DEFINE_INODE_IREC_EVENT(xfs_reflink_cancel_cow);
 
 /* rmap swapext tracepoints */
-DEFINE_INODE_IREC_EVENT(xfs_swap_extent_rmap_remap);
 DEFINE_INODE_IREC_EVENT(xfs_swap_extent_rmap_remap_piece);
 DEFINE_INODE_ERROR_EVENT(xfs_swap_extent_rmap_error);
 
+DECLARE_EVENT_CLASS(xfs_swapext_class,
+	TP_PROTO(struct xfs_inode *ip1, struct xfs_inode *ip2,
+		 xfs_fileoff_t startoff1, xfs_fileoff_t startoff2,
+		 xfs_filblks_t blockcount),
+	TP_ARGS(ip1, ip2, startoff1, startoff2, blockcount),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(xfs_ino_t, ino1)
+		__field(xfs_ino_t, ino2)
+		__field(xfs_fileoff_t, startoff1)
+		__field(xfs_fileoff_t, startoff2)
+		__field(xfs_filblks_t, blockcount)
+	),
+	TP_fast_assign(
+		__entry->dev = VFS_I(ip1)->i_sb->s_dev;
+		__entry->ino1 = ip1->i_ino;
+		__entry->ino2 = ip2->i_ino;
+		__entry->startoff1 = startoff1;
+		__entry->startoff2 = startoff2;
+		__entry->blockcount = blockcount;
+	),
+	TP_printk("dev %d:%d ino1 0x%llx fileoff1 0x%llx ino2 0x%llx fileoff2 0x%llx len 0x%llx",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  __entry->ino1,
+		  __entry->startoff1,
+		  __entry->ino2,
+		  __entry->startoff2,
+		  __entry->blockcount)
+)
+#define DEFINE_SWAPEXT_EVENT(name) \
+DEFINE_EVENT(xfs_swapext_class, name, \
+	TP_PROTO(struct xfs_inode *ip1, struct xfs_inode *ip2, \
+		 xfs_fileoff_t startoff1, xfs_fileoff_t startoff2, \
+		 xfs_filblks_t blockcount), \
+	TP_ARGS(ip1, ip2, startoff1, startoff2, blockcount))
+DEFINE_SWAPEXT_EVENT(xfs_swapext_defer);
+DEFINE_SWAPEXT_EVENT(xfs_swapext_deferred);
+DEFINE_SWAPEXT_EVENT(xfs_swap_range);
+
 /* fsmap traces */
 DECLARE_EVENT_CLASS(xfs_fsmap_class,
 	TP_PROTO(struct xfs_mount *mp, u32 keydev, xfs_agnumber_t agno,
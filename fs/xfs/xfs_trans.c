@@ -34,6 +34,110 @@
 
 kmem_zone_t	*xfs_trans_zone;
 kmem_zone_t	*xfs_log_item_desc_zone;
+mempool_t	*xfs_log_item_desc_pool;
+
+/*
+ * Log reservations sized for the current btree depths.
+ *
+ * The precomputed reservations assume every per-AG btree is as deep as it
+ * could ever get, but the free space, rmap and refcount btrees of most
+ * filesystems are only a level or two deep, and the write and truncate
+ * reservations are dominated by worst case splits of those trees.  Once we
+ * have seen the AGF of every AG we know how deep the trees really are, so
+ * those transactions reserve for the deepest tree of each type plus
+ * XFS_DRESV_HEADROOM levels instead, and many more of them fit in the log.
+ *
+ * A tree only gains a level by splitting its root, and the new root starts out
+ * with just two records, so no transaction can grow a tree by more than one
+ * level.  Whenever a tree grows to within one level of the depth we are sized
+ * for, the reservations are resized, which leaves every transaction already in
+ * flight covered for one more root split.  Rolling transactions pick up the
+ * bigger reservation at their next roll, so long chains of deferred work never
+ * run on a stale size.  The AGFs of AGs that aren't in use yet are read
+ * lazily, so until they all have been we stick to the worst case.
+ */
+#define XFS_DRESV_HEADROOM	2
+
+/*
+ * Raise the depths the dynamic reservations are sized for to cover the btrees
+ * of @pag.  The depths never come back down.
+ */
+void
+xfs_trans_dresv_update(
+	struct xfs_mount	*mp,
+	struct xfs_perag	*pag)
+{
+	struct xfs_resv_levels	*cur = &mp->m_dresv_levels;
+	struct xfs_resv_levels	mlv;
+	struct xfs_resv_levels	lv;
+
+	xfs_trans_resv_max_levels(mp, &mlv);
+	lv.rl_ag = min(max(pag->pagf_levels[XFS_BTNUM_BNOi],
+			   pag->pagf_levels[XFS_BTNUM_CNTi]) +
+			XFS_DRESV_HEADROOM, mlv.rl_ag);
+	lv.rl_rmap = min(pag->pagf_levels[XFS_BTNUM_RMAPi] +
+			XFS_DRESV_HEADROOM, mlv.rl_rmap);
+	lv.rl_refc = min(pag->pagf_refcount_level + XFS_DRESV_HEADROOM,
+			mlv.rl_refc);
+
+	if (lv.rl_ag <= READ_ONCE(cur->rl_ag) &&
+	    lv.rl_rmap <= READ_ONCE(cur->rl_rmap) &&
+	    lv.rl_refc <= READ_ONCE(cur->rl_refc))
+		return;
+
+	write_seqlock(&mp->m_dresv_lock);
+	cur->rl_ag = max(cur->rl_ag, lv.rl_ag);
+	cur->rl_rmap = max(cur->rl_rmap, lv.rl_rmap);
+	cur->rl_refc = max(cur->rl_refc, lv.rl_refc);
+	if (!atomic_read(&mp->m_dresv_unseen))
+		xfs_trans_resv_calc_levels(mp, &mp->m_dresv, cur);
+	write_sequnlock(&mp->m_dresv_lock);
+}
+
+/*
+ * The AGF of @pag has been read for the first time.  Once we've seen all of
+ * them, switch over to the reservations for the current btree depths.  AGs
+ * added by growfs start out with single level trees and don't hold us up.
+ */
+void
+xfs_trans_dresv_agf_init(
+	struct xfs_mount	*mp,
+	struct xfs_perag	*pag)
+{
+	xfs_trans_dresv_update(mp, pag);
+	if (pag->pag_agno >= mp->m_dresv_agcount)
+		return;
+	if (!atomic_dec_and_test(&mp->m_dresv_unseen))
+		return;
+
+	write_seqlock(&mp->m_dresv_lock);
+	xfs_trans_resv_calc_levels(mp, &mp->m_dresv, &mp->m_dresv_levels);
+	write_sequnlock(&mp->m_dresv_lock);
+}
+
+/*
+ * Look up the current reservation for the M_RES() entry @resp.  Returns false
+ * if @resp is a reservation the caller made up itself.
+ */
+STATIC bool
+xfs_trans_dresv_get(
+	struct xfs_mount	*mp,
+	struct xfs_trans_res	*resp,
+	struct xfs_trans_res	*tres)
+{
+	struct xfs_trans_res	*base = (struct xfs_trans_res *)M_RES(mp);
+	struct xfs_trans_res	*end = (struct xfs_trans_res *)(M_RES(mp) + 1);
+	unsigned int		seq;
+
+	if (resp < base || resp >= end)
+		return false;
+
+	do {
+		seq = read_seqbegin(&mp->m_dresv_lock);
+		*tres = ((struct xfs_trans_res *)&mp->m_dresv)[resp - base];
+	} while (read_seqretry(&mp->m_dresv_lock, seq));
+	return true;
+}
 
 /*
  * Initialize the precomputed transaction reservation values
@@ -44,6 +148,14 @@ xfs_trans_init(
 	struct xfs_mount	*mp)
 {
 	xfs_trans_resv_calc(mp, M_RES(mp));
+
+	seqlock_init(&mp->m_dresv_lock);
+	mp->m_dresv = mp->m_resv;
+	mp->m_dresv_levels.rl_ag = 1;
+	mp->m_dresv_levels.rl_rmap = 1;
+	mp->m_dresv_levels.rl_refc = 1;
+	mp->m_dresv_agcount = mp->m_sb.sb_agcount;
+	atomic_set(&mp->m_dresv_unseen, mp->m_sb.sb_agcount);
 }
 
 /*
@@ -97,6 +209,7 @@ xfs_trans_dup(
 	/* We gave our writer reference to the new transaction */
 	tp->t_flags |= XFS_TRANS_NO_WRITECOUNT;
 	ntp->t_ticket = xfs_log_ticket_get(tp->t_ticket);
+	ntp->t_resv = tp->t_resv;
 	ntp->t_blk_res = tp->t_blk_res - tp->t_blk_res_used;
 	tp->t_blk_res = tp->t_blk_res_used;
 	ntp->t_rtx_res = tp->t_rtx_res - tp->t_rtx_res_used;
@@ -236,6 +349,7 @@ xfs_trans_alloc(
 	struct xfs_trans	**tpp)
 {
 	struct xfs_trans	*tp;
+	struct xfs_trans_res	tres;
 	int			error;
 
 	if (!(flags & XFS_TRANS_NO_WRITECOUNT))
@@ -252,6 +366,11 @@ xfs_trans_alloc(
 	INIT_LIST_HEAD(&tp->t_items);
 	INIT_LIST_HEAD(&tp->t_busy);
 
+	if (xfs_trans_dresv_get(mp, resp, &tres)) {
+		tp->t_resv = resp;
+		resp = &tres;
+	}
+
 	error = xfs_trans_reserve(tp, resp, blocks, rtextents);
 	if (error) {
 		xfs_trans_cancel(tp);
@@ -716,10 +835,22 @@ xfs_trans_add_item(
 	ASSERT(lip->li_mountp == tp->t_mountp);
 	ASSERT(lip->li_ailp == tp->t_mountp->m_ail);
 
-	lidp = kmem_zone_zalloc(xfs_log_item_desc_zone, KM_SLEEP | KM_NOFS);
+	/*
+	 * Hand out the descriptors embedded in the transaction first and only
+	 * fall back to the pool once they are used up.  Inline slots are not
+	 * recycled when an item is removed again, which is rare enough that
+	 * it is not worth tracking.
+	 */
+	if (tp->t_desc_nr < XFS_TRANS_INLINE_DESCS) {
+		lidp = &tp->t_desc[tp->t_desc_nr++];
+		lidp->lid_flags = XFS_LID_INLINE;
+	} else {
+		lidp = kmem_pool_zalloc(xfs_log_item_desc_pool,
+				sizeof(*lidp), KM_SLEEP | KM_NOFS);
+		lidp->lid_flags = 0;
+	}
 
 	lidp->lid_item = lip;
-	lidp->lid_flags = 0;
 	list_add_tail(&lidp->lid_trans, &tp->t_items);
 
 	lip->li_desc = lidp;
@@ -730,7 +861,8 @@ xfs_trans_free_item_desc(
 	struct xfs_log_item_desc *lidp)
 {
 	list_del_init(&lidp->lid_trans);
-	kmem_zone_free(xfs_log_item_desc_zone, lidp);
+	if (!(lidp->lid_flags & XFS_LID_INLINE))
+		kmem_pool_free(xfs_log_item_desc_pool, lidp);
 }
 
 /*
@@ -771,7 +903,12 @@ xfs_trans_free_items(
 	}
 }
 
-static inline void
+/*
+ * Insert a batch of items into the AIL and unpin them. The log tail is not
+ * moved here - we return whether the minimum item in the AIL changed so that
+ * the caller can update the tail once for all the batches it inserts.
+ */
+static inline bool
 xfs_log_item_batch_insert(
 	struct xfs_ail		*ailp,
 	struct xfs_ail_cursor	*cur,
@@ -779,17 +916,20 @@ xfs_log_item_batch_insert(
 	int			nr_items,
 	xfs_lsn_t		commit_lsn)
 {
+	bool	mlip_changed;
 	int	i;
 
 	spin_lock(&ailp->xa_lock);
-	/* xfs_trans_ail_update_bulk drops ailp->xa_lock */
-	xfs_trans_ail_update_bulk(ailp, cur, log_items, nr_items, commit_lsn);
+	mlip_changed = xfs_ail_insert_bulk(ailp, cur, log_items, nr_items,
+					   commit_lsn);
+	spin_unlock(&ailp->xa_lock);
 
 	for (i = 0; i < nr_items; i++) {
 		struct xfs_log_item *lip = log_items[i];
 
 		lip->li_ops->iop_unpin(lip, 0);
 	}
+	return mlip_changed;
 }
 
 /*
@@ -811,6 +951,11 @@ xfs_log_item_batch_insert(
  * call. This saves a lot of needless list walking and is a net win, even
  * though it slightly increases that amount of AIL lock traffic to set it up
  * and tear it down.
+ *
+ * Moving the log tail is deferred until all the batches have been inserted so
+ * that a large checkpoint only updates the tail and wakes log space waiters
+ * once. The tail can only move forward as a result of the insertions, so
+ * holding it back for the duration of the insert is safe.
  */
 void
 xfs_trans_committed_bulk(
@@ -823,6 +968,7 @@ xfs_trans_committed_bulk(
 	struct xfs_log_item	*log_items[LOG_ITEM_BATCH_SIZE];
 	struct xfs_log_vec	*lv;
 	struct xfs_ail_cursor	cur;
+	bool			mlip_changed = false;
 	int			i = 0;
 
 	spin_lock(&ailp->xa_lock);
@@ -873,19 +1019,21 @@ xfs_trans_committed_bulk(
 		/* Item is a candidate for bulk AIL insert.  */
 		log_items[i++] = lv->lv_item;
 		if (i >= LOG_ITEM_BATCH_SIZE) {
-			xfs_log_item_batch_insert(ailp, &cur, log_items,
-					LOG_ITEM_BATCH_SIZE, commit_lsn);
+			mlip_changed |= xfs_log_item_batch_insert(ailp, &cur,
+					log_items, LOG_ITEM_BATCH_SIZE,
+					commit_lsn);
 			i = 0;
 		}
 	}
 
 	/* make sure we insert the remainder! */
 	if (i)
-		xfs_log_item_batch_insert(ailp, &cur, log_items, i, commit_lsn);
+		mlip_changed |= xfs_log_item_batch_insert(ailp, &cur,
+					log_items, i, commit_lsn);
 
 	spin_lock(&ailp->xa_lock);
 	xfs_trans_ail_cursor_done(&cur);
-	spin_unlock(&ailp->xa_lock);
+	xfs_ail_update_finish(ailp, mlip_changed);
 }
 
 /*
@@ -1040,6 +1188,8 @@ xfs_trans_roll(
 {
 	struct xfs_trans	*trans;
 	struct xfs_trans_res	tres;
+	struct xfs_trans_res	cur;
+	bool			grow = false;
 	int			error;
 
 	/*
@@ -1054,6 +1204,12 @@ xfs_trans_roll(
 	 */
 	tres.tr_logres = trans->t_log_res;
 	tres.tr_logcount = trans->t_log_count;
+	if (trans->t_resv &&
+	    xfs_trans_dresv_get(trans->t_mountp, trans->t_resv, &cur) &&
+	    cur.tr_logres > tres.tr_logres) {
+		tres.tr_logres = cur.tr_logres;
+		grow = true;
+	}
 	*tpp = xfs_trans_dup(trans);
 
 	/*
@@ -1069,6 +1225,15 @@ xfs_trans_roll(
 
 	trans = *tpp;
 
+	/*
+	 * The btrees have grown since our ticket was sized, so give back what
+	 * is left of it and take out a new one for the bigger reservation.
+	 */
+	if (grow) {
+		xfs_log_done(trans->t_mountp, trans->t_ticket, NULL, false);
+		trans->t_ticket = NULL;
+	}
+
 	/*
 	 * Reserve space in the log for th next transaction.
 	 * This also pushes items in the "AIL", the list of logged items,
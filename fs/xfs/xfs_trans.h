@@ -27,8 +27,8 @@ struct xfs_efi_log_item;
 struct xfs_inode;
 struct xfs_item_ops;
 struct xfs_log_iovec;
-struct xfs_log_item_desc;
 struct xfs_mount;
+struct xfs_perag;
 struct xfs_trans;
 struct xfs_trans_res;
 struct xfs_dquot_acct;
@@ -40,6 +40,8 @@ struct xfs_cud_log_item;
 struct xfs_defer_ops;
 struct xfs_bui_log_item;
 struct xfs_bud_log_item;
+struct xfs_sxi_log_item;
+struct xfs_sxd_log_item;
 
 typedef struct xfs_log_item {
 	struct list_head		li_ail;		/* AIL pointers */
@@ -61,6 +63,7 @@ typedef struct xfs_log_item {
 	struct xfs_log_vec		*li_lv;		/* active log vector */
 	struct xfs_log_vec		*li_lv_shadow;	/* standby vector */
 	xfs_lsn_t			li_seq;		/* CIL commit seq */
+	int				li_order_id;	/* CIL commit order */
 } xfs_log_item_t;
 
 #define	XFS_LI_IN_AIL	0x1
@@ -79,6 +82,7 @@ struct xfs_item_ops {
 	void (*iop_unlock)(xfs_log_item_t *);
 	xfs_lsn_t (*iop_committed)(xfs_log_item_t *, xfs_lsn_t);
 	void (*iop_committing)(xfs_log_item_t *, xfs_lsn_t);
+	bool (*iop_written)(struct xfs_log_item *);
 };
 
 void	xfs_log_item_init(struct xfs_mount *mp, struct xfs_log_item *item,
@@ -93,6 +97,29 @@ void	xfs_log_item_init(struct xfs_mount *mp, struct xfs_log_item *item,
 #define XFS_ITEM_FLUSHING	3
 
 
+/*
+ * This structure is used to track log items associated with
+ * a transaction.  It points to the log item and keeps some
+ * flags to track the state of the log item.  It also tracks
+ * the amount of space needed to log the item it describes
+ * once we get to commit processing (see xfs_trans_commit()).
+ */
+struct xfs_log_item_desc {
+	struct xfs_log_item	*lid_item;
+	struct list_head	lid_trans;
+	unsigned char		lid_flags;
+};
+
+#define XFS_LID_DIRTY		0x1
+#define XFS_LID_INLINE		0x2	/* embedded in the transaction */
+
+/*
+ * Number of log item descriptors embedded in each transaction.  Most
+ * transactions join only a handful of items, so this lets the common case
+ * avoid a trip through the descriptor zone for every item it joins.
+ */
+#define XFS_TRANS_INLINE_DESCS	8
+
 /*
  * This is the structure maintained for every active transaction.
  */
@@ -100,6 +127,7 @@ typedef struct xfs_trans {
 	unsigned int		t_magic;	/* magic number */
 	unsigned int		t_log_res;	/* amt of log space resvd */
 	unsigned int		t_log_count;	/* count for perm log res */
+	struct xfs_trans_res	*t_resv;	/* M_RES entry, for regrants */
 	unsigned int		t_blk_res;	/* # of blocks resvd */
 	unsigned int		t_blk_res_used;	/* # of resvd blocks used */
 	unsigned int		t_rtx_res;	/* # of rt extents resvd */
@@ -130,6 +158,8 @@ typedef struct xfs_trans {
 	struct list_head	t_items;	/* log item descriptors */
 	struct list_head	t_busy;		/* list of busy extents */
 	unsigned long		t_pflags;	/* saved process flags state */
+	unsigned int		t_desc_nr;	/* inline descriptors used */
+	struct xfs_log_item_desc t_desc[XFS_TRANS_INLINE_DESCS];
 } xfs_trans_t;
 
 /*
@@ -156,6 +186,10 @@ int		xfs_trans_alloc(struct xfs_mount *mp, struct xfs_trans_res *resp,
 			struct xfs_trans **tpp);
 int		xfs_trans_alloc_empty(struct xfs_mount *mp,
 			struct xfs_trans **tpp);
+void		xfs_trans_dresv_update(struct xfs_mount *mp,
+			struct xfs_perag *pag);
+void		xfs_trans_dresv_agf_init(struct xfs_mount *mp,
+			struct xfs_perag *pag);
 void		xfs_trans_mod_sb(xfs_trans_t *, uint, int64_t);
 
 struct xfs_buf	*xfs_trans_get_buf_map(struct xfs_trans *tp,
@@ -236,6 +270,7 @@ void		xfs_trans_buf_copy_type(struct xfs_buf *dst_bp,
 
 extern kmem_zone_t	*xfs_trans_zone;
 extern kmem_zone_t	*xfs_log_item_desc_zone;
+extern mempool_t	*xfs_log_item_desc_pool;
 
 /* rmap updates */
 enum xfs_rmap_intent_type;
@@ -273,4 +308,14 @@ int xfs_trans_log_finish_bmap_update(struct xfs_trans *tp,
 		int whichfork, xfs_fileoff_t startoff, xfs_fsblock_t startblock,
 		xfs_filblks_t *blockcount, xfs_exntst_t state);
 
+/* extent swapping */
+struct xfs_swapext_intent;
+
+void xfs_swapext_init_defer_op(void);
+struct xfs_sxd_log_item *xfs_trans_get_sxd(struct xfs_trans *tp,
+		struct xfs_sxi_log_item *sxip);
+int xfs_trans_log_finish_swapext(struct xfs_trans *tp,
+		struct xfs_sxd_log_item *sxdp, struct xfs_defer_ops *dop,
+		struct xfs_swapext_intent *sxi);
+
 #endif	/* __XFS_TRANS_H__ */
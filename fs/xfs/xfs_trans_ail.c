@@ -338,6 +338,7 @@ xfsaild_push(
 	int			stuck = 0;
 	int			flushing = 0;
 	int			count = 0;
+	bool			urgent;
 
 	/*
 	 * If we encountered pinned items or did not finish writing out all
@@ -454,7 +455,12 @@ xfsaild_push(
 	xfs_trans_ail_cursor_done(&cur);
 	spin_unlock(&ailp->xa_lock);
 
-	if (xfs_buf_delwri_submit_nowait(&ailp->xa_buf_list))
+	/*
+	 * Writeback is urgent if transactions are stalled waiting for the log
+	 * tail to move, or somebody is waiting for the AIL to empty.
+	 */
+	urgent = xfs_log_space_waiters(mp) || waitqueue_active(&ailp->xa_empty);
+	if (xfs_buf_delwri_submit_nowait(&ailp->xa_buf_list, urgent))
 		ailp->xa_log_flush++;
 
 	if (!count || XFS_LSN_CMP(lsn, target) >= 0) {
@@ -495,6 +501,7 @@ xfsaild(
 {
 	struct xfs_ail	*ailp = data;
 	long		tout = 0;	/* milliseconds */
+	ktime_t		start;
 
 	current->flags |= PF_MEMALLOC;
 	set_freezable();
@@ -517,8 +524,9 @@ xfsaild(
 		 * The barrier matches the xa_target update in xfs_ail_push().
 		 */
 		smp_rmb();
-		if (!xfs_ail_min(ailp) &&
-		    ailp->xa_target == ailp->xa_target_prev) {
+		if (ailp->xa_paused ||
+		    (!xfs_ail_min(ailp) &&
+		     ailp->xa_target == ailp->xa_target_prev)) {
 			spin_unlock(&ailp->xa_lock);
 			freezable_schedule();
 			tout = 0;
@@ -533,7 +541,13 @@ xfsaild(
 
 		try_to_freeze();
 
-		tout = xfsaild_push(ailp);
+		mutex_lock(&ailp->xa_push_lock);
+		if (!ailp->xa_paused) {
+			start = ktime_get();
+			tout = xfsaild_push(ailp);
+			XFS_STATS_LAT(ailp->xa_mount, XFS_LAT_AIL_PUSH, start);
+		}
+		mutex_unlock(&ailp->xa_push_lock);
 	}
 
 	return 0;
@@ -614,17 +628,72 @@ xfs_ail_push_all_sync(
 }
 
 /*
- * xfs_trans_ail_update - bulk AIL insertion operation.
+ * Stop xfsaild from pushing items until xfs_ail_resume() is called.  A push
+ * that is already running is allowed to finish issuing its I/O first, but
+ * the caller has to wait for that I/O to complete itself.  Nothing may wait
+ * for the AIL to make progress while it is paused.
+ */
+void
+xfs_ail_pause(
+	struct xfs_ail		*ailp)
+{
+	mutex_lock(&ailp->xa_push_lock);
+	ailp->xa_paused = true;
+	mutex_unlock(&ailp->xa_push_lock);
+}
+
+void
+xfs_ail_resume(
+	struct xfs_ail		*ailp)
+{
+	mutex_lock(&ailp->xa_push_lock);
+	ailp->xa_paused = false;
+	mutex_unlock(&ailp->xa_push_lock);
+	wake_up_process(ailp->xa_task);
+}
+
+/*
+ * Finish an AIL modification that may have changed the minimum item in the
+ * AIL. If it did, the log tail needs to be moved to match the new minimum LSN,
+ * anyone waiting for the AIL to empty needs to be told about it and anyone
+ * waiting for log space needs to be woken as the tail moving forward may have
+ * given them the space they need.
+ *
+ * Batching AIL modifications and only calling this once per batch amortises
+ * the tail update over all the items in the batch.
+ *
+ * This function must be called with the AIL lock held.  The lock is dropped
+ * before returning.
+ */
+void
+xfs_ail_update_finish(
+	struct xfs_ail		*ailp,
+	bool			mlip_changed) __releases(ailp->xa_lock)
+{
+	struct xfs_mount	*mp = ailp->xa_mount;
+
+	if (!mlip_changed) {
+		spin_unlock(&ailp->xa_lock);
+		return;
+	}
+
+	if (!XFS_FORCED_SHUTDOWN(mp))
+		xlog_assign_tail_lsn_locked(mp);
+	if (list_empty(&ailp->xa_ail))
+		wake_up_all(&ailp->xa_empty);
+	spin_unlock(&ailp->xa_lock);
+	xfs_log_space_wake(mp);
+}
+
+/*
+ * xfs_ail_insert_bulk - bulk AIL insertion operation.
  *
- * @xfs_trans_ail_update takes an array of log items that all need to be
+ * @xfs_ail_insert_bulk takes an array of log items that all need to be
  * positioned at the same LSN in the AIL. If an item is not in the AIL, it will
  * be added.  Otherwise, it will be repositioned  by removing it and re-adding
- * it to the AIL. If we move the first item in the AIL, update the log tail to
- * match the new minimum LSN in the AIL.
+ * it to the AIL.
  *
- * This function takes the AIL lock once to execute the update operations on
- * all the items in the array, and as such should not be called with the AIL
- * lock held. As a result, once we have the AIL lock, we need to check each log
+ * The caller holds the AIL lock, so once we have it we need to check each log
  * item LSN to confirm it needs to be moved forward in the AIL.
  *
  * To optimise the insert operation, we delete all the items from the AIL in
@@ -632,19 +701,21 @@ xfs_ail_push_all_sync(
  * list into the correct position in the AIL. This avoids needing to do an
  * insert operation on every item.
  *
- * This function must be called with the AIL lock held.  The lock is dropped
- * before returning.
+ * Returns true if the first item in the AIL was moved. The log tail is not
+ * updated here; the caller must pass the result to xfs_ail_update_finish()
+ * once it has finished modifying the AIL, which allows callers inserting many
+ * batches of items to move the tail only once.
  */
-void
-xfs_trans_ail_update_bulk(
+bool
+xfs_ail_insert_bulk(
 	struct xfs_ail		*ailp,
 	struct xfs_ail_cursor	*cur,
 	struct xfs_log_item	**log_items,
 	int			nr_items,
-	xfs_lsn_t		lsn) __releases(ailp->xa_lock)
+	xfs_lsn_t		lsn)
 {
 	xfs_log_item_t		*mlip;
-	int			mlip_changed = 0;
+	bool			mlip_changed = false;
 	int			i;
 	LIST_HEAD(tmp);
 
@@ -661,7 +732,7 @@ xfs_trans_ail_update_bulk(
 			trace_xfs_ail_move(lip, lip->li_lsn, lsn);
 			xfs_ail_delete(ailp, lip);
 			if (mlip == lip)
-				mlip_changed = 1;
+				mlip_changed = true;
 		} else {
 			lip->li_flags |= XFS_LI_IN_AIL;
 			trace_xfs_ail_insert(lip, 0, lsn);
@@ -673,15 +744,31 @@ xfs_trans_ail_update_bulk(
 	if (!list_empty(&tmp))
 		xfs_ail_splice(ailp, cur, &tmp, lsn);
 
-	if (mlip_changed) {
-		if (!XFS_FORCED_SHUTDOWN(ailp->xa_mount))
-			xlog_assign_tail_lsn_locked(ailp->xa_mount);
-		spin_unlock(&ailp->xa_lock);
+	return mlip_changed;
+}
 
-		xfs_log_space_wake(ailp->xa_mount);
-	} else {
-		spin_unlock(&ailp->xa_lock);
-	}
+/*
+ * xfs_trans_ail_update_bulk - bulk AIL insertion operation.
+ *
+ * Insert or move the items in the array to @lsn in the AIL as per
+ * xfs_ail_insert_bulk(). If we move the first item in the AIL, update the log
+ * tail to match the new minimum LSN in the AIL.
+ *
+ * This function must be called with the AIL lock held.  The lock is dropped
+ * before returning.
+ */
+void
+xfs_trans_ail_update_bulk(
+	struct xfs_ail		*ailp,
+	struct xfs_ail_cursor	*cur,
+	struct xfs_log_item	**log_items,
+	int			nr_items,
+	xfs_lsn_t		lsn) __releases(ailp->xa_lock)
+{
+	bool			mlip_changed;
+
+	mlip_changed = xfs_ail_insert_bulk(ailp, cur, log_items, nr_items, lsn);
+	xfs_ail_update_finish(ailp, mlip_changed);
 }
 
 bool
@@ -741,16 +828,7 @@ xfs_trans_ail_delete(
 	}
 
 	mlip_changed = xfs_ail_delete_one(ailp, lip);
-	if (mlip_changed) {
-		if (!XFS_FORCED_SHUTDOWN(mp))
-			xlog_assign_tail_lsn_locked(mp);
-		if (list_empty(&ailp->xa_ail))
-			wake_up_all(&ailp->xa_empty);
-	}
-
-	spin_unlock(&ailp->xa_lock);
-	if (mlip_changed)
-		xfs_log_space_wake(ailp->xa_mount);
+	xfs_ail_update_finish(ailp, mlip_changed);
 }
 
 int
@@ -769,6 +847,7 @@ xfs_trans_ail_init(
 	spin_lock_init(&ailp->xa_lock);
 	INIT_LIST_HEAD(&ailp->xa_buf_list);
 	init_waitqueue_head(&ailp->xa_empty);
+	mutex_init(&ailp->xa_push_lock);
 
 	ailp->xa_task = kthread_run(xfsaild, ailp, "xfsaild/%s",
 			ailp->xa_mount->m_fsname);
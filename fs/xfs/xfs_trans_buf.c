@@ -253,6 +253,7 @@ xfs_trans_read_buf_map(
 	int			error;
 
 	*bpp = NULL;
+
 	/*
 	 * If we find the buffer in the cache with this transaction
 	 * pointer in its b_fsprivate2 field, then we know we already
@@ -601,19 +601,47 @@ xfs_trans_dqresv(
 	long		ninos,
 	uint		flags)
 {
-	xfs_qcnt_t	hardlimit;
-	xfs_qcnt_t	softlimit;
-	time_t		timer;
-	xfs_qwarncnt_t	warns;
-	xfs_qwarncnt_t	warnlimit;
+	xfs_qcnt_t	hardlimit = 0;
+	xfs_qcnt_t	softlimit = 0;
+	time_t		timer = 0;
+	xfs_qwarncnt_t	warns = 0;
+	xfs_qwarncnt_t	warnlimit = 0;
 	xfs_qcnt_t	total_count;
+	xfs_qcnt_t	slack_limit = 0;
 	xfs_qcnt_t	*resbcountp;
 	xfs_quotainfo_t	*q = mp->m_quotainfo;
 	struct xfs_def_quota	*defq;
+	bool		enforce;
 
+	/*
+	 * Regular block reservations and releases can usually be satisfied
+	 * from this CPU's slack without touching the dquot at all.
+	 */
+	if ((flags & XFS_TRANS_DQ_RES_BLKS) && ninos == 0 && nblks != 0) {
+		if (nblks > 0 ? xfs_dqslack_get(dqp, nblks) :
+				xfs_dqslack_put(dqp, -nblks))
+			goto out_trans;
+	}
 
 	xfs_dqlock(dqp);
 
+	enforce = (flags & XFS_QMOPT_FORCE_RES) == 0 &&
+	    dqp->q_core.d_id &&
+	    ((XFS_IS_UQUOTA_ENFORCED(dqp->q_mount) && XFS_QM_ISUDQ(dqp)) ||
+	     (XFS_IS_GQUOTA_ENFORCED(dqp->q_mount) && XFS_QM_ISGDQ(dqp)) ||
+	     (XFS_IS_PQUOTA_ENFORCED(dqp->q_mount) && XFS_QM_ISPDQ(dqp)));
+
+	/*
+	 * Accounting only: there is nothing to check, just move the
+	 * reservation.  Without a limit the slack refill below also hands
+	 * out much bigger batches, so we rarely get here at all.
+	 */
+	if (!enforce) {
+		resbcountp = (flags & XFS_TRANS_DQ_RES_BLKS) ?
+				&dqp->q_res_bcount : &dqp->q_res_rtbcount;
+		goto out_resv;
+	}
+
 	defq = xfs_get_defquota(dqp, q);
 
 	if (flags & XFS_TRANS_DQ_RES_BLKS) {
@@ -640,62 +668,66 @@ xfs_trans_dqresv(
 		warnlimit = dqp->q_mount->m_quotainfo->qi_rtbwarnlimit;
 		resbcountp = &dqp->q_res_rtbcount;
 	}
+	slack_limit = softlimit ? softlimit : hardlimit;
 
-	if ((flags & XFS_QMOPT_FORCE_RES) == 0 &&
-	    dqp->q_core.d_id &&
-	    ((XFS_IS_UQUOTA_ENFORCED(dqp->q_mount) && XFS_QM_ISUDQ(dqp)) ||
-	     (XFS_IS_GQUOTA_ENFORCED(dqp->q_mount) && XFS_QM_ISGDQ(dqp)) ||
-	     (XFS_IS_PQUOTA_ENFORCED(dqp->q_mount) && XFS_QM_ISPDQ(dqp)))) {
-		if (nblks > 0) {
-			/*
-			 * dquot is locked already. See if we'd go over the
-			 * hardlimit or exceed the timelimit if we allocate
-			 * nblks.
-			 */
+	if (nblks > 0) {
+		/*
+		 * dquot is locked already. See if we'd go over the
+		 * hardlimit or exceed the timelimit if we allocate
+		 * nblks.  The per-cpu slack is counted in the
+		 * reservation, so pull it back in before deciding
+		 * that we really are over a limit.
+		 */
+		total_count = *resbcountp + nblks;
+		if ((flags & XFS_TRANS_DQ_RES_BLKS) &&
+		    ((hardlimit && total_count > hardlimit) ||
+		     (softlimit && total_count > softlimit))) {
+			xfs_dqslack_drain(dqp);
 			total_count = *resbcountp + nblks;
-			if (hardlimit && total_count > hardlimit) {
-				xfs_quota_warn(mp, dqp, QUOTA_NL_BHARDWARN);
+		}
+		if (hardlimit && total_count > hardlimit) {
+			xfs_quota_warn(mp, dqp, QUOTA_NL_BHARDWARN);
+			goto error_return;
+		}
+		if (softlimit && total_count > softlimit) {
+			if ((timer != 0 && get_seconds() > timer) ||
+			    (warns != 0 && warns >= warnlimit)) {
+				xfs_quota_warn(mp, dqp,
+					       QUOTA_NL_BSOFTLONGWARN);
 				goto error_return;
 			}
-			if (softlimit && total_count > softlimit) {
-				if ((timer != 0 && get_seconds() > timer) ||
-				    (warns != 0 && warns >= warnlimit)) {
-					xfs_quota_warn(mp, dqp,
-						       QUOTA_NL_BSOFTLONGWARN);
-					goto error_return;
-				}
 
-				xfs_quota_warn(mp, dqp, QUOTA_NL_BSOFTWARN);
-			}
+			xfs_quota_warn(mp, dqp, QUOTA_NL_BSOFTWARN);
 		}
-		if (ninos > 0) {
-			total_count = be64_to_cpu(dqp->q_core.d_icount) + ninos;
-			timer = be32_to_cpu(dqp->q_core.d_itimer);
-			warns = be16_to_cpu(dqp->q_core.d_iwarns);
-			warnlimit = dqp->q_mount->m_quotainfo->qi_iwarnlimit;
-			hardlimit = be64_to_cpu(dqp->q_core.d_ino_hardlimit);
-			if (!hardlimit)
-				hardlimit = defq->ihardlimit;
-			softlimit = be64_to_cpu(dqp->q_core.d_ino_softlimit);
-			if (!softlimit)
-				softlimit = defq->isoftlimit;
-
-			if (hardlimit && total_count > hardlimit) {
-				xfs_quota_warn(mp, dqp, QUOTA_NL_IHARDWARN);
+	}
+	if (ninos > 0) {
+		total_count = be64_to_cpu(dqp->q_core.d_icount) + ninos;
+		timer = be32_to_cpu(dqp->q_core.d_itimer);
+		warns = be16_to_cpu(dqp->q_core.d_iwarns);
+		warnlimit = dqp->q_mount->m_quotainfo->qi_iwarnlimit;
+		hardlimit = be64_to_cpu(dqp->q_core.d_ino_hardlimit);
+		if (!hardlimit)
+			hardlimit = defq->ihardlimit;
+		softlimit = be64_to_cpu(dqp->q_core.d_ino_softlimit);
+		if (!softlimit)
+			softlimit = defq->isoftlimit;
+
+		if (hardlimit && total_count > hardlimit) {
+			xfs_quota_warn(mp, dqp, QUOTA_NL_IHARDWARN);
+			goto error_return;
+		}
+		if (softlimit && total_count > softlimit) {
+			if  ((timer != 0 && get_seconds() > timer) ||
+			     (warns != 0 && warns >= warnlimit)) {
+				xfs_quota_warn(mp, dqp,
+					       QUOTA_NL_ISOFTLONGWARN);
 				goto error_return;
 			}
-			if (softlimit && total_count > softlimit) {
-				if  ((timer != 0 && get_seconds() > timer) ||
-				     (warns != 0 && warns >= warnlimit)) {
-					xfs_quota_warn(mp, dqp,
-						       QUOTA_NL_ISOFTLONGWARN);
-					goto error_return;
-				}
-				xfs_quota_warn(mp, dqp, QUOTA_NL_ISOFTWARN);
-			}
+			xfs_quota_warn(mp, dqp, QUOTA_NL_ISOFTWARN);
 		}
 	}
 
+out_resv:
 	/*
 	 * Change the reservation, but not the actual usage.
 	 * Note that q_res_bcount = q_core.d_bcount + resv
@@ -704,6 +736,20 @@ xfs_trans_dqresv(
 	if (ninos != 0)
 		dqp->q_res_icount += (xfs_qcnt_t)ninos;
 
+	/*
+	 * Grab some slack for the next reservations on this CPU, as long as
+	 * that doesn't take us past a limit we have to check exactly.
+	 */
+	if ((flags & XFS_TRANS_DQ_RES_BLKS) && nblks > 0)
+		xfs_dqslack_refill(dqp, slack_limit);
+
+	ASSERT(dqp->q_res_bcount >= be64_to_cpu(dqp->q_core.d_bcount));
+	ASSERT(dqp->q_res_rtbcount >= be64_to_cpu(dqp->q_core.d_rtbcount));
+	ASSERT(dqp->q_res_icount >= be64_to_cpu(dqp->q_core.d_icount));
+
+	xfs_dqunlock(dqp);
+
+out_trans:
 	/*
 	 * note the reservation amt in the trans struct too,
 	 * so that the transaction knows how much was reserved by
@@ -723,11 +769,6 @@ xfs_trans_dqresv(
 					    XFS_TRANS_DQ_RES_INOS,
 					    ninos);
 	}
-	ASSERT(dqp->q_res_bcount >= be64_to_cpu(dqp->q_core.d_bcount));
-	ASSERT(dqp->q_res_rtbcount >= be64_to_cpu(dqp->q_core.d_rtbcount));
-	ASSERT(dqp->q_res_icount >= be64_to_cpu(dqp->q_core.d_icount));
-
-	xfs_dqunlock(dqp);
 	return 0;
 
 error_return:
@@ -102,7 +102,7 @@ xfs_trans_free_extent(
 	return error;
 }
 
-/* Sort bmap items by AG. */
+/* Sort extent free items by AG and then by block. */
 static int
 xfs_extent_free_diff_items(
 	void				*priv,
@@ -115,8 +115,18 @@ xfs_extent_free_diff_items(
 
 	ra = container_of(a, struct xfs_extent_free_item, xefi_list);
 	rb = container_of(b, struct xfs_extent_free_item, xefi_list);
-	return  XFS_FSB_TO_AGNO(mp, ra->xefi_startblock) -
-		XFS_FSB_TO_AGNO(mp, rb->xefi_startblock);
+	if (XFS_FSB_TO_AGNO(mp, ra->xefi_startblock) !=
+	    XFS_FSB_TO_AGNO(mp, rb->xefi_startblock))
+		return  XFS_FSB_TO_AGNO(mp, ra->xefi_startblock) -
+			XFS_FSB_TO_AGNO(mp, rb->xefi_startblock);
+
+	/*
+	 * Frees of disjoint extents can be done in any order, so walk each AG
+	 * in block order to keep the free space btree updates local.
+	 */
+	if (ra->xefi_startblock < rb->xefi_startblock)
+		return -1;
+	return ra->xefi_startblock > rb->xefi_startblock;
 }
 
 /* Get an EFI. */
@@ -200,6 +210,29 @@ xfs_extent_free_finish_item(
 	return error;
 }
 
+/* Record an extent in an EFD that cancels its EFI without freeing it. */
+STATIC void
+xfs_extent_free_log_done(
+	struct xfs_trans		*tp,
+	void				*done_item,
+	struct list_head		*item)
+{
+	struct xfs_efd_log_item		*efdp = done_item;
+	struct xfs_extent_free_item	*free;
+	struct xfs_extent		*extp;
+
+	free = container_of(item, struct xfs_extent_free_item, xefi_list);
+
+	tp->t_flags |= XFS_TRANS_DIRTY;
+	efdp->efd_item.li_desc->lid_flags |= XFS_LID_DIRTY;
+
+	ASSERT(efdp->efd_next_extent < efdp->efd_format.efd_nextents);
+	extp = &efdp->efd_format.efd_extents[efdp->efd_next_extent];
+	extp->ext_start = free->xefi_startblock;
+	extp->ext_len = free->xefi_blockcount;
+	efdp->efd_next_extent++;
+}
+
 /* Abort all pending EFIs. */
 STATIC void
 xfs_extent_free_abort_intent(
@@ -227,6 +260,7 @@ static const struct xfs_defer_op_type xfs_extent_free_defer_type = {
 	.abort_intent	= xfs_extent_free_abort_intent,
 	.log_item	= xfs_extent_free_log_item,
 	.create_done	= xfs_extent_free_create_done,
+	.log_done	= xfs_extent_free_log_done,
 	.finish_item	= xfs_extent_free_finish_item,
 	.cancel_item	= xfs_extent_free_cancel_item,
 };
@@ -108,17 +108,33 @@ xfs_trans_log_inode(
 	 */
 	ip->i_itemp->ili_fsync_fields |= flags;
 
+	/*
+	 * Any lazily updated timestamps are logged along with the core now,
+	 * so the VFS doesn't need to ask for them again.  Racing with the
+	 * flag being set without i_lock just costs an extra transaction
+	 * later on.
+	 */
+	if (VFS_I(ip)->i_state & I_DIRTY_TIME) {
+		spin_lock(&VFS_I(ip)->i_lock);
+		VFS_I(ip)->i_state &= ~I_DIRTY_TIME;
+		spin_unlock(&VFS_I(ip)->i_lock);
+	}
+
 	/*
 	 * First time we log the inode in a transaction, bump the inode change
 	 * counter if it is configured for this to occur. We don't use
 	 * inode_inc_version() because there is no need for extra locking around
 	 * i_version as we already hold the inode locked exclusively for
-	 * metadata modification.
+	 * metadata modification.  The change counter is part of the compact
+	 * core too, so don't force a full core for timestamp and size updates.
 	 */
 	if (!(ip->i_itemp->ili_item.li_desc->lid_flags & XFS_LID_DIRTY) &&
 	    IS_I_VERSION(VFS_I(ip))) {
 		VFS_I(ip)->i_version++;
-		flags |= XFS_ILOG_CORE;
+		if (flags & ~(XFS_ILOG_TIMESTAMP | XFS_ILOG_ISIZE))
+			flags |= XFS_ILOG_CORE;
+		else
+			flags |= XFS_ILOG_TIMESTAMP;
 	}
 
 	tp->t_flags |= XFS_TRANS_DIRTY;
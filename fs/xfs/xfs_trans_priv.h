@@ -76,11 +76,18 @@ struct xfs_ail {
 	int			xa_log_flush;
 	struct list_head	xa_buf_list;
 	wait_queue_head_t	xa_empty;
+	struct mutex		xa_push_lock;	/* held across a push */
+	bool			xa_paused;	/* pushing stopped by freeze */
 };
 
 /*
  * From xfs_trans_ail.c
  */
+bool	xfs_ail_insert_bulk(struct xfs_ail *ailp, struct xfs_ail_cursor *cur,
+				struct xfs_log_item **log_items, int nr_items,
+				xfs_lsn_t lsn);
+void	xfs_ail_update_finish(struct xfs_ail *ailp, bool mlip_changed)
+				__releases(ailp->xa_lock);
 void	xfs_trans_ail_update_bulk(struct xfs_ail *ailp,
 				struct xfs_ail_cursor *cur,
 				struct xfs_log_item **log_items, int nr_items,
@@ -128,6 +135,8 @@ xfs_trans_ail_remove(
 void			xfs_ail_push(struct xfs_ail *, xfs_lsn_t);
 void			xfs_ail_push_all(struct xfs_ail *);
 void			xfs_ail_push_all_sync(struct xfs_ail *);
+void			xfs_ail_pause(struct xfs_ail *);
+void			xfs_ail_resume(struct xfs_ail *);
 struct xfs_log_item	*xfs_ail_min(struct xfs_ail  *ailp);
 xfs_lsn_t		xfs_ail_min_lsn(struct xfs_ail *ailp);
 
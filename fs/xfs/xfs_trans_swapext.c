@@ -0,0 +1,209 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_shared.h"
+#include "xfs_format.h"
+#include "xfs_log_format.h"
+#include "xfs_trans_resv.h"
+#include "xfs_mount.h"
+#include "xfs_defer.h"
+#include "xfs_trans.h"
+#include "xfs_trans_priv.h"
+#include "xfs_swapext_item.h"
+#include "xfs_swapext.h"
+#include "xfs_inode.h"
+
+/*
+ * This routine is called to allocate an "extent swap done"
+ * log item.
+ */
+struct xfs_sxd_log_item *
+xfs_trans_get_sxd(
+	struct xfs_trans		*tp,
+	struct xfs_sxi_log_item		*sxip)
+{
+	struct xfs_sxd_log_item		*sxdp;
+
+	sxdp = xfs_sxd_init(tp->t_mountp, sxip);
+	xfs_trans_add_item(tp, &sxdp->sxd_item);
+	return sxdp;
+}
+
+/*
+ * Exchange the next mapping pair and log it to the SXD. Note that the
+ * transaction is marked dirty regardless of whether the exchange
+ * succeeds or fails to support the SXI/SXD lifecycle rules.
+ */
+int
+xfs_trans_log_finish_swapext(
+	struct xfs_trans		*tp,
+	struct xfs_sxd_log_item		*sxdp,
+	struct xfs_defer_ops		*dop,
+	struct xfs_swapext_intent	*sxi)
+{
+	int				error;
+
+	error = xfs_swapext_finish_one(tp, dop, sxi);
+
+	/*
+	 * Mark the transaction dirty, even on error. This ensures the
+	 * transaction is aborted, which:
+	 *
+	 * 1.) releases the SXI and frees the SXD
+	 * 2.) shuts down the filesystem
+	 */
+	tp->t_flags |= XFS_TRANS_DIRTY;
+	sxdp->sxd_item.li_desc->lid_flags |= XFS_LID_DIRTY;
+
+	return error;
+}
+
+/* There's only ever one swap per intent, so there's nothing to sort. */
+static int
+xfs_swapext_diff_items(
+	void				*priv,
+	struct list_head		*a,
+	struct list_head		*b)
+{
+	return 0;
+}
+
+/* Get an SXI. */
+STATIC void *
+xfs_swapext_create_intent(
+	struct xfs_trans		*tp,
+	unsigned int			count)
+{
+	struct xfs_sxi_log_item		*sxip;
+
+	ASSERT(count == 1);
+	ASSERT(tp != NULL);
+
+	sxip = xfs_sxi_init(tp->t_mountp);
+	ASSERT(sxip != NULL);
+
+	/*
+	 * Get a log_item_desc to point at the new item.
+	 */
+	xfs_trans_add_item(tp, &sxip->sxi_item);
+	return sxip;
+}
+
+/* Log the range to be exchanged in the intent item. */
+STATIC void
+xfs_swapext_log_item(
+	struct xfs_trans		*tp,
+	void				*intent,
+	struct list_head		*item)
+{
+	struct xfs_sxi_log_item		*sxip = intent;
+	struct xfs_swapext_intent	*sxi;
+	struct xfs_swap_extent		*sx;
+
+	sxi = container_of(item, struct xfs_swapext_intent, sxi_list);
+
+	tp->t_flags |= XFS_TRANS_DIRTY;
+	sxip->sxi_item.li_desc->lid_flags |= XFS_LID_DIRTY;
+
+	sx = &sxip->sxi_format.sxi_extent;
+	sx->se_inode1 = sxi->sxi_ip1->i_ino;
+	sx->se_inode2 = sxi->sxi_ip2->i_ino;
+	sx->se_startoff1 = sxi->sxi_startoff1;
+	sx->se_startoff2 = sxi->sxi_startoff2;
+	sx->se_blockcount = sxi->sxi_blockcount;
+	sx->se_flags = sxi->sxi_flags;
+}
+
+/* Get an SXD so we can process the extent swap. */
+STATIC void *
+xfs_swapext_create_done(
+	struct xfs_trans		*tp,
+	void				*intent,
+	unsigned int			count)
+{
+	return xfs_trans_get_sxd(tp, intent);
+}
+
+/*
+ * Exchange the next mapping pair and put the intent back on the intake list
+ * instead of asking for a fresh transaction with -EAGAIN, so that the new
+ * intent is logged behind the bmap updates we just queued and they're
+ * finished before we go on.  The intent is requeued even when the range is
+ * used up, so that the bmap updates for the last pair are never in the log
+ * without an intent saying a swap was in progress; finishing the empty
+ * intent afterwards does nothing.
+ */
+STATIC int
+xfs_swapext_finish_item(
+	struct xfs_trans		*tp,
+	struct xfs_defer_ops		*dop,
+	struct list_head		*item,
+	void				*done_item,
+	void				**state)
+{
+	struct xfs_swapext_intent	*sxi;
+	bool				empty;
+	int				error;
+
+	sxi = container_of(item, struct xfs_swapext_intent, sxi_list);
+	empty = sxi->sxi_blockcount == 0;
+	error = xfs_trans_log_finish_swapext(tp, done_item, dop, sxi);
+	if (!error && !empty) {
+		xfs_defer_add(dop, XFS_DEFER_OPS_TYPE_SWAPEXT, &sxi->sxi_list);
+		return 0;
+	}
+	kmem_free(sxi);
+	return error;
+}
+
+/* Abort all pending SXIs. */
+STATIC void
+xfs_swapext_abort_intent(
+	void				*intent)
+{
+	xfs_sxi_release(intent);
+}
+
+/* Cancel a deferred extent swap. */
+STATIC void
+xfs_swapext_cancel_item(
+	struct list_head		*item)
+{
+	struct xfs_swapext_intent	*sxi;
+
+	sxi = container_of(item, struct xfs_swapext_intent, sxi_list);
+	kmem_free(sxi);
+}
+
+static const struct xfs_defer_op_type xfs_swapext_defer_type = {
+	.type		= XFS_DEFER_OPS_TYPE_SWAPEXT,
+	.max_items	= 1,
+	.diff_items	= xfs_swapext_diff_items,
+	.create_intent	= xfs_swapext_create_intent,
+	.abort_intent	= xfs_swapext_abort_intent,
+	.log_item	= xfs_swapext_log_item,
+	.create_done	= xfs_swapext_create_done,
+	.finish_item	= xfs_swapext_finish_item,
+	.cancel_item	= xfs_swapext_cancel_item,
+};
+
+/* Register the deferred op type. */
+void
+xfs_swapext_init_defer_op(void)
+{
+	xfs_defer_init_op_type(&xfs_swapext_defer_type);
+}
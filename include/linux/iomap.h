@@ -22,6 +22,7 @@ struct vm_fault;
  * Flags for all iomap mappings:
  */
 #define IOMAP_F_NEW	0x01	/* blocks have been newly allocated */
+#define IOMAP_F_DIRTY	0x02	/* uncommitted metadata needed for fdatasync */
 
 /*
  * Flags that only need to be reported for IOMAP_REPORT requests:
@@ -0,0 +1,905 @@
+/*
+ * xfs_mdbench: metadata heavy workload benchmarks for XFS
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2.
+ *
+ * Runs a fixed set of metadata workloads against a directory on a mounted
+ * XFS filesystem and reports the results one "key=value" record per line so
+ * they can be compared across kernels and mkfs geometries. The XFS stats of
+ * the filesystem are sampled around each benchmark and the deltas reported
+ * alongside the results.
+ *
+ * Compile with:
+ *
+ * gcc -O2 -o xfs_mdbench xfs_mdbench.c -lpthread
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/utsname.h>
+#include <linux/fs.h>
+#include <linux/fsmap.h>
+
+/*
+ * Bulkstat ABI, copied from fs/xfs/libxfs/xfs_fs.h so that we don't need
+ * the xfsprogs development headers to build.
+ */
+struct xfs_bstime {
+	time_t		tv_sec;		/* seconds		*/
+	__s32		tv_nsec;	/* and nanoseconds	*/
+};
+
+struct xfs_bstat {
+	__u64		bs_ino;		/* inode number			*/
+	__u16		bs_mode;	/* type and mode		*/
+	__u16		bs_nlink;	/* number of links		*/
+	__u32		bs_uid;		/* user id			*/
+	__u32		bs_gid;		/* group id			*/
+	__u32		bs_rdev;	/* device value			*/
+	__s32		bs_blksize;	/* block size			*/
+	__s64		bs_size;	/* file size			*/
+	struct xfs_bstime bs_atime;	/* access time			*/
+	struct xfs_bstime bs_mtime;	/* modify time			*/
+	struct xfs_bstime bs_ctime;	/* inode change time		*/
+	int64_t		bs_blocks;	/* number of blocks		*/
+	__u32		bs_xflags;	/* extended flags		*/
+	__s32		bs_extsize;	/* extent size			*/
+	__s32		bs_extents;	/* number of extents		*/
+	__u32		bs_gen;		/* generation count		*/
+	__u16		bs_projid_lo;	/* lower part of project id	*/
+	__u16		bs_forkoff;	/* inode fork offset in bytes	*/
+	__u16		bs_projid_hi;	/* higher part of project id	*/
+	unsigned char	bs_pad[6];	/* pad space, unused		*/
+	__u32		bs_cowextsize;	/* cow extent size		*/
+	__u32		bs_dmevmask;	/* DMIG event mask		*/
+	__u16		bs_dmstate;	/* DMIG state info		*/
+	__u16		bs_aextents;	/* attribute number of extents	*/
+};
+
+struct xfs_fsop_bulkreq {
+	__u64		*lastip;	/* last inode # pointer		*/
+	__s32		icount;		/* count of entries in buffer	*/
+	void		*ubuffer;	/* user buffer for inode desc.	*/
+	__s32		*ocount;	/* output count pointer		*/
+};
+
+#define XFS_IOC_FSBULKSTAT	_IOWR('X', 101, struct xfs_fsop_bulkreq)
+
+#define MAX_STAT_LINES	64
+#define MAX_STAT_VALS	64
+#define IO_SIZE		4096
+#define SRC_SIZE	(16 * 1024 * 1024)
+#define BULKSTAT_NR	1024
+#define FSMAP_NR	1024
+
+static int nthreads = 4;
+static int nfiles = 10000;
+static int nclones = 100;
+static int nfsyncs = 1000;
+static int nwrites = 4096;
+static int nlarge = 100000;
+static char *basedir;
+static char stats_path[PATH_MAX];
+static FILE *out;
+
+struct stats_sample {
+	int		nr;
+	char		name[MAX_STAT_LINES][32];
+	int		nvals[MAX_STAT_LINES];
+	uint64_t	vals[MAX_STAT_LINES][MAX_STAT_VALS];
+};
+
+struct thread_arg {
+	pthread_t	thread;
+	int		id;
+	uint64_t	ops;
+	int		error;
+	unsigned int	seed;
+	double		start;
+	double		end;
+};
+
+struct bench {
+	const char	*name;
+	int		(*setup)(void);
+	int		(*work)(struct thread_arg *arg);
+	void		(*teardown)(void);
+};
+
+static pthread_barrier_t start_barrier;
+static struct bench *cur_bench;
+
+static void fatal(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void path(char *buf, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void path(char *buf, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	len = snprintf(buf, PATH_MAX, "%s/", basedir);
+	va_start(ap, fmt);
+	vsnprintf(buf + len, PATH_MAX - len, fmt, ap);
+	va_end(ap);
+}
+
+/*
+ * Stats sampling
+ */
+
+/* find the per-filesystem stats file, falling back to the global one */
+static void find_stats_path(void)
+{
+	char link[PATH_MAX];
+	char real[PATH_MAX];
+	struct stat st;
+
+	if (stats_path[0])
+		return;
+	if (stat(basedir, &st) < 0)
+		fatal(basedir);
+
+	snprintf(link, sizeof(link), "/sys/dev/block/%u:%u",
+		 major(st.st_dev), minor(st.st_dev));
+	if (realpath(link, real)) {
+		snprintf(stats_path, sizeof(stats_path),
+			 "/sys/fs/xfs/%s/stats/stats", basename(real));
+		if (access(stats_path, R_OK) == 0)
+			return;
+	}
+	snprintf(stats_path, sizeof(stats_path), "/sys/fs/xfs/stats/stats");
+}
+
+static void read_stats(struct stats_sample *s)
+{
+	char line[4096];
+	FILE *f;
+
+	s->nr = 0;
+	f = fopen(stats_path, "r");
+	if (!f)
+		return;
+
+	while (s->nr < MAX_STAT_LINES && fgets(line, sizeof(line), f)) {
+		char *tok, *save;
+		int n = 0;
+
+		tok = strtok_r(line, " \n", &save);
+		if (!tok || !strcmp(tok, "debug"))
+			continue;
+		snprintf(s->name[s->nr], sizeof(s->name[0]), "%s", tok);
+		while (n < MAX_STAT_VALS &&
+		       (tok = strtok_r(NULL, " \n", &save)))
+			s->vals[s->nr][n++] = strtoull(tok, NULL, 10);
+		s->nvals[s->nr++] = n;
+	}
+	fclose(f);
+}
+
+static void report_stats(const char *bench, struct stats_sample *before,
+			 struct stats_sample *after)
+{
+	int i, j;
+
+	for (i = 0; i < after->nr && i < before->nr; i++) {
+		int changed = 0;
+
+		if (strcmp(before->name[i], after->name[i]))
+			continue;
+		for (j = 0; j < after->nvals[i]; j++)
+			changed |= after->vals[i][j] != before->vals[i][j];
+		if (!changed)
+			continue;
+
+		fprintf(out, "stats bench=%s group=%s deltas=", bench,
+			after->name[i]);
+		for (j = 0; j < after->nvals[i]; j++)
+			fprintf(out, "%s%lld", j ? "," : "",
+				(long long)(after->vals[i][j] -
+					    before->vals[i][j]));
+		fprintf(out, "\n");
+	}
+}
+
+/*
+ * Helpers shared by the benchmarks
+ */
+
+static int create_file(const char *name)
+{
+	int fd;
+
+	fd = open(name, O_CREAT | O_EXCL | O_WRONLY, 0644);
+	if (fd < 0)
+		return -errno;
+	close(fd);
+	return 0;
+}
+
+static int create_files(const char *dirfmt, int nr)
+{
+	char name[PATH_MAX];
+	int t, i, error;
+
+	for (t = 0; t < nthreads; t++) {
+		for (i = 0; i < nr; i++) {
+			path(name, dirfmt, t);
+			snprintf(name + strlen(name), PATH_MAX - strlen(name),
+				 "/t%d.f%d", t, i);
+			error = create_file(name);
+			if (error)
+				return error;
+		}
+	}
+	return 0;
+}
+
+static void unlink_files(const char *dirfmt, int nr)
+{
+	char name[PATH_MAX];
+	int t, i;
+
+	for (t = 0; t < nthreads; t++) {
+		for (i = 0; i < nr; i++) {
+			path(name, dirfmt, t);
+			snprintf(name + strlen(name), PATH_MAX - strlen(name),
+				 "/t%d.f%d", t, i);
+			unlink(name);
+		}
+	}
+}
+
+static int make_dirs(const char *dirfmt)
+{
+	char name[PATH_MAX];
+	int t;
+
+	for (t = 0; t < nthreads; t++) {
+		path(name, dirfmt, t);
+		if (mkdir(name, 0755) < 0 && errno != EEXIST)
+			return -errno;
+	}
+	return 0;
+}
+
+static void remove_dirs(const char *dirfmt)
+{
+	char name[PATH_MAX];
+	int t;
+
+	for (t = 0; t < nthreads; t++) {
+		path(name, dirfmt, t);
+		rmdir(name);
+	}
+}
+
+static int write_file(const char *name, off_t size)
+{
+	char buf[IO_SIZE];
+	off_t off;
+	int fd;
+
+	fd = open(name, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd < 0)
+		return -errno;
+	memset(buf, 0x5a, sizeof(buf));
+	for (off = 0; off < size; off += sizeof(buf)) {
+		if (pwrite(fd, buf, sizeof(buf), off) != sizeof(buf)) {
+			close(fd);
+			return -EIO;
+		}
+	}
+	fsync(fd);
+	close(fd);
+	return 0;
+}
+
+static int clone_file(const char *src, const char *dst)
+{
+	int sfd, dfd, error = 0;
+
+	sfd = open(src, O_RDONLY);
+	if (sfd < 0)
+		return -errno;
+	dfd = open(dst, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (dfd < 0) {
+		error = -errno;
+		goto out;
+	}
+	if (ioctl(dfd, FICLONE, sfd) < 0)
+		error = -errno;
+	close(dfd);
+out:
+	close(sfd);
+	return error;
+}
+
+/*
+ * Create and unlink storms, in one shared directory and in one directory per
+ * thread.
+ */
+
+#define SHARED_DIR	"shared"
+#define PRIVATE_DIR	"private%d"
+
+static int work_create(struct thread_arg *arg, const char *dirfmt)
+{
+	char name[PATH_MAX];
+	int i, error;
+
+	for (i = 0; i < nfiles; i++) {
+		path(name, dirfmt, arg->id);
+		snprintf(name + strlen(name), PATH_MAX - strlen(name),
+			 "/t%d.f%d", arg->id, i);
+		error = create_file(name);
+		if (error)
+			return error;
+		arg->ops++;
+	}
+	return 0;
+}
+
+static int work_unlink(struct thread_arg *arg, const char *dirfmt)
+{
+	char name[PATH_MAX];
+	int i;
+
+	for (i = 0; i < nfiles; i++) {
+		path(name, dirfmt, arg->id);
+		snprintf(name + strlen(name), PATH_MAX - strlen(name),
+			 "/t%d.f%d", arg->id, i);
+		if (unlink(name) < 0)
+			return -errno;
+		arg->ops++;
+	}
+	return 0;
+}
+
+static int setup_create_shared(void)
+{
+	return make_dirs(SHARED_DIR);
+}
+
+static int work_create_shared(struct thread_arg *arg)
+{
+	return work_create(arg, SHARED_DIR);
+}
+
+static void teardown_shared(void)
+{
+	unlink_files(SHARED_DIR, nfiles);
+	remove_dirs(SHARED_DIR);
+}
+
+static int setup_unlink_shared(void)
+{
+	int error;
+
+	error = make_dirs(SHARED_DIR);
+	if (error)
+		return error;
+	return create_files(SHARED_DIR, nfiles);
+}
+
+static int work_unlink_shared(struct thread_arg *arg)
+{
+	return work_unlink(arg, SHARED_DIR);
+}
+
+static int setup_create_private(void)
+{
+	return make_dirs(PRIVATE_DIR);
+}
+
+static int work_create_private(struct thread_arg *arg)
+{
+	return work_create(arg, PRIVATE_DIR);
+}
+
+static void teardown_private(void)
+{
+	unlink_files(PRIVATE_DIR, nfiles);
+	remove_dirs(PRIVATE_DIR);
+}
+
+static int setup_unlink_private(void)
+{
+	int error;
+
+	error = make_dirs(PRIVATE_DIR);
+	if (error)
+		return error;
+	return create_files(PRIVATE_DIR, nfiles);
+}
+
+static int work_unlink_private(struct thread_arg *arg)
+{
+	return work_unlink(arg, PRIVATE_DIR);
+}
+
+/*
+ * Small overwrites followed by fsync from every thread, which is dominated by
+ * log forces and how well they are batched into group commits.
+ */
+
+static int work_fsync(struct thread_arg *arg)
+{
+	char name[PATH_MAX];
+	char buf[IO_SIZE];
+	int i, fd, error = 0;
+
+	path(name, "fsync.%d", arg->id);
+	fd = open(name, O_CREAT | O_TRUNC | O_RDWR, 0644);
+	if (fd < 0)
+		return -errno;
+	memset(buf, arg->id, sizeof(buf));
+
+	for (i = 0; i < nfsyncs; i++) {
+		if (pwrite(fd, buf, sizeof(buf), (off_t)(i % 256) * IO_SIZE) !=
+		    sizeof(buf) || fsync(fd) < 0) {
+			error = -EIO;
+			break;
+		}
+		arg->ops++;
+	}
+	close(fd);
+	return error;
+}
+
+static void teardown_fsync(void)
+{
+	char name[PATH_MAX];
+	int t;
+
+	for (t = 0; t < nthreads; t++) {
+		path(name, "fsync.%d", t);
+		unlink(name);
+	}
+}
+
+/*
+ * Reflink clones of a shared source file, and copy on write overwrites of
+ * random blocks in a private clone per thread.
+ */
+
+static int setup_reflink(void)
+{
+	char name[PATH_MAX];
+
+	path(name, "reflink.src");
+	return write_file(name, SRC_SIZE);
+}
+
+static int work_reflink_clone(struct thread_arg *arg)
+{
+	char src[PATH_MAX];
+	char dst[PATH_MAX];
+	int i, error;
+
+	path(src, "reflink.src");
+	for (i = 0; i < nclones; i++) {
+		path(dst, "reflink.t%d.c%d", arg->id, i);
+		error = clone_file(src, dst);
+		if (error)
+			return error;
+		arg->ops++;
+	}
+	return 0;
+}
+
+static void teardown_reflink_clone(void)
+{
+	char name[PATH_MAX];
+	int t, i;
+
+	for (t = 0; t < nthreads; t++) {
+		for (i = 0; i < nclones; i++) {
+			path(name, "reflink.t%d.c%d", t, i);
+			unlink(name);
+		}
+	}
+	path(name, "reflink.src");
+	unlink(name);
+}
+
+static int setup_cow_overwrite(void)
+{
+	char src[PATH_MAX];
+	char dst[PATH_MAX];
+	int t, error;
+
+	error = setup_reflink();
+	if (error)
+		return error;
+	path(src, "reflink.src");
+	for (t = 0; t < nthreads; t++) {
+		path(dst, "cow.%d", t);
+		error = clone_file(src, dst);
+		if (error)
+			return error;
+	}
+	return 0;
+}
+
+static int work_cow_overwrite(struct thread_arg *arg)
+{
+	char name[PATH_MAX];
+	char buf[IO_SIZE];
+	int i, fd, error = 0;
+	off_t off;
+
+	path(name, "cow.%d", arg->id);
+	fd = open(name, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	memset(buf, arg->id, sizeof(buf));
+
+	for (i = 0; i < nwrites; i++) {
+		off = (off_t)(rand_r(&arg->seed) % (SRC_SIZE / IO_SIZE)) *
+			IO_SIZE;
+		if (pwrite(fd, buf, sizeof(buf), off) != sizeof(buf)) {
+			error = -EIO;
+			break;
+		}
+		arg->ops++;
+	}
+	if (!error && fsync(fd) < 0)
+		error = -errno;
+	close(fd);
+	return error;
+}
+
+static void teardown_cow_overwrite(void)
+{
+	char name[PATH_MAX];
+	int t;
+
+	for (t = 0; t < nthreads; t++) {
+		path(name, "cow.%d", t);
+		unlink(name);
+	}
+	path(name, "reflink.src");
+	unlink(name);
+}
+
+/*
+ * Whole filesystem bulkstat and getfsmap scans, one full scan per thread.
+ * The shared directory is populated first so there is something to find.
+ */
+
+static int work_bulkstat(struct thread_arg *arg)
+{
+	struct xfs_fsop_bulkreq req;
+	struct xfs_bstat *buf;
+	__u64 last = 0;
+	__s32 count = 0;
+	int fd, error = 0;
+
+	buf = calloc(BULKSTAT_NR, sizeof(*buf));
+	if (!buf)
+		return -ENOMEM;
+	fd = open(basedir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		error = -errno;
+		goto out;
+	}
+
+	req.lastip = &last;
+	req.icount = BULKSTAT_NR;
+	req.ubuffer = buf;
+	req.ocount = &count;
+	do {
+		if (ioctl(fd, XFS_IOC_FSBULKSTAT, &req) < 0) {
+			error = -errno;
+			break;
+		}
+		arg->ops += count;
+	} while (count > 0);
+	close(fd);
+out:
+	free(buf);
+	return error;
+}
+
+static int work_getfsmap(struct thread_arg *arg)
+{
+	struct fsmap_head *head;
+	struct fsmap *last;
+	int fd, error = 0;
+
+	head = calloc(1, fsmap_sizeof(FSMAP_NR));
+	if (!head)
+		return -ENOMEM;
+	fd = open(basedir, O_RDONLY | O_DIRECTORY);
+	if (fd < 0) {
+		error = -errno;
+		goto out;
+	}
+
+	head->fmh_count = FSMAP_NR;
+	head->fmh_keys[1].fmr_device = UINT_MAX;
+	head->fmh_keys[1].fmr_physical = ULLONG_MAX;
+	head->fmh_keys[1].fmr_owner = ULLONG_MAX;
+	head->fmh_keys[1].fmr_offset = ULLONG_MAX;
+	head->fmh_keys[1].fmr_flags = UINT_MAX;
+	for (;;) {
+		if (ioctl(fd, FS_IOC_GETFSMAP, head) < 0) {
+			error = -errno;
+			break;
+		}
+		if (head->fmh_entries == 0)
+			break;
+		arg->ops += head->fmh_entries;
+		last = &head->fmh_recs[head->fmh_entries - 1];
+		if (last->fmr_flags & FMR_OF_LAST)
+			break;
+		fsmap_advance(head);
+	}
+	close(fd);
+out:
+	free(head);
+	return error;
+}
+
+/*
+ * Random lookups in one large directory.
+ */
+
+static int setup_lookup_large(void)
+{
+	char name[PATH_MAX];
+	int i, error;
+
+	path(name, "large");
+	if (mkdir(name, 0755) < 0 && errno != EEXIST)
+		return -errno;
+	for (i = 0; i < nlarge; i++) {
+		path(name, "large/entry.%d", i);
+		error = create_file(name);
+		if (error && error != -EEXIST)
+			return error;
+	}
+	return 0;
+}
+
+static int work_lookup_large(struct thread_arg *arg)
+{
+	char name[PATH_MAX];
+	struct stat st;
+	int i;
+
+	for (i = 0; i < nfiles; i++) {
+		path(name, "large/entry.%d", rand_r(&arg->seed) % nlarge);
+		if (stat(name, &st) < 0)
+			return -errno;
+		arg->ops++;
+	}
+	return 0;
+}
+
+static void teardown_lookup_large(void)
+{
+	char name[PATH_MAX];
+	int i;
+
+	for (i = 0; i < nlarge; i++) {
+		path(name, "large/entry.%d", i);
+		unlink(name);
+	}
+	path(name, "large");
+	rmdir(name);
+}
+
+static struct bench benches[] = {
+	{ "create_shared", setup_create_shared, work_create_shared,
+	  teardown_shared },
+	{ "unlink_shared", setup_unlink_shared, work_unlink_shared,
+	  teardown_shared },
+	{ "create_private", setup_create_private, work_create_private,
+	  teardown_private },
+	{ "unlink_private", setup_unlink_private, work_unlink_private,
+	  teardown_private },
+	{ "fsync", NULL, work_fsync, teardown_fsync },
+	{ "reflink_clone", setup_reflink, work_reflink_clone,
+	  teardown_reflink_clone },
+	{ "cow_overwrite", setup_cow_overwrite, work_cow_overwrite,
+	  teardown_cow_overwrite },
+	{ "bulkstat", setup_unlink_shared, work_bulkstat, teardown_shared },
+	{ "getfsmap", setup_unlink_shared, work_getfsmap, teardown_shared },
+	{ "lookup_large", setup_lookup_large, work_lookup_large,
+	  teardown_lookup_large },
+};
+
+static void *worker(void *p)
+{
+	struct thread_arg *arg = p;
+
+	pthread_barrier_wait(&start_barrier);
+	arg->start = now();
+	arg->error = cur_bench->work(arg);
+	arg->end = now();
+	return NULL;
+}
+
+static int run_bench(struct bench *b)
+{
+	struct stats_sample *before, *after;
+	struct thread_arg *args;
+	uint64_t ops = 0;
+	double start = 0, end = 0, elapsed;
+	int t, error = 0;
+
+	before = calloc(1, sizeof(*before));
+	after = calloc(1, sizeof(*after));
+	args = calloc(nthreads, sizeof(*args));
+	if (!before || !after || !args)
+		fatal("calloc");
+
+	if (b->setup) {
+		error = b->setup();
+		if (error)
+			goto out_teardown;
+	}
+	sync();
+
+	cur_bench = b;
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	for (t = 0; t < nthreads; t++) {
+		args[t].id = t;
+		args[t].seed = t + 1;
+		if (pthread_create(&args[t].thread, NULL, worker, &args[t]))
+			fatal("pthread_create");
+	}
+
+	read_stats(before);
+	pthread_barrier_wait(&start_barrier);
+	for (t = 0; t < nthreads; t++) {
+		pthread_join(args[t].thread, NULL);
+		ops += args[t].ops;
+		if (args[t].error && !error)
+			error = args[t].error;
+		if (!t || args[t].start < start)
+			start = args[t].start;
+		if (!t || args[t].end > end)
+			end = args[t].end;
+	}
+	elapsed = end - start;
+	read_stats(after);
+	pthread_barrier_destroy(&start_barrier);
+
+	fprintf(out, "result bench=%s threads=%d ops=%llu seconds=%.6f "
+		"ops_per_sec=%.1f error=%d\n", b->name, nthreads,
+		(unsigned long long)ops, elapsed,
+		elapsed > 0 ? ops / elapsed : 0.0, error);
+	report_stats(b->name, before, after);
+	fflush(out);
+
+out_teardown:
+	if (error)
+		fprintf(stderr, "%s: %s\n", b->name, strerror(-error));
+	if (b->teardown)
+		b->teardown();
+	free(args);
+	free(after);
+	free(before);
+	return error;
+}
+
+static void usage(const char *prog)
+{
+	size_t i;
+
+	fprintf(stderr,
+"Usage: %s [options] <dir> [bench...]\n"
+"  -t threads    worker threads (default %d)\n"
+"  -n files      files created, unlinked or looked up per thread (default %d)\n"
+"  -c clones     reflink clones per thread (default %d)\n"
+"  -f fsyncs     fsyncs per thread (default %d)\n"
+"  -w writes     CoW overwrites per thread (default %d)\n"
+"  -l entries    entries in the large directory (default %d)\n"
+"  -o file       write results to file instead of stdout\n"
+"  -S file       XFS stats file to sample (default: per-filesystem)\n"
+"Benchmarks:", prog, nthreads, nfiles, nclones, nfsyncs, nwrites, nlarge);
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		fprintf(stderr, " %s", benches[i].name);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct utsname uts;
+	size_t i;
+	int c, j, failed = 0;
+
+	out = stdout;
+	while ((c = getopt(argc, argv, "t:n:c:f:w:l:o:S:")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'n':
+			nfiles = atoi(optarg);
+			break;
+		case 'c':
+			nclones = atoi(optarg);
+			break;
+		case 'f':
+			nfsyncs = atoi(optarg);
+			break;
+		case 'w':
+			nwrites = atoi(optarg);
+			break;
+		case 'l':
+			nlarge = atoi(optarg);
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (!out)
+				fatal(optarg);
+			break;
+		case 'S':
+			snprintf(stats_path, sizeof(stats_path), "%s", optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc || nthreads < 1 || nfiles < 1 || nclones < 1 ||
+	    nfsyncs < 1 || nwrites < 1 || nlarge < 1)
+		usage(argv[0]);
+	basedir = argv[optind++];
+	find_stats_path();
+
+	uname(&uts);
+	fprintf(out, "config kernel=%s dir=%s stats=%s threads=%d files=%d "
+		"clones=%d fsyncs=%d writes=%d large=%d\n", uts.release,
+		basedir, stats_path, nthreads, nfiles, nclones, nfsyncs,
+		nwrites, nlarge);
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (optind < argc) {
+			for (j = optind; j < argc; j++)
+				if (!strcmp(argv[j], benches[i].name))
+					break;
+			if (j == argc)
+				continue;
+		}
+		if (run_bench(&benches[i]))
+			failed++;
+	}
+
+	if (out != stdout)
+		fclose(out);
+	return failed ? 1 : 0;
+}